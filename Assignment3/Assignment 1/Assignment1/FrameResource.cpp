@@ -1,15 +1,103 @@
 #include "FrameResource.h"
 
-FrameResource::FrameResource(ID3D12Device* device, UINT passCount, UINT objectCount, UINT materialCount)
+FrameResource::FrameResource(ID3D12Device* device, UINT objectCount, UINT instanceCount, UINT batchCount, UINT meshletDrawCount, UINT meshletInstanceCount, UINT materialCount, UINT workerCmdListCount, UINT clusterListLength, UINT treeCount, UINT viewCount)
 {
     ThrowIfFailed(device->CreateCommandAllocator(
         D3D12_COMMAND_LIST_TYPE_DIRECT,
 		IID_PPV_ARGS(CmdListAlloc.GetAddressOf())));
 
+    ThrowIfFailed(device->CreateCommandAllocator(
+        D3D12_COMMAND_LIST_TYPE_COMPUTE,
+        IID_PPV_ARGS(ComputeCmdListAlloc.GetAddressOf())));
+
+    WorkerCmdListAllocs.resize(workerCmdListCount);
+    WorkerCmdLists.resize(workerCmdListCount);
+    for (UINT i = 0; i < workerCmdListCount; ++i)
+    {
+        ThrowIfFailed(device->CreateCommandAllocator(
+            D3D12_COMMAND_LIST_TYPE_DIRECT,
+            IID_PPV_ARGS(WorkerCmdListAllocs[i].GetAddressOf())));
+
+        ThrowIfFailed(device->CreateCommandList(
+            0,
+            D3D12_COMMAND_LIST_TYPE_DIRECT,
+            WorkerCmdListAllocs[i].Get(),
+            nullptr,
+            IID_PPV_ARGS(WorkerCmdLists[i].GetAddressOf())));
+
+        // Start off closed so the first frame can Reset them like every other frame.
+        WorkerCmdLists[i]->Close();
+    }
+
+    WorkerBundles.resize(workerCmdListCount);
+    for (LayerBundle& bundle : WorkerBundles)
+    {
+        ThrowIfFailed(device->CreateCommandAllocator(
+            D3D12_COMMAND_LIST_TYPE_BUNDLE,
+            IID_PPV_ARGS(bundle.Alloc.GetAddressOf())));
+
+        ThrowIfFailed(device->CreateCommandList(
+            0,
+            D3D12_COMMAND_LIST_TYPE_BUNDLE,
+            bundle.Alloc.Get(),
+            nullptr,
+            IID_PPV_ARGS(bundle.List.GetAddressOf())));
+
+        // Generation 0 is never current, so the first use records it.
+        bundle.List->Close();
+    }
+
   //  FrameCB = std::make_unique<UploadBuffer<FrameConstants>>(device, 1, true);
-    PassCB = std::make_unique<UploadBuffer<PassConstants>>(device, passCount, true);
-    MaterialCB = std::make_unique<UploadBuffer<MaterialConstants>>(device, materialCount, true);
-    ObjectCB = std::make_unique<UploadBuffer<ObjectConstants>>(device, objectCount, true);
+    ObjectBuffer = std::make_unique<UploadBuffer<ObjectConstants>>(device, objectCount, false);
+    MaterialBuffer = std::make_unique<UploadBuffer<MaterialData>>(device, materialCount, false);
+    InstanceBuffer = std::make_unique<UploadBuffer<InstanceData>>(device, instanceCount, false);
+    InstanceCullBuffer = std::make_unique<UploadBuffer<InstanceCullData>>(device, instanceCount, false);
+
+    Views.resize(viewCount);
+    for (ViewBuffers& view : Views)
+    {
+        // Written by the culling and clustering compute shaders, so these live in the default heap.
+        ThrowIfFailed(device->CreateCommittedResource(
+            &CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+            D3D12_HEAP_FLAG_NONE,
+            &CD3DX12_RESOURCE_DESC::Buffer((instanceCount + meshletInstanceCount) * sizeof(UINT), D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS),
+            D3D12_RESOURCE_STATE_COMMON,
+            nullptr,
+            IID_PPV_ARGS(view.VisibleInstances.GetAddressOf())));
+
+        ThrowIfFailed(device->CreateCommittedResource(
+            &CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+            D3D12_HEAP_FLAG_NONE,
+            &CD3DX12_RESOURCE_DESC::Buffer(batchCount * sizeof(D3D12_DRAW_INDEXED_ARGUMENTS) + meshletDrawCount * sizeof(MeshletDrawArguments), D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS),
+            D3D12_RESOURCE_STATE_COMMON,
+            nullptr,
+            IID_PPV_ARGS(view.DrawArgs.GetAddressOf())));
+
+        ThrowIfFailed(device->CreateCommittedResource(
+            &CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+            D3D12_HEAP_FLAG_NONE,
+            &CD3DX12_RESOURCE_DESC::Buffer(clusterListLength * sizeof(UINT), D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS),
+            D3D12_RESOURCE_STATE_COMMON,
+            nullptr,
+            IID_PPV_ARGS(view.ClusterLights.GetAddressOf())));
+
+        // Kept non-empty so the root SRV always has a buffer behind it.
+        ThrowIfFailed(device->CreateCommittedResource(
+            &CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+            D3D12_HEAP_FLAG_NONE,
+            &CD3DX12_RESOURCE_DESC::Buffer(MathHelper::Max(treeCount, 1u) * sizeof(TreeInstance), D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS),
+            D3D12_RESOURCE_STATE_COMMON,
+            nullptr,
+            IID_PPV_ARGS(view.VisibleTrees.GetAddressOf())));
+
+        ThrowIfFailed(device->CreateCommittedResource(
+            &CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+            D3D12_HEAP_FLAG_NONE,
+            &CD3DX12_RESOURCE_DESC::Buffer(sizeof(D3D12_DRAW_ARGUMENTS), D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS),
+            D3D12_RESOURCE_STATE_COMMON,
+            nullptr,
+            IID_PPV_ARGS(view.TreeDrawArgs.GetAddressOf())));
+    }
 }
 
 FrameResource::~FrameResource()
@@ -3,6 +3,7 @@
 #include "../../Common/d3dUtil.h"
 #include "../../Common/MathHelper.h"
 #include "../../Common/UploadBuffer.h"
+#include "../../Common/FrameArena.h"
 
 struct ObjectConstants
 {
@@ -10,6 +11,168 @@ struct ObjectConstants
     DirectX::XMFLOAT4X4 TexTransform = MathHelper::Identity4x4();
 };
 
+// Per-instance data for instanced draws.  Stored in a structured buffer and
+// indexed by SV_InstanceID in the vertex shader.  A lightmapped instance's lightmap
+// UVs go into its rectangle of slice LightmapSlice by the scale in xy and the
+// offset in zw; the others have a LightmapSlice of ~0u.
+struct InstanceData
+{
+    DirectX::XMFLOAT4X4 World = MathHelper::Identity4x4();
+    DirectX::XMFLOAT4X4 TexTransform = MathHelper::Identity4x4();
+    DirectX::XMFLOAT4 LightmapScaleOffset = { 0.0f, 0.0f, 0.0f, 0.0f };
+    UINT LightmapSlice = ~0u;
+    UINT Pad[3] = {};
+};
+
+// Bits of MaterialData::Flags; must match Default.hlsl.  Waves displaces the
+// vertices by the GpuWaves heights.
+const UINT MaterialFlagWaves = 0x1;
+
+// Per-material data in a structured buffer indexed by the material root constant.
+// DiffuseMapIndex is the texture's descriptor in the shader-visible heap.
+struct MaterialData
+{
+    DirectX::XMFLOAT4 DiffuseAlbedo = { 1.0f, 1.0f, 1.0f, 1.0f };
+    DirectX::XMFLOAT3 FresnelR0 = { 0.01f, 0.01f, 0.01f };
+    float Roughness = 0.25f;
+    DirectX::XMFLOAT4X4 MatTransform = MathHelper::Identity4x4();
+    UINT DiffuseMapIndex = 0;
+    UINT Flags = 0;
+    UINT Pad[2] = {};
+};
+
+// World-space bounds of a batched instance, read by the culling compute shader.
+// Batch is the instance's slot in the indirect draw arguments and BatchStart the
+// first element of its batch's range in the visible instance list.  An instance of
+// a batch drawn by meshlet has the MeshletCount meshlets from FirstMeshlet, and
+// MeshletDraw is the slot of its batch's first meshlet draw; MeshletCount is 0 for
+// the batches drawn whole.  The material and the submesh's indices the instance is
+// drawn with are read by the visibility buffer's resolve.
+struct InstanceCullData
+{
+    DirectX::XMFLOAT3 Center = { 0.0f, 0.0f, 0.0f };
+    UINT Batch = 0;
+    DirectX::XMFLOAT3 Extents = { 0.0f, 0.0f, 0.0f };
+    UINT BatchStart = 0;
+    UINT FirstMeshlet = 0;
+    UINT MeshletCount = 0;
+    UINT MeshletDraw = 0;
+    UINT MaterialIndex = 0;
+    UINT StartIndexLocation = 0;
+    INT BaseVertexLocation = 0;
+    UINT Pad[2] = {};
+};
+
+// One meshlet of a batch, drawn with a command signature that sets the first draw
+// constant before the draw.  VisibleOffset is where the meshlet's visible list
+// starts, from the start of the meshlet lists; the culling shader counts the
+// instances up like the batches'.
+struct MeshletDrawArguments
+{
+    UINT VisibleOffset = 0;
+    D3D12_DRAW_INDEXED_ARGUMENTS Draw = {};
+};
+
+// What a culling dispatch tests; must match Cull.hlsl.  Prepass keeps the instances
+// the last Occlusion pass found visible, Occlusion tests against the Hi-Z pyramid.
+enum class CullPhase : UINT
+{
+    Frustum = 0,
+    Prepass,
+    Occlusion
+};
+
+// Constants of the culling compute shader.  ViewProj is transposed like the pass
+// constants; the depth size and mip count describe the Hi-Z pyramid.
+struct CullConstants
+{
+    DirectX::XMFLOAT4 FrustumPlanes[6];
+    DirectX::XMFLOAT4X4 ViewProj = MathHelper::Identity4x4();
+    UINT DepthWidth = 0;
+    UINT DepthHeight = 0;
+    UINT InstanceCount = 0;
+    CullPhase Phase = CullPhase::Frustum;
+    UINT HiZMipCount = 0;
+    UINT ReverseZ = 0;
+
+    // Byte offset of the meshlet draws in the draw arguments and the element the
+    // meshlet lists start at in the visible instance list.
+    UINT MeshletDrawStart = 0;
+    UINT MeshletVisibleStart = 0;
+
+    // For the meshlets' normal cones.
+    DirectX::XMFLOAT3 EyePosW = { 0.0f, 0.0f, 0.0f };
+
+    // The layer's range of the instances this dispatch culls.
+    UINT FirstInstance = 0;
+};
+
+// A tree billboard that survived culling, written by TreeCull.hlsl and expanded to a
+// quad by TreeSprite.hlsl.  Variant picks the slice of the tree texture array.
+struct TreeInstance
+{
+    DirectX::XMFLOAT3 CenterW = { 0.0f, 0.0f, 0.0f };
+    UINT Variant = 0;
+    DirectX::XMFLOAT2 Size = { 0.0f, 0.0f };
+    UINT Pad[2] = {};
+};
+
+// Root constants of the tree culling compute shader.  Trees farther from the eye
+// than MaxDistance are dropped too.
+struct TreeCullConstants
+{
+    DirectX::XMFLOAT4 FrustumPlanes[6];
+    DirectX::XMFLOAT3 EyePosW = { 0.0f, 0.0f, 0.0f };
+    float MaxDistance = 0.0f;
+    UINT SpriteCount = 0;
+    UINT TileCount = 0;
+};
+
+// Root constants of the FXAA compute shader.  Width and Height are the rendered
+// corner of the scene target; UvMax is its last texel centre.
+struct FxaaConstants
+{
+    DirectX::XMFLOAT2 RcpFrame = { 0.0f, 0.0f };
+    UINT Width = 0;
+    UINT Height = 0;
+    DirectX::XMFLOAT2 UvMax = { 1.0f, 1.0f };
+};
+
+// Root constants of the upscaling pass; matches cbUpscale in Upscale.hlsl.
+struct UpscaleConstants
+{
+    DirectX::XMFLOAT2 UvScale = { 1.0f, 1.0f };
+    DirectX::XMFLOAT2 UvMax = { 1.0f, 1.0f };
+    DirectX::XMFLOAT2 RcpSourceSize = { 0.0f, 0.0f };
+    float Sharpness = 0.0f;
+};
+
+// Root constants of the visibility-buffer resolve; matches cbResolve in
+// VisibilityResolve.hlsl.  The view's rectangle is in render target pixels.
+struct VisibilityResolveConstants
+{
+    DirectX::XMUINT2 ViewOrigin = { 0, 0 };
+    DirectX::XMUINT2 ViewSize = { 0, 0 };
+    float NearDepth = 0.0f;
+    UINT Index32 = 0;
+    UINT Pad[2] = {};
+};
+
+// Clustered lighting parameters at the end of the pass constants; matches
+// ClusterParams in LightingUtil.hlsl.  The tiles cover the view's own rectangle,
+// which starts at Origin in the render target.  The first DynamicLightCount local
+// lights are the ones that move, the only ones a lightmapped surface evaluates.
+struct ClusterParams
+{
+    DirectX::XMFLOAT2 TileSize = { 0.0f, 0.0f };
+    float SliceScale = 0.0f;
+    float SliceBias = 0.0f;
+    UINT LocalLightCount = 0;
+    UINT DynamicLightCount = 0;
+    DirectX::XMFLOAT2 Origin = { 0.0f, 0.0f };
+};
+
+// What one view of the scene sees it through; changes every frame.
 struct PassConstants
 {
     DirectX::XMFLOAT4X4 View = MathHelper::Identity4x4();
@@ -27,6 +190,25 @@ struct PassConstants
     float TotalTime = 0.0f;
     float DeltaTime = 0.0f;
 
+    // Cascaded shadows of directional light 0: world to shadow map texture space for
+    // each cascade, the view depth each cascade ends at and the shadow map's index in
+    // the SRV heap.  Four cascades, as CascadedShadowMap::CascadeCount.
+    DirectX::XMFLOAT4X4 ShadowTransform[4];
+    DirectX::XMFLOAT4 CascadeSplits = { 0.0f, 0.0f, 0.0f, 0.0f };
+    UINT ShadowMapIndex = 0;
+    float ShadowTexelSize = 0.0f;
+
+    // The lightmap atlas's index in the SRV heap.
+    UINT LightmapIndex = 0;
+    float cbPerObjectPad3 = 0.0f;
+
+    ClusterParams Cluster;
+};
+
+// The lights and the atmosphere, shared by every view and rewritten only when they
+// change.  Matches cbScene in Default.hlsl and TreeSprite.hlsl.
+struct SceneConstants
+{
     DirectX::XMFLOAT4 AmbientLight = { 0.0f, 0.0f, 0.0f, 1.0f };
 
     //step4
@@ -38,7 +220,8 @@ struct PassConstants
     // Indices [0, NUM_DIR_LIGHTS) are directional lights;
     // indices [NUM_DIR_LIGHTS, NUM_DIR_LIGHTS+NUM_POINT_LIGHTS) are point lights;
     // indices [NUM_DIR_LIGHTS+NUM_POINT_LIGHTS, NUM_DIR_LIGHTS+NUM_POINT_LIGHT+NUM_SPOT_LIGHTS)
-    // are spot lights for a maximum of MaxLights per object.
+    // are spot lights for a maximum of MaxLights per object.  With clustered
+    // lighting only the directional lights are here.
     Light Lights[MaxLights];
 };
 
@@ -49,13 +232,22 @@ struct Vertex
     DirectX::XMFLOAT2 TexC;
 };
 
+// 20-byte alternative to Vertex: the normal is octahedral-encoded into two SNORM16s
+// and the texture coordinates are halves.  Default.hlsl reads it with PACKED_VERTEX.
+struct PackedVertex
+{
+    DirectX::XMFLOAT3 Pos;
+    DirectX::PackedVector::XMSHORTN2 Normal;
+    DirectX::PackedVector::XMHALF2 TexC;
+};
+
 // Stores the resources needed for the CPU to build the command lists
 // for a frame.  
 struct FrameResource
 {
 public:
 
-    FrameResource(ID3D12Device* device, UINT passCount, UINT objectCount, UINT materialCount);
+    FrameResource(ID3D12Device* device, UINT objectCount, UINT instanceCount, UINT batchCount, UINT meshletDrawCount, UINT meshletInstanceCount, UINT materialCount, UINT workerCmdListCount, UINT clusterListLength, UINT treeCount, UINT viewCount);
     FrameResource(const FrameResource& rhs) = delete;
     FrameResource& operator=(const FrameResource& rhs) = delete;
     ~FrameResource();
@@ -64,12 +256,77 @@ public:
     // So each frame needs their own allocator.
     Microsoft::WRL::ComPtr<ID3D12CommandAllocator> CmdListAlloc;
 
+    // For the list the compute queue runs alongside the frame.
+    Microsoft::WRL::ComPtr<ID3D12CommandAllocator> ComputeCmdListAlloc;
+
+    // Command lists recorded in parallel by the worker threads, one allocator
+    // each since an allocator can only be used by one thread at a time.
+    std::vector<Microsoft::WRL::ComPtr<ID3D12CommandAllocator>> WorkerCmdListAllocs;
+    std::vector<Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList>> WorkerCmdLists;
+
+    // A bundle per worker list, replayed by it for as long as the draws it holds stay
+    // the same.  The rest records what it was last recorded from.
+    struct LayerBundle
+    {
+        Microsoft::WRL::ComPtr<ID3D12CommandAllocator> Alloc;
+        Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> List;
+
+        UINT64 Generation = 0;
+        UINT Layer = 0;
+        ID3D12PipelineState* PSO = nullptr;
+        size_t First = 0;
+        size_t Count = 0;
+    };
+    std::vector<LayerBundle> WorkerBundles;
+
     // We cannot update a cbuffer until the GPU is done processing the commands
-    // that reference it.  So each frame needs their own cbuffers.
+    // that reference it.  So each frame needs their own cbuffers.  These hold
+    // data that persists between frames and is only rewritten when dirty;
+    // per-frame constants come from the application's UploadRingBuffer.
    // std::unique_ptr<UploadBuffer<FrameConstants>> FrameCB = nullptr;
-    std::unique_ptr<UploadBuffer<PassConstants>> PassCB = nullptr;
-    std::unique_ptr<UploadBuffer<MaterialConstants>> MaterialCB = nullptr;
-    std::unique_ptr<UploadBuffer<ObjectConstants>> ObjectCB = nullptr;
+    // Transforms of every render item, indexed by ObjCBIndex.  Unbatched draws
+    // select theirs with a root constant.
+    std::unique_ptr<UploadBuffer<ObjectConstants>> ObjectBuffer = nullptr;
+
+    // Every material, indexed by MatCBIndex.  Draws select theirs with a root constant.
+    std::unique_ptr<UploadBuffer<MaterialData>> MaterialBuffer = nullptr;
+
+    // Instance data for every batched render item.  Each batch owns a contiguous
+    // range so it can be drawn with one DrawIndexedInstanced call.
+    std::unique_ptr<UploadBuffer<InstanceData>> InstanceBuffer = nullptr;
+
+    // Bounds of every batched instance, indexed like InstanceBuffer.
+    std::unique_ptr<UploadBuffer<InstanceCullData>> InstanceCullBuffer = nullptr;
+
+    // What the compute passes find for one view.  Each view culls and clusters its
+    // own, so the views drawn in a frame don't share any of these.
+    struct ViewBuffers
+    {
+        // InstanceBuffer indices of the instances that survived GPU culling, packed at
+        // the start of each batch's range, then the meshlets' lists after the batches'.
+        // CPU culling writes its list to the upload ring.
+        Microsoft::WRL::ComPtr<ID3D12Resource> VisibleInstances = nullptr;
+
+        // One D3D12_DRAW_INDEXED_ARGUMENTS per batch for ExecuteIndirect, then the
+        // MeshletDrawArguments.  The culling pass copies in the arguments with zero
+        // instances from the upload ring and then counts the visible instances into it.
+        Microsoft::WRL::ComPtr<ID3D12Resource> DrawArgs = nullptr;
+
+        // Per-cluster light lists written by the light clustering pass: for each
+        // cluster a count followed by indices into the frame's local light buffer.
+        Microsoft::WRL::ComPtr<ID3D12Resource> ClusterLights = nullptr;
+
+        // The trees the tree culling pass kept, appended in whatever order its threads
+        // finish, and the D3D12_DRAW_ARGUMENTS that draw them: four vertices a tree and
+        // an instance count the pass counts up from zero like DrawArgs.
+        Microsoft::WRL::ComPtr<ID3D12Resource> VisibleTrees = nullptr;
+        Microsoft::WRL::ComPtr<ID3D12Resource> TreeDrawArgs = nullptr;
+    };
+    std::vector<ViewBuffers> Views;
+
+    // CPU data of the frame being built in this slot.  Reset once the slot's fence
+    // has passed, like the command allocators.
+    FrameArena Arena;
 
     // Fence value to mark commands up to this fence point.  This lets us
     // check if these frame resources are still in use by the GPU.
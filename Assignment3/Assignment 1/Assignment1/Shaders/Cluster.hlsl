@@ -0,0 +1,125 @@
+//***************************************************************************************
+// Cluster.hlsl
+//
+// Bins the point and spot lights into the view-space clusters of the clustered
+// forward path.  The view frustum is cut into CLUSTER_COUNT_X x CLUSTER_COUNT_Y
+// screen tiles and CLUSTER_COUNT_Z depth slices, spaced exponentially between the
+// near and far planes.  Each thread owns one cluster: it builds the cluster's
+// view-space AABB and keeps the lights whose range sphere touches it.  The lights
+// are staged through groupshared memory a block at a time, transformed to view
+// space once per group.
+//***************************************************************************************
+
+#define CLUSTERED_LIGHTING 1
+
+#include "LightingUtil.hlsl"
+
+cbuffer cbPass : register(b0)
+{
+    float4x4 gView;
+    float4x4 gInvView;
+    float4x4 gProj;
+    float4x4 gInvProj;
+    float4x4 gViewProj;
+    float4x4 gInvViewProj;
+    float3 gEyePosW;
+    float cbPerObjectPad1;
+    float2 gRenderTargetSize;
+    float2 gInvRenderTargetSize;
+    float gNearZ;
+    float gFarZ;
+    float gTotalTime;
+    float gDeltaTime;
+    float4x4 gShadowTransform[4];
+    float4 gCascadeSplits;
+    uint gShadowMapIndex;
+    float gShadowTexelSize;
+    float2 cbPerObjectPad3;
+    ClusterParams gCluster;
+};
+
+RWStructuredBuffer<uint> gClusterLightsOut : register(u0);
+
+#define GROUP_SIZE 64
+
+groupshared float4 gsLightSpheres[GROUP_SIZE];
+
+// Point on the ray through pixel, at view-space depth z.  pixel is relative to the
+// view's rectangle, which gRenderTargetSize is the size of.
+float3 ViewRayAt(float2 pixel, float z)
+{
+    float2 ndc = float2(pixel.x * gInvRenderTargetSize.x * 2.0f - 1.0f,
+                        1.0f - pixel.y * gInvRenderTargetSize.y * 2.0f);
+
+    // Halfway in depth stays finite with a reverse-Z infinite projection, unlike the far plane there.
+    float4 onRay = mul(float4(ndc, 0.5f, 1.0f), gInvProj);
+    float3 ray = onRay.xyz / onRay.w;
+
+    return ray * (z / ray.z);
+}
+
+bool SphereTouchesBox(float4 sphere, float3 boxMin, float3 boxMax)
+{
+    float3 closest = clamp(sphere.xyz, boxMin, boxMax);
+    float3 d = closest - sphere.xyz;
+
+    return dot(d, d) <= sphere.w * sphere.w;
+}
+
+[numthreads(GROUP_SIZE, 1, 1)]
+void CS(uint3 dispatchThreadID : SV_DispatchThreadID, uint groupIndex : SV_GroupIndex)
+{
+    const uint clusterCount = CLUSTER_COUNT_X * CLUSTER_COUNT_Y * CLUSTER_COUNT_Z;
+    const uint cluster = dispatchThreadID.x;
+
+    uint3 cell;
+    cell.x = cluster % CLUSTER_COUNT_X;
+    cell.y = (cluster / CLUSTER_COUNT_X) % CLUSTER_COUNT_Y;
+    cell.z = cluster / (CLUSTER_COUNT_X * CLUSTER_COUNT_Y);
+
+    // Inverse of ClusterSlice().
+    float zNear = gNearZ * pow(gFarZ / gNearZ, (float)cell.z / CLUSTER_COUNT_Z);
+    float zFar = gNearZ * pow(gFarZ / gNearZ, (float)(cell.z + 1) / CLUSTER_COUNT_Z);
+
+    // The tile's cross-section grows with depth, so the extremes lie on its
+    // corner rays at the slice's near and far depths.
+    float2 tileMin = cell.xy * gCluster.TileSize;
+    float2 tileMax = min(tileMin + gCluster.TileSize, gRenderTargetSize);
+
+    float3 p0 = ViewRayAt(tileMin, zNear);
+    float3 p1 = ViewRayAt(tileMin, zFar);
+    float3 p2 = ViewRayAt(tileMax, zNear);
+    float3 p3 = ViewRayAt(tileMax, zFar);
+
+    float3 boxMin = min(min(p0, p1), min(p2, p3));
+    float3 boxMax = max(max(p0, p1), max(p2, p3));
+
+    uint count = 0;
+    const uint listStart = cluster * CLUSTER_LIST_STRIDE;
+
+    for (uint first = 0; first < gCluster.LocalLightCount; first += GROUP_SIZE)
+    {
+        // Stage the next block of lights as view-space range spheres.
+        uint light = first + groupIndex;
+        if (light < gCluster.LocalLightCount)
+        {
+            Light L = gLocalLights[light];
+            gsLightSpheres[groupIndex] = float4(mul(float4(L.Position, 1.0f), gView).xyz, L.FalloffEnd);
+        }
+        GroupMemoryBarrierWithGroupSync();
+
+        uint blockSize = min(GROUP_SIZE, gCluster.LocalLightCount - first);
+        if (cluster < clusterCount)
+        {
+            for (uint i = 0; i < blockSize && count < MAX_LIGHTS_PER_CLUSTER; ++i)
+            {
+                if (SphereTouchesBox(gsLightSpheres[i], boxMin, boxMax))
+                    gClusterLightsOut[listStart + 1 + count++] = first + i;
+            }
+        }
+        GroupMemoryBarrierWithGroupSync();
+    }
+
+    if (cluster < clusterCount)
+        gClusterLightsOut[listStart] = count;
+}
@@ -0,0 +1,254 @@
+//***************************************************************************************
+// Cull.hlsl
+//
+// Culls the batched instances.  Each thread tests one instance's world space AABB
+// against the camera planes.  A visible instance bumps its batch's instance count
+// in the indirect draw arguments and writes its index into the batch's range of the
+// visible instance list.
+//
+// Occlusion culling runs in two phases around a depth pre-pass:
+//   -CULL_PREPASS keeps what was visible last frame, for the pre-pass to draw.
+//   -CULL_OCCLUSION then tests every instance against the Hi-Z pyramid of that
+//    depth, keeps what is not hidden behind it and remembers the result for the
+//    next frame's pre-pass.
+//
+// An instance of a batch drawn by meshlet goes on to test each of its meshlets: the
+// bounding sphere against the planes, and the normal cone against the eye.  Those
+// left bump their own draw's instance count instead of the batch's.
+//***************************************************************************************
+
+struct InstanceCullData
+{
+    float3 Center;
+    uint   Batch;
+    float3 Extents;
+    uint   BatchStart;
+    uint   FirstMeshlet;
+    uint   MeshletCount;    // 0 if the batch is drawn whole
+    uint   MeshletDraw;
+    uint   MaterialIndex;       // the rest is only for the visibility buffer's resolve
+    uint   StartIndexLocation;
+    int    BaseVertexLocation;
+    uint2  CullPad;
+};
+
+// Must match Meshlet in MeshletBuilder.h.
+struct Meshlet
+{
+    float3 Center;
+    float  Radius;
+    float3 ConeAxis;
+    float  ConeCutoff;
+    uint   FirstIndex;
+    uint   IndexCount;
+};
+
+// See SurfaceShading.hlsl.
+struct InstanceData
+{
+    float4x4 World;
+    float4x4 TexTransform;
+    float4   LightmapScaleOffset;
+    uint     LightmapSlice;
+    uint3    InstancePad;
+};
+
+#define CULL_FRUSTUM   0
+#define CULL_PREPASS   1
+#define CULL_OCCLUSION 2
+
+cbuffer cbCull : register(b0)
+{
+    // Plane normals point into the frustum.
+    float4   gFrustumPlanes[6];
+    float4x4 gViewProj;
+    uint2    gDepthSize;
+    uint     gInstanceCount;
+    uint     gPhase;
+    uint     gHiZMipCount;
+    uint     gReverseZ;
+
+    // Byte offset of the meshlet draws in gDrawArgs, and where the meshlet lists
+    // start in gVisibleInstances.
+    uint     gMeshletDrawStart;
+    uint     gMeshletVisibleStart;
+    float3   gEyePosW;
+
+    // The range of the instances culled, InstanceCount long.
+    uint     gFirstInstance;
+};
+
+StructuredBuffer<InstanceCullData> gInstanceCull : register(t0);
+StructuredBuffer<Meshlet> gMeshlets : register(t2);
+StructuredBuffer<InstanceData> gInstanceData : register(t3);
+
+// Farthest depth of each texel's 2x2 texels in the mip below; mip 0 halves the depth
+// buffer.  Farthest is the smallest depth with gReverseZ.
+Texture2D<float> gHiZ : register(t1);
+
+RWStructuredBuffer<uint> gVisibleInstances : register(u0);
+
+// One D3D12_DRAW_INDEXED_ARGUMENTS per batch, then the meshlet draws: the start of
+// the meshlet's list from gMeshletVisibleStart followed by its draw arguments.
+RWByteAddressBuffer gDrawArgs : register(u1);
+
+// Non-zero for each instance the last CULL_OCCLUSION pass kept.
+RWStructuredBuffer<uint> gVisibleLastFrame : register(u2);
+
+#define DRAW_ARGS_STRIDE 20
+#define INSTANCE_COUNT_OFFSET 4
+#define MESHLET_DRAW_STRIDE 24
+#define MESHLET_INSTANCE_COUNT_OFFSET 8
+
+bool OutsidePlane(float4 plane, float3 center, float3 extents)
+{
+    // Signed distance of the box center and the box's projected radius on the plane normal.
+    float dist = dot(plane.xyz, center) + plane.w;
+    float radius = dot(abs(plane.xyz), extents);
+
+    return dist + radius < 0.0f;
+}
+
+// True if the box is entirely behind the depth in the Hi-Z pyramid.
+bool Occluded(float3 center, float3 extents)
+{
+    // Depths are flipped with gReverseZ, so the comparisons below are the usual ones.
+    float2 minNdc = 1.0f;
+    float2 maxNdc = -1.0f;
+    float nearestZ = 1.0f;
+
+    [unroll]
+    for (uint i = 0; i < 8; ++i)
+    {
+        float3 corner = center + extents * float3((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f, (i & 4) ? 1.0f : -1.0f);
+        float4 clip = mul(float4(corner, 1.0f), gViewProj);
+
+        // The box reaches behind the eye, so it cannot be projected; keep it.
+        if (clip.w <= 0.0f)
+            return false;
+
+        float3 ndc = clip.xyz / clip.w;
+        minNdc = min(minNdc, ndc.xy);
+        maxNdc = max(maxNdc, ndc.xy);
+        nearestZ = min(nearestZ, gReverseZ ? 1.0f - ndc.z : ndc.z);
+    }
+
+    // The pixels the box covers; y points down in the depth buffer.
+    float2 topLeft = float2(minNdc.x, -maxNdc.y) * 0.5f + 0.5f;
+    float2 bottomRight = float2(maxNdc.x, -minNdc.y) * 0.5f + 0.5f;
+    uint2 p0 = (uint2)clamp(topLeft * gDepthSize, 0.0f, gDepthSize - 1.0f);
+    uint2 p1 = (uint2)clamp(bottomRight * gDepthSize, 0.0f, gDepthSize - 1.0f);
+
+    // The mip whose texels are at least as wide as the box, so it spans at most 2x2 of them.
+    uint span = max(p1.x - p0.x, p1.y - p0.y) + 1;
+    uint mip = span > 1 ? firstbithigh(span - 1) : 0;
+    mip = min(mip, gHiZMipCount - 1);
+
+    uint2 t0 = p0 >> (mip + 1);
+    uint2 t1 = p1 >> (mip + 1);
+    float4 texels = float4(gHiZ.Load(int3(t0, mip)), gHiZ.Load(int3(t1.x, t0.y, mip)),
+                           gHiZ.Load(int3(t0.x, t1.y, mip)), gHiZ.Load(int3(t1, mip)));
+    if (gReverseZ)
+        texels = 1.0f - texels;
+    float farthest = max(max(texels.x, texels.y), max(texels.z, texels.w));
+
+    return nearestZ > farthest;
+}
+
+// Adds a visible instance to the draws of the meshlets it shows.
+void CullMeshlets(uint instance, InstanceCullData cull)
+{
+    float4x4 world = gInstanceData[instance].World;
+    float3 r0 = world[0].xyz;
+    float3 r1 = world[1].xyz;
+    float3 r2 = world[2].xyz;
+
+    // The eye in the meshlets' space, through the inverse of the upper 3x3.  Which
+    // side of a face the eye is on is the same in both spaces, unless the transform
+    // mirrors and swaps the winding; mirrored instances skip the cone test.
+    float3 c0 = cross(r1, r2);
+    float3 c1 = cross(r2, r0);
+    float3 c2 = cross(r0, r1);
+    float det = dot(r0, c0);
+    float3 toEye = gEyePosW - world[3].xyz;
+    float3 eyeL = float3(dot(toEye, c0), dot(toEye, c1), dot(toEye, c2)) / det;
+
+    // The spheres grow by the largest of the axis scales.
+    float scale = sqrt(max(dot(r0, r0), max(dot(r1, r1), dot(r2, r2))));
+
+    for (uint m = 0; m < cull.MeshletCount; ++m)
+    {
+        Meshlet meshlet = gMeshlets[cull.FirstMeshlet + m];
+
+        float3 centerW = mul(float4(meshlet.Center, 1.0f), world).xyz;
+        float radiusW = meshlet.Radius * scale;
+
+        bool visible = true;
+        [unroll]
+        for (int i = 0; i < 6; ++i)
+        {
+            if (dot(gFrustumPlanes[i].xyz, centerW) + gFrustumPlanes[i].w < -radiusW)
+                visible = false;
+        }
+
+        // Back facing from every point of the sphere.
+        if (visible && det > 0.0f)
+        {
+            float3 v = meshlet.Center - eyeL;
+            visible = dot(v, meshlet.ConeAxis) < meshlet.ConeCutoff * length(v) + meshlet.Radius;
+        }
+
+        if (!visible)
+            continue;
+
+        uint draw = gMeshletDrawStart + (cull.MeshletDraw + m) * MESHLET_DRAW_STRIDE;
+        uint slot;
+        gDrawArgs.InterlockedAdd(draw + MESHLET_INSTANCE_COUNT_OFFSET, 1, slot);
+
+        gVisibleInstances[gMeshletVisibleStart + gDrawArgs.Load(draw) + slot] = instance;
+    }
+}
+
+[numthreads(64, 1, 1)]
+void CS(uint3 dispatchThreadID : SV_DispatchThreadID)
+{
+    if (dispatchThreadID.x >= gInstanceCount)
+        return;
+
+    uint instance = gFirstInstance + dispatchThreadID.x;
+
+    InstanceCullData cull = gInstanceCull[instance];
+
+    bool visible = true;
+
+    [unroll]
+    for (int i = 0; i < 6; ++i)
+    {
+        if (OutsidePlane(gFrustumPlanes[i], cull.Center, cull.Extents))
+            visible = false;
+    }
+
+    if (visible && gPhase == CULL_PREPASS)
+        visible = gVisibleLastFrame[instance] != 0;
+
+    if (gPhase == CULL_OCCLUSION)
+    {
+        if (visible)
+            visible = !Occluded(cull.Center, cull.Extents);
+        gVisibleLastFrame[instance] = visible ? 1 : 0;
+    }
+
+    if (!visible)
+        return;
+
+    if (cull.MeshletCount > 0)
+    {
+        CullMeshlets(instance, cull);
+        return;
+    }
+
+    uint slot;
+    gDrawArgs.InterlockedAdd(cull.Batch * DRAW_ARGS_STRIDE + INSTANCE_COUNT_OFFSET, 1, slot);
+
+    gVisibleInstances[cull.BatchStart + slot] = instance;
+}
@@ -2,89 +2,42 @@
 // Default.hlsl by Frank Luna (C) 2015 All Rights Reserved.
 //
 // Default shader, currently supports lighting.
+//
+// With LIGHTMAP the lightmapped instances take their static point and spot lights
+// from the lightmap atlas rather than the clusters; the rest are lit as without it.
+// Only CLUSTERED_LIGHTING tells the moving lights apart, so without it LIGHTMAP just
+// reads the second stream.
 //***************************************************************************************
 
-// Defaults for number of lights.
-#ifndef NUM_DIR_LIGHTS
-    #define NUM_DIR_LIGHTS 3
-#endif
-
-#ifndef NUM_POINT_LIGHTS
-    #define NUM_POINT_LIGHTS 5
-#endif
-
-#ifndef NUM_SPOT_LIGHTS
-    #define NUM_SPOT_LIGHTS 0
-#endif
-
-// Include structures and functions for lighting.
-#include "LightingUtil.hlsl"
-
-// Constant data that varies per frame.
-
-Texture2D    gDiffuseMap : register(t0);
-
-
-SamplerState gsamPointWrap        : register(s0);
-SamplerState gsamPointClamp       : register(s1);
-SamplerState gsamLinearWrap       : register(s2);
-SamplerState gsamLinearClamp      : register(s3);
-SamplerState gsamAnisotropicWrap  : register(s4);
-SamplerState gsamAnisotropicClamp : register(s5);
-
-// Constant data that varies per frame.
-cbuffer cbPerObject : register(b0)
-{
-    float4x4 gWorld;
-    float4x4 gTexTransform;
-};
-
-// Constant data that varies per pass.
-cbuffer cbPass : register(b1)
-{
-    float4x4 gView;
-    float4x4 gInvView;
-    float4x4 gProj;
-    float4x4 gInvProj;
-    float4x4 gViewProj;
-    float4x4 gInvViewProj;
-    float3 gEyePosW;
-    float cbPerObjectPad1;
-    float2 gRenderTargetSize;
-    float2 gInvRenderTargetSize;
-    float gNearZ;
-    float gFarZ;
-    float gTotalTime;
-    float gDeltaTime;
-    float4 gAmbientLight;
-
-    // Allow application to change fog parameters once per frame.
-    // For example, we may only use fog for certain times of day.
-    float4 gFogColor;
-    float gFogStart;
-    float gFogRange;
-    float2 cbPerObjectPad2;
-
-    // Indices [0, NUM_DIR_LIGHTS) are directional lights;
-    // indices [NUM_DIR_LIGHTS, NUM_DIR_LIGHTS+NUM_POINT_LIGHTS) are point lights;
-    // indices [NUM_DIR_LIGHTS+NUM_POINT_LIGHTS, NUM_DIR_LIGHTS+NUM_POINT_LIGHT+NUM_SPOT_LIGHTS)
-    // are spot lights for a maximum of MaxLights per object.
-    Light gLights[MaxLights];
-};
+// Resources, vertex decoding and the lighting itself, shared with the visibility
+// buffer's resolve.
+#include "SurfaceShading.hlsl"
 
-cbuffer cbMaterial : register(b2)
+// Set per draw as root constants.  Instanced draws read their transforms from
+// gInstanceData; gObjectIndex is 0 for them, or the start of a meshlet's visible
+// list for a meshlet draw.
+cbuffer cbDraw : register(b0)
 {
-    float4   gDiffuseAlbedo;
-    float3   gFresnelR0;
-    float    gRoughness;
-    float4x4 gMatTransform;
+    uint gObjectIndex;
+    uint gMaterialIndex;
 };
 
+// With PACKED_VERTEX the normal arrives octahedral-encoded in two SNORMs (see
+// MathHelper::OctahedralEncode) and the texture coordinates as halves, which the
+// input assembler widens to float2.  The lightmap UVs are a second stream of
+// UNORMs.
 struct VertexIn
 {
     float3 PosL    : POSITION;
+#ifdef PACKED_VERTEX
+    float2 NormalL : NORMAL;
+#else
     float3 NormalL : NORMAL;
+#endif
     float2 TexC    : TEXCOORD;
+#ifdef LIGHTMAP
+    float2 LightmapUV : TEXCOORD1;
+#endif
 };
 
 struct VertexOut
@@ -93,32 +46,104 @@ struct VertexOut
     float3 PosW    : POSITION;
     float3 NormalW : NORMAL;
     float2 TexC    : TEXCOORD;
+#ifdef VISIBILITY
+    nointerpolation uint Instance : INSTANCE;
+#endif
+#ifdef LIGHTMAP
+    float2 LightmapUV : TEXCOORD1;
+    nointerpolation uint LightmapSlice : LIGHTMAP_SLICE;
+#endif
 };
 
-VertexOut VS(VertexIn vin)
+VertexOut VS(VertexIn vin, uint instanceID : SV_InstanceID)
 {
     VertexOut vout = (VertexOut)0.0f;
 
+    // Fetch the instance data.
+    uint instance = gVisibleInstances[gObjectIndex + instanceID];
+    InstanceData instData = gInstanceData[instance];
+    float4x4 world = instData.World;
+    float4x4 texTransform = instData.TexTransform;
+
+#ifdef PACKED_VERTEX
+    float3 normalL = OctahedralDecode(vin.NormalL);
+#else
+    float3 normalL = vin.NormalL;
+#endif
+
+    // The same for every vertex of the draw, so the branch is coherent.
+    float3 posL = vin.PosL;
+    if (gMaterialData[gMaterialIndex].Flags & MATERIAL_FLAG_WAVES)
+    {
+        float height;
+        SampleWaves(vin.TexC, height, normalL);
+        posL.y += height;
+    }
+
     // Transform to world space.
-    float4 posW = mul(float4(vin.PosL, 1.0f), gWorld);
+    float4 posW = mul(float4(posL, 1.0f), world);
     vout.PosW = posW.xyz;
 
     // Assumes nonuniform scaling; otherwise, need to use inverse-transpose of world matrix.
-    vout.NormalW = mul(vin.NormalL, (float3x3)gWorld);
+    vout.NormalW = mul(normalL, (float3x3)world);
 
     // Transform to homogeneous clip space.
     vout.PosH = mul(posW, gViewProj);
 
     // Output vertex attributes for interpolation across triangle.
-    float4 texC = mul(float4(vin.TexC, 0.0f, 1.0f), gTexTransform);
-    vout.TexC = mul(texC, gMatTransform).xy;
+    float4 texC = mul(float4(vin.TexC, 0.0f, 1.0f), texTransform);
+    vout.TexC = mul(texC, gMaterialData[gMaterialIndex].MatTransform).xy;
+
+#ifdef VISIBILITY
+    vout.Instance = instance;
+#endif
+
+#ifdef LIGHTMAP
+    vout.LightmapUV = vin.LightmapUV * instData.LightmapScaleOffset.xy + instData.LightmapScaleOffset.zw;
+    vout.LightmapSlice = instData.LightmapSlice;
+#endif
 
     return vout;
 }
 
+#ifdef VISIBILITY
+// Only which triangle of which instance covers the pixel; VisibilityResolve.hlsl
+// shades it.  SV_PrimitiveID counts from the draw's first index, which is the
+// submesh's for a batch drawn whole.
+uint VisibilityPS(VertexOut pin, uint primitiveID : SV_PrimitiveID) : SV_Target
+{
+    return ((pin.Instance + 1) << VISIBILITY_TRIANGLE_BITS) | primitiveID;
+}
+#endif
+
+#ifdef WEIGHTED_OIT
+// Weighted blended order-independent transparency (McGuire and Bavoil 2013): every
+// surface adds its premultiplied colour, weighted to favour the nearer ones, into
+// the first target and multiplies the second, cleared to 1, by 1 - alpha.
+// Oit.hlsl divides the sum by the total weight and blends it over the scene.
+struct OitOut
+{
+    float4 Accumulation : SV_Target0;
+    float  Revealage    : SV_Target1;
+};
+
+OitOut WeightedOit(float4 color, float viewDepth)
+{
+    float weight = color.a * clamp(10.0f / (1e-5f + pow(viewDepth / 5.0f, 2.0f) + pow(viewDepth / 200.0f, 6.0f)), 1e-2f, 3e3f);
+
+    OitOut oit;
+    oit.Accumulation = float4(color.rgb * color.a, color.a) * weight;
+    oit.Revealage = color.a;
+    return oit;
+}
+
+OitOut PS(VertexOut pin)
+#else
 float4 PS(VertexOut pin) : SV_Target
+#endif
 {
-    float4 diffuseAlbedo = gDiffuseMap.Sample(gsamAnisotropicWrap, pin.TexC) * gDiffuseAlbedo;
+    MaterialData matData = gMaterialData[gMaterialIndex];
+    float4 diffuseAlbedo = gTextureMaps[matData.DiffuseMapIndex].Sample(gsamAnisotropicWrap, pin.TexC) * matData.DiffuseAlbedo;
 
 #ifdef ALPHA_TEST
     // Discard pixel if texture alpha < 0.1.  We do this test as soon 
@@ -130,31 +155,23 @@ float4 PS(VertexOut pin) : SV_Target
     // Interpolating normal can unnormalize it, so renormalize it.
     pin.NormalW = normalize(pin.NormalW);
 
-    // Vector from point being lit to eye. 
-    float3 toEyeW = gEyePosW - pin.PosW;
-    float distToEye = length(toEyeW);
-    toEyeW /= distToEye; // normalize
-
-    // Light terms.
-    float4 ambient = gAmbientLight * diffuseAlbedo;
-
-    const float shininess = 1.0f - gRoughness;
-    Material mat = { diffuseAlbedo, gFresnelR0, shininess };
-    float3 shadowFactor = 1.0f;
-    float4 directLight = ComputeLighting(gLights, mat, pin.PosW,
-        pin.NormalW, toEyeW, shadowFactor);
-
-    float4 litColor = ambient + directLight;
-
-#ifdef FOG
-    float fogAmount = saturate((distToEye - gFogStart) / gFogRange);
-    litColor = lerp(litColor, gFogColor, fogAmount);
+    // The clusters hold the static lights too, for what has no lightmap.  The same for
+    // every pixel of an instance, so the branch is coherent.
+#if defined(LIGHTMAP) && defined(CLUSTERED_LIGHTING)
+    float4 litColor;
+    if (pin.LightmapSlice != NO_LIGHTMAP)
+        litColor = ShadeLightmappedSurface(matData, diffuseAlbedo, pin.PosW, pin.NormalW, pin.PosH.w, pin.LightmapUV, pin.LightmapSlice);
+    else
+        litColor = ShadeSurface(matData, diffuseAlbedo, pin.PosW, pin.NormalW, pin.PosH.xy, pin.PosH.w);
+#else
+    float4 litColor = ShadeSurface(matData, diffuseAlbedo, pin.PosW, pin.NormalW, pin.PosH.xy, pin.PosH.w);
 #endif
 
-    // Common convention to take alpha from diffuse albedo.
-    litColor.a = diffuseAlbedo.a;
-
+#ifdef WEIGHTED_OIT
+    return WeightedOit(litColor, pin.PosH.w);
+#else
     return litColor;
+#endif
 }
 
 
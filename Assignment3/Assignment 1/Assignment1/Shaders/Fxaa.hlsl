@@ -0,0 +1,164 @@
+//***************************************************************************************
+// Fxaa.hlsl
+//
+// Fast approximate anti-aliasing of the single-sampled scene, in the spirit of FXAA
+// 3.11's quality preset.  Each thread finds the local luma contrast; above the
+// threshold it picks the edge direction, walks along the edge in both directions
+// to its ends and blends towards the neighbour across the edge by how close the
+// pixel is to the nearer end.  Luma is computed from the colour, not stored in alpha.
+// Only the gSize corner of the scene is rendered, so reads are clamped to gUvMax.
+//***************************************************************************************
+
+#define FXAA_SEARCH_STEPS 8
+
+static const float gSearchOffsets[FXAA_SEARCH_STEPS] = { 1.0f, 1.5f, 2.0f, 2.0f, 2.0f, 2.0f, 4.0f, 8.0f };
+
+// Below these the pixel is left alone: the absolute contrast, and the contrast
+// relative to the brightest of the pixel and its neighbours.
+static const float gEdgeThresholdMin = 0.0312f;
+static const float gEdgeThreshold = 0.125f;
+static const float gSubpixelQuality = 0.75f;
+
+cbuffer cbFxaa : register(b0)
+{
+    float2 gRcpFrame;
+    uint2  gSize;
+    float2 gUvMax;
+};
+
+Texture2D<float4> gScene : register(t0);
+RWTexture2D<float4> gOutput : register(u0);
+
+SamplerState gsamLinearClamp : register(s0);
+
+float Luma(float3 color)
+{
+    return dot(color, float3(0.299f, 0.587f, 0.114f));
+}
+
+float3 Fetch(float2 uv)
+{
+    return gScene.SampleLevel(gsamLinearClamp, min(uv, gUvMax), 0.0f).rgb;
+}
+
+float LumaAt(float2 uv)
+{
+    return Luma(Fetch(uv));
+}
+
+[numthreads(8, 8, 1)]
+void CS(uint3 dispatchThreadID : SV_DispatchThreadID)
+{
+    if (any(dispatchThreadID.xy >= gSize))
+        return;
+
+    float2 uv = (dispatchThreadID.xy + 0.5f) * gRcpFrame;
+    float4 center = gScene.SampleLevel(gsamLinearClamp, uv, 0.0f);
+
+    float lumaM = Luma(center.rgb);
+    float lumaN = LumaAt(uv + float2(0.0f, -gRcpFrame.y));
+    float lumaS = LumaAt(uv + float2(0.0f, gRcpFrame.y));
+    float lumaW = LumaAt(uv + float2(-gRcpFrame.x, 0.0f));
+    float lumaE = LumaAt(uv + float2(gRcpFrame.x, 0.0f));
+
+    float lumaMax = max(lumaM, max(max(lumaN, lumaS), max(lumaW, lumaE)));
+    float lumaMin = min(lumaM, min(min(lumaN, lumaS), min(lumaW, lumaE)));
+    float range = lumaMax - lumaMin;
+    if (range < max(gEdgeThresholdMin, lumaMax * gEdgeThreshold))
+    {
+        gOutput[dispatchThreadID.xy] = center;
+        return;
+    }
+
+    float lumaNW = LumaAt(uv - gRcpFrame);
+    float lumaSE = LumaAt(uv + gRcpFrame);
+    float lumaNE = LumaAt(uv + float2(gRcpFrame.x, -gRcpFrame.y));
+    float lumaSW = LumaAt(uv + float2(-gRcpFrame.x, gRcpFrame.y));
+
+    // Is the edge closer to horizontal or to vertical?
+    float edgeH = abs(lumaNW + lumaNE - 2.0f * lumaN) +
+                  abs(lumaW + lumaE - 2.0f * lumaM) * 2.0f +
+                  abs(lumaSW + lumaSE - 2.0f * lumaS);
+    float edgeV = abs(lumaNW + lumaSW - 2.0f * lumaW) +
+                  abs(lumaN + lumaS - 2.0f * lumaM) * 2.0f +
+                  abs(lumaNE + lumaSE - 2.0f * lumaE);
+    bool horizontal = edgeH >= edgeV;
+
+    // Step across the edge towards the neighbour with the larger gradient.
+    float luma1 = horizontal ? lumaN : lumaW;
+    float luma2 = horizontal ? lumaS : lumaE;
+    float gradient1 = abs(luma1 - lumaM);
+    float gradient2 = abs(luma2 - lumaM);
+    float stepLength = horizontal ? gRcpFrame.y : gRcpFrame.x;
+    float lumaLocalAverage;
+    if (gradient1 >= gradient2)
+    {
+        stepLength = -stepLength;
+        lumaLocalAverage = 0.5f * (luma1 + lumaM);
+    }
+    else
+    {
+        lumaLocalAverage = 0.5f * (luma2 + lumaM);
+    }
+    float gradientScaled = 0.25f * max(gradient1, gradient2);
+
+    // Walk along the edge, half a pixel across it, until the luma leaves the edge's.
+    float2 edgeUV = uv;
+    if (horizontal)
+        edgeUV.y += 0.5f * stepLength;
+    else
+        edgeUV.x += 0.5f * stepLength;
+    float2 along = horizontal ? float2(gRcpFrame.x, 0.0f) : float2(0.0f, gRcpFrame.y);
+
+    float2 uv1 = edgeUV - along;
+    float2 uv2 = edgeUV + along;
+    float lumaEnd1 = LumaAt(uv1) - lumaLocalAverage;
+    float lumaEnd2 = LumaAt(uv2) - lumaLocalAverage;
+    bool reached1 = abs(lumaEnd1) >= gradientScaled;
+    bool reached2 = abs(lumaEnd2) >= gradientScaled;
+
+    [unroll]
+    for (int i = 1; i < FXAA_SEARCH_STEPS; ++i)
+    {
+        if (reached1 && reached2)
+            break;
+        if (!reached1)
+        {
+            uv1 -= along * gSearchOffsets[i];
+            lumaEnd1 = LumaAt(uv1) - lumaLocalAverage;
+            reached1 = abs(lumaEnd1) >= gradientScaled;
+        }
+        if (!reached2)
+        {
+            uv2 += along * gSearchOffsets[i];
+            lumaEnd2 = LumaAt(uv2) - lumaLocalAverage;
+            reached2 = abs(lumaEnd2) >= gradientScaled;
+        }
+    }
+
+    float distance1 = horizontal ? uv.x - uv1.x : uv.y - uv1.y;
+    float distance2 = horizontal ? uv2.x - uv.x : uv2.y - uv.y;
+    bool nearer1 = distance1 < distance2;
+    float distanceNearer = min(distance1, distance2);
+    float edgeLength = distance1 + distance2;
+
+    // Only blend if the pixel is on the side of the edge whose end it is nearer to.
+    bool lumaMSmaller = lumaM < lumaLocalAverage;
+    bool correctVariation = ((nearer1 ? lumaEnd1 : lumaEnd2) < 0.0f) != lumaMSmaller;
+    float edgeOffset = correctVariation ? 0.5f - distanceNearer / edgeLength : 0.0f;
+
+    // Thin features shorter than the search get a low-pass blend instead.
+    float lumaAverage = (2.0f * (lumaN + lumaS + lumaW + lumaE) + lumaNW + lumaNE + lumaSW + lumaSE) / 12.0f;
+    float subpixel = saturate(abs(lumaAverage - lumaM) / range);
+    subpixel = (-2.0f * subpixel + 3.0f) * subpixel * subpixel;
+    float subpixelOffset = subpixel * subpixel * gSubpixelQuality;
+
+    float offset = max(edgeOffset, subpixelOffset);
+    float2 finalUV = uv;
+    if (horizontal)
+        finalUV.y += offset * stepLength;
+    else
+        finalUV.x += offset * stepLength;
+
+    gOutput[dispatchThreadID.xy] = float4(Fetch(finalUV), center.a);
+}
@@ -0,0 +1,124 @@
+//***************************************************************************************
+// GenerateMips.hlsl
+//
+// Writes up to four mips of a texture in one dispatch.  Each thread filters the
+// texels under its texel of the first mip written; the group then halves its 8x8
+// block in groupshared memory for the next three.  MipGenerator only asks for as
+// many mips as halve exactly, so the groupshared steps are plain 2x2 averages.
+// An odd source size widens that axis of the first step to a 1-2-1 tent over three
+// texels.  Gamma encoded colour is filtered in linear space.  gFromSource copies
+// mip 0 of another texture (of any format the SRV can read) instead of filtering.
+// Slices are the dispatch's z.
+//***************************************************************************************
+
+cbuffer cbMips : register(b0)
+{
+    uint2 gSrcSize;
+    uint  gNumMips;         // 1 to 4
+    uint  gSrcOdd;          // bit 0: width, bit 1: height
+    uint  gGammaEncoded;
+    uint  gFromSource;
+};
+
+Texture2DArray<float4> gSource : register(t0);
+
+RWTexture2DArray<float4> gSrcMip : register(u0);
+RWTexture2DArray<float4> gOutMip1 : register(u1);
+RWTexture2DArray<float4> gOutMip2 : register(u2);
+RWTexture2DArray<float4> gOutMip3 : register(u3);
+RWTexture2DArray<float4> gOutMip4 : register(u4);
+
+groupshared float4 gCache[64];
+
+float3 ToLinear(float3 c)
+{
+    return c <= 0.04045f ? c / 12.92f : pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+float3 FromLinear(float3 c)
+{
+    return c <= 0.0031308f ? c * 12.92f : 1.055f * pow(c, 1.0f / 2.4f) - 0.055f;
+}
+
+float4 Fetch(uint2 p, uint slice)
+{
+    p = min(p, gSrcSize - 1);
+    float4 c = gFromSource ? gSource.Load(int4(p, slice, 0)) : gSrcMip[uint3(p, slice)];
+    return gGammaEncoded ? float4(ToLinear(saturate(c.rgb)), c.a) : c;
+}
+
+float4 Pack(float4 c)
+{
+    return gGammaEncoded ? float4(FromLinear(saturate(c.rgb)), c.a) : c;
+}
+
+float4 Filter(uint2 p, uint slice)
+{
+    float3 evenWeights = float3(0.5f, 0.5f, 0.0f);
+    float3 oddWeights = float3(0.25f, 0.5f, 0.25f);
+    float3 wx = (gSrcOdd & 1) ? oddWeights : evenWeights;
+    float3 wy = (gSrcOdd & 2) ? oddWeights : evenWeights;
+
+    float4 sum = 0.0f;
+    [unroll]
+    for (uint y = 0; y < 3; ++y)
+    {
+        [unroll]
+        for (uint x = 0; x < 3; ++x)
+        {
+            float w = wx[x] * wy[y];
+            if (w > 0.0f)
+                sum += w * Fetch(p + uint2(x, y), slice);
+        }
+    }
+    return sum;
+}
+
+[numthreads(8, 8, 1)]
+void CS(uint groupIndex : SV_GroupIndex, uint3 dispatchThreadID : SV_DispatchThreadID)
+{
+    uint slice = dispatchThreadID.z;
+    uint2 p = dispatchThreadID.xy;
+
+    // Threads past the edge still feed the cache; their stores are dropped.
+    float4 c = gFromSource ? Fetch(p, slice) : Filter(p * 2, slice);
+    gOutMip1[uint3(p, slice)] = Pack(c);
+
+    if (gNumMips == 1)
+        return;
+
+    gCache[groupIndex] = c;
+    GroupMemoryBarrierWithGroupSync();
+
+    // Even x and y within the 8x8 block.
+    if ((groupIndex & 0x9) == 0)
+    {
+        c = 0.25f * (c + gCache[groupIndex + 1] + gCache[groupIndex + 8] + gCache[groupIndex + 9]);
+        gOutMip2[uint3(p / 2, slice)] = Pack(c);
+        gCache[groupIndex] = c;
+    }
+
+    if (gNumMips == 2)
+        return;
+
+    GroupMemoryBarrierWithGroupSync();
+
+    // Multiples of four.
+    if ((groupIndex & 0x1B) == 0)
+    {
+        c = 0.25f * (c + gCache[groupIndex + 2] + gCache[groupIndex + 16] + gCache[groupIndex + 18]);
+        gOutMip3[uint3(p / 4, slice)] = Pack(c);
+        gCache[groupIndex] = c;
+    }
+
+    if (gNumMips == 3)
+        return;
+
+    GroupMemoryBarrierWithGroupSync();
+
+    if (groupIndex == 0)
+    {
+        c = 0.25f * (c + gCache[groupIndex + 4] + gCache[groupIndex + 32] + gCache[groupIndex + 36]);
+        gOutMip4[uint3(p / 8, slice)] = Pack(c);
+    }
+}
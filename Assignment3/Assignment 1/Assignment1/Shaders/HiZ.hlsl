@@ -0,0 +1,42 @@
+//***************************************************************************************
+// HiZ.hlsl
+//
+// Builds one mip of the hierarchical-Z pyramid.  Each thread writes the farthest of
+// the 2x2 source texels under its texel: the largest depth, or the smallest with
+// gReverseZ.  Mip 0 reads the depth buffer, every other mip the one before it.
+// Source reads past the edge are clamped to it, so odd sizes keep their last row and
+// column.
+//***************************************************************************************
+
+cbuffer cbHiZ : register(b0)
+{
+    uint2 gSrcSize;
+    uint2 gDstSize;
+    uint  gFromDepth;
+    uint  gReverseZ;
+};
+
+Texture2D<float> gDepth : register(t0);
+
+RWTexture2D<float> gSrcMip : register(u0);
+RWTexture2D<float> gDstMip : register(u1);
+
+float Fetch(uint2 p)
+{
+    p = min(p, gSrcSize - 1);
+    return gFromDepth ? gDepth.Load(int3(p, 0)) : gSrcMip[p];
+}
+
+[numthreads(8, 8, 1)]
+void CS(uint3 dispatchThreadID : SV_DispatchThreadID)
+{
+    if (any(dispatchThreadID.xy >= gDstSize))
+        return;
+
+    uint2 p = dispatchThreadID.xy * 2;
+    float4 depths = float4(Fetch(p), Fetch(p + uint2(1, 0)), Fetch(p + uint2(0, 1)), Fetch(p + uint2(1, 1)));
+    float depth = gReverseZ ? min(min(depths.x, depths.y), min(depths.z, depths.w))
+                            : max(max(depths.x, depths.y), max(depths.z, depths.w));
+
+    gDstMip[dispatchThreadID.xy] = depth;
+}
@@ -0,0 +1,151 @@
+//***************************************************************************************
+// Impostor.hlsl
+//
+// Draws each distant cluster as one quad textured from the frame of its atlas slices
+// nearest the eye, lit like the tree billboards from the baked normals.
+//***************************************************************************************
+
+// Defaults for number of lights.
+#ifndef NUM_DIR_LIGHTS
+    #define NUM_DIR_LIGHTS 3
+#endif
+
+#ifndef NUM_POINT_LIGHTS
+    #define NUM_POINT_LIGHTS 0
+#endif
+
+#ifndef NUM_SPOT_LIGHTS
+    #define NUM_SPOT_LIGHTS 0
+#endif
+
+// Include structures and functions for lighting.
+#include "LightingUtil.hlsl"
+#include "ImpostorFrames.hlsl"
+
+// The application's whole descriptor heap; gAtlasIndex picks the atlas.
+Texture2DArray gTextureArrayMaps[] : register(t0, space3);
+
+SamplerState gsamLinearClamp : register(s3);
+
+// Must match ImpostorInstance in the application.
+struct ImpostorInstance
+{
+    float3 CenterW;
+    float  Radius;
+    uint   Slice;
+    uint3  Pad;
+};
+
+// The impostors drawn this frame, indexed by SV_InstanceID.
+StructuredBuffer<ImpostorInstance> gImpostors : register(t1, space1);
+
+// Set per draw as root constants; gObjectIndex is unused.  The atlas holds an
+// albedo and a normal slice per cluster.
+cbuffer cbDraw : register(b0)
+{
+    uint gObjectIndex;
+    uint gAtlasIndex;
+};
+
+// See TreeSprite.hlsl.
+cbuffer cbPass : register(b1)
+{
+    float4x4 gView;
+    float4x4 gInvView;
+    float4x4 gProj;
+    float4x4 gInvProj;
+    float4x4 gViewProj;
+    float4x4 gInvViewProj;
+    float3 gEyePosW;
+    float cbPerObjectPad1;
+    float2 gRenderTargetSize;
+    float2 gInvRenderTargetSize;
+    float gNearZ;
+    float gFarZ;
+    float gTotalTime;
+    float gDeltaTime;
+};
+
+cbuffer cbScene : register(b2)
+{
+    float4 gAmbientLight;
+
+    float4 gFogColor;
+    float gFogStart;
+    float gFogRange;
+    float2 cbPerObjectPad2;
+
+    Light gLights[MaxLights];
+};
+
+// What the bake doesn't keep: the items' Fresnel reflectances are all about this.
+static const float3 gImpostorFresnelR0 = float3(0.05f, 0.05f, 0.05f);
+
+struct VertexOut
+{
+    float4 PosH : SV_POSITION;
+    float3 PosW : POSITION;
+    float2 TexC : TEXCOORD;
+    nointerpolation uint Slice : SLICE;
+};
+
+// A four-vertex triangle strip per impostor, with no vertex buffer.  The quad faces
+// along its frame's direction rather than straight at the eye, so it shows what
+// was baked.  The eye is never taken below the hemisphere the frames cover.
+VertexOut VS(uint vertexID : SV_VertexID, uint instanceID : SV_InstanceID)
+{
+    ImpostorInstance impostor = gImpostors[instanceID];
+
+    float3 toEye = gEyePosW - impostor.CenterW;
+    toEye.y = max(toEye.y, 0.0f);
+    uint2 frame = ImpostorNearestFrame(normalize(toEye));
+
+    float3 right, up, look;
+    ImpostorFrameBasis(ImpostorFrameDirection(frame), right, up, look);
+
+    // Strip order: (left, bottom), (left, top), (right, bottom), (right, top), seen
+    // from the eye.
+    float2 corner = float2((vertexID & 2) ? 1.0f : -1.0f, (vertexID & 1) ? 1.0f : -1.0f);
+    float3 posW = impostor.CenterW + impostor.Radius * (corner.x * right + corner.y * up);
+
+    VertexOut vout;
+    vout.PosH  = mul(float4(posW, 1.0f), gViewProj);
+    vout.PosW  = posW;
+    vout.TexC  = ImpostorFrameUV(frame, corner);
+    vout.Slice = impostor.Slice;
+
+    return vout;
+}
+
+float4 PS(VertexOut pin) : SV_Target
+{
+    Texture2DArray atlas = gTextureArrayMaps[gAtlasIndex];
+    float4 diffuseAlbedo = atlas.Sample(gsamLinearClamp, float3(pin.TexC, 2 * pin.Slice));
+    clip(diffuseAlbedo.a - 0.5f);
+    diffuseAlbedo.a = 1.0f;
+
+    float4 normalRoughness = atlas.Sample(gsamLinearClamp, float3(pin.TexC, 2 * pin.Slice + 1));
+    float3 normalW = normalize(normalRoughness.xyz * 2.0f - 1.0f);
+
+    // Vector from point being lit to eye.
+    float3 toEyeW = gEyePosW - pin.PosW;
+    float distToEye = length(toEyeW);
+    toEyeW /= distToEye; // normalize
+
+    float4 ambient = gAmbientLight * diffuseAlbedo;
+
+    Material mat = { diffuseAlbedo, gImpostorFresnelR0, 1.0f - normalRoughness.a };
+    float3 shadowFactor = 1.0f;
+    float4 directLight = ComputeLighting(gLights, mat, pin.PosW, normalW, toEyeW, shadowFactor);
+
+    float4 litColor = ambient + directLight;
+
+#ifdef FOG
+    float fogAmount = saturate((distToEye - gFogStart) / gFogRange);
+    litColor = lerp(litColor, gFogColor, fogAmount);
+#endif
+
+    litColor.a = 1.0f;
+
+    return litColor;
+}
@@ -0,0 +1,87 @@
+//***************************************************************************************
+// ImpostorBake.hlsl
+//
+// Renders a cluster's items into every frame of its impostor slices at once.  Each
+// item is one draw with IMPOSTOR_FRAMES^2 instances, and each instance projects the
+// item into its own frame of the atlas, so no viewports change between frames.  The
+// first target takes the albedo with full coverage in alpha, the second the world
+// normal and the roughness.
+//***************************************************************************************
+
+#include "SurfaceShading.hlsl"
+#include "ImpostorFrames.hlsl"
+
+// gObjectIndex picks the item in gInstanceData, whose World already takes it into
+// the unit sphere around its cluster.
+cbuffer cbDraw : register(b0)
+{
+    uint gObjectIndex;
+    uint gMaterialIndex;
+};
+
+// See Default.hlsl.
+struct VertexIn
+{
+    float3 PosL    : POSITION;
+#ifdef PACKED_VERTEX
+    float2 NormalL : NORMAL;
+#else
+    float3 NormalL : NORMAL;
+#endif
+    float2 TexC    : TEXCOORD;
+};
+
+struct VertexOut
+{
+    float4 PosH    : SV_POSITION;
+    float3 NormalW : NORMAL;
+    float2 TexC    : TEXCOORD;
+};
+
+struct BakeOut
+{
+    float4 Albedo          : SV_Target0;
+    float4 NormalRoughness : SV_Target1;
+};
+
+VertexOut VS(VertexIn vin, uint instanceID : SV_InstanceID)
+{
+    InstanceData instData = gInstanceData[gObjectIndex];
+
+#ifdef PACKED_VERTEX
+    float3 normalL = OctahedralDecode(vin.NormalL);
+#else
+    float3 normalL = vin.NormalL;
+#endif
+
+    float3 posC = mul(float4(vin.PosL, 1.0f), instData.World).xyz;
+
+    uint2 frame = uint2(instanceID % IMPOSTOR_FRAMES, instanceID / IMPOSTOR_FRAMES);
+    float3 right, up, look;
+    ImpostorFrameBasis(ImpostorFrameDirection(frame), right, up, look);
+
+    // The sphere fills the frame; its near side maps to depth 0 and far side to 1.
+    float2 uv = ImpostorFrameUV(frame, float2(dot(posC, right), dot(posC, up)));
+
+    VertexOut vout;
+    vout.PosH = float4(uv.x * 2.0f - 1.0f, 1.0f - uv.y * 2.0f, 0.5f + 0.5f * dot(posC, look), 1.0f);
+
+    // The cluster's space is the world's, scaled and moved.
+    vout.NormalW = mul(normalL, (float3x3)instData.World);
+
+    float4 texC = mul(float4(vin.TexC, 0.0f, 1.0f), instData.TexTransform);
+    vout.TexC = mul(texC, gMaterialData[gMaterialIndex].MatTransform).xy;
+
+    return vout;
+}
+
+BakeOut PS(VertexOut pin)
+{
+    MaterialData matData = gMaterialData[gMaterialIndex];
+    float4 diffuseAlbedo = gTextureMaps[matData.DiffuseMapIndex].Sample(gsamAnisotropicWrap, pin.TexC) * matData.DiffuseAlbedo;
+
+    BakeOut bake;
+    bake.Albedo = float4(diffuseAlbedo.rgb, 1.0f);
+    bake.NormalRoughness = float4(normalize(pin.NormalW) * 0.5f + 0.5f, matData.Roughness);
+    return bake;
+}
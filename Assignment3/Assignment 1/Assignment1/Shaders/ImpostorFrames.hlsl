@@ -0,0 +1,54 @@
+//***************************************************************************************
+// ImpostorFrames.hlsl
+//
+// The frames of an impostor atlas slice, shared by the bake and the draw.  The slice
+// is a grid of IMPOSTOR_FRAMES x IMPOSTOR_FRAMES frames, each an orthographic view of
+// the cluster's bounding sphere from a direction of the upper hemisphere.  The
+// directions are laid out hemi-octahedrally, so the frames cover the hemisphere
+// about evenly.  Must match gImpostorFrames in the application.
+//***************************************************************************************
+
+#define IMPOSTOR_FRAMES 8
+
+// Hemi-octahedral mapping between a direction with y >= 0 and [0,1]^2.
+float2 HemiOctahedralEncode(float3 d)
+{
+    float2 p = d.xz / (abs(d.x) + abs(d.y) + abs(d.z));
+    return float2(p.x + p.y, p.x - p.y) * 0.5f + 0.5f;
+}
+
+float3 HemiOctahedralDecode(float2 uv)
+{
+    float2 e = uv * 2.0f - 1.0f;
+    float2 p = float2(e.x + e.y, e.x - e.y) * 0.5f;
+    return normalize(float3(p.x, 1.0f - abs(p.x) - abs(p.y), p.y));
+}
+
+// The direction frame looks at the cluster from.
+float3 ImpostorFrameDirection(uint2 frame)
+{
+    return HemiOctahedralDecode((frame + 0.5f) / IMPOSTOR_FRAMES);
+}
+
+// The frame whose direction lies closest to d.
+uint2 ImpostorNearestFrame(float3 d)
+{
+    return (uint2)clamp(floor(HemiOctahedralEncode(d) * IMPOSTOR_FRAMES), 0.0f, IMPOSTOR_FRAMES - 1.0f);
+}
+
+// The frame's camera axes, as XMMatrixLookAtLH would build them for an eye along
+// direction looking at the centre.  Straight down the world's up would be degenerate.
+void ImpostorFrameBasis(float3 direction, out float3 right, out float3 up, out float3 look)
+{
+    look = -direction;
+    float3 reference = abs(direction.y) > 0.999f ? float3(0.0f, 0.0f, 1.0f) : float3(0.0f, 1.0f, 0.0f);
+    right = normalize(cross(reference, look));
+    up = cross(look, right);
+}
+
+// Where a point of the frame lies in the slice, from its position on the frame's
+// camera plane in multiples of the sphere's radius.
+float2 ImpostorFrameUV(uint2 frame, float2 planePos)
+{
+    return (frame + 0.5f + float2(0.5f, -0.5f) * planePos) / IMPOSTOR_FRAMES;
+}
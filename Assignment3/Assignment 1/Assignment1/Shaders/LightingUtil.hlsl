@@ -135,6 +135,8 @@ float3 ComputeSpotLight(Light L, Material mat, float3 pos, float3 normal, float3
     return BlinnPhong(lightStrength, lightVec, normal, toEye, mat);
 }
 
+#ifndef CLUSTERED_LIGHTING
+
 float4 ComputeLighting(Light gLights[MaxLights], Material mat,
                        float3 pos, float3 normal, float3 toEye,
                        float3 shadowFactor)
@@ -167,4 +169,111 @@ float4 ComputeLighting(Light gLights[MaxLights], Material mat,
     return float4(result, 0.0f);
 }
 
+#else
+
+//---------------------------------------------------------------------------------------
+// Clustered forward lighting: the directional lights still come from gLights, the
+// point and spot lights from gLocalLights, of which only those Cluster.hlsl binned
+// into the pixel's cluster are evaluated.  Must match the constants in the
+// application.
+//---------------------------------------------------------------------------------------
+
+#define CLUSTER_COUNT_X 16
+#define CLUSTER_COUNT_Y 9
+#define CLUSTER_COUNT_Z 24
+
+// Each cluster's list is its light count followed by up to MAX_LIGHTS_PER_CLUSTER
+// indices into gLocalLights.
+#define MAX_LIGHTS_PER_CLUSTER 63
+#define CLUSTER_LIST_STRIDE (MAX_LIGHTS_PER_CLUSTER + 1)
+
+struct ClusterParams
+{
+    float2 TileSize;        // in pixels
+    float SliceScale;       // slice = log(viewZ) * SliceScale - SliceBias
+    float SliceBias;
+    uint LocalLightCount;
+    uint DynamicLightCount; // the first ones, which the lightmaps leave out
+    float2 Origin;          // the view's top-left pixel in the render target
+};
+
+// Point lights have a SpotPower of zero.
+StructuredBuffer<Light> gLocalLights : register(t2, space1);
+StructuredBuffer<uint> gClusterLights : register(t3, space1);
+
+uint ClusterSlice(float viewZ, ClusterParams params)
+{
+    float slice = log(viewZ) * params.SliceScale - params.SliceBias;
+    return (uint)clamp(slice, 0.0f, CLUSTER_COUNT_Z - 1.0f);
+}
+
+// pixel is SV_Position.xy and viewZ its w.
+uint ClusterIndex(float2 pixel, float viewZ, ClusterParams params)
+{
+    uint2 tile = min(uint2((pixel - params.Origin) / params.TileSize), uint2(CLUSTER_COUNT_X - 1, CLUSTER_COUNT_Y - 1));
+    return tile.x + CLUSTER_COUNT_X * (tile.y + CLUSTER_COUNT_Y * ClusterSlice(viewZ, params));
+}
+
+float4 ComputeLighting(Light gLights[MaxLights], Material mat,
+                       float3 pos, float3 normal, float3 toEye,
+                       float3 shadowFactor, uint cluster)
+{
+    float3 result = 0.0f;
+
+    int i = 0;
+
+#if (NUM_DIR_LIGHTS > 0)
+    for(i = 0; i < NUM_DIR_LIGHTS; ++i)
+    {
+        result += shadowFactor[i] * ComputeDirectionalLight(gLights[i], mat, normal, toEye);
+    }
+#endif
+
+    uint listStart = cluster * CLUSTER_LIST_STRIDE;
+    uint count = gClusterLights[listStart];
+
+    for(uint j = 0; j < count; ++j)
+    {
+        Light L = gLocalLights[gClusterLights[listStart + 1 + j]];
+
+        if(L.SpotPower > 0.0f)
+            result += ComputeSpotLight(L, mat, pos, normal, toEye);
+        else
+            result += ComputePointLight(L, mat, pos, normal, toEye);
+    }
+
+    return float4(result, 0.0f);
+}
+
+// For a lightmapped surface, which has the static lights' diffuse term baked: the
+// directional lights and only the first dynamicLightCount local lights, those that
+// move.  They are few, so they aren't looked up through the clusters.
+float4 ComputeDynamicLighting(Light gLights[MaxLights], Material mat,
+                              float3 pos, float3 normal, float3 toEye,
+                              float3 shadowFactor, uint dynamicLightCount)
+{
+    float3 result = 0.0f;
 
+    int i = 0;
+
+#if (NUM_DIR_LIGHTS > 0)
+    for(i = 0; i < NUM_DIR_LIGHTS; ++i)
+    {
+        result += shadowFactor[i] * ComputeDirectionalLight(gLights[i], mat, normal, toEye);
+    }
+#endif
+
+    for(uint j = 0; j < dynamicLightCount; ++j)
+    {
+        Light L = gLocalLights[j];
+
+        if(L.SpotPower > 0.0f)
+            result += ComputeSpotLight(L, mat, pos, normal, toEye);
+        else
+            result += ComputePointLight(L, mat, pos, normal, toEye);
+    }
+
+    return float4(result, 0.0f);
+}
+
+#endif
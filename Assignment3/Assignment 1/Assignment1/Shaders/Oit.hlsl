@@ -0,0 +1,48 @@
+//***************************************************************************************
+// Oit.hlsl
+//
+// Composites the weighted blended transparency of Default.hlsl's WEIGHTED_OIT pixel
+// shader over the scene.  One triangle covers the view; pixels no transparent
+// surface touched are discarded, the others get the weighted average colour with an
+// alpha of 1 - revealage and are blended SRC_ALPHA / INV_SRC_ALPHA.  With MSAA the
+// targets are multisampled and the pixel shader runs per sample.
+//***************************************************************************************
+
+#ifdef MSAA
+Texture2DMS<float4> gAccumulation : register(t0);
+Texture2DMS<float>  gRevealage    : register(t1);
+#else
+Texture2D<float4> gAccumulation : register(t0);
+Texture2D<float>  gRevealage    : register(t1);
+#endif
+
+float4 VS(uint vertexID : SV_VertexID) : SV_POSITION
+{
+    float2 texC = float2((vertexID << 1) & 2, vertexID & 2);
+    return float4(texC * float2(2.0f, -2.0f) + float2(-1.0f, 1.0f), 0.0f, 1.0f);
+}
+
+#ifdef MSAA
+float4 PS(float4 posH : SV_POSITION, uint sampleIndex : SV_SampleIndex) : SV_Target
+{
+    int2 pixel = int2(posH.xy);
+    float revealage = gRevealage.Load(pixel, sampleIndex);
+    float4 accumulation = gAccumulation.Load(pixel, sampleIndex);
+#else
+float4 PS(float4 posH : SV_POSITION) : SV_Target
+{
+    int3 pixel = int3(posH.xy, 0);
+    float revealage = gRevealage.Load(pixel);
+    float4 accumulation = gAccumulation.Load(pixel);
+#endif
+
+    if (revealage >= 1.0f)
+        discard;
+
+    // Very bright sums overflow the half floats; keep them finite.
+    if (isinf(max(max(abs(accumulation.r), abs(accumulation.g)), abs(accumulation.b))))
+        accumulation.rgb = accumulation.aaa;
+
+    float3 average = accumulation.rgb / max(accumulation.a, 1e-5f);
+    return float4(average, 1.0f - revealage);
+}
@@ -0,0 +1,40 @@
+//***************************************************************************************
+// Overlay.hlsl
+//
+// Flat-coloured screen rectangles for the profiler overlay.  Each instance is one
+// bar, expanded from a four vertex triangle strip; no vertex buffer is bound.
+//***************************************************************************************
+
+struct OverlayBar
+{
+    float4 Rect;  // left, top, right, bottom in NDC
+    float4 Color;
+};
+
+StructuredBuffer<OverlayBar> gBars : register(t0);
+
+struct VertexOut
+{
+    float4 PosH  : SV_POSITION;
+    float4 Color : COLOR;
+};
+
+VertexOut VS(uint vertexID : SV_VertexID, uint instanceID : SV_InstanceID)
+{
+    OverlayBar bar = gBars[instanceID];
+
+    // Strip order: top left, top right, bottom left, bottom right.
+    float2 corner = float2(vertexID & 1, vertexID >> 1);
+
+    VertexOut vout;
+    vout.PosH = float4(lerp(bar.Rect.x, bar.Rect.z, corner.x),
+                       lerp(bar.Rect.y, bar.Rect.w, corner.y), 0.0f, 1.0f);
+    vout.Color = bar.Color;
+
+    return vout;
+}
+
+float4 PS(VertexOut pin) : SV_Target
+{
+    return pin.Color;
+}
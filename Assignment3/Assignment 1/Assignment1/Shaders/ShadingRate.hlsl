@@ -0,0 +1,95 @@
+//***************************************************************************************
+// ShadingRate.hlsl
+//
+// Builds the shading rate image, one group per tile.  The group's threads between
+// them read every pixel of the tile for the nearest depth and the darkest and
+// brightest luma of the colour, and the first thread picks the rate.
+//***************************************************************************************
+
+cbuffer cbShadingRate : register(b0)
+{
+    uint2 gDepthSize;
+    uint  gTileSize;
+    uint  gHasColor;
+    float gProjA;
+    float gProjB;
+    float gFogStart;
+    float gFogRange;
+    float gCoarse2x2Contrast;
+    float gCoarse4x4Contrast;
+    uint2 gPad;
+};
+
+Texture2D<float>  gDepth : register(t0);
+Texture2D<float4> gColor : register(t1);
+
+RWTexture2D<uint> gRateImage : register(u0);
+
+// D3D12_SHADING_RATE values.
+static const uint Rate1x1 = 0x0;
+static const uint Rate2x2 = 0x5;
+static const uint Rate4x4 = 0xA;
+
+// Non-negative floats order the same as their bits.
+groupshared uint gsNearestZ;
+groupshared uint gsMinLuma;
+groupshared uint gsMaxLuma;
+
+[numthreads(8, 8, 1)]
+void CS(uint3 groupID : SV_GroupID, uint3 groupThreadID : SV_GroupThreadID, uint groupIndex : SV_GroupIndex)
+{
+    if (groupIndex == 0)
+    {
+        gsNearestZ = asuint(1e30f);
+        gsMinLuma = asuint(1.0f);
+        gsMaxLuma = 0;
+    }
+    GroupMemoryBarrierWithGroupSync();
+
+    float nearestZ = 1e30f;
+    float minLuma = 1.0f;
+    float maxLuma = 0.0f;
+
+    uint2 tileOrigin = groupID.xy * gTileSize;
+    for (uint y = groupThreadID.y; y < gTileSize; y += 8)
+    {
+        for (uint x = groupThreadID.x; x < gTileSize; x += 8)
+        {
+            uint2 p = min(tileOrigin + uint2(x, y), gDepthSize - 1);
+
+            // Works for either depth direction; the cleared depth comes out past the
+            // fog's end either way, since the clear colour is the fog colour.
+            float viewZ = gProjB / (gDepth.Load(int3(p, 0)) - gProjA);
+            nearestZ = min(nearestZ, max(viewZ, 0.0f));
+
+            if (gHasColor)
+            {
+                float luma = dot(saturate(gColor.Load(int3(p, 0)).rgb), float3(0.299f, 0.587f, 0.114f));
+                minLuma = min(minLuma, luma);
+                maxLuma = max(maxLuma, luma);
+            }
+        }
+    }
+
+    InterlockedMin(gsNearestZ, asuint(nearestZ));
+    InterlockedMin(gsMinLuma, asuint(minLuma));
+    InterlockedMax(gsMaxLuma, asuint(maxLuma));
+    GroupMemoryBarrierWithGroupSync();
+
+    if (groupIndex != 0)
+        return;
+
+    // At most this much of the lit colour shows through the fog anywhere in the tile.
+    float fogAmount = saturate((asfloat(gsNearestZ) - gFogStart) / gFogRange);
+    float contrast = 1.0f - fogAmount;
+    if (gHasColor)
+        contrast = min(contrast, asfloat(gsMaxLuma) - asfloat(gsMinLuma));
+
+    uint rate = Rate1x1;
+    if (contrast < gCoarse4x4Contrast)
+        rate = Rate4x4;
+    else if (contrast < gCoarse2x2Contrast)
+        rate = Rate2x2;
+
+    gRateImage[groupID.xy] = rate;
+}
@@ -0,0 +1,294 @@
+//***************************************************************************************
+// SurfaceShading.hlsl
+//
+// What Default.hlsl and VisibilityResolve.hlsl have in common: the resources of the
+// main root signature, the vertex decoding and the lighting of a surface point.
+//***************************************************************************************
+
+// Defaults for number of lights.
+#ifndef NUM_DIR_LIGHTS
+    #define NUM_DIR_LIGHTS 3
+#endif
+
+#ifndef NUM_POINT_LIGHTS
+    #define NUM_POINT_LIGHTS 5
+#endif
+
+#ifndef NUM_SPOT_LIGHTS
+    #define NUM_SPOT_LIGHTS 0
+#endif
+
+// Include structures and functions for lighting.
+#include "LightingUtil.hlsl"
+
+// Every texture in the application's descriptor heap; a material picks one by
+// index.  The array textures alias the same heap through another space.
+Texture2D    gTextureMaps[]      : register(t0, space2);
+Texture2DArray gTextureArrayMaps[] : register(t0, space3);
+
+// And the depth textures through a third, for the cascaded shadow map.
+Texture2DArray<float> gShadowMaps[] : register(t0, space4);
+
+SamplerState gsamPointWrap        : register(s0);
+SamplerState gsamPointClamp       : register(s1);
+SamplerState gsamLinearWrap       : register(s2);
+SamplerState gsamLinearClamp      : register(s3);
+SamplerState gsamAnisotropicWrap  : register(s4);
+SamplerState gsamAnisotropicClamp : register(s5);
+SamplerComparisonState gsamShadow : register(s6);
+
+// LightmapScaleOffset takes the vertex's lightmap UVs into the instance's rectangle
+// of slice LightmapSlice, or LightmapSlice is NO_LIGHTMAP.
+struct InstanceData
+{
+    float4x4 World;
+    float4x4 TexTransform;
+    float4   LightmapScaleOffset;
+    uint     LightmapSlice;
+    uint3    InstancePad;
+};
+
+#define NO_LIGHTMAP 0xFFFFFFFF
+
+// Per-instance data for every batched render item.
+StructuredBuffer<InstanceData> gInstanceData : register(t0, space1);
+
+// Indices into gInstanceData of the batch's instances that survived culling.
+// The application offsets the root SRV to the batch's range, so SV_InstanceID
+// indexes it directly.  A meshlet draw points it at the meshlet lists instead and
+// gObjectIndex at its own.
+StructuredBuffer<uint> gVisibleInstances : register(t1, space1);
+
+struct MaterialData
+{
+    float4   DiffuseAlbedo;
+    float3   FresnelR0;
+    float    Roughness;
+    float4x4 MatTransform;
+    uint     DiffuseMapIndex;
+    uint     Flags;
+    uint     MatPad1;
+    uint     MatPad2;
+};
+
+// Every material, indexed by the draw's material index.
+StructuredBuffer<MaterialData> gMaterialData : register(t4, space1);
+
+// MaterialData.Flags; must match the MaterialFlag constants in FrameResource.h.
+#define MATERIAL_FLAG_WAVES 0x1
+
+// Heights of the GpuWaves solver, WAVE_COLUMNS x WAVE_ROWS row-major, laid over a
+// WAVE_GRID_SIZE square grid.  Must match gWaveColumns, gWaveRows and gWaveGridSize
+// in the application.
+#define WAVE_COLUMNS 256
+#define WAVE_ROWS 256
+#define WAVE_GRID_SIZE 100.0f
+
+StructuredBuffer<float> gWaveHeights : register(t6, space1);
+
+// Constant data that varies per pass.
+cbuffer cbPass : register(b1)
+{
+    float4x4 gView;
+    float4x4 gInvView;
+    float4x4 gProj;
+    float4x4 gInvProj;
+    float4x4 gViewProj;
+    float4x4 gInvViewProj;
+    float3 gEyePosW;
+    float cbPerObjectPad1;
+    float2 gRenderTargetSize;
+    float2 gInvRenderTargetSize;
+    float gNearZ;
+    float gFarZ;
+    float gTotalTime;
+    float gDeltaTime;
+
+    // Cascaded shadows of directional light 0; see PassConstants.
+    float4x4 gShadowTransform[4];
+    float4 gCascadeSplits;
+    uint gShadowMapIndex;
+    float gShadowTexelSize;
+    uint gLightmapIndex;
+    float cbPerObjectPad3;
+
+#ifdef CLUSTERED_LIGHTING
+    ClusterParams gCluster;
+#endif
+};
+
+// Shared by every view and only rewritten when the lights or the fog change.
+cbuffer cbScene : register(b2)
+{
+    float4 gAmbientLight;
+
+    // Allow application to change fog parameters when it needs to.
+    // For example, we may only use fog for certain times of day.
+    float4 gFogColor;
+    float gFogStart;
+    float gFogRange;
+    float2 cbPerObjectPad2;
+
+    // Indices [0, NUM_DIR_LIGHTS) are directional lights;
+    // indices [NUM_DIR_LIGHTS, NUM_DIR_LIGHTS+NUM_POINT_LIGHTS) are point lights;
+    // indices [NUM_DIR_LIGHTS+NUM_POINT_LIGHTS, NUM_DIR_LIGHTS+NUM_POINT_LIGHT+NUM_SPOT_LIGHTS)
+    // are spot lights for a maximum of MaxLights per object.  With CLUSTERED_LIGHTING
+    // only the directional lights are here; the rest are in gLocalLights.
+    Light gLights[MaxLights];
+};
+
+float3 OctahedralDecode(float2 e)
+{
+    float3 n = float3(e.x, e.y, 1.0f - abs(e.x) - abs(e.y));
+
+    // Unfold the lower hemisphere.
+    float t = saturate(-n.z);
+    n.xy += (n.xy >= 0.0f) ? -t : t;
+
+    return normalize(n);
+}
+
+float WaveHeight(int2 cell)
+{
+    cell = clamp(cell, int2(0, 0), int2(WAVE_COLUMNS - 1, WAVE_ROWS - 1));
+    return gWaveHeights[cell.y * WAVE_COLUMNS + cell.x];
+}
+
+// The grid's texture coordinates run from 0 to 1 across it, at any level of detail,
+// so they locate the vertex in the height field.  Columns run along +x and rows
+// along -z, as in GeometryGenerator::CreateGrid.
+void SampleWaves(float2 texC, out float height, out float3 normalL)
+{
+    float2 cellF = saturate(texC) * float2(WAVE_COLUMNS - 1, WAVE_ROWS - 1);
+    int2 cell = (int2)cellF;
+    float2 f = cellF - cell;
+
+    float h00 = WaveHeight(cell);
+    float h10 = WaveHeight(cell + int2(1, 0));
+    float h01 = WaveHeight(cell + int2(0, 1));
+    float h11 = WaveHeight(cell + int2(1, 1));
+    height = lerp(lerp(h00, h10, f.x), lerp(h01, h11, f.x), f.y);
+
+    // Central differences around the cell.
+    float2 spacing = WAVE_GRID_SIZE / float2(WAVE_COLUMNS - 1, WAVE_ROWS - 1);
+    float left = WaveHeight(cell - int2(1, 0));
+    float top = WaveHeight(cell - int2(0, 1));
+    normalL = normalize(float3((left - h10) / (2.0f * spacing.x), 1.0f, (h01 - top) / (2.0f * spacing.y)));
+}
+
+#define CASCADE_COUNT 4
+
+// Fraction of light 0 that reaches posW, from a 3x3 PCF of the cascade that covers
+// viewZ.  Points past the last cascade are lit.
+float CascadedShadowFactor(float3 posW, float viewZ)
+{
+    if (viewZ > gCascadeSplits[CASCADE_COUNT - 1])
+        return 1.0f;
+
+    uint cascade = 0;
+    [unroll]
+    for (uint i = 0; i < CASCADE_COUNT - 1; ++i)
+        cascade += viewZ > gCascadeSplits[i] ? 1 : 0;
+
+    // Orthographic, so w is 1.
+    float3 shadowPosT = mul(float4(posW, 1.0f), gShadowTransform[cascade]).xyz;
+
+    const float dx = gShadowTexelSize;
+    const float2 offsets[9] =
+    {
+        float2(-dx, -dx), float2(0.0f, -dx), float2(dx, -dx),
+        float2(-dx, 0.0f), float2(0.0f, 0.0f), float2(dx, 0.0f),
+        float2(-dx, +dx), float2(0.0f, +dx), float2(dx, +dx)
+    };
+
+    float percentLit = 0.0f;
+    [unroll]
+    for (int j = 0; j < 9; ++j)
+    {
+        percentLit += gShadowMaps[gShadowMapIndex].SampleCmpLevelZero(gsamShadow,
+            float3(shadowPosT.xy + offsets[j], cascade), shadowPosT.z);
+    }
+
+    return percentLit / 9.0f;
+}
+
+// The visibility buffer's texels hold the instance, plus one so that the cleared 0
+// means nothing, above the triangle of its submesh in the low bits.  Must match
+// gVisibilityTriangleBits in the application.
+#define VISIBILITY_TRIANGLE_BITS 16
+
+// Lights a point of an opaque or translucent surface, ambient, direct and fog.
+// pixel is its position in the render target and viewZ its view depth, which pick
+// the light cluster and the shadow cascade; normalW is normalized.
+float4 ShadeSurface(MaterialData matData, float4 diffuseAlbedo, float3 posW, float3 normalW,
+                    float2 pixel, float viewZ)
+{
+    // Vector from point being lit to eye. 
+    float3 toEyeW = gEyePosW - posW;
+    float distToEye = length(toEyeW);
+    toEyeW /= distToEye; // normalize
+
+    // Light terms.
+    float4 ambient = gAmbientLight * diffuseAlbedo;
+
+    const float shininess = 1.0f - matData.Roughness;
+    Material mat = { diffuseAlbedo, matData.FresnelR0, shininess };
+    float3 shadowFactor = 1.0f;
+    shadowFactor[0] = CascadedShadowFactor(posW, viewZ);
+#ifdef CLUSTERED_LIGHTING
+    uint cluster = ClusterIndex(pixel, viewZ, gCluster);
+    float4 directLight = ComputeLighting(gLights, mat, posW,
+        normalW, toEyeW, shadowFactor, cluster);
+#else
+    float4 directLight = ComputeLighting(gLights, mat, posW,
+        normalW, toEyeW, shadowFactor);
+#endif
+
+    float4 litColor = ambient + directLight;
+
+#ifdef FOG
+    float fogAmount = saturate((distToEye - gFogStart) / gFogRange);
+    litColor = lerp(litColor, gFogColor, fogAmount);
+#endif
+
+    // Common convention to take alpha from diffuse albedo.
+    litColor.a = diffuseAlbedo.a;
+
+    return litColor;
+}
+
+#ifdef CLUSTERED_LIGHTING
+// ShadeSurface for a point whose static point and spot lights are baked into the
+// lightmap: their diffuse term comes from the atlas, and only the directional and
+// the moving lights are evaluated.  The baked lights lose their highlights.
+float4 ShadeLightmappedSurface(MaterialData matData, float4 diffuseAlbedo, float3 posW, float3 normalW,
+                               float viewZ, float2 lightmapUV, uint lightmapSlice)
+{
+    float3 toEyeW = gEyePosW - posW;
+    float distToEye = length(toEyeW);
+    toEyeW /= distToEye; // normalize
+
+    float3 irradiance = gTextureArrayMaps[gLightmapIndex].Sample(gsamLinearClamp,
+        float3(lightmapUV, lightmapSlice)).rgb;
+    float4 ambient = gAmbientLight * diffuseAlbedo;
+    float4 baked = float4(irradiance * diffuseAlbedo.rgb, 0.0f);
+
+    const float shininess = 1.0f - matData.Roughness;
+    Material mat = { diffuseAlbedo, matData.FresnelR0, shininess };
+    float3 shadowFactor = 1.0f;
+    shadowFactor[0] = CascadedShadowFactor(posW, viewZ);
+    float4 directLight = ComputeDynamicLighting(gLights, mat, posW,
+        normalW, toEyeW, shadowFactor, gCluster.DynamicLightCount);
+
+    float4 litColor = ambient + baked + directLight;
+
+#ifdef FOG
+    float fogAmount = saturate((distToEye - gFogStart) / gFogRange);
+    litColor = lerp(litColor, gFogColor, fogAmount);
+#endif
+
+    litColor.a = diffuseAlbedo.a;
+
+    return litColor;
+}
+#endif
@@ -0,0 +1,79 @@
+//***************************************************************************************
+// TreeCull.hlsl
+//
+// Culls the tree billboards of every tile.  Each thread places one scene sprite in
+// one tile, tests the sphere around its quad against the camera planes and the
+// cull distance, and appends a survivor to the visible tree list.  The instance
+// count of the indirect draw arguments doubles as the list's counter.
+//***************************************************************************************
+
+struct SceneSprite
+{
+    float3 Position;
+    float2 Size;
+};
+
+struct TreeInstance
+{
+    float3 CenterW;
+    uint   Variant;
+    float2 Size;
+    uint2  Pad;
+};
+
+cbuffer cbTreeCull : register(b0)
+{
+    // Plane normals point into the frustum.
+    float4 gFrustumPlanes[6];
+    float3 gEyePosW;
+    float  gMaxDistance;
+    uint   gSpriteCount;
+    uint   gTileCount;
+};
+
+StructuredBuffer<SceneSprite> gSprites : register(t0);
+
+// World matrix of each tile's trees.
+StructuredBuffer<float4x4> gTileWorld : register(t1);
+
+RWStructuredBuffer<TreeInstance> gVisibleTrees : register(u0);
+
+// One D3D12_DRAW_ARGUMENTS.
+RWByteAddressBuffer gDrawArgs : register(u1);
+
+#define INSTANCE_COUNT_OFFSET 4
+
+// x: sprite, y: tile.
+[numthreads(64, 1, 1)]
+void CS(uint3 dispatchThreadID : SV_DispatchThreadID)
+{
+    uint sprite = dispatchThreadID.x;
+    if (sprite >= gSpriteCount)
+        return;
+
+    SceneSprite s = gSprites[sprite];
+    float3 centerW = mul(float4(s.Position, 1.0f), gTileWorld[dispatchThreadID.y]).xyz;
+
+    // The quad turns to face the eye, so bound it by the sphere through its corners.
+    float radius = 0.5f * length(s.Size);
+
+    if (distance(centerW, gEyePosW) - radius > gMaxDistance)
+        return;
+
+    [unroll]
+    for (int i = 0; i < 6; ++i)
+    {
+        if (dot(gFrustumPlanes[i].xyz, centerW) + gFrustumPlanes[i].w < -radius)
+            return;
+    }
+
+    uint slot;
+    gDrawArgs.InterlockedAdd(INSTANCE_COUNT_OFFSET, 1, slot);
+
+    TreeInstance tree;
+    tree.CenterW = centerW;
+    tree.Variant = sprite % 3;
+    tree.Size = s.Size;
+    tree.Pad = 0;
+    gVisibleTrees[slot] = tree;
+}
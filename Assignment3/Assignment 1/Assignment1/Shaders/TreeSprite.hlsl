@@ -18,7 +18,9 @@
 // Include structures and functions for lighting.
 #include "LightingUtil.hlsl"
 //step5
-Texture2DArray gTreeMapArray : register(t0);
+// The application's whole descriptor heap; the material picks the tree array by index.
+Texture2D      gTextureMaps[]      : register(t0, space2);
+Texture2DArray gTextureArrayMaps[] : register(t0, space3);
 
 //you can use dynamic indexing as well. Pay attention how we changed the sampler!
 //Texture2D gTreeMapArray[3] : register(t0);
@@ -31,11 +33,22 @@ SamplerState gsamLinearClamp      : register(s3);
 SamplerState gsamAnisotropicWrap  : register(s4);
 SamplerState gsamAnisotropicClamp : register(s5);
 
-// Constant data that varies per frame.
-cbuffer cbPerObject : register(b0)
+struct TreeInstance
 {
-    float4x4 gWorld;
-	float4x4 gTexTransform;
+    float3 CenterW;
+    uint   Variant;
+    float2 Size;
+    uint2  Pad;
+};
+
+// The trees TreeCull.hlsl kept this frame, indexed by SV_InstanceID.
+StructuredBuffer<TreeInstance> gVisibleTrees : register(t1, space1);
+
+// Set per draw as root constants.
+cbuffer cbDraw : register(b0)
+{
+    uint gObjectIndex;
+    uint gMaterialIndex;
 };
 
 // Constant data that varies per material.
@@ -55,6 +68,18 @@ cbuffer cbPass : register(b1)
     float gFarZ;
     float gTotalTime;
     float gDeltaTime;
+
+    // Cascaded shadows of directional light 0; see PassConstants.
+    float4x4 gShadowTransform[4];
+    float4 gCascadeSplits;
+    uint gShadowMapIndex;
+    float gShadowTexelSize;
+    float2 cbPerObjectPad3;
+};
+
+// See Default.hlsl.
+cbuffer cbScene : register(b2)
+{
     float4 gAmbientLight;
 
 	float4 gFogColor;
@@ -69,112 +94,68 @@ cbuffer cbPass : register(b1)
     Light gLights[MaxLights];
 };
 
-cbuffer cbMaterial : register(b2)
+struct MaterialData
 {
-	float4   gDiffuseAlbedo;
-    float3   gFresnelR0;
-    float    gRoughness;
-	float4x4 gMatTransform;
-};
- 
-struct VertexIn
-{
-	float3 PosW  : POSITION;
-	float2 SizeW : SIZE;
+    float4   DiffuseAlbedo;
+    float3   FresnelR0;
+    float    Roughness;
+    float4x4 MatTransform;
+    uint     DiffuseMapIndex;
+    uint     Flags;
+    uint     MatPad1;
+    uint     MatPad2;
 };
 
+StructuredBuffer<MaterialData> gMaterialData : register(t4, space1);
+ 
 struct VertexOut
-{
-	float3 CenterW : POSITION;
-	float2 SizeW   : SIZE;
-};
-
-struct GeoOut
 {
 	float4 PosH    : SV_POSITION;
     float3 PosW    : POSITION;
     float3 NormalW : NORMAL;
     float2 TexC    : TEXCOORD;
-    uint   PrimID  : SV_PrimitiveID;
+    nointerpolation uint Variant : VARIANT;
 };
 
-VertexOut VS(VertexIn vin)
+// Drawn as a four-vertex triangle strip per visible tree, with no vertex buffer.
+VertexOut VS(uint vertexID : SV_VertexID, uint instanceID : SV_InstanceID)
 {
-	VertexOut vout;
-
-	// Just pass data over to geometry shader.
-	vout.CenterW = vin.PosW;
-	vout.SizeW   = vin.SizeW;
+	TreeInstance tree = gVisibleTrees[instanceID];
 
-	return vout;
-}
- 
-//step4
- // We expand each point into a quad (4 vertices), so the maximum number of vertices
- // we output per geometry shader invocation is 4.
-[maxvertexcount(4)]
-void GS(point VertexOut gin[1], //PrimitiveType InputVertexType InputName[NumElements]-> one vertex for a point, two for aline, threefor atriangle, four for line with adjacency, and six for a triangle with adjacency.
-        uint primID : SV_PrimitiveID, //inout StreamOutputObject<OutputVertexType>
-        inout TriangleStream<GeoOut> triStream)  //OutputName
-{	
 	//
 	// Compute the local coordinate system of the sprite relative to the world
 	// space such that the billboard is aligned with the y-axis and faces the eye.
 	//
 
 	float3 up = float3(0.0f, 1.0f, 0.0f);
-	float3 look = gEyePosW - gin[0].CenterW;
+	float3 look = gEyePosW - tree.CenterW;
 	look.y = 0.0f; // y-axis aligned, so project to xz-plane
 	look = normalize(look);
 	float3 right = cross(up, look);
 
-	//
-	// Compute triangle strip vertices (quad) in world space.
-	//
-	float halfWidth  = 0.5f*gin[0].SizeW.x;
-	float halfHeight = 0.5f*gin[0].SizeW.y;
-	
-	float4 v[4];
-	v[0] = float4(gin[0].CenterW + halfWidth*right - halfHeight*up, 1.0f);
-	v[1] = float4(gin[0].CenterW + halfWidth*right + halfHeight*up, 1.0f);
-	v[2] = float4(gin[0].CenterW - halfWidth*right - halfHeight*up, 1.0f);
-	v[3] = float4(gin[0].CenterW - halfWidth*right + halfHeight*up, 1.0f);
+	// Strip order: (right, bottom), (right, top), (left, bottom), (left, top).
+	float2 corner = float2((vertexID & 2) ? -0.5f : 0.5f, (vertexID & 1) ? 0.5f : -0.5f);
+	float3 posW = tree.CenterW + corner.x*tree.Size.x*right + corner.y*tree.Size.y*up;
 
-	//
-	// Transform quad vertices to world space and output 
-	// them as a triangle strip.
-	//
-	
-	float2 texC[4] = 
-	{
-		float2(0.0f, 1.0f),
-		float2(0.0f, 0.0f),
-		float2(1.0f, 1.0f),
-		float2(1.0f, 0.0f)
-	};
-	
-	GeoOut gout;
-	[unroll]
-	for(int i = 0; i < 4; ++i)
-	{
-		gout.PosH     = mul(v[i], gViewProj);
-		gout.PosW     = v[i].xyz;
-		gout.NormalW  = look;
-		gout.TexC     = texC[i];
-		gout.PrimID   = primID;
-		
-		triStream.Append(gout);
-	}
+	VertexOut vout;
+	vout.PosH    = mul(float4(posW, 1.0f), gViewProj);
+	vout.PosW    = posW;
+	vout.NormalW = look;
+	vout.TexC    = float2((vertexID & 2) ? 1.0f : 0.0f, (vertexID & 1) ? 0.0f : 1.0f);
+	vout.Variant = tree.Variant;
+
+	return vout;
 }
 
 //step6
-float4 PS(GeoOut pin) : SV_Target
+float4 PS(VertexOut pin) : SV_Target
 {
-	float3 uvw = float3(pin.TexC, pin.PrimID%3);
-    float4 diffuseAlbedo = gTreeMapArray.Sample(gsamAnisotropicWrap, uvw) * gDiffuseAlbedo;
+	float3 uvw = float3(pin.TexC, pin.Variant);
+    MaterialData matData = gMaterialData[gMaterialIndex];
+    float4 diffuseAlbedo = gTextureArrayMaps[matData.DiffuseMapIndex].Sample(gsamAnisotropicWrap, uvw) * matData.DiffuseAlbedo;
 
     //using dynamic indexing
-    //float4 diffuseAlbedo = gTreeMapArray[pin.PrimID % 3].Sample(gsamAnisotropicWrap, pin.TexC) * gDiffuseAlbedo;
+    //float4 diffuseAlbedo = gTreeMapArray[pin.Variant].Sample(gsamAnisotropicWrap, pin.TexC) * gDiffuseAlbedo;
 
 	
 #ifdef ALPHA_TEST
@@ -195,8 +176,8 @@ float4 PS(GeoOut pin) : SV_Target
     // Light terms.
     float4 ambient = gAmbientLight*diffuseAlbedo;
 
-    const float shininess = 1.0f - gRoughness;
-    Material mat = { diffuseAlbedo, gFresnelR0, shininess };
+    const float shininess = 1.0f - matData.Roughness;
+    Material mat = { diffuseAlbedo, matData.FresnelR0, shininess };
     float3 shadowFactor = 1.0f;
     float4 directLight = ComputeLighting(gLights, mat, pin.PosW,
         pin.NormalW, toEyeW, shadowFactor);
@@ -0,0 +1,62 @@
+//***************************************************************************************
+// Upscale.hlsl
+//
+// Stretches the scene, rendered into the top-left corner of a window-sized target,
+// over the back buffer.  One triangle covers the screen; the pixel shader samples
+// the source bilinearly and, with gSharpness above 0, sharpens the result by how
+// much contrast the neighbourhood has left, like AMD's contrast adaptive
+// sharpening, to win back some of the detail the lower resolution lost.
+//***************************************************************************************
+
+cbuffer cbUpscale : register(b0)
+{
+    float2 gUvScale;        // back buffer uv to source uv
+    float2 gUvMax;          // the last rendered texel centre, in source uv
+    float2 gRcpSourceSize;
+    float  gSharpness;      // 0 to 1
+};
+
+Texture2D<float4> gSource : register(t0);
+
+SamplerState gsamLinearClamp : register(s0);
+
+struct VertexOut
+{
+    float4 PosH : SV_POSITION;
+    float2 TexC : TEXCOORD;
+};
+
+VertexOut VS(uint vertexID : SV_VertexID)
+{
+    VertexOut vout;
+    vout.TexC = float2((vertexID << 1) & 2, vertexID & 2);
+    vout.PosH = float4(vout.TexC * float2(2.0f, -2.0f) + float2(-1.0f, 1.0f), 0.0f, 1.0f);
+    return vout;
+}
+
+float3 Fetch(float2 uv)
+{
+    return gSource.SampleLevel(gsamLinearClamp, min(uv, gUvMax), 0.0f).rgb;
+}
+
+float4 PS(VertexOut pin) : SV_Target
+{
+    float2 uv = pin.TexC * gUvScale;
+    float3 color = Fetch(uv);
+    if (gSharpness <= 0.0f)
+        return float4(color, 1.0f);
+
+    float3 n = Fetch(uv + float2(0.0f, -gRcpSourceSize.y));
+    float3 s = Fetch(uv + float2(0.0f, gRcpSourceSize.y));
+    float3 w = Fetch(uv + float2(-gRcpSourceSize.x, 0.0f));
+    float3 e = Fetch(uv + float2(gRcpSourceSize.x, 0.0f));
+
+    // Less sharpening where the neighbourhood is already close to black or white.
+    float3 minRgb = min(color, min(min(n, s), min(w, e)));
+    float3 maxRgb = max(color, max(max(n, s), max(w, e)));
+    float3 amount = sqrt(saturate(min(minRgb, 1.0f - maxRgb) / max(maxRgb, 1e-4f)));
+
+    float3 weight = amount * (-1.0f / lerp(8.0f, 5.0f, gSharpness));
+    float3 sharpened = (color + (n + s + w + e) * weight) / (1.0f + 4.0f * weight);
+    return float4(saturate(sharpened), 1.0f);
+}
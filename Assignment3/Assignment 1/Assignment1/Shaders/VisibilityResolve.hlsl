@@ -0,0 +1,185 @@
+//***************************************************************************************
+// VisibilityResolve.hlsl
+//
+// Shades the first view's opaque layer from the visibility buffer, one thread per
+// pixel.  The texel names the instance and the triangle; the triangle's vertices
+// are fetched and transformed again, and the ray through the pixel gives the
+// barycentrics to interpolate them with.  The rays through the next pixel across
+// and down give the texture coordinate gradients the pixel shader's derivatives
+// would have.
+//***************************************************************************************
+
+#include "SurfaceShading.hlsl"
+
+// Must match InstanceCullData in FrameResource.h.
+struct InstanceCullData
+{
+    float3 Center;
+    uint   Batch;
+    float3 Extents;
+    uint   BatchStart;
+    uint   FirstMeshlet;
+    uint   MeshletCount;
+    uint   MeshletDraw;
+    uint   MaterialIndex;
+    uint   StartIndexLocation;
+    int    BaseVertexLocation;
+    uint2  CullPad;
+};
+
+StructuredBuffer<InstanceCullData> gInstanceCull : register(t7, space1);
+
+// The shape geometry's vertex and index buffers.
+ByteAddressBuffer gVertices : register(t8, space1);
+ByteAddressBuffer gIndices : register(t9, space1);
+
+Texture2D<uint> gVisibility : register(t0, space5);
+RWTexture2D<float4> gSceneColor : register(u0);
+
+cbuffer cbResolve : register(b0)
+{
+    // The view's rectangle of the render target, in pixels.
+    uint2 gViewOrigin;
+    uint2 gViewSize;
+
+    // The depth of the near plane, 1 with reverse-Z.
+    float gNearDepth;
+    uint  gIndex32;
+    uint2 gResolvePad;
+};
+
+#ifdef PACKED_VERTEX
+    #define VERTEX_STRIDE 20
+#else
+    #define VERTEX_STRIDE 32
+#endif
+
+struct SurfaceVertex
+{
+    float3 PosW;
+    float3 NormalW;
+    float2 TexC;
+};
+
+uint LoadIndex(uint i)
+{
+    if (gIndex32)
+        return gIndices.Load(i * 4);
+
+    uint pair = gIndices.Load((i * 2) & ~3u);
+    return (i & 1) ? (pair >> 16) : (pair & 0xffff);
+}
+
+// What Default.hlsl's VS computes for the vertex, before the projection.  The
+// texture coordinates are left untransformed: the transforms are affine, so they
+// can be applied after the interpolation.
+SurfaceVertex LoadVertex(uint index, InstanceData instData, MaterialData matData)
+{
+    uint address = index * VERTEX_STRIDE;
+    float3 posL = asfloat(gVertices.Load3(address));
+
+#ifdef PACKED_VERTEX
+    // Two SNORM16s and two halves, x in the low bits of each.
+    uint2 packed = gVertices.Load2(address + 12);
+    int2 normalBits = int2(packed.x << 16, packed.x) >> 16;
+    float3 normalL = OctahedralDecode(max(normalBits / 32767.0f, -1.0f));
+    float2 texC = float2(f16tof32(packed.y), f16tof32(packed.y >> 16));
+#else
+    float3 normalL = asfloat(gVertices.Load3(address + 12));
+    float2 texC = asfloat(gVertices.Load2(address + 24));
+#endif
+
+    if (matData.Flags & MATERIAL_FLAG_WAVES)
+    {
+        float height;
+        SampleWaves(texC, height, normalL);
+        posL.y += height;
+    }
+
+    SurfaceVertex v;
+    v.PosW = mul(float4(posL, 1.0f), instData.World).xyz;
+    v.NormalW = mul(normalL, (float3x3)instData.World);
+    v.TexC = texC;
+    return v;
+}
+
+// The direction from the eye through a point of the view, in render target pixels.
+float3 PixelRay(float2 pixel)
+{
+    float2 ndc = (pixel - gViewOrigin) / gViewSize * float2(2.0f, -2.0f) + float2(-1.0f, 1.0f);
+    float4 nearW = mul(float4(ndc, gNearDepth, 1.0f), gInvViewProj);
+    return normalize(nearW.xyz / nearW.w - gEyePosW);
+}
+
+// Barycentrics of the point where the ray from the eye meets the triangle's plane
+// (Moller and Trumbore), without the bounds tests: the visibility buffer already
+// says the ray hits it.
+float3 RayBarycentrics(float3 dir, SurfaceVertex v0, SurfaceVertex v1, SurfaceVertex v2)
+{
+    float3 e1 = v1.PosW - v0.PosW;
+    float3 e2 = v2.PosW - v0.PosW;
+    float3 p = cross(dir, e2);
+    float invDet = 1.0f / dot(e1, p);
+
+    float3 t = gEyePosW - v0.PosW;
+    float u = dot(t, p) * invDet;
+    float v = dot(dir, cross(t, e1)) * invDet;
+
+    return float3(1.0f - u - v, u, v);
+}
+
+float2 InterpolateTexC(float3 b, SurfaceVertex v0, SurfaceVertex v1, SurfaceVertex v2,
+                       InstanceData instData, MaterialData matData)
+{
+    float2 texC = b.x * v0.TexC + b.y * v1.TexC + b.z * v2.TexC;
+    float4 texT = mul(float4(texC, 0.0f, 1.0f), instData.TexTransform);
+    return mul(texT, matData.MatTransform).xy;
+}
+
+[numthreads(8, 8, 1)]
+void CS(uint3 dispatchThreadID : SV_DispatchThreadID)
+{
+    if (any(dispatchThreadID.xy >= gViewSize))
+        return;
+
+    uint2 pixel = gViewOrigin + dispatchThreadID.xy;
+    uint visibility = gVisibility[pixel];
+
+    // Nothing opaque there; the clear colour stays.
+    if (visibility == 0)
+        return;
+
+    uint instance = (visibility >> VISIBILITY_TRIANGLE_BITS) - 1;
+    uint primitive = visibility & ((1u << VISIBILITY_TRIANGLE_BITS) - 1);
+
+    InstanceCullData draw = gInstanceCull[instance];
+    InstanceData instData = gInstanceData[instance];
+    MaterialData matData = gMaterialData[draw.MaterialIndex];
+
+    uint firstIndex = draw.StartIndexLocation + primitive * 3;
+    SurfaceVertex v0 = LoadVertex(draw.BaseVertexLocation + LoadIndex(firstIndex), instData, matData);
+    SurfaceVertex v1 = LoadVertex(draw.BaseVertexLocation + LoadIndex(firstIndex + 1), instData, matData);
+    SurfaceVertex v2 = LoadVertex(draw.BaseVertexLocation + LoadIndex(firstIndex + 2), instData, matData);
+
+    // Where the pixel shader would have run: at the pixel's centre.
+    float2 center = pixel + 0.5f;
+    float3 b = RayBarycentrics(PixelRay(center), v0, v1, v2);
+    float3 bx = RayBarycentrics(PixelRay(center + float2(1.0f, 0.0f)), v0, v1, v2);
+    float3 by = RayBarycentrics(PixelRay(center + float2(0.0f, 1.0f)), v0, v1, v2);
+
+    float3 posW = b.x * v0.PosW + b.y * v1.PosW + b.z * v2.PosW;
+    float3 normalW = normalize(b.x * v0.NormalW + b.y * v1.NormalW + b.z * v2.NormalW);
+
+    float2 texC = InterpolateTexC(b, v0, v1, v2, instData, matData);
+    float2 texCdx = InterpolateTexC(bx, v0, v1, v2, instData, matData) - texC;
+    float2 texCdy = InterpolateTexC(by, v0, v1, v2, instData, matData) - texC;
+
+    // Neighbouring pixels may be other materials, unlike in a draw.
+    float4 diffuseAlbedo = gTextureMaps[NonUniformResourceIndex(matData.DiffuseMapIndex)].SampleGrad(
+        gsamAnisotropicWrap, texC, texCdx, texCdy) * matData.DiffuseAlbedo;
+
+    // The pixel shader's SV_Position.w.
+    float viewZ = mul(float4(posW, 1.0f), gViewProj).w;
+
+    gSceneColor[pixel] = ShadeSurface(matData, diffuseAlbedo, posW, normalW, center, viewZ);
+}
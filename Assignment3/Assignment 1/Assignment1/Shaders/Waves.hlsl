@@ -0,0 +1,56 @@
+//***************************************************************************************
+// Waves.hlsl
+//
+// One step of the wave equation solver in GpuWaves.  Each thread computes one cell's
+// next height from its previous height and the current heights around it.  Border
+// cells are held at zero.
+//***************************************************************************************
+
+cbuffer cbWaves : register(b0)
+{
+    float3 gWaveK;
+    uint   gColumns;
+    uint   gRows;
+
+    // Raises one cell by gDisturbMagnitude and its four neighbours by half that.
+    uint   gDisturbColumn;
+    uint   gDisturbRow;
+    float  gDisturbMagnitude;
+};
+
+// Row-major gColumns x gRows heights.
+StructuredBuffer<float> gPrevSolution : register(t0);
+StructuredBuffer<float> gCurrSolution : register(t1);
+
+RWStructuredBuffer<float> gNextSolution : register(u0);
+
+[numthreads(16, 16, 1)]
+void CS(uint3 dispatchThreadID : SV_DispatchThreadID)
+{
+    uint x = dispatchThreadID.x;
+    uint y = dispatchThreadID.y;
+    if (x >= gColumns || y >= gRows)
+        return;
+
+    uint i = y * gColumns + x;
+
+    if (x == 0 || y == 0 || x == gColumns - 1 || y == gRows - 1)
+    {
+        gNextSolution[i] = 0.0f;
+        return;
+    }
+
+    float next =
+        gWaveK.x * gPrevSolution[i] +
+        gWaveK.y * gCurrSolution[i] +
+        gWaveK.z * (gCurrSolution[i - gColumns] + gCurrSolution[i + gColumns] +
+                    gCurrSolution[i - 1] + gCurrSolution[i + 1]);
+
+    uint distance = abs((int)x - (int)gDisturbColumn) + abs((int)y - (int)gDisturbRow);
+    if (distance == 0)
+        next += gDisturbMagnitude;
+    else if (distance == 1)
+        next += 0.5f * gDisturbMagnitude;
+
+    gNextSolution[i] = next;
+}
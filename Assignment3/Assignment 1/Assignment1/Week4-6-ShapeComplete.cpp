@@ -2,13 +2,37 @@
  *  @brief Shape Practice Solution.
  *
  *  Place all of the scene geometry in one big vertex and index buffer.
- * Then use the DrawIndexedInstanced method to draw one object at a time ((as the
- * world matrix needs to be changed between objects)
+ * Render items that share geometry, submesh and material are grouped into
+ * batches and drawn with a single DrawIndexedInstanced call; the per-instance
+ * world matrices are read from a structured buffer.  Batched instances are
+ * frustum culled against their world-space bounds, either on the CPU or by a
+ * compute shader that fills the ExecuteIndirect arguments.  With GPU culling the
+ * opaque instances visible last frame are drawn into a depth-only pre-pass, a
+ * hierarchical-Z pyramid is built from that depth, and every instance is tested
+ * against it before the color passes.  Directional light 0 casts cascaded
+ * shadows; walls and ground are cached per cascade and only the gates are drawn
+ * into the shadow map every frame.  The tree billboards
+ * are culled on the GPU as well and drawn as instanced quads through
+ * ExecuteIndirect.  Distant clusters of the static items are drawn as a single
+ * quad each, from an atlas of views baked once the textures have streamed in.
+ * The static point and spot lights are baked into lightmaps at load, so the
+ * static items only light themselves by the sun and the camera's own lights.
+ * The water is displaced by a wave equation solved on an async
+ * compute queue, and the translucent items are either radix sorted back to front
+ * or composited with weighted blended order-independent transparency.  The
+ * player moves in fixed-rate ticks driven by raw input, swept against the maze
+ * walls, and is drawn between the last two ticks.
  *
  *   Controls:
  *   Hold down '1' key to view scene in wireframe mode.
+ *   'W', 'S', 'A', 'D', 'E' and 'Q' move forward, back, left, right, up and down.
+ *   Press 'C' to switch between CPU and GPU culling.
+ *   Press 'Z' to toggle occlusion culling.
+ *   Press 'L' to cycle how many frames the CPU may run ahead of the GPU.
+ *   Press 'V' to cycle the present mode: vsync, immediate, tearing.
+ *   Press 'T' to switch between sorted and weighted blended transparency.
  *   Hold the left mouse button down and move the mouse to rotate.
- *   Hold the right mouse button down and move the mouse to zoom in and out.
+ *   Click the right mouse button to name what is under the cursor in the debugger's output.
  *
  *  @author Hooman Salamat
  */
@@ -17,9 +41,51 @@
 #include "../../Common/d3dApp.h"
 #include "../../Common/MathHelper.h"
 #include "../../Common/UploadBuffer.h"
+#include "../../Common/UploadRingBuffer.h"
+#include "../../Common/PlacedResourceAllocator.h"
+#include "../../Common/TextureStreamer.h"
+#include "../../Common/ResidencyManager.h"
+#include "../../Common/GpuProfiler.h"
+#include "../../Common/GpuEvent.h"
+#include "../../Common/Benchmark.h"
 #include "../../Common/GeometryGenerator.h"
+#include "../../Common/MeshOptimizer.h"
+#include "../../Common/MeshletBuilder.h"
+#include "../../Common/RadixSort.h"
+#include "../../Common/MeshCache.h"
 #include "../../Common/Camera.h"
+#include "../../Common/CollisionGrid.h"
+#include "../../Common/Bvh.h"
+#include "../../Common/LightmapBaker.h"
+#include "../../Common/RawInput.h"
+#include "../../Common/DrawStateCache.h"
+#include "../../Common/ThreadPool.h"
+#include "../../Common/JobSystem.h"
+#include "../../Common/TransformStore.h"
+#include "../../Common/SceneGraph.h"
+#include "../../Common/SceneFile.h"
+#include "../../Common/ShaderLibrary.h"
+#include "../../Common/PipelineCache.h"
+#include "../../Common/FileWatcher.h"
+#include "../../Common/DescriptorAllocator.h"
+#include "../../Common/ResourceStateTracker.h"
+#include "../../Common/GpuWaves.h"
+#include "../../Common/HiZPyramid.h"
+#include "../../Common/ShadingRateImage.h"
+#include "../../Common/CascadedShadowMap.h"
+#include "../../Common/RenderGraph.h"
+#include "../../Common/DynamicResolution.h"
+#include "../../Common/TextureCooker.h"
+#include "../../Common/MipGenerator.h"
+#include "../../Common/WorldPartition.h"
 #include "FrameResource.h"
+#include <map>
+#include <set>
+#include <tuple>
+#include <functional>
+#include <atomic>
+#include <cstdlib>
+#include <new>
 
 using Microsoft::WRL::ComPtr;
 using namespace DirectX;
@@ -30,6 +96,241 @@ using namespace DirectX::PackedVector;
 
 const int gNumFrameResources = 3;
 
+// Size of the upload ring shared by all frames in flight for per-frame data.
+const UINT64 gUploadRingByteSize = 4 * 1024 * 1024;
+
+// Staging space for geometry and texture data uploaded while initializing.
+const UINT64 gStagingRingByteSize = 16 * 1024 * 1024;
+
+// Descriptors in the persistent shader-visible heap.  Shaders index it directly, so
+// it is bound once per command list and never rebuilt; a streamed texture takes a
+// new descriptor for each copy that arrives and frees the last one.
+const UINT gSrvHeapCapacity = 4096;
+
+// Views drawn each frame at most: up to gMaxPlayers split-screen players and the
+// minimap over them.  F3 cycles the players, 'M' toggles the minimap.
+const UINT gMaxPlayers = 4;
+const UINT gMaxViews = gMaxPlayers + 1;
+
+// The minimap's camera hangs this far above the first player, looking straight down,
+// and covers the top-right corner of the screen.
+const float gMinimapHeight = 60.0f;
+const XMFLOAT4 gMinimapRect = { 0.74f, 0.02f, 0.24f, 0.3f };
+
+// Number of command lists per frame resource that the worker threads record into:
+// up to gMaxOpaqueRecordJobs for the first view's opaque layer, one each for its
+// trees and translucent layer, and one for each of the other views.
+const int gMaxOpaqueRecordJobs = 4;
+const int gNumWorkerCmdLists = gMaxOpaqueRecordJobs + 2 + (gMaxViews - 1);
+
+// With GPU culling, the opaque and translucent lists replay bundles of their draws,
+// recorded again only when the batches or the pipelines change.
+const bool gLayerBundles = true;
+
+// The Transparent layer draws an item per batch, sorted back to front by the first
+// view's depth whenever its camera moves.  'T' switches to weighted blended
+// order-independent transparency instead, which needs no order, batches the items
+// again and composites two accumulation targets over each view.
+const bool gWeightedOit = false;
+const DXGI_FORMAT gOitAccumulationFormat = DXGI_FORMAT_R16G16B16A16_FLOAT;
+const DXGI_FORMAT gOitRevealageFormat = DXGI_FORMAT_R16_FLOAT;
+
+// Variable rate shading.  With Tier 2, the first view's opaque layer and trees shade
+// each screen tile at 2x2 or 4x4 where the fog and the last frame's colour leave
+// less contrast than these, and 'G' toggles it.  The water shades at
+// gWaterShadingRate on Tier 1 too.
+const bool gVariableRateShading = true;
+const float gShadingRate2x2Contrast = 0.1f;
+const float gShadingRate4x4Contrast = 0.04f;
+const D3D12_SHADING_RATE gWaterShadingRate = D3D12_SHADING_RATE_2X2;
+
+// Visibility-buffer rendering, toggled with 'I'.  The first view's opaque layer only
+// writes each pixel's instance and triangle, and one compute pass shades them, so a
+// pixel is lit once however many lights and materials the scene has.  Not with MSAA.
+// A texel holds the instance + 1 above the triangle's gVisibilityTriangleBits (which
+// must match SurfaceShading.hlsl), so 0 is nothing.
+const bool gVisibilityBuffer = false;
+const UINT gVisibilityTriangleBits = 16;
+
+// With GPU culling, opaque batches of a submesh with at least gMinBatchMeshlets
+// meshlets are drawn a meshlet at a time, and each visible instance's meshlets are
+// culled against the frustum and their normal cones first.  Smaller submeshes
+// aren't worth the extra draws.
+const bool gMeshletCulling = true;
+const UINT gMinBatchMeshlets = 4;
+
+// The player moves in ticks of gSimulationHz whatever the frame rate, and each frame
+// draws the camera between the last two.  At most gMaxTicksPerFrame run in a frame,
+// so after a stall the simulation skips ahead rather than falling further behind.
+const int gSimulationHz = 120;
+const int gMaxTicksPerFrame = 8;
+const float gWalkSpeed = 10.0f;
+
+// Detail levels generated for each tessellated primitive.  An item drops to level
+// i + 1 when its bounding sphere covers less than gLodScreenCoverage[i] of the half
+// screen height, and comes back only once it is gLodHysteresis above that again.
+const int gNumLodLevels = 4;
+const float gLodScreenCoverage[gNumLodLevels - 1] = { 0.4f, 0.15f, 0.06f };
+const float gLodHysteresis = 0.15f;
+
+// Impostors.  A tile's static opaque items are grouped into clusters on a grid of
+// gImpostorClusterSize squares, and once every texture is in, each cluster of at
+// least gImpostorMinItems items is baked into gImpostorAtlasSize slices of albedo and
+// normals, as gImpostorFrames x gImpostorFrames views over the upper hemisphere
+// (which must match ImpostorFrames.hlsl).  A cluster farther than gImpostorDistance
+// from the first camera is drawn as one quad instead of its items, and comes back
+// once it is gImpostorHysteresis nearer than that.  Items larger than a cluster, like
+// the ground, always stay geometry.
+const bool gImpostors = true;
+const float gImpostorClusterSize = 60.0f;
+const UINT gImpostorMinItems = 4;
+const UINT gImpostorFrames = 8;
+const UINT gImpostorAtlasSize = 512;
+const float gImpostorDistance = 300.0f;
+const float gImpostorHysteresis = 0.1f;
+
+// Build the shape geometry with PackedVertex instead of Vertex: 20 bytes a vertex
+// instead of 32, at the cost of a normal decode in the vertex shader.
+const bool gPackedVertices = true;
+
+// Reverse-Z: near maps to depth 1 and the far plane goes to infinity at depth 0, in a
+// D32_FLOAT depth buffer, so depth precision no longer falls off with distance.
+// gFarZ still bounds culling, the shadow cascades and the light clusters.
+const bool gReverseZ = true;
+const float gNearZ = 1.0f;
+const float gFarZ = 1000.0f;
+
+// The scene description and the binary it is compiled to on first use.  Bump
+// gSceneGeometryVersion whenever BakeShapeGeometry changes what it generates, so
+// existing binaries are rebuilt.
+const wchar_t* const gSceneDirectory = L"Scenes";
+const wchar_t* const gSceneFile = L"Scenes\\Castle.scene";
+const wchar_t* const gSceneBinaryFile = L"Scenes\\Castle.scenebin";
+const std::uint64_t gSceneGeometryVersion = 3;
+
+// The world partition.  The -grid tiles are the cells of a world streamed around the
+// camera: tiles within gCellLoadRadius are built on a worker thread and added, those
+// past gCellUnloadRadius removed, and no more than gMaxWorldCells are ever resident,
+// so the frame resources are sized for that many tiles however big the grid is.
+// Without streaming every tile is built up front.
+const bool gWorldStreaming = true;
+const float gCellLoadRadius = 350.0f;
+const float gCellUnloadRadius = 500.0f;
+const UINT gMaxWorldCells = 25;
+const UINT gMaxCellLoadsInFlight = 2;
+
+// Generated meshes, keyed by how they were made; see BakeShapeGeometry.
+const wchar_t* const gMeshCacheDirectory = L"MeshCache";
+
+// Light counts Default.hlsl is compiled with.  The point and spot light counts only
+// apply without clustered lighting.
+const int gNumDirLights = 3;
+const int gNumPointLights = 5;
+const int gNumSpotLights = 0;
+
+// Clustered forward lighting.  The point and spot lights go to a structured buffer
+// and a compute pass bins them into a grid of gClusterCountX x gClusterCountY screen
+// tiles by gClusterCountZ exponential depth slices, so each pixel only shades the
+// lights whose range reaches its cluster.  The grid must match LightingUtil.hlsl.
+const bool gClusteredLighting = true;
+const UINT gClusterCountX = 16;
+const UINT gClusterCountY = 9;
+const UINT gClusterCountZ = 24;
+const UINT gClusterCount = gClusterCountX * gClusterCountY * gClusterCountZ;
+const UINT gMaxLightsPerCluster = 63;
+const UINT gMaxLocalLights = 1024;
+
+// Lightmaps.  At load, each of the first tile's static opaque items gets a square of
+// the gLightmapAtlasSize slices, gLightmapTexelsPerUnit texels to the square root of
+// its area and between gLightmapMinRect and gLightmapMaxRect a side.  The diffuse
+// light of the point and spot lights that don't follow the camera is baked into it,
+// shadowed by the static items.  Those items then only evaluate the directional and
+// the moving lights.  The scene's lights stand on the first tile alone, so the other
+// tiles stay lit through the clusters.  Clustered lighting is what keeps the moving
+// lights apart, so the lightmaps come with it.  gLightmapChartPadding is the gutter
+// between a mesh's charts; see LightmapBaker::GenerateUVs.
+const bool gLightmaps = gClusteredLighting;
+const UINT gLightmapAtlasSize = 1024;
+const UINT gLightmapMaxSlices = 4;
+const float gLightmapTexelsPerUnit = 2.0f;
+const UINT gLightmapMinRect = 32;
+const UINT gLightmapMaxRect = 512;
+const float gLightmapChartPadding = 0.08f;
+
+// Cascaded shadow map of directional light 0: the size of each cascade and how far
+// towards the light casters outside a cascade's box still shadow it.
+const UINT gShadowMapSize = 2048;
+const float gShadowCasterDistance = 200.0f;
+
+// The water's height field, solved on the compute queue.  The columns, rows and grid
+// size must match Default.hlsl; the grid size is that of the "grid" shape.  A random
+// ripple is dropped every gWaveDisturbInterval seconds.
+const UINT gWaveColumns = 256;
+const UINT gWaveRows = 256;
+const float gWaveGridSize = 100.0f;
+const float gWaveTimeStep = 0.03f;
+const float gWaveSpeed = 2.0f;
+const float gWaveDamping = 0.2f;
+const float gWaveDisturbInterval = 0.25f;
+
+// Dynamic resolution: the GPU frame time 'R' aims for, the smallest fraction of the
+// window the scene may render at, and how much the upscale sharpens (0 to 1).
+const float gDynamicResolutionMs = 1000.0f / 60.0f;
+const float gMinRenderScale = 0.5f;
+const float gUpscaleSharpness = 0.3f;
+
+// Shader bytecode built by -compileshaders, and the cache of permutations compiled
+// at startup because no precompiled file matched.
+const wchar_t* const gPrecompiledShaderDirectory = L"Shaders\\Compiled";
+const wchar_t* const gShaderCacheDirectory = L"ShaderCache";
+
+// Watch Shaders and Scenes while running: edited shaders are recompiled in the
+// background and their pipelines swapped in, and the scene's materials and lighting
+// are read again.  Benchmark runs keep the files they started with.
+const bool gHotReload = true;
+const wchar_t* const gShaderSourceDirectory = L"Shaders";
+
+// The profiler's GPU scopes leave breadcrumbs, so a device removal can say which
+// passes of the last frame finished.  F4 writes the memory and descriptor use to the
+// debugger's output.
+const bool gGpuBreadcrumbs = true;
+
+// Recipes for the cooked textures the scene streams, run by -cooktextures and, for
+// the stale ones, at startup.
+const wchar_t* const gTextureManifest = L"../../Textures/Textures.cook";
+
+// Serialized ID3D12PipelineLibrary of every pipeline created so far.
+const wchar_t* const gPipelineLibraryFile = L"ShaderCache\\Pipelines.bin";
+
+// Don't bother splitting a layer into chunks smaller than this.
+const size_t MinBatchesPerRecordJob = 16;
+
+// Dirty object constants are written in jobs of about this many slots.
+const UINT gObjectCBChunkSize = 1024;
+
+// How far a right-click looks for something to pick, and how far the -rays
+// line-of-sight rays look for something in the way.
+const float gPickRange = 1000.0f;
+const float gLineOfSightRange = 100.0f;
+
+// Every operator new of the process, on any thread, so the profiler can show what a
+// frame allocates.  The array and nothrow forms come through here too; only the
+// over-aligned ones don't, and nothing a frame runs uses them.
+std::atomic<UINT64> gHeapAllocations{ 0 };
+
+void* operator new(std::size_t size)
+{
+	++gHeapAllocations;
+	if (void* p = std::malloc(size != 0 ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
 float rotation;
 
 // Lightweight structure stores parameters to draw a shape.  This will
@@ -38,27 +339,50 @@ struct RenderItem
 {
 	RenderItem() = default;
 
-	// World matrix of the shape that describes the object's local space
-	// relative to the world space, which defines the position, orientation,
-	// and scale of the object in the world.
-	XMFLOAT4X4 World = MathHelper::Identity4x4();
+	// Slot of the item's world and texture transforms in the app's TransformStore,
+	// which is also its index into the ObjectBuffer.  Change the transforms through the
+	// store so that every frame resource picks up the update.
+	UINT ObjCBIndex = -1;
 
-	XMFLOAT4X4 TexTransform = MathHelper::Identity4x4();
+	// Node in the app's SceneGraph that positions the item.
+	UINT SceneNode = -1;
 
-	// Dirty flag indicating the object data has changed and we need to update the constant buffer.
-	// Because we have an object cbuffer for each FrameResource, we have to apply the
-	// update to each FrameResource.  Thus, when we modify obect data we should set 
-	// NumFramesDirty = gNumFrameResources so that each frame resource gets the update.
-	int NumFramesDirty = gNumFrameResources;
+	// Index into the frame resource InstanceBuffer, or -1 if the item is not batched.
+	UINT InstanceIndex = -1;
 
-	// Index into GPU constant buffer corresponding to the ObjectCB for this render item.
-	UINT ObjCBIndex = -1;
+	// Indirect argument slot of the item's batch and the batch's first instance.
+	UINT BatchIndex = -1;
+	UINT BatchStart = -1;
+
+	// The batch's first meshlet draw, or -1 if the batch is drawn whole.
+	UINT MeshletDraw = -1;
 
 	Material* Mat = nullptr;
 	MeshGeometry* Geo = nullptr;
 
 	std::string name;
-	BoundingBox box;
+
+	// The submesh's bounds in its own space, its LOD chain if it has one and the BVH
+	// of its finest level that rays are cast against, looked up by name once when the
+	// item is made.
+	BoundingBox LocalBounds;
+	const std::array<SubmeshGeometry, gNumLodLevels>* LodChain = nullptr;
+	const MeshBvh* RayMesh = nullptr;
+
+	// World-space bounds of the item's submesh, used for frustum culling.
+	BoundingBox Bounds;
+
+	// Moves at run time, so it is drawn into the shadow map every frame rather than
+	// into the cached static cascades.
+	bool DynamicCaster = false;
+
+	// Drawn as part of its cluster's impostor, so left out of the batches.
+	bool Impostor = false;
+
+	// Where the item's lightmap UVs go in the atlas, as InstanceData has them; only
+	// the first tile's static items have a slice.
+	XMFLOAT4 LightmapScaleOffset = { 0.0f, 0.0f, 0.0f, 0.0f };
+	UINT LightmapSlice = LightmapBaker::NoSlice;
 
 	// Primitive topology.
 	D3D12_PRIMITIVE_TOPOLOGY PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
@@ -67,6 +391,45 @@ struct RenderItem
 	UINT IndexCount = 0;
 	UINT StartIndexLocation = 0;
 	int BaseVertexLocation = 0;
+
+	// The submesh's meshlets.
+	UINT FirstMeshlet = 0;
+	UINT MeshletCount = 0;
+};
+
+// Group of render items that share geometry, submesh and material.  The batch
+// is drawn with one DrawIndexedInstanced call; its instances occupy the range
+// [InstanceStart, InstanceStart + Instances.size()) of the InstanceBuffer.
+struct RenderBatch
+{
+	MeshGeometry* Geo = nullptr;
+	Material* Mat = nullptr;
+
+	D3D12_PRIMITIVE_TOPOLOGY PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+
+	UINT IndexCount = 0;
+	UINT StartIndexLocation = 0;
+	int BaseVertexLocation = 0;
+
+	UINT InstanceStart = 0;
+	std::vector<RenderItem*> Instances;
+
+	// Slot of the batch's arguments in the frame resource DrawArgs buffer.
+	UINT BatchIndex = 0;
+
+	// A batch drawn by meshlet has MeshletCount draws from MeshletDraw, each with
+	// room for all its instances in the meshlet lists from MeshletInstanceStart.
+	// MeshletCount is 0 for a batch drawn whole.
+	UINT FirstMeshlet = 0;
+	UINT MeshletCount = 0;
+	UINT MeshletDraw = 0;
+	UINT MeshletInstanceStart = 0;
+
+	// Instances that passed CPU culling this frame.
+	UINT VisibleCount = 0;
+
+	// Batches are submitted in ascending key order so consecutive draws share state.
+	UINT64 SortKey = 0;
 };
 
 enum class RenderLayer : int
@@ -77,49 +440,271 @@ enum class RenderLayer : int
 	Count
 };
 
+enum class CullMode : int
+{
+	Cpu = 0,
+	Gpu
+};
+
+// The app's pipelines; each has a PipelineCache handle in mPipelineHandles.
+enum class PipelineId : int
+{
+	Opaque = 0,
+	DepthPrepass,
+	Shadow,
+	Transparent,
+	TransparentOit,
+	Tree,
+	Cull,
+	TreeCull,
+	HiZ,
+	GenerateMips,
+	Cluster,
+	Waves,
+	Fxaa,
+	Upscale,
+	OitComposite,
+	Overlay,
+	ShadingRate,
+	Visibility,
+	VisibilityResolve,
+	Impostor,
+	ImpostorBake,
+	Count
+};
+
+// Parameters of mRootSignature, most frequently changed first.  The registers are
+// the ones Default.hlsl and TreeSprite.hlsl declare.
+enum class RootParameter : int
+{
+	DrawConstants = 0,	// b0: object and material index, set per draw
+	VisibleInstances,	// t1, space1: offset to each batch's visible list, the visible trees or the impostors
+	PassCB,				// b1
+	SceneCB,			// b2: lights, fog and ambient
+	InstanceData,		// t0, space1
+	ObjectData,			// t5, space1
+	MaterialData,		// t4, space1
+	LocalLights,		// t2, space1
+	ClusterLights,		// t3, space1
+	WaveHeights,		// t6, space1
+	Textures,			// t0, space2 and space3: the whole SRV heap
+	Count
+};
+
+// A contiguous slice of one layer that a worker thread records into its own command list.
+struct RecordJob
+{
+	RenderLayer Layer = RenderLayer::Opaque;
+	ID3D12PipelineState* PSO = nullptr;
+
+	size_t First = 0;
+	size_t Count = 0;
+
+	// The first view's layers are split over several jobs; any other view draws all
+	// of its layers in one, and ignores the fields above.
+	UINT View = 0;
+
+	// Set on the last job only: it is the one list that records transitions while
+	// the others are recorded, so mResourceStates is never used by two threads.  It
+	// also resolves the scene into the back buffer and draws the overlay.
+	bool TransitionToPresent = false;
+};
+
+// One camera's rectangle of the scene target.  View 0 is the first player's and sits
+// at the top-left of every layout; the CPU culling, the occlusion culling, the LODs,
+// the shadow cascades and the world streaming follow its camera alone.  The other
+// views are frustum culled on the GPU into their frame resource buffers.
+struct SceneView
+{
+	Camera* ViewCamera = nullptr;
+
+	// Left, top, width and height as fractions of the render area.
+	XMFLOAT4 Rect = { 0.0f, 0.0f, 1.0f, 1.0f };
+
+	// Drawn over the views before it, so it clears its rectangle first.
+	bool Overlaid = false;
+
+	// In render target pixels, from Rect and the render size.
+	D3D12_VIEWPORT Viewport = {};
+	D3D12_RECT ScissorRect = {};
+
+	// View-space frustum of the camera, rebuilt when the projection changes.
+	BoundingFrustum Frustum;
+
+	// The inverses in PassCB are only recomputed when the camera's versions move on.
+	PassConstants PassCB;
+	UINT64 PassViewVersion = 0;
+	UINT64 PassLensVersion = 0;
+	D3D12_GPU_VIRTUAL_ADDRESS PassCBAddress = 0;
+};
+
+// One distant cluster's quad: its bounding sphere and its pair of atlas slices;
+// matches Impostor.hlsl.
+struct ImpostorInstance
+{
+	XMFLOAT3 CenterW;
+	float Radius;
+	UINT Slice;
+	UINT Pad[3];
+};
+
+// One flat-coloured rectangle of the profiler overlay; matches Overlay.hlsl.
+struct OverlayBar
+{
+	XMFLOAT4 Rect;  // left, top, right, bottom in NDC
+	XMFLOAT4 Color;
+};
+
 class ShapesApp : public D3DApp
 {
 public:
-	ShapesApp(HINSTANCE hInstance);
+	ShapesApp(HINSTANCE hInstance, const BenchmarkSettings& benchmark = BenchmarkSettings());
 	ShapesApp(const ShapesApp& rhs) = delete;
 	ShapesApp& operator=(const ShapesApp& rhs) = delete;
 	~ShapesApp();
 
 	virtual bool Initialize()override;
+	virtual LRESULT MsgProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)override;
+
+	// Why the device was removed and how far the GPU got, or nothing if it wasn't.
+	std::wstring DeviceRemovedReport()const;
 
 private:
 	virtual void OnResize()override;
 	virtual void Update(const GameTimer& gt)override;
 	virtual void Draw(const GameTimer& gt)override;
-
 	virtual void OnMouseDown(WPARAM btnState, int x, int y)override;
-	virtual void OnMouseUp(WPARAM btnState, int x, int y)override;
-	virtual void OnMouseMove(WPARAM btnState, int x, int y)override;
 
-	void OnKeyboardInput(const GameTimer& gt);
+	void OnKeyboardInput();
+	float UpdateSimulation();
+	void SimulateTick(float dt);
+	bool UpdateBenchmark();
+	void FinishBenchmark();
 	void AnimateMaterials(const GameTimer& gt);
 	void UpdateObjectCBs(const GameTimer& gt);
 	void UpdateMaterialCBs(const GameTimer& gt);
 	void UpdateMainPassCB(const GameTimer& gt);
-	void Collision();
-
+	void UpdateViewPassCB(SceneView& view);
+	void UpdateSceneCB();
+	void UpdateCulling();
+	void UpdateResidency();
+	void UpdateShadowCasters();
+	XMFLOAT3 MovePlayer(XMFLOAT3 position, XMFLOAT3 motion);
+	void PushOutOfWalls(XMFLOAT3& position);
+	void UpdateLods();
+	void UpdateImpostors();
+	void BuildProfilerScopes();
+	void ReportMemoryStats();
+	void UpdateProfilerOverlay(const GameTimer& gt);
+	void DrawProfilerOverlay(ID3D12GraphicsCommandList* cmdList);
+	void SetAntiAliasing(AntiAliasing mode);
+	void SetDynamicResolution(float targetMs);
+	void UpdateRenderScale();
+	void SetViewLayout(UINT playerCount, bool minimap);
+	void UpdateViewLenses();
+	void UpdateViewRects();
+	void UpdateViewCameras();
+	void BuildSceneTargets();
+	ID3D12Resource* SceneTarget()const;
+	D3D12_CPU_DESCRIPTOR_HANDLE SceneTargetView()const;
+	void RecordSceneResolve(ID3D12GraphicsCommandList* cmdList);
+	void RecordUpscale(ID3D12GraphicsCommandList* cmdList, ID3D12Resource* source, UINT srvIndex);
+	void BuildOitTargets();
+	void BeginWeightedOit(ID3D12GraphicsCommandList* cmdList, UINT view);
+	void CompositeWeightedOit(ID3D12GraphicsCommandList* cmdList);
+	void BuildVisibilityTarget();
+	void RecordVisibilityResolve(ID3D12GraphicsCommandList* cmdList);
+
+	bool LoadScene();
+	void BakeShapeGeometry(SceneDescription& scene);
 	void LoadTextures();
+	void StreamTexture(const std::string& name, const std::wstring& filename, bool isArray);
+	void OnTextureResident(const std::string& name, const ComPtr<ID3D12Resource>& texture, bool fullResolution);
+	void BindTexture(const std::string& name, const ComPtr<ID3D12Resource>& texture, UINT64 retireFence);
+	void GenerateTextureMips(ID3D12GraphicsCommandList* cmdList);
+	void UseTexture(Material* mat, const std::string& textureName);
+	void CreateTextureSrv(ID3D12Resource* texture, bool isArray, UINT heapIndex);
 	void BuildRootSignature();
+	void BuildCullSignatures();
+	void BuildHiZSignature();
+	void BuildMipSignature();
+	void BuildOverlaySignature();
+	void BuildClusterSignature();
+	void BuildFxaaSignature();
+	void BuildUpscaleSignature();
+	void BuildOitSignature();
+	void BuildShadingRateSignature();
+	void BuildVisibilitySignature();
 	void BuildDescriptorHeaps();
 	void BuildShadersAndInputLayout();
 	void BuildShapeGeometry();
+	void BuildRayMeshes();
+	void BuildLightmapUVs();
 	void BuildTreeSpritesGeometry();
 	void BuildPSOs();
+	void SetPipeline(PipelineId id, const std::string& name, const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc);
+	void SetPipeline(PipelineId id, const std::string& name, const D3D12_COMPUTE_PIPELINE_STATE_DESC& desc);
+	bool UsesReloadedShader(const D3D12_SHADER_BYTECODE& shader)const;
+	ID3D12PipelineState* GetPipeline(PipelineId id);
+	void StartHotReload();
+	void UpdateHotReload();
+	void StartShaderReload();
+	void FinishShaderReload();
+	void SwapReloadedPipelines();
+	void ReloadScene();
 	void BuildFrameResources();
 	void BuildMaterials();
+	struct WorldCell;
 	void BuildRenderItems();
-	void DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<RenderItem*>& ritems);
-
-	std::array<const CD3DX12_STATIC_SAMPLER_DESC, 6> GetStaticSamplers();
-
-
-
-	void MakeThing(std::string name, std::string material, RenderLayer type, XMFLOAT3 objectScale, XMFLOAT3 objectPos, XMFLOAT2 textureScale, XMFLOAT3 ObjectRotation = XMFLOAT3(0,0,0));
+	void BuildImpostorClusters(const WorldCell& prototype);
+	void BuildImpostorAtlas();
+	void BuildLightmaps(const WorldCell& prototype);
+	void BuildLightmapAtlas();
+	std::unique_ptr<WorldCell> BuildWorldCell(int x, int z);
+	void CommitWorldCell(int x, int z, std::unique_ptr<WorldCell> cell);
+	void UnloadWorldCell(int x, int z);
+	void UpdateWorld();
+	void RebuildWorldColliders();
+	void CastLineOfSightRays(Ray* rays, bool* occluded);
+	void UpdateSceneGraph();
+	void UpdateCellGraph(WorldCell& cell);
+	void AnimateGates(const GameTimer& gt);
+	void SetGatePose(WorldCell& cell);
+	void BuildRenderBatches();
+	void MarkLayerDirty(RenderLayer layer);
+	void SortTransparentBatches();
+	void DrawRenderBatches(DrawStateCache& state, const std::vector<RenderBatch>& batches, size_t first, size_t count,
+		ID3D12Resource* drawArgs = nullptr, ID3D12Resource* visibleInstances = nullptr);
+	void BuildRecordJobs();
+	void RecordLayerJob(const RecordJob& job, UINT listIndex);
+	void RecordViewJob(DrawStateCache& state, UINT view);
+	void ExecuteLayerBundle(DrawStateCache& state, const RecordJob& job, UINT listIndex);
+	void BindShadingRateImage(ID3D12GraphicsCommandList* cmdList, ID3D12Resource* image);
+	void SetShadingRate(ID3D12GraphicsCommandList* cmdList, D3D12_SHADING_RATE rate);
+	void BindFrameRootArguments(DrawStateCache& state, UINT view = 0);
+	void BuildRenderGraph();
+	void RecordCullPass(ID3D12GraphicsCommandList* cmdList, CullPhase phase, UINT view,
+		ID3D12Resource* drawArgs, ID3D12Resource* visibleInstances);
+	void RecordDepthPrepass(ID3D12GraphicsCommandList* cmdList,
+		ID3D12Resource* drawArgs, ID3D12Resource* visibleInstances);
+	void RecordShadowCascades(ID3D12GraphicsCommandList* cmdList, bool dynamicCasters);
+	void AddShadowDraw(const RenderItem* ri, size_t rangeStart);
+	void DrawShadowCasters(DrawStateCache& state, size_t first, size_t last);
+	void RecordTreeCulling(ID3D12GraphicsCommandList* cmdList, UINT view);
+	void DrawTrees(DrawStateCache& state, UINT view = 0);
+	void BakeImpostors(ID3D12GraphicsCommandList* cmdList);
+	void DrawImpostors(DrawStateCache& state);
+	void RecordLightClustering(ID3D12GraphicsCommandList* cmdList, UINT view);
+	void BuildWaveSignature();
+	void BuildWaves();
+	void UpdateWaves(const GameTimer& gt);
+	void SubmitWaves();
+
+	std::array<const CD3DX12_STATIC_SAMPLER_DESC, 7> GetStaticSamplers();
+
+
+
+	void MakeThing(WorldCell& cell, std::uint32_t parentNode, const std::string& name, const std::string& material, RenderLayer type, XMFLOAT3 objectScale, XMFLOAT3 objectPos, XMFLOAT2 textureScale, XMFLOAT3 ObjectRotation = XMFLOAT3(0,0,0));
 
 private:
 
@@ -127,37 +712,609 @@ private:
 	FrameResource* mCurrFrameResource = nullptr;
 	int mCurrFrameResourceIndex = 0;
 
-	UINT mCbvSrvDescriptorSize = 0;
-
 	ComPtr<ID3D12RootSignature> mRootSignature = nullptr;
+	ComPtr<ID3D12RootSignature> mCullRootSignature = nullptr;
+	ComPtr<ID3D12RootSignature> mTreeCullRootSignature = nullptr;
+	ComPtr<ID3D12RootSignature> mHiZRootSignature = nullptr;
+	ComPtr<ID3D12RootSignature> mMipRootSignature = nullptr;
+	ComPtr<ID3D12RootSignature> mOverlayRootSignature = nullptr;
+	ComPtr<ID3D12RootSignature> mClusterRootSignature = nullptr;
+	ComPtr<ID3D12RootSignature> mWaveRootSignature = nullptr;
+	ComPtr<ID3D12RootSignature> mFxaaRootSignature = nullptr;
+	ComPtr<ID3D12RootSignature> mUpscaleRootSignature = nullptr;
+	ComPtr<ID3D12RootSignature> mOitRootSignature = nullptr;
+	ComPtr<ID3D12RootSignature> mShadingRateRootSignature = nullptr;
+	ComPtr<ID3D12RootSignature> mVisibilityRootSignature = nullptr;
+	ComPtr<ID3D12CommandSignature> mDrawIndexedSignature = nullptr;
+	ComPtr<ID3D12CommandSignature> mMeshletDrawSignature = nullptr;
+	ComPtr<ID3D12CommandSignature> mDrawSignature = nullptr;
+
+	std::unique_ptr<DescriptorAllocator> mSrvHeap;
+	UINT mPlaceholderSrvIndex = 0;
+	UINT mPlaceholderArraySrvIndex = 0;
+
+	// Geometry and textures are placed in the allocator's heaps, so it is declared
+	// ahead of them to outlive them.  Their initial data is staged in mStagingRing,
+	// which Initialize() frees once the copies have executed.
+	std::unique_ptr<PlacedResourceAllocator> mResourceAllocator;
+	std::unique_ptr<UploadRingBuffer> mStagingRing;
+	std::unique_ptr<TextureStreamer> mTextureStreamer;
+
+	// Demotes the streamed textures nothing has drawn for a while when video memory
+	// runs short.  mStreamedTextures, further down, is indexed by residency handle.
+	std::unique_ptr<ResidencyManager> mResidency;
+	std::vector<UINT> mDemoteScratch;
+	std::vector<UINT> mPromoteScratch;
+
+	// Which descriptor each streamed texture is sampled through and which materials
+	// sample it.  A copy's descriptor is written once into a fresh index, never over
+	// one that frames in flight may still read.
+	struct TextureSlot
+	{
+		UINT SrvIndex = 0;
+		bool IsArray = false;
+		std::vector<Material*> Users;
+
+		// TextureStreamer id and ResidencyManager handle.  Demoted from the request
+		// until the copy with the top mip is asked for again.
+		UINT StreamId = 0;
+		UINT ResidencyHandle = 0;
+		bool Demoted = false;
+	};
+	std::unordered_map<std::string, TextureSlot> mTextureSlots;
+	std::vector<TextureSlot*> mStreamedTextures;
 
-	ComPtr<ID3D12DescriptorHeap> mSrvDescriptorHeap = nullptr;
+	// Streamed textures whose full resolution copy came without a complete mip chain.
+	// Draw replaces each with a copy whose mips MipGenerator fills in.
+	std::unique_ptr<MipGenerator> mMipGenerator;
+	std::vector<std::string> mPendingMips;
+
+	// Textures, materials, lights, placements and the baked shape geometry.
+	SceneBinary mScene;
 
 	std::unordered_map<std::string, std::unique_ptr<MeshGeometry>> mGeometries;
 	std::unordered_map<std::string, std::unique_ptr<Material>> mMaterials;
+
+	// What the frame looks up, found once when they are built.  The water is null for
+	// a scene without one.
+	MeshGeometry* mShapeGeo = nullptr;
+	MeshGeometry* mTreeSpritesGeo = nullptr;
+	Material* mWaterMat = nullptr;
+
 	std::unordered_map<std::string, std::unique_ptr<Texture>> mTextures;
 	std::unordered_map<std::string, ComPtr<ID3DBlob>> mShaders;
-	std::unordered_map<std::string, ComPtr<ID3D12PipelineState>> mPSOs;
+
+	// The lights and environment of mScene, which a scene reload replaces.
+	std::vector<SceneLight> mLights;
+	SceneEnvironment mEnvironment;
+
+	// Which permutation each entry of mShaders is, and the key it was loaded by.
+	struct ShaderRequest
+	{
+		std::string Name;
+		std::string Program;
+		std::vector<std::string> Options;
+		std::uint64_t Key = 0;
+	};
+	std::vector<ShaderRequest> mShaderRequests;
+
+	// Kept for the reloads to compile with, and only used by one of them at a time.
+	// Declared before mTaskPool, whose destructor finishes a reload still running.
+	std::unique_ptr<ShaderLibrary> mShaderLibrary;
+
+	// A recompile running on mTaskPool.  Its requests are a copy with the new keys,
+	// and Blobs holds the bytecode of the permutations whose key changed.
+	struct ShaderReload
+	{
+		std::vector<ShaderRequest> Requests;
+		std::vector<std::pair<size_t, ComPtr<ID3DBlob>>> Blobs;
+		bool Failed = false;
+		std::atomic<bool> Done{ false };
+	};
+	std::shared_ptr<ShaderReload> mShaderReload;
+	bool mShaderReloadQueued = false;
+
+	FileWatcher mShaderWatcher;
+	FileWatcher mSceneWatcher;
+
+	// While BuildPSOs runs for a reload only the pipelines using the reloaded bytecode
+	// are created, into mPendingPipelines, and they replace mPipelineHandles' entries
+	// once all are ready.  Replaced bytecode stays alive for pipelines still being
+	// created from it.
+	bool mReloadingPipelines = false;
+	std::set<const void*> mReloadedByteCode;
+	std::vector<std::pair<PipelineId, PipelineCache::Handle>> mPendingPipelines;
+	std::vector<ComPtr<ID3DBlob>> mRetiredShaders;
 
 	std::vector<D3D12_INPUT_ELEMENT_DESC> mInputLayout;
-	std::vector<D3D12_INPUT_ELEMENT_DESC> mTreeSpriteInputLayout;
+	std::vector<D3D12_INPUT_ELEMENT_DESC> mLightmapInputLayout;
+
+	// A tile of the world and the render items on it.  BuildWorldCell makes one on
+	// mWorld's worker, positioned and with its bounds, and CommitWorldCell gives the
+	// items transform slots and adds them to the layers.  Every item hangs off a node
+	// of its cell's scene graph, whose root sits at the cell's offset; MakeThing
+	// positions are relative to the node it is given.
+	struct WorldCell : WorldPartition::CellData
+	{
+		struct Item
+		{
+			std::unique_ptr<RenderItem> Ritem;
+			RenderLayer Layer = RenderLayer::Opaque;
+			XMFLOAT4X4 TexTransform = MathHelper::Identity4x4();
+		};
+
+		XMFLOAT3 Offset = { 0.0f, 0.0f, 0.0f };
+		SceneGraph Graph;
+		std::uint32_t RootNode = SceneGraph::NoParent;
+		std::vector<Item> Items;
+		std::vector<RenderItem*> NodeItems;
+
+		// Nodes the gates move, and the maze walls in world space.
+		std::vector<std::uint32_t> DrawbridgeNodes;
+		std::vector<std::uint32_t> PortcullisNodes;
+		std::vector<BoundingBox> Walls;
+
+		// Which of mImpostorClusters the tile draws as impostors.
+		std::vector<bool> Impostors;
+	};
 
-	// List of all the render items.
-	std::vector<std::unique_ptr<RenderItem>> mAllRitems;
+	// The loaded cells own every render item.  The frame resources hold
+	// mInstanceCapacity instances and the transform store a fixed number of slots,
+	// both enough for the partition's MaxCells tiles.
+	std::unique_ptr<WorldPartition> mWorld;
+	std::map<std::pair<int, int>, std::unique_ptr<WorldCell>> mCells;
+	WorldPartition::LoadedCallback mOnCellLoaded;
+	WorldPartition::UnloadCallback mOnCellUnloaded;
+	UINT mInstanceCapacity = 0;
+	bool mWorldChanged = false;
+
+	// Transforms of every render item, and the item owning each slot.  Only the
+	// slots changed within the last gNumFrameResources frames get uploaded.  Slots
+	// of unloaded items go back on the store's free list.
+	TransformStore mTransforms{ gNumFrameResources };
+	std::vector<RenderItem*> mTransformOwners;
+
+	// Materials by MatCBIndex and the ones whose constants changed.
+	std::vector<Material*> mMaterialsByIndex;
+	DirtyList mMaterialDirty{ gNumFrameResources };
 
 	// Render items divided by PSO.
 	std::vector<RenderItem*> mRitemLayer[(int)RenderLayer::Count];
 
+	// Instanced batches built from mRitemLayer, divided by PSO.  Each batched layer
+	// has a fixed range of the instances, batches, meshlet draws and meshlet list
+	// elements, laid out by BuildRenderItems one layer after the other, so rebuilding
+	// a layer leaves the others' indices and instance data alone.  The counts are the
+	// ends of the furthest ranges in use.
+	struct BatchRange
+	{
+		UINT FirstInstance = 0;
+		UINT FirstBatch = 0;
+		UINT FirstMeshletDraw = 0;
+		UINT FirstMeshletInstance = 0;
+		UINT InstanceCapacity = 0;
+		UINT BatchCapacity = 0;
+		UINT MeshletDrawCapacity = 0;
+		UINT MeshletInstanceCapacity = 0;
+		UINT InstanceCount = 0;
+		UINT BatchCount = 0;
+		UINT MeshletDrawCount = 0;
+		UINT MeshletInstanceCount = 0;
+	};
+	std::vector<RenderBatch> mBatchLayer[(int)RenderLayer::Count];
+	BatchRange mBatchRanges[(int)RenderLayer::Count];
+	UINT mInstanceCount = 0;
+	UINT mBatchCount = 0;
+	UINT mMeshletDrawCount = 0;
+	UINT mMeshletInstanceCount = 0;
+
+	// Set when a layer's membership changes; that layer's batches are rebuilt and
+	// re-sorted at the start of the next frame.
+	bool mLayerDirty[(int)RenderLayer::Count] = {};
+
+	// Advanced whenever the batches are rebuilt or the pipelines replaced, which
+	// makes every recorded layer bundle stale.
+	UINT64 mBundleGeneration = 1;
+
+	// The Transparent batches were last sorted for this view version of the first
+	// camera; BuildRenderBatches clears mTransparentSorted.  The keys are the batches'
+	// flipped view depths over their indices.
+	UINT64 mTransparentSortVersion = 0;
+	bool mTransparentSorted = false;
+	std::vector<std::uint64_t> mTransparentSortKeys;
+	std::vector<std::uint64_t> mTransparentSortScratch;
+	std::vector<RenderBatch> mTransparentSortBatches;
+
+	// The frame resources' DrawArgs hold this many batches, enough for every LOD
+	// item to sit in a batch of its own level.  Tiles share their batches, so this
+	// doesn't grow with the tiles loaded, except for the transparent items, which
+	// are batched one by one while they are sorted.
+	UINT mBatchCapacity = 0;
+
+	// Meshlet draws and meshlet list elements after the batches' in DrawArgs and
+	// VisibleInstances: enough for every batch to be split into the meshlets of
+	// each level of its chain, and for every instance of the most tiles to sit in a
+	// batch of its finest level.
+	UINT mMeshletDrawCapacity = 0;
+	UINT mMeshletInstanceCapacity = 0;
+
+	// The shape geometry's meshlets, for the culling pass.
+	ComPtr<ID3D12Resource> mMeshletBuffer = nullptr;
+
+	// Every tile draws all of the scene's sprites, so the frame resources' visible
+	// tree lists hold this many for the most tiles that can be loaded.
+	UINT mTreeCapacity = 0;
+
+	// Submeshes of each tessellated primitive from finest to coarsest, and the
+	// items drawn with one of them.
+	std::unordered_map<std::string, std::array<SubmeshGeometry, gNumLodLevels>> mLodChains;
+	struct LodItem
+	{
+		RenderItem* Item = nullptr;
+		RenderLayer Layer = RenderLayer::Opaque;
+		const std::array<SubmeshGeometry, gNumLodLevels>* Chain = nullptr;
+		int Level = 0;
+	};
+	std::vector<LodItem> mLodItems;
+
+	// Every tile's clusters that turn into impostors far away; see gImpostors.  A
+	// cluster's sphere bounds its items in the tile's space, and Items index every
+	// tile's WorldCell::Items.  Item i of a cluster is baked by mImpostorBakeDraws[
+	// FirstBakeDraw + i], whose instance takes it into the unit sphere around the
+	// cluster.  Cluster c has the albedo at slice 2c of mImpostorAtlas and the normals
+	// at 2c + 1; once baked the atlas stays readable and isn't tracked.  The upload is
+	// this frame's list of impostors, built by UpdateImpostors.
+	struct ImpostorCluster
+	{
+		XMFLOAT3 Center = { 0.0f, 0.0f, 0.0f };
+		float Radius = 0.0f;
+		std::vector<UINT> Items;
+		UINT FirstBakeDraw = 0;
+	};
+	struct ImpostorBakeDraw
+	{
+		InstanceData Instance;
+		MeshGeometry* Geo = nullptr;
+		Material* Mat = nullptr;
+		UINT IndexCount = 0;
+		UINT StartIndexLocation = 0;
+		int BaseVertexLocation = 0;
+	};
+	std::vector<ImpostorCluster> mImpostorClusters;
+	std::vector<ImpostorBakeDraw> mImpostorBakeDraws;
+	ComPtr<ID3D12Resource> mImpostorAtlas;
+	ComPtr<ID3D12Resource> mImpostorDepth;
+	ComPtr<ID3D12DescriptorHeap> mImpostorRtvHeap;
+	ComPtr<ID3D12DescriptorHeap> mImpostorDsvHeap;
+	UINT mImpostorSrvIndex = 0;
+	bool mImpostorsBaked = false;
+	UploadRingBuffer::Allocation mImpostorUpload;
+	UINT mImpostorCount = 0;
+
+	// The lightmaps; see gLightmaps.  mLightmapMeshes holds every shape submesh's
+	// vertices, keyed by its StartIndexLocation, until the bake is done with them;
+	// meshes whose UVs couldn't be laid out aren't Valid.  mLightmapItems is what the
+	// bake gave each of the prototype tile's items, by its index, and what the first
+	// tile's copies take.  The atlas stays readable once uploaded.
+	struct LightmapMesh
+	{
+		std::vector<XMFLOAT3> Positions;
+		std::vector<XMFLOAT3> Normals;
+		std::vector<XMFLOAT2> UVs;
+		std::vector<std::uint32_t> Indices;
+		bool Valid = false;
+	};
+	struct LightmapItem
+	{
+		XMFLOAT4 ScaleOffset = { 0.0f, 0.0f, 0.0f, 0.0f };
+		UINT Slice = LightmapBaker::NoSlice;
+	};
+	std::map<UINT, LightmapMesh> mLightmapMeshes;
+	std::unique_ptr<LightmapBaker> mLightmapBaker;
+	std::vector<LightmapItem> mLightmapItems;
+	ComPtr<ID3D12Resource> mLightmapAtlas;
+	ComPtr<ID3D12Resource> mLightmapUploadBuffer;
+	UINT mLightmapSrvIndex = 0;
+
+	// What every view's pass constants share: the times, the shadow cascades and the
+	// clusters' depth slices and light count.  UpdateViewPassCB adds the camera's.
 	PassConstants mMainPassCB;
 
+	// One buffer for every frame in flight: the queue runs the frames in order, and
+	// the copy's barrier waits for the reads of the frames before.  mSceneCBPending
+	// says mSceneCBUpload has a copy this frame's list has yet to make.
+	SceneConstants mSceneCB;
+	ComPtr<ID3D12Resource> mSceneCBBuffer;
+	UploadRingBuffer::Allocation mSceneCBUpload;
+	bool mSceneCBDirty = true;
+	bool mSceneCBPending = false;
+	bool mSceneCBFollowsCamera = false;
+	XMFLOAT3 mSceneCBEyePos = { 0.0f, 0.0f, 0.0f };
+
+	// Per-frame constants and lists are sub-allocated from the ring, which
+	// recycles the space once the frame's fence has passed.
+	std::unique_ptr<UploadRingBuffer> mUploadRing;
+
+	// States of the back buffers, the depth buffer and the frame resources' default
+	// buffers, in the order the frame's lists record them.
+	ResourceStateTracker mResourceStates;
+
+	// The main list's passes, rebuilt every frame by BuildRenderGraph.  Owns the
+	// transients: the pre-pass culling results and the Hi-Z pyramid.
+	std::unique_ptr<RenderGraph> mRenderGraph;
+	UploadRingBuffer::Allocation mVisibleInstanceUpload;
+	UploadRingBuffer::Allocation mDrawArgsUpload;
+	UINT64 mDrawArgsResetBytes = 0;
+	UploadRingBuffer::Allocation mTreeDrawArgsUpload;
+	UploadRingBuffer::Allocation mTreeTileUpload;
+	UploadRingBuffer::Allocation mLocalLightUpload;
+
+	// The wave solver runs on its own queue, overlapping the direct queue's work up to
+	// the translucent list, which draws the water and waits for it.  mComputeStates
+	// tracks the height buffers on that queue.
+	ComPtr<ID3D12CommandQueue> mComputeQueue;
+	ComPtr<ID3D12GraphicsCommandList> mComputeCmdList;
+	ComPtr<ID3D12Fence> mComputeFence;
+	UINT64 mComputeFenceValue = 0;
+	ResourceStateTracker mComputeStates;
+	std::unique_ptr<GpuWaves> mWaves;
+	UINT mWaveSteps = 0;
+	float mNextWaveDisturbTime = 0.0f;
+
+	// Runs the per-frame jobs: the update graph and the command list recording.  The
+	// main thread works through them too while it waits.
+	std::unique_ptr<JobSystem> mJobs;
+	std::vector<RecordJob> mRecordJobs;
+	size_t mWaterRecordJob = 0;
+	std::vector<ID3D12CommandList*> mSubmitLists;
+
+	// Threads for the longer tasks that aren't part of a frame: shape baking and
+	// pipeline compiles.
+	std::unique_ptr<ThreadPool> mTaskPool;
+
+	// Created on mTaskPool while the rest of Initialize runs, and loaded from the
+	// pipeline library on later runs.  Declared after the pool so that it is
+	// destroyed first, waiting for its tasks.
+	std::unique_ptr<PipelineCache> mPipelines;
+	PipelineCache::Handle mPipelineHandles[(int)PipelineId::Count] = {};
+
 	Camera mCamera;
 	BoundingBox player;
 
-
-	POINT mLastMousePos;
-	UINT objectIndexnumber = 0;
+	// Keyboard and mouse of the first player, read through WM_INPUT.  mSimTime is the
+	// QueryPerformanceCounter time simulated up to, and the camera is placed between
+	// mPrevSimPosition and mSimPosition, the positions after the last two ticks.
+	RawInput mRawInput;
+	std::int64_t mSimTime = 0;
+	XMFLOAT3 mPrevSimPosition = { 0.0f, 0.0f, 0.0f };
+	XMFLOAT3 mSimPosition = { 0.0f, 0.0f, 0.0f };
+
+	// The views of the layout SetViewLayout picked, view 0 through mCamera.  The other
+	// players stand where the first one was when they joined, and the minimap looks
+	// straight down on the first player from gMinimapHeight.
+	std::vector<SceneView> mViews;
+	Camera mPlayerCameras[gMaxPlayers - 1];
+	Camera mMinimapCamera;
+	UINT mPlayerCount = 0;
+	bool mShowMinimap = false;
+	bool mPlayersKeyDown = false;
+	bool mMinimapKeyDown = false;
+
+	// Maze walls, built once after the render items.  Every tick sweeps the player's
+	// box along its motion so fast moves still stop at the walls in between.
+	CollisionGrid mCollisionGrid;
+	std::vector<std::uint32_t> mCollisionCandidates;
+
+	// BVHs of the shape submeshes, built with the geometry, and one over the static
+	// items of the loaded tiles, rebuilt with the collision grid.  A hit's user id
+	// indexes mRayItems.
+	std::unordered_map<std::string, std::unique_ptr<MeshBvh>> mRayMeshes;
+	SceneBvh mRayScene;
+	std::vector<const RenderItem*> mRayItems;
+
+	// 'C' toggles the culling of the first view; the others always cull on the GPU.
+	CullMode mCullMode = CullMode::Gpu;
+	bool mCullKeyDown = false;
+
+	// Occlusion culling against the Hi-Z pyramid of a depth pre-pass, GPU culling
+	// only.  mVisibleLastFrame holds a flag per instance for the next frame's
+	// pre-pass; 'Z' toggles it.  Not available with 4X MSAA.
+	std::unique_ptr<HiZPyramid> mHiZ;
+	ComPtr<ID3D12Resource> mVisibleLastFrame;
+	bool mOcclusionCulling = true;
+	bool mOcclusionKeyDown = false;
+
+	// F2 cycles the anti-aliasing.  Msaa4x draws into D3DApp's MSAA target and depth
+	// buffer and resolves into the back buffer; Fxaa draws into mSceneColor and
+	// filters it into mFxaaOutput, which is copied to the back buffer.  The scene's
+	// PSOs are built for mPsoSampleCount and rebuilt when it changes.
+	AntiAliasing mAntiAliasing = AntiAliasing::None;
+	bool mAntiAliasingKeyDown = false;
+	UINT mPsoSampleCount = 0;
+	ComPtr<ID3D12Resource> mSceneColor;
+	ComPtr<ID3D12Resource> mFxaaOutput;
+	ComPtr<ID3D12DescriptorHeap> mSceneRtvHeap;
+	UINT mSceneSrvIndex = 0;
+	UINT mFxaaSrvIndex = 0;
+	UINT mFxaaUavIndex = 0;
+
+	// 'T' toggles weighted blended transparency.  mOitTargets are the accumulation and
+	// revealage targets, window-sized with the scene's sample count, and only exist
+	// while it is on.
+	bool mWeightedOit = gWeightedOit;
+	bool mOitKeyDown = false;
+	ComPtr<ID3D12Resource> mOitTargets[2];
+	ComPtr<ID3D12DescriptorHeap> mOitRtvHeap;
+	UINT mOitSrvIndex[2] = {};
+
+	// 'G' toggles variable rate shading.  mShadingRateImageThisFrame says whether the
+	// render graph built an image for the first view's lists to bind.
+	std::unique_ptr<ShadingRateImage> mShadingRate;
+	bool mVariableRateShading = gVariableRateShading;
+	bool mVrsKeyDown = false;
+	bool mShadingRateImageThisFrame = false;
+
+	// 'I' toggles visibility-buffer rendering.  mVisibilityTarget is window-sized and
+	// only exists while it is on without MSAA, and then mSceneColor is a UAV the
+	// resolve writes through mSceneUavIndex.  mVisibilitySupported says whether the
+	// instance and triangle counts fit the texel's bits.  mVisibilityThisFrame says
+	// whether the render graph chose the path for this frame's lists.
+	bool mVisibilityRendering = gVisibilityBuffer;
+	bool mVisibilityKeyDown = false;
+	bool mVisibilitySupported = false;
+	bool mVisibilityThisFrame = false;
+	ComPtr<ID3D12Resource> mVisibilityTarget;
+	ComPtr<ID3D12DescriptorHeap> mVisibilityRtvHeap;
+	UINT mVisibilitySrvIndex = 0;
+	UINT mSceneUavIndex = 0;
+
+	// 'R' toggles dynamic resolution.  The scene renders into the mRenderWidth x
+	// mRenderHeight corner of its target, through the views' viewports, and is
+	// stretched over the back buffer; that needs mSceneColor even without FXAA.  The
+	// scale follows the frame scope's GPU time.
+	DynamicResolution mDynamicResolution{ gMinRenderScale };
+	bool mDynamicResolutionKeyDown = false;
+	UINT mRenderWidth = 0;
+	UINT mRenderHeight = 0;
+
+	// Light 0's shadow map.  Each frame UpdateShadowCasters culls the static casters
+	// of the cascades being re-rendered and the dynamic casters of every cascade into
+	// mShadowDraws, whose instances go to mShadowInstanceUpload.
+	struct ShadowDraw
+	{
+		const RenderItem* Item = nullptr;
+		UINT FirstInstance = 0;
+		UINT InstanceCount = 0;
+	};
+	std::unique_ptr<CascadedShadowMap> mShadowMap;
+	std::vector<RenderItem*> mDynamicCasters;
+	std::vector<ShadowDraw> mShadowDraws;
+	std::vector<UINT> mShadowInstances;
+	size_t mStaticShadowDraws[CascadedShadowMap::CascadeCount + 1] = {};
+	size_t mDynamicShadowDraws[CascadedShadowMap::CascadeCount + 1] = {};
+	D3D12_GPU_VIRTUAL_ADDRESS mShadowPassCBAddress[CascadedShadowMap::CascadeCount] = {};
+	UploadRingBuffer::Allocation mShadowInstanceUpload;
+
+	// Timestamps around each part of Draw and timers around the heavy parts of Update.
+	std::unique_ptr<GpuProfiler> mProfiler;
+	UINT mFrameGpuScope = 0;
+	UINT mClearGpuScope = 0;
+	UINT mCullGpuScope = 0;
+	UINT mPrepassGpuScope = 0;
+	UINT mHiZGpuScope = 0;
+	UINT mShadingRateGpuScope = 0;
+	UINT mVisibilityResolveGpuScope = 0;
+	UINT mShadowGpuScope = 0;
+	UINT mTreeCullGpuScope = 0;
+	UINT mLightsGpuScope = 0;
+	UINT mOpaqueGpuScope = 0;
+	UINT mTreeGpuScope = 0;
+	UINT mTransparentGpuScope = 0;
+	UINT mViewCullGpuScope = 0;
+	UINT mViewsGpuScope = 0;
+	UINT mAntiAliasGpuScope = 0;
+	UINT mUpscaleGpuScope = 0;
+	UINT mOverlayGpuScope = 0;
+	UINT mUpdateCpuScope = 0;
+	UINT mObjectCBCpuScope = 0;
+	UINT mSimulationCpuScope = 0;
+	UINT mRecordCpuScope = 0;
+	UINT mGpuWaitCpuScope = 0;
+	UINT mRayCpuScope = 0;
+
+	// Heap allocations from the start of Update to the end of Draw.
+	UINT mAllocationCounter = 0;
+	UINT64 mFrameAllocationStart = 0;
+
+	// 'L' cycles the frames in flight from gNumFrameResources down to 1 and back,
+	// 'V' cycles the present mode.
+	bool mLatencyKeyDown = false;
+	bool mPresentModeKeyDown = false;
+
+	// 'O' toggles the bar overlay, 'P' starts and stops writing profile.csv.
+	bool mShowOverlay = true;
+	bool mOverlayKeyDown = false;
+	bool mCsvKeyDown = false;
+	bool mMemoryReportKeyDown = false;
+	UploadRingBuffer::Allocation mOverlayBars;
+	UINT mOverlayBarCount = 0;
+	std::vector<OverlayBar> mOverlayScratch;
+	float mNextCaptionTime = 0.0f;
+
+	// -benchmark: wait for the textures, warm up, then fly the camera path for a
+	// fixed number of fixed-length frames while logging every frame's timings.
+	enum class BenchmarkPhase { Loading, Warmup, Running, Done };
+	BenchmarkSettings mBenchmark;
+	BenchmarkPhase mBenchmarkPhase = BenchmarkPhase::Loading;
+	CameraPath mBenchmarkPath;
+	BenchmarkLog mBenchmarkLog;
+	UINT mBenchmarkFrame = 0;
+	UINT64 mBenchmarkFirstFrame = 0;
+	UINT64 mFrameNumber = 0;
+
+	// 'B' raises and lowers every tile's drawbridge and portcullis together.
+	bool mGatesRaised = false;
+	bool mGateKeyDown = false;
+	float mGateAmount = 0.0f;
 };
 
+// Every shader the app uses and the options it may be built with.  Shared by
+// BuildShadersAndInputLayout and -compileshaders, which builds all permutations.
+static void AddShaderPrograms(ShaderLibrary& shaders)
+{
+	const std::vector<ShaderDefine> lightCounts =
+	{
+		{ "NUM_DIR_LIGHTS", std::to_string(gNumDirLights) },
+		{ "NUM_POINT_LIGHTS", std::to_string(gNumPointLights) },
+		{ "NUM_SPOT_LIGHTS", std::to_string(gNumSpotLights) },
+	};
+
+	shaders.AddProgram("standardVS", L"Shaders\\Default.hlsl", "VS", "vs_5_1", {}, { "PACKED_VERTEX", "VISIBILITY", "LIGHTMAP" });
+	shaders.AddProgram("opaquePS", L"Shaders\\Default.hlsl", "PS", "ps_5_1", lightCounts,
+		{ "FOG", "ALPHA_TEST", "CLUSTERED_LIGHTING", "WEIGHTED_OIT", "LIGHTMAP" });
+	shaders.AddProgram("visibilityPS", L"Shaders\\Default.hlsl", "VisibilityPS", "ps_5_1", { { "VISIBILITY" } });
+	shaders.AddProgram("visibilityResolveCS", L"Shaders\\VisibilityResolve.hlsl", "CS", "cs_5_1", lightCounts,
+		{ "FOG", "CLUSTERED_LIGHTING", "PACKED_VERTEX" });
+
+	shaders.AddProgram("treeSpriteVS", L"Shaders\\TreeSprite.hlsl", "VS", "vs_5_1");
+	shaders.AddProgram("treeSpritePS", L"Shaders\\TreeSprite.hlsl", "PS", "ps_5_1", {}, { "FOG", "ALPHA_TEST" });
+
+	shaders.AddProgram("impostorVS", L"Shaders\\Impostor.hlsl", "VS", "vs_5_1");
+	shaders.AddProgram("impostorPS", L"Shaders\\Impostor.hlsl", "PS", "ps_5_1", {}, { "FOG" });
+	shaders.AddProgram("impostorBakeVS", L"Shaders\\ImpostorBake.hlsl", "VS", "vs_5_1", {}, { "PACKED_VERTEX" });
+	shaders.AddProgram("impostorBakePS", L"Shaders\\ImpostorBake.hlsl", "PS", "ps_5_1");
+
+	shaders.AddProgram("cullCS", L"Shaders\\Cull.hlsl", "CS", "cs_5_1");
+	shaders.AddProgram("treeCullCS", L"Shaders\\TreeCull.hlsl", "CS", "cs_5_1");
+	shaders.AddProgram("hizCS", L"Shaders\\HiZ.hlsl", "CS", "cs_5_1");
+	shaders.AddProgram("shadingRateCS", L"Shaders\\ShadingRate.hlsl", "CS", "cs_5_1");
+	shaders.AddProgram("mipsCS", L"Shaders\\GenerateMips.hlsl", "CS", "cs_5_1");
+	shaders.AddProgram("clusterCS", L"Shaders\\Cluster.hlsl", "CS", "cs_5_1");
+	shaders.AddProgram("wavesCS", L"Shaders\\Waves.hlsl", "CS", "cs_5_1");
+	shaders.AddProgram("fxaaCS", L"Shaders\\Fxaa.hlsl", "CS", "cs_5_1");
+	shaders.AddProgram("upscaleVS", L"Shaders\\Upscale.hlsl", "VS", "vs_5_1");
+	shaders.AddProgram("upscalePS", L"Shaders\\Upscale.hlsl", "PS", "ps_5_1");
+	shaders.AddProgram("oitCompositeVS", L"Shaders\\Oit.hlsl", "VS", "vs_5_1");
+	shaders.AddProgram("oitCompositePS", L"Shaders\\Oit.hlsl", "PS", "ps_5_1", {}, { "MSAA" });
+
+	shaders.AddProgram("overlayVS", L"Shaders\\Overlay.hlsl", "VS", "vs_5_1");
+	shaders.AddProgram("overlayPS", L"Shaders\\Overlay.hlsl", "PS", "ps_5_1");
+}
+
+// Cooks the recipes in gTextureManifest, all of them or only the stale ones.  Adds a
+// line to errors for each failure.
+static UINT CookTextures(bool force, std::wstring& errors)
+{
+	TextureCooker cooker;
+	std::string error;
+	if (!cooker.LoadManifest(gTextureManifest, error))
+	{
+		errors += std::wstring(gTextureManifest) + L", " + AnsiToWString(error) + L"\n";
+		return 0;
+	}
+	return cooker.Cook(force, errors);
+}
+
 int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE prevInstance,
 	PSTR cmdLine, int showCmd)
 {
@@ -166,13 +1323,56 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE prevInstance,
 	_CrtSetDbgFlag(_CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF);
 #endif
 
+	// Offline build step: compile every shader permutation and exit, no window needed.
+	if (std::string(cmdLine) == "-compileshaders")
+	{
+		try
+		{
+			ShaderLibrary shaders(gPrecompiledShaderDirectory, gShaderCacheDirectory);
+			AddShaderPrograms(shaders);
+			shaders.CompileAll();
+		}
+		catch (DxException& e)
+		{
+			MessageBox(nullptr, e.ToString().c_str(), L"Shader compilation failed", MB_OK);
+		}
+		return 0;
+	}
+
+	// Offline build step: cook every texture in the manifest and exit.
+	if (std::string(cmdLine) == "-cooktextures")
+	{
+		std::wstring errors;
+		CookTextures(true, errors);
+		if (!errors.empty())
+			MessageBox(nullptr, errors.c_str(), L"Texture cooking failed", MB_OK);
+		return 0;
+	}
+
+	BenchmarkSettings benchmark;
+	if (!ParseBenchmarkSettings(cmdLine, benchmark))
+	{
+		MessageBox(nullptr, L"Usage: [-benchmark] [-frames N] [-warmup N] [-dt seconds] [-nopresent] [-presentmode vsync|immediate|tearing] [-aa none|msaa4x|fxaa] [-dynres ms] [-out file] [-grid N M] [-latency N] [-config file]",
+			L"Bad command line", MB_OK);
+		return 0;
+	}
+
 	try
 	{
-		ShapesApp theApp(hInstance);
-		if (!theApp.Initialize())
-			return 0;
+		ShapesApp theApp(hInstance, benchmark);
+		try
+		{
+			if (!theApp.Initialize())
+				return 0;
 
-		return theApp.Run();
+			return theApp.Run();
+		}
+		catch (DxException& e)
+		{
+			// The HRESULT alone doesn't say which pass the GPU was in.
+			MessageBox(nullptr, (e.ToString() + theApp.DeviceRemovedReport()).c_str(), L"HR Failed", MB_OK);
+			return 0;
+		}
 	}
 	catch (DxException& e)
 	{
@@ -181,9 +1381,24 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE prevInstance,
 	}
 }
 
-ShapesApp::ShapesApp(HINSTANCE hInstance)
-	: D3DApp(hInstance)
+ShapesApp::ShapesApp(HINSTANCE hInstance, const BenchmarkSettings& benchmark)
+	: D3DApp(hInstance), mBenchmark(benchmark)
 {
+	// A benchmark keeps running while another window has focus.
+	mPauseWhenInactive = !mBenchmark.Enabled;
+
+	mMaxFramesInFlight = gNumFrameResources;
+
+	// Nothing uses the stencil, so reverse-Z takes the 32-bit float depth on its own.
+	mReverseZ = gReverseZ;
+	if (mReverseZ)
+		mDepthStencilFormat = DXGI_FORMAT_D32_FLOAT;
+	mCamera.SetReverseZ(mReverseZ);
+	for (Camera& camera : mPlayerCameras)
+		camera.SetReverseZ(mReverseZ);
+	mMinimapCamera.SetReverseZ(mReverseZ);
+
+	SetViewLayout(1, false);
 }
 
 ShapesApp::~ShapesApp()
@@ -200,25 +1415,104 @@ bool ShapesApp::Initialize()
 	// Reset the command list to prep for initialization commands.
 	ThrowIfFailed(mCommandList->Reset(mDirectCmdListAlloc.Get(), nullptr));
 
-	// Get the increment size of a descriptor in this heap type.  This is hardware specific, 
-	// so we have to query this information.
-	mCbvSrvDescriptorSize = md3dDevice->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+	// Never use more threads than there are command lists to record.
+	unsigned int cores = std::thread::hardware_concurrency();
+	mTaskPool = std::make_unique<ThreadPool>(MathHelper::Clamp<unsigned int>(cores > 1 ? cores - 1 : 1, 1, gNumWorkerCmdLists));
+	mJobs = std::make_unique<JobSystem>();
 
 	mCamera.SetPosition(0.0f, 3.0f, -150.0f);
 
 	player.Center = mCamera.GetPosition3f();
 	player.Extents = XMFLOAT3(1.5f, 0.6f, 1.5f);
+	mSimPosition = player.Center;
+	mPrevSimPosition = player.Center;
+
+	mRawInput.Register(mhMainWnd);
+
+	mResourceAllocator = std::make_unique<PlacedResourceAllocator>(md3dDevice.Get());
+	mStagingRing = std::make_unique<UploadRingBuffer>(md3dDevice.Get(), gStagingRingByteSize);
+	mTextureStreamer = std::make_unique<TextureStreamer>(md3dDevice.Get(), *mResourceAllocator);
+	mResidency = std::make_unique<ResidencyManager>(mAdapter.Get());
+	mRenderGraph = std::make_unique<RenderGraph>(md3dDevice.Get(), mResourceStates);
+
+	mProfiler = std::make_unique<GpuProfiler>(md3dDevice.Get(), mCommandQueue.Get(), gNumFrameResources);
+	BuildProfilerScopes();
+	if (gGpuBreadcrumbs)
+		mProfiler->EnableBreadcrumbs();
+
+	// Record what the run actually used, so the JSON says so too.
+	if (mBenchmark.FramesInFlight != 0)
+		mFramePacer->SetFramesInFlight(mBenchmark.FramesInFlight);
+	mBenchmark.FramesInFlight = mFramePacer->FramesInFlight();
+	SetPresentMode(mBenchmark.Presentation);
+	mBenchmark.Presentation = GetPresentMode();
+
+	if (mBenchmark.Enabled)
+	{
+		// Outside the maze entrance, north through the maze above the hedges, over the
+		// drawbridge and the gate, once round the castle and back out over the maze.
+		if (mBenchmark.Path.empty())
+		{
+			mBenchmark.Path = {
+				{ XMFLOAT3(0.0f, 20.0f, -185.0f), XMFLOAT3(0.0f, 5.0f, -150.0f) },
+				{ XMFLOAT3(0.0f, 18.0f, -140.0f), XMFLOAT3(0.0f, 5.0f, -110.0f) },
+				{ XMFLOAT3(-15.0f, 18.0f, -110.0f), XMFLOAT3(0.0f, 5.0f, -80.0f) },
+				{ XMFLOAT3(15.0f, 18.0f, -80.0f), XMFLOAT3(0.0f, 5.0f, -55.0f) },
+				{ XMFLOAT3(0.0f, 18.0f, -50.0f), XMFLOAT3(0.0f, 7.5f, -25.0f) },
+				{ XMFLOAT3(0.0f, 30.0f, -20.0f), XMFLOAT3(0.0f, 5.0f, 0.0f) },
+				{ XMFLOAT3(40.0f, 30.0f, 0.0f), XMFLOAT3(0.0f, 5.0f, 0.0f) },
+				{ XMFLOAT3(0.0f, 30.0f, 40.0f), XMFLOAT3(0.0f, 5.0f, 0.0f) },
+				{ XMFLOAT3(-40.0f, 30.0f, 0.0f), XMFLOAT3(0.0f, 5.0f, 0.0f) },
+				{ XMFLOAT3(0.0f, 45.0f, -60.0f), XMFLOAT3(0.0f, 0.0f, -110.0f) },
+			};
+		}
+
+		mBenchmarkPath = CameraPath(mBenchmark.Path, mBenchmark.FrameCount * mBenchmark.FixedDeltaTime);
+		mTimer.SetFixedDeltaTime(mBenchmark.FixedDeltaTime);
+	}
 
-	LoadTextures();
+	if (!LoadScene())
+		return false;
+	mLights.assign(mScene.Lights().begin(), mScene.Lights().end());
+	mEnvironment = mScene.Environment();
+
+	// Grouped by what they upload, for captures of the initialization.
+	{
+		GpuEvent event(mCommandList.Get(), "descriptor heaps and textures");
+		BuildDescriptorHeaps();
+		LoadTextures();
+	}
 	BuildRootSignature();
-	BuildDescriptorHeaps();
+	BuildCullSignatures();
+	BuildHiZSignature();
+	BuildMipSignature();
+	BuildOverlaySignature();
+	BuildClusterSignature();
+	BuildWaveSignature();
+	BuildFxaaSignature();
+	BuildUpscaleSignature();
+	BuildOitSignature();
+	BuildShadingRateSignature();
+	BuildVisibilitySignature();
 	BuildShadersAndInputLayout();
-	BuildShapeGeometry();
-	BuildTreeSpritesGeometry();
-	BuildMaterials();
-	BuildRenderItems();
-	BuildFrameResources();
 	BuildPSOs();
+	{
+		GpuEvent event(mCommandList.Get(), "geometry");
+		BuildShapeGeometry();
+		BuildRayMeshes();
+		BuildLightmapUVs();
+		BuildTreeSpritesGeometry();
+	}
+	{
+		GpuEvent event(mCommandList.Get(), "scene");
+		BuildMaterials();
+		BuildRenderItems();
+		BuildImpostorAtlas();
+		BuildLightmapAtlas();
+		BuildRenderBatches();
+		BuildFrameResources();
+		BuildWaves();
+	}
 
 	// Execute the initialization commands.
 	ThrowIfFailed(mCommandList->Close());
@@ -228,46 +1522,196 @@ bool ShapesApp::Initialize()
 	// Wait until initialization is complete.
 	FlushCommandQueue();
 
+	// Resolve the pipelines and save any new ones to the library.
+	mPipelines->Flush();
+
+	if (gHotReload && !mBenchmark.Enabled)
+		StartHotReload();
+
+	// Needs the queue idle and the SRV heap; rebuilds the targets and the PSOs.
+	mDynamicResolution.SetTargetMs(mBenchmark.DynamicResolutionMs);
+	mBenchmark.DynamicResolutionMs = mDynamicResolution.TargetMs();
+	if (mBenchmark.AntiAliasingMode != mAntiAliasing || mDynamicResolution.Enabled() || mVisibilityRendering)
+		SetAntiAliasing(mBenchmark.AntiAliasingMode);
+
+	// The queue is idle and nothing stages through the ring after initialization, so
+	// its upload heap can go.  The scene's vertex and index blobs are on the GPU too.
+	mStagingRing.reset();
+	mLightmapUploadBuffer.Reset();
+	mScene.ReleaseGeometry();
+
 	return true;
 }
 
 void ShapesApp::OnResize()
 {
+	for (int i = 0; i < SwapChainBufferCount; ++i)
+		mResourceStates.Untrack(mSwapChainBuffer[i].Get());
+	mResourceStates.Untrack(mDepthStencilBuffer.Get());
+	mResourceStates.Untrack(mMsaaRenderTarget.Get());
+
 	D3DApp::OnResize();
 
-	// The window resized, so update the aspect ratio and recompute the projection matrix.
-	mCamera.SetLens(0.25f * MathHelper::Pi, AspectRatio(), 1.0f, 1000.0f);
+	for (int i = 0; i < SwapChainBufferCount; ++i)
+		mResourceStates.Track(mSwapChainBuffer[i].Get(), D3D12_RESOURCE_STATE_PRESENT);
+	mResourceStates.Track(mDepthStencilBuffer.Get(), D3D12_RESOURCE_STATE_DEPTH_WRITE);
+	if (mMsaaRenderTarget != nullptr)
+		mResourceStates.Track(mMsaaRenderTarget.Get(), D3D12_RESOURCE_STATE_RENDER_TARGET);
+
+	// D3DApp::OnResize has flushed the queue, so the pyramid's views can be rewritten.
+	// The first call comes before Initialize has made the heap.
+	if (mHiZ != nullptr)
+	{
+		mHiZ->Resize(mDepthStencilBuffer.Get(), mReverseZ, mCurrentFence);
+		mShadingRate->Resize(mDepthStencilBuffer.Get(), mCurrentFence);
+		BuildSceneTargets();
+		BuildOitTargets();
+		BuildVisibilityTarget();
+	}
+	UpdateRenderScale();
+
+	// The scene's pipelines have to match the new sample count.  Those that did not
+	// change load from the library.
+	if (mPipelines != nullptr && mPsoSampleCount != (m4xMsaaState ? 4u : 1u))
+	{
+		BuildPSOs();
+		mPipelines->Flush();
+	}
+
+	// The window resized, so update the aspect ratios and recompute the projection matrices.
+	UpdateViewLenses();
 }
 
 void ShapesApp::Update(const GameTimer& gt)
 {
-	OnKeyboardInput(gt);
+	mFrameAllocationStart = gHeapAllocations.load();
+
+	// Wait for the GPU and the swap chain before reading input, so the frame is built
+	// from the freshest input there is.  This also waits until the GPU has finished
+	// the commands of the next frame resource.
+	int nextFrameResourceIndex = (mCurrFrameResourceIndex + 1) % gNumFrameResources;
+	float gpuWaitMs = mFramePacer->WaitForFrame(mCurrentFence,
+		mFrameResources[nextFrameResourceIndex]->Fence, mBenchmark.Present);
+
+	// Input that arrived during the wait is still queued.
+	mRawInput.Poll();
+	UpdateHotReload();
+
+	float simulationMs = 0.0f;
+	if (!mBenchmark.Enabled)
+	{
+		OnKeyboardInput();
+		simulationMs = UpdateSimulation();
+	}
+	else if (!UpdateBenchmark())
+		return;
+	UpdateViewCameras();
 
 	// Cycle through the circular frame resource array.
-	mCurrFrameResourceIndex = (mCurrFrameResourceIndex + 1) % gNumFrameResources;
+	mCurrFrameResourceIndex = nextFrameResourceIndex;
 	mCurrFrameResource = mFrameResources[mCurrFrameResourceIndex].get();
-
-	// Has the GPU finished processing the commands of the current frame resource?
-	// If not, wait until the GPU has completed commands up to this fence point.
-	if (mCurrFrameResource->Fence != 0 && mFence->GetCompletedValue() < mCurrFrameResource->Fence)
+	mCurrFrameResource->Arena.Reset();
+
+	// The slot's previous frame is done, so its timestamps can be read back.
+	mProfiler->BeginFrame(mCurrFrameResourceIndex);
+	mProfiler->AddCpuTime(mGpuWaitCpuScope, gpuWaitMs);
+	mProfiler->AddCpuTime(mSimulationCpuScope, simulationMs);
+	if (mBenchmarkPhase == BenchmarkPhase::Running)
+		mBenchmarkLog.Capture(*mProfiler, mBenchmarkFirstFrame);
+	++mFrameNumber;
+
+	mProfiler->BeginCpuScope(mUpdateCpuScope);
+
+	// Reclaim the ring space of every frame the GPU has finished with.
+	mUploadRing->ReleaseCompleted(mFence->GetCompletedValue());
+	mSrvHeap->ReleaseCompleted(mFence->GetCompletedValue());
+	mRenderGraph->ReleaseCompleted(mFence->GetCompletedValue());
+
+	// Swap in textures that finished streaming before this frame records.
+	mTextureStreamer->Update(mCurrentFence, mFence->GetCompletedValue());
+	UpdateResidency();
+
+	UpdateWorld();
+	UpdateLods();
+	UpdateImpostors();
+	if (std::any_of(std::begin(mLayerDirty), std::end(mLayerDirty), [](bool dirty) { return dirty; }))
+		BuildRenderBatches();
+
+	// The rest runs as a graph of jobs.  The chains below share nothing but what was
+	// settled above: the materials, the water, the scene's transforms and the camera's
+	// pass each have a chain of their own, and the frame's arena is only used by the
+	// object chain.  The upload ring is used by the pass chain and by culling, and
+	// Allocate() isn't thread-safe, so culling has to wait for the pass chain as well
+	// as for the scene graph, whose bounds it reads along with the sort of the
+	// Transparent batches ahead of it.  The line-of-sight rays only read the ray BVH, rebuilt with
+	// the world above.  The player has already been moved and collided by the
+	// simulation ticks.
+	JobSystem::Counter materials, waves, scene, objects, pass, culling, lineOfSight, updated;
+
+	if (mBenchmark.RayQueries > 0)
 	{
-		HANDLE eventHandle = CreateEventEx(nullptr, nullptr, false, EVENT_ALL_ACCESS);
-		ThrowIfFailed(mFence->SetEventOnCompletion(mCurrFrameResource->Fence, eventHandle));
-		WaitForSingleObject(eventHandle, INFINITE);
-		CloseHandle(eventHandle);
+		Ray* rays = mCurrFrameResource->Arena.AllocateArray<Ray>(mBenchmark.RayQueries);
+		bool* occluded = mCurrFrameResource->Arena.AllocateArray<bool>(mBenchmark.RayQueries);
+		mJobs->Run(lineOfSight, [this, rays, occluded]() { CastLineOfSightRays(rays, occluded); });
 	}
 
-	AnimateMaterials(gt);
-	UpdateObjectCBs(gt);
-	UpdateMaterialCBs(gt);
-	UpdateMainPassCB(gt);
+	mJobs->Run(materials, [this, &gt]()
+	{
+		AnimateMaterials(gt);
+		UpdateMaterialCBs(gt);
+	});
+
+	mJobs->Run(waves, [this, &gt]() { UpdateWaves(gt); });
 
-	Collision();
+	mJobs->Run(scene, [this, &gt]()
+	{
+		AnimateGates(gt);
+		UpdateSceneGraph();
+	});
+
+	mJobs->RunAfter({ &scene }, objects, [this, &gt]()
+	{
+		mProfiler->BeginCpuScope(mObjectCBCpuScope);
+		UpdateObjectCBs(gt);
+		mProfiler->EndCpuScope(mObjectCBCpuScope);
+	});
+
+	mJobs->Run(pass, [this, &gt]()
+	{
+		UpdateRenderScale();
+		UpdateMainPassCB(gt);
+	});
+
+	mJobs->RunAfter({ &scene, &pass }, culling, [this]()
+	{
+		SortTransparentBatches();
+		UpdateCulling();
+		UpdateShadowCasters();
+	});
+
+	// The main thread takes jobs until the whole graph is done, then rethrows the
+	// first exception a job raised.
+	mJobs->RunAfter({ &materials, &waves, &objects, &culling, &lineOfSight }, updated, []() {});
+	mJobs->Wait(updated);
+
+	mProfiler->EndCpuScope(mUpdateCpuScope);
+
+	UpdateProfilerOverlay(gt);
 }
 
 void ShapesApp::Draw(const GameTimer& gt)
 {
-	/*------------* DRAW OPAQUE OBJECTS *------------*/
+	if (mBenchmarkPhase == BenchmarkPhase::Done)
+		return;
+
+	/*------------* WAVES ON THE COMPUTE QUEUE *------------*/
+
+	// Submitted first, so the solver runs while the direct queue clears, culls and
+	// draws the opaque layer.
+	if (mWaveSteps > 0)
+		SubmitWaves();
+
+	/*------------* BEGIN FRAME *------------*/
 
 	auto cmdListAlloc = mCurrFrameResource->CmdListAlloc;
 
@@ -277,62 +1721,67 @@ void ShapesApp::Draw(const GameTimer& gt)
 
 	// A command list can be reset after it has been added to the command queue via ExecuteCommandList.
 	// Reusing the command list reuses memory.
-	ThrowIfFailed(mCommandList->Reset(cmdListAlloc.Get(), mPSOs["opaque"].Get()));
-
-	mCommandList->RSSetViewports(1, &mScreenViewport);
-	mCommandList->RSSetScissorRects(1, &mScissorRect);
-
-	// Indicate a state transition on the resource usage.
-	mCommandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(CurrentBackBuffer(),
-		D3D12_RESOURCE_STATE_PRESENT, D3D12_RESOURCE_STATE_RENDER_TARGET));
-
-	// Clear the back buffer and depth buffer.
-	mCommandList->ClearRenderTargetView(CurrentBackBufferView(), (float*)&mMainPassCB.FogColor, 0, nullptr);
+	ThrowIfFailed(mCommandList->Reset(cmdListAlloc.Get(), nullptr));
 
-	mCommandList->ClearDepthStencilView(DepthStencilView(), D3D12_CLEAR_FLAG_DEPTH | D3D12_CLEAR_FLAG_STENCIL, 1.0f, 0, 0, nullptr);
+	mProfiler->BeginScope(mCommandList.Get(), mFrameGpuScope);
 
-	// Specify the buffers we are going to render to.
-	mCommandList->OMSetRenderTargets(1, &CurrentBackBufferView(), true, &DepthStencilView());
-
-	ID3D12DescriptorHeap* descriptorHeaps[] = { mSrvDescriptorHeap.Get() };
+	ID3D12DescriptorHeap* descriptorHeaps[] = { mSrvHeap->Heap() };
 	mCommandList->SetDescriptorHeaps(_countof(descriptorHeaps), descriptorHeaps);
 
-	mCommandList->SetGraphicsRootSignature(mRootSignature.Get());
+	// Once, as soon as every texture the clusters sample is in with all its mips.
+	if (mImpostorAtlas != nullptr && !mImpostorsBaked && mTextureStreamer->PendingCount() == 0 && mPendingMips.empty())
+		BakeImpostors(mCommandList.Get());
 
-	auto passCB = mCurrFrameResource->PassCB->Resource();
-	mCommandList->SetGraphicsRootConstantBufferView(2, passCB->GetGPUVirtualAddress());
+	if (!mPendingMips.empty())
+		GenerateTextureMips(mCommandList.Get());
 
-	DrawRenderItems(mCommandList.Get(), mRitemLayer[(int)RenderLayer::Opaque]);
+	// The passes declare what they use; the graph places the barriers between them.
+	BuildRenderGraph();
+	mRenderGraph->Compile(mCurrentFence);
+	mRenderGraph->Execute(mCommandList.Get());
 
+	ThrowIfFailed(mCommandList->Close());
 
-	/*------------* DRAW TREE BILLBOARDS *------------*/
+	/*------------* RECORD THE LAYERS IN PARALLEL *------------*/
 
-	mCommandList->SetPipelineState(mPSOs["tree"].Get());
-	DrawRenderItems(mCommandList.Get(), mRitemLayer[(int)RenderLayer::AlphaTestedTreeSprites]);
+	mProfiler->BeginCpuScope(mRecordCpuScope);
 
-	// Indicate a state transition on the resource usage.
-	mCommandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(CurrentBackBuffer(),
-		D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PRESENT));
+	BuildRecordJobs();
 
-	/*------------* DRAW TRANSLUCENT OBJECTS *------------*/
+	JobSystem::Counter recording;
+	for (UINT i = 0; i < (UINT)mRecordJobs.size(); ++i)
+		mJobs->Run(recording, [this, i]() { RecordLayerJob(mRecordJobs[i], i); });
 
-	mCommandList->SetPipelineState(mPSOs["transparent"].Get());
-	DrawRenderItems(mCommandList.Get(), mRitemLayer[(int)RenderLayer::Transparent]);
+	// Records a list itself while it waits, and rethrows any DxException raised while recording.
+	mJobs->Wait(recording);
 
-	// Indicate a state transition on the resource usage.
-	mCommandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(CurrentBackBuffer(),
-		D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PRESENT));
+	// Submit the clear and every worker list in draw order with a single call.
+	mSubmitLists.clear();
+	mSubmitLists.push_back(mCommandList.Get());
+	for (size_t i = 0; i < mRecordJobs.size(); ++i)
+		mSubmitLists.push_back(mCurrFrameResource->WorkerCmdLists[i].Get());
 
-	// Done recording commands.
-	ThrowIfFailed(mCommandList->Close());
+	// Resolves the timestamps written by every list above.
+	mSubmitLists.push_back(mProfiler->EndFrame());
 
-	// Add the command list to the queue for execution.
-	ID3D12CommandList* cmdsLists[] = { mCommandList.Get() };
-	mCommandQueue->ExecuteCommandLists(_countof(cmdsLists), cmdsLists);
+	mProfiler->EndCpuScope(mRecordCpuScope);
 
-	// Swap the back and front buffers
-	ThrowIfFailed(mSwapChain->Present(0, 0));
-	mCurrBackBuffer = (mCurrBackBuffer + 1) % SwapChainBufferCount;
+	// The first view's translucent list is the first to draw the water, so the queue
+	// only waits for the wave solver ahead of it; everything before runs alongside
+	// the solver.  The main list comes first in mSubmitLists.
+	const UINT listsBeforeWater = 1 + (UINT)mWaterRecordJob;
+	mCommandQueue->ExecuteCommandLists(listsBeforeWater, mSubmitLists.data());
+	if (mWaveSteps > 0)
+		ThrowIfFailed(mCommandQueue->Wait(mComputeFence.Get(), mComputeFenceValue));
+	mCommandQueue->ExecuteCommandLists((UINT)mSubmitLists.size() - listsBeforeWater, mSubmitLists.data() + listsBeforeWater);
+	mResourceStates.OnCommandListsExecuted();
+
+	// Swap the back and front buffers.  -nopresent keeps rendering to the same one.
+	if (mBenchmark.Present)
+	{
+		PresentFrame();
+		mCurrBackBuffer = (mCurrBackBuffer + 1) % SwapChainBufferCount;
+	}
 
 	// Advance the fence value to mark commands up to this fence point.
 	mCurrFrameResource->Fence = ++mCurrentFence;
@@ -341,1176 +1790,5875 @@ void ShapesApp::Draw(const GameTimer& gt)
 	// Because we are on the GPU timeline, the new fence point won't be 
 	// set until the GPU finishes processing all the commands prior to this Signal().
 	mCommandQueue->Signal(mFence.Get(), mCurrentFence);
-}
 
-void ShapesApp::OnMouseDown(WPARAM btnState, int x, int y)
-{
-	mLastMousePos.x = x;
-	mLastMousePos.y = y;
+	// Everything allocated from the ring this frame is free once the GPU reaches this fence.
+	mUploadRing->FinishFrame(mCurrentFence);
 
-	SetCapture(mhMainWnd);
-}
+	// And the heights it drew the water with may be overwritten.
+	mWaves->MarkRead(mCurrentFence);
 
-void ShapesApp::OnMouseUp(WPARAM btnState, int x, int y)
-{
-	ReleaseCapture();
+	// Everything this frame allocated, on any thread.  The frames that rebuild the
+	// caption, stream in a tile or a texture, or rebuild the batches count theirs too.
+	mProfiler->SetCount(mAllocationCounter, (float)(gHeapAllocations.load() - mFrameAllocationStart));
 }
 
-void ShapesApp::OnMouseMove(WPARAM btnState, int x, int y)
+void ShapesApp::BuildRecordJobs()
 {
-	if ((btnState & MK_LBUTTON) != 0)
-	{
-		// Make each pixel correspond to a quarter of a degree.
-		float dx = XMConvertToRadians(0.25f * static_cast<float>(x - mLastMousePos.x));
-		float dy = XMConvertToRadians(0.25f * static_cast<float>(y - mLastMousePos.y));
-
-		//step4: Instead of updating the angles based on input to orbit camera around scene, 
-		//we rotate the cameras look direction:
-		//mTheta += dx;
-		//mPhi += dy;
+	mRecordJobs.clear();
 
-		mCamera.Pitch(dy);
-		mCamera.RotateY(dx);
-	}
+	/*------------* OPAQUE OBJECTS *------------*/
 
-	mLastMousePos.x = x;
-	mLastMousePos.y = y;
-}
+	// Split the opaque layer into chunks, leaving one list each for the trees, the
+	// translucent layer and the other views.
+	const auto& opaque = mBatchLayer[(int)RenderLayer::Opaque];
+	size_t opaqueJobs = (opaque.size() + MinBatchesPerRecordJob - 1) / MinBatchesPerRecordJob;
+	opaqueJobs = MathHelper::Clamp<size_t>(opaqueJobs, 1, gMaxOpaqueRecordJobs);
 
-void ShapesApp::OnKeyboardInput(const GameTimer& gt)
-{
-	const float dt = gt.DeltaTime();
+	const size_t chunkSize = (opaque.size() + opaqueJobs - 1) / opaqueJobs;
+	for (size_t first = 0; first < opaque.size(); first += chunkSize)
+	{
+		RecordJob job;
+		job.Layer = RenderLayer::Opaque;
+		job.PSO = GetPipeline(mVisibilityThisFrame ? PipelineId::Visibility : PipelineId::Opaque);
+		job.First = first;
+		job.Count = MathHelper::Min(chunkSize, opaque.size() - first);
+		mRecordJobs.push_back(job);
+	}
 
-	//GetAsyncKeyState returns a short (2 bytes)
-	if (GetAsyncKeyState('W') & 0x8000) //most significant bit (MSB) is 1 when key is pressed (1000 000 000 000)
-		mCamera.Walk(10.0f * dt);
+	/*------------* TREE BILLBOARDS *------------*/
 
-	if (GetAsyncKeyState('S') & 0x8000)
-		mCamera.Walk(-10.0f * dt);
+	RecordJob treeJob;
+	treeJob.Layer = RenderLayer::AlphaTestedTreeSprites;
+	treeJob.PSO = GetPipeline(PipelineId::Tree);
+	treeJob.Count = mRitemLayer[(int)RenderLayer::AlphaTestedTreeSprites].size();
+	mRecordJobs.push_back(treeJob);
 
-	if (GetAsyncKeyState('A') & 0x8000)
-		mCamera.Strafe(-10.0f * dt);
+	/*------------* TRANSLUCENT OBJECTS *------------*/
 
-	if (GetAsyncKeyState('D') & 0x8000)
-		mCamera.Strafe(10.0f * dt);
+	RecordJob transparentJob;
+	transparentJob.Layer = RenderLayer::Transparent;
+	transparentJob.PSO = GetPipeline(mWeightedOit ? PipelineId::TransparentOit : PipelineId::Transparent);
+	transparentJob.Count = mBatchLayer[(int)RenderLayer::Transparent].size();
+	mWaterRecordJob = mRecordJobs.size();
+	mRecordJobs.push_back(transparentJob);
 
-	if (GetAsyncKeyState('E') & 0x8000)
-		mCamera.Pedestal(10.0f * dt);
+	/*------------* THE OTHER VIEWS *------------*/
 
-	if (GetAsyncKeyState('Q') & 0x8000)
-		mCamera.Pedestal(-10.0f * dt);
+	// A list each, in order, so a view drawn over the others comes after them.
+	for (UINT v = 1; v < (UINT)mViews.size(); ++v)
+	{
+		RecordJob viewJob;
+		viewJob.View = v;
+		mRecordJobs.push_back(viewJob);
+	}
 
-	//mCamera.SetPosition(mCamera.GetPosition3f().x, 3.0f, mCamera.GetPosition3f().z);
-	player.Center = mCamera.GetPosition3f();
+	mRecordJobs.back().TransitionToPresent = true;
 
-	mCamera.UpdateViewMatrix();
+	assert(mRecordJobs.size() <= gNumWorkerCmdLists);
 }
 
-void ShapesApp::AnimateMaterials(const GameTimer& gt)
+void ShapesApp::RecordLayerJob(const RecordJob& job, UINT listIndex)
 {
-	// Scroll the water material texture coordinates.
-	auto waterMat = mMaterials["water"].get();
+	auto cmdListAlloc = mCurrFrameResource->WorkerCmdListAllocs[listIndex];
+	auto cmdList = mCurrFrameResource->WorkerCmdLists[listIndex];
 
-	float& tu = waterMat->MatTransform(3, 0);
-	float& tv = waterMat->MatTransform(3, 1);
+	ThrowIfFailed(cmdListAlloc->Reset());
+	ThrowIfFailed(cmdList->Reset(cmdListAlloc.Get(), nullptr));
 
-	tu += 0.01f * gt.DeltaTime();
-	tv += 0.02f * gt.DeltaTime();
+	// Named after what the list draws in a capture, RenderLayer order.
+	static const char* const layerEventNames[] = { "opaque", "transparent", "trees" };
+	GpuEvent::Begin(cmdList.Get(), job.View != 0 ? "other view" : layerEventNames[(int)job.Layer]);
 
-	if (tu >= 1.0f)
-		tu -= 1.0f;
-	if (tv >= 1.0f)
-		tv -= 1.0f;
+	// Command lists do not inherit state from each other, so each one binds the frame state again.
+	const SceneView& view = mViews[job.View];
+	cmdList->RSSetViewports(1, &view.Viewport);
+	cmdList->RSSetScissorRects(1, &view.ScissorRect);
 
-	waterMat->MatTransform(3, 0) = tu;
-	waterMat->MatTransform(3, 1) = tv;
+	// The first view's opaque layer draws into the visibility buffer instead.
+	const bool visibility = mVisibilityThisFrame && job.View == 0 && job.Layer == RenderLayer::Opaque;
+	D3D12_CPU_DESCRIPTOR_HANDLE sceneView = visibility ?
+		mVisibilityRtvHeap->GetCPUDescriptorHandleForHeapStart() : SceneTargetView();
+	D3D12_CPU_DESCRIPTOR_HANDLE depthStencilView = DepthStencilView();
+	cmdList->OMSetRenderTargets(1, &sceneView, true, &depthStencilView);
 
-	// Material has changed, so need to update cbuffer.
-	waterMat->NumFramesDirty = gNumFrameResources;
-}
+	ID3D12DescriptorHeap* descriptorHeaps[] = { mSrvHeap->Heap() };
+	cmdList->SetDescriptorHeaps(_countof(descriptorHeaps), descriptorHeaps);
 
+	cmdList->SetGraphicsRootSignature(mRootSignature.Get());
 
-void ShapesApp::UpdateObjectCBs(const GameTimer& gt)
-{
-	auto currObjectCB = mCurrFrameResource->ObjectCB.get();
-	for (auto& e : mAllRitems)
+	// Filters out redundant PSO, input assembler and root argument changes.
+	DrawStateCache state(cmdList.Get());
+	BindFrameRootArguments(state, job.View);
+
+	if (job.View != 0)
+	{
+		// The other views' lists are the last ones; their scope spans all of them.
+		if (job.View == 1)
+			mProfiler->BeginScope(cmdList.Get(), mViewsGpuScope);
+		RecordViewJob(state, job.View);
+		if (job.View + 1 == (UINT)mViews.size())
+			mProfiler->EndScope(cmdList.Get(), mViewsGpuScope);
+	}
+	else
 	{
-		// Only update the cbuffer data if the constants have changed.  
-		// This needs to be tracked per frame resource.
-		if (e->NumFramesDirty > 0)
+		// The lists run in order, so the first opaque one readies the visibility buffer
+		// for all of them and the trees' list shades it before drawing over it.
+		if (visibility && job.First == 0)
+		{
+			cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mVisibilityTarget.Get(),
+				D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_RENDER_TARGET));
+			const float clearColor[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			cmdList->ClearRenderTargetView(sceneView, clearColor, 1, &view.ScissorRect);
+		}
+		else if (mVisibilityThisFrame && job.Layer == RenderLayer::AlphaTestedTreeSprites)
+		{
+			RecordVisibilityResolve(cmdList.Get());
+		}
+
+		state.SetPipelineState(job.PSO);
+
+		// The opaque layer is split over several lists; its scope spans all of them.
+		const size_t opaqueCount = mBatchLayer[(int)RenderLayer::Opaque].size();
+		UINT scope = mOpaqueGpuScope;
+		if (job.Layer == RenderLayer::AlphaTestedTreeSprites)
+			scope = mTreeGpuScope;
+		else if (job.Layer == RenderLayer::Transparent)
+			scope = mTransparentGpuScope;
+
+		if (job.Layer != RenderLayer::Opaque || job.First == 0)
+			mProfiler->BeginScope(cmdList.Get(), scope);
+
+		const bool weightedOit = job.Layer == RenderLayer::Transparent && mWeightedOit;
+		if (weightedOit)
+			BeginWeightedOit(cmdList.Get(), job.View);
+
+		// Only the first view is drawn in perspective over the whole image, and the
+		// translucent layer blends over what is behind it.  Coarse pixels of the
+		// visibility buffer would each stand for a single triangle.
+		const bool shadingRateImage = mShadingRateImageThisFrame &&
+			((job.Layer == RenderLayer::Opaque && !visibility) || job.Layer == RenderLayer::AlphaTestedTreeSprites);
+		if (shadingRateImage)
+			BindShadingRateImage(cmdList.Get(), mShadingRate->Resource());
+
+		// The water's rate is set per draw, which bundles can't do.  The sorted
+		// layer's bundle was recorded again whenever the camera moved anyway.
+		const bool waterRate = job.Layer == RenderLayer::Transparent && mVariableRateShading &&
+			mShadingRate->Tier() != D3D12_VARIABLE_SHADING_RATE_TIER_NOT_SUPPORTED;
+
+		if (job.Layer == RenderLayer::AlphaTestedTreeSprites)
 		{
-			XMMATRIX world = XMLoadFloat4x4(&e->World);
-			XMMATRIX texTransform = XMLoadFloat4x4(&e->TexTransform);
+			DrawTrees(state);
+			DrawImpostors(state);
+		}
+		else if (gLayerBundles && mCullMode == CullMode::Gpu && !waterRate)
+			ExecuteLayerBundle(state, job, listIndex);
+		else
+			DrawRenderBatches(state, mBatchLayer[(int)job.Layer], job.First, job.Count);
 
-			ObjectConstants objConstants;
-			XMStoreFloat4x4(&objConstants.World, XMMatrixTranspose(world));
-			XMStoreFloat4x4(&objConstants.TexTransform, XMMatrixTranspose(texTransform));
+		// The resolve and the overlay may follow in the same list.
+		if (shadingRateImage)
+			BindShadingRateImage(cmdList.Get(), nullptr);
 
-			currObjectCB->CopyData(e->ObjCBIndex, objConstants);
+		if (weightedOit)
+			CompositeWeightedOit(cmdList.Get());
 
-			// Next FrameResource need to be updated too.
-			e->NumFramesDirty--;
-		}
+		if (job.Layer != RenderLayer::Opaque || job.First + job.Count == opaqueCount)
+			mProfiler->EndScope(cmdList.Get(), scope);
 	}
-}
 
-void ShapesApp::UpdateMaterialCBs(const GameTimer& gt)
-{
-	auto currMaterialCB = mCurrFrameResource->MaterialCB.get();
-	for (auto& e : mMaterials)
+	GpuEvent::End(cmdList.Get());
+
+	// The list submitted last finishes the scene into the back buffer and the overlay
+	// goes on top of it, single-sampled and without depth.
+	if (job.TransitionToPresent)
 	{
-		// Only update the cbuffer data if the constants have changed.  If the cbuffer
-		// data changes, it needs to be updated for each FrameResource.
-		Material* mat = e.second.get();
-		if (mat->NumFramesDirty > 0)
-		{
-			XMMATRIX matTransform = XMLoadFloat4x4(&mat->MatTransform);
+		GpuEvent event(cmdList.Get(), "resolve and overlay");
+		RecordSceneResolve(cmdList.Get());
 
-			MaterialConstants matConstants;
-			matConstants.DiffuseAlbedo = mat->DiffuseAlbedo;
-			matConstants.FresnelR0 = mat->FresnelR0;
-			matConstants.Roughness = mat->Roughness;
-			XMStoreFloat4x4(&matConstants.MatTransform, XMMatrixTranspose(matTransform));
+		D3D12_CPU_DESCRIPTOR_HANDLE backBufferView = CurrentBackBufferView();
+		cmdList->OMSetRenderTargets(1, &backBufferView, true, nullptr);
+		cmdList->RSSetViewports(1, &mScreenViewport);
+		cmdList->RSSetScissorRects(1, &mScissorRect);
 
-			currMaterialCB->CopyData(mat->MatCBIndex, matConstants);
+		mProfiler->BeginScope(cmdList.Get(), mOverlayGpuScope);
+		DrawProfilerOverlay(cmdList.Get());
+		mProfiler->EndScope(cmdList.Get(), mOverlayGpuScope);
 
-			// Next FrameResource need to be updated too.
-			mat->NumFramesDirty--;
-		}
+		// Indicate a state transition on the resource usage.
+		mResourceStates.Transition(CurrentBackBuffer(), D3D12_RESOURCE_STATE_PRESENT);
+		mResourceStates.FlushBarriers(cmdList.Get());
+
+		mProfiler->EndScope(cmdList.Get(), mFrameGpuScope);
 	}
+
+	// Done recording commands.
+	ThrowIfFailed(cmdList->Close());
 }
 
-void ShapesApp::UpdateMainPassCB(const GameTimer& gt)
+// Every layer of one of the other views, from what its own culling kept.  A view
+// drawn over the others clears its rectangle first.
+void ShapesApp::RecordViewJob(DrawStateCache& state, UINT view)
 {
-	XMMATRIX view = mCamera.GetView();
-	XMMATRIX proj = mCamera.GetProj();
-
-	XMMATRIX viewProj = XMMatrixMultiply(view, proj);
-	XMMATRIX invView = XMMatrixInverse(&XMMatrixDeterminant(view), view);
-	XMMATRIX invProj = XMMatrixInverse(&XMMatrixDeterminant(proj), proj);
-	XMMATRIX invViewProj = XMMatrixInverse(&XMMatrixDeterminant(viewProj), viewProj);
-
-	XMStoreFloat4x4(&mMainPassCB.View, XMMatrixTranspose(view));
-	XMStoreFloat4x4(&mMainPassCB.InvView, XMMatrixTranspose(invView));
-	XMStoreFloat4x4(&mMainPassCB.Proj, XMMatrixTranspose(proj));
-	XMStoreFloat4x4(&mMainPassCB.InvProj, XMMatrixTranspose(invProj));
-	XMStoreFloat4x4(&mMainPassCB.ViewProj, XMMatrixTranspose(viewProj));
-	XMStoreFloat4x4(&mMainPassCB.InvViewProj, XMMatrixTranspose(invViewProj));
-	mMainPassCB.EyePosW = mCamera.GetPosition3f();
-	mMainPassCB.RenderTargetSize = XMFLOAT2((float)mClientWidth, (float)mClientHeight);
-	mMainPassCB.InvRenderTargetSize = XMFLOAT2(1.0f / mClientWidth, 1.0f / mClientHeight);
-	mMainPassCB.NearZ = 1.0f;
-	mMainPassCB.FarZ = 1000.0f;
+	const SceneView& sceneView = mViews[view];
+	const FrameResource::ViewBuffers& buffers = mCurrFrameResource->Views[view];
+	auto cmdList = state.CommandList();
+
+	if (sceneView.Overlaid)
+	{
+		cmdList->ClearRenderTargetView(SceneTargetView(), (float*)&mSceneCB.FogColor, 1, &sceneView.ScissorRect);
+		D3D12_CLEAR_FLAGS depthClearFlags = D3D12_CLEAR_FLAG_DEPTH;
+		if (mDepthStencilFormat == DXGI_FORMAT_D24_UNORM_S8_UINT)
+			depthClearFlags |= D3D12_CLEAR_FLAG_STENCIL;
+		cmdList->ClearDepthStencilView(DepthStencilView(), depthClearFlags, DepthClearValue(), 0, 1, &sceneView.ScissorRect);
+	}
+
+	const auto& opaque = mBatchLayer[(int)RenderLayer::Opaque];
+	state.SetPipelineState(GetPipeline(PipelineId::Opaque));
+	DrawRenderBatches(state, opaque, 0, opaque.size(), buffers.DrawArgs.Get(), buffers.VisibleInstances.Get());
+
+	state.SetPipelineState(GetPipeline(PipelineId::Tree));
+	DrawTrees(state, view);
+	DrawImpostors(state);
+
+	// In the first view's order; the sort doesn't follow the other cameras.
+	const auto& transparent = mBatchLayer[(int)RenderLayer::Transparent];
+	if (mWeightedOit)
+		BeginWeightedOit(cmdList, view);
+	state.SetPipelineState(GetPipeline(mWeightedOit ? PipelineId::TransparentOit : PipelineId::Transparent));
+	DrawRenderBatches(state, transparent, 0, transparent.size(), buffers.DrawArgs.Get(), buffers.VisibleInstances.Get());
+	if (mWeightedOit)
+		CompositeWeightedOit(cmdList);
+}
+
+// GPU culling leaves nothing in a layer's draws that changes between frames: the
+// counts come from the frame resource's DrawArgs, and the addresses are the frame
+// resource's own.  So each frame resource keeps a bundle per list, replayed until
+// mBundleGeneration moves on or the job covers other batches.
+void ShapesApp::ExecuteLayerBundle(DrawStateCache& state, const RecordJob& job, UINT listIndex)
+{
+	FrameResource::LayerBundle& bundle = mCurrFrameResource->WorkerBundles[listIndex];
+	if (bundle.Generation != mBundleGeneration || bundle.Layer != (UINT)job.Layer || bundle.PSO != job.PSO ||
+		bundle.First != job.First || bundle.Count != job.Count)
+	{
+		// The frame resource's last frame is done with it, like with the worker lists.
+		ThrowIfFailed(bundle.Alloc->Reset());
+		ThrowIfFailed(bundle.List->Reset(bundle.Alloc.Get(), nullptr));
+
+		// Matching the calling list's root signature lets the bundle inherit the frame
+		// arguments bound there.  It has to set its own pipeline and input assembler.
+		bundle.List->SetGraphicsRootSignature(mRootSignature.Get());
+
+		DrawStateCache bundleState(bundle.List.Get());
+		bundleState.SetPipelineState(job.PSO);
+		DrawRenderBatches(bundleState, mBatchLayer[(int)job.Layer], job.First, job.Count);
+
+		ThrowIfFailed(bundle.List->Close());
+
+		bundle.Generation = mBundleGeneration;
+		bundle.Layer = (UINT)job.Layer;
+		bundle.PSO = job.PSO;
+		bundle.First = job.First;
+		bundle.Count = job.Count;
+	}
+
+	state.CommandList()->ExecuteBundle(bundle.List.Get());
+
+	// The bindings the bundle left behind carry over into the list.
+	state.Invalidate();
+}
+
+// Variable rate shading is state of the list, so the pipelines don't change with it.
+// The draw's rate and the image's are combined by taking the coarser; Tier 1 has no
+// image, or combiners, and takes the draw's.
+void ShapesApp::BindShadingRateImage(ID3D12GraphicsCommandList* cmdList, ID3D12Resource* image)
+{
+	ComPtr<ID3D12GraphicsCommandList5> cmdList5;
+	if (!mVariableRateShading || mShadingRate->Tier() < D3D12_VARIABLE_SHADING_RATE_TIER_2 ||
+		FAILED(cmdList->QueryInterface(IID_PPV_ARGS(cmdList5.GetAddressOf()))))
+		return;
+
+	cmdList5->RSSetShadingRateImage(image);
+	SetShadingRate(cmdList, D3D12_SHADING_RATE_1X1);
+}
+
+void ShapesApp::SetShadingRate(ID3D12GraphicsCommandList* cmdList, D3D12_SHADING_RATE rate)
+{
+	ComPtr<ID3D12GraphicsCommandList5> cmdList5;
+	if (!mVariableRateShading || mShadingRate->Tier() == D3D12_VARIABLE_SHADING_RATE_TIER_NOT_SUPPORTED ||
+		FAILED(cmdList->QueryInterface(IID_PPV_ARGS(cmdList5.GetAddressOf()))))
+		return;
+
+	D3D12_SHADING_RATE_COMBINER combiners[D3D12_RS_SET_SHADING_RATE_COMBINER_COUNT] =
+	{
+		D3D12_SHADING_RATE_COMBINER_PASSTHROUGH,
+		D3D12_SHADING_RATE_COMBINER_PASSTHROUGH
+	};
+	if (mShadingRate->Tier() >= D3D12_VARIABLE_SHADING_RATE_TIER_2)
+		combiners[1] = D3D12_SHADING_RATE_COMBINER_MAX;
+
+	cmdList5->RSSetShadingRate(rate, combiners);
+}
+
+// Everything but the draw constants and the visible list is bound once per list;
+// the shaders index it with the per-draw object and material index.  The pass
+// constants and the cluster lists are the view's.
+void ShapesApp::BindFrameRootArguments(DrawStateCache& state, UINT view)
+{
+	state.SetGraphicsRootConstantBufferView((UINT)RootParameter::PassCB, mViews[view].PassCBAddress);
+	state.SetGraphicsRootConstantBufferView((UINT)RootParameter::SceneCB, mSceneCBBuffer->GetGPUVirtualAddress());
+	state.SetGraphicsRootShaderResourceView((UINT)RootParameter::InstanceData, mCurrFrameResource->InstanceBuffer->Resource()->GetGPUVirtualAddress());
+	state.SetGraphicsRootShaderResourceView((UINT)RootParameter::ObjectData, mCurrFrameResource->ObjectBuffer->Resource()->GetGPUVirtualAddress());
+	state.SetGraphicsRootShaderResourceView((UINT)RootParameter::MaterialData, mCurrFrameResource->MaterialBuffer->Resource()->GetGPUVirtualAddress());
+	state.SetGraphicsRootDescriptorTable((UINT)RootParameter::Textures, mSrvHeap->GpuHandle(0));
+
+	if (gClusteredLighting)
+	{
+		state.SetGraphicsRootShaderResourceView((UINT)RootParameter::LocalLights, mLocalLightUpload.GpuAddress);
+		state.SetGraphicsRootShaderResourceView((UINT)RootParameter::ClusterLights, mCurrFrameResource->Views[view].ClusterLights->GetGPUVirtualAddress());
+	}
+
+	// Only read by the translucent list, which the queue holds back until the solver is done.
+	state.SetGraphicsRootShaderResourceView((UINT)RootParameter::WaveHeights, mWaves->Solution());
+}
+
+LRESULT ShapesApp::MsgProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
+{
+	switch (msg)
+	{
+	// Both go on to D3DApp: WM_INPUT still has to reach DefWindowProc to be cleaned up.
+	case WM_INPUT:
+		mRawInput.OnInput((HRAWINPUT)lParam);
+		break;
+
+	// Keys let go while another window has the focus are never reported.
+	case WM_ACTIVATE:
+		if (LOWORD(wParam) == WA_INACTIVE)
+			mRawInput.ReleaseAll();
+		break;
+	}
+
+	return D3DApp::MsgProc(hwnd, msg, wParam, lParam);
+}
+
+// A right-click casts a ray through the cursor from the camera of the view it falls
+// in, the last view drawn first since it lies on top, and names the static item hit.
+void ShapesApp::OnMouseDown(WPARAM btnState, int x, int y)
+{
+	if ((btnState & MK_RBUTTON) == 0 || mClientWidth == 0 || mClientHeight == 0)
+		return;
+
+	float u = (float)x / mClientWidth;
+	float v = (float)y / mClientHeight;
+	for (auto view = mViews.rbegin(); view != mViews.rend(); ++view)
+	{
+		const XMFLOAT4& rect = view->Rect;
+		if (u < rect.x || u >= rect.x + rect.z || v < rect.y || v >= rect.y + rect.w)
+			continue;
+
+		// Through the cursor's point on the near plane.
+		const Camera& camera = *view->ViewCamera;
+		float ndcX = (u - rect.x) / rect.z * 2.0f - 1.0f;
+		float ndcY = 1.0f - (v - rect.y) / rect.w * 2.0f;
+		XMVECTOR direction = camera.GetNearZ() * camera.GetLook() +
+			(0.5f * ndcX * camera.GetNearWindowWidth()) * camera.GetRight() +
+			(0.5f * ndcY * camera.GetNearWindowHeight()) * camera.GetUp();
+
+		Ray ray;
+		ray.Origin = camera.GetPosition3f();
+		XMStoreFloat3(&ray.Direction, XMVector3Normalize(direction));
+		ray.MaxT = gPickRange;
+
+		std::ostringstream report;
+		RayHit hit = mRayScene.Intersect(ray);
+		if (hit.UserId == RayHit::NoHit)
+		{
+			report << "Pick: nothing within " << gPickRange << "\n";
+		}
+		else
+		{
+			const RenderItem* ri = mRayItems[hit.UserId];
+			report << "Pick: " << ri->name << " (" << ri->Mat->Name << ") at " << hit.T
+				<< ", triangle " << hit.Triangle << "\n";
+		}
+		::OutputDebugStringA(report.str().c_str());
+		return;
+	}
+}
+
+void ShapesApp::OnKeyboardInput()
+{
+	// Toggle on the key press rather than every frame the key is held.
+	bool cullKeyDown = (GetAsyncKeyState('C') & 0x8000) != 0;
+	if (cullKeyDown && !mCullKeyDown)
+		mCullMode = (mCullMode == CullMode::Gpu) ? CullMode::Cpu : CullMode::Gpu;
+	mCullKeyDown = cullKeyDown;
+
+	bool occlusionKeyDown = (GetAsyncKeyState('Z') & 0x8000) != 0;
+	if (occlusionKeyDown && !mOcclusionKeyDown)
+		mOcclusionCulling = !mOcclusionCulling;
+	mOcclusionKeyDown = occlusionKeyDown;
+
+	bool overlayKeyDown = (GetAsyncKeyState('O') & 0x8000) != 0;
+	if (overlayKeyDown && !mOverlayKeyDown)
+		mShowOverlay = !mShowOverlay;
+	mOverlayKeyDown = overlayKeyDown;
+
+	bool gateKeyDown = (GetAsyncKeyState('B') & 0x8000) != 0;
+	if (gateKeyDown && !mGateKeyDown)
+		mGatesRaised = !mGatesRaised;
+	mGateKeyDown = gateKeyDown;
+
+	bool csvKeyDown = (GetAsyncKeyState('P') & 0x8000) != 0;
+	if (csvKeyDown && !mCsvKeyDown)
+	{
+		if (mProfiler->IsCsvOpen())
+			mProfiler->CloseCsv();
+		else
+			mProfiler->OpenCsv(L"profile.csv");
+	}
+	mCsvKeyDown = csvKeyDown;
+
+	bool latencyKeyDown = (GetAsyncKeyState('L') & 0x8000) != 0;
+	if (latencyKeyDown && !mLatencyKeyDown)
+	{
+		UINT framesInFlight = mFramePacer->FramesInFlight();
+		mFramePacer->SetFramesInFlight(framesInFlight > 1 ? framesInFlight - 1 : mFramePacer->MaxFramesInFlight());
+	}
+	mLatencyKeyDown = latencyKeyDown;
+
+	// Skip tearing where it is unsupported, or SetPresentMode would turn it back
+	// into Immediate and the cycle would never reach Vsync.
+	bool presentModeKeyDown = (GetAsyncKeyState('V') & 0x8000) != 0;
+	if (presentModeKeyDown && !mPresentModeKeyDown)
+	{
+		int next = ((int)GetPresentMode() + 1) % (int)PresentMode::Count;
+		if ((PresentMode)next == PresentMode::Tearing && !IsTearingSupported())
+			next = (int)PresentMode::Vsync;
+		SetPresentMode((PresentMode)next);
+	}
+	mPresentModeKeyDown = presentModeKeyDown;
+
+	bool antiAliasingKeyDown = (GetAsyncKeyState(VK_F2) & 0x8000) != 0;
+	if (antiAliasingKeyDown && !mAntiAliasingKeyDown)
+		SetAntiAliasing((AntiAliasing)(((int)mAntiAliasing + 1) % (int)AntiAliasing::Count));
+	mAntiAliasingKeyDown = antiAliasingKeyDown;
+
+	bool dynamicResolutionKeyDown = (GetAsyncKeyState('R') & 0x8000) != 0;
+	if (dynamicResolutionKeyDown && !mDynamicResolutionKeyDown)
+		SetDynamicResolution(mDynamicResolution.Enabled() ? 0.0f : gDynamicResolutionMs);
+	mDynamicResolutionKeyDown = dynamicResolutionKeyDown;
+
+	bool memoryReportKeyDown = (GetAsyncKeyState(VK_F4) & 0x8000) != 0;
+	if (memoryReportKeyDown && !mMemoryReportKeyDown)
+		ReportMemoryStats();
+	mMemoryReportKeyDown = memoryReportKeyDown;
+
+	bool playersKeyDown = (GetAsyncKeyState(VK_F3) & 0x8000) != 0;
+	if (playersKeyDown && !mPlayersKeyDown)
+		SetViewLayout(mPlayerCount % gMaxPlayers + 1, mShowMinimap);
+	mPlayersKeyDown = playersKeyDown;
+
+	bool minimapKeyDown = (GetAsyncKeyState('M') & 0x8000) != 0;
+	if (minimapKeyDown && !mMinimapKeyDown)
+		SetViewLayout(mPlayerCount, !mShowMinimap);
+	mMinimapKeyDown = minimapKeyDown;
+
+	// The targets come or go, and the transparent items are batched differently.
+	bool oitKeyDown = (GetAsyncKeyState('T') & 0x8000) != 0;
+	if (oitKeyDown && !mOitKeyDown)
+	{
+		mWeightedOit = !mWeightedOit;
+		FlushCommandQueue();
+		BuildOitTargets();
+		MarkLayerDirty(RenderLayer::Transparent);
+	}
+	mOitKeyDown = oitKeyDown;
+
+	// mSceneColor becomes a UAV or stops being one, and the opaque batches meshlets
+	// only without the visibility buffer.
+	bool visibilityKeyDown = (GetAsyncKeyState('I') & 0x8000) != 0;
+	if (visibilityKeyDown && !mVisibilityKeyDown)
+	{
+		mVisibilityRendering = !mVisibilityRendering;
+		FlushCommandQueue();
+		BuildSceneTargets();
+		BuildVisibilityTarget();
+		MarkLayerDirty(RenderLayer::Opaque);
+	}
+	mVisibilityKeyDown = visibilityKeyDown;
+
+	bool vrsKeyDown = (GetAsyncKeyState('G') & 0x8000) != 0;
+	if (vrsKeyDown && !mVrsKeyDown)
+		mVariableRateShading = !mVariableRateShading;
+	mVrsKeyDown = vrsKeyDown;
+}
+
+// Runs the ticks due by now, each with the keys that were down during it, and places
+// the camera between the last two.  Returns the milliseconds it took: the profiler's
+// frame only begins after it.
+float ShapesApp::UpdateSimulation()
+{
+	const std::int64_t start = RawInput::Now();
+
+	// The view turns every frame, with all the mouse motion since the last one.
+	long dx = 0, dy = 0;
+	mRawInput.TakeMouseDelta(dx, dy);
+	if (dx != 0 || dy != 0)
+	{
+		// Make each count correspond to a quarter of a degree.
+		mCamera.Pitch(XMConvertToRadians(0.25f * static_cast<float>(dy)));
+		mCamera.RotateY(XMConvertToRadians(0.25f * static_cast<float>(dx)));
+	}
+
+	const std::int64_t frequency = RawInput::Frequency();
+	const std::int64_t tickLength = frequency / gSimulationHz;
+
+	// After a stall, and on the first frame, only the last gMaxTicksPerFrame ticks run.
+	const std::int64_t backlog = gMaxTicksPerFrame * tickLength;
+	if (start - mSimTime > backlog)
+		mSimTime = start - backlog;
+
+	while (mSimTime + tickLength <= start)
+	{
+		mSimTime += tickLength;
+		mRawInput.AdvanceTo(mSimTime);
+		SimulateTick(1.0f / gSimulationHz);
+	}
+
+	// The time past the last tick, as a fraction of the next one.
+	float alpha = (float)(start - mSimTime) / (float)tickLength;
+	XMVECTOR position = XMVectorLerp(XMLoadFloat3(&mPrevSimPosition), XMLoadFloat3(&mSimPosition), alpha);
+	XMFLOAT3 drawn;
+	XMStoreFloat3(&drawn, position);
+
+	// Left alone while the player stands still, so the view version only moves with
+	// the camera and what is keyed on it (the view matrices, the transparent sort)
+	// isn't redone every frame.
+	const XMFLOAT3 current = mCamera.GetPosition3f();
+	if (drawn.x != current.x || drawn.y != current.y || drawn.z != current.z)
+		mCamera.SetPosition(drawn);
+	mCamera.UpdateViewMatrix();
+
+	return (float)((RawInput::Now() - start) * 1000.0 / (double)frequency);
+}
+
+// One tick of the first player, moving along the camera's axes as they were at the
+// start of the frame.
+void ShapesApp::SimulateTick(float dt)
+{
+	auto axis = [this](UINT positive, UINT negative)
+	{
+		return (mRawInput.KeyDown(positive) ? 1.0f : 0.0f) - (mRawInput.KeyDown(negative) ? 1.0f : 0.0f);
+	};
+
+	XMVECTOR velocity = axis('W', 'S') * mCamera.GetLook() + axis('D', 'A') * mCamera.GetRight() + axis('E', 'Q') * mCamera.GetUp();
+
+	XMFLOAT3 motion;
+	XMStoreFloat3(&motion, gWalkSpeed * dt * velocity);
+
+	mPrevSimPosition = mSimPosition;
+	mSimPosition = MovePlayer(mSimPosition, motion);
+	PushOutOfWalls(mSimPosition);
+	player.Center = mSimPosition;
+}
+
+// Returns false once the run is over and nothing more should be rendered.
+bool ShapesApp::UpdateBenchmark()
+{
+	switch (mBenchmarkPhase)
+	{
+	case BenchmarkPhase::Loading:
+		// Texture arrivals are not deterministic, so nothing is timed until all are in.
+		if (mTextureStreamer->PendingCount() == 0)
+			mBenchmarkPhase = BenchmarkPhase::Warmup;
+		break;
+
+	case BenchmarkPhase::Warmup:
+		if (++mBenchmarkFrame >= mBenchmark.WarmupFrames)
+		{
+			mBenchmarkPhase = BenchmarkPhase::Running;
+			mBenchmarkFrame = 0;
+			mBenchmarkFirstFrame = mFrameNumber;
+		}
+		break;
+
+	case BenchmarkPhase::Running:
+		if (++mBenchmarkFrame > mBenchmark.FrameCount)
+		{
+			FinishBenchmark();
+			return false;
+		}
+		break;
+
+	case BenchmarkPhase::Done:
+		return false;
+	}
+
+	// Frame n always sees the view at n * dt; loading and warmup hold the first one.
+	float t = (mBenchmarkPhase == BenchmarkPhase::Running) ? (mBenchmarkFrame - 1) * mBenchmark.FixedDeltaTime : 0.0f;
+
+	XMFLOAT3 position, target;
+	mBenchmarkPath.Sample(t, position, target);
+	mCamera.LookAt(position, target, XMFLOAT3(0.0f, 1.0f, 0.0f));
+
+	// The path goes through the walls, so nothing is simulated.
+	player.Center = mCamera.GetPosition3f();
+	mSimPosition = player.Center;
+	mPrevSimPosition = player.Center;
+	mCamera.UpdateViewMatrix();
+
+	return true;
+}
+
+void ShapesApp::FinishBenchmark()
+{
+	mBenchmarkPhase = BenchmarkPhase::Done;
+
+	// Collect the frames still in flight: once the queue is idle every slot can be
+	// read back, oldest first.
+	FlushCommandQueue();
+	for (int i = 1; i <= gNumFrameResources; ++i)
+	{
+		mProfiler->BeginFrame((mCurrFrameResourceIndex + i) % gNumFrameResources);
+		mBenchmarkLog.Capture(*mProfiler, mBenchmarkFirstFrame);
+	}
+
+	UINT renderItemCount = 0;
+	for (const auto& e : mCells)
+		renderItemCount += (UINT)e.second->Items.size();
+
+	if (!mBenchmarkLog.WriteJson(mBenchmark.OutputFile, mBenchmark, renderItemCount))
+	{
+		std::wstring file(mBenchmark.OutputFile.begin(), mBenchmark.OutputFile.end());
+		OutputDebugString((L"Benchmark: could not write " + file + L"\n").c_str());
+	}
+
+	PostQuitMessage(0);
+}
+
+void ShapesApp::AnimateGates(const GameTimer& gt)
+{
+	// Takes two seconds either way.  Only the gate nodes change; the scene graph
+	// carries the door and both drawbridge wedges along with them.
+	float target = mGatesRaised ? 1.0f : 0.0f;
+	if (mGateAmount == target)
+		return;
+
+	float step = 0.5f * gt.DeltaTime();
+	mGateAmount = MathHelper::Clamp(mGateAmount + (mGatesRaised ? step : -step), 0.0f, 1.0f);
+
+	for (auto& e : mCells)
+		SetGatePose(*e.second);
+}
+
+void ShapesApp::SetGatePose(WorldCell& cell)
+{
+	XMFLOAT4X4 portcullisLocal, drawbridgeLocal;
+	XMStoreFloat4x4(&portcullisLocal, XMMatrixTranslation(0.0f, 12.0f * mGateAmount, 0.0f));
+	XMStoreFloat4x4(&drawbridgeLocal, XMMatrixRotationX(XMConvertToRadians(60.0f) * mGateAmount) * XMMatrixTranslation(0.0f, 0.0f, -2.0f));
+
+	for (std::uint32_t node : cell.PortcullisNodes)
+		cell.Graph.SetLocal(node, portcullisLocal);
+	for (std::uint32_t node : cell.DrawbridgeNodes)
+		cell.Graph.SetLocal(node, drawbridgeLocal);
+}
+
+void ShapesApp::AnimateMaterials(const GameTimer& gt)
+{
+	// Scroll the water material texture coordinates.
+	if (mWaterMat == nullptr)
+		return;
+	Material* waterMat = mWaterMat;
+
+	float& tu = waterMat->MatTransform(3, 0);
+	float& tv = waterMat->MatTransform(3, 1);
+
+	tu += 0.01f * gt.DeltaTime();
+	tv += 0.02f * gt.DeltaTime();
+
+	if (tu >= 1.0f)
+		tu -= 1.0f;
+	if (tv >= 1.0f)
+		tv -= 1.0f;
+
+	waterMat->MatTransform(3, 0) = tu;
+	waterMat->MatTransform(3, 1) = tv;
+
+	// Material has changed, so need to update cbuffer.
+	mMaterialDirty.Mark(waterMat->MatCBIndex);
+}
+
+
+void ShapesApp::UpdateObjectCBs(const GameTimer& gt)
+{
+	auto currObjectBuffer = mCurrFrameResource->ObjectBuffer.get();
+	auto currInstanceBuffer = mCurrFrameResource->InstanceBuffer.get();
+	auto currInstanceCullBuffer = mCurrFrameResource->InstanceCullBuffer.get();
+
+	// Only the slots whose constants changed recently.  Each run is transposed straight
+	// into the mapped buffers with streaming stores.
+	auto writeSlot = [&](UINT slot, ObjectConstants* dst)
+	{
+		const XMFLOAT4X4& world = mTransforms.World(slot);
+		const XMFLOAT4X4& texTransform = mTransforms.TexTransform(slot);
+
+		MathHelper::StoreTransposedStream(&dst->World, world);
+		MathHelper::StoreTransposedStream(&dst->TexTransform, texTransform);
+
+		// Batched items read their transforms from the instance buffer instead.
+		const RenderItem* e = mTransformOwners[slot];
+		if (e != nullptr && e->InstanceIndex != (UINT)-1)
+		{
+			InstanceData* instData = currInstanceBuffer->MappedElement(e->InstanceIndex);
+			MathHelper::StoreTransposedStream(&instData->World, world);
+			MathHelper::StoreTransposedStream(&instData->TexTransform, texTransform);
+			instData->LightmapScaleOffset = e->LightmapScaleOffset;
+			instData->LightmapSlice = e->LightmapSlice;
+
+			InstanceCullData cullData;
+			cullData.Center = e->Bounds.Center;
+			cullData.Extents = e->Bounds.Extents;
+			cullData.Batch = e->BatchIndex;
+			cullData.BatchStart = e->BatchStart;
+			cullData.MaterialIndex = (UINT)e->Mat->MatCBIndex;
+			cullData.StartIndexLocation = e->StartIndexLocation;
+			cullData.BaseVertexLocation = e->BaseVertexLocation;
+			if (e->MeshletDraw != (UINT)-1)
+			{
+				cullData.FirstMeshlet = e->FirstMeshlet;
+				cullData.MeshletCount = e->MeshletCount;
+				cullData.MeshletDraw = e->MeshletDraw;
+			}
+			currInstanceCullBuffer->CopyData(e->InstanceIndex, cullData);
+		}
+	};
+
+	// Short runs are packed together and long ones split, so every job writes about
+	// gObjectCBChunkSize slots.  Different jobs never share a slot or an instance.
+	// A job's spans are in the frame's arena: no more of them than its slots.
+	JobSystem::Counter chunks;
+	std::pair<UINT, UINT>* spans = nullptr;
+	UINT spanCount = 0;
+	UINT spanSlots = 0;
+	auto submitSpans = [&]()
+	{
+		mJobs->Run(chunks, [currObjectBuffer, &writeSlot, spans, spanCount]()
+		{
+			for (UINT i = 0; i < spanCount; ++i)
+				currObjectBuffer->CopyRange(spans[i].first, spans[i].second, writeSlot);
+		});
+		spans = nullptr;
+		spanCount = 0;
+		spanSlots = 0;
+	};
+
+	mTransforms.ConsumeDirtyRanges([&](std::uint32_t first, std::uint32_t count)
+	{
+		while (count > 0)
+		{
+			if (spans == nullptr)
+				spans = mCurrFrameResource->Arena.AllocateArray<std::pair<UINT, UINT>>(gObjectCBChunkSize);
+
+			UINT take = MathHelper::Min<UINT>(count, gObjectCBChunkSize - spanSlots);
+			spans[spanCount++] = std::make_pair(first, take);
+			spanSlots += take;
+			first += take;
+			count -= take;
+
+			if (spanSlots == gObjectCBChunkSize)
+				submitSpans();
+		}
+	});
+	if (spanCount > 0)
+		submitSpans();
+
+	// Writes spans itself until every job is done.
+	mJobs->Wait(chunks);
+}
+
+void ShapesApp::UpdateMaterialCBs(const GameTimer& gt)
+{
+	auto currMaterialBuffer = mCurrFrameResource->MaterialBuffer.get();
+	mMaterialDirty.Consume([&](std::uint32_t first, std::uint32_t count)
+	{
+		for (std::uint32_t index = first; index < first + count; ++index)
+		{
+			const Material* mat = mMaterialsByIndex[index];
+			XMMATRIX matTransform = XMLoadFloat4x4(&mat->MatTransform);
+
+			MaterialData matData;
+			matData.DiffuseAlbedo = mat->DiffuseAlbedo;
+			matData.FresnelR0 = mat->FresnelR0;
+			matData.Roughness = mat->Roughness;
+			XMStoreFloat4x4(&matData.MatTransform, XMMatrixTranspose(matTransform));
+			matData.DiffuseMapIndex = mat->DiffuseSrvHeapIndex;
+			matData.Flags = mat->Flags;
+
+			currMaterialBuffer->CopyData(mat->MatCBIndex, matData);
+		}
+	});
+}
+
+void ShapesApp::UpdateMainPassCB(const GameTimer& gt)
+{
+	// Every view has the same near and far planes.
+	mMainPassCB.NearZ = mCamera.GetNearZ();
+	mMainPassCB.FarZ = mCamera.GetFarZ();
 	mMainPassCB.TotalTime = gt.TotalTime();
 	mMainPassCB.DeltaTime = gt.DeltaTime();
-	
-	mMainPassCB.FogColor = XMFLOAT4(0.125f, 0.26f, 0.3f, 0.5f);
-	mMainPassCB.gFogStart = 70.0f;
 
-	/*------------------------ LIGHTS ------------------------*/
-	
-	//Ambient
-	mMainPassCB.AmbientLight = { 0.01f, 0.01f, 0.01f, 0.5f };
+	UpdateSceneCB();
+
+	if (gClusteredLighting)
+	{
+		// slice = log(viewZ / NearZ) / log(FarZ / NearZ) * gClusterCountZ, split into a
+		// scale and a bias on log(viewZ).
+		const float logDepthRange = logf(mMainPassCB.FarZ / mMainPassCB.NearZ);
+
+		ClusterParams& cluster = mMainPassCB.Cluster;
+		cluster.SliceScale = gClusterCountZ / logDepthRange;
+		cluster.SliceBias = gClusterCountZ * logf(mMainPassCB.NearZ) / logDepthRange;
+	}
+
+	// Light 0 is the first directional light in either layout.
+	static_assert(_countof(mMainPassCB.ShadowTransform) == CascadedShadowMap::CascadeCount,
+		"PassConstants and Default.hlsl need a shadow transform per cascade");
+	mShadowMap->Update(mCamera, mSceneCB.Lights[0].Direction);
+
+	float splits[CascadedShadowMap::CascadeCount];
+	for (UINT i = 0; i < CascadedShadowMap::CascadeCount; ++i)
+	{
+		XMStoreFloat4x4(&mMainPassCB.ShadowTransform[i], XMMatrixTranspose(mShadowMap->ShadowTransform(i)));
+		splits[i] = mShadowMap->SplitDistance(i);
+	}
+	mMainPassCB.CascadeSplits = XMFLOAT4(splits);
+	mMainPassCB.ShadowMapIndex = mShadowMap->SrvIndex();
+	mMainPassCB.ShadowTexelSize = 1.0f / mShadowMap->Size();
+
+	for (SceneView& view : mViews)
+		UpdateViewPassCB(view);
+
+	// The shadow passes see the scene through each cascade's light box instead.
+	PassConstants shadowPassCB = mViews[0].PassCB;
+	for (UINT i = 0; i < CascadedShadowMap::CascadeCount; ++i)
+	{
+		XMStoreFloat4x4(&shadowPassCB.ViewProj, XMMatrixTranspose(mShadowMap->ViewProj(i)));
+		mShadowPassCBAddress[i] = mUploadRing->CopyConstants(shadowPassCB).GpuAddress;
+	}
+}
+
+// The shared constants with the view's camera and rectangle written over them.
+void ShapesApp::UpdateViewPassCB(SceneView& view)
+{
+	const Camera& camera = *view.ViewCamera;
+	PassConstants& passCB = view.PassCB;
+
+	// The matrices, and the three inverses above all, only change with the camera.
+	if (camera.GetViewVersion() != view.PassViewVersion || camera.GetLensVersion() != view.PassLensVersion)
+	{
+		XMMATRIX viewMatrix = camera.GetView();
+		XMMATRIX proj = camera.GetProj();
+
+		XMMATRIX viewProj = XMMatrixMultiply(viewMatrix, proj);
+		XMMATRIX invView = XMMatrixInverse(&XMMatrixDeterminant(viewMatrix), viewMatrix);
+		XMMATRIX invProj = XMMatrixInverse(&XMMatrixDeterminant(proj), proj);
+		XMMATRIX invViewProj = XMMatrixInverse(&XMMatrixDeterminant(viewProj), viewProj);
+
+		XMStoreFloat4x4(&passCB.View, XMMatrixTranspose(viewMatrix));
+		XMStoreFloat4x4(&passCB.InvView, XMMatrixTranspose(invView));
+		XMStoreFloat4x4(&passCB.Proj, XMMatrixTranspose(proj));
+		XMStoreFloat4x4(&passCB.InvProj, XMMatrixTranspose(invProj));
+		XMStoreFloat4x4(&passCB.ViewProj, XMMatrixTranspose(viewProj));
+		XMStoreFloat4x4(&passCB.InvViewProj, XMMatrixTranspose(invViewProj));
+
+		view.PassViewVersion = camera.GetViewVersion();
+		view.PassLensVersion = camera.GetLensVersion();
+	}
+	passCB.EyePosW = camera.GetPosition3f();
+	passCB.RenderTargetSize = XMFLOAT2(view.Viewport.Width, view.Viewport.Height);
+	passCB.InvRenderTargetSize = XMFLOAT2(1.0f / view.Viewport.Width, 1.0f / view.Viewport.Height);
+
+	passCB.NearZ = mMainPassCB.NearZ;
+	passCB.FarZ = mMainPassCB.FarZ;
+	passCB.TotalTime = mMainPassCB.TotalTime;
+	passCB.DeltaTime = mMainPassCB.DeltaTime;
+	std::copy(std::begin(mMainPassCB.ShadowTransform), std::end(mMainPassCB.ShadowTransform), passCB.ShadowTransform);
+	passCB.CascadeSplits = mMainPassCB.CascadeSplits;
+	passCB.ShadowMapIndex = mMainPassCB.ShadowMapIndex;
+	passCB.ShadowTexelSize = mMainPassCB.ShadowTexelSize;
+	passCB.LightmapIndex = mMainPassCB.LightmapIndex;
+
+	// The clusters tile the view's rectangle; SV_Position is in render target pixels.
+	if (gClusteredLighting)
+	{
+		passCB.Cluster = mMainPassCB.Cluster;
+		passCB.Cluster.TileSize = XMFLOAT2(ceilf(view.Viewport.Width / gClusterCountX), ceilf(view.Viewport.Height / gClusterCountY));
+		passCB.Cluster.Origin = XMFLOAT2(view.Viewport.TopLeftX, view.Viewport.TopLeftY);
+	}
+
+	view.PassCBAddress = mUploadRing->CopyConstants(passCB).GpuAddress;
+}
+
+// The lights, fog and ambient live in mSceneCBBuffer, in the default heap, and are
+// uploaded again only when they change.  Only a light that follows the camera changes
+// them between frames, and with clustered lighting those are in the local light
+// buffer, which is still written every frame.
+void ShapesApp::UpdateSceneCB()
+{
+	const XMFLOAT3 eyePos = mCamera.GetPosition3f();
+
+	if (gClusteredLighting)
+	{
+		// The point and spot lights go to this frame's local light buffer, the point
+		// lights marked by a SpotPower of zero, for RecordLightClustering to bin.  The
+		// ones that follow the camera go first: the lightmapped items evaluate those
+		// themselves, having the others baked in.
+		UINT localLightCapacity = MathHelper::Clamp((UINT)mLights.size(), 1u, gMaxLocalLights);
+		mLocalLightUpload = mUploadRing->Allocate(localLightCapacity * sizeof(Light));
+		Light* localLights = reinterpret_cast<Light*>(mLocalLightUpload.CpuAddress);
+
+		UINT localLightCount = 0;
+		UINT dynamicLightCount = 0;
+		for (int pass = 0; pass < 2; ++pass)
+		{
+			const bool followsCamera = pass == 0;
+			for (const SceneLight& sceneLight : mLights)
+			{
+				if (sceneLight.Type == SceneLightType::Directional || (sceneLight.FollowsCamera != 0) != followsCamera ||
+					localLightCount == localLightCapacity)
+					continue;
+
+				Light& light = localLights[localLightCount++];
+				light = sceneLight.Data;
+				if (sceneLight.Type == SceneLightType::Point)
+					light.SpotPower = 0.0f;
+				if (sceneLight.FollowsCamera)
+					light.Position = eyePos;
+			}
+			if (followsCamera)
+				dynamicLightCount = localLightCount;
+		}
+		mMainPassCB.Cluster.LocalLightCount = localLightCount;
+		mMainPassCB.Cluster.DynamicLightCount = dynamicLightCount;
+	}
+	else if (mSceneCBFollowsCamera && (eyePos.x != mSceneCBEyePos.x || eyePos.y != mSceneCBEyePos.y || eyePos.z != mSceneCBEyePos.z))
+	{
+		mSceneCBDirty = true;
+	}
+
+	if (!mSceneCBDirty)
+		return;
+
+	const SceneEnvironment& environment = mEnvironment;
+	mSceneCB.FogColor = environment.FogColor;
+	mSceneCB.gFogStart = environment.FogStart;
+	mSceneCB.gFogRange = environment.FogRange;
+	mSceneCB.AmbientLight = environment.AmbientLight;
+
+	for (Light& light : mSceneCB.Lights)
+		light.Strength = XMFLOAT3(0.0f, 0.0f, 0.0f);
+
+	mSceneCBFollowsCamera = false;
+	if (gClusteredLighting)
+	{
+		// Only the directional lights stay in the scene constants.
+		int dirLights = 0;
+		for (const SceneLight& sceneLight : mLights)
+		{
+			if (sceneLight.Type == SceneLightType::Directional && dirLights < gNumDirLights)
+				mSceneCB.Lights[dirLights++] = sceneLight.Data;
+		}
+	}
+	else
+	{
+		// Default.hlsl expects the directional lights first, then the point lights, then
+		// the spot lights, in runs of NUM_DIR_LIGHTS, NUM_POINT_LIGHTS and NUM_SPOT_LIGHTS.
+		// Lights beyond a run's size are dropped and unused slots stay dark.
+		const int lightCounts[] = { gNumDirLights, gNumPointLights, gNumSpotLights };
+		int firstLight[3] = { 0, gNumDirLights, gNumDirLights + gNumPointLights };
+		int used[3] = {};
+
+		for (const SceneLight& sceneLight : mLights)
+		{
+			int type = (int)sceneLight.Type;
+			if (used[type] == lightCounts[type])
+				continue;
+
+			Light& light = mSceneCB.Lights[firstLight[type] + used[type]++];
+			light = sceneLight.Data;
+			if (sceneLight.FollowsCamera)
+			{
+				light.Position = eyePos;
+				mSceneCBFollowsCamera = true;
+			}
+		}
+	}
+
+	// BuildRenderGraph copies it into the buffer ahead of the passes that read it.
+	mSceneCBUpload = mUploadRing->CopyConstants(mSceneCB);
+	mSceneCBEyePos = eyePos;
+	mSceneCBDirty = false;
+	mSceneCBPending = true;
+}
+
+void ShapesApp::UpdateCulling()
+{
+	const RenderLayer culledLayers[] = { RenderLayer::Opaque, RenderLayer::Transparent };
+
+	if (mCullMode == CullMode::Cpu)
+	{
+		// Bring the camera frustum into world space, where the item bounds live.
+		XMMATRIX view = mCamera.GetView();
+		XMMATRIX invView = XMMatrixInverse(&XMMatrixDeterminant(view), view);
+
+		BoundingFrustum worldFrustum;
+		mViews[0].Frustum.Transform(worldFrustum, invView);
+
+		// Pack the visible instances at the front of each batch's range.
+		mVisibleInstanceUpload = mUploadRing->Allocate(MathHelper::Max(mInstanceCount, 1u) * sizeof(UINT), sizeof(UINT));
+		UINT* visibleInstances = reinterpret_cast<UINT*>(mVisibleInstanceUpload.CpuAddress);
+		for (RenderLayer layer : culledLayers)
+		{
+			for (auto& batch : mBatchLayer[(int)layer])
+			{
+				batch.VisibleCount = 0;
+				for (RenderItem* ri : batch.Instances)
+				{
+					if (worldFrustum.Contains(ri->Bounds) != DirectX::DISJOINT)
+						visibleInstances[batch.InstanceStart + batch.VisibleCount++] = ri->InstanceIndex;
+				}
+			}
+		}
+	}
+
+	// The other views are culled on the GPU either way.
+	if (mCullMode == CullMode::Gpu || mViews.size() > 1)
+	{
+		// The compute shader fills in the instance counts; write the rest of the arguments.
+		// The meshlet draws come after room for every batch, as in the DrawArgs buffers.
+		const UINT64 meshletDrawStart = mBatchCapacity * sizeof(D3D12_DRAW_INDEXED_ARGUMENTS);
+		mDrawArgsResetBytes = mMeshletDrawCount > 0 ?
+			meshletDrawStart + mMeshletDrawCount * sizeof(MeshletDrawArguments) :
+			mBatchCount * sizeof(D3D12_DRAW_INDEXED_ARGUMENTS);
+		mDrawArgsUpload = mUploadRing->Allocate(mDrawArgsResetBytes);
+		auto drawArgs = reinterpret_cast<D3D12_DRAW_INDEXED_ARGUMENTS*>(mDrawArgsUpload.CpuAddress);
+		auto meshletDraws = reinterpret_cast<MeshletDrawArguments*>(static_cast<std::uint8_t*>(mDrawArgsUpload.CpuAddress) + meshletDrawStart);
+		const Meshlet* meshlets = mScene.Meshlets().Data;
+		for (RenderLayer layer : culledLayers)
+		{
+			for (const auto& batch : mBatchLayer[(int)layer])
+			{
+				D3D12_DRAW_INDEXED_ARGUMENTS& args = drawArgs[batch.BatchIndex];
+				args.IndexCountPerInstance = batch.IndexCount;
+				args.InstanceCount = 0;
+				args.StartIndexLocation = batch.StartIndexLocation;
+				args.BaseVertexLocation = batch.BaseVertexLocation;
+				args.StartInstanceLocation = 0;
+
+				for (UINT m = 0; m < batch.MeshletCount; ++m)
+				{
+					const Meshlet& meshlet = meshlets[batch.FirstMeshlet + m];
+					MeshletDrawArguments& meshletArgs = meshletDraws[batch.MeshletDraw + m];
+					meshletArgs.VisibleOffset = batch.MeshletInstanceStart + m * (UINT)batch.Instances.size();
+					meshletArgs.Draw.IndexCountPerInstance = meshlet.IndexCount;
+					meshletArgs.Draw.InstanceCount = 0;
+					meshletArgs.Draw.StartIndexLocation = batch.StartIndexLocation + meshlet.FirstIndex;
+					meshletArgs.Draw.BaseVertexLocation = batch.BaseVertexLocation;
+					meshletArgs.Draw.StartInstanceLocation = 0;
+				}
+			}
+		}
+	}
+
+	// The trees are always culled on the GPU.  Each tile's item carries the transform
+	// its trees are placed with.
+	const auto& treeTiles = mRitemLayer[(int)RenderLayer::AlphaTestedTreeSprites];
+	if (!treeTiles.empty())
+	{
+		mTreeTileUpload = mUploadRing->Allocate(treeTiles.size() * sizeof(XMFLOAT4X4));
+		auto tileWorld = reinterpret_cast<XMFLOAT4X4*>(mTreeTileUpload.CpuAddress);
+		for (size_t i = 0; i < treeTiles.size(); ++i)
+			XMStoreFloat4x4(&tileWorld[i], XMMatrixTranspose(XMLoadFloat4x4(&mTransforms.World(treeTiles[i]->ObjCBIndex))));
+
+		mTreeDrawArgsUpload = mUploadRing->Allocate(sizeof(D3D12_DRAW_ARGUMENTS));
+		auto& treeArgs = *reinterpret_cast<D3D12_DRAW_ARGUMENTS*>(mTreeDrawArgsUpload.CpuAddress);
+		treeArgs.VertexCountPerInstance = 4;
+		treeArgs.InstanceCount = 0;
+		treeArgs.StartVertexLocation = 0;
+		treeArgs.StartInstanceLocation = 0;
+	}
+}
+
+void ShapesApp::UpdateResidency()
+{
+	// A texture is used while anything with one of its materials is in a view's frustum.
+	bool* visibleMaterials = mCurrFrameResource->Arena.AllocateArray<bool>(mMaterials.size());
+	for (const SceneView& sceneView : mViews)
+	{
+		XMMATRIX view = sceneView.ViewCamera->GetView();
+		XMMATRIX invView = XMMatrixInverse(&XMMatrixDeterminant(view), view);
+
+		BoundingFrustum worldFrustum;
+		sceneView.Frustum.Transform(worldFrustum, invView);
+
+		for (const auto& layer : mRitemLayer)
+		{
+			for (const RenderItem* ri : layer)
+			{
+				if (!visibleMaterials[ri->Mat->MatCBIndex] && worldFrustum.Contains(ri->Bounds) != DirectX::DISJOINT)
+					visibleMaterials[ri->Mat->MatCBIndex] = true;
+			}
+		}
+	}
+
+	for (const TextureSlot* slot : mStreamedTextures)
+	{
+		for (const Material* mat : slot->Users)
+		{
+			if (visibleMaterials[mat->MatCBIndex])
+			{
+				mResidency->MarkUsed(slot->ResidencyHandle, mFrameNumber);
+				break;
+			}
+		}
+	}
+
+	// Empty heaps count as free: placing something in one doesn't grow the process.
+	UINT64 reclaimable = mResourceAllocator->HeapBytes() - mResourceAllocator->BytesInUse() -
+		mResourceAllocator->EvictedBytes();
+	mResidency->Update(mFrameNumber, reclaimable, mDemoteScratch, mPromoteScratch);
+
+	for (UINT handle : mDemoteScratch)
+	{
+		TextureSlot& slot = *mStreamedTextures[handle];
+		slot.Demoted = true;
+		mTextureStreamer->Demote(slot.StreamId);
+	}
+	for (UINT handle : mPromoteScratch)
+	{
+		TextureSlot& slot = *mStreamedTextures[handle];
+		slot.Demoted = false;
+		mTextureStreamer->Promote(slot.StreamId);
+	}
+
+	// Within the budget, empty heaps are kept resident for what is placed next.
+	if (mResidency->OverBudget())
+		mResourceAllocator->EvictUnusedHeaps();
+}
+
+void ShapesApp::UpdateShadowCasters()
+{
+	mShadowDraws.clear();
+	mShadowInstances.clear();
+
+	// Only the opaque layer casts.  The static casters of a cascade are culled when
+	// it has to be re-rendered, the dynamic ones every frame.
+	const auto& opaque = mBatchLayer[(int)RenderLayer::Opaque];
+	for (UINT i = 0; i < CascadedShadowMap::CascadeCount; ++i)
+	{
+		const size_t rangeStart = mShadowDraws.size();
+		mStaticShadowDraws[i] = rangeStart;
+		if (!mShadowMap->StaticDirty(i))
+			continue;
+
+		const BoundingOrientedBox& bounds = mShadowMap->CasterBounds(i);
+		for (const RenderBatch& batch : opaque)
+		{
+			for (const RenderItem* ri : batch.Instances)
+			{
+				if (!ri->DynamicCaster && bounds.Intersects(ri->Bounds))
+					AddShadowDraw(ri, rangeStart);
+			}
+		}
+	}
+	mStaticShadowDraws[CascadedShadowMap::CascadeCount] = mShadowDraws.size();
+
+	for (UINT i = 0; i < CascadedShadowMap::CascadeCount; ++i)
+	{
+		const size_t rangeStart = mShadowDraws.size();
+		mDynamicShadowDraws[i] = rangeStart;
+
+		const BoundingOrientedBox& bounds = mShadowMap->CasterBounds(i);
+		for (const RenderItem* ri : mDynamicCasters)
+		{
+			if (bounds.Intersects(ri->Bounds))
+				AddShadowDraw(ri, rangeStart);
+		}
+	}
+	mDynamicShadowDraws[CascadedShadowMap::CascadeCount] = mShadowDraws.size();
+
+	if (!mShadowInstances.empty())
+	{
+		mShadowInstanceUpload = mUploadRing->Allocate(mShadowInstances.size() * sizeof(UINT), sizeof(UINT));
+		memcpy(mShadowInstanceUpload.CpuAddress, mShadowInstances.data(), mShadowInstances.size() * sizeof(UINT));
+	}
+}
+
+// Appends ri's instance to the last draw of the range if that draws the same submesh
+// with the same material, and starts a new draw otherwise.
+void ShapesApp::AddShadowDraw(const RenderItem* ri, size_t rangeStart)
+{
+	if (mShadowDraws.size() > rangeStart)
+	{
+		ShadowDraw& last = mShadowDraws.back();
+		const RenderItem* prev = last.Item;
+		if (prev->Geo == ri->Geo && prev->Mat == ri->Mat &&
+			prev->IndexCount == ri->IndexCount &&
+			prev->StartIndexLocation == ri->StartIndexLocation &&
+			prev->BaseVertexLocation == ri->BaseVertexLocation)
+		{
+			mShadowInstances.push_back(ri->InstanceIndex);
+			++last.InstanceCount;
+			return;
+		}
+	}
+
+	ShadowDraw draw;
+	draw.Item = ri;
+	draw.FirstInstance = (UINT)mShadowInstances.size();
+	draw.InstanceCount = 1;
+	mShadowDraws.push_back(draw);
+	mShadowInstances.push_back(ri->InstanceIndex);
+}
+
+// Extracts the six planes of a view-projection matrix's frustum, normals pointing inward.
+static void ExtractFrustumPlanes(FXMMATRIX viewProj, XMFLOAT4 planes[6])
+{
+	// Row vectors multiply on the left, so the planes come from the columns.
+	XMMATRIX m = XMMatrixTranspose(viewProj);
+
+	XMVECTOR p[6] =
+	{
+		m.r[3] + m.r[0], // left
+		m.r[3] - m.r[0], // right
+		m.r[3] + m.r[1], // bottom
+		m.r[3] - m.r[1], // top
+		m.r[2],          // near
+		m.r[3] - m.r[2]  // far
+	};
+
+	for (int i = 0; i < 6; ++i)
+		XMStoreFloat4(&planes[i], XMPlaneNormalize(p[i]));
+}
+
+// Declares the passes the frame's main list records.  The worker lists record after
+// the graph has executed; the forward pass stands in for them, so its barriers make
+// what they read ready.
+void ShapesApp::BuildRenderGraph()
+{
+	RenderGraph& graph = *mRenderGraph;
+	graph.Reset();
+
+	const bool gpuCulling = mCullMode == CullMode::Gpu;
+	const bool occlusion = gpuCulling && mOcclusionCulling && mHiZ->Supported();
+	const bool drawTrees = !mRitemLayer[(int)RenderLayer::AlphaTestedTreeSprites].empty();
+
+	// The back buffer itself, unless the transparent list resolves into it.
+	auto sceneColor = graph.Import("scene color", SceneTarget());
+	auto depthBuffer = graph.Import("depth buffer", mDepthStencilBuffer.Get());
+	const FrameResource::ViewBuffers& mainView = mCurrFrameResource->Views[0];
+	auto drawArgs = graph.Import("draw args", mainView.DrawArgs.Get());
+	auto visibleInstances = graph.Import("visible instances", mainView.VisibleInstances.Get());
+	auto visibleLastFrame = graph.Import("visible last frame", mVisibleLastFrame.Get());
+	auto clusterLights = graph.Import("cluster lights", mainView.ClusterLights.Get());
+	auto treeDrawArgs = graph.Import("tree draw args", mainView.TreeDrawArgs.Get());
+	auto visibleTrees = graph.Import("visible trees", mainView.VisibleTrees.Get());
+	auto staticShadowMap = graph.Import("static shadow map", mShadowMap->StaticResource());
+	auto shadowMap = graph.Import("shadow map", mShadowMap->Resource());
+	auto sceneCB = graph.Import("scene constants", mSceneCBBuffer.Get());
+
+	if (mSceneCBPending)
+	{
+		graph.AddPass("scene constants",
+			[&](RenderGraph::Builder& builder)
+			{
+				builder.Write(sceneCB, D3D12_RESOURCE_STATE_COPY_DEST);
+			},
+			[this, upload = mSceneCBUpload](ID3D12GraphicsCommandList* cmdList)
+			{
+				cmdList->CopyBufferRegion(mSceneCBBuffer.Get(), 0, upload.Resource, upload.Offset, sizeof(SceneConstants));
+			});
+		mSceneCBPending = false;
+	}
+
+	// The first opaque list readies the visibility buffer, so there has to be one.
+	mVisibilityThisFrame = mVisibilityRendering && mVisibilityTarget != nullptr && mSceneColor != nullptr &&
+		mVisibilitySupported && !mBatchLayer[(int)RenderLayer::Opaque].empty();
+
+	// The shading rates come from the last frame's depth and colour, so they are read
+	// before the clear.  Without mSceneColor the back buffer has changed since.
+	mShadingRateImageThisFrame = mVariableRateShading && mShadingRate->ImageSupported();
+	RenderGraph::Handle shadingRateImage = 0;
+	if (mShadingRateImageThisFrame)
+	{
+		shadingRateImage = graph.CreateTransient("shading rate image", mShadingRate->TextureDesc());
+
+		graph.AddPass("shading rate",
+			[&](RenderGraph::Builder& builder)
+			{
+				builder.Read(depthBuffer, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+				if (mSceneColor != nullptr)
+					builder.Read(sceneColor, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+				builder.Write(shadingRateImage, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+			},
+			[this, shadingRateImage](ID3D12GraphicsCommandList* cmdList)
+			{
+				mShadingRate->SetTexture(mRenderGraph->Resource(shadingRateImage), mCurrentFence);
+
+				const XMFLOAT4X4 proj = mViews[0].ViewCamera->GetProj4x4f();
+				ShadingRateImage::BuildConstants constants;
+				constants.ProjA = proj._33;
+				constants.ProjB = proj._43;
+				constants.FogStart = mSceneCB.gFogStart;
+				constants.FogRange = mSceneCB.gFogRange;
+				constants.Coarse2x2Contrast = gShadingRate2x2Contrast;
+				constants.Coarse4x4Contrast = gShadingRate4x4Contrast;
+
+				D3D12_GPU_DESCRIPTOR_HANDLE colorSrv = {};
+				if (mSceneColor != nullptr)
+					colorSrv = mSrvHeap->GpuHandle(mSceneSrvIndex);
+
+				mProfiler->BeginScope(cmdList, mShadingRateGpuScope);
+				cmdList->SetPipelineState(GetPipeline(PipelineId::ShadingRate));
+				cmdList->SetComputeRootSignature(mShadingRateRootSignature.Get());
+				mShadingRate->Build(cmdList, constants, colorSrv);
+				mProfiler->EndScope(cmdList, mShadingRateGpuScope);
+			});
+	}
+
+	graph.AddPass("clear",
+		[&](RenderGraph::Builder& builder)
+		{
+			builder.Write(sceneColor, D3D12_RESOURCE_STATE_RENDER_TARGET);
+			builder.Write(depthBuffer, D3D12_RESOURCE_STATE_DEPTH_WRITE);
+		},
+		[this](ID3D12GraphicsCommandList* cmdList)
+		{
+			mProfiler->BeginScope(cmdList, mClearGpuScope);
+			cmdList->ClearRenderTargetView(SceneTargetView(), (float*)&mSceneCB.FogColor, 0, nullptr);
+			D3D12_CLEAR_FLAGS depthClearFlags = D3D12_CLEAR_FLAG_DEPTH;
+			if (mDepthStencilFormat == DXGI_FORMAT_D24_UNORM_S8_UINT)
+				depthClearFlags |= D3D12_CLEAR_FLAG_STENCIL;
+			cmdList->ClearDepthStencilView(DepthStencilView(), depthClearFlags, DepthClearValue(), 0, 0, nullptr);
+			mProfiler->EndScope(cmdList, mClearGpuScope);
+		});
+
+	if (gpuCulling)
+	{
+		// The pre-pass lists and the pyramid only live until the occlusion phase, so
+		// they share memory with each other's neighbours in the transient heaps.
+		RenderGraph::Handle prepassDrawArgs = 0;
+		RenderGraph::Handle prepassVisibleInstances = 0;
+		RenderGraph::Handle hiZ = 0;
+		if (occlusion)
+		{
+			prepassDrawArgs = graph.CreateTransient("prepass draw args", CD3DX12_RESOURCE_DESC::Buffer(
+				mBatchCapacity * sizeof(D3D12_DRAW_INDEXED_ARGUMENTS) + mMeshletDrawCapacity * sizeof(MeshletDrawArguments),
+				D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS));
+			prepassVisibleInstances = graph.CreateTransient("prepass visible instances", CD3DX12_RESOURCE_DESC::Buffer(
+				MathHelper::Max(mInstanceCapacity + mMeshletInstanceCapacity, 1u) * sizeof(UINT), D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS));
+			hiZ = graph.CreateTransient("hi-z pyramid", mHiZ->TextureDesc());
+		}
+
+		// Reset the arguments to zero instances; the shader counts the visible ones up.
+		graph.AddPass("cull reset",
+			[&](RenderGraph::Builder& builder)
+			{
+				builder.Write(drawArgs, D3D12_RESOURCE_STATE_COPY_DEST);
+				if (occlusion)
+					builder.Write(prepassDrawArgs, D3D12_RESOURCE_STATE_COPY_DEST);
+			},
+			[this, occlusion, drawArgs, prepassDrawArgs](ID3D12GraphicsCommandList* cmdList)
+			{
+				mProfiler->BeginScope(cmdList, mCullGpuScope);
+
+				cmdList->CopyBufferRegion(mRenderGraph->Resource(drawArgs), 0,
+					mDrawArgsUpload.Resource, mDrawArgsUpload.Offset, mDrawArgsResetBytes);
+				if (occlusion)
+				{
+					cmdList->CopyBufferRegion(mRenderGraph->Resource(prepassDrawArgs), 0,
+						mDrawArgsUpload.Resource, mDrawArgsUpload.Offset, mDrawArgsResetBytes);
+				}
+			});
+
+		if (!occlusion)
+		{
+			graph.AddPass("cull",
+				[&](RenderGraph::Builder& builder)
+				{
+					builder.Write(drawArgs, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+					builder.Write(visibleInstances, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+					builder.Read(visibleLastFrame, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+				},
+				[this, drawArgs, visibleInstances](ID3D12GraphicsCommandList* cmdList)
+				{
+					cmdList->SetPipelineState(GetPipeline(PipelineId::Cull));
+					cmdList->SetComputeRootSignature(mCullRootSignature.Get());
+					RecordCullPass(cmdList, CullPhase::Frustum, 0,
+						mRenderGraph->Resource(drawArgs), mRenderGraph->Resource(visibleInstances));
+
+					mProfiler->EndScope(cmdList, mCullGpuScope);
+				});
+		}
+		else
+		{
+			// What was visible last frame is drawn into the depth buffer first ...
+			graph.AddPass("prepass cull",
+				[&](RenderGraph::Builder& builder)
+				{
+					builder.Write(prepassDrawArgs, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+					builder.Write(prepassVisibleInstances, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+					builder.Read(visibleLastFrame, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+				},
+				[this, prepassDrawArgs, prepassVisibleInstances](ID3D12GraphicsCommandList* cmdList)
+				{
+					cmdList->SetPipelineState(GetPipeline(PipelineId::Cull));
+					cmdList->SetComputeRootSignature(mCullRootSignature.Get());
+					RecordCullPass(cmdList, CullPhase::Prepass, 0,
+						mRenderGraph->Resource(prepassDrawArgs), mRenderGraph->Resource(prepassVisibleInstances));
+				});
+
+			graph.AddPass("depth prepass",
+				[&](RenderGraph::Builder& builder)
+				{
+					builder.Read(prepassDrawArgs, D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT);
+					builder.Read(prepassVisibleInstances, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+					builder.Write(depthBuffer, D3D12_RESOURCE_STATE_DEPTH_WRITE);
+				},
+				[this, prepassDrawArgs, prepassVisibleInstances](ID3D12GraphicsCommandList* cmdList)
+				{
+					mProfiler->BeginScope(cmdList, mPrepassGpuScope);
+					RecordDepthPrepass(cmdList,
+						mRenderGraph->Resource(prepassDrawArgs), mRenderGraph->Resource(prepassVisibleInstances));
+					mProfiler->EndScope(cmdList, mPrepassGpuScope);
+				});
+
+			// ... reduced to the Hi-Z pyramid ...
+			graph.AddPass("hi-z",
+				[&](RenderGraph::Builder& builder)
+				{
+					builder.Read(depthBuffer, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+					builder.Write(hiZ, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+				},
+				[this, hiZ](ID3D12GraphicsCommandList* cmdList)
+				{
+					// Frames still in flight may read the views of a texture the graph
+					// replaced, so those only go once the GPU is past them.
+					mHiZ->SetTexture(mRenderGraph->Resource(hiZ), mCurrentFence);
+
+					mProfiler->BeginScope(cmdList, mHiZGpuScope);
+					cmdList->SetPipelineState(GetPipeline(PipelineId::HiZ));
+					cmdList->SetComputeRootSignature(mHiZRootSignature.Get());
+					mHiZ->Build(cmdList, mResourceStates);
+					mProfiler->EndScope(cmdList, mHiZGpuScope);
+				});
+
+			// ... and everything is tested against it.  The pre-pass cull read the
+			// history this pass overwrites, which the graph puts a UAV barrier between.
+			graph.AddPass("occlusion cull",
+				[&](RenderGraph::Builder& builder)
+				{
+					builder.Read(hiZ, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+					builder.Write(drawArgs, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+					builder.Write(visibleInstances, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+					builder.Write(visibleLastFrame, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+				},
+				[this, drawArgs, visibleInstances](ID3D12GraphicsCommandList* cmdList)
+				{
+					cmdList->SetPipelineState(GetPipeline(PipelineId::Cull));
+					cmdList->SetComputeRootSignature(mCullRootSignature.Get());
+					RecordCullPass(cmdList, CullPhase::Occlusion, 0,
+						mRenderGraph->Resource(drawArgs), mRenderGraph->Resource(visibleInstances));
+
+					mProfiler->EndScope(cmdList, mCullGpuScope);
+				});
+		}
+	}
+
+	if (drawTrees)
+	{
+		graph.AddPass("tree cull reset",
+			[&](RenderGraph::Builder& builder)
+			{
+				builder.Write(treeDrawArgs, D3D12_RESOURCE_STATE_COPY_DEST);
+			},
+			[this, treeDrawArgs](ID3D12GraphicsCommandList* cmdList)
+			{
+				mProfiler->BeginScope(cmdList, mTreeCullGpuScope);
+				cmdList->CopyBufferRegion(mRenderGraph->Resource(treeDrawArgs), 0,
+					mTreeDrawArgsUpload.Resource, mTreeDrawArgsUpload.Offset, sizeof(D3D12_DRAW_ARGUMENTS));
+			});
+
+		graph.AddPass("tree cull",
+			[&](RenderGraph::Builder& builder)
+			{
+				builder.Write(treeDrawArgs, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+				builder.Write(visibleTrees, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+			},
+			[this](ID3D12GraphicsCommandList* cmdList)
+			{
+				RecordTreeCulling(cmdList, 0);
+				mProfiler->EndScope(cmdList, mTreeCullGpuScope);
+			});
+	}
+
+	if (gClusteredLighting)
+	{
+		graph.AddPass("lights",
+			[&](RenderGraph::Builder& builder)
+			{
+				builder.Write(clusterLights, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+			},
+			[this](ID3D12GraphicsCommandList* cmdList)
+			{
+				mProfiler->BeginScope(cmdList, mLightsGpuScope);
+				RecordLightClustering(cmdList, 0);
+				mProfiler->EndScope(cmdList, mLightsGpuScope);
+			});
+	}
+
+	// The other views are only frustum culled, and leave the occlusion history to
+	// view 0.  Their arguments are reset together, then each view culls its batches
+	// and trees and bins its lights.
+	struct ViewHandles
+	{
+		RenderGraph::Handle DrawArgs = 0;
+		RenderGraph::Handle VisibleInstances = 0;
+		RenderGraph::Handle ClusterLights = 0;
+		RenderGraph::Handle TreeDrawArgs = 0;
+		RenderGraph::Handle VisibleTrees = 0;
+	};
+	ViewHandles* views = mCurrFrameResource->Arena.AllocateArray<ViewHandles>(mViews.size());
+	for (UINT v = 1; v < (UINT)mViews.size(); ++v)
+	{
+		const FrameResource::ViewBuffers& buffers = mCurrFrameResource->Views[v];
+		views[v].DrawArgs = graph.Import("view draw args", buffers.DrawArgs.Get());
+		views[v].VisibleInstances = graph.Import("view visible instances", buffers.VisibleInstances.Get());
+		views[v].ClusterLights = graph.Import("view cluster lights", buffers.ClusterLights.Get());
+		views[v].TreeDrawArgs = graph.Import("view tree draw args", buffers.TreeDrawArgs.Get());
+		views[v].VisibleTrees = graph.Import("view visible trees", buffers.VisibleTrees.Get());
+	}
+
+	if (mViews.size() > 1)
+	{
+		graph.AddPass("view cull reset",
+			[&](RenderGraph::Builder& builder)
+			{
+				for (UINT v = 1; v < (UINT)mViews.size(); ++v)
+				{
+					builder.Write(views[v].DrawArgs, D3D12_RESOURCE_STATE_COPY_DEST);
+					if (drawTrees)
+						builder.Write(views[v].TreeDrawArgs, D3D12_RESOURCE_STATE_COPY_DEST);
+				}
+			},
+			[this, drawTrees](ID3D12GraphicsCommandList* cmdList)
+			{
+				mProfiler->BeginScope(cmdList, mViewCullGpuScope);
+
+				for (UINT v = 1; v < (UINT)mViews.size(); ++v)
+				{
+					const FrameResource::ViewBuffers& buffers = mCurrFrameResource->Views[v];
+					cmdList->CopyBufferRegion(buffers.DrawArgs.Get(), 0,
+						mDrawArgsUpload.Resource, mDrawArgsUpload.Offset, mDrawArgsResetBytes);
+					if (drawTrees)
+					{
+						cmdList->CopyBufferRegion(buffers.TreeDrawArgs.Get(), 0,
+							mTreeDrawArgsUpload.Resource, mTreeDrawArgsUpload.Offset, sizeof(D3D12_DRAW_ARGUMENTS));
+					}
+				}
+			});
+
+		graph.AddPass("view cull",
+			[&](RenderGraph::Builder& builder)
+			{
+				builder.Read(visibleLastFrame, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+				for (UINT v = 1; v < (UINT)mViews.size(); ++v)
+				{
+					builder.Write(views[v].DrawArgs, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+					builder.Write(views[v].VisibleInstances, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+					if (drawTrees)
+					{
+						builder.Write(views[v].TreeDrawArgs, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+						builder.Write(views[v].VisibleTrees, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+					}
+					if (gClusteredLighting)
+						builder.Write(views[v].ClusterLights, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+				}
+			},
+			[this, drawTrees](ID3D12GraphicsCommandList* cmdList)
+			{
+				for (UINT v = 1; v < (UINT)mViews.size(); ++v)
+				{
+					const FrameResource::ViewBuffers& buffers = mCurrFrameResource->Views[v];
+					cmdList->SetPipelineState(GetPipeline(PipelineId::Cull));
+					cmdList->SetComputeRootSignature(mCullRootSignature.Get());
+					RecordCullPass(cmdList, CullPhase::Frustum, v, buffers.DrawArgs.Get(), buffers.VisibleInstances.Get());
+
+					if (drawTrees)
+						RecordTreeCulling(cmdList, v);
+					if (gClusteredLighting)
+						RecordLightClustering(cmdList, v);
+				}
+
+				mProfiler->EndScope(cmdList, mViewCullGpuScope);
+			});
+	}
+
+	// The cascades that moved get their static casters redrawn into the cache; then
+	// the cache is copied into the shadow map and every cascade gets its dynamic casters.
+	bool staticDirty = false;
+	for (UINT i = 0; i < CascadedShadowMap::CascadeCount; ++i)
+		staticDirty = staticDirty || mShadowMap->StaticDirty(i);
+
+	if (staticDirty)
+	{
+		graph.AddPass("static shadows",
+			[&](RenderGraph::Builder& builder)
+			{
+				builder.Write(staticShadowMap, D3D12_RESOURCE_STATE_DEPTH_WRITE);
+			},
+			[this](ID3D12GraphicsCommandList* cmdList)
+			{
+				mProfiler->BeginScope(cmdList, mShadowGpuScope);
+				RecordShadowCascades(cmdList, false);
+			});
+	}
+
+	graph.AddPass("shadow copy",
+		[&](RenderGraph::Builder& builder)
+		{
+			builder.Read(staticShadowMap, D3D12_RESOURCE_STATE_COPY_SOURCE);
+			builder.Write(shadowMap, D3D12_RESOURCE_STATE_COPY_DEST);
+		},
+		[this, staticDirty](ID3D12GraphicsCommandList* cmdList)
+		{
+			if (!staticDirty)
+				mProfiler->BeginScope(cmdList, mShadowGpuScope);
+			mShadowMap->CopyStatic(cmdList, mResourceStates);
+		});
+
+	graph.AddPass("dynamic shadows",
+		[&](RenderGraph::Builder& builder)
+		{
+			builder.Write(shadowMap, D3D12_RESOURCE_STATE_DEPTH_WRITE);
+		},
+		[this](ID3D12GraphicsCommandList* cmdList)
+		{
+			RecordShadowCascades(cmdList, true);
+			mProfiler->EndScope(cmdList, mShadowGpuScope);
+		});
+
+	graph.AddPass("forward",
+		[&](RenderGraph::Builder& builder)
+		{
+			builder.Write(sceneColor, D3D12_RESOURCE_STATE_RENDER_TARGET);
+			builder.Write(depthBuffer, D3D12_RESOURCE_STATE_DEPTH_WRITE);
+			builder.Read(shadowMap, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+			if (mVisibilityThisFrame)
+			{
+				// The resolve shades the first view in a compute shader.
+				builder.Read(shadowMap, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+				if (gClusteredLighting)
+					builder.Read(clusterLights, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+			}
+			if (gpuCulling)
+			{
+				builder.Read(drawArgs, D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT);
+				builder.Read(visibleInstances, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+			}
+			if (drawTrees)
+			{
+				builder.Read(treeDrawArgs, D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT);
+				builder.Read(visibleTrees, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+			}
+			if (gClusteredLighting)
+				builder.Read(clusterLights, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+			for (UINT v = 1; v < (UINT)mViews.size(); ++v)
+			{
+				builder.Read(views[v].DrawArgs, D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT);
+				builder.Read(views[v].VisibleInstances, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+				if (drawTrees)
+				{
+					builder.Read(views[v].TreeDrawArgs, D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT);
+					builder.Read(views[v].VisibleTrees, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+				}
+				if (gClusteredLighting)
+					builder.Read(views[v].ClusterLights, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+			}
+			builder.Read(sceneCB, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER);
+			if (mShadingRateImageThisFrame)
+				builder.Read(shadingRateImage, D3D12_RESOURCE_STATE_SHADING_RATE_SOURCE);
+		},
+		nullptr);
+}
+
+void ShapesApp::RecordCullPass(ID3D12GraphicsCommandList* cmdList, CullPhase phase, UINT view,
+	ID3D12Resource* drawArgs, ID3D12Resource* visibleInstances)
+{
+	const Camera& camera = *mViews[view].ViewCamera;
+
+	CullConstants cullConstants;
+	// The planes keep the far one; the occlusion test projects into the depth buffer's depths.
+	XMMATRIX viewMatrix = camera.GetView();
+	XMMATRIX viewProj = XMMatrixMultiply(viewMatrix, camera.GetProj());
+	ExtractFrustumPlanes(XMMatrixMultiply(viewMatrix, camera.GetCullProj()), cullConstants.FrustumPlanes);
+	XMStoreFloat4x4(&cullConstants.ViewProj, XMMatrixTranspose(viewProj));
+	// Only view 0's corner of the depth buffer, the one the pre-pass draws; past it
+	// the pyramid holds the clear depth, which occludes nothing.
+	cullConstants.DepthWidth = (UINT)mViews[0].Viewport.Width;
+	cullConstants.DepthHeight = (UINT)mViews[0].Viewport.Height;
+	cullConstants.Phase = phase;
+	cullConstants.HiZMipCount = mHiZ->MipCount();
+	cullConstants.ReverseZ = mReverseZ ? 1 : 0;
+	cullConstants.MeshletDrawStart = mBatchCapacity * sizeof(D3D12_DRAW_INDEXED_ARGUMENTS);
+	cullConstants.MeshletVisibleStart = mInstanceCapacity;
+	cullConstants.EyePosW = camera.GetPosition3f();
+
+	// The pyramid is only read by the occlusion phase; the other phases bind whatever
+	// the view holds.
+	cmdList->SetComputeRootShaderResourceView(1, mCurrFrameResource->InstanceCullBuffer->Resource()->GetGPUVirtualAddress());
+	cmdList->SetComputeRootUnorderedAccessView(2, visibleInstances->GetGPUVirtualAddress());
+	cmdList->SetComputeRootUnorderedAccessView(3, drawArgs->GetGPUVirtualAddress());
+	cmdList->SetComputeRootUnorderedAccessView(4, mVisibleLastFrame->GetGPUVirtualAddress());
+	cmdList->SetComputeRootDescriptorTable(5, mHiZ->Srv());
+	cmdList->SetComputeRootShaderResourceView(6, mMeshletBuffer->GetGPUVirtualAddress());
+	cmdList->SetComputeRootShaderResourceView(7, mCurrFrameResource->InstanceBuffer->Resource()->GetGPUVirtualAddress());
+
+	// A dispatch per layer, so the unused ends of the layers' ranges are skipped.
+	// One thread per instance, 64 threads per group.
+	for (RenderLayer layer : { RenderLayer::Opaque, RenderLayer::Transparent })
+	{
+		const BatchRange& range = mBatchRanges[(int)layer];
+		if (range.InstanceCount == 0)
+			continue;
+
+		cullConstants.FirstInstance = range.FirstInstance;
+		cullConstants.InstanceCount = range.InstanceCount;
+		cmdList->SetComputeRootConstantBufferView(0, mUploadRing->CopyConstants(cullConstants).GpuAddress);
+		cmdList->Dispatch((range.InstanceCount + 63) / 64, 1, 1);
+	}
+}
+
+void ShapesApp::RecordDepthPrepass(ID3D12GraphicsCommandList* cmdList,
+	ID3D12Resource* drawArgs, ID3D12Resource* visibleInstances)
+{
+	cmdList->RSSetViewports(1, &mViews[0].Viewport);
+	cmdList->RSSetScissorRects(1, &mViews[0].ScissorRect);
+
+	D3D12_CPU_DESCRIPTOR_HANDLE depthStencilView = DepthStencilView();
+	cmdList->OMSetRenderTargets(0, nullptr, false, &depthStencilView);
+
+	cmdList->SetGraphicsRootSignature(mRootSignature.Get());
+
+	DrawStateCache state(cmdList);
+	BindFrameRootArguments(state);
+	state.SetPipelineState(GetPipeline(PipelineId::DepthPrepass));
+
+	const auto& opaque = mBatchLayer[(int)RenderLayer::Opaque];
+	DrawRenderBatches(state, opaque, 0, opaque.size(), drawArgs, visibleInstances);
+}
+
+// Draws either the static casters of the cascades that moved into the cache, or the
+// dynamic casters of every cascade into the shadow map.
+void ShapesApp::RecordShadowCascades(ID3D12GraphicsCommandList* cmdList, bool dynamicCasters)
+{
+	cmdList->SetGraphicsRootSignature(mRootSignature.Get());
+
+	DrawStateCache state(cmdList);
+	BindFrameRootArguments(state);
+	state.SetPipelineState(GetPipeline(PipelineId::Shadow));
+
+	for (UINT i = 0; i < CascadedShadowMap::CascadeCount; ++i)
+	{
+		if (!dynamicCasters)
+		{
+			if (!mShadowMap->StaticDirty(i))
+				continue;
+
+			mShadowMap->BeginStaticCascade(cmdList, mResourceStates, i);
+			state.SetGraphicsRootConstantBufferView((UINT)RootParameter::PassCB, mShadowPassCBAddress[i]);
+			DrawShadowCasters(state, mStaticShadowDraws[i], mStaticShadowDraws[i + 1]);
+		}
+		else
+		{
+			if (mDynamicShadowDraws[i] == mDynamicShadowDraws[i + 1])
+				continue;
+
+			mShadowMap->BeginDynamicCascade(cmdList, mResourceStates, i);
+			state.SetGraphicsRootConstantBufferView((UINT)RootParameter::PassCB, mShadowPassCBAddress[i]);
+			DrawShadowCasters(state, mDynamicShadowDraws[i], mDynamicShadowDraws[i + 1]);
+		}
+	}
+}
+
+void ShapesApp::DrawShadowCasters(DrawStateCache& state, size_t first, size_t last)
+{
+	for (size_t i = first; i < last; ++i)
+	{
+		const ShadowDraw& draw = mShadowDraws[i];
+		const RenderItem* ri = draw.Item;
+
+		state.SetVertexBuffer(ri->Geo->VertexBufferView());
+		state.SetIndexBuffer(ri->Geo->IndexBufferView());
+		state.SetPrimitiveTopology(ri->PrimitiveType);
+
+		state.SetGraphicsRoot32BitConstants((UINT)RootParameter::DrawConstants, 0, (UINT)ri->Mat->MatCBIndex);
+		state.SetGraphicsRootShaderResourceView((UINT)RootParameter::VisibleInstances,
+			mShadowInstanceUpload.GpuAddress + draw.FirstInstance * sizeof(UINT));
+
+		state.CommandList()->DrawIndexedInstanced(ri->IndexCount, draw.InstanceCount, ri->StartIndexLocation, ri->BaseVertexLocation, 0);
+	}
+}
+
+void ShapesApp::RecordTreeCulling(ID3D12GraphicsCommandList* cmdList, UINT view)
+{
+	// The render graph has reset the arguments and put both buffers in UNORDERED_ACCESS.
+	auto treeDrawArgs = mCurrFrameResource->Views[view].TreeDrawArgs.Get();
+	auto visibleTrees = mCurrFrameResource->Views[view].VisibleTrees.Get();
+	const Camera& camera = *mViews[view].ViewCamera;
+
+	// The trees are fogged like everything else, so past the fog's far end a tree is
+	// the fog colour the back buffer is cleared to.
+	TreeCullConstants treeConstants;
+	ExtractFrustumPlanes(XMMatrixMultiply(camera.GetView(), camera.GetCullProj()), treeConstants.FrustumPlanes);
+	treeConstants.EyePosW = mViews[view].PassCB.EyePosW;
+	treeConstants.MaxDistance = mSceneCB.gFogStart + mSceneCB.gFogRange;
+	treeConstants.SpriteCount = mScene.Sprites().Count;
+	treeConstants.TileCount = (UINT)mRitemLayer[(int)RenderLayer::AlphaTestedTreeSprites].size();
+
+	cmdList->SetPipelineState(GetPipeline(PipelineId::TreeCull));
+	cmdList->SetComputeRootSignature(mTreeCullRootSignature.Get());
+	cmdList->SetComputeRoot32BitConstants(0, sizeof(TreeCullConstants) / 4, &treeConstants, 0);
+	cmdList->SetComputeRootShaderResourceView(1, mTreeSpritesGeo->VertexBufferGPU->GetGPUVirtualAddress());
+	cmdList->SetComputeRootShaderResourceView(2, mTreeTileUpload.GpuAddress);
+	cmdList->SetComputeRootUnorderedAccessView(3, visibleTrees->GetGPUVirtualAddress());
+	cmdList->SetComputeRootUnorderedAccessView(4, treeDrawArgs->GetGPUVirtualAddress());
+
+	// One thread per sprite and tile, 64 sprites per group.
+	cmdList->Dispatch((treeConstants.SpriteCount + 63) / 64, treeConstants.TileCount, 1);
+}
+
+void ShapesApp::RecordLightClustering(ID3D12GraphicsCommandList* cmdList, UINT view)
+{
+	// The render graph has already put the cluster lists in UNORDERED_ACCESS.
+	auto clusterLights = mCurrFrameResource->Views[view].ClusterLights.Get();
+
+	cmdList->SetPipelineState(GetPipeline(PipelineId::Cluster));
+	cmdList->SetComputeRootSignature(mClusterRootSignature.Get());
+	cmdList->SetComputeRootConstantBufferView(0, mViews[view].PassCBAddress);
+	cmdList->SetComputeRootShaderResourceView(1, mLocalLightUpload.GpuAddress);
+	cmdList->SetComputeRootUnorderedAccessView(2, clusterLights->GetGPUVirtualAddress());
+
+	// One thread per cluster, 64 threads per group.
+	cmdList->Dispatch((gClusterCount + 63) / 64, 1, 1);
+}
+
+void ShapesApp::UpdateWaves(const GameTimer& gt)
+{
+	// MathHelper::Rand is never seeded, so a benchmark run always drops the same ripples.
+	if (gt.TotalTime() >= mNextWaveDisturbTime)
+	{
+		UINT column = (UINT)MathHelper::Rand(4, gWaveColumns - 5);
+		UINT row = (UINT)MathHelper::Rand(4, gWaveRows - 5);
+		mWaves->Disturb(column, row, MathHelper::RandF(0.05f, 0.15f));
+
+		mNextWaveDisturbTime = gt.TotalTime() + gWaveDisturbInterval;
+	}
+
+	mWaveSteps = mWaves->Advance(gt.DeltaTime());
+}
+
+void ShapesApp::SubmitWaves()
+{
+	// The frame resource's last frame is done, and its direct work waited for any
+	// compute work it had, so the allocator is free.
+	auto cmdListAlloc = mCurrFrameResource->ComputeCmdListAlloc;
+	ThrowIfFailed(cmdListAlloc->Reset());
+	ThrowIfFailed(mComputeCmdList->Reset(cmdListAlloc.Get(), GetPipeline(PipelineId::Waves)));
+
+	mComputeCmdList->SetComputeRootSignature(mWaveRootSignature.Get());
+	mWaves->RecordSteps(mComputeCmdList.Get(), mComputeStates, mWaveSteps);
+
+	ThrowIfFailed(mComputeCmdList->Close());
+
+	// Frames still in flight on the direct queue may be drawing with the heights the
+	// steps overwrite.
+	UINT64 readFence = mWaves->WriteFence(mWaveSteps);
+	if (readFence != 0)
+		ThrowIfFailed(mComputeQueue->Wait(mFence.Get(), readFence));
+
+	ID3D12CommandList* cmdsLists[] = { mComputeCmdList.Get() };
+	mComputeQueue->ExecuteCommandLists(_countof(cmdsLists), cmdsLists);
+	mComputeStates.OnCommandListsExecuted();
+
+	ThrowIfFailed(mComputeQueue->Signal(mComputeFence.Get(), ++mComputeFenceValue));
+}
+
+float Sign(const float value)
+{
+	return (value < 0.0f) ? -1.0f : 1.0f;
+}
+
+void ShapesApp::UpdateLods()
+{
+	XMVECTOR eye = mCamera.GetPosition();
+	const float tanHalfFov = tanf(0.5f * mCamera.GetFovY());
+	const float nearZ = mCamera.GetNearZ();
+
+	for (LodItem& lodItem : mLodItems)
+	{
+		// Not drawn, so not worth rebatching for.
+		RenderItem* ri = lodItem.Item;
+		if (ri->Impostor)
+			continue;
+
+		// Fraction of the half screen height the bounding sphere covers.
+		float radius = XMVectorGetX(XMVector3Length(XMLoadFloat3(&ri->Bounds.Extents)));
+		float distance = XMVectorGetX(XMVector3Length(XMLoadFloat3(&ri->Bounds.Center) - eye));
+		float coverage = radius / (MathHelper::Max(distance, nearZ) * tanHalfFov);
+
+		int level = lodItem.Level;
+		while (level < gNumLodLevels - 1 && coverage < gLodScreenCoverage[level] * (1.0f - gLodHysteresis))
+			++level;
+		while (level > 0 && coverage > gLodScreenCoverage[level - 1] * (1.0f + gLodHysteresis))
+			--level;
+
+		if (level == lodItem.Level)
+			continue;
+
+		const SubmeshGeometry& submesh = (*lodItem.Chain)[level];
+		ri->IndexCount = submesh.IndexCount;
+		ri->StartIndexLocation = submesh.StartIndexLocation;
+		ri->BaseVertexLocation = submesh.BaseVertexLocation;
+		ri->FirstMeshlet = submesh.FirstMeshlet;
+		ri->MeshletCount = submesh.MeshletCount;
+		lodItem.Level = level;
+
+		// Items batch by submesh, so a new level means a different batch.
+		MarkLayerDirty(lodItem.Layer);
+	}
+}
+
+// Swaps each loaded tile's clusters between their items and their impostor by the
+// distance from the first camera, and lists the impostors for this frame's draws.
+// Nothing changes until the atlas has been baked.
+void ShapesApp::UpdateImpostors()
+{
+	mImpostorCount = 0;
+	if (!mImpostorsBaked || mCells.empty())
+		return;
+
+	const size_t capacity = mCells.size() * mImpostorClusters.size();
+	mImpostorUpload = mUploadRing->Allocate(capacity * sizeof(ImpostorInstance), sizeof(ImpostorInstance));
+	ImpostorInstance* impostors = static_cast<ImpostorInstance*>(mImpostorUpload.CpuAddress);
+
+	XMVECTOR eye = mCamera.GetPosition();
+	const float farDistance = gImpostorDistance * (1.0f + gImpostorHysteresis);
+	const float nearDistance = gImpostorDistance * (1.0f - gImpostorHysteresis);
+	for (auto& e : mCells)
+	{
+		WorldCell& cell = *e.second;
+		for (UINT c = 0; c < (UINT)mImpostorClusters.size(); ++c)
+		{
+			const ImpostorCluster& cluster = mImpostorClusters[c];
+			XMFLOAT3 center(cell.Offset.x + cluster.Center.x, cell.Offset.y + cluster.Center.y, cell.Offset.z + cluster.Center.z);
+			float distance = XMVectorGetX(XMVector3Length(XMLoadFloat3(&center) - eye));
+
+			bool impostor = cell.Impostors[c];
+			if (impostor ? distance < nearDistance : distance > farDistance)
+			{
+				impostor = !impostor;
+				cell.Impostors[c] = impostor;
+				for (UINT i : cluster.Items)
+					cell.Items[i].Ritem->Impostor = impostor;
+				MarkLayerDirty(RenderLayer::Opaque);
+			}
+
+			if (impostor)
+			{
+				ImpostorInstance& instance = impostors[mImpostorCount++];
+				instance.CenterW = center;
+				instance.Radius = cluster.Radius;
+				instance.Slice = c;
+			}
+		}
+	}
+}
+
+// Slides the player's box from position along motion.  Each sweep stops just short
+// of the first wall it hits, and the rest of the motion carries on along the wall.
+XMFLOAT3 ShapesApp::MovePlayer(XMFLOAT3 position, XMFLOAT3 motion)
+{
+	const float skin = 0.01f;
+
+	BoundingBox box = player;
+	for (int i = 0; i < 3; ++i)
+	{
+		box.Center = position;
+
+		XMFLOAT2 normal;
+		float t = mCollisionGrid.Sweep(box, motion, normal, mCollisionCandidates);
+
+		position.x += motion.x * t + normal.x * skin;
+		position.y += motion.y * t;
+		position.z += motion.z * t + normal.y * skin;
+		if (t >= 1.0f)
+			break;
+
+		// What is left of the motion, without the part heading into the wall.
+		float rest = 1.0f - t;
+		motion = XMFLOAT3(motion.x * rest, motion.y * rest, motion.z * rest);
+		float into = motion.x * normal.x + motion.z * normal.y;
+		motion.x -= into * normal.x;
+		motion.z -= into * normal.y;
+	}
+
+	return position;
+}
+
+// Pushes position out of the walls the box still overlaps, along the axis of least
+// overlap.  The sweep stops short of the walls, so this only moves a box that
+// started inside one, which the sweep lets out freely.
+void ShapesApp::PushOutOfWalls(XMFLOAT3& position)
+{
+	BoundingBox box = player;
+	box.Center = position;
+
+	mCollisionGrid.Query(box, mCollisionCandidates);
+
+	for (std::uint32_t index : mCollisionCandidates)
+	{
+		const BoundingBox& wall = mCollisionGrid.GetCollider(index).Box;
+
+		float distX = wall.Center.x - position.x;
+		float distZ = wall.Center.z - position.z;
+
+		float sumX = box.Extents.x + wall.Extents.x;
+		float sumZ = box.Extents.z + wall.Extents.z;
+
+		float overX = sumX - abs(distX);
+		float overZ = sumZ - abs(distZ);
+
+		if (overX < 0 || overZ < 0)
+		{
+			continue;
+		}
+
+		if (overX < overZ)
+			position.x -= Sign(distX) * overX;
+		else
+			position.z -= Sign(distZ) * overZ;
+	}
+}
+
+void ShapesApp::BuildProfilerScopes()
+{
+	mFrameGpuScope = mProfiler->AddGpuScope("frame");
+	mClearGpuScope = mProfiler->AddGpuScope("clear");
+	mCullGpuScope = mProfiler->AddGpuScope("cull");
+	mPrepassGpuScope = mProfiler->AddGpuScope("prepass");
+	mHiZGpuScope = mProfiler->AddGpuScope("hiz");
+	mShadingRateGpuScope = mProfiler->AddGpuScope("shadingRate");
+	mVisibilityResolveGpuScope = mProfiler->AddGpuScope("visibilityResolve");
+	mShadowGpuScope = mProfiler->AddGpuScope("shadows");
+	mTreeCullGpuScope = mProfiler->AddGpuScope("treeCull");
+	mLightsGpuScope = mProfiler->AddGpuScope("lights");
+	mOpaqueGpuScope = mProfiler->AddGpuScope("opaque");
+	mTreeGpuScope = mProfiler->AddGpuScope("trees");
+	mTransparentGpuScope = mProfiler->AddGpuScope("transparent");
+	mViewCullGpuScope = mProfiler->AddGpuScope("viewCull");
+	mViewsGpuScope = mProfiler->AddGpuScope("views");
+	mAntiAliasGpuScope = mProfiler->AddGpuScope("aa");
+	mUpscaleGpuScope = mProfiler->AddGpuScope("upscale");
+	mOverlayGpuScope = mProfiler->AddGpuScope("overlay");
+
+	mUpdateCpuScope = mProfiler->AddCpuScope("update");
+	mObjectCBCpuScope = mProfiler->AddCpuScope("objectCBs");
+	mSimulationCpuScope = mProfiler->AddCpuScope("simulation");
+	mRecordCpuScope = mProfiler->AddCpuScope("record");
+	mGpuWaitCpuScope = mProfiler->AddCpuScope("gpuWait");
+	mRayCpuScope = mProfiler->AddCpuScope("rays");
+
+	mAllocationCounter = mProfiler->AddCounter("allocations");
+}
+
+// F4: the video memory the process holds and how full its allocators and the
+// shader-visible heap are, in the debugger's output.  Committed resources aren't
+// counted one by one; they are what the adapter reports beyond the heaps.
+void ShapesApp::ReportMemoryStats()
+{
+	const double mb = 1.0 / 1048576.0;
+
+	// Without IDXGIAdapter3 the sizes from the adapter stay 0.
+	DXGI_QUERY_VIDEO_MEMORY_INFO local = {};
+	DXGI_QUERY_VIDEO_MEMORY_INFO nonLocal = {};
+	if (mAdapter != nullptr)
+	{
+		mAdapter->QueryVideoMemoryInfo(0, DXGI_MEMORY_SEGMENT_GROUP_LOCAL, &local);
+		mAdapter->QueryVideoMemoryInfo(0, DXGI_MEMORY_SEGMENT_GROUP_NON_LOCAL, &nonLocal);
+	}
+
+	const UINT64 placedBytes = mResourceAllocator->HeapBytes() - mResourceAllocator->EvictedBytes();
+	const UINT64 heapBytes = placedBytes + mRenderGraph->TransientHeapBytes();
+
+	std::ostringstream report;
+	report.precision(2);
+	report << std::fixed << "Memory, frame " << mFrameNumber << ":\n";
+	report << "  video memory " << local.CurrentUsage * mb << " MB of a " << local.Budget * mb << " MB budget\n";
+	report << "  placed heaps " << mResourceAllocator->HeapBytes() * mb << " MB, "
+		<< mResourceAllocator->BytesInUse() * mb << " MB placed, " << mResourceAllocator->EvictedBytes() * mb << " MB evicted\n";
+	report << "  render graph heaps " << mRenderGraph->TransientHeapBytes() * mb << " MB for "
+		<< mRenderGraph->TransientResourceBytes() * mb << " MB of transients\n";
+	report << "  committed and driver " << (local.CurrentUsage - MathHelper::Min(local.CurrentUsage, heapBytes)) * mb << " MB\n";
+	report << "  streamed textures " << mResidency->TrackedBytes() * mb << " MB\n";
+	report << "  system memory " << nonLocal.CurrentUsage * mb << " MB of a " << nonLocal.Budget * mb << " MB budget\n";
+	report << "  upload ring " << mUploadRing->BytesInUse() * mb << " MB of " << mUploadRing->Size() * mb << " MB in flight\n";
+	report << "  shader-visible descriptors " << mSrvHeap->AllocatedCount() << " of " << mSrvHeap->Capacity() << "\n";
+	report << "  frame arenas " << mCurrFrameResource->Arena.BytesUsed() * mb << " MB used of "
+		<< mCurrFrameResource->Arena.Capacity() * mb << " MB, per frame resource\n";
+	::OutputDebugStringA(report.str().c_str());
+}
+
+std::wstring ShapesApp::DeviceRemovedReport()const
+{
+	HRESULT reason = (md3dDevice != nullptr) ? md3dDevice->GetDeviceRemovedReason() : S_OK;
+	if (reason == S_OK)
+		return std::wstring();
+
+	std::ostringstream report;
+	report << "\n\nDevice removed, reason 0x" << std::hex << (UINT)reason << std::dec << ".\n";
+	if (mProfiler != nullptr)
+		report << mProfiler->BreadcrumbReport();
+	::OutputDebugStringA(report.str().c_str());
+
+	return AnsiToWString(report.str());
+}
+
+void ShapesApp::UpdateProfilerOverlay(const GameTimer& gt)
+{
+	// Twice a second, put the averages in the title bar ahead of the fps D3DApp adds.
+	if (gt.TotalTime() >= mNextCaptionTime)
+	{
+		std::wostringstream caption;
+		caption.precision(2);
+		caption << std::fixed << L"d3d App   ";
+		for (UINT i = 0; i < mProfiler->ScopeCount(); ++i)
+		{
+			const std::string& name = mProfiler->ScopeName(i);
+			caption << std::wstring(name.begin(), name.end()) << L" " << mProfiler->Stats(i).Avg << L"  ";
+		}
+		caption << L"inFlight " << mFramePacer->FramesInFlight() << L"  ";
+		caption << L"transientMB " << mRenderGraph->TransientHeapBytes() / 1048576.0 << L"/"
+			<< mRenderGraph->TransientResourceBytes() / 1048576.0 << L"  ";
+		if (mResidency->Budget() != UINT64_MAX)
+			caption << L"vramMB " << mResidency->Usage() / 1048576.0 << L"/" << mResidency->Budget() / 1048576.0 << L"  ";
+		const char* presentMode = PresentModeName(GetPresentMode());
+		caption << std::wstring(presentMode, presentMode + strlen(presentMode)) << L"  ";
+		const char* antiAliasing = AntiAliasingName(mAntiAliasing);
+		caption << std::wstring(antiAliasing, antiAliasing + strlen(antiAliasing)) << L"  ";
+		if (mDynamicResolution.Enabled())
+			caption << L"scale " << mDynamicResolution.Scale() << L"  ";
+		caption << (mProfiler->IsCsvOpen() ? L"[csv] " : L"");
+		mMainWndCaption = caption.str();
+		mNextCaptionTime = gt.TotalTime() + 0.5f;
+	}
+
+	mOverlayBarCount = 0;
+	if (!mShowOverlay)
+		return;
+
+	// One row per scope from the top left: a budget bar for a 60 Hz frame, the
+	// rolling average on top of it and a tick at the 99th percentile.  Counters aren't
+	// times, so they are only in the caption.
+	const float budgetMs = 1000.0f / 60.0f;
+	const float barWidthPx = 240.0f;
+	const float rowHeightPx = 10.0f;
+	const float rowGapPx = 4.0f;
+	const float marginPx = 8.0f;
+
+	auto toNdcX = [this](float px) { return px / mClientWidth * 2.0f - 1.0f; };
+	auto toNdcY = [this](float py) { return 1.0f - py / mClientHeight * 2.0f; };
+
+	mOverlayScratch.clear();
+	UINT row = 0;
+	for (UINT i = 0; i < mProfiler->ScopeCount(); ++i)
+	{
+		if (mProfiler->IsCounter(i))
+			continue;
+
+		const ProfileStats& stats = mProfiler->Stats(i);
+		float top = marginPx + row++ * (rowHeightPx + rowGapPx);
+		float bottom = top + rowHeightPx;
+		float avgPx = barWidthPx * MathHelper::Min(stats.Avg / budgetMs, 1.0f);
+		float p99Px = barWidthPx * MathHelper::Min(stats.P99 / budgetMs, 1.0f);
+
+		XMFLOAT4 color = mProfiler->IsGpuScope(i) ?
+			XMFLOAT4(0.2f, 0.8f, 0.3f, 0.9f) : XMFLOAT4(0.9f, 0.6f, 0.1f, 0.9f);
+
+		OverlayBar budget = { XMFLOAT4(toNdcX(marginPx), toNdcY(top), toNdcX(marginPx + barWidthPx), toNdcY(bottom)), XMFLOAT4(0.0f, 0.0f, 0.0f, 0.5f) };
+		OverlayBar avg = { XMFLOAT4(toNdcX(marginPx), toNdcY(top), toNdcX(marginPx + avgPx), toNdcY(bottom)), color };
+		OverlayBar p99 = { XMFLOAT4(toNdcX(marginPx + p99Px - 1.0f), toNdcY(top - 1.0f), toNdcX(marginPx + p99Px + 1.0f), toNdcY(bottom + 1.0f)), XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f) };
+
+		mOverlayScratch.push_back(budget);
+		mOverlayScratch.push_back(avg);
+		mOverlayScratch.push_back(p99);
+	}
+
+	mOverlayBarCount = (UINT)mOverlayScratch.size();
+	mOverlayBars = mUploadRing->Allocate(mOverlayBarCount * sizeof(OverlayBar));
+	memcpy(mOverlayBars.CpuAddress, mOverlayScratch.data(), mOverlayBarCount * sizeof(OverlayBar));
+}
+
+void ShapesApp::DrawProfilerOverlay(ID3D12GraphicsCommandList* cmdList)
+{
+	if (mOverlayBarCount == 0)
+		return;
+
+	cmdList->SetGraphicsRootSignature(mOverlayRootSignature.Get());
+	cmdList->SetPipelineState(GetPipeline(PipelineId::Overlay));
+	cmdList->SetGraphicsRootShaderResourceView(0, mOverlayBars.GpuAddress);
+	cmdList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
+	cmdList->DrawInstanced(4, mOverlayBarCount, 0, 0);
+}
+
+void ShapesApp::SetAntiAliasing(AntiAliasing mode)
+{
+	mAntiAliasing = mode;
+
+	// Either way OnResize runs, which rebuilds the targets and, if the sample count
+	// changed, the PSOs.
+	if (Get4xMsaaState() != (mode == AntiAliasing::Msaa4x))
+		Set4xMsaaState(mode == AntiAliasing::Msaa4x);
+	else
+		OnResize();
+}
+
+void ShapesApp::SetDynamicResolution(float targetMs)
+{
+	mDynamicResolution.SetTargetMs(targetMs);
+
+	// mSceneColor may come or go, so nothing may still be using it.
+	FlushCommandQueue();
+	BuildSceneTargets();
+	UpdateRenderScale();
+}
+
+// Steers the scale by the last frame the profiler collected, a few frames old.
+void ShapesApp::UpdateRenderScale()
+{
+	// The first call comes from D3DApp::Initialize, before there is a profiler.
+	if (mProfiler != nullptr)
+	{
+		const std::vector<float>& gpuTimes = mProfiler->LastFrameTimes();
+		if (mFrameGpuScope < gpuTimes.size())
+			mDynamicResolution.Update(gpuTimes[mFrameGpuScope]);
+	}
+
+	mRenderWidth = mDynamicResolution.ScaledSize((UINT)mClientWidth);
+	mRenderHeight = mDynamicResolution.ScaledSize((UINT)mClientHeight);
+
+	UpdateViewRects();
+}
+
+// Side by side for two players and in quarters for three or four, with the minimap
+// over the top-right corner.  A player who joins starts a few steps to the right of
+// the first one, looking the same way.
+void ShapesApp::SetViewLayout(UINT playerCount, bool minimap)
+{
+	static const XMFLOAT4 layouts[gMaxPlayers][gMaxPlayers] =
+	{
+		{ { 0.0f, 0.0f, 1.0f, 1.0f } },
+		{ { 0.0f, 0.0f, 0.5f, 1.0f }, { 0.5f, 0.0f, 0.5f, 1.0f } },
+		{ { 0.0f, 0.0f, 0.5f, 0.5f }, { 0.5f, 0.0f, 0.5f, 0.5f }, { 0.0f, 0.5f, 0.5f, 0.5f } },
+		{ { 0.0f, 0.0f, 0.5f, 0.5f }, { 0.5f, 0.0f, 0.5f, 0.5f }, { 0.0f, 0.5f, 0.5f, 0.5f }, { 0.5f, 0.5f, 0.5f, 0.5f } },
+	};
+
+	for (UINT i = mPlayerCount; i < playerCount; ++i)
+	{
+		if (i == 0)
+			continue;
+
+		Camera& camera = mPlayerCameras[i - 1];
+		camera = mCamera;
+		camera.Strafe(3.0f * i);
+		camera.UpdateViewMatrix();
+	}
+	mPlayerCount = playerCount;
+	mShowMinimap = minimap;
+
+	// The views get new rectangles, so their pass constants start over.
+	mViews.clear();
+	for (UINT i = 0; i < playerCount; ++i)
+	{
+		SceneView view;
+		view.ViewCamera = (i == 0) ? &mCamera : &mPlayerCameras[i - 1];
+		view.Rect = layouts[playerCount - 1][i];
+		mViews.push_back(view);
+	}
+	if (minimap)
+	{
+		SceneView view;
+		view.ViewCamera = &mMinimapCamera;
+		view.Rect = gMinimapRect;
+		view.Overlaid = true;
+		mViews.push_back(view);
+	}
+	assert(mViews.size() <= gMaxViews);
+
+	UpdateViewCameras();
+	UpdateViewLenses();
+	UpdateViewRects();
+}
+
+void ShapesApp::UpdateViewLenses()
+{
+	for (SceneView& view : mViews)
+	{
+		float fovY = (view.ViewCamera == &mMinimapCamera) ? 0.4f * MathHelper::Pi : 0.25f * MathHelper::Pi;
+		float aspect = AspectRatio() * view.Rect.z / view.Rect.w;
+		view.ViewCamera->SetLens(fovY, aspect, gNearZ, gFarZ);
+
+		BoundingFrustum::CreateFromMatrix(view.Frustum, view.ViewCamera->GetCullProj());
+	}
+}
+
+// Whole pixels, so that neighbouring views share their edges without a gap.
+void ShapesApp::UpdateViewRects()
+{
+	for (SceneView& view : mViews)
+	{
+		LONG left = (LONG)(view.Rect.x * mRenderWidth);
+		LONG top = (LONG)(view.Rect.y * mRenderHeight);
+		LONG right = (LONG)((view.Rect.x + view.Rect.z) * mRenderWidth);
+		LONG bottom = (LONG)((view.Rect.y + view.Rect.w) * mRenderHeight);
+
+		view.ScissorRect = { left, top, right, bottom };
+		view.Viewport = mScreenViewport;
+		view.Viewport.TopLeftX = (float)left;
+		view.Viewport.TopLeftY = (float)top;
+		view.Viewport.Width = (float)(right - left);
+		view.Viewport.Height = (float)(bottom - top);
+	}
+}
+
+// The minimap follows the first player; the other players' cameras have no input yet.
+void ShapesApp::UpdateViewCameras()
+{
+	if (!mShowMinimap)
+		return;
+
+	XMFLOAT3 target = mCamera.GetPosition3f();
+	XMFLOAT3 eye = XMFLOAT3(target.x, target.y + gMinimapHeight, target.z);
+
+	// Left alone while the player stands still, so its pass constants are reused.
+	XMFLOAT3 current = mMinimapCamera.GetPosition3f();
+	if (eye.x == current.x && eye.y == current.y && eye.z == current.z)
+		return;
+
+	mMinimapCamera.LookAt(eye, target, XMFLOAT3(0.0f, 0.0f, 1.0f));
+	mMinimapCamera.UpdateViewMatrix();
+}
+
+// Called with the queue idle.  mSceneColor is the single-sampled scene for FXAA or
+// the upscale; mFxaaOutput is only needed for FXAA.
+void ShapesApp::BuildSceneTargets()
+{
+	if (mSceneColor != nullptr)
+	{
+		mResourceStates.Untrack(mSceneColor.Get());
+		mSrvHeap->Free(mSceneSrvIndex, mCurrentFence);
+		if (mSceneColor->GetDesc().Flags & D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS)
+			mSrvHeap->Free(mSceneUavIndex, mCurrentFence);
+		mSceneColor.Reset();
+	}
+	if (mFxaaOutput != nullptr)
+	{
+		mResourceStates.Untrack(mFxaaOutput.Get());
+		mSrvHeap->Free(mFxaaSrvIndex, mCurrentFence);
+		mSrvHeap->Free(mFxaaUavIndex, mCurrentFence);
+		mFxaaOutput.Reset();
+	}
+
+	// The visibility resolve writes the scene as a UAV, which MSAA targets can't be.
+	const bool fxaa = mAntiAliasing == AntiAliasing::Fxaa;
+	const bool visibility = mVisibilityRendering && mAntiAliasing != AntiAliasing::Msaa4x;
+	if (!fxaa && !mDynamicResolution.Enabled() && !visibility)
+		return;
+
+	if (mSceneRtvHeap == nullptr)
+	{
+		D3D12_DESCRIPTOR_HEAP_DESC rtvHeapDesc = {};
+		rtvHeapDesc.NumDescriptors = 1;
+		rtvHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_RTV;
+		rtvHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
+		ThrowIfFailed(md3dDevice->CreateDescriptorHeap(&rtvHeapDesc, IID_PPV_ARGS(mSceneRtvHeap.GetAddressOf())));
+	}
+
+	// Like D3DApp's MSAA target, there is no optimized clear value: the fog colour
+	// comes from the scene.  Window-sized, so dynamic resolution never reallocates.
+	D3D12_RESOURCE_DESC colorDesc = CD3DX12_RESOURCE_DESC::Tex2D(mBackBufferFormat, mClientWidth, mClientHeight,
+		1, 1, 1, 0, D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET);
+	if (visibility)
+		colorDesc.Flags |= D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS;
+	ThrowIfFailed(md3dDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+		D3D12_HEAP_FLAG_NONE,
+		&colorDesc,
+		D3D12_RESOURCE_STATE_RENDER_TARGET,
+		nullptr,
+		IID_PPV_ARGS(mSceneColor.GetAddressOf())));
+
+	md3dDevice->CreateRenderTargetView(mSceneColor.Get(), nullptr, mSceneRtvHeap->GetCPUDescriptorHandleForHeapStart());
+
+	mSceneSrvIndex = mSrvHeap->Allocate();
+	md3dDevice->CreateShaderResourceView(mSceneColor.Get(), nullptr, mSrvHeap->CpuHandle(mSceneSrvIndex));
+
+	if (visibility)
+	{
+		mSceneUavIndex = mSrvHeap->Allocate();
+		md3dDevice->CreateUnorderedAccessView(mSceneColor.Get(), nullptr, nullptr, mSrvHeap->CpuHandle(mSceneUavIndex));
+	}
+
+	mResourceStates.Track(mSceneColor.Get(), D3D12_RESOURCE_STATE_RENDER_TARGET);
+
+	if (!fxaa)
+		return;
+
+	colorDesc.Flags = D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS;
+	ThrowIfFailed(md3dDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+		D3D12_HEAP_FLAG_NONE,
+		&colorDesc,
+		D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
+		nullptr,
+		IID_PPV_ARGS(mFxaaOutput.GetAddressOf())));
+
+	mFxaaSrvIndex = mSrvHeap->Allocate();
+	md3dDevice->CreateShaderResourceView(mFxaaOutput.Get(), nullptr, mSrvHeap->CpuHandle(mFxaaSrvIndex));
+
+	mFxaaUavIndex = mSrvHeap->Allocate();
+	md3dDevice->CreateUnorderedAccessView(mFxaaOutput.Get(), nullptr, nullptr, mSrvHeap->CpuHandle(mFxaaUavIndex));
+
+	mResourceStates.Track(mFxaaOutput.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+}
+
+// Where the clear and the layers draw.
+ID3D12Resource* ShapesApp::SceneTarget()const
+{
+	if (mAntiAliasing == AntiAliasing::Msaa4x)
+		return MsaaRenderTarget();
+	if (mSceneColor != nullptr)
+		return mSceneColor.Get();
+	return CurrentBackBuffer();
+}
+
+D3D12_CPU_DESCRIPTOR_HANDLE ShapesApp::SceneTargetView()const
+{
+	if (mAntiAliasing == AntiAliasing::Msaa4x)
+		return MsaaRenderTargetView();
+	if (mSceneColor != nullptr)
+		return mSceneRtvHeap->GetCPUDescriptorHandleForHeapStart();
+	return CurrentBackBufferView();
+}
+
+// Resolves or filters the scene target, then stretches it over the back buffer if
+// it was rendered at a lower resolution, or copies it there if it was only drawn
+// into mSceneColor for the visibility resolve.  Leaves the back buffer a render
+// target; without any of these the scene is already there.
+void ShapesApp::RecordSceneResolve(ID3D12GraphicsCommandList* cmdList)
+{
+	if (SceneTarget() == CurrentBackBuffer())
+		return;
+
+	const bool upscale = mDynamicResolution.Enabled();
+	ID3D12Resource* upscaleSource = mSceneColor.Get();
+	UINT upscaleSrvIndex = mSceneSrvIndex;
+
+	if (mAntiAliasing != AntiAliasing::None)
+		mProfiler->BeginScope(cmdList, mAntiAliasGpuScope);
+
+	if (mAntiAliasing == AntiAliasing::Msaa4x)
+	{
+		// The whole target is resolved; only the rendered corner is read after.
+		ID3D12Resource* resolved = upscale ? mSceneColor.Get() : CurrentBackBuffer();
+		mResourceStates.Transition(MsaaRenderTarget(), D3D12_RESOURCE_STATE_RESOLVE_SOURCE);
+		mResourceStates.Transition(resolved, D3D12_RESOURCE_STATE_RESOLVE_DEST);
+		mResourceStates.FlushBarriers(cmdList);
+		cmdList->ResolveSubresource(resolved, 0, MsaaRenderTarget(), 0, mBackBufferFormat);
+	}
+	else if (mAntiAliasing == AntiAliasing::Fxaa)
+	{
+		mResourceStates.Transition(mSceneColor.Get(), D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+		mResourceStates.Transition(mFxaaOutput.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+		mResourceStates.FlushBarriers(cmdList);
+
+		FxaaConstants constants;
+		constants.RcpFrame = XMFLOAT2(1.0f / mClientWidth, 1.0f / mClientHeight);
+		constants.Width = mRenderWidth;
+		constants.Height = mRenderHeight;
+		constants.UvMax = XMFLOAT2((mRenderWidth - 0.5f) / mClientWidth, (mRenderHeight - 0.5f) / mClientHeight);
+
+		cmdList->SetComputeRootSignature(mFxaaRootSignature.Get());
+		cmdList->SetPipelineState(GetPipeline(PipelineId::Fxaa));
+		cmdList->SetComputeRoot32BitConstants(0, sizeof(FxaaConstants) / 4, &constants, 0);
+		cmdList->SetComputeRootDescriptorTable(1, mSrvHeap->GpuHandle(mSceneSrvIndex));
+		cmdList->SetComputeRootDescriptorTable(2, mSrvHeap->GpuHandle(mFxaaUavIndex));
+		cmdList->Dispatch((mRenderWidth + 7) / 8, (mRenderHeight + 7) / 8, 1);
+
+		upscaleSource = mFxaaOutput.Get();
+		upscaleSrvIndex = mFxaaSrvIndex;
+		if (!upscale)
+		{
+			mResourceStates.Transition(mFxaaOutput.Get(), D3D12_RESOURCE_STATE_COPY_SOURCE);
+			mResourceStates.Transition(CurrentBackBuffer(), D3D12_RESOURCE_STATE_COPY_DEST);
+			mResourceStates.FlushBarriers(cmdList);
+			cmdList->CopyResource(CurrentBackBuffer(), mFxaaOutput.Get());
+		}
+	}
+	else if (!upscale)
+	{
+		mResourceStates.Transition(mSceneColor.Get(), D3D12_RESOURCE_STATE_COPY_SOURCE);
+		mResourceStates.Transition(CurrentBackBuffer(), D3D12_RESOURCE_STATE_COPY_DEST);
+		mResourceStates.FlushBarriers(cmdList);
+		cmdList->CopyResource(CurrentBackBuffer(), mSceneColor.Get());
+	}
+
+	if (mAntiAliasing != AntiAliasing::None)
+		mProfiler->EndScope(cmdList, mAntiAliasGpuScope);
+
+	if (upscale)
+	{
+		mProfiler->BeginScope(cmdList, mUpscaleGpuScope);
+		RecordUpscale(cmdList, upscaleSource, upscaleSrvIndex);
+		mProfiler->EndScope(cmdList, mUpscaleGpuScope);
+	}
+	else
+	{
+		mResourceStates.Transition(CurrentBackBuffer(), D3D12_RESOURCE_STATE_RENDER_TARGET);
+		mResourceStates.FlushBarriers(cmdList);
+	}
+}
+
+// A bilinear stretch of the rendered corner of source over the whole back buffer,
+// sharpened by gUpscaleSharpness.
+void ShapesApp::RecordUpscale(ID3D12GraphicsCommandList* cmdList, ID3D12Resource* source, UINT srvIndex)
+{
+	mResourceStates.Transition(source, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+	mResourceStates.Transition(CurrentBackBuffer(), D3D12_RESOURCE_STATE_RENDER_TARGET);
+	mResourceStates.FlushBarriers(cmdList);
+
+	UpscaleConstants constants;
+	constants.UvScale = XMFLOAT2((float)mRenderWidth / mClientWidth, (float)mRenderHeight / mClientHeight);
+	constants.UvMax = XMFLOAT2((mRenderWidth - 0.5f) / mClientWidth, (mRenderHeight - 0.5f) / mClientHeight);
+	constants.RcpSourceSize = XMFLOAT2(1.0f / mClientWidth, 1.0f / mClientHeight);
+	constants.Sharpness = mRenderWidth < (UINT)mClientWidth ? gUpscaleSharpness : 0.0f;
+
+	D3D12_CPU_DESCRIPTOR_HANDLE backBufferView = CurrentBackBufferView();
+	cmdList->OMSetRenderTargets(1, &backBufferView, true, nullptr);
+	cmdList->RSSetViewports(1, &mScreenViewport);
+	cmdList->RSSetScissorRects(1, &mScissorRect);
+
+	cmdList->SetGraphicsRootSignature(mUpscaleRootSignature.Get());
+	cmdList->SetPipelineState(GetPipeline(PipelineId::Upscale));
+	cmdList->SetGraphicsRoot32BitConstants(0, sizeof(UpscaleConstants) / 4, &constants, 0);
+	cmdList->SetGraphicsRootDescriptorTable(1, mSrvHeap->GpuHandle(srvIndex));
+	cmdList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	cmdList->DrawInstanced(3, 1, 0, 0);
+}
+
+// The weighted OIT targets, with optimized clears of 0 and 1.  Only while 'T' has
+// turned the weighted transparency on; called again when the window or the sample
+// count changes.  They wait between frames as shader resources.
+void ShapesApp::BuildOitTargets()
+{
+	for (int i = 0; i < 2; ++i)
+	{
+		if (mOitTargets[i] != nullptr)
+		{
+			mSrvHeap->Free(mOitSrvIndex[i], mCurrentFence);
+			mOitTargets[i].Reset();
+		}
+	}
+
+	if (!mWeightedOit)
+		return;
+
+	if (mOitRtvHeap == nullptr)
+	{
+		D3D12_DESCRIPTOR_HEAP_DESC rtvHeapDesc = {};
+		rtvHeapDesc.NumDescriptors = 2;
+		rtvHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_RTV;
+		rtvHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
+		ThrowIfFailed(md3dDevice->CreateDescriptorHeap(&rtvHeapDesc, IID_PPV_ARGS(mOitRtvHeap.GetAddressOf())));
+	}
+
+	const DXGI_FORMAT formats[2] = { gOitAccumulationFormat, gOitRevealageFormat };
+	const float clearValues[2][4] = { { 0.0f, 0.0f, 0.0f, 0.0f }, { 1.0f, 0.0f, 0.0f, 0.0f } };
+
+	CD3DX12_CPU_DESCRIPTOR_HANDLE rtv(mOitRtvHeap->GetCPUDescriptorHandleForHeapStart());
+	for (int i = 0; i < 2; ++i)
+	{
+		D3D12_RESOURCE_DESC desc = CD3DX12_RESOURCE_DESC::Tex2D(formats[i], mClientWidth, mClientHeight, 1, 1,
+			m4xMsaaState ? 4 : 1, m4xMsaaState ? (m4xMsaaQuality - 1) : 0, D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET);
+		CD3DX12_CLEAR_VALUE clearValue(formats[i], clearValues[i]);
+		ThrowIfFailed(md3dDevice->CreateCommittedResource(
+			&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+			D3D12_HEAP_FLAG_NONE,
+			&desc,
+			D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE,
+			&clearValue,
+			IID_PPV_ARGS(mOitTargets[i].GetAddressOf())));
+
+		md3dDevice->CreateRenderTargetView(mOitTargets[i].Get(), nullptr, rtv);
+		rtv.Offset(1, mRtvDescriptorSize);
+
+		mOitSrvIndex[i] = mSrvHeap->Allocate();
+		md3dDevice->CreateShaderResourceView(mOitTargets[i].Get(), nullptr, mSrvHeap->CpuHandle(mOitSrvIndex[i]));
+	}
+}
+
+// The visibility buffer, window-sized with an optimized clear of 0, nothing drawn.
+// Only while 'I' has turned visibility rendering on without MSAA; called again when
+// the window or the sample count changes.  Like the OIT targets it isn't tracked:
+// the first view's opaque lists make it a render target and the resolve moves it
+// back to the shader resource it waits between frames as.
+void ShapesApp::BuildVisibilityTarget()
+{
+	if (mVisibilityTarget != nullptr)
+	{
+		mSrvHeap->Free(mVisibilitySrvIndex, mCurrentFence);
+		mVisibilityTarget.Reset();
+	}
+
+	if (!mVisibilityRendering || m4xMsaaState)
+		return;
+
+	if (mVisibilityRtvHeap == nullptr)
+	{
+		D3D12_DESCRIPTOR_HEAP_DESC rtvHeapDesc = {};
+		rtvHeapDesc.NumDescriptors = 1;
+		rtvHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_RTV;
+		rtvHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
+		ThrowIfFailed(md3dDevice->CreateDescriptorHeap(&rtvHeapDesc, IID_PPV_ARGS(mVisibilityRtvHeap.GetAddressOf())));
+	}
+
+	D3D12_RESOURCE_DESC desc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R32_UINT, mClientWidth, mClientHeight,
+		1, 1, 1, 0, D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET);
+	const float clearColor[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	CD3DX12_CLEAR_VALUE clearValue(DXGI_FORMAT_R32_UINT, clearColor);
+	ThrowIfFailed(md3dDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+		D3D12_HEAP_FLAG_NONE,
+		&desc,
+		D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE,
+		&clearValue,
+		IID_PPV_ARGS(mVisibilityTarget.GetAddressOf())));
+
+	md3dDevice->CreateRenderTargetView(mVisibilityTarget.Get(), nullptr, mVisibilityRtvHeap->GetCPUDescriptorHandleForHeapStart());
+
+	mVisibilitySrvIndex = mSrvHeap->Allocate();
+	md3dDevice->CreateShaderResourceView(mVisibilityTarget.Get(), nullptr, mSrvHeap->CpuHandle(mVisibilitySrvIndex));
+}
+
+// Shades the first view's opaque pixels into mSceneColor from the visibility buffer
+// the opaque lists left as a render target.  Then the list can draw the trees, with
+// the graphics bindings it had before.
+void ShapesApp::RecordVisibilityResolve(ID3D12GraphicsCommandList* cmdList)
+{
+	D3D12_RESOURCE_BARRIER barriers[2] =
+	{
+		CD3DX12_RESOURCE_BARRIER::Transition(mVisibilityTarget.Get(),
+			D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE),
+		CD3DX12_RESOURCE_BARRIER::Transition(mSceneColor.Get(),
+			D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_UNORDERED_ACCESS)
+	};
+	cmdList->ResourceBarrier(2, barriers);
+
+	const D3D12_RECT& rect = mViews[0].ScissorRect;
+	MeshGeometry* geo = mShapeGeo;
+
+	VisibilityResolveConstants constants;
+	constants.ViewOrigin = XMUINT2((UINT)rect.left, (UINT)rect.top);
+	constants.ViewSize = XMUINT2((UINT)(rect.right - rect.left), (UINT)(rect.bottom - rect.top));
+	constants.NearDepth = mReverseZ ? 1.0f : 0.0f;
+	constants.Index32 = geo->IndexFormat == DXGI_FORMAT_R32_UINT;
+
+	mProfiler->BeginScope(cmdList, mVisibilityResolveGpuScope);
+
+	cmdList->SetComputeRootSignature(mVisibilityRootSignature.Get());
+	cmdList->SetPipelineState(GetPipeline(PipelineId::VisibilityResolve));
+	cmdList->SetComputeRoot32BitConstants(0, sizeof(VisibilityResolveConstants) / 4, &constants, 0);
+	cmdList->SetComputeRootConstantBufferView(1, mViews[0].PassCBAddress);
+	cmdList->SetComputeRootConstantBufferView(2, mSceneCBBuffer->GetGPUVirtualAddress());
+	cmdList->SetComputeRootShaderResourceView(3, mCurrFrameResource->InstanceBuffer->Resource()->GetGPUVirtualAddress());
+	cmdList->SetComputeRootShaderResourceView(4, mCurrFrameResource->MaterialBuffer->Resource()->GetGPUVirtualAddress());
+	if (gClusteredLighting)
+	{
+		cmdList->SetComputeRootShaderResourceView(5, mLocalLightUpload.GpuAddress);
+		cmdList->SetComputeRootShaderResourceView(6, mCurrFrameResource->Views[0].ClusterLights->GetGPUVirtualAddress());
+	}
+
+	// Bound for the shader's sake; no opaque material has waves, so it isn't read
+	// before the solver is done.
+	cmdList->SetComputeRootShaderResourceView(7, mWaves->Solution());
+	cmdList->SetComputeRootShaderResourceView(8, mCurrFrameResource->InstanceCullBuffer->Resource()->GetGPUVirtualAddress());
+	cmdList->SetComputeRootShaderResourceView(9, geo->VertexBufferGPU->GetGPUVirtualAddress());
+	cmdList->SetComputeRootShaderResourceView(10, geo->IndexBufferGPU->GetGPUVirtualAddress());
+	cmdList->SetComputeRootDescriptorTable(11, mSrvHeap->GpuHandle(0));
+	cmdList->SetComputeRootDescriptorTable(12, mSrvHeap->GpuHandle(mVisibilitySrvIndex));
+	cmdList->SetComputeRootDescriptorTable(13, mSrvHeap->GpuHandle(mSceneUavIndex));
+	cmdList->Dispatch((constants.ViewSize.x + 7) / 8, (constants.ViewSize.y + 7) / 8, 1);
+
+	mProfiler->EndScope(cmdList, mVisibilityResolveGpuScope);
+
+	barriers[1] = CD3DX12_RESOURCE_BARRIER::Transition(mSceneColor.Get(),
+		D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_RENDER_TARGET);
+	cmdList->ResourceBarrier(1, &barriers[1]);
+}
+
+// Points a view's transparent draws at the cleared OIT targets.  The layers' lists
+// may not use mResourceStates while they record, so the targets aren't tracked: the
+// list that draws a view's transparency moves them to render targets and back
+// itself.  The views' lists run one after another and share them.
+void ShapesApp::BeginWeightedOit(ID3D12GraphicsCommandList* cmdList, UINT view)
+{
+	D3D12_RESOURCE_BARRIER barriers[2];
+	for (int i = 0; i < 2; ++i)
+	{
+		barriers[i] = CD3DX12_RESOURCE_BARRIER::Transition(mOitTargets[i].Get(),
+			D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_RENDER_TARGET);
+	}
+	cmdList->ResourceBarrier(2, barriers);
+
+	const D3D12_RECT& rect = mViews[view].ScissorRect;
+	CD3DX12_CPU_DESCRIPTOR_HANDLE targets(mOitRtvHeap->GetCPUDescriptorHandleForHeapStart());
+	const float accumulationClear[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	const float revealageClear[4] = { 1.0f, 0.0f, 0.0f, 0.0f };
+	cmdList->ClearRenderTargetView(targets, accumulationClear, 1, &rect);
+	cmdList->ClearRenderTargetView(CD3DX12_CPU_DESCRIPTOR_HANDLE(targets, 1, mRtvDescriptorSize), revealageClear, 1, &rect);
+
+	D3D12_CPU_DESCRIPTOR_HANDLE depthStencilView = DepthStencilView();
+	cmdList->OMSetRenderTargets(2, &targets, true, &depthStencilView);
+}
+
+// Blends what BeginWeightedOit's targets gathered over the scene target, through the
+// viewport and scissor rectangle still set.  Leaves the list's pipeline and root
+// signature changed, so nothing may be drawn through its DrawStateCache after.
+void ShapesApp::CompositeWeightedOit(ID3D12GraphicsCommandList* cmdList)
+{
+	D3D12_RESOURCE_BARRIER barriers[2];
+	for (int i = 0; i < 2; ++i)
+	{
+		barriers[i] = CD3DX12_RESOURCE_BARRIER::Transition(mOitTargets[i].Get(),
+			D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+	}
+	cmdList->ResourceBarrier(2, barriers);
+
+	D3D12_CPU_DESCRIPTOR_HANDLE sceneView = SceneTargetView();
+	cmdList->OMSetRenderTargets(1, &sceneView, true, nullptr);
+
+	cmdList->SetGraphicsRootSignature(mOitRootSignature.Get());
+	cmdList->SetPipelineState(GetPipeline(PipelineId::OitComposite));
+	cmdList->SetGraphicsRootDescriptorTable(0, mSrvHeap->GpuHandle(mOitSrvIndex[0]));
+	cmdList->SetGraphicsRootDescriptorTable(1, mSrvHeap->GpuHandle(mOitSrvIndex[1]));
+	cmdList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	cmdList->DrawInstanced(3, 1, 0, 0);
+}
+
+
+// Maps the compiled scene, recompiling it first if the description has changed
+// since, or if there is no binary yet.  Without a description an existing binary
+// is used as it is.
+bool ShapesApp::LoadScene()
+{
+	std::string text;
+	std::ifstream fin(gSceneFile, std::ios::binary);
+	const bool haveSource = !!fin;
+	if (haveSource)
+		text.assign(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+
+	const std::uint64_t buildKey = (gSceneGeometryVersion << 8) | (gPackedVertices ? 1 : 0);
+	const std::uint64_t sourceHash = HashSceneSource(text, buildKey);
+
+	// A binary without its description must still have the vertex layout this build reads.
+	const UINT vertexStride = gPackedVertices ? sizeof(PackedVertex) : sizeof(Vertex);
+	if (mScene.Open(gSceneBinaryFile) && mScene.VertexStride() == vertexStride &&
+		(!haveSource || mScene.SourceHash() == sourceHash))
+		return true;
+
+	if (!haveSource)
+	{
+		MessageBox(nullptr, (std::wstring(L"Cannot open ") + gSceneFile).c_str(), L"Scene", MB_OK);
+		return false;
+	}
+
+	SceneDescription scene;
+	std::string error;
+	if (!ParseScene(text, scene, error))
+	{
+		MessageBox(nullptr, (std::wstring(gSceneFile) + L", " + AnsiToWString(error)).c_str(), L"Scene", MB_OK);
+		return false;
+	}
+
+	BakeShapeGeometry(scene);
+	mScene.Build(scene, sourceHash);
+
+	// If this fails the scene is simply compiled again next time.
+	if (!mScene.Save(gSceneBinaryFile))
+		OutputDebugString((std::wstring(L"Scene: could not write ") + gSceneBinaryFile + L"\n").c_str());
+
+	return true;
+}
+
+void ShapesApp::LoadTextures()
+{
+	// Bound in place of every texture until its first streamed copy arrives.
+	auto placeholderTex = std::make_unique<Texture>();
+	placeholderTex->Name = "placeholderTex";
+	placeholderTex->Filename = L"../../Textures/white1x1.dds";
+	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
+		mCommandList.Get(), placeholderTex->Filename.c_str(),
+		*mResourceAllocator, *mStagingRing, placeholderTex->Resource));
+
+	CreateTextureSrv(placeholderTex->Resource.Get(), false, mPlaceholderSrvIndex);
+	CreateTextureSrv(placeholderTex->Resource.Get(), true, mPlaceholderArraySrvIndex);
+
+	mTextures[placeholderTex->Name] = std::move(placeholderTex);
+
+	// -cooktextures normally leaves nothing to do here.  A texture that fails keeps
+	// its old cooked copy, or the placeholder.
+	std::wstring cookErrors;
+	CookTextures(false, cookErrors);
+	if (!cookErrors.empty())
+		OutputDebugString((L"Textures: " + cookErrors).c_str());
+
+	for (const SceneTexture& texture : mScene.Textures())
+		StreamTexture(texture.Name, AnsiToWString(texture.File), texture.IsArray != 0);
+}
+
+void ShapesApp::StreamTexture(const std::string& name, const std::wstring& filename, bool isArray)
+{
+	auto tex = std::make_unique<Texture>();
+	tex->Name = name;
+	tex->Filename = filename;
+	mTextures[name] = std::move(tex);
+
+	TextureSlot& slot = mTextureSlots[name];
+	slot.SrvIndex = isArray ? mPlaceholderArraySrvIndex : mPlaceholderSrvIndex;
+	slot.IsArray = isArray;
+	slot.ResidencyHandle = mResidency->Register();
+	mStreamedTextures.push_back(&slot);
+
+	slot.StreamId = mTextureStreamer->Stream(filename,
+		[this, name](const ComPtr<ID3D12Resource>& texture, bool fullResolution)
+	{
+		OnTextureResident(name, texture, fullResolution);
+	});
+}
+
+void ShapesApp::OnTextureResident(const std::string& name, const ComPtr<ID3D12Resource>& texture, bool fullResolution)
+{
+	BindTexture(name, texture, mCurrentFence);
+
+	// The first low resolution copy is about to be replaced anyway.
+	TextureSlot& slot = mTextureSlots[name];
+	D3D12_RESOURCE_DESC desc = texture->GetDesc();
+	if (fullResolution || slot.Demoted)
+		mResidency->SetResidentBytes(slot.ResidencyHandle, md3dDevice->GetResourceAllocationInfo(0, 1, &desc).SizeInBytes, !fullResolution);
+
+	if (fullResolution && desc.MipLevels < TextureCooker::FullMipCount((UINT)desc.Width, desc.Height))
+		mPendingMips.push_back(name);
+}
+
+void ShapesApp::BindTexture(const std::string& name, const ComPtr<ID3D12Resource>& texture, UINT64 retireFence)
+{
+	// Replacing the reference lets the streamer free the low resolution copy.
+	mTextures[name]->Resource = texture;
+
+	TextureSlot& slot = mTextureSlots[name];
+	UINT previousSrvIndex = slot.SrvIndex;
+	slot.SrvIndex = mSrvHeap->Allocate();
+	CreateTextureSrv(texture.Get(), slot.IsArray, slot.SrvIndex);
+
+	// The index reaches the shaders through the material buffer only.
+	for (Material* mat : slot.Users)
+	{
+		mat->DiffuseSrvHeapIndex = slot.SrvIndex;
+		mMaterialDirty.Mark(mat->MatCBIndex);
+	}
+
+	// Frames up to retireFence may still sample the previous copy.
+	if (previousSrvIndex != mPlaceholderSrvIndex && previousSrvIndex != mPlaceholderArraySrvIndex)
+		mSrvHeap->Free(previousSrvIndex, retireFence);
+}
+
+void ShapesApp::GenerateTextureMips(ID3D12GraphicsCommandList* cmdList)
+{
+	cmdList->SetPipelineState(GetPipeline(PipelineId::GenerateMips));
+	cmdList->SetComputeRootSignature(mMipRootSignature.Get());
+
+	for (const std::string& name : mPendingMips)
+	{
+		// The streamer still holds the streamed copy, so it outlives this frame's reads.
+		ID3D12Resource* source = mTextures[name]->Resource.Get();
+		D3D12_RESOURCE_DESC desc = MipGenerator::FullChainDesc(source->GetDesc());
+		if (!mMipGenerator->Supported(desc.Format))
+			break;
+
+		// Uncompressed, so it costs more memory than a cooked texture would.
+		ComPtr<ID3D12Resource> texture;
+		ThrowIfFailed(mResourceAllocator->CreateResource(desc, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, texture));
+
+		mResourceStates.Track(texture.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+		mMipGenerator->GenerateFrom(cmdList, mResourceStates, source, texture.Get(), true, mCurrentFence + 1);
+		mResourceStates.Untrack(texture.Get());
+
+		// This frame's material buffer already went out with the old descriptor.
+		BindTexture(name, texture, mCurrentFence + 1);
+
+		// The streamer frees it when it is demoted or promoted.
+		const TextureSlot& slot = mTextureSlots[name];
+		mTextureStreamer->Adopt(slot.StreamId, texture, mCurrentFence + 1);
+		mResidency->SetResidentBytes(slot.ResidencyHandle, md3dDevice->GetResourceAllocationInfo(0, 1, &desc).SizeInBytes, false);
+	}
+	mPendingMips.clear();
+}
+
+void ShapesApp::UseTexture(Material* mat, const std::string& textureName)
+{
+	TextureSlot& slot = mTextureSlots[textureName];
+	mat->DiffuseSrvHeapIndex = slot.SrvIndex;
+	slot.Users.push_back(mat);
+}
+
+void ShapesApp::CreateTextureSrv(ID3D12Resource* texture, bool isArray, UINT heapIndex)
+{
+	CD3DX12_CPU_DESCRIPTOR_HANDLE hDescriptor = mSrvHeap->CpuHandle(heapIndex);
+
+	auto desc = texture->GetDesc();
+
+	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+	srvDesc.Format = desc.Format;
+	if (isArray)
+	{
+		srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2DARRAY;
+		srvDesc.Texture2DArray.MostDetailedMip = 0;
+		srvDesc.Texture2DArray.MipLevels = -1;
+		srvDesc.Texture2DArray.FirstArraySlice = 0;
+		srvDesc.Texture2DArray.ArraySize = desc.DepthOrArraySize;
+	}
+	else
+	{
+		srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+		srvDesc.Texture2D.MostDetailedMip = 0;
+		srvDesc.Texture2D.MipLevels = -1;
+	}
+	md3dDevice->CreateShaderResourceView(texture, &srvDesc, hDescriptor);
+}
+
+void ShapesApp::BuildRootSignature()
+{
+	// Version 1.1 lets the driver assume the data behind most parameters stays put for
+	// the whole execution.  Older runtimes get the same layout without the flags.
+	D3D12_FEATURE_DATA_ROOT_SIGNATURE featureData = {};
+	featureData.HighestVersion = D3D_ROOT_SIGNATURE_VERSION_1_1;
+	if (FAILED(md3dDevice->CheckFeatureSupport(D3D12_FEATURE_ROOT_SIGNATURE, &featureData, sizeof(featureData))))
+		featureData.HighestVersion = D3D_ROOT_SIGNATURE_VERSION_1_0;
+
+	// Every per-frame buffer is written before the lists that read it are recorded.
+	// The visible list and cluster lists are written by compute passes earlier in
+	// the frame, and the scene constants by a copy, so they only stay static from the
+	// draw on.
+	const D3D12_ROOT_DESCRIPTOR_FLAGS cpuWritten = D3D12_ROOT_DESCRIPTOR_FLAG_DATA_STATIC;
+	const D3D12_ROOT_DESCRIPTOR_FLAGS gpuWritten = D3D12_ROOT_DESCRIPTOR_FLAG_DATA_STATIC_WHILE_SET_AT_EXECUTE;
+
+	// The whole SRV heap, seen both as Texture2D (space2) and Texture2DArray (space3).
+	// Streamed textures write their descriptors while the heap is bound, so the
+	// descriptors are volatile; the textures they point to never change.
+	const D3D12_DESCRIPTOR_RANGE_FLAGS texFlags =
+		D3D12_DESCRIPTOR_RANGE_FLAG_DESCRIPTORS_VOLATILE | D3D12_DESCRIPTOR_RANGE_FLAG_DATA_STATIC;
+	CD3DX12_DESCRIPTOR_RANGE1 texTable[3];
+	texTable[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, UINT_MAX, 0, 2, texFlags, 0);
+	texTable[1].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, UINT_MAX, 0, 3, texFlags, 0);
+
+	// And once more as depth (space4) for the shadow map, which is written every frame.
+	texTable[2].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, UINT_MAX, 0, 4,
+		D3D12_DESCRIPTOR_RANGE_FLAG_DESCRIPTORS_VOLATILE | D3D12_DESCRIPTOR_RANGE_FLAG_DATA_STATIC_WHILE_SET_AT_EXECUTE, 0);
+
+	// Root parameter can be a table, root descriptor or root constants.
+	CD3DX12_ROOT_PARAMETER1 slotRootParameter[(int)RootParameter::Count];
+
+	// Perfomance TIP: Order from most frequent to least frequent.
+	slotRootParameter[(int)RootParameter::DrawConstants].InitAsConstants(2, 0);
+	slotRootParameter[(int)RootParameter::VisibleInstances].InitAsShaderResourceView(1, 1, gpuWritten, D3D12_SHADER_VISIBILITY_VERTEX);
+	slotRootParameter[(int)RootParameter::PassCB].InitAsConstantBufferView(1, 0, cpuWritten);
+	slotRootParameter[(int)RootParameter::SceneCB].InitAsConstantBufferView(2, 0, gpuWritten, D3D12_SHADER_VISIBILITY_PIXEL);
+	slotRootParameter[(int)RootParameter::InstanceData].InitAsShaderResourceView(0, 1, cpuWritten, D3D12_SHADER_VISIBILITY_VERTEX);
+	slotRootParameter[(int)RootParameter::ObjectData].InitAsShaderResourceView(5, 1, cpuWritten, D3D12_SHADER_VISIBILITY_VERTEX);
+	slotRootParameter[(int)RootParameter::MaterialData].InitAsShaderResourceView(4, 1, cpuWritten);
+	slotRootParameter[(int)RootParameter::LocalLights].InitAsShaderResourceView(2, 1, cpuWritten, D3D12_SHADER_VISIBILITY_PIXEL);
+	slotRootParameter[(int)RootParameter::ClusterLights].InitAsShaderResourceView(3, 1, gpuWritten, D3D12_SHADER_VISIBILITY_PIXEL);
+	slotRootParameter[(int)RootParameter::WaveHeights].InitAsShaderResourceView(6, 1, gpuWritten, D3D12_SHADER_VISIBILITY_VERTEX);
+	slotRootParameter[(int)RootParameter::Textures].InitAsDescriptorTable(_countof(texTable), texTable, D3D12_SHADER_VISIBILITY_PIXEL);
+
+	auto staticSamplers = GetStaticSamplers();
+
+	// A root signature is an array of root parameters.  No hull or domain shaders are used.
+	CD3DX12_VERSIONED_ROOT_SIGNATURE_DESC rootSigDesc(_countof(slotRootParameter), slotRootParameter,
+		(UINT)staticSamplers.size(), staticSamplers.data(),
+		D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT |
+		D3D12_ROOT_SIGNATURE_FLAG_DENY_HULL_SHADER_ROOT_ACCESS |
+		D3D12_ROOT_SIGNATURE_FLAG_DENY_DOMAIN_SHADER_ROOT_ACCESS);
+
+	ComPtr<ID3DBlob> serializedRootSig = nullptr;
+	ComPtr<ID3DBlob> errorBlob = nullptr;
+	HRESULT hr = D3DX12SerializeVersionedRootSignature(&rootSigDesc, featureData.HighestVersion,
+		serializedRootSig.GetAddressOf(), errorBlob.GetAddressOf());
+
+	if (errorBlob != nullptr)
+	{
+		::OutputDebugStringA((char*)errorBlob->GetBufferPointer());
+	}
+	ThrowIfFailed(hr);
+
+	ThrowIfFailed(md3dDevice->CreateRootSignature(
+		0,
+		serializedRootSig->GetBufferPointer(),
+		serializedRootSig->GetBufferSize(),
+		IID_PPV_ARGS(mRootSignature.GetAddressOf())));
+	PipelineCache::TagRootSignature(mRootSignature.Get(), serializedRootSig.Get());
+}
+
+void ShapesApp::BuildCullSignatures()
+{
+	// The cull constants, the instance bounds, the visible list, the draw arguments,
+	// the visibility history, the Hi-Z pyramid, and the meshlets and instance data
+	// the meshlets are culled with.
+	CD3DX12_DESCRIPTOR_RANGE hiZTable;
+	hiZTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 1);
+
+	CD3DX12_ROOT_PARAMETER slotRootParameter[8];
+
+	slotRootParameter[0].InitAsConstantBufferView(0);
+	slotRootParameter[1].InitAsShaderResourceView(0);
+	slotRootParameter[2].InitAsUnorderedAccessView(0);
+	slotRootParameter[3].InitAsUnorderedAccessView(1);
+	slotRootParameter[4].InitAsUnorderedAccessView(2);
+	slotRootParameter[5].InitAsDescriptorTable(1, &hiZTable);
+	slotRootParameter[6].InitAsShaderResourceView(2);
+	slotRootParameter[7].InitAsShaderResourceView(3);
+
+	CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(_countof(slotRootParameter), slotRootParameter,
+		0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_NONE);
+
+	ComPtr<ID3DBlob> serializedRootSig = nullptr;
+	ComPtr<ID3DBlob> errorBlob = nullptr;
+	HRESULT hr = D3D12SerializeRootSignature(&rootSigDesc, D3D_ROOT_SIGNATURE_VERSION_1,
+		serializedRootSig.GetAddressOf(), errorBlob.GetAddressOf());
+
+	if (errorBlob != nullptr)
+	{
+		::OutputDebugStringA((char*)errorBlob->GetBufferPointer());
+	}
+	ThrowIfFailed(hr);
+
+	ThrowIfFailed(md3dDevice->CreateRootSignature(
+		0,
+		serializedRootSig->GetBufferPointer(),
+		serializedRootSig->GetBufferSize(),
+		IID_PPV_ARGS(mCullRootSignature.GetAddressOf())));
+	PipelineCache::TagRootSignature(mCullRootSignature.Get(), serializedRootSig.Get());
+
+	// The indirect arguments only hold the draw itself, so no root signature is needed.
+	D3D12_INDIRECT_ARGUMENT_DESC argumentDesc = {};
+	argumentDesc.Type = D3D12_INDIRECT_ARGUMENT_TYPE_DRAW_INDEXED;
+
+	D3D12_COMMAND_SIGNATURE_DESC commandSignatureDesc = {};
+	commandSignatureDesc.ByteStride = sizeof(D3D12_DRAW_INDEXED_ARGUMENTS);
+	commandSignatureDesc.NumArgumentDescs = 1;
+	commandSignatureDesc.pArgumentDescs = &argumentDesc;
+
+	ThrowIfFailed(md3dDevice->CreateCommandSignature(&commandSignatureDesc, nullptr,
+		IID_PPV_ARGS(mDrawIndexedSignature.GetAddressOf())));
+
+	// A meshlet draw also points gObjectIndex at its visible list, which takes the
+	// root signature the constant belongs to.
+	D3D12_INDIRECT_ARGUMENT_DESC meshletArgumentDescs[2] = {};
+	meshletArgumentDescs[0].Type = D3D12_INDIRECT_ARGUMENT_TYPE_CONSTANT;
+	meshletArgumentDescs[0].Constant.RootParameterIndex = (UINT)RootParameter::DrawConstants;
+	meshletArgumentDescs[0].Constant.DestOffsetIn32BitValues = 0;
+	meshletArgumentDescs[0].Constant.Num32BitValuesToSet = 1;
+	meshletArgumentDescs[1].Type = D3D12_INDIRECT_ARGUMENT_TYPE_DRAW_INDEXED;
+
+	D3D12_COMMAND_SIGNATURE_DESC meshletSignatureDesc = {};
+	meshletSignatureDesc.ByteStride = sizeof(MeshletDrawArguments);
+	meshletSignatureDesc.NumArgumentDescs = _countof(meshletArgumentDescs);
+	meshletSignatureDesc.pArgumentDescs = meshletArgumentDescs;
+
+	ThrowIfFailed(md3dDevice->CreateCommandSignature(&meshletSignatureDesc, mRootSignature.Get(),
+		IID_PPV_ARGS(mMeshletDrawSignature.GetAddressOf())));
+
+	// The tree culling pass: its constants, the sprites, the tile transforms, the
+	// visible tree list and the tree draw arguments.
+	CD3DX12_ROOT_PARAMETER treeRootParameter[5];
+
+	treeRootParameter[0].InitAsConstants(sizeof(TreeCullConstants) / 4, 0);
+	treeRootParameter[1].InitAsShaderResourceView(0);
+	treeRootParameter[2].InitAsShaderResourceView(1);
+	treeRootParameter[3].InitAsUnorderedAccessView(0);
+	treeRootParameter[4].InitAsUnorderedAccessView(1);
+
+	CD3DX12_ROOT_SIGNATURE_DESC treeRootSigDesc(_countof(treeRootParameter), treeRootParameter,
+		0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_NONE);
+
+	hr = D3D12SerializeRootSignature(&treeRootSigDesc, D3D_ROOT_SIGNATURE_VERSION_1,
+		serializedRootSig.ReleaseAndGetAddressOf(), errorBlob.ReleaseAndGetAddressOf());
+
+	if (errorBlob != nullptr)
+	{
+		::OutputDebugStringA((char*)errorBlob->GetBufferPointer());
+	}
+	ThrowIfFailed(hr);
+
+	ThrowIfFailed(md3dDevice->CreateRootSignature(
+		0,
+		serializedRootSig->GetBufferPointer(),
+		serializedRootSig->GetBufferSize(),
+		IID_PPV_ARGS(mTreeCullRootSignature.GetAddressOf())));
+	PipelineCache::TagRootSignature(mTreeCullRootSignature.Get(), serializedRootSig.Get());
+
+	// The trees are drawn without an index buffer.
+	argumentDesc.Type = D3D12_INDIRECT_ARGUMENT_TYPE_DRAW;
+	commandSignatureDesc.ByteStride = sizeof(D3D12_DRAW_ARGUMENTS);
+
+	ThrowIfFailed(md3dDevice->CreateCommandSignature(&commandSignatureDesc, nullptr,
+		IID_PPV_ARGS(mDrawSignature.GetAddressOf())));
+}
+
+void ShapesApp::BuildHiZSignature()
+{
+	// The layout HiZPyramid::Build binds: its constants, the depth buffer and the mip
+	// read and the mip written.
+	CD3DX12_DESCRIPTOR_RANGE depthTable;
+	depthTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 0);
+
+	CD3DX12_DESCRIPTOR_RANGE srcMipTable;
+	srcMipTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 1, 0);
+
+	CD3DX12_DESCRIPTOR_RANGE dstMipTable;
+	dstMipTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 1, 1);
+
+	CD3DX12_ROOT_PARAMETER slotRootParameter[4];
+
+	slotRootParameter[0].InitAsConstants(sizeof(HiZPyramid::BuildConstants) / 4, 0);
+	slotRootParameter[1].InitAsDescriptorTable(1, &depthTable);
+	slotRootParameter[2].InitAsDescriptorTable(1, &srcMipTable);
+	slotRootParameter[3].InitAsDescriptorTable(1, &dstMipTable);
+
+	CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(_countof(slotRootParameter), slotRootParameter,
+		0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_NONE);
+
+	ComPtr<ID3DBlob> serializedRootSig = nullptr;
+	ComPtr<ID3DBlob> errorBlob = nullptr;
+	HRESULT hr = D3D12SerializeRootSignature(&rootSigDesc, D3D_ROOT_SIGNATURE_VERSION_1,
+		serializedRootSig.GetAddressOf(), errorBlob.GetAddressOf());
+
+	if (errorBlob != nullptr)
+	{
+		::OutputDebugStringA((char*)errorBlob->GetBufferPointer());
+	}
+	ThrowIfFailed(hr);
+
+	ThrowIfFailed(md3dDevice->CreateRootSignature(
+		0,
+		serializedRootSig->GetBufferPointer(),
+		serializedRootSig->GetBufferSize(),
+		IID_PPV_ARGS(mHiZRootSignature.GetAddressOf())));
+	PipelineCache::TagRootSignature(mHiZRootSignature.Get(), serializedRootSig.Get());
+}
+
+void ShapesApp::BuildShadingRateSignature()
+{
+	// The layout ShadingRateImage::Build binds: its constants, the depth buffer, the
+	// colour and the image written.
+	CD3DX12_DESCRIPTOR_RANGE depthTable;
+	depthTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 0);
+
+	CD3DX12_DESCRIPTOR_RANGE colorTable;
+	colorTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 1);
+
+	CD3DX12_DESCRIPTOR_RANGE imageTable;
+	imageTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 1, 0);
+
+	CD3DX12_ROOT_PARAMETER slotRootParameter[4];
+
+	slotRootParameter[0].InitAsConstants(sizeof(ShadingRateImage::BuildConstants) / 4, 0);
+	slotRootParameter[1].InitAsDescriptorTable(1, &depthTable);
+	slotRootParameter[2].InitAsDescriptorTable(1, &colorTable);
+	slotRootParameter[3].InitAsDescriptorTable(1, &imageTable);
+
+	CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(_countof(slotRootParameter), slotRootParameter,
+		0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_NONE);
+
+	ComPtr<ID3DBlob> serializedRootSig = nullptr;
+	ComPtr<ID3DBlob> errorBlob = nullptr;
+	HRESULT hr = D3D12SerializeRootSignature(&rootSigDesc, D3D_ROOT_SIGNATURE_VERSION_1,
+		serializedRootSig.GetAddressOf(), errorBlob.GetAddressOf());
+
+	if (errorBlob != nullptr)
+	{
+		::OutputDebugStringA((char*)errorBlob->GetBufferPointer());
+	}
+	ThrowIfFailed(hr);
+
+	ThrowIfFailed(md3dDevice->CreateRootSignature(
+		0,
+		serializedRootSig->GetBufferPointer(),
+		serializedRootSig->GetBufferSize(),
+		IID_PPV_ARGS(mShadingRateRootSignature.GetAddressOf())));
+	PipelineCache::TagRootSignature(mShadingRateRootSignature.Get(), serializedRootSig.Get());
+}
+
+void ShapesApp::BuildVisibilitySignature()
+{
+	// The resolve's constants, the per-frame data Default.hlsl shades with at the
+	// registers it declares them, the instances' submeshes and the shape geometry,
+	// the texture heap as in BuildRootSignature, the visibility buffer and the scene
+	// colour written.  Compute can't see mRootSignature's vertex and pixel parameters.
+	CD3DX12_DESCRIPTOR_RANGE texTable[3];
+	texTable[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, UINT_MAX, 0, 2);
+	texTable[1].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, UINT_MAX, 0, 3);
+	texTable[2].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, UINT_MAX, 0, 4);
+
+	CD3DX12_DESCRIPTOR_RANGE visibilityTable;
+	visibilityTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 0, 5);
+
+	CD3DX12_DESCRIPTOR_RANGE sceneTable;
+	sceneTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 1, 0);
+
+	CD3DX12_ROOT_PARAMETER slotRootParameter[14];
+
+	slotRootParameter[0].InitAsConstants(sizeof(VisibilityResolveConstants) / 4, 0);
+	slotRootParameter[1].InitAsConstantBufferView(1);
+	slotRootParameter[2].InitAsConstantBufferView(2);
+	slotRootParameter[3].InitAsShaderResourceView(0, 1);
+	slotRootParameter[4].InitAsShaderResourceView(4, 1);
+	slotRootParameter[5].InitAsShaderResourceView(2, 1);
+	slotRootParameter[6].InitAsShaderResourceView(3, 1);
+	slotRootParameter[7].InitAsShaderResourceView(6, 1);
+	slotRootParameter[8].InitAsShaderResourceView(7, 1);
+	slotRootParameter[9].InitAsShaderResourceView(8, 1);
+	slotRootParameter[10].InitAsShaderResourceView(9, 1);
+	slotRootParameter[11].InitAsDescriptorTable(_countof(texTable), texTable);
+	slotRootParameter[12].InitAsDescriptorTable(1, &visibilityTable);
+	slotRootParameter[13].InitAsDescriptorTable(1, &sceneTable);
+
+	auto staticSamplers = GetStaticSamplers();
+
+	CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(_countof(slotRootParameter), slotRootParameter,
+		(UINT)staticSamplers.size(), staticSamplers.data(), D3D12_ROOT_SIGNATURE_FLAG_NONE);
+
+	ComPtr<ID3DBlob> serializedRootSig = nullptr;
+	ComPtr<ID3DBlob> errorBlob = nullptr;
+	HRESULT hr = D3D12SerializeRootSignature(&rootSigDesc, D3D_ROOT_SIGNATURE_VERSION_1,
+		serializedRootSig.GetAddressOf(), errorBlob.GetAddressOf());
+
+	if (errorBlob != nullptr)
+	{
+		::OutputDebugStringA((char*)errorBlob->GetBufferPointer());
+	}
+	ThrowIfFailed(hr);
+
+	ThrowIfFailed(md3dDevice->CreateRootSignature(
+		0,
+		serializedRootSig->GetBufferPointer(),
+		serializedRootSig->GetBufferSize(),
+		IID_PPV_ARGS(mVisibilityRootSignature.GetAddressOf())));
+	PipelineCache::TagRootSignature(mVisibilityRootSignature.Get(), serializedRootSig.Get());
+}
+
+void ShapesApp::BuildMipSignature()
+{
+	// The layout MipGenerator binds: its constants, the texture copied from, the mip
+	// read and the four mips written.
+	CD3DX12_DESCRIPTOR_RANGE sourceTable;
+	sourceTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 0);
+
+	CD3DX12_DESCRIPTOR_RANGE mipTables[5];
+	for (UINT i = 0; i < _countof(mipTables); ++i)
+		mipTables[i].Init(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 1, i);
+
+	CD3DX12_ROOT_PARAMETER slotRootParameter[7];
+
+	slotRootParameter[0].InitAsConstants(sizeof(MipGenerator::Constants) / 4, 0);
+	slotRootParameter[1].InitAsDescriptorTable(1, &sourceTable);
+	for (UINT i = 0; i < _countof(mipTables); ++i)
+		slotRootParameter[2 + i].InitAsDescriptorTable(1, &mipTables[i]);
+
+	CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(_countof(slotRootParameter), slotRootParameter,
+		0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_NONE);
+
+	ComPtr<ID3DBlob> serializedRootSig = nullptr;
+	ComPtr<ID3DBlob> errorBlob = nullptr;
+	HRESULT hr = D3D12SerializeRootSignature(&rootSigDesc, D3D_ROOT_SIGNATURE_VERSION_1,
+		serializedRootSig.GetAddressOf(), errorBlob.GetAddressOf());
+
+	if (errorBlob != nullptr)
+	{
+		::OutputDebugStringA((char*)errorBlob->GetBufferPointer());
+	}
+	ThrowIfFailed(hr);
+
+	ThrowIfFailed(md3dDevice->CreateRootSignature(
+		0,
+		serializedRootSig->GetBufferPointer(),
+		serializedRootSig->GetBufferSize(),
+		IID_PPV_ARGS(mMipRootSignature.GetAddressOf())));
+	PipelineCache::TagRootSignature(mMipRootSignature.Get(), serializedRootSig.Get());
+}
+
+void ShapesApp::BuildOverlaySignature()
+{
+	CD3DX12_ROOT_PARAMETER slotRootParameter[1];
+
+	slotRootParameter[0].InitAsShaderResourceView(0, 0, D3D12_SHADER_VISIBILITY_VERTEX);
+
+	CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(_countof(slotRootParameter), slotRootParameter,
+		0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_NONE);
+
+	ComPtr<ID3DBlob> serializedRootSig = nullptr;
+	ComPtr<ID3DBlob> errorBlob = nullptr;
+	HRESULT hr = D3D12SerializeRootSignature(&rootSigDesc, D3D_ROOT_SIGNATURE_VERSION_1,
+		serializedRootSig.GetAddressOf(), errorBlob.GetAddressOf());
+
+	if (errorBlob != nullptr)
+	{
+		::OutputDebugStringA((char*)errorBlob->GetBufferPointer());
+	}
+	ThrowIfFailed(hr);
+
+	ThrowIfFailed(md3dDevice->CreateRootSignature(
+		0,
+		serializedRootSig->GetBufferPointer(),
+		serializedRootSig->GetBufferSize(),
+		IID_PPV_ARGS(mOverlayRootSignature.GetAddressOf())));
+	PipelineCache::TagRootSignature(mOverlayRootSignature.Get(), serializedRootSig.Get());
+}
+
+void ShapesApp::BuildClusterSignature()
+{
+	CD3DX12_ROOT_PARAMETER slotRootParameter[3];
+
+	// The pass constants, the local lights and the cluster light lists.
+	slotRootParameter[0].InitAsConstantBufferView(0);
+	slotRootParameter[1].InitAsShaderResourceView(2, 1);
+	slotRootParameter[2].InitAsUnorderedAccessView(0);
+
+	CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(_countof(slotRootParameter), slotRootParameter,
+		0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_NONE);
+
+	ComPtr<ID3DBlob> serializedRootSig = nullptr;
+	ComPtr<ID3DBlob> errorBlob = nullptr;
+	HRESULT hr = D3D12SerializeRootSignature(&rootSigDesc, D3D_ROOT_SIGNATURE_VERSION_1,
+		serializedRootSig.GetAddressOf(), errorBlob.GetAddressOf());
+
+	if (errorBlob != nullptr)
+	{
+		::OutputDebugStringA((char*)errorBlob->GetBufferPointer());
+	}
+	ThrowIfFailed(hr);
+
+	ThrowIfFailed(md3dDevice->CreateRootSignature(
+		0,
+		serializedRootSig->GetBufferPointer(),
+		serializedRootSig->GetBufferSize(),
+		IID_PPV_ARGS(mClusterRootSignature.GetAddressOf())));
+	PipelineCache::TagRootSignature(mClusterRootSignature.Get(), serializedRootSig.Get());
+}
+
+void ShapesApp::BuildWaveSignature()
+{
+	CD3DX12_ROOT_PARAMETER slotRootParameter[4];
+
+	// The layout GpuWaves::RecordSteps binds: the step constants, the previous and
+	// current heights and the next heights.
+	slotRootParameter[0].InitAsConstants(sizeof(GpuWaves::StepConstants) / 4, 0);
+	slotRootParameter[1].InitAsShaderResourceView(0);
+	slotRootParameter[2].InitAsShaderResourceView(1);
+	slotRootParameter[3].InitAsUnorderedAccessView(0);
+
+	CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(_countof(slotRootParameter), slotRootParameter,
+		0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_NONE);
+
+	ComPtr<ID3DBlob> serializedRootSig = nullptr;
+	ComPtr<ID3DBlob> errorBlob = nullptr;
+	HRESULT hr = D3D12SerializeRootSignature(&rootSigDesc, D3D_ROOT_SIGNATURE_VERSION_1,
+		serializedRootSig.GetAddressOf(), errorBlob.GetAddressOf());
+
+	if (errorBlob != nullptr)
+	{
+		::OutputDebugStringA((char*)errorBlob->GetBufferPointer());
+	}
+	ThrowIfFailed(hr);
+
+	ThrowIfFailed(md3dDevice->CreateRootSignature(
+		0,
+		serializedRootSig->GetBufferPointer(),
+		serializedRootSig->GetBufferSize(),
+		IID_PPV_ARGS(mWaveRootSignature.GetAddressOf())));
+	PipelineCache::TagRootSignature(mWaveRootSignature.Get(), serializedRootSig.Get());
+}
+
+void ShapesApp::BuildFxaaSignature()
+{
+	// Fxaa.hlsl: its constants, the scene colour and the filtered output.
+	CD3DX12_DESCRIPTOR_RANGE sceneTable;
+	sceneTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 0);
+
+	CD3DX12_DESCRIPTOR_RANGE outputTable;
+	outputTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 1, 0);
+
+	CD3DX12_ROOT_PARAMETER slotRootParameter[3];
+
+	slotRootParameter[0].InitAsConstants(sizeof(FxaaConstants) / 4, 0);
+	slotRootParameter[1].InitAsDescriptorTable(1, &sceneTable);
+	slotRootParameter[2].InitAsDescriptorTable(1, &outputTable);
+
+	const CD3DX12_STATIC_SAMPLER_DESC linearClamp(
+		0, // shaderRegister
+		D3D12_FILTER_MIN_MAG_MIP_LINEAR, // filter
+		D3D12_TEXTURE_ADDRESS_MODE_CLAMP,  // addressU
+		D3D12_TEXTURE_ADDRESS_MODE_CLAMP,  // addressV
+		D3D12_TEXTURE_ADDRESS_MODE_CLAMP); // addressW
+
+	CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(_countof(slotRootParameter), slotRootParameter,
+		1, &linearClamp, D3D12_ROOT_SIGNATURE_FLAG_NONE);
+
+	ComPtr<ID3DBlob> serializedRootSig = nullptr;
+	ComPtr<ID3DBlob> errorBlob = nullptr;
+	HRESULT hr = D3D12SerializeRootSignature(&rootSigDesc, D3D_ROOT_SIGNATURE_VERSION_1,
+		serializedRootSig.GetAddressOf(), errorBlob.GetAddressOf());
+
+	if (errorBlob != nullptr)
+	{
+		::OutputDebugStringA((char*)errorBlob->GetBufferPointer());
+	}
+	ThrowIfFailed(hr);
+
+	ThrowIfFailed(md3dDevice->CreateRootSignature(
+		0,
+		serializedRootSig->GetBufferPointer(),
+		serializedRootSig->GetBufferSize(),
+		IID_PPV_ARGS(mFxaaRootSignature.GetAddressOf())));
+	PipelineCache::TagRootSignature(mFxaaRootSignature.Get(), serializedRootSig.Get());
+}
+
+void ShapesApp::BuildUpscaleSignature()
+{
+	// Upscale.hlsl: its constants and the scene being stretched.
+	CD3DX12_DESCRIPTOR_RANGE sourceTable;
+	sourceTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 0);
+
+	CD3DX12_ROOT_PARAMETER slotRootParameter[2];
+
+	slotRootParameter[0].InitAsConstants(sizeof(UpscaleConstants) / 4, 0, 0, D3D12_SHADER_VISIBILITY_PIXEL);
+	slotRootParameter[1].InitAsDescriptorTable(1, &sourceTable, D3D12_SHADER_VISIBILITY_PIXEL);
+
+	const CD3DX12_STATIC_SAMPLER_DESC linearClamp(
+		0, // shaderRegister
+		D3D12_FILTER_MIN_MAG_MIP_LINEAR, // filter
+		D3D12_TEXTURE_ADDRESS_MODE_CLAMP,  // addressU
+		D3D12_TEXTURE_ADDRESS_MODE_CLAMP,  // addressV
+		D3D12_TEXTURE_ADDRESS_MODE_CLAMP,  // addressW
+		0.0f,                              // mipLODBias
+		16,                                // maxAnisotropy
+		D3D12_COMPARISON_FUNC_LESS_EQUAL,
+		D3D12_STATIC_BORDER_COLOR_OPAQUE_WHITE,
+		0.0f,                              // minLOD
+		D3D12_FLOAT32_MAX,                 // maxLOD
+		D3D12_SHADER_VISIBILITY_PIXEL);
+
+	CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(_countof(slotRootParameter), slotRootParameter,
+		1, &linearClamp, D3D12_ROOT_SIGNATURE_FLAG_NONE);
+
+	ComPtr<ID3DBlob> serializedRootSig = nullptr;
+	ComPtr<ID3DBlob> errorBlob = nullptr;
+	HRESULT hr = D3D12SerializeRootSignature(&rootSigDesc, D3D_ROOT_SIGNATURE_VERSION_1,
+		serializedRootSig.GetAddressOf(), errorBlob.GetAddressOf());
+
+	if (errorBlob != nullptr)
+	{
+		::OutputDebugStringA((char*)errorBlob->GetBufferPointer());
+	}
+	ThrowIfFailed(hr);
+
+	ThrowIfFailed(md3dDevice->CreateRootSignature(
+		0,
+		serializedRootSig->GetBufferPointer(),
+		serializedRootSig->GetBufferSize(),
+		IID_PPV_ARGS(mUpscaleRootSignature.GetAddressOf())));
+	PipelineCache::TagRootSignature(mUpscaleRootSignature.Get(), serializedRootSig.Get());
+}
+
+void ShapesApp::BuildOitSignature()
+{
+	// Oit.hlsl's composite: the accumulation and revealage targets, read with Load.
+	CD3DX12_DESCRIPTOR_RANGE accumulationTable;
+	accumulationTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 0);
+	CD3DX12_DESCRIPTOR_RANGE revealageTable;
+	revealageTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 1);
+
+	CD3DX12_ROOT_PARAMETER slotRootParameter[2];
+
+	slotRootParameter[0].InitAsDescriptorTable(1, &accumulationTable, D3D12_SHADER_VISIBILITY_PIXEL);
+	slotRootParameter[1].InitAsDescriptorTable(1, &revealageTable, D3D12_SHADER_VISIBILITY_PIXEL);
+
+	CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(_countof(slotRootParameter), slotRootParameter,
+		0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_NONE);
+
+	ComPtr<ID3DBlob> serializedRootSig = nullptr;
+	ComPtr<ID3DBlob> errorBlob = nullptr;
+	HRESULT hr = D3D12SerializeRootSignature(&rootSigDesc, D3D_ROOT_SIGNATURE_VERSION_1,
+		serializedRootSig.GetAddressOf(), errorBlob.GetAddressOf());
+
+	if (errorBlob != nullptr)
+	{
+		::OutputDebugStringA((char*)errorBlob->GetBufferPointer());
+	}
+	ThrowIfFailed(hr);
+
+	ThrowIfFailed(md3dDevice->CreateRootSignature(
+		0,
+		serializedRootSig->GetBufferPointer(),
+		serializedRootSig->GetBufferSize(),
+		IID_PPV_ARGS(mOitRootSignature.GetAddressOf())));
+	PipelineCache::TagRootSignature(mOitRootSignature.Get(), serializedRootSig.Get());
+}
+
+void ShapesApp::BuildDescriptorHeaps()
+{
+	//
+	// Create the SRV heap.
+	//
+	mSrvHeap = std::make_unique<DescriptorAllocator>(md3dDevice.Get(),
+		D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV, gSrvHeapCapacity, true);
+
+	//
+	// The placeholders (2D and 2D array) stay for good; LoadTextures writes them.
+	// Streamed textures take descriptors as their copies arrive.
+	//
+	mPlaceholderSrvIndex = mSrvHeap->Allocate();
+	mPlaceholderArraySrvIndex = mSrvHeap->Allocate();
+
+	// The Hi-Z pyramid's views live in the same heap; OnResize rebuilds it from here on.
+	// Its texture is a render graph transient, set when the Hi-Z pass runs.
+	mHiZ = std::make_unique<HiZPyramid>(md3dDevice.Get(), *mSrvHeap);
+	mHiZ->Resize(mDepthStencilBuffer.Get(), mReverseZ, mCurrentFence);
+
+	// So do the shading rate image's, the same way.
+	mShadingRate = std::make_unique<ShadingRateImage>(md3dDevice.Get(), *mSrvHeap);
+	mShadingRate->Resize(mDepthStencilBuffer.Get(), mCurrentFence);
+
+	mMipGenerator = std::make_unique<MipGenerator>(md3dDevice.Get(), *mSrvHeap);
+
+	// Likewise rebuilt by OnResize, and by 'T' and 'I'.
+	BuildOitTargets();
+	BuildVisibilityTarget();
+
+	mShadowMap = std::make_unique<CascadedShadowMap>(md3dDevice.Get(), *mSrvHeap, mResourceStates,
+		gShadowMapSize, gShadowCasterDistance);
+}
+
+void ShapesApp::BuildShadersAndInputLayout()
+{
+	mShaderLibrary = std::make_unique<ShaderLibrary>(gPrecompiledShaderDirectory, gShaderCacheDirectory);
+	AddShaderPrograms(*mShaderLibrary);
+
+	std::vector<std::string> standardVSOptions;
+	if (gPackedVertices)
+		standardVSOptions.push_back("PACKED_VERTEX");
+
+	std::vector<std::string> opaquePSOptions = { "FOG" };
+	if (gClusteredLighting)
+		opaquePSOptions.push_back("CLUSTERED_LIGHTING");
+
+	std::vector<std::string> oitPSOptions = opaquePSOptions;
+	oitPSOptions.push_back("WEIGHTED_OIT");
+
+	// The visibility VS passes the instance on to the pixel shader, and the resolve
+	// reads the vertex layout itself.
+	std::vector<std::string> visibilityVSOptions = standardVSOptions;
+	visibilityVSOptions.push_back("VISIBILITY");
+	std::vector<std::string> visibilityResolveOptions = opaquePSOptions;
+	if (gPackedVertices)
+		visibilityResolveOptions.push_back("PACKED_VERTEX");
+
+	// The opaque layer reads the lightmaps through a second vertex stream.
+	std::vector<std::string> lightmapVSOptions = standardVSOptions;
+	lightmapVSOptions.push_back("LIGHTMAP");
+	std::vector<std::string> lightmapPSOptions = opaquePSOptions;
+	lightmapPSOptions.push_back("LIGHTMAP");
+
+	// The composite reads multisampled targets while MSAA is on; BuildPSOs picks.
+	mShaderRequests =
+	{
+		{ "standardVS", "standardVS", standardVSOptions },
+		{ "opaquePS", "opaquePS", opaquePSOptions },
+		{ "oitPS", "opaquePS", oitPSOptions },
+		{ "visibilityVS", "standardVS", visibilityVSOptions },
+		{ "visibilityPS", "visibilityPS" },
+		{ "visibilityResolveCS", "visibilityResolveCS", visibilityResolveOptions },
+		{ "oitCompositeVS", "oitCompositeVS" },
+		{ "oitCompositePS", "oitCompositePS" },
+		{ "oitCompositeMsaaPS", "oitCompositePS", { "MSAA" } },
+		{ "treeSpriteVS", "treeSpriteVS" },
+		{ "treeSpritePS", "treeSpritePS", { "FOG", "ALPHA_TEST" } },
+		{ "impostorVS", "impostorVS" },
+		{ "impostorPS", "impostorPS", { "FOG" } },
+		{ "impostorBakeVS", "impostorBakeVS", standardVSOptions },
+		{ "impostorBakePS", "impostorBakePS" },
+		{ "cullCS", "cullCS" },
+		{ "treeCullCS", "treeCullCS" },
+		{ "hizCS", "hizCS" },
+		{ "shadingRateCS", "shadingRateCS" },
+		{ "mipsCS", "mipsCS" },
+		{ "clusterCS", "clusterCS" },
+		{ "wavesCS", "wavesCS" },
+		{ "fxaaCS", "fxaaCS" },
+		{ "upscaleVS", "upscaleVS" },
+		{ "upscalePS", "upscalePS" },
+		{ "overlayVS", "overlayVS" },
+		{ "overlayPS", "overlayPS" },
+	};
+	if (gLightmaps)
+	{
+		mShaderRequests.push_back({ "lightmapVS", "standardVS", lightmapVSOptions });
+		mShaderRequests.push_back({ "lightmapPS", "opaquePS", lightmapPSOptions });
+	}
+
+	for (ShaderRequest& request : mShaderRequests)
+	{
+		request.Key = mShaderLibrary->Key(request.Program, request.Options);
+		mShaders[request.Name] = mShaderLibrary->Get(request.Program, request.Options);
+	}
+
+	if (gPackedVertices)
+	{
+		mInputLayout =
+		{
+			{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+			{ "NORMAL", 0, DXGI_FORMAT_R16G16_SNORM, 0, 12, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+			{ "TEXCOORD", 0, DXGI_FORMAT_R16G16_FLOAT, 0, 16, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		};
+	}
+	else
+	{
+		mInputLayout =
+		{
+			{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+			{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+			{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		};
+	}
+
+	// The lightmap UVs come from their own buffer in slot 1; see BuildLightmapUVs.
+	mLightmapInputLayout = mInputLayout;
+	mLightmapInputLayout.push_back(
+		{ "TEXCOORD", 1, DXGI_FORMAT_R16G16_UNORM, 1, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 });
+}
+
+
+// Local-space bounding box of a generated mesh.
+static BoundingBox ComputeMeshBounds(const GeometryGenerator::MeshData& mesh)
+{
+	BoundingBox bounds;
+	BoundingBox::CreateFromPoints(bounds, mesh.Vertices.size(), &mesh.Vertices[0].Position, sizeof(GeometryGenerator::Vertex));
+	return bounds;
+}
+
+// Submesh name of a level of detail; level 0 keeps the plain name.
+static std::string LodName(const std::string& name, int lod)
+{
+	return lod == 0 ? name : name + "_lod" + std::to_string(lod);
+}
+
+// Mesh cache key text: the generator and its arguments.
+static std::string MeshRecipe(const char* generator, std::initializer_list<float> args)
+{
+	std::ostringstream recipe;
+	recipe << generator;
+	for (float arg : args)
+		recipe << ' ' << arg;
+	return recipe.str();
+}
+
+// Optimizes a generated mesh, cuts it into meshlets and converts it to the vertex
+// format the shape geometry is drawn with.
+static void PrepareMesh(GeometryGenerator::MeshData& data, MeshCache::Entry& entry)
+{
+	MeshOptimizer::Optimize(data);
+
+	entry.VertexCount = (UINT)data.Vertices.size();
+	entry.Indices = data.Indices32;
+	entry.Bounds = ComputeMeshBounds(data);
+	entry.Meshlets = MeshletBuilder::Build(data);
+
+	if (gPackedVertices)
+	{
+		entry.VertexStride = sizeof(PackedVertex);
+		entry.Vertices.resize(data.Vertices.size() * sizeof(PackedVertex));
+
+		PackedVertex* vertices = reinterpret_cast<PackedVertex*>(entry.Vertices.data());
+		for (size_t i = 0; i < data.Vertices.size(); ++i)
+		{
+			XMFLOAT2 octNormal = MathHelper::OctahedralEncode(data.Vertices[i].Normal);
+			vertices[i].Pos = data.Vertices[i].Position;
+			vertices[i].Normal = XMSHORTN2(octNormal.x, octNormal.y);
+			vertices[i].TexC = XMHALF2(data.Vertices[i].TexC.x, data.Vertices[i].TexC.y);
+		}
+	}
+	else
+	{
+		entry.VertexStride = sizeof(Vertex);
+		entry.Vertices.resize(data.Vertices.size() * sizeof(Vertex));
+
+		Vertex* vertices = reinterpret_cast<Vertex*>(entry.Vertices.data());
+		for (size_t i = 0; i < data.Vertices.size(); ++i)
+		{
+			vertices[i].Pos = data.Vertices[i].Position;
+			vertices[i].Normal = data.Vertices[i].Normal;
+			vertices[i].TexC = data.Vertices[i].TexC;
+		}
+	}
+}
+
+// Generates every shape the scene can refer to into scene.Vertices/Indices/Submeshes.
+// Meshes already in the mesh cache are appended as they are.
+void ShapesApp::BakeShapeGeometry(SceneDescription& scene)
+{
+	GeometryGenerator geoGen;
+
+	struct Shape
+	{
+		std::string Name;
+		std::string Recipe;
+		std::function<GeometryGenerator::MeshData()> Generate;
+	};
+
+	std::vector<Shape> shapes;
+	auto addShape = [&shapes](const std::string& name, const std::string& recipe, std::function<GeometryGenerator::MeshData()> generate)
+	{
+		shapes.push_back({ name, recipe, std::move(generate) });
+	};
+
+	addShape("box", MeshRecipe("CreateBox", { 1.0f, 1.0f, 1.0f, 0 }), [&] { return geoGen.CreateBox(1.0f, 1.0f, 1.0f, 0); });
+	addShape("wedge", MeshRecipe("CreateWedge", { 1.0f, 1.0f, 1.0f, 1 }), [&] { return geoGen.CreateWedge(1.0f, 1.0f, 1.0f, 1); });
+	addShape("pyramid", MeshRecipe("CreatePyramid", { 1.0f, 1.0f, 1.0f, 5 }), [&] { return geoGen.CreatePyramid(1.0f, 1.0f, 1.0f, 5); });
+	addShape("diamond", MeshRecipe("CreateDiamond", { 2.0f, 1.0f, 12 }), [&] { return geoGen.CreateDiamond(2.0f, 1.0f, 12); });
+	addShape("spike", MeshRecipe("CreateSpike", { 2.0f, 3.0f, 1.0f, 6, 2 }), [&] { return geoGen.CreateSpike(2.0f, 3.0f, 1.0f, 6, 2); });
+	addShape("squarewindow", MeshRecipe("CreateSquareWindow", { 0.5f, 1.0f, 1.0f }), [&] { return geoGen.CreateSquareWindow(0.5f, 1.0f, 1.0f); });
+	addShape("caltrop", MeshRecipe("CreateCaltrop", { 1.0f, 1.0f, 1.0f }), [&] { return geoGen.CreateCaltrop(1.0f, 1.0f, 1.0f); });
+
+	// The tessellated primitives also get coarser copies for distant items.  Level 0
+	// is the original detail and keeps the plain name.
+	const UINT gridLods[gNumLodLevels][2] = { { 60, 40 }, { 30, 20 }, { 15, 10 }, { 6, 4 } };
+	const UINT sphereLods[gNumLodLevels][2] = { { 20, 20 }, { 12, 12 }, { 8, 6 }, { 5, 4 } };
+	const UINT cylinderLods[gNumLodLevels][2] = { { 20, 20 }, { 12, 6 }, { 8, 2 }, { 6, 1 } };
+	const UINT coneLods[gNumLodLevels][2] = { { 12, 4 }, { 8, 2 }, { 6, 1 }, { 4, 1 } };
+	const UINT geosphereLods[gNumLodLevels] = { 3, 2, 1, 0 };
+
+	for (int lod = 0; lod < gNumLodLevels; ++lod)
+	{
+		const UINT* grid = gridLods[lod];
+		const UINT* sphere = sphereLods[lod];
+		const UINT* cylinder = cylinderLods[lod];
+		const UINT* cone = coneLods[lod];
+		const UINT geosphere = geosphereLods[lod];
+
+		addShape(LodName("grid", lod), MeshRecipe("CreateGrid", { 100.0f, 100.0f, (float)grid[0], (float)grid[1] }),
+			[&geoGen, grid] { return geoGen.CreateGrid(100.0f, 100.0f, grid[0], grid[1]); });
+		addShape(LodName("sphere", lod), MeshRecipe("CreateSphere", { 0.5f, (float)sphere[0], (float)sphere[1] }),
+			[&geoGen, sphere] { return geoGen.CreateSphere(0.5f, sphere[0], sphere[1]); });
+		addShape(LodName("cylinder", lod), MeshRecipe("CreateCylinder", { 1.0f, 1.0f, 3.0f, (float)cylinder[0], (float)cylinder[1] }),
+			[&geoGen, cylinder] { return geoGen.CreateCylinder(1.0f, 1.0f, 3.0f, cylinder[0], cylinder[1]); });
+		addShape(LodName("cone", lod), MeshRecipe("CreateCone", { 1.0f, 2.0f, (float)cone[0], (float)cone[1] }),
+			[&geoGen, cone] { return geoGen.CreateCone(1.0f, 2.0f, cone[0], cone[1]); });
+		addShape(LodName("geosphere", lod), MeshRecipe("CreateGeosphere", { 0.5f, (float)geosphere }),
+			[&geoGen, geosphere] { return geoGen.CreateGeosphere(0.5f, geosphere); });
+	}
+
+	// Everything PrepareMesh does after generating goes into the key as well, and
+	// the generator's own version for what Subdivide emits.
+	const std::string preparation = std::string(" | GeometryGenerator 2 | MeshOptimizer 1 | MeshletBuilder 1 | ") + (gPackedVertices ? "PackedVertex" : "Vertex");
+	MeshCache cache(gMeshCacheDirectory);
+	scene.VertexStride = gPackedVertices ? sizeof(PackedVertex) : sizeof(Vertex);
+
+	// Load what the cache has, then generate and prepare the rest across the pool.
+	std::vector<MeshCache::Entry> entries(shapes.size());
+	std::vector<std::uint64_t> keys(shapes.size());
+	std::vector<size_t> missing;
+	std::vector<std::function<GeometryGenerator::MeshData()>> generators;
+	for (size_t i = 0; i < shapes.size(); ++i)
+	{
+		keys[i] = MeshCache::Key(shapes[i].Recipe + preparation);
+		if (!cache.Load(keys[i], entries[i]) || entries[i].VertexStride != scene.VertexStride)
+		{
+			missing.push_back(i);
+			generators.push_back(shapes[i].Generate);
+		}
+	}
+
+	if (!missing.empty())
+	{
+		std::vector<GeometryGenerator::MeshData> meshes = GeometryGenerator::CreateBatch(*mTaskPool, generators);
+		for (size_t m = 0; m < missing.size(); ++m)
+			mTaskPool->Submit([&meshes, &entries, &missing, m]() { PrepareMesh(meshes[m], entries[missing[m]]); });
+		mTaskPool->Wait();
+
+		for (size_t i : missing)
+			cache.Store(keys[i], entries[i]);
+	}
+
+	// We are concatenating all the geometry into one big vertex/index buffer.  So
+	// define the regions in the buffer each submesh covers.
+	std::vector<std::uint32_t> indices;
+	UINT vertexCount = 0;
+
+	// Indices are relative to each submesh's base vertex, so 16 bits do as long as
+	// no single submesh has more vertices than that.
+	UINT maxSubmeshVertices = 0;
+
+	for (size_t i = 0; i < shapes.size(); ++i)
+	{
+		const Shape& shape = shapes[i];
+		const MeshCache::Entry& entry = entries[i];
+
+		maxSubmeshVertices = MathHelper::Max(maxSubmeshVertices, entry.VertexCount);
+
+		SceneSubmesh submesh;
+		assert(shape.Name.size() < SceneNameLength);
+		strcpy_s(submesh.Name, shape.Name.c_str());
+		submesh.IndexCount = (UINT)entry.Indices.size();
+		submesh.StartIndexLocation = (UINT)indices.size();
+		submesh.BaseVertexLocation = (INT)vertexCount;
+		submesh.BoundsCenter = entry.Bounds.Center;
+		submesh.BoundsExtents = entry.Bounds.Extents;
+		submesh.FirstMeshlet = (UINT)scene.Meshlets.size();
+		submesh.MeshletCount = (UINT)entry.Meshlets.size();
+		scene.Submeshes.push_back(submesh);
+
+		scene.Meshlets.insert(scene.Meshlets.end(), entry.Meshlets.begin(), entry.Meshlets.end());
+
+		scene.Vertices.insert(scene.Vertices.end(), entry.Vertices.begin(), entry.Vertices.end());
+		indices.insert(indices.end(), entry.Indices.begin(), entry.Indices.end());
+		vertexCount += entry.VertexCount;
+	}
+
+	if (maxSubmeshVertices <= 0x10000)
+	{
+		std::vector<std::uint16_t> indices16(std::begin(indices), std::end(indices));
+		scene.IndexFormat = DXGI_FORMAT_R16_UINT;
+		scene.Indices.assign((const std::uint8_t*)indices16.data(), (const std::uint8_t*)(indices16.data() + indices16.size()));
+	}
+	else
+	{
+		scene.IndexFormat = DXGI_FORMAT_R32_UINT;
+		scene.Indices.assign((const std::uint8_t*)indices.data(), (const std::uint8_t*)(indices.data() + indices.size()));
+	}
+}
+
+// The shape geometry comes straight out of the compiled scene, one copy per buffer.
+void ShapesApp::BuildShapeGeometry()
+{
+	auto geo = std::make_unique<MeshGeometry>();
+	geo->Name = "shapeGeo";
+
+	for (const SceneSubmesh& sceneSubmesh : mScene.Submeshes())
+	{
+		SubmeshGeometry submesh;
+		submesh.IndexCount = sceneSubmesh.IndexCount;
+		submesh.StartIndexLocation = sceneSubmesh.StartIndexLocation;
+		submesh.BaseVertexLocation = sceneSubmesh.BaseVertexLocation;
+		submesh.Bounds = BoundingBox(sceneSubmesh.BoundsCenter, sceneSubmesh.BoundsExtents);
+		submesh.FirstMeshlet = sceneSubmesh.FirstMeshlet;
+		submesh.MeshletCount = sceneSubmesh.MeshletCount;
+		geo->DrawArgs[sceneSubmesh.Name] = submesh;
+	}
+
+	// A mesh with a "_lod1" variant has a chain of detail levels.  A level missing
+	// from the file repeats the one before it.
+	for (const auto& e : geo->DrawArgs)
+	{
+		if (e.first.find("_lod") != std::string::npos || geo->DrawArgs.count(LodName(e.first, 1)) == 0)
+			continue;
+
+		auto& chain = mLodChains[e.first];
+		chain[0] = e.second;
+		for (int lod = 1; lod < gNumLodLevels; ++lod)
+		{
+			auto level = geo->DrawArgs.find(LodName(e.first, lod));
+			chain[lod] = level != geo->DrawArgs.end() ? level->second : chain[lod - 1];
+		}
+	}
+
+	// The ray BVHs are built from mScene's copy of the geometry, so the blobs are not kept.
+	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
+		mCommandList.Get(), mScene.VertexData(), mScene.VertexDataSize(), *mResourceAllocator, *mStagingRing);
+
+	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
+		mCommandList.Get(), mScene.IndexData(), mScene.IndexDataSize(), *mResourceAllocator, *mStagingRing);
+
+	// Kept non-empty so the culling pass's root SRV always has a buffer behind it.
+	const Meshlet emptyMeshlet;
+	const SceneSpan<Meshlet> meshlets = mScene.Meshlets();
+	mMeshletBuffer = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(), mCommandList.Get(),
+		meshlets.Count > 0 ? (const void*)meshlets.Data : &emptyMeshlet,
+		MathHelper::Max(meshlets.Count, 1u) * sizeof(Meshlet), *mResourceAllocator, *mStagingRing);
+
+	geo->VertexByteStride = mScene.VertexStride();
+	geo->VertexBufferByteSize = mScene.VertexDataSize();
+	geo->IndexFormat = mScene.IndexFormat();
+	geo->IndexBufferByteSize = mScene.IndexDataSize();
+
+	mShapeGeo = geo.get();
+	mGeometries[geo->Name] = std::move(geo);
+}
+
+// One BVH per submesh, each built in a job of its own from mScene's geometry, which is
+// released after initialization.  The LOD variants get none: rays are cast against an
+// item's finest level whichever one it draws.
+void ShapesApp::BuildRayMeshes()
+{
+	const UINT indexSize = mScene.IndexFormat() == DXGI_FORMAT_R32_UINT ? 4 : 2;
+
+	JobSystem::Counter built;
+	for (const auto& e : mShapeGeo->DrawArgs)
+	{
+		if (e.first.find("_lod") != std::string::npos)
+			continue;
+
+		auto& bvh = mRayMeshes[e.first];
+		bvh = std::make_unique<MeshBvh>();
+
+		MeshBvh* mesh = bvh.get();
+		const SubmeshGeometry* submesh = &e.second;
+		mJobs->Run(built, [this, mesh, submesh, indexSize]()
+		{
+			mesh->Build(mScene.VertexData(), mScene.VertexStride(), mScene.IndexData(), indexSize,
+				submesh->IndexCount, submesh->StartIndexLocation, submesh->BaseVertexLocation);
+		});
+	}
+	mJobs->Wait(built);
+}
+
+// A second set of texture coordinates for every submesh, laid out by LightmapBaker in
+// a job of its own, into a stream beside the vertex buffer.  Each submesh's vertices
+// stay in mLightmapMeshes for the bake; its LOD variants get UVs of their own, which
+// only roughly match the finest level's rectangles.
+void ShapesApp::BuildLightmapUVs()
+{
+	if (!gLightmaps)
+		return;
+
+	const bool packed = mScene.VertexStride() == sizeof(PackedVertex);
+	const bool indices32 = mScene.IndexFormat() == DXGI_FORMAT_R32_UINT;
+	const UINT vertexCount = mScene.VertexDataSize() / mScene.VertexStride();
+	std::vector<XMUSHORTN2> stream(vertexCount, XMUSHORTN2(0.0f, 0.0f));
+
+	JobSystem::Counter built;
+	for (const auto& e : mShapeGeo->DrawArgs)
+	{
+		LightmapMesh* mesh = &mLightmapMeshes[e.second.StartIndexLocation];
+		const SubmeshGeometry* submesh = &e.second;
+		XMUSHORTN2* uvs = stream.data();
+		mJobs->Run(built, [this, mesh, submesh, uvs, packed, indices32]()
+		{
+			mesh->Indices.resize(submesh->IndexCount);
+			std::uint32_t meshVertices = 0;
+			for (UINT i = 0; i < submesh->IndexCount; ++i)
+			{
+				const UINT index = submesh->StartIndexLocation + i;
+				mesh->Indices[i] = indices32 ? ((const std::uint32_t*)mScene.IndexData())[index] :
+					((const std::uint16_t*)mScene.IndexData())[index];
+				meshVertices = MathHelper::Max(meshVertices, mesh->Indices[i] + 1);
+			}
+
+			mesh->Positions.resize(meshVertices);
+			mesh->Normals.resize(meshVertices);
+			std::vector<XMFLOAT2> texCoords(meshVertices);
+			const std::uint8_t* vertices = (const std::uint8_t*)mScene.VertexData() +
+				(size_t)submesh->BaseVertexLocation * mScene.VertexStride();
+			for (std::uint32_t v = 0; v < meshVertices; ++v)
+			{
+				if (packed)
+				{
+					const PackedVertex& vertex = ((const PackedVertex*)vertices)[v];
+					XMFLOAT2 octNormal;
+					XMStoreFloat2(&octNormal, XMLoadShortN2(&vertex.Normal));
+					mesh->Positions[v] = vertex.Pos;
+					mesh->Normals[v] = MathHelper::OctahedralDecode(octNormal);
+					XMStoreFloat2(&texCoords[v], XMLoadHalf2(&vertex.TexC));
+				}
+				else
+				{
+					const Vertex& vertex = ((const Vertex*)vertices)[v];
+					mesh->Positions[v] = vertex.Pos;
+					mesh->Normals[v] = vertex.Normal;
+					texCoords[v] = vertex.TexC;
+				}
+			}
+
+			mesh->UVs.resize(meshVertices);
+			mesh->Valid = LightmapBaker::GenerateUVs(mesh->Positions.data(), texCoords.data(), meshVertices,
+				mesh->Indices.data(), submesh->IndexCount, gLightmapChartPadding, mesh->UVs.data());
+			if (!mesh->Valid)
+				return;
+
+			for (std::uint32_t v = 0; v < meshVertices; ++v)
+				uvs[submesh->BaseVertexLocation + v] = XMUSHORTN2(mesh->UVs[v].x, mesh->UVs[v].y);
+		});
+	}
+	mJobs->Wait(built);
+
+	const UINT byteSize = vertexCount * sizeof(XMUSHORTN2);
+	mShapeGeo->LightmapUVBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
+		mCommandList.Get(), stream.data(), byteSize, *mResourceAllocator, *mStagingRing);
+	mShapeGeo->LightmapUVByteStride = sizeof(XMUSHORTN2);
+	mShapeGeo->LightmapUVBufferByteSize = byteSize;
+}
+
+void ShapesApp::BuildTreeSpritesGeometry()
+{
+	// The sprite records go up as they are and the tree culling pass reads them as a
+	// structured buffer.  There is no index buffer; each visible tree is drawn as a
+	// four-vertex strip built from SV_VertexID.
+	const SceneSpan<SceneSprite> sprites = mScene.Sprites();
+	if (sprites.Count == 0)
+		return;
+
+	const UINT vbByteSize = sprites.Count * sizeof(SceneSprite);
+
+	auto geo = std::make_unique<MeshGeometry>();
+	geo->Name = "treeSpritesGeo";
+
+	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
+		mCommandList.Get(), sprites.Data, vbByteSize, *mResourceAllocator, *mStagingRing);
+
+	geo->VertexByteStride = sizeof(SceneSprite);
+	geo->VertexBufferByteSize = vbByteSize;
+
+	SubmeshGeometry submesh;
+	submesh.IndexCount = 0;
+	submesh.StartIndexLocation = 0;
+	submesh.BaseVertexLocation = 0;
+
+	geo->DrawArgs["points"] = submesh;
+
+	mTreeSpritesGeo = geo.get();
+	mGeometries["treeSpritesGeo"] = std::move(geo);
+}
+
+void ShapesApp::BuildPSOs()
+{
+	// Called again by OnResize when the sample count changes; new handles replace the old.
+	if (mPipelines == nullptr)
+		mPipelines = std::make_unique<PipelineCache>(md3dDevice.Get(), *mTaskPool, gPipelineLibraryFile);
+	mPsoSampleCount = m4xMsaaState ? 4 : 1;
+	if (!mReloadingPipelines)
+	{
+		// A reload still waiting would bring back pipelines of the old sample count.
+		mPendingPipelines.clear();
+		++mBundleGeneration;
+	}
+
+	/*----------- OPAQUE OBJECTS -----------*/
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC opaquePsoDesc;
+	ZeroMemory(&opaquePsoDesc, sizeof(D3D12_GRAPHICS_PIPELINE_STATE_DESC));
+	opaquePsoDesc.InputLayout = { mInputLayout.data(), (UINT)mInputLayout.size() };
+	opaquePsoDesc.pRootSignature = mRootSignature.Get();
+	opaquePsoDesc.VS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["standardVS"]->GetBufferPointer()),
+		mShaders["standardVS"]->GetBufferSize()
+	};
+	opaquePsoDesc.PS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["opaquePS"]->GetBufferPointer()),
+		mShaders["opaquePS"]->GetBufferSize()
+	};
+	opaquePsoDesc.RasterizerState = CD3DX12_RASTERIZER_DESC(D3D12_DEFAULT);
+	opaquePsoDesc.BlendState = CD3DX12_BLEND_DESC(D3D12_DEFAULT);
+	opaquePsoDesc.DepthStencilState = CD3DX12_DEPTH_STENCIL_DESC(D3D12_DEFAULT);
+	// Passes the depth the pre-pass already wrote.
+	opaquePsoDesc.DepthStencilState.DepthFunc = mReverseZ ? D3D12_COMPARISON_FUNC_GREATER_EQUAL : D3D12_COMPARISON_FUNC_LESS_EQUAL;
+	opaquePsoDesc.SampleMask = UINT_MAX;
+	opaquePsoDesc.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
+	opaquePsoDesc.NumRenderTargets = 1;
+	opaquePsoDesc.RTVFormats[0] = mBackBufferFormat;
+	opaquePsoDesc.SampleDesc.Count = mPsoSampleCount;
+	opaquePsoDesc.SampleDesc.Quality = m4xMsaaState ? (m4xMsaaQuality - 1) : 0;
+	opaquePsoDesc.DSVFormat = mDepthStencilFormat;
+
+	// With the lightmaps on, the opaque layer also reads their UVs; the passes built
+	// from opaquePsoDesc below don't.
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC forwardPsoDesc = opaquePsoDesc;
+	if (gLightmaps)
+	{
+		forwardPsoDesc.InputLayout = { mLightmapInputLayout.data(), (UINT)mLightmapInputLayout.size() };
+		forwardPsoDesc.VS =
+		{
+			reinterpret_cast<BYTE*>(mShaders["lightmapVS"]->GetBufferPointer()),
+			mShaders["lightmapVS"]->GetBufferSize()
+		};
+		forwardPsoDesc.PS =
+		{
+			reinterpret_cast<BYTE*>(mShaders["lightmapPS"]->GetBufferPointer()),
+			mShaders["lightmapPS"]->GetBufferSize()
+		};
+	}
+	SetPipeline(PipelineId::Opaque, gLightmaps ? "opaqueLightmap" : "opaque", forwardPsoDesc);
 
+	/*----------- DEPTH PRE-PASS -----------*/
 
-	//Directional/Parallel
+	// The opaque layer's depth only, for the Hi-Z pyramid the occlusion cull tests against.
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC depthPrepassPsoDesc = opaquePsoDesc;
+	depthPrepassPsoDesc.PS = { nullptr, 0 };
+	depthPrepassPsoDesc.NumRenderTargets = 0;
+	depthPrepassPsoDesc.RTVFormats[0] = DXGI_FORMAT_UNKNOWN;
+	SetPipeline(PipelineId::DepthPrepass, "depthPrepass", depthPrepassPsoDesc);
 
-	mMainPassCB.Lights[0].Direction = { 0.57735f, -0.57735f, 0.57735f };
-	mMainPassCB.Lights[0].Strength = { 0.2f, 0.2f, 0.066f };
-	
-	mMainPassCB.Lights[1].Direction = { -0.57735f, -0.57735f, 0.57735f };
-	mMainPassCB.Lights[1].Strength = { 0.1f, 0.1f, 0.1f };
-	
-	mMainPassCB.Lights[2].Direction = { 0.0f, -0.707f, -0.707f };
-	mMainPassCB.Lights[2].Strength = { 0.045f, 0.045f, 0.045f };
+	/*----------- VISIBILITY BUFFER -----------*/
+
+	// The opaque layer's instance and triangle ids, shaded later by the resolve.
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC visibilityPsoDesc = opaquePsoDesc;
+	visibilityPsoDesc.VS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["visibilityVS"]->GetBufferPointer()),
+		mShaders["visibilityVS"]->GetBufferSize()
+	};
+	visibilityPsoDesc.PS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["visibilityPS"]->GetBufferPointer()),
+		mShaders["visibilityPS"]->GetBufferSize()
+	};
+	visibilityPsoDesc.RTVFormats[0] = DXGI_FORMAT_R32_UINT;
+	SetPipeline(PipelineId::Visibility, "visibility", visibilityPsoDesc);
 
+	/*----------- SHADOW CASTERS -----------*/
 
-	//Point
+	// Depth only, into a single-sampled D32 cascade, biased against shadow acne.
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC shadowPsoDesc = depthPrepassPsoDesc;
+	shadowPsoDesc.DepthStencilState = CD3DX12_DEPTH_STENCIL_DESC(D3D12_DEFAULT);
+	shadowPsoDesc.RasterizerState.DepthBias = 2000;
+	shadowPsoDesc.RasterizerState.DepthBiasClamp = 0.0f;
+	shadowPsoDesc.RasterizerState.SlopeScaledDepthBias = 2.0f;
+	shadowPsoDesc.SampleDesc.Count = 1;
+	shadowPsoDesc.SampleDesc.Quality = 0;
+	shadowPsoDesc.DSVFormat = CascadedShadowMap::DsvFormat;
+	SetPipeline(PipelineId::Shadow, "shadow", shadowPsoDesc);
 
-	mMainPassCB.Lights[3].Position = { -22.0f, 28.0f, 22.0f };
-	mMainPassCB.Lights[3].Strength = { 1.0f, 0.0f, 0.0f };
-	mMainPassCB.Lights[3].FalloffStart = 20.0f;
-	mMainPassCB.Lights[3].FalloffEnd = 35.0f;
-	
-	mMainPassCB.Lights[4].Position = { 22.0f, 28.0f, 22.0f };
-	mMainPassCB.Lights[4].Strength = { 0.0f, 0.75f, 1.0f };
-	mMainPassCB.Lights[4].FalloffStart = 20.0f;
-	mMainPassCB.Lights[4].FalloffEnd = 35.0f;
-	
-	mMainPassCB.Lights[5].Position = { -22.0f, 28.0f, -22.0f };
-	mMainPassCB.Lights[5].Strength = { 0.0f, 0.8f, 0.0f };
-	mMainPassCB.Lights[5].FalloffStart = 20.0f;
-	mMainPassCB.Lights[5].FalloffEnd = 35.0f;
-	
-	mMainPassCB.Lights[6].Position = { 22.0f, 28.0f, -22.0f };
-	mMainPassCB.Lights[6].Strength = { 0.4f, 0.0f, 1.0f };
-	mMainPassCB.Lights[6].FalloffStart = 20.0f;
-	mMainPassCB.Lights[6].FalloffEnd = 35.0f;
+
+
+	/*----------- TRANSLUCENT OBJECTS -----------*/
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC transparentPsoDesc = opaquePsoDesc;
+
+	D3D12_RENDER_TARGET_BLEND_DESC transparencyBlendDesc;
+	transparencyBlendDesc.BlendEnable = true;
+	transparencyBlendDesc.LogicOpEnable = false;
+	transparencyBlendDesc.SrcBlend = D3D12_BLEND_SRC_ALPHA;
+	transparencyBlendDesc.DestBlend = D3D12_BLEND_INV_SRC_ALPHA;
+	transparencyBlendDesc.BlendOp = D3D12_BLEND_OP_ADD;
+	transparencyBlendDesc.SrcBlendAlpha = D3D12_BLEND_ONE;
+	transparencyBlendDesc.DestBlendAlpha = D3D12_BLEND_ZERO;
+	transparencyBlendDesc.BlendOpAlpha = D3D12_BLEND_OP_ADD;
+	transparencyBlendDesc.LogicOp = D3D12_LOGIC_OP_NOOP;
+	transparencyBlendDesc.RenderTargetWriteMask = D3D12_COLOR_WRITE_ENABLE_ALL;
+
+	transparentPsoDesc.BlendState.RenderTarget[0] = transparencyBlendDesc;
+	SetPipeline(PipelineId::Transparent, "transparent", transparentPsoDesc);
+
+	/*----------- WEIGHTED BLENDED TRANSPARENCY -----------*/
+
+	// Into the two OIT targets instead of over the scene: the weighted colours add up
+	// and the revealage is multiplied by 1 - alpha.  Depth tested but not written, so
+	// a surface behind another transparent one still counts.
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC oitPsoDesc = transparentPsoDesc;
+	oitPsoDesc.PS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["oitPS"]->GetBufferPointer()),
+		mShaders["oitPS"]->GetBufferSize()
+	};
+
+	D3D12_RENDER_TARGET_BLEND_DESC accumulationBlendDesc = transparencyBlendDesc;
+	accumulationBlendDesc.SrcBlend = D3D12_BLEND_ONE;
+	accumulationBlendDesc.DestBlend = D3D12_BLEND_ONE;
+	accumulationBlendDesc.SrcBlendAlpha = D3D12_BLEND_ONE;
+	accumulationBlendDesc.DestBlendAlpha = D3D12_BLEND_ONE;
+
+	D3D12_RENDER_TARGET_BLEND_DESC revealageBlendDesc = transparencyBlendDesc;
+	revealageBlendDesc.SrcBlend = D3D12_BLEND_ZERO;
+	revealageBlendDesc.DestBlend = D3D12_BLEND_INV_SRC_COLOR;
+	revealageBlendDesc.SrcBlendAlpha = D3D12_BLEND_ZERO;
+	revealageBlendDesc.DestBlendAlpha = D3D12_BLEND_INV_SRC_ALPHA;
+	revealageBlendDesc.RenderTargetWriteMask = D3D12_COLOR_WRITE_ENABLE_RED;
+
+	oitPsoDesc.BlendState.IndependentBlendEnable = true;
+	oitPsoDesc.BlendState.RenderTarget[0] = accumulationBlendDesc;
+	oitPsoDesc.BlendState.RenderTarget[1] = revealageBlendDesc;
+	oitPsoDesc.DepthStencilState.DepthWriteMask = D3D12_DEPTH_WRITE_MASK_ZERO;
+	oitPsoDesc.NumRenderTargets = 2;
+	oitPsoDesc.RTVFormats[0] = gOitAccumulationFormat;
+	oitPsoDesc.RTVFormats[1] = gOitRevealageFormat;
+	SetPipeline(PipelineId::TransparentOit, "transparentOit", oitPsoDesc);
+
+	// One triangle over the view, blended onto the scene target like the sorted layer.
+	ID3DBlob* oitCompositePS = mShaders[m4xMsaaState ? "oitCompositeMsaaPS" : "oitCompositePS"].Get();
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC oitCompositePsoDesc = transparentPsoDesc;
+	oitCompositePsoDesc.InputLayout = { nullptr, 0 };
+	oitCompositePsoDesc.pRootSignature = mOitRootSignature.Get();
+	oitCompositePsoDesc.VS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["oitCompositeVS"]->GetBufferPointer()),
+		mShaders["oitCompositeVS"]->GetBufferSize()
+	};
+	oitCompositePsoDesc.PS =
+	{
+		reinterpret_cast<BYTE*>(oitCompositePS->GetBufferPointer()),
+		oitCompositePS->GetBufferSize()
+	};
+	oitCompositePsoDesc.RasterizerState.CullMode = D3D12_CULL_MODE_NONE;
+	oitCompositePsoDesc.DepthStencilState.DepthEnable = false;
+	oitCompositePsoDesc.DepthStencilState.DepthWriteMask = D3D12_DEPTH_WRITE_MASK_ZERO;
+	oitCompositePsoDesc.DSVFormat = DXGI_FORMAT_UNKNOWN;
+	SetPipeline(PipelineId::OitComposite, "oitComposite", oitCompositePsoDesc);
+
+	/*----------- TREE BILLBOARD OBJECTS -----------*/
 	
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC treePsoDesc = transparentPsoDesc;
+
+	// The vertex shader builds the quads from the visible tree list, so there is no input layout.
+	treePsoDesc.InputLayout = { nullptr, 0 };
+	treePsoDesc.pRootSignature = mRootSignature.Get();
+	treePsoDesc.VS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["treeSpriteVS"]->GetBufferPointer()),
+		mShaders["treeSpriteVS"]->GetBufferSize()
+	};
+
+	treePsoDesc.PS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["treeSpritePS"]->GetBufferPointer()),
+		mShaders["treeSpritePS"]->GetBufferSize()
+	};
+	treePsoDesc.RasterizerState = CD3DX12_RASTERIZER_DESC(D3D12_DEFAULT);
+	treePsoDesc.BlendState = CD3DX12_BLEND_DESC(D3D12_DEFAULT);
+	treePsoDesc.DepthStencilState = CD3DX12_DEPTH_STENCIL_DESC(D3D12_DEFAULT);
+	if (mReverseZ)
+		treePsoDesc.DepthStencilState.DepthFunc = D3D12_COMPARISON_FUNC_GREATER;
+	treePsoDesc.SampleMask = UINT_MAX;
+	treePsoDesc.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
+	treePsoDesc.NumRenderTargets = 1;
+	treePsoDesc.RTVFormats[0] = mBackBufferFormat;
+	treePsoDesc.SampleDesc.Count = mPsoSampleCount;
+	treePsoDesc.SampleDesc.Quality = m4xMsaaState ? (m4xMsaaQuality - 1) : 0;
+	treePsoDesc.DSVFormat = mDepthStencilFormat;
+	SetPipeline(PipelineId::Tree, "tree", treePsoDesc);
+
+	/*----------- IMPOSTORS -----------*/
+
+	// Drawn with the trees, and like them from a list rather than vertices.
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC impostorPsoDesc = treePsoDesc;
+	impostorPsoDesc.VS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["impostorVS"]->GetBufferPointer()),
+		mShaders["impostorVS"]->GetBufferSize()
+	};
+	impostorPsoDesc.PS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["impostorPS"]->GetBufferPointer()),
+		mShaders["impostorPS"]->GetBufferSize()
+	};
+	SetPipeline(PipelineId::Impostor, "impostor", impostorPsoDesc);
+
+	// Every frame of a cluster at once into the single-sampled atlas, with a depth
+	// buffer of its own that isn't reversed.
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC impostorBakePsoDesc = opaquePsoDesc;
+	impostorBakePsoDesc.VS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["impostorBakeVS"]->GetBufferPointer()),
+		mShaders["impostorBakeVS"]->GetBufferSize()
+	};
+	impostorBakePsoDesc.PS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["impostorBakePS"]->GetBufferPointer()),
+		mShaders["impostorBakePS"]->GetBufferSize()
+	};
+	impostorBakePsoDesc.DepthStencilState = CD3DX12_DEPTH_STENCIL_DESC(D3D12_DEFAULT);
+	impostorBakePsoDesc.NumRenderTargets = 2;
+	impostorBakePsoDesc.RTVFormats[0] = DXGI_FORMAT_R8G8B8A8_UNORM;
+	impostorBakePsoDesc.RTVFormats[1] = DXGI_FORMAT_R8G8B8A8_UNORM;
+	impostorBakePsoDesc.SampleDesc.Count = 1;
+	impostorBakePsoDesc.SampleDesc.Quality = 0;
+	impostorBakePsoDesc.DSVFormat = DXGI_FORMAT_D32_FLOAT;
+	SetPipeline(PipelineId::ImpostorBake, "impostorBake", impostorBakePsoDesc);
+
+	/*----------- FRUSTUM CULLING -----------*/
+
+	D3D12_COMPUTE_PIPELINE_STATE_DESC cullPsoDesc = {};
+	cullPsoDesc.pRootSignature = mCullRootSignature.Get();
+	cullPsoDesc.CS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["cullCS"]->GetBufferPointer()),
+		mShaders["cullCS"]->GetBufferSize()
+	};
+	cullPsoDesc.Flags = D3D12_PIPELINE_STATE_FLAG_NONE;
+	SetPipeline(PipelineId::Cull, "cull", cullPsoDesc);
+
+	D3D12_COMPUTE_PIPELINE_STATE_DESC treeCullPsoDesc = {};
+	treeCullPsoDesc.pRootSignature = mTreeCullRootSignature.Get();
+	treeCullPsoDesc.CS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["treeCullCS"]->GetBufferPointer()),
+		mShaders["treeCullCS"]->GetBufferSize()
+	};
+	treeCullPsoDesc.Flags = D3D12_PIPELINE_STATE_FLAG_NONE;
+	SetPipeline(PipelineId::TreeCull, "treeCull", treeCullPsoDesc);
+
+	D3D12_COMPUTE_PIPELINE_STATE_DESC hiZPsoDesc = {};
+	hiZPsoDesc.pRootSignature = mHiZRootSignature.Get();
+	hiZPsoDesc.CS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["hizCS"]->GetBufferPointer()),
+		mShaders["hizCS"]->GetBufferSize()
+	};
+	hiZPsoDesc.Flags = D3D12_PIPELINE_STATE_FLAG_NONE;
+	SetPipeline(PipelineId::HiZ, "hiz", hiZPsoDesc);
+
+	D3D12_COMPUTE_PIPELINE_STATE_DESC shadingRatePsoDesc = {};
+	shadingRatePsoDesc.pRootSignature = mShadingRateRootSignature.Get();
+	shadingRatePsoDesc.CS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["shadingRateCS"]->GetBufferPointer()),
+		mShaders["shadingRateCS"]->GetBufferSize()
+	};
+	shadingRatePsoDesc.Flags = D3D12_PIPELINE_STATE_FLAG_NONE;
+	SetPipeline(PipelineId::ShadingRate, "shadingRate", shadingRatePsoDesc);
+
+	D3D12_COMPUTE_PIPELINE_STATE_DESC visibilityResolvePsoDesc = {};
+	visibilityResolvePsoDesc.pRootSignature = mVisibilityRootSignature.Get();
+	visibilityResolvePsoDesc.CS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["visibilityResolveCS"]->GetBufferPointer()),
+		mShaders["visibilityResolveCS"]->GetBufferSize()
+	};
+	visibilityResolvePsoDesc.Flags = D3D12_PIPELINE_STATE_FLAG_NONE;
+	SetPipeline(PipelineId::VisibilityResolve, "visibilityResolve", visibilityResolvePsoDesc);
+
+	D3D12_COMPUTE_PIPELINE_STATE_DESC mipsPsoDesc = {};
+	mipsPsoDesc.pRootSignature = mMipRootSignature.Get();
+	mipsPsoDesc.CS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["mipsCS"]->GetBufferPointer()),
+		mShaders["mipsCS"]->GetBufferSize()
+	};
+	mipsPsoDesc.Flags = D3D12_PIPELINE_STATE_FLAG_NONE;
+	SetPipeline(PipelineId::GenerateMips, "generateMips", mipsPsoDesc);
+
+	/*----------- LIGHT CLUSTERING -----------*/
+
+	D3D12_COMPUTE_PIPELINE_STATE_DESC clusterPsoDesc = {};
+	clusterPsoDesc.pRootSignature = mClusterRootSignature.Get();
+	clusterPsoDesc.CS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["clusterCS"]->GetBufferPointer()),
+		mShaders["clusterCS"]->GetBufferSize()
+	};
+	clusterPsoDesc.Flags = D3D12_PIPELINE_STATE_FLAG_NONE;
+	SetPipeline(PipelineId::Cluster, "cluster", clusterPsoDesc);
 
-	//Torch
+	/*----------- WAVE SOLVER -----------*/
 
-	mMainPassCB.Lights[7].Position = mCamera.GetPosition3f();
-	mMainPassCB.Lights[7].Strength = { 0.7f, 0.45f, 0.0f };
-	mMainPassCB.Lights[7].FalloffStart = 25.0f;
-	mMainPassCB.Lights[7].FalloffEnd = 50.0f;
+	D3D12_COMPUTE_PIPELINE_STATE_DESC wavesPsoDesc = {};
+	wavesPsoDesc.pRootSignature = mWaveRootSignature.Get();
+	wavesPsoDesc.CS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["wavesCS"]->GetBufferPointer()),
+		mShaders["wavesCS"]->GetBufferSize()
+	};
+	wavesPsoDesc.Flags = D3D12_PIPELINE_STATE_FLAG_NONE;
+	SetPipeline(PipelineId::Waves, "waves", wavesPsoDesc);
+
+	/*----------- FXAA -----------*/
+
+	// Loaded with the rest of mShaderRequests whether or not FXAA is picked.
+	assert(mShaders["fxaaCS"] != nullptr);
+	D3D12_COMPUTE_PIPELINE_STATE_DESC fxaaPsoDesc = {};
+	fxaaPsoDesc.pRootSignature = mFxaaRootSignature.Get();
+	fxaaPsoDesc.CS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["fxaaCS"]->GetBufferPointer()),
+		mShaders["fxaaCS"]->GetBufferSize()
+	};
+	fxaaPsoDesc.Flags = D3D12_PIPELINE_STATE_FLAG_NONE;
+	SetPipeline(PipelineId::Fxaa, "fxaa", fxaaPsoDesc);
+
+	/*----------- PROFILER OVERLAY -----------*/
+
+	// Screen-space bars expanded from SV_VertexID; no input layout and no depth test.
+	// Drawn into the back buffer after the resolve, so always single-sampled.
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC overlayPsoDesc = transparentPsoDesc;
+	overlayPsoDesc.InputLayout = { nullptr, 0 };
+	overlayPsoDesc.pRootSignature = mOverlayRootSignature.Get();
+	overlayPsoDesc.VS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["overlayVS"]->GetBufferPointer()),
+		mShaders["overlayVS"]->GetBufferSize()
+	};
+	overlayPsoDesc.PS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["overlayPS"]->GetBufferPointer()),
+		mShaders["overlayPS"]->GetBufferSize()
+	};
+	overlayPsoDesc.RasterizerState.CullMode = D3D12_CULL_MODE_NONE;
+	overlayPsoDesc.DepthStencilState.DepthEnable = false;
+	overlayPsoDesc.DepthStencilState.DepthWriteMask = D3D12_DEPTH_WRITE_MASK_ZERO;
+	overlayPsoDesc.DSVFormat = DXGI_FORMAT_UNKNOWN;
+	overlayPsoDesc.SampleDesc.Count = 1;
+	overlayPsoDesc.SampleDesc.Quality = 0;
+	SetPipeline(PipelineId::Overlay, "overlay", overlayPsoDesc);
+
+	/*----------- UPSCALE -----------*/
+
+	// One screen-covering triangle into the back buffer, opaque.  Loaded even while
+	// the resolution stays at 100%, since the scale can change at run time.
+	assert(mShaders["upscaleVS"] != nullptr && mShaders["upscalePS"] != nullptr);
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC upscalePsoDesc = overlayPsoDesc;
+	upscalePsoDesc.pRootSignature = mUpscaleRootSignature.Get();
+	upscalePsoDesc.VS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["upscaleVS"]->GetBufferPointer()),
+		mShaders["upscaleVS"]->GetBufferSize()
+	};
+	upscalePsoDesc.PS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["upscalePS"]->GetBufferPointer()),
+		mShaders["upscalePS"]->GetBufferSize()
+	};
+	upscalePsoDesc.BlendState = CD3DX12_BLEND_DESC(D3D12_DEFAULT);
+	SetPipeline(PipelineId::Upscale, "upscale", upscalePsoDesc);
 
-	auto currPassCB = mCurrFrameResource->PassCB.get();
-	currPassCB->CopyData(0, mMainPassCB);
 }
 
-float Sign(const float value)
+void ShapesApp::SetPipeline(PipelineId id, const std::string& name, const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc)
 {
-	return (value < 0.0f) ? -1.0f : 1.0f;
+	if (!mReloadingPipelines)
+		mPipelineHandles[(int)id] = mPipelines->CreateGraphics(name, desc);
+	else if (UsesReloadedShader(desc.VS) || UsesReloadedShader(desc.PS) || UsesReloadedShader(desc.GS) ||
+		UsesReloadedShader(desc.HS) || UsesReloadedShader(desc.DS))
+		mPendingPipelines.push_back({ id, mPipelines->CreateGraphics(name, desc) });
+}
+
+void ShapesApp::SetPipeline(PipelineId id, const std::string& name, const D3D12_COMPUTE_PIPELINE_STATE_DESC& desc)
+{
+	if (!mReloadingPipelines)
+		mPipelineHandles[(int)id] = mPipelines->CreateCompute(name, desc);
+	else if (UsesReloadedShader(desc.CS))
+		mPendingPipelines.push_back({ id, mPipelines->CreateCompute(name, desc) });
+}
+
+bool ShapesApp::UsesReloadedShader(const D3D12_SHADER_BYTECODE& shader)const
+{
+	return shader.pShaderBytecode != nullptr && mReloadedByteCode.count(shader.pShaderBytecode) != 0;
 }
 
-void ShapesApp::Collision()
+ID3D12PipelineState* ShapesApp::GetPipeline(PipelineId id)
 {
-	for (int i = 0; i < mAllRitems.size(); i++)
+	return mPipelines->Get(mPipelineHandles[(int)id]);
+}
+
+void ShapesApp::StartHotReload()
+{
+	// Without a directory to watch there is simply nothing to reload.
+	if (!mShaderWatcher.Start(gShaderSourceDirectory))
+		OutputDebugString((std::wstring(L"Hot reload: cannot watch ") + gShaderSourceDirectory + L"\n").c_str());
+	if (!mSceneWatcher.Start(gSceneDirectory))
+		OutputDebugString((std::wstring(L"Hot reload: cannot watch ") + gSceneDirectory + L"\n").c_str());
+}
+
+// Runs after WaitForFrame, so nothing recorded for this frame has used the pipelines
+// yet.  The frames still on the GPU keep the old ones, which the cache never releases.
+void ShapesApp::UpdateHotReload()
+{
+	std::vector<std::wstring> files;
+	mShaderWatcher.TakeChanges(files);
+	for (const std::wstring& file : files)
+	{
+		// Whatever includes a changed file is found by the keys; the compiled bytecode
+		// under Shaders\Compiled shows up here too and is ignored.
+		size_t dot = file.find_last_of(L'.');
+		std::wstring extension = dot == std::wstring::npos ? std::wstring() : file.substr(dot);
+		if (file.empty() || _wcsicmp(extension.c_str(), L".hlsl") == 0 || _wcsicmp(extension.c_str(), L".hlsli") == 0)
+			mShaderReloadQueued = true;
+	}
+
+	files.clear();
+	mSceneWatcher.TakeChanges(files);
+	for (const std::wstring& file : files)
 	{
-		if (mAllRitems[i]->name == "box")
+		if (file.empty() || _wcsicmp((std::wstring(gSceneDirectory) + L"\\" + file).c_str(), gSceneFile) == 0)
 		{
+			ReloadScene();
+			break;
+		}
+	}
 
-			float distX = mAllRitems[i]->box.Center.x - player.Center.x;
-			float distZ = mAllRitems[i]->box.Center.z - player.Center.z;
+	if (mShaderReload != nullptr && mShaderReload->Done)
+	{
+		FinishShaderReload();
+		mShaderReload = nullptr;
+	}
 
-			float sumX = player.Extents.x + mAllRitems[i]->box.Extents.x;
-			float sumZ = player.Extents.z + mAllRitems[i]->box.Extents.z;
+	// One recompile at a time.  Edits made meanwhile start the next one.
+	if (mShaderReloadQueued && mShaderReload == nullptr && mPendingPipelines.empty())
+		StartShaderReload();
 
-			float overX = sumX - abs(distX);
-			float overZ = sumZ - abs(distZ);
+	if (!mPendingPipelines.empty())
+		SwapReloadedPipelines();
+}
 
-			if (overX < 0 || overZ < 0)
-			{
-				continue;
-			}
+void ShapesApp::StartShaderReload()
+{
+	mShaderReloadQueued = false;
 
-			XMFLOAT2 contact_normal;
-			XMFLOAT3 min_trans;
+	auto reload = std::make_shared<ShaderReload>();
+	reload->Requests = mShaderRequests;
+	mShaderReload = reload;
 
-			if (overX < overZ)
-			{
-				contact_normal = XMFLOAT2(Sign(distX), 0.0f);
-				min_trans = XMFLOAT3(contact_normal.x * overX, 0.0f, 0.0f);
-			}
-			else
+	ShaderLibrary* library = mShaderLibrary.get();
+	mTaskPool->Submit([reload, library]()
+	{
+		try
+		{
+			library->ForgetSources();
+			for (size_t i = 0; i < reload->Requests.size(); ++i)
 			{
-				contact_normal = XMFLOAT2(0.0f, Sign(distZ));
-				min_trans = XMFLOAT3(0.0f, 0.0f, contact_normal.y * overZ);
-			}
+				ShaderRequest& request = reload->Requests[i];
+				std::uint64_t key = library->Key(request.Program, request.Options);
+				if (key == request.Key)
+					continue;
 
-			mCamera.SetPosition(mCamera.GetPosition3f().x - min_trans.x, mCamera.GetPosition3f().y - min_trans.y, mCamera.GetPosition3f().z - min_trans.z);
+				request.Key = key;
+				reload->Blobs.push_back({ i, library->Get(request.Program, request.Options) });
+			}
 		}
-	}
+		catch (DxException& e)
+		{
+			// d3dUtil::CompileShader has already printed the compiler's errors.
+			OutputDebugString((L"Shader reload: " + e.ToString() + L"\n").c_str());
+			reload->Failed = true;
+		}
+		reload->Done = true;
+	});
 }
 
-
-void ShapesApp::LoadTextures()
+void ShapesApp::FinishShaderReload()
 {
-	auto grassTex = std::make_unique<Texture>();
-	grassTex->Name = "grassTex";
-	grassTex->Filename = L"../../Textures/grass.dds";
-	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-		mCommandList.Get(), grassTex->Filename.c_str(),
-		grassTex->Resource, grassTex->UploadHeap));
+	// A failed compile keeps every old key, so the next edit tries all of them again.
+	if (mShaderReload->Failed || mShaderReload->Blobs.empty())
+		return;
 
-	auto waterTex = std::make_unique<Texture>();
-	waterTex->Name = "waterTex";
-	waterTex->Filename = L"../../Textures/water1.dds";
-	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-		mCommandList.Get(), waterTex->Filename.c_str(),
-		waterTex->Resource, waterTex->UploadHeap));
+	mReloadedByteCode.clear();
+	for (auto& blob : mShaderReload->Blobs)
+	{
+		ShaderRequest& request = mShaderRequests[blob.first];
+		request.Key = mShaderReload->Requests[blob.first].Key;
 
-	auto fenceTex = std::make_unique<Texture>();
-	fenceTex->Name = "fenceTex";
-	fenceTex->Filename = L"../../Textures/bricks.dds";
-	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-		mCommandList.Get(), fenceTex->Filename.c_str(),
-		fenceTex->Resource, fenceTex->UploadHeap));
+		mRetiredShaders.push_back(std::move(mShaders[request.Name]));
+		mShaders[request.Name] = blob.second;
+		mReloadedByteCode.insert(blob.second->GetBufferPointer());
+	}
 
-	auto woodTex = std::make_unique<Texture>();
-	woodTex->Name = "woodTex";
-	woodTex->Filename = L"../../Textures/wood.dds";
-	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-		mCommandList.Get(), woodTex->Filename.c_str(),
-		woodTex->Resource, woodTex->UploadHeap));
-	
-	auto iceTex = std::make_unique<Texture>();
-	iceTex->Name = "iceTex";
-	iceTex->Filename = L"../../Textures/ice.dds";
-	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-		mCommandList.Get(), iceTex->Filename.c_str(),
-		iceTex->Resource, iceTex->UploadHeap));
+	mReloadingPipelines = true;
+	BuildPSOs();
+	mReloadingPipelines = false;
 
-	auto metalTex = std::make_unique<Texture>();
-	metalTex->Name = "metalTex";
-	metalTex->Filename = L"../../Textures/metal.dds";
-	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-		mCommandList.Get(), metalTex->Filename.c_str(),
-		metalTex->Resource, metalTex->UploadHeap));
+	OutputDebugString((L"Shader reload: " + std::to_wstring(mShaderReload->Blobs.size()) + L" permutations, " +
+		std::to_wstring(mPendingPipelines.size()) + L" pipelines\n").c_str());
+}
 
-	auto treeArrayTex = std::make_unique<Texture>();
-	treeArrayTex->Name = "treeArrayTex";
-	treeArrayTex->Filename = L"../../Textures/treeArray2.dds";
-	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-		mCommandList.Get(), treeArrayTex->Filename.c_str(),
-		treeArrayTex->Resource, treeArrayTex->UploadHeap));
+void ShapesApp::SwapReloadedPipelines()
+{
+	for (auto& pending : mPendingPipelines)
+	{
+		if (!mPipelines->Ready(pending.second))
+			return;
+	}
+
+	// A pipeline that failed to create leaves the old one in place.
+	for (auto& pending : mPendingPipelines)
+	{
+		try
+		{
+			mPipelines->Get(pending.second);
+			mPipelineHandles[(int)pending.first] = pending.second;
+		}
+		catch (DxException& e)
+		{
+			OutputDebugString((L"Shader reload: " + e.ToString() + L"\n").c_str());
+		}
+	}
+	mPendingPipelines.clear();
 
-	mTextures[grassTex->Name] = std::move(grassTex);
-	mTextures[waterTex->Name] = std::move(waterTex);
-	mTextures[fenceTex->Name] = std::move(fenceTex);
-	mTextures[woodTex->Name] = std::move(woodTex);
-	mTextures[iceTex->Name] = std::move(iceTex);
-	mTextures[metalTex->Name] = std::move(metalTex);
-	mTextures[treeArrayTex->Name] = std::move(treeArrayTex);
+	// The bundles bake in the pipelines they were recorded with.
+	++mBundleGeneration;
 }
 
-void ShapesApp::BuildRootSignature()
+// The records are plain data, zero filled past the end of their names.
+template<typename T>
+static bool SameRecords(const std::vector<T>& records, SceneSpan<T> span)
 {
-	CD3DX12_DESCRIPTOR_RANGE texTable;
-	texTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 0);
+	return records.size() == span.Count &&
+		(span.Count == 0 || std::memcmp(records.data(), span.Data, span.Count * sizeof(T)) == 0);
+}
 
-	// Root parameter can be a table, root descriptor or root constants.
-	CD3DX12_ROOT_PARAMETER slotRootParameter[6];
+// Only what has a place to go without rebuilding the world is reloaded: the materials'
+// constants, the lights, the ambient and the fog.  Everything else takes a restart.
+void ShapesApp::ReloadScene()
+{
+	std::ifstream fin(gSceneFile, std::ios::binary);
+	if (!fin)
+		return;
+	std::string text((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+
+	SceneDescription scene;
+	std::string error;
+	if (!ParseScene(text, scene, error))
+	{
+		OutputDebugString((std::wstring(gSceneFile) + L", " + AnsiToWString(error) + L"\n").c_str());
+		return;
+	}
 
-	// Perfomance TIP: Order from most frequent to least frequent.
-	slotRootParameter[0].InitAsDescriptorTable(1, &texTable, D3D12_SHADER_VISIBILITY_PIXEL);
-	slotRootParameter[1].InitAsConstantBufferView(0);
-	slotRootParameter[2].InitAsConstantBufferView(1);
-	slotRootParameter[3].InitAsConstantBufferView(2);
-	slotRootParameter[4].InitAsConstantBufferView(3);
-	slotRootParameter[5].InitAsConstantBufferView(4);
+	bool restart = !SameRecords(scene.Textures, mScene.Textures()) || !SameRecords(scene.Nodes, mScene.Nodes()) ||
+		!SameRecords(scene.Objects, mScene.Objects()) || !SameRecords(scene.Sprites, mScene.Sprites()) ||
+		scene.Materials.size() != mScene.Materials().Count ||
+		std::strcmp(scene.Environment.SpriteMaterial, mEnvironment.SpriteMaterial) != 0;
 
-	auto staticSamplers = GetStaticSamplers();
+	// Materials keep their constant buffer slot.
+	for (const SceneMaterial& sceneMat : scene.Materials)
+	{
+		auto it = mMaterials.find(sceneMat.Name);
+		if (it == mMaterials.end() || std::strcmp(sceneMat.Texture, mScene.Materials()[(UINT)it->second->MatCBIndex].Texture) != 0)
+		{
+			restart = true;
+			continue;
+		}
 
-	// A root signature is an array of root parameters.
-	CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(5, slotRootParameter,
-		(UINT)staticSamplers.size(), staticSamplers.data(),
-		D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT);
+		Material* mat = it->second.get();
+		mat->DiffuseAlbedo = sceneMat.DiffuseAlbedo;
+		mat->FresnelR0 = sceneMat.FresnelR0;
+		mat->Roughness = sceneMat.Roughness;
+		mMaterialDirty.Mark(mat->MatCBIndex);
+	}
 
-	// create a root signature with a single slot which points to a descriptor range consisting of a single constant buffer
-	ComPtr<ID3DBlob> serializedRootSig = nullptr;
-	ComPtr<ID3DBlob> errorBlob = nullptr;
-	HRESULT hr = D3D12SerializeRootSignature(&rootSigDesc, D3D_ROOT_SIGNATURE_VERSION_1,
-		serializedRootSig.GetAddressOf(), errorBlob.GetAddressOf());
+	mLights = scene.Lights;
+	mEnvironment.AmbientLight = scene.Environment.AmbientLight;
+	mEnvironment.FogColor = scene.Environment.FogColor;
+	mEnvironment.FogStart = scene.Environment.FogStart;
+	mEnvironment.FogRange = scene.Environment.FogRange;
+	mSceneCBDirty = true;
 
-	if (errorBlob != nullptr)
+	OutputDebugString(restart ?
+		L"Scene reload: materials and lighting updated, the rest needs a restart\n" :
+		L"Scene reload: materials and lighting updated\n");
+}
+
+void ShapesApp::BuildFrameResources()
+{
+	mUploadRing = std::make_unique<UploadRingBuffer>(md3dDevice.Get(), gUploadRingByteSize);
+
+	// Sized by BuildRenderItems for the most tiles the world partition keeps loaded.
+	for (int i = 0; i < gNumFrameResources; ++i)
 	{
-		::OutputDebugStringA((char*)errorBlob->GetBufferPointer());
+		mFrameResources.push_back(std::make_unique<FrameResource>(md3dDevice.Get(),
+			mTransforms.Capacity(), mInstanceCapacity, mBatchCapacity, mMeshletDrawCapacity, mMeshletInstanceCapacity, (UINT)mMaterials.size(), gNumWorkerCmdLists,
+			gClusterCount * (gMaxLightsPerCluster + 1), mTreeCapacity, gMaxViews));
+
+		// Default buffers decay back to COMMON after every frame.
+		for (const FrameResource::ViewBuffers& view : mFrameResources.back()->Views)
+		{
+			mResourceStates.Track(view.VisibleInstances.Get(), D3D12_RESOURCE_STATE_COMMON, true);
+			mResourceStates.Track(view.DrawArgs.Get(), D3D12_RESOURCE_STATE_COMMON, true);
+			mResourceStates.Track(view.ClusterLights.Get(), D3D12_RESOURCE_STATE_COMMON, true);
+			mResourceStates.Track(view.VisibleTrees.Get(), D3D12_RESOURCE_STATE_COMMON, true);
+			mResourceStates.Track(view.TreeDrawArgs.Get(), D3D12_RESOURCE_STATE_COMMON, true);
+		}
 	}
-	ThrowIfFailed(hr);
 
-	ThrowIfFailed(md3dDevice->CreateRootSignature(
-		0,
-		serializedRootSig->GetBufferPointer(),
-		serializedRootSig->GetBufferSize(),
-		IID_PPV_ARGS(mRootSignature.GetAddressOf())));
+	// Shared by the frames in flight: the queue runs them in order, and each frame's
+	// pre-pass reads what the frame before it wrote.  Committed buffers start zeroed,
+	// so the first pre-pass draws nothing.
+	ThrowIfFailed(md3dDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+		D3D12_HEAP_FLAG_NONE,
+		&CD3DX12_RESOURCE_DESC::Buffer(MathHelper::Max(mInstanceCapacity, 1u) * sizeof(UINT), D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS),
+		D3D12_RESOURCE_STATE_COMMON,
+		nullptr,
+		IID_PPV_ARGS(mVisibleLastFrame.GetAddressOf())));
+	mResourceStates.Track(mVisibleLastFrame.Get(), D3D12_RESOURCE_STATE_COMMON, true);
+
+	ThrowIfFailed(md3dDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+		D3D12_HEAP_FLAG_NONE,
+		&CD3DX12_RESOURCE_DESC::Buffer(d3dUtil::CalcConstantBufferByteSize(sizeof(SceneConstants))),
+		D3D12_RESOURCE_STATE_COMMON,
+		nullptr,
+		IID_PPV_ARGS(mSceneCBBuffer.GetAddressOf())));
+	mResourceStates.Track(mSceneCBBuffer.Get(), D3D12_RESOURCE_STATE_COMMON, true);
 }
 
-void ShapesApp::BuildDescriptorHeaps()
+// The compute queue, its list and fence, and the wave solver's height buffers.  Every
+// frame's direct work waits for its compute work, so flushing the direct queue
+// flushes both.
+void ShapesApp::BuildWaves()
 {
-	//
-	// Create the SRV heap.
-	//
-	D3D12_DESCRIPTOR_HEAP_DESC srvHeapDesc = {};
-	srvHeapDesc.NumDescriptors = 7; //
-	srvHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
-	srvHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
-	ThrowIfFailed(md3dDevice->CreateDescriptorHeap(&srvHeapDesc, IID_PPV_ARGS(&mSrvDescriptorHeap)));
+	D3D12_COMMAND_QUEUE_DESC queueDesc = {};
+	queueDesc.Type = D3D12_COMMAND_LIST_TYPE_COMPUTE;
+	queueDesc.Flags = D3D12_COMMAND_QUEUE_FLAG_NONE;
+	ThrowIfFailed(md3dDevice->CreateCommandQueue(&queueDesc, IID_PPV_ARGS(mComputeQueue.GetAddressOf())));
 
-	//
-	// Fill out the heap with actual descriptors.
-	//
-	CD3DX12_CPU_DESCRIPTOR_HANDLE hDescriptor(mSrvDescriptorHeap->GetCPUDescriptorHandleForHeapStart());
+	ThrowIfFailed(md3dDevice->CreateCommandList(
+		0,
+		D3D12_COMMAND_LIST_TYPE_COMPUTE,
+		mFrameResources[0]->ComputeCmdListAlloc.Get(),
+		nullptr,
+		IID_PPV_ARGS(mComputeCmdList.GetAddressOf())));
 
-	auto grassTex = mTextures["grassTex"]->Resource;
-	auto waterTex = mTextures["waterTex"]->Resource;
-	auto fenceTex = mTextures["fenceTex"]->Resource;
-	auto woodTex = mTextures["woodTex"]->Resource;
-	auto iceTex = mTextures["iceTex"]->Resource;
-	auto metalTex = mTextures["metalTex"]->Resource;
-	auto treeArrayTex = mTextures["treeArrayTex"]->Resource;
+	// Start off closed so the first frame can Reset it like every other frame.
+	mComputeCmdList->Close();
 
-	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
-	srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+	ThrowIfFailed(md3dDevice->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(mComputeFence.GetAddressOf())));
+
+	// One cell per grid spacing, so the wave speed is in the grid's own units.
+	mWaves = std::make_unique<GpuWaves>(md3dDevice.Get(), gWaveColumns, gWaveRows,
+		gWaveGridSize / (gWaveColumns - 1), gWaveTimeStep, gWaveSpeed, gWaveDamping);
 
-	srvDesc.Format = grassTex->GetDesc().Format;
-	srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
-	srvDesc.Texture2D.MostDetailedMip = 0;
-	srvDesc.Texture2D.MipLevels = -1;
-	md3dDevice->CreateShaderResourceView(grassTex.Get(), &srvDesc, hDescriptor);
+	// Buffers decay back to COMMON after every submission.
+	for (UINT i = 0; i < GpuWaves::BufferCount; ++i)
+		mComputeStates.Track(mWaves->Buffer(i), D3D12_RESOURCE_STATE_COMMON, true);
+}
 
-	// next descriptor
-	hDescriptor.Offset(1, mCbvSrvDescriptorSize);
+void ShapesApp::BuildMaterials()
+{
+	// Constant buffer indices follow the order of the scene file.
+	int matCBIndex = 0;
+	for (const SceneMaterial& sceneMat : mScene.Materials())
+	{
+		auto mat = std::make_unique<Material>();
+		mat->Name = sceneMat.Name;
+		mat->MatCBIndex = matCBIndex++;
+		UseTexture(mat.get(), sceneMat.Texture);
+		mat->DiffuseAlbedo = sceneMat.DiffuseAlbedo;
+		mat->FresnelR0 = sceneMat.FresnelR0;
+		mat->Roughness = sceneMat.Roughness;
+
+		mMaterials[sceneMat.Name] = std::move(mat);
+	}
 
-	srvDesc.Format = waterTex->GetDesc().Format;
-	md3dDevice->CreateShaderResourceView(waterTex.Get(), &srvDesc, hDescriptor);
+	// The water is displaced by the wave solver.
+	auto water = mMaterials.find("water");
+	mWaterMat = (water != mMaterials.end()) ? water->second.get() : nullptr;
+	if (mWaterMat != nullptr)
+		mWaterMat->Flags |= MaterialFlagWaves;
 
-	// next descriptor
-	hDescriptor.Offset(1, mCbvSrvDescriptorSize);
+	// Every material's constants start out unwritten.
+	mMaterialsByIndex.assign(mMaterials.size(), nullptr);
+	mMaterialDirty.Resize((std::uint32_t)mMaterials.size());
+	for (auto& e : mMaterials)
+	{
+		mMaterialsByIndex[e.second->MatCBIndex] = e.second.get();
+		mMaterialDirty.Mark(e.second->MatCBIndex);
+	}
+}
 
-	srvDesc.Format = fenceTex->GetDesc().Format;
-	md3dDevice->CreateShaderResourceView(fenceTex.Get(), &srvDesc, hDescriptor);
+//CREATED FUNCTION FOR RENDERING OBJECTS TO MAKE IT EASIER INTO THE ShapesApp::BuildWorldCell() function.
+// Runs on the world partition's worker, so it only reads the app and writes the cell.
+void ShapesApp::MakeThing(WorldCell& cell, std::uint32_t parentNode, const std::string& name, const std::string& material, RenderLayer type, XMFLOAT3 objectScale, XMFLOAT3 objectPos, XMFLOAT2 textureScale, XMFLOAT3 ObjectRotation)
+{
+	auto item = std::make_unique<RenderItem>();
 
-	//Wood descriptor
-	hDescriptor.Offset(1, mCbvSrvDescriptorSize);
+	item->name = name;
 
-	srvDesc.Format = woodTex->GetDesc().Format;
-	md3dDevice->CreateShaderResourceView(woodTex.Get(), &srvDesc, hDescriptor);
+	//Collision for maze, detected if the shape is a box and if the material is a "wirefence" (the brick material we made)
+	// The grid is static, so only walls sitting directly on the tile collide.
+	if (name == "box" && material == "wirefence" && parentNode == cell.RootNode)
+	{
+		BoundingBox wall;
+		wall.Center = XMFLOAT3(objectPos.x + cell.Offset.x, objectPos.y + cell.Offset.y, objectPos.z + cell.Offset.z);
+		wall.Extents = XMFLOAT3(objectScale.x * 0.5f, objectScale.y * 0.5f, objectScale.z * 0.5f);
+		cell.Walls.push_back(wall);
+	}
 	
-	//ice descriptor
-	hDescriptor.Offset(1, mCbvSrvDescriptorSize);
-
-	srvDesc.Format = iceTex->GetDesc().Format;
-	md3dDevice->CreateShaderResourceView(iceTex.Get(), &srvDesc, hDescriptor);
+	XMMATRIX local = XMMatrixScaling(objectScale.x, objectScale.y, objectScale.z) * XMMatrixRotationRollPitchYaw(ObjectRotation.x * (XM_PI / 180), ObjectRotation.y * (XM_PI / 180), ObjectRotation.z * (XM_PI / 180)) * XMMatrixTranslation(objectPos.x, objectPos.y, objectPos.z);
 
-	//metal descriptor
-	hDescriptor.Offset(1, mCbvSrvDescriptorSize);
+	WorldCell::Item cellItem;
+	XMFLOAT4X4 localF;
+	XMStoreFloat4x4(&localF, local);
+	XMStoreFloat4x4(&cellItem.TexTransform, XMMatrixScaling(textureScale.x, textureScale.y, 1.0f));
 
-	srvDesc.Format = metalTex->GetDesc().Format;
-	md3dDevice->CreateShaderResourceView(metalTex.Get(), &srvDesc, hDescriptor);
+	// The world matrix and bounds are filled in when the cell's graph is updated,
+	// and the transform slot when the cell is committed.
+	item->SceneNode = cell.Graph.AddNode(parentNode, localF);
+	cell.NodeItems.resize(cell.Graph.NodeCount(), nullptr);
+	cell.NodeItems[item->SceneNode] = item.get();
 
-	//tree descriptor
-	hDescriptor.Offset(1, mCbvSrvDescriptorSize);
-	auto desc = treeArrayTex->GetDesc();
-	srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2DARRAY;
-	srvDesc.Format = treeArrayTex->GetDesc().Format;
-	srvDesc.Texture2DArray.MostDetailedMip = 0;
-	srvDesc.Texture2DArray.MipLevels = -1;
-	srvDesc.Texture2DArray.FirstArraySlice = 0;
-	srvDesc.Texture2DArray.ArraySize = treeArrayTex->GetDesc().DepthOrArraySize;
-	md3dDevice->CreateShaderResourceView(treeArrayTex.Get(), &srvDesc, hDescriptor);
+	item->Mat = mMaterials.at(material).get();
+	item->Geo = mShapeGeo;
+	item->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
 
+	const SubmeshGeometry& submesh = item->Geo->DrawArgs.at(name);
+	item->LocalBounds = submesh.Bounds;
+	auto chain = mLodChains.find(name);
+	if (chain != mLodChains.end())
+		item->LodChain = &chain->second;
+	auto rayMesh = mRayMeshes.find(name);
+	if (rayMesh != mRayMeshes.end())
+		item->RayMesh = rayMesh->second.get();
+	item->IndexCount = submesh.IndexCount;
+	item->StartIndexLocation = submesh.StartIndexLocation;
+	item->BaseVertexLocation = submesh.BaseVertexLocation;
+	item->FirstMeshlet = submesh.FirstMeshlet;
+	item->MeshletCount = submesh.MeshletCount;
+
+	cellItem.Ritem = std::move(item);
+	cellItem.Layer = type;
+	cell.Items.push_back(std::move(cellItem));
 }
 
-void ShapesApp::BuildShadersAndInputLayout()
+
+void ShapesApp::BuildRenderItems()
 {
-	const D3D_SHADER_MACRO defines[] =
+	mTransforms.Clear();
+	mTransformOwners.clear();
+	mLodItems.clear();
+	mCells.clear();
+	mDynamicCasters.clear();
+	mCollisionGrid.Clear();
+	for (auto& layer : mRitemLayer)
+		layer.clear();
+
+	// -grid N M gives the world N tiles across and M deep, abutting the ground boxes.
+	// A tile always sits at the origin so the camera start and the benchmark path
+	// stay on the original layout.
+	const int columns = (int)mBenchmark.GridColumns;
+	const int rows = (int)mBenchmark.GridRows;
+
+	WorldPartition::Settings world;
+	world.CellWidth = 300.0f;
+	world.CellDepth = 230.0f;
+	world.MinX = -columns / 2;
+	world.MaxX = columns - 1 - columns / 2;
+	world.MinZ = -rows / 2;
+	world.MaxZ = rows - 1 - rows / 2;
+	if (gWorldStreaming)
 	{
-		//"NOFOG",
-			"FOG", 
-		"1", NULL, NULL
-	};
-
-	const D3D_SHADER_MACRO alphaTestDefines[] =
+		world.LoadRadius = gCellLoadRadius;
+		world.UnloadRadius = gCellUnloadRadius;
+		world.MaxCells = MathHelper::Min(gMaxWorldCells, (UINT)(columns * rows));
+		world.MaxLoadsInFlight = gMaxCellLoadsInFlight;
+		world.MaxCommitsPerUpdate = 1;
+	}
+	else
 	{
-		"ALPHA_TEST",
-		NULL, NULL
-	};
-
-	mShaders["standardVS"] = d3dUtil::CompileShader(L"Shaders\\Default.hlsl", nullptr, "VS", "vs_5_1");
-	mShaders["opaquePS"] = d3dUtil::CompileShader(L"Shaders\\Default.hlsl", defines, "PS", "ps_5_1");
-
-	mShaders["treeSpriteVS"] = d3dUtil::CompileShader(L"Shaders\\TreeSprite.hlsl", nullptr, "VS", "vs_5_1");
-	mShaders["treeSpriteGS"] = d3dUtil::CompileShader(L"Shaders\\TreeSprite.hlsl", nullptr, "GS", "gs_5_1");
-	mShaders["treeSpritePS"] = d3dUtil::CompileShader(L"Shaders\\TreeSprite.hlsl", alphaTestDefines, "PS", "ps_5_1");
+		world.LoadRadius = MathHelper::Infinity;
+		world.UnloadRadius = MathHelper::Infinity;
+		world.MaxCells = (UINT)(columns * rows);
+		world.MaxLoadsInFlight = world.MaxCells;
+		world.MaxCommitsPerUpdate = world.MaxCells;
+	}
 
-	mInputLayout =
+	mWorld = std::make_unique<WorldPartition>(world, [this](int x, int z) -> std::unique_ptr<WorldPartition::CellData>
 	{
-		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-		{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-		{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-	};
-
-	mTreeSpriteInputLayout =
+		return BuildWorldCell(x, z);
+	});
+	mOnCellLoaded = [this](int x, int z, std::unique_ptr<WorldPartition::CellData> data)
 	{
-		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-		{ "SIZE", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 12, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		CommitWorldCell(x, z, std::unique_ptr<WorldCell>(static_cast<WorldCell*>(data.release())));
 	};
-}
-
+	mOnCellUnloaded = [this](int x, int z) { UnloadWorldCell(x, z); };
+
+	// Every tile holds the same items, so one built here sizes everything for the
+	// most tiles that can be loaded: the transform slots, the instances, the batches
+	// and the tree lists.
+	std::unique_ptr<WorldCell> prototype = BuildWorldCell(0, 0);
+
+	UINT batchedItems[(int)RenderLayer::Count] = {};
+	UINT itemMeshlets[(int)RenderLayer::Count] = {};
+	UINT treeItems = 0;
+	std::map<std::tuple<RenderLayer, MeshGeometry*, UINT, Material*>, UINT> batches;
+	std::map<std::tuple<RenderLayer, const void*, Material*>, UINT> lodBatches;
+	for (const WorldCell::Item& cellItem : prototype->Items)
+	{
+		const RenderItem* ri = cellItem.Ritem.get();
+		if (cellItem.Layer == RenderLayer::AlphaTestedTreeSprites)
+		{
+			++treeItems;
+			continue;
+		}
 
-void ShapesApp::BuildShapeGeometry()
-{
-	GeometryGenerator geoGen;
-	GeometryGenerator::MeshData box = geoGen.CreateBox(1.0f, 1.0f, 1.0f, 0);
-	GeometryGenerator::MeshData grid = geoGen.CreateGrid(100.0f, 100.0f, 60, 40);
-	GeometryGenerator::MeshData sphere = geoGen.CreateSphere(0.5f, 20, 20);
-	GeometryGenerator::MeshData cylinder = geoGen.CreateCylinder(1.0f, 1.0f, 3.0f, 20, 20);
-	GeometryGenerator::MeshData wedge = geoGen.CreateWedge(1.0f, 1.0f, 1.0f, 1);
-	GeometryGenerator::MeshData pyramid = geoGen.CreatePyramid(1.0f, 1.0f, 1.0f, 5);
-	GeometryGenerator::MeshData cone = geoGen.CreateCone(1.0f, 2.0f, 12, 4);
-	GeometryGenerator::MeshData diamond = geoGen.CreateDiamond(2.0f, 1.0f, 12);
-	GeometryGenerator::MeshData spike = geoGen.CreateSpike(2.0f, 3.0f, 1.0f, 6, 2);
-	GeometryGenerator::MeshData squarewindow = geoGen.CreateSquareWindow(0.5f, 1.0f, 1.0f);
-	GeometryGenerator::MeshData caltrop = geoGen.CreateCaltrop(1.0f, 1.0f, 1.0f);
+		++batchedItems[(int)cellItem.Layer];
+		itemMeshlets[(int)cellItem.Layer] += ri->MeshletCount;
+		batches.emplace(std::make_tuple(cellItem.Layer, ri->Geo, ri->StartIndexLocation, ri->Mat), ri->MeshletCount);
 
+		// Every submesh/material pair of a LOD chain may end up split across all its levels.
+		if (ri->LodChain != nullptr)
+		{
+			UINT chainMeshlets = 0;
+			for (int lod = 1; lod < gNumLodLevels; ++lod)
+				chainMeshlets += (*ri->LodChain)[lod].MeshletCount;
+			lodBatches.emplace(std::make_tuple(cellItem.Layer, ri->LodChain, ri->Mat), chainMeshlets);
+		}
+	}
 
-	// We are concatenating all the geometry into one big vertex/index buffer.  So
-	// define the regions in the buffer each submesh covers.
+	mTransforms.Reserve(world.MaxCells * (UINT)prototype->Items.size());
+	mTransformOwners.assign(mTransforms.Capacity(), nullptr);
 
+	for (BatchRange& range : mBatchRanges)
+		range = BatchRange();
+	for (const auto& e : batches)
+	{
+		BatchRange& range = mBatchRanges[(int)std::get<0>(e.first)];
+		++range.BatchCapacity;
+		range.MeshletDrawCapacity += e.second;
+	}
+	for (const auto& e : lodBatches)
+	{
+		BatchRange& range = mBatchRanges[(int)std::get<0>(e.first)];
+		range.BatchCapacity += gNumLodLevels - 1;
+		range.MeshletDrawCapacity += e.second;
+	}
 
-	// Cache the vertex offsets to each object in the concatenated vertex buffer.
-	UINT boxVertexOffset = 0;
-	UINT gridVertexOffset = (UINT)box.Vertices.size();
-	UINT sphereVertexOffset = gridVertexOffset + (UINT)grid.Vertices.size();
-	UINT cylinderVertexOffset = sphereVertexOffset + (UINT)sphere.Vertices.size();
-	UINT wedgeVertexOffset = cylinderVertexOffset + (UINT)cylinder.Vertices.size();
-	UINT pyramidVertexOffset = wedgeVertexOffset + (UINT)wedge.Vertices.size();
-	UINT coneVertexOffset = pyramidVertexOffset + (UINT)pyramid.Vertices.size();
-	UINT diamondVertexOffset = coneVertexOffset + (UINT)cone.Vertices.size();
-	UINT spikeVertexOffset = diamondVertexOffset + (UINT)diamond.Vertices.size();
-	UINT squarewindowVertexOffset = spikeVertexOffset + (UINT)spike.Vertices.size();
-	UINT caltropVertexOffset = squarewindowVertexOffset + (UINT)squarewindow.Vertices.size();
-
-
-	// Cache the starting index for each object in the concatenated index buffer.
-	UINT boxIndexOffset = 0;
-	UINT gridIndexOffset = (UINT)box.Indices32.size();
-	UINT sphereIndexOffset = gridIndexOffset + (UINT)grid.Indices32.size();
-	UINT cylinderIndexOffset = sphereIndexOffset + (UINT)sphere.Indices32.size();
-	UINT wedgeIndexOffset = cylinderIndexOffset + (UINT)cylinder.Indices32.size();
-	UINT pyramidIndexOffset = wedgeIndexOffset + (UINT)wedge.Indices32.size();
-	UINT coneIndexOffset = pyramidIndexOffset + (UINT)pyramid.Indices32.size();
-	UINT diamondIndexOffset = coneIndexOffset + (UINT)cone.Indices32.size();
-	UINT spikeIndexOffset = diamondIndexOffset + (UINT)diamond.Indices32.size();
-	UINT squarewindowIndexOffset = spikeIndexOffset + (UINT)spike.Indices32.size();
-	UINT caltropIndexOffset = squarewindowIndexOffset + (UINT)squarewindow.Indices32.size();
-
-	// Define the SubmeshGeometry that cover different
-	// regions of the vertex/index buffers.
-
-	SubmeshGeometry boxSubmesh;
-	boxSubmesh.IndexCount = (UINT)box.Indices32.size();
-	boxSubmesh.StartIndexLocation = boxIndexOffset;
-	boxSubmesh.BaseVertexLocation = boxVertexOffset;
-
-	SubmeshGeometry gridSubmesh;
-	gridSubmesh.IndexCount = (UINT)grid.Indices32.size();
-	gridSubmesh.StartIndexLocation = gridIndexOffset;
-	gridSubmesh.BaseVertexLocation = gridVertexOffset;
-
-	SubmeshGeometry sphereSubmesh;
-	sphereSubmesh.IndexCount = (UINT)sphere.Indices32.size();
-	sphereSubmesh.StartIndexLocation = sphereIndexOffset;
-	sphereSubmesh.BaseVertexLocation = sphereVertexOffset;
-
-	SubmeshGeometry cylinderSubmesh;
-	cylinderSubmesh.IndexCount = (UINT)cylinder.Indices32.size();
-	cylinderSubmesh.StartIndexLocation = cylinderIndexOffset;
-	cylinderSubmesh.BaseVertexLocation = cylinderVertexOffset;
-
-	SubmeshGeometry wedgeSubmesh;
-	wedgeSubmesh.IndexCount = (UINT)wedge.Indices32.size();
-	wedgeSubmesh.StartIndexLocation = wedgeIndexOffset;
-	wedgeSubmesh.BaseVertexLocation = wedgeVertexOffset;
-
-	SubmeshGeometry pyramidSubmesh;
-	pyramidSubmesh.IndexCount = (UINT)pyramid.Indices32.size();
-	pyramidSubmesh.StartIndexLocation = pyramidIndexOffset;
-	pyramidSubmesh.BaseVertexLocation = pyramidVertexOffset;
-
-	SubmeshGeometry coneSubmesh;
-	coneSubmesh.IndexCount = (UINT)cone.Indices32.size();
-	coneSubmesh.StartIndexLocation = coneIndexOffset;
-	coneSubmesh.BaseVertexLocation = coneVertexOffset;
-
-	SubmeshGeometry diamondSubmesh;
-	diamondSubmesh.IndexCount = (UINT)diamond.Indices32.size();
-	diamondSubmesh.StartIndexLocation = diamondIndexOffset;
-	diamondSubmesh.BaseVertexLocation = diamondVertexOffset;
-
-	SubmeshGeometry spikeSubmesh;
-	spikeSubmesh.IndexCount = (UINT)spike.Indices32.size();
-	spikeSubmesh.StartIndexLocation = spikeIndexOffset;
-	spikeSubmesh.BaseVertexLocation = spikeVertexOffset;
-
-	SubmeshGeometry squarewindowSubmesh;
-	squarewindowSubmesh.IndexCount = (UINT)squarewindow.Indices32.size();
-	squarewindowSubmesh.StartIndexLocation = squarewindowIndexOffset;
-	squarewindowSubmesh.BaseVertexLocation = squarewindowVertexOffset;
-
-	SubmeshGeometry caltropSubmesh;
-	caltropSubmesh.IndexCount = (UINT)caltrop.Indices32.size();
-	caltropSubmesh.StartIndexLocation = caltropIndexOffset;
-	caltropSubmesh.BaseVertexLocation = caltropVertexOffset;
-	
+	// The batched layers' ranges, one after the other.  Items are built at their
+	// finest level, the one with the most meshlets.
+	mInstanceCapacity = 0;
+	mBatchCapacity = 0;
+	mMeshletDrawCapacity = 0;
+	mMeshletInstanceCapacity = 0;
+	for (RenderLayer layer : { RenderLayer::Opaque, RenderLayer::Transparent })
+	{
+		BatchRange& range = mBatchRanges[(int)layer];
+		range.InstanceCapacity = world.MaxCells * batchedItems[(int)layer];
+		range.MeshletInstanceCapacity = world.MaxCells * itemMeshlets[(int)layer];
+		if (layer == RenderLayer::Transparent)
+			range.BatchCapacity += world.MaxCells * batchedItems[(int)layer];
+
+		range.FirstInstance = mInstanceCapacity;
+		range.FirstBatch = mBatchCapacity;
+		range.FirstMeshletDraw = mMeshletDrawCapacity;
+		range.FirstMeshletInstance = mMeshletInstanceCapacity;
+		mInstanceCapacity += range.InstanceCapacity;
+		mBatchCapacity += range.BatchCapacity;
+		mMeshletDrawCapacity += range.MeshletDrawCapacity;
+		mMeshletInstanceCapacity += range.MeshletInstanceCapacity;
+	}
+	mTreeCapacity = mScene.Sprites().Count * treeItems * world.MaxCells;
 
-	// Extract the vertex elements we are interested in and pack the
-	// vertices of all the meshes into one vertex buffer.
+	BuildImpostorClusters(*prototype);
+	BuildLightmaps(*prototype);
 
-	auto totalVertexCount =
-		box.Vertices.size() +
-		grid.Vertices.size() +
-		sphere.Vertices.size() +
-		cylinder.Vertices.size() +
-		wedge.Vertices.size() +
-		pyramid.Vertices.size() +
-		cone.Vertices.size() +
-		diamond.Vertices.size() +
-		spike.Vertices.size() + 
-		squarewindow.Vertices.size() +
-		caltrop.Vertices.size();
+	// A visibility texel holds the instance + 1 and the triangle in 32 bits.
+	UINT maxTriangles = 0;
+	for (const auto& e : mShapeGeo->DrawArgs)
+		maxTriangles = MathHelper::Max(maxTriangles, e.second.IndexCount / 3);
+	mVisibilitySupported = mInstanceCapacity < (1u << (32 - gVisibilityTriangleBits)) &&
+		maxTriangles <= (1u << gVisibilityTriangleBits);
 
-	std::vector<Vertex> vertices(totalVertexCount);
+	// The tiles around the camera are there for the first frame.
+	mWorld->Update(mCamera.GetPosition3f(), mOnCellLoaded, mOnCellUnloaded, true);
+	RebuildWorldColliders();
+}
 
-	UINT k = 0;
+// Groups the prototype tile's static opaque items by gImpostorClusterSize square and
+// keeps what each cluster's bake draws: the items at their finest level, moved into
+// the unit sphere around the cluster.  Every tile holds the same items in the same
+// order, so the clusters stand for the items of any tile.
+void ShapesApp::BuildImpostorClusters(const WorldCell& prototype)
+{
+	mImpostorClusters.clear();
+	mImpostorBakeDraws.clear();
+	if (!gImpostors)
+		return;
 
-	for (size_t i = 0; i < box.Vertices.size(); ++i, ++k)
+	std::map<std::pair<int, int>, std::vector<UINT>> squares;
+	for (UINT i = 0; i < (UINT)prototype.Items.size(); ++i)
 	{
-		vertices[k].Pos = box.Vertices[i].Position;
-		vertices[k].Normal = box.Vertices[i].Normal;
-		vertices[k].TexC = box.Vertices[i].TexC;
+		const WorldCell::Item& cellItem = prototype.Items[i];
+		const RenderItem* ri = cellItem.Ritem.get();
+		const XMFLOAT3& extents = ri->Bounds.Extents;
+		if (cellItem.Layer != RenderLayer::Opaque || ri->DynamicCaster ||
+			2.0f * MathHelper::Max(extents.x, extents.z) > gImpostorClusterSize)
+			continue;
+
+		int x = (int)floorf((ri->Bounds.Center.x - prototype.Offset.x) / gImpostorClusterSize);
+		int z = (int)floorf((ri->Bounds.Center.z - prototype.Offset.z) / gImpostorClusterSize);
+		squares[std::make_pair(x, z)].push_back(i);
 	}
 
-	for (size_t i = 0; i < grid.Vertices.size(); ++i, ++k)
+	// Two slices a cluster, for as many as an array texture holds.
+	const size_t maxClusters = D3D12_REQ_TEXTURE2D_ARRAY_AXIS_DIMENSION / 2;
+	for (const auto& e : squares)
 	{
-		vertices[k].Pos = grid.Vertices[i].Position;
-		vertices[k].Normal = grid.Vertices[i].Normal;
-		vertices[k].TexC = grid.Vertices[i].TexC;
+		if (e.second.size() < gImpostorMinItems || mImpostorClusters.size() == maxClusters)
+			continue;
+
+		BoundingBox bounds = prototype.Items[e.second.front()].Ritem->Bounds;
+		for (UINT i : e.second)
+			BoundingBox::CreateMerged(bounds, bounds, prototype.Items[i].Ritem->Bounds);
+
+		ImpostorCluster cluster;
+		cluster.Center = XMFLOAT3(bounds.Center.x - prototype.Offset.x, bounds.Center.y - prototype.Offset.y,
+			bounds.Center.z - prototype.Offset.z);
+		cluster.Radius = XMVectorGetX(XMVector3Length(XMLoadFloat3(&bounds.Extents)));
+		cluster.Items = e.second;
+		cluster.FirstBakeDraw = (UINT)mImpostorBakeDraws.size();
+
+		const float scale = 1.0f / cluster.Radius;
+		XMMATRIX toCluster = XMMatrixTranslation(-bounds.Center.x, -bounds.Center.y, -bounds.Center.z) *
+			XMMatrixScaling(scale, scale, scale);
+		for (UINT i : cluster.Items)
+		{
+			const WorldCell::Item& cellItem = prototype.Items[i];
+			const RenderItem* ri = cellItem.Ritem.get();
+
+			ImpostorBakeDraw draw;
+			XMMATRIX world = XMLoadFloat4x4(&prototype.Graph.World(ri->SceneNode)) * toCluster;
+			XMStoreFloat4x4(&draw.Instance.World, XMMatrixTranspose(world));
+			XMStoreFloat4x4(&draw.Instance.TexTransform, XMMatrixTranspose(XMLoadFloat4x4(&cellItem.TexTransform)));
+			draw.Geo = ri->Geo;
+			draw.Mat = ri->Mat;
+			draw.IndexCount = ri->IndexCount;
+			draw.StartIndexLocation = ri->StartIndexLocation;
+			draw.BaseVertexLocation = ri->BaseVertexLocation;
+			mImpostorBakeDraws.push_back(draw);
+		}
 
+		mImpostorClusters.push_back(std::move(cluster));
 	}
+}
 
-	for (size_t i = 0; i < sphere.Vertices.size(); ++i, ++k)
+// The clusters' albedo and normal slices, with a view of each to render into and a
+// depth buffer the bake reuses for every cluster.  Baked by the first frame that has
+// all the textures.
+void ShapesApp::BuildImpostorAtlas()
+{
+	if (mImpostorClusters.empty())
+		return;
+
+	const UINT slices = 2 * (UINT)mImpostorClusters.size();
+	D3D12_RESOURCE_DESC desc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R8G8B8A8_UNORM, gImpostorAtlasSize, gImpostorAtlasSize,
+		(UINT16)slices, 1, 1, 0, D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET);
+	const float clearColor[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	CD3DX12_CLEAR_VALUE clearValue(DXGI_FORMAT_R8G8B8A8_UNORM, clearColor);
+	ThrowIfFailed(md3dDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+		D3D12_HEAP_FLAG_NONE,
+		&desc,
+		D3D12_RESOURCE_STATE_RENDER_TARGET,
+		&clearValue,
+		IID_PPV_ARGS(mImpostorAtlas.GetAddressOf())));
+
+	D3D12_DESCRIPTOR_HEAP_DESC rtvHeapDesc = {};
+	rtvHeapDesc.NumDescriptors = slices;
+	rtvHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_RTV;
+	rtvHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
+	ThrowIfFailed(md3dDevice->CreateDescriptorHeap(&rtvHeapDesc, IID_PPV_ARGS(mImpostorRtvHeap.GetAddressOf())));
+
+	D3D12_RENDER_TARGET_VIEW_DESC rtvDesc = {};
+	rtvDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	rtvDesc.ViewDimension = D3D12_RTV_DIMENSION_TEXTURE2DARRAY;
+	rtvDesc.Texture2DArray.ArraySize = 1;
+	for (UINT i = 0; i < slices; ++i)
 	{
-		vertices[k].Pos = sphere.Vertices[i].Position;
-		vertices[k].Normal = sphere.Vertices[i].Normal;
-		vertices[k].TexC = sphere.Vertices[i].TexC;
-
+		rtvDesc.Texture2DArray.FirstArraySlice = i;
+		md3dDevice->CreateRenderTargetView(mImpostorAtlas.Get(), &rtvDesc,
+			CD3DX12_CPU_DESCRIPTOR_HANDLE(mImpostorRtvHeap->GetCPUDescriptorHandleForHeapStart(), i, mRtvDescriptorSize));
 	}
 
-	for (size_t i = 0; i < cylinder.Vertices.size(); ++i, ++k)
-	{
-		vertices[k].Pos = cylinder.Vertices[i].Position;
-		vertices[k].Normal = cylinder.Vertices[i].Normal;
-		vertices[k].TexC = cylinder.Vertices[i].TexC;
+	D3D12_RESOURCE_DESC depthDesc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_D32_FLOAT, gImpostorAtlasSize, gImpostorAtlasSize,
+		1, 1, 1, 0, D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL);
+	CD3DX12_CLEAR_VALUE depthClearValue(DXGI_FORMAT_D32_FLOAT, 1.0f, 0);
+	ThrowIfFailed(md3dDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+		D3D12_HEAP_FLAG_NONE,
+		&depthDesc,
+		D3D12_RESOURCE_STATE_DEPTH_WRITE,
+		&depthClearValue,
+		IID_PPV_ARGS(mImpostorDepth.GetAddressOf())));
+
+	D3D12_DESCRIPTOR_HEAP_DESC dsvHeapDesc = {};
+	dsvHeapDesc.NumDescriptors = 1;
+	dsvHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_DSV;
+	dsvHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
+	ThrowIfFailed(md3dDevice->CreateDescriptorHeap(&dsvHeapDesc, IID_PPV_ARGS(mImpostorDsvHeap.GetAddressOf())));
+	md3dDevice->CreateDepthStencilView(mImpostorDepth.Get(), nullptr, mImpostorDsvHeap->GetCPUDescriptorHandleForHeapStart());
+
+	mImpostorSrvIndex = mSrvHeap->Allocate();
+	CreateTextureSrv(mImpostorAtlas.Get(), true, mImpostorSrvIndex);
+}
 
-	}
+// Bakes the static lights into the prototype tile's static opaque items, shadowed by
+// the same items with the gates left out, since they move.  The prototype stands at
+// tile (0, 0), where CommitWorldCell hands its items what they were given here.
+void ShapesApp::BuildLightmaps(const WorldCell& prototype)
+{
+	mLightmapItems.clear();
+	if (!gLightmaps)
+		return;
 
-	for (size_t i = 0; i < wedge.Vertices.size(); ++i, ++k)
+	std::vector<Light> lights;
+	for (const SceneLight& sceneLight : mLights)
 	{
-		vertices[k].Pos = wedge.Vertices[i].Position;
-		vertices[k].Normal = wedge.Vertices[i].Normal;
-		vertices[k].TexC = wedge.Vertices[i].TexC;
+		if (sceneLight.Type == SceneLightType::Directional || sceneLight.FollowsCamera)
+			continue;
 
+		lights.push_back(sceneLight.Data);
+		if (sceneLight.Type == SceneLightType::Point)
+			lights.back().SpotPower = 0.0f;
 	}
+	if (lights.empty())
+		return;
 
-	for (size_t i = 0; i < pyramid.Vertices.size(); ++i, ++k)
+	SceneBvh occluders;
+	for (UINT i = 0; i < (UINT)prototype.Items.size(); ++i)
 	{
-		vertices[k].Pos = pyramid.Vertices[i].Position;
-		vertices[k].Normal = pyramid.Vertices[i].Normal;
-		vertices[k].TexC = pyramid.Vertices[i].TexC;
-
+		const WorldCell::Item& cellItem = prototype.Items[i];
+		const RenderItem* ri = cellItem.Ritem.get();
+		if (cellItem.Layer == RenderLayer::Opaque && !ri->DynamicCaster && ri->RayMesh != nullptr)
+			occluders.Add(ri->RayMesh, prototype.Graph.World(ri->SceneNode), i);
 	}
+	occluders.Build();
+
+	mLightmapBaker = std::make_unique<LightmapBaker>(gLightmapAtlasSize, gLightmapMaxSlices,
+		gLightmapTexelsPerUnit, gLightmapMinRect, gLightmapMaxRect);
 
-	for (size_t i = 0; i < cone.Vertices.size(); ++i, ++k)
+	// The water's waves move its vertices, so it keeps its lighting.
+	std::vector<std::pair<UINT, std::uint32_t>> baked;
+	for (UINT i = 0; i < (UINT)prototype.Items.size(); ++i)
 	{
-		vertices[k].Pos = cone.Vertices[i].Position;
-		vertices[k].Normal = cone.Vertices[i].Normal;
-		vertices[k].TexC = cone.Vertices[i].TexC;
+		const WorldCell::Item& cellItem = prototype.Items[i];
+		const RenderItem* ri = cellItem.Ritem.get();
+		if (cellItem.Layer != RenderLayer::Opaque || ri->DynamicCaster || ri->Geo != mShapeGeo ||
+			(ri->Mat->Flags & MaterialFlagWaves) != 0)
+			continue;
+
+		auto mesh = mLightmapMeshes.find(ri->StartIndexLocation);
+		if (mesh == mLightmapMeshes.end() || !mesh->second.Valid)
+			continue;
+
+		LightmapBaker::Mesh bakeMesh;
+		bakeMesh.Positions = mesh->second.Positions.data();
+		bakeMesh.Normals = mesh->second.Normals.data();
+		bakeMesh.LightmapUVs = mesh->second.UVs.data();
+		bakeMesh.VertexCount = (std::uint32_t)mesh->second.Positions.size();
+		bakeMesh.Indices = mesh->second.Indices.data();
+		bakeMesh.IndexCount = (std::uint32_t)mesh->second.Indices.size();
+		baked.emplace_back(i, mLightmapBaker->AddInstance(bakeMesh, prototype.Graph.World(ri->SceneNode)));
+	}
+
+	mLightmapBaker->Bake(*mJobs, lights, occluders);
 
+	mLightmapItems.resize(prototype.Items.size());
+	for (const auto& e : baked)
+	{
+		mLightmapItems[e.first].ScaleOffset = mLightmapBaker->ScaleOffset(e.second);
+		mLightmapItems[e.first].Slice = mLightmapBaker->Slice(e.second);
 	}
+}
 
-	for (size_t i = 0; i < diamond.Vertices.size(); ++i, ++k)
+// Uploads what BuildLightmaps baked, through an upload heap of its own since the
+// atlas outgrows the staging ring, and lets the meshes go.
+void ShapesApp::BuildLightmapAtlas()
+{
+	std::unique_ptr<LightmapBaker> baker = std::move(mLightmapBaker);
+	mLightmapMeshes.clear();
+	if (baker == nullptr || baker->SliceCount() == 0)
+		return;
+
+	const UINT size = baker->AtlasSize();
+	const UINT slices = baker->SliceCount();
+	D3D12_RESOURCE_DESC desc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R16G16B16A16_FLOAT, size, size,
+		(UINT16)slices, 1);
+	ThrowIfFailed(md3dDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+		D3D12_HEAP_FLAG_NONE,
+		&desc,
+		D3D12_RESOURCE_STATE_COPY_DEST,
+		nullptr,
+		IID_PPV_ARGS(mLightmapAtlas.GetAddressOf())));
+
+	const UINT64 uploadBufferSize = GetRequiredIntermediateSize(mLightmapAtlas.Get(), 0, slices);
+	ThrowIfFailed(md3dDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
+		D3D12_HEAP_FLAG_NONE,
+		&CD3DX12_RESOURCE_DESC::Buffer(uploadBufferSize),
+		D3D12_RESOURCE_STATE_GENERIC_READ,
+		nullptr,
+		IID_PPV_ARGS(mLightmapUploadBuffer.GetAddressOf())));
+
+	const std::vector<XMHALF4>& texels = baker->Texels();
+	std::vector<D3D12_SUBRESOURCE_DATA> initData(slices);
+	for (UINT i = 0; i < slices; ++i)
 	{
-		vertices[k].Pos = diamond.Vertices[i].Position;
-		vertices[k].Normal = diamond.Vertices[i].Normal;
-		vertices[k].TexC = diamond.Vertices[i].TexC;
+		initData[i].pData = texels.data() + (size_t)i * size * size;
+		initData[i].RowPitch = size * sizeof(XMHALF4);
+		initData[i].SlicePitch = initData[i].RowPitch * size;
+	}
+	UpdateSubresources(mCommandList.Get(), mLightmapAtlas.Get(), mLightmapUploadBuffer.Get(), 0, 0, slices, initData.data());
+
+	mCommandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mLightmapAtlas.Get(),
+		D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE));
+
+	mLightmapSrvIndex = mSrvHeap->Allocate();
+	CreateTextureSrv(mLightmapAtlas.Get(), true, mLightmapSrvIndex);
+	mMainPassCB.LightmapIndex = mLightmapSrvIndex;
+}
+
+// Builds tile (x, z) of the world: its scene graph, the items on it with their
+// bounds, and its walls.  Runs on mWorld's worker, after Initialize only reading
+// what stays fixed: the scene, the materials and the geometry.
+std::unique_ptr<ShapesApp::WorldCell> ShapesApp::BuildWorldCell(int x, int z)
+{
+	auto cell = std::make_unique<WorldCell>();
+	cell->Offset = mWorld->CellCenter(x, z);
+
+	XMFLOAT4X4 tileLocal;
+	XMStoreFloat4x4(&tileLocal, XMMatrixTranslation(cell->Offset.x, cell->Offset.y, cell->Offset.z));
+	cell->RootNode = cell->Graph.AddNode(SceneGraph::NoParent, tileLocal);
+	cell->NodeItems.resize(cell->Graph.NodeCount(), nullptr);
 
+	const SceneEnvironment& environment = mScene.Environment();
+	auto spriteMat = mMaterials.find(environment.SpriteMaterial);
+	if (mScene.Sprites().Count > 0 && spriteMat != mMaterials.end())
+	{
+		auto treeSpritesRitem = std::make_unique<RenderItem>();
+		treeSpritesRitem->name = "points";
+		treeSpritesRitem->SceneNode = cell->Graph.AddNode(cell->RootNode, MathHelper::Identity4x4());
+		cell->NodeItems.resize(cell->Graph.NodeCount(), nullptr);
+		cell->NodeItems[treeSpritesRitem->SceneNode] = treeSpritesRitem.get();
+		treeSpritesRitem->Mat = spriteMat->second.get();
+		treeSpritesRitem->Geo = mTreeSpritesGeo;
+		treeSpritesRitem->LocalBounds = mTreeSpritesGeo->DrawArgs.at("points").Bounds;
+
+		treeSpritesRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP;
+
+		// Only positions the tile's trees; DrawTrees draws every tile's in one go.
+		WorldCell::Item cellItem;
+		cellItem.Ritem = std::move(treeSpritesRitem);
+		cellItem.Layer = RenderLayer::AlphaTestedTreeSprites;
+		cell->Items.push_back(std::move(cellItem));
 	}
 
-	for (size_t i = 0; i < spike.Vertices.size(); ++i, ++k)
+	// Scene nodes come after their parents, so each one's parent already has its
+	// node in this tile.
+	const SceneSpan<SceneNode> nodes = mScene.Nodes();
+	std::vector<std::uint32_t> tileNodes(nodes.Count);
+
+	// Nodes the gates move, and everything hanging off them.
+	std::vector<bool> animated(nodes.Count, false);
+	for (UINT i = 0; i < nodes.Count; ++i)
 	{
-		vertices[k].Pos = spike.Vertices[i].Position;
-		vertices[k].Normal = spike.Vertices[i].Normal;
-		vertices[k].TexC = spike.Vertices[i].TexC;
+		const SceneNode& node = nodes[i];
 
+		XMFLOAT4X4 local;
+		XMStoreFloat4x4(&local, XMMatrixTranslation(node.Translation.x, node.Translation.y, node.Translation.z));
+		tileNodes[i] = cell->Graph.AddNode(node.Parent == SceneNoParent ? cell->RootNode : tileNodes[node.Parent], local);
+
+		if (node.Flags & SceneNodePortcullis)
+			cell->PortcullisNodes.push_back(tileNodes[i]);
+		if (node.Flags & SceneNodeDrawbridge)
+			cell->DrawbridgeNodes.push_back(tileNodes[i]);
+
+		animated[i] = (node.Flags & (SceneNodePortcullis | SceneNodeDrawbridge)) != 0 ||
+			(node.Parent != SceneNoParent && animated[node.Parent]);
 	}
 
-	for (size_t i = 0; i < squarewindow.Vertices.size(); ++i, ++k)
+	// Objects naming a mesh or material the scene doesn't have are left out.
+	const MeshGeometry* shapeGeo = mShapeGeo;
+	for (const SceneObject& object : mScene.Objects())
 	{
-		vertices[k].Pos = squarewindow.Vertices[i].Position;
-		vertices[k].Normal = squarewindow.Vertices[i].Normal;
-		vertices[k].TexC = squarewindow.Vertices[i].TexC;
-
+		if (mMaterials.count(object.Material) == 0 || shapeGeo->DrawArgs.count(object.Mesh) == 0)
+			continue;
+
+		std::uint32_t parentNode = object.Parent == SceneNoParent ? cell->RootNode : tileNodes[object.Parent];
+		MakeThing(*cell, parentNode, object.Mesh, object.Material,
+			object.Layer == SceneLayer::Transparent ? RenderLayer::Transparent : RenderLayer::Opaque,
+			object.Scale, object.Position, object.TexScale, object.Rotation);
+		cell->Items.back().Ritem->DynamicCaster = object.Parent != SceneNoParent && animated[object.Parent];
 	}
-	
-	for (size_t i = 0; i < caltrop.Vertices.size(); ++i, ++k)
+
+	// World matrices and bounds; the transform store gets them on commit.
+	WorldCell& built = *cell;
+	built.Graph.Update([&built](std::uint32_t node, const XMFLOAT4X4& world)
 	{
-		vertices[k].Pos = caltrop.Vertices[i].Position;
-		vertices[k].Normal = caltrop.Vertices[i].Normal;
-		vertices[k].TexC = caltrop.Vertices[i].TexC;
+		RenderItem* ri = built.NodeItems[node];
+		if (ri != nullptr)
+			ri->LocalBounds.Transform(ri->Bounds, XMLoadFloat4x4(&world));
+	});
+
+	return cell;
+}
 
+// Hands the cell's items transform slots from the store's free list and adds them to
+// the layers.  The batches are rebuilt at the start of the frame, the colliders and
+// shadow casters by UpdateWorld.
+void ShapesApp::CommitWorldCell(int x, int z, std::unique_ptr<WorldCell> cell)
+{
+	// Only the first tile stands among the baked lights.
+	if (x == 0 && z == 0)
+	{
+		for (size_t i = 0; i < mLightmapItems.size(); ++i)
+		{
+			cell->Items[i].Ritem->LightmapScaleOffset = mLightmapItems[i].ScaleOffset;
+			cell->Items[i].Ritem->LightmapSlice = mLightmapItems[i].Slice;
+		}
 	}
 
-	
+	for (WorldCell::Item& cellItem : cell->Items)
+	{
+		RenderItem* ri = cellItem.Ritem.get();
 
-	std::vector<std::uint16_t> indices;
-	indices.insert(indices.end(), std::begin(box.GetIndices16()), std::end(box.GetIndices16()));
-	indices.insert(indices.end(), std::begin(grid.GetIndices16()), std::end(grid.GetIndices16()));
-	indices.insert(indices.end(), std::begin(sphere.GetIndices16()), std::end(sphere.GetIndices16()));
-	indices.insert(indices.end(), std::begin(cylinder.GetIndices16()), std::end(cylinder.GetIndices16()));
-	indices.insert(indices.end(), std::begin(wedge.GetIndices16()), std::end(wedge.GetIndices16()));
-	indices.insert(indices.end(), std::begin(pyramid.GetIndices16()), std::end(pyramid.GetIndices16()));
-	indices.insert(indices.end(), std::begin(cone.GetIndices16()), std::end(cone.GetIndices16()));
-	indices.insert(indices.end(), std::begin(diamond.GetIndices16()), std::end(diamond.GetIndices16()));
-	indices.insert(indices.end(), std::begin(spike.GetIndices16()), std::end(spike.GetIndices16()));
-	indices.insert(indices.end(), std::begin(squarewindow.GetIndices16()), std::end(squarewindow.GetIndices16()));
-	indices.insert(indices.end(), std::begin(caltrop.GetIndices16()), std::end(caltrop.GetIndices16()));
+		// Capacity was reserved for the most tiles there can be, so this never grows
+		// the store past what the frame resources' object buffers hold.
+		ri->ObjCBIndex = mTransforms.Allocate();
+		assert(ri->ObjCBIndex < mTransformOwners.size());
+		mTransforms.SetTexTransform(ri->ObjCBIndex, cellItem.TexTransform);
+		mTransforms.SetWorld(ri->ObjCBIndex, cell->Graph.World(ri->SceneNode));
+		mTransformOwners[ri->ObjCBIndex] = ri;
 
+		mRitemLayer[(int)cellItem.Layer].push_back(ri);
+		MarkLayerDirty(cellItem.Layer);
 
-	const UINT vbByteSize = (UINT)vertices.size() * sizeof(Vertex);
-	const UINT ibByteSize = (UINT)indices.size() * sizeof(std::uint16_t);
+		if (ri->LodChain != nullptr && cellItem.Layer != RenderLayer::AlphaTestedTreeSprites)
+		{
+			LodItem lodItem;
+			lodItem.Item = ri;
+			lodItem.Layer = cellItem.Layer;
+			lodItem.Chain = ri->LodChain;
+			mLodItems.push_back(lodItem);
+		}
+	}
 
-	auto geo = std::make_unique<MeshGeometry>();
-	geo->Name = "shapeGeo";
+	// Drawn as geometry until UpdateImpostors finds a cluster far enough away.
+	cell->Impostors.assign(mImpostorClusters.size(), false);
 
+	// Built with the gates closed.
+	if (mGateAmount != 0.0f)
+	{
+		SetGatePose(*cell);
+		UpdateCellGraph(*cell);
+	}
 
-	ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
-	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), vertices.data(), vbByteSize);
+	mCells[std::make_pair(x, z)] = std::move(cell);
+	mWorldChanged = true;
+}
 
-	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
-	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
+// Drops the cell's items from the layers and the LOD list and frees their transform
+// slots for the next cell.  Frames already submitted only read the frame resources'
+// copies, so the slots can be reused straight away.
+void ShapesApp::UnloadWorldCell(int x, int z)
+{
+	auto it = mCells.find(std::make_pair(x, z));
+	if (it == mCells.end())
+		return;
 
-	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), vertices.data(), vbByteSize, geo->VertexBufferUploader);
+	WorldCell& cell = *it->second;
+	std::set<const RenderItem*> items;
+	for (const WorldCell::Item& cellItem : cell.Items)
+	{
+		const RenderItem* ri = cellItem.Ritem.get();
+		items.insert(ri);
+		mTransforms.Free(ri->ObjCBIndex);
+		mTransformOwners[ri->ObjCBIndex] = nullptr;
+		MarkLayerDirty(cellItem.Layer);
+	}
 
-	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
+	auto unloaded = [&items](const RenderItem* ri) { return items.count(ri) != 0; };
+	for (auto& layer : mRitemLayer)
+		layer.erase(std::remove_if(layer.begin(), layer.end(), unloaded), layer.end());
+	mLodItems.erase(std::remove_if(mLodItems.begin(), mLodItems.end(),
+		[&unloaded](const LodItem& lodItem) { return unloaded(lodItem.Item); }), mLodItems.end());
 
-	geo->VertexByteStride = sizeof(Vertex);
-	geo->VertexBufferByteSize = vbByteSize;
-	geo->IndexFormat = DXGI_FORMAT_R16_UINT;
-	geo->IndexBufferByteSize = ibByteSize;
-
-	geo->DrawArgs["box"] = boxSubmesh;
-	geo->DrawArgs["grid"] = gridSubmesh;
-	geo->DrawArgs["sphere"] = sphereSubmesh;
-	geo->DrawArgs["cylinder"] = cylinderSubmesh;
-	geo->DrawArgs["wedge"] = wedgeSubmesh;
-	geo->DrawArgs["pyramid"] = pyramidSubmesh;
-	geo->DrawArgs["cone"] = coneSubmesh;
-	geo->DrawArgs["diamond"] = diamondSubmesh;
-	geo->DrawArgs["spike"] = spikeSubmesh;
-	geo->DrawArgs["squarewindow"] = squarewindowSubmesh;
-	geo->DrawArgs["caltrop"] = caltropSubmesh;
+	mCells.erase(it);
+	mWorldChanged = true;
+}
 
-	mGeometries[geo->Name] = std::move(geo);
+// Streams the tiles around the camera in and out.  At most one tile is committed a
+// frame, so the cost of a frame doesn't depend on how far the camera jumped.
+void ShapesApp::UpdateWorld()
+{
+	mWorld->Update(mCamera.GetPosition3f(), mOnCellLoaded, mOnCellUnloaded);
+	if (mWorldChanged)
+		RebuildWorldColliders();
 }
 
-void ShapesApp::BuildTreeSpritesGeometry()
+// The collision grid, the ray BVH and the dynamic shadow casters come from the loaded
+// tiles, and the cached static cascades may have been rendered with a tile that is gone.
+void ShapesApp::RebuildWorldColliders()
 {
-	struct TreeSpriteVertex
+	mCollisionGrid.Clear();
+	for (const auto& e : mCells)
 	{
-		XMFLOAT3 Pos;
-		XMFLOAT2 Size;
-	};
+		for (const BoundingBox& wall : e.second->Walls)
+			mCollisionGrid.Add(wall, ColliderType::Wall);
+	}
+	mCollisionGrid.Build();
 
-	static const int treeCount = 12;
-	std::array<TreeSpriteVertex, 12> vertices;
-	for (UINT i = 0; i < treeCount; ++i)
+	// Only what stays put goes in, so only the top level over the items' meshes is
+	// rebuilt, and only when the tiles change.
+	mRayScene.Clear();
+	mRayItems.clear();
+	for (RenderLayer layer : { RenderLayer::Opaque, RenderLayer::Transparent })
 	{
-		vertices[i].Size = XMFLOAT2(10.0f, 10.0f);
-	}
+		for (const RenderItem* ri : mRitemLayer[(int)layer])
+		{
+			if (ri->DynamicCaster || ri->RayMesh == nullptr)
+				continue;
 
-	vertices[0].Pos = XMFLOAT3(45.0f, 4.0f, 35.0f);
-	vertices[1].Pos = XMFLOAT3(45.0f, 4.0f, 25.0f);
-	vertices[2].Pos = XMFLOAT3(45.0f, 4.0f, 15.0f);
-	vertices[3].Pos = XMFLOAT3(45.0f, 4.0f, 5.0f);
-	vertices[4].Pos = XMFLOAT3(45.0f, 4.0f, -5.0f);
-	vertices[5].Pos = XMFLOAT3(-45.0f, 4.0f, -15.0f);
-	vertices[6].Pos = XMFLOAT3(-45.0f, 4.0f, 35.0f);
-	vertices[7].Pos = XMFLOAT3(-45.0f, 4.0f, 25.0f);
-	vertices[8].Pos = XMFLOAT3(-45.0f, 4.0f, 15.0f);
-	vertices[9].Pos = XMFLOAT3(-45.0f, 4.0f, 5.0f);
-	vertices[10].Pos = XMFLOAT3(-45.0f, 4.0f, -5.0f);
-	vertices[11].Pos = XMFLOAT3(-45.0f, 4.0f, -15.0f);
+			mRayScene.Add(ri->RayMesh, mTransforms.World(ri->ObjCBIndex), (std::uint32_t)mRayItems.size());
+			mRayItems.push_back(ri);
+		}
+	}
+	mRayScene.Build();
 
-	std::array<std::uint16_t, 12> indices =
+	// Sorted so that the gates sharing a submesh and material go out in one draw.
+	mDynamicCasters.clear();
+	for (RenderItem* ri : mRitemLayer[(int)RenderLayer::Opaque])
 	{
-		0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11
-	};
+		if (ri->DynamicCaster)
+			mDynamicCasters.push_back(ri);
+	}
+	std::sort(mDynamicCasters.begin(), mDynamicCasters.end(), [](const RenderItem* a, const RenderItem* b)
+	{
+		return std::tie(a->Geo, a->StartIndexLocation, a->Mat) < std::tie(b->Geo, b->StartIndexLocation, b->Mat);
+	});
 
-	const UINT vbByteSize = (UINT)vertices.size() * sizeof(TreeSpriteVertex);
-	const UINT ibByteSize = (UINT)indices.size() * sizeof(std::uint16_t);
+	if (mShadowMap != nullptr)
+		mShadowMap->InvalidateStatic();
 
-	auto geo = std::make_unique<MeshGeometry>();
-	geo->Name = "treeSpritesGeo";
+	mWorldChanged = false;
+}
 
-	ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
-	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), vertices.data(), vbByteSize);
+// -rays: as many rays from the camera as asked for, spread evenly over the sphere
+// along a Fibonacci spiral, each asking whether anything static lies within
+// gLineOfSightRange.  Stands in for the visibility checks of a crowd of observers.
+void ShapesApp::CastLineOfSightRays(Ray* rays, bool* occluded)
+{
+	mProfiler->BeginCpuScope(mRayCpuScope);
 
-	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
-	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
+	const UINT count = mBenchmark.RayQueries;
+	const XMFLOAT3 eye = mCamera.GetPosition3f();
+	const float goldenAngle = XM_PI * (3.0f - sqrtf(5.0f));
+	for (UINT i = 0; i < count; ++i)
+	{
+		float y = 1.0f - 2.0f * (i + 0.5f) / count;
+		float r = sqrtf(MathHelper::Max(1.0f - y * y, 0.0f));
+		float phi = goldenAngle * i;
 
-	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), vertices.data(), vbByteSize, geo->VertexBufferUploader);
+		rays[i].Origin = eye;
+		rays[i].Direction = XMFLOAT3(r * cosf(phi), y, r * sinf(phi));
+		rays[i].MaxT = gLineOfSightRange;
+	}
 
-	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
+	mRayScene.OccludedBatch(*mJobs, rays, count, occluded);
 
-	geo->VertexByteStride = sizeof(TreeSpriteVertex);
-	geo->VertexBufferByteSize = vbByteSize;
-	geo->IndexFormat = DXGI_FORMAT_R16_UINT;
-	geo->IndexBufferByteSize = ibByteSize;
+	mProfiler->EndCpuScope(mRayCpuScope);
+}
 
-	SubmeshGeometry submesh;
-	submesh.IndexCount = (UINT)indices.size();
-	submesh.StartIndexLocation = 0;
-	submesh.BaseVertexLocation = 0;
+// Pushes recomputed world matrices into the transform store, which uploads them to
+// every frame resource, and moves the items' culling bounds along.
+void ShapesApp::UpdateSceneGraph()
+{
+	for (auto& e : mCells)
+		UpdateCellGraph(*e.second);
+}
 
-	geo->DrawArgs["points"] = submesh;
+void ShapesApp::UpdateCellGraph(WorldCell& cell)
+{
+	cell.Graph.Update([this, &cell](std::uint32_t node, const XMFLOAT4X4& world)
+	{
+		RenderItem* ri = cell.NodeItems[node];
+		if (ri == nullptr)
+			return;
 
-	mGeometries["treeSpritesGeo"] = std::move(geo);
+		mTransforms.SetWorld(ri->ObjCBIndex, world);
+		ri->LocalBounds.Transform(ri->Bounds, XMLoadFloat4x4(&world));
+	});
 }
 
-void ShapesApp::BuildPSOs()
+// Packs the state a draw depends on into a sortable key, most expensive change first:
+// PSO (the layer) | geometry buffers | material index.  Textures are read through the
+// material, so they no longer change any bindings.
+static UINT64 MakeDrawKey(RenderLayer layer, UINT geoRank, const Material* mat)
 {
-	/*----------- OPAQUE OBJECTS -----------*/
-	D3D12_GRAPHICS_PIPELINE_STATE_DESC opaquePsoDesc;
-	ZeroMemory(&opaquePsoDesc, sizeof(D3D12_GRAPHICS_PIPELINE_STATE_DESC));
-	opaquePsoDesc.InputLayout = { mInputLayout.data(), (UINT)mInputLayout.size() };
-	opaquePsoDesc.pRootSignature = mRootSignature.Get();
-	opaquePsoDesc.VS =
+	return ((UINT64)layer << 56) |
+		((UINT64)(geoRank & 0xFFFF) << 40) |
+		(UINT64)(mat->MatCBIndex & 0xFFFFF);
+}
+
+void ShapesApp::BuildRenderBatches()
+{
+	// Tree sprites are culled and drawn by their own passes.
+	const RenderLayer batchedLayers[] = { RenderLayer::Opaque, RenderLayer::Transparent };
+
+	// Items that dropped out of a rebuilt layer must not keep writing into the
+	// instance buffers.  The other layers keep their batches and instances as they are.
+	for (auto& e : mCells)
 	{
-		reinterpret_cast<BYTE*>(mShaders["standardVS"]->GetBufferPointer()),
-		mShaders["standardVS"]->GetBufferSize()
-	};
-	opaquePsoDesc.PS =
+		for (WorldCell::Item& cellItem : e.second->Items)
+		{
+			if (!mLayerDirty[(int)cellItem.Layer])
+				continue;
+
+			RenderItem* ri = cellItem.Ritem.get();
+			ri->InstanceIndex = -1;
+			ri->BatchIndex = -1;
+			ri->BatchStart = -1;
+			ri->MeshletDraw = -1;
+		}
+	}
+
+	for (RenderLayer layer : batchedLayers)
 	{
-		reinterpret_cast<BYTE*>(mShaders["opaquePS"]->GetBufferPointer()),
-		mShaders["opaquePS"]->GetBufferSize()
-	};
-	opaquePsoDesc.RasterizerState = CD3DX12_RASTERIZER_DESC(D3D12_DEFAULT);
-	opaquePsoDesc.BlendState = CD3DX12_BLEND_DESC(D3D12_DEFAULT);
-	opaquePsoDesc.DepthStencilState = CD3DX12_DEPTH_STENCIL_DESC(D3D12_DEFAULT);
-	opaquePsoDesc.SampleMask = UINT_MAX;
-	opaquePsoDesc.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
-	opaquePsoDesc.NumRenderTargets = 1;
-	opaquePsoDesc.RTVFormats[0] = mBackBufferFormat;
-	opaquePsoDesc.SampleDesc.Count = m4xMsaaState ? 4 : 1;
-	opaquePsoDesc.SampleDesc.Quality = m4xMsaaState ? (m4xMsaaQuality - 1) : 0;
-	opaquePsoDesc.DSVFormat = mDepthStencilFormat;
-	ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&opaquePsoDesc, IID_PPV_ARGS(&mPSOs["opaque"])));
+		if (!mLayerDirty[(int)layer])
+			continue;
 
+		auto& batches = mBatchLayer[(int)layer];
+		batches.clear();
 
+		BatchRange& range = mBatchRanges[(int)layer];
+		range.InstanceCount = 0;
+		range.BatchCount = 0;
+		range.MeshletDrawCount = 0;
+		range.MeshletInstanceCount = 0;
 
-	/*----------- TRANSLUCENT OBJECTS -----------*/
-	D3D12_GRAPHICS_PIPELINE_STATE_DESC transparentPsoDesc = opaquePsoDesc;
+		// Items with the same geometry, submesh and material can share a draw call.
+		// Sorted transparency orders the items themselves, so each gets its own.
+		const bool itemBatches = layer == RenderLayer::Transparent && !mWeightedOit;
+		std::map<std::tuple<MeshGeometry*, UINT, Material*, RenderItem*>, size_t> batchLookup;
 
-	D3D12_RENDER_TARGET_BLEND_DESC transparencyBlendDesc;
-	transparencyBlendDesc.BlendEnable = true;
-	transparencyBlendDesc.LogicOpEnable = false;
-	transparencyBlendDesc.SrcBlend = D3D12_BLEND_SRC_ALPHA;
-	transparencyBlendDesc.DestBlend = D3D12_BLEND_INV_SRC_ALPHA;
-	transparencyBlendDesc.BlendOp = D3D12_BLEND_OP_ADD;
-	transparencyBlendDesc.SrcBlendAlpha = D3D12_BLEND_ONE;
-	transparencyBlendDesc.DestBlendAlpha = D3D12_BLEND_ZERO;
-	transparencyBlendDesc.BlendOpAlpha = D3D12_BLEND_OP_ADD;
-	transparencyBlendDesc.LogicOp = D3D12_LOGIC_OP_NOOP;
-	transparencyBlendDesc.RenderTargetWriteMask = D3D12_COLOR_WRITE_ENABLE_ALL;
+		// Geometry only needs a stable rank within the layer for sorting.
+		std::unordered_map<const MeshGeometry*, UINT> geoRank;
 
-	transparentPsoDesc.BlendState.RenderTarget[0] = transparencyBlendDesc;
-	ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&transparentPsoDesc, IID_PPV_ARGS(&mPSOs["transparent"])));
+		for (RenderItem* ri : mRitemLayer[(int)layer])
+		{
+			if (ri->Impostor)
+				continue;
 
-	/*----------- TREE BILLBOARD OBJECTS -----------*/
-	
-	D3D12_GRAPHICS_PIPELINE_STATE_DESC treePsoDesc = transparentPsoDesc;
+			auto key = std::make_tuple(ri->Geo, ri->StartIndexLocation, ri->Mat, itemBatches ? ri : nullptr);
+			auto it = batchLookup.find(key);
+			if (it == batchLookup.end())
+			{
+				RenderBatch batch;
+				batch.Geo = ri->Geo;
+				batch.Mat = ri->Mat;
+				batch.PrimitiveType = ri->PrimitiveType;
+				batch.IndexCount = ri->IndexCount;
+				batch.StartIndexLocation = ri->StartIndexLocation;
+				batch.BaseVertexLocation = ri->BaseVertexLocation;
+
+				// The waves move the water's vertices out of its meshlets' bounds.  The
+				// visibility buffer needs SV_PrimitiveID to count from the submesh's start.
+				if (gMeshletCulling && layer == RenderLayer::Opaque && ri->MeshletCount >= gMinBatchMeshlets &&
+					(ri->Mat->Flags & MaterialFlagWaves) == 0 && !mVisibilityRendering)
+				{
+					batch.FirstMeshlet = ri->FirstMeshlet;
+					batch.MeshletCount = ri->MeshletCount;
+				}
+
+				it = batchLookup.emplace(key, batches.size()).first;
+				batches.push_back(std::move(batch));
+			}
 
-	treePsoDesc.InputLayout = { mTreeSpriteInputLayout.data(), (UINT)mTreeSpriteInputLayout.size() };
-	treePsoDesc.pRootSignature = mRootSignature.Get();
-	treePsoDesc.VS =
-	{
-		reinterpret_cast<BYTE*>(mShaders["treeSpriteVS"]->GetBufferPointer()),
-		mShaders["treeSpriteVS"]->GetBufferSize()
-	};
+			batches[it->second].Instances.push_back(ri);
+			geoRank.emplace(ri->Geo, (UINT)geoRank.size());
+		}
 
-	treePsoDesc.GS =
-	{
-		reinterpret_cast<BYTE*>(mShaders["treeSpriteGS"]->GetBufferPointer()),
-		mShaders["treeSpriteGS"]->GetBufferSize()
-	};
+		// Order the batches by draw key so that consecutive draws usually share
+		// geometry and textures and the state cache can skip the rebinds.
+		for (auto& batch : batches)
+			batch.SortKey = MakeDrawKey(layer, geoRank[batch.Geo], batch.Mat);
 
-	treePsoDesc.PS =
-	{
-		reinterpret_cast<BYTE*>(mShaders["treeSpritePS"]->GetBufferPointer()),
-		mShaders["treeSpritePS"]->GetBufferSize()
-	};
-	treePsoDesc.RasterizerState = CD3DX12_RASTERIZER_DESC(D3D12_DEFAULT);
-	treePsoDesc.BlendState = CD3DX12_BLEND_DESC(D3D12_DEFAULT);
-	treePsoDesc.DepthStencilState = CD3DX12_DEPTH_STENCIL_DESC(D3D12_DEFAULT);
-	treePsoDesc.SampleMask = UINT_MAX;
-	treePsoDesc.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_POINT;
-	treePsoDesc.NumRenderTargets = 1;
-	treePsoDesc.RTVFormats[0] = mBackBufferFormat;
-	//there is abug with F2 key that is supposed to turn on the multisampling!
-	//Set4xMsaaState(true);
-	//m4xMsaaState = true;
+		std::stable_sort(batches.begin(), batches.end(),
+			[](const RenderBatch& a, const RenderBatch& b) { return a.SortKey < b.SortKey; });
 
-	treePsoDesc.SampleDesc.Count = m4xMsaaState ? 4 : 1;
-	treePsoDesc.SampleDesc.Quality = m4xMsaaState ? (m4xMsaaQuality - 1) : 0;
-	treePsoDesc.DSVFormat = mDepthStencilFormat;
-	ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&treePsoDesc, IID_PPV_ARGS(&mPSOs["tree"])));
+		// Give each batch a contiguous part of the layer's range of the instance
+		// buffer, and those drawn by meshlet their draws and a list per meshlet as well.
+		for (auto& batch : batches)
+		{
+			batch.InstanceStart = range.FirstInstance + range.InstanceCount;
+			batch.BatchIndex = range.FirstBatch + range.BatchCount++;
 
-}
+			UINT meshletDraw = -1;
+			if (batch.MeshletCount > 0)
+			{
+				batch.MeshletDraw = range.FirstMeshletDraw + range.MeshletDrawCount;
+				batch.MeshletInstanceStart = range.FirstMeshletInstance + range.MeshletInstanceCount;
+				range.MeshletDrawCount += batch.MeshletCount;
+				range.MeshletInstanceCount += batch.MeshletCount * (UINT)batch.Instances.size();
+				meshletDraw = batch.MeshletDraw;
+			}
 
-void ShapesApp::BuildFrameResources()
-{
-	for (int i = 0; i < gNumFrameResources; ++i)
+			for (size_t i = 0; i < batch.Instances.size(); ++i)
+			{
+				batch.Instances[i]->InstanceIndex = range.FirstInstance + range.InstanceCount++;
+				batch.Instances[i]->BatchIndex = batch.BatchIndex;
+				batch.Instances[i]->BatchStart = batch.InstanceStart;
+				batch.Instances[i]->MeshletDraw = meshletDraw;
+				mTransforms.MarkDirty(batch.Instances[i]->ObjCBIndex);
+			}
+		}
+
+		assert(range.InstanceCount <= range.InstanceCapacity && range.BatchCount <= range.BatchCapacity);
+		assert(range.MeshletDrawCount <= range.MeshletDrawCapacity && range.MeshletInstanceCount <= range.MeshletInstanceCapacity);
+	}
+
+	// The draw arguments are reset and the visible lists uploaded up to the end of
+	// the furthest range in use.
+	auto rangeEnd = [](UINT first, UINT count) { return count > 0 ? first + count : 0u; };
+	mInstanceCount = 0;
+	mBatchCount = 0;
+	mMeshletDrawCount = 0;
+	mMeshletInstanceCount = 0;
+	for (RenderLayer layer : batchedLayers)
 	{
-		mFrameResources.push_back(std::make_unique<FrameResource>(md3dDevice.Get(),
-			1, (UINT)mAllRitems.size(), (UINT)mMaterials.size()));
+		const BatchRange& range = mBatchRanges[(int)layer];
+		mInstanceCount = MathHelper::Max(mInstanceCount, rangeEnd(range.FirstInstance, range.InstanceCount));
+		mBatchCount = MathHelper::Max(mBatchCount, rangeEnd(range.FirstBatch, range.BatchCount));
+		mMeshletDrawCount = MathHelper::Max(mMeshletDrawCount, rangeEnd(range.FirstMeshletDraw, range.MeshletDrawCount));
+		mMeshletInstanceCount = MathHelper::Max(mMeshletInstanceCount,
+			rangeEnd(range.FirstMeshletInstance, range.MeshletInstanceCount));
 	}
+
+	if (mLayerDirty[(int)RenderLayer::Transparent])
+		mTransparentSorted = false;
+	std::fill(std::begin(mLayerDirty), std::end(mLayerDirty), false);
+	++mBundleGeneration;
 }
 
-void ShapesApp::BuildMaterials()
+void ShapesApp::MarkLayerDirty(RenderLayer layer)
 {
-	auto grass = std::make_unique<Material>();
-	grass->Name = "grass";
-	grass->MatCBIndex = 0;
-	grass->DiffuseSrvHeapIndex = 0;
-	grass->DiffuseAlbedo = XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f);
-	grass->FresnelR0 = XMFLOAT3(0.01f, 0.01f, 0.01f);
-	grass->Roughness = 0.125f;
+	mLayerDirty[(int)layer] = true;
+}
 
-	
-	auto water = std::make_unique<Material>();
-	water->Name = "water";
-	water->MatCBIndex = 1;
-	water->DiffuseSrvHeapIndex = 1;
-	water->DiffuseAlbedo = XMFLOAT4(1.0f, 1.0f, 1.0f, 0.6f);
-	water->FresnelR0 = XMFLOAT3(0.1f, 0.1f, 0.1f);
-	water->Roughness = 0.0f;
-
-	auto wirefence = std::make_unique<Material>();
-	wirefence->Name = "wirefence";
-	wirefence->MatCBIndex = 2;
-	wirefence->DiffuseSrvHeapIndex = 2;
-	wirefence->DiffuseAlbedo = XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f);
-	wirefence->FresnelR0 = XMFLOAT3(0.1f, 0.1f, 0.1f);
-	wirefence->Roughness = 0.25f;
-
-
-	auto wood = std::make_unique<Material>();
-	wood->Name = "wood";
-	wood->MatCBIndex = 3;
-	wood->DiffuseSrvHeapIndex = 3;
-	wood->DiffuseAlbedo = XMFLOAT4(Colors::SandyBrown);
-	wood->FresnelR0 = XMFLOAT3(0.15f, 0.18f, 0.18f);
-	wood->Roughness = 0.25f;
-
-	auto ice = std::make_unique<Material>();
-	ice->Name = "ice";
-	ice->MatCBIndex = 4;
-	ice->DiffuseSrvHeapIndex = 4;
-	ice->DiffuseAlbedo = XMFLOAT4(Colors::LightBlue);
-	ice->FresnelR0 = XMFLOAT3(0.15f, 0.18f, 0.18f);
-	ice->Roughness = 0.25f;
-
-	auto metal = std::make_unique<Material>();
-	metal->Name = "metal";
-	metal->MatCBIndex = 5;
-	metal->DiffuseSrvHeapIndex = 5;
-	metal->DiffuseAlbedo = XMFLOAT4(Colors::DarkGray);
-	metal->FresnelR0 = XMFLOAT3(0.15f, 0.18f, 0.18f);
-	metal->Roughness = 0.25f;
-
-	auto treeSprites = std::make_unique<Material>();
-	treeSprites->Name = "treeSprites";
-	treeSprites->MatCBIndex = 6;
-	treeSprites->DiffuseSrvHeapIndex = 6;
-	treeSprites->DiffuseAlbedo = XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f);
-	treeSprites->FresnelR0 = XMFLOAT3(0.01f, 0.01f, 0.01f);
-	treeSprites->Roughness = 0.125f;
-
-
-	mMaterials["grass"] = std::move(grass);
-	mMaterials["water"] = std::move(water);
-	mMaterials["wirefence"] = std::move(wirefence);
-	mMaterials["wood"] = std::move(wood);
-	mMaterials["ice"] = std::move(ice);
-	mMaterials["metal"] = std::move(metal);
-	mMaterials["treeSprites"] = std::move(treeSprites);
-}
-
-//CREATED FUNCTION FOR RENDERING OBJECTS TO MAKE IT EASIER INTO THE ShapesApp::BuildRenderItems() function.
-void ShapesApp::MakeThing(std::string name, std::string material, RenderLayer type, XMFLOAT3 objectScale, XMFLOAT3 objectPos, XMFLOAT2 textureScale, XMFLOAT3 ObjectRotation)
+// Orders the Transparent batches, an item each, back to front along the first
+// view's camera.  Only when that camera moved or the batches were rebuilt: the
+// transparent items don't move by themselves.  The draws are found through their
+// BatchIndex and InstanceStart, so only the order they are drawn in changes.
+void ShapesApp::SortTransparentBatches()
 {
-	auto item = std::make_unique<RenderItem>();
+	auto& batches = mBatchLayer[(int)RenderLayer::Transparent];
+	if (mWeightedOit || batches.size() < 2)
+		return;
+	if (mTransparentSorted && mTransparentSortVersion == mCamera.GetViewVersion())
+		return;
 
-	item->name = name;
+	mTransparentSorted = true;
+	mTransparentSortVersion = mCamera.GetViewVersion();
 
+	XMVECTOR eye = mCamera.GetPosition();
+	XMVECTOR look = mCamera.GetLook();
 
-	//Collision for maze, detected if the shape is a box and if the material is a "wirefence" (the brick material we made)
-	if (name == "box" && material == "wirefence")
+	// Flipped, so the farthest sorts first.
+	mTransparentSortKeys.resize(batches.size());
+	for (size_t i = 0; i < batches.size(); ++i)
 	{
-		item->box.Center = objectPos;
-		item->box.Extents = XMFLOAT3(objectScale.x * 0.5f, objectScale.y * 0.5f, objectScale.z * 0.5);
+		XMVECTOR center = XMLoadFloat3(&batches[i].Instances.front()->Bounds.Center);
+		float depth = XMVectorGetX(XMVector3Dot(center - eye, look));
+		mTransparentSortKeys[i] = ((std::uint64_t)~RadixSort::FloatKey(depth) << 32) | (std::uint64_t)i;
 	}
-	
-	XMStoreFloat4x4(&item->World, XMMatrixScaling(objectScale.x, objectScale.y, objectScale.z) * XMMatrixRotationRollPitchYaw(ObjectRotation.x * (XM_PI / 180), ObjectRotation.y * (XM_PI / 180), ObjectRotation.z * (XM_PI / 180)) * XMMatrixTranslation(objectPos.x, objectPos.y, objectPos.z));
-	XMStoreFloat4x4(&item->TexTransform, XMMatrixScaling(textureScale.x, textureScale.y, 1.0f));
-	item->ObjCBIndex = objectIndexnumber;
-
-	item->Mat = mMaterials[material].get();
-	item->Geo = mGeometries["shapeGeo"].get();
-	item->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	RadixSort::SortHigh32(mTransparentSortKeys, mTransparentSortScratch);
 
-	item->IndexCount = item->Geo->DrawArgs[name].IndexCount;
-	item->StartIndexLocation = item->Geo->DrawArgs[name].StartIndexLocation;
-	item->BaseVertexLocation = item->Geo->DrawArgs[name].BaseVertexLocation;
+	bool reordered = false;
+	for (size_t i = 0; i < batches.size() && !reordered; ++i)
+		reordered = (size_t)(mTransparentSortKeys[i] & 0xFFFFFFFF) != i;
+	if (!reordered)
+		return;
 
-	mRitemLayer[(int)type].push_back(item.get());
-	mAllRitems.push_back(std::move(item));
+	mTransparentSortBatches.clear();
+	for (std::uint64_t key : mTransparentSortKeys)
+		mTransparentSortBatches.push_back(std::move(batches[(size_t)(key & 0xFFFFFFFF)]));
+	batches.swap(mTransparentSortBatches);
 
-	objectIndexnumber++;
+	// The bundles replay the order they were recorded in.
+	++mBundleGeneration;
 }
 
-
-void ShapesApp::BuildRenderItems()
+void ShapesApp::DrawRenderBatches(DrawStateCache& state, const std::vector<RenderBatch>& batches, size_t first, size_t count,
+	ID3D12Resource* drawArgs, ID3D12Resource* visibleInstances)
 {
-	objectIndexnumber = 0;
-
-	auto treeSpritesRitem = std::make_unique<RenderItem>();
-	treeSpritesRitem->World = MathHelper::Identity4x4();
-	treeSpritesRitem->ObjCBIndex = objectIndexnumber;
-	treeSpritesRitem->Mat = mMaterials["treeSprites"].get();
-	treeSpritesRitem->Geo = mGeometries["treeSpritesGeo"].get();
+	auto cmdList = state.CommandList();
+
+	// The depth pre-pass passes in what the first occlusion phase kept, and the other
+	// views what their own culling did, which is always on the GPU.
+	const bool gpuCulled = (drawArgs != nullptr) || (mCullMode == CullMode::Gpu);
+	if (drawArgs == nullptr)
+		drawArgs = mCurrFrameResource->Views[0].DrawArgs.Get();
+	if (visibleInstances == nullptr)
+		visibleInstances = mCurrFrameResource->Views[0].VisibleInstances.Get();
+
+	// GPU culling writes the visible list into the default heap; CPU culling into the upload heap.
+	D3D12_GPU_VIRTUAL_ADDRESS visibleAddress = gpuCulled ?
+		visibleInstances->GetGPUVirtualAddress() :
+		mVisibleInstanceUpload.GpuAddress;
+
+	// Bundles don't set shading rates; RecordLayerJob keeps the water out of them.
+	const bool bundle = cmdList->GetType() == D3D12_COMMAND_LIST_TYPE_BUNDLE;
+
+	// For each batch in [first, first + count)...
+	for (size_t i = first; i < first + count; ++i)
+	{
+		const RenderBatch& batch = batches[i];
 
-	treeSpritesRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_POINTLIST;
-	treeSpritesRitem->IndexCount = treeSpritesRitem->Geo->DrawArgs["points"].IndexCount;
-	treeSpritesRitem->StartIndexLocation = treeSpritesRitem->Geo->DrawArgs["points"].StartIndexLocation;
-	treeSpritesRitem->BaseVertexLocation = treeSpritesRitem->Geo->DrawArgs["points"].BaseVertexLocation;
+		// Entirely culled on the CPU, so skip the state changes too.
+		if (!gpuCulled && batch.VisibleCount == 0)
+			continue;
 
-	mRitemLayer[(int)RenderLayer::AlphaTestedTreeSprites].push_back(treeSpritesRitem.get());
+		// The waves' detail is in their motion more than in their shading.
+		const bool water = !bundle && (batch.Mat->Flags & MaterialFlagWaves) != 0;
+		if (water)
+			SetShadingRate(cmdList, gWaterShadingRate);
 
-	mAllRitems.push_back(std::move(treeSpritesRitem));
-	
-	objectIndexnumber++;
-
-	/*-------------------- MAZE --------------------*/
-
-	/*-------------------- GRASSY GROUND --------------------*/
-	MakeThing("box", "grass", RenderLayer::Opaque, { 300.0f, 10.0f, 100.0f }, { 0.0f, -5.0f, 20.0f }, { 150.0f, 50.0f });
-	MakeThing("box", "grass", RenderLayer::Opaque, { 300.0f, 10.0f, 100.0f }, { 0.0f, -5.0f, -110.0f }, { 150.0f, 50.0f });
-	MakeThing("box", "grass", RenderLayer::Opaque, { 300.0f, 5.0f, 100.0f }, { 0.0f, -10.0f, -45.0f }, { 150.0f, 50.0f });
-	MakeThing("grid", "water", RenderLayer::Transparent, { 10.0f, 1.0f, 10.0f }, { 0.0f, -0.2f, -45.0f }, { 5.0f, 5.0f });
-
-	/*-------------------- CASTLE WALLS -------------------*/
-	MakeThing("box", "wirefence", RenderLayer::Opaque, { 50.0f, 15.0f, 3.0f }, { 0.0f, 7.5f, 25.0f }, { 5.0f, 5.0f }); //back wall
-	MakeThing("box", "wirefence", RenderLayer::Opaque, { 3.0f, 15.0f, 50.0f }, { 25.0f, 7.5f, 0.0f }, { 5.0f, 5.0f }); //right wall
-	MakeThing("box", "wirefence", RenderLayer::Opaque, { 3.0f, 15.0f, 50.0f }, { -25.0f, 7.5f, 0.0f }, { 5.0f, 5.0f }); //left wall
-	MakeThing("box", "wirefence", RenderLayer::Opaque, { 50.0f, 15.0f, 3.0f }, { 0.0f, 7.5f, -25.0f }, { 5.0f, 5.0f }); //front wall
-
-	/*-------------------- CASTLE CORNERS -------------------*/
-	MakeThing("cylinder", "wirefence", RenderLayer::Opaque, { 5.0f, 6.0f, 5.0f }, { -25.0f, 8.5f, 25.0f }, { 5.0f, 5.0f }); //Back Left
-	MakeThing("cylinder", "wirefence", RenderLayer::Opaque, { 5.0f, 6.0f, 5.0f }, { 25.0f, 8.5f, 25.0f }, { 5.0f, 5.0f }); //Back Right
-	MakeThing("cylinder", "wirefence", RenderLayer::Opaque, { 5.0f, 6.0f, 5.0f }, { -25.0f, 8.5f, -25.0f }, { 5.0f, 5.0f }); //Front Left
-	MakeThing("cylinder", "wirefence", RenderLayer::Opaque, { 5.0f, 6.0f, 5.0f }, { 25.0f, 8.5f, -25.0f }, { 5.0f, 5.0f }); //Front Right
-
-	/*-------------------- CASTLE CORNER TOPS -------------------*/
-	MakeThing("cone", "wirefence", RenderLayer::Opaque, { 6.5f, 4.5f, 6.5f }, { -25.0f, 21.0f, 25.0f }, { 5.0f, 5.0f }); //Back Left
-	MakeThing("cone", "wirefence", RenderLayer::Opaque, { 6.5f, 4.5f, 6.5f }, { 25.0f, 21.0f, 25.0f }, { 5.0f, 5.0f }); //Back Right
-	MakeThing("cone", "wirefence", RenderLayer::Opaque, { 6.5f, 4.5f, 6.5f }, { -25.0f, 21.0f, -25.0f }, { 5.0f, 5.0f }); //Front Left
-	MakeThing("cone", "wirefence", RenderLayer::Opaque, { 6.5f, 4.5f, 6.5f }, { 25.0f, 21.0f, -25.0f }, { 5.0f, 5.0f }); //Front Right
-
-	/*-------------------- CASTLE DOOR -------------------*/
-	MakeThing("squarewindow", "metal", RenderLayer::Opaque, { 10.0f, 10.0f, 10.0f }, { 0.0f, 7.5f, -25.0f }, { 5.0f, 5.0f });
-
-	/*-------------------- DIAMOND & PEDESTAL -------------------*/
-	MakeThing("box", "wirefence", RenderLayer::Opaque, { 1.0f, 5.0f, 1.0f }, { 0.0f, 0.0f, 10.0f }, { 5.0f, 5.0f });
-	MakeThing("diamond", "ice", RenderLayer::Opaque, { 1.0f, 2.5f, 1.0f }, { 0.0f, 4.0f, 10.0f }, { 5.0f, 5.0f });
-
-	/*-------------------- CALTROPS -------------------*/
-	MakeThing("caltrop", "metal", RenderLayer::Opaque, { 0.7f, 0.7f, 0.7f }, { -2.0f, 0.325f, 8.0f }, { 5.0f, 5.0f });
-	MakeThing("caltrop", "metal", RenderLayer::Opaque, { 0.7f, 0.7f, 0.7f }, { 2.0f, 0.325f, 7.2f }, { 5.0f, 5.0f });
-	MakeThing("caltrop", "metal", RenderLayer::Opaque, { 0.7f, 0.7f, 0.7f }, { -1.8f, 0.325f, 10.0f }, { 5.0f, 5.0f });
-	MakeThing("caltrop", "metal", RenderLayer::Opaque, { 0.7f, 0.7f, 0.7f }, { 0.0f, 0.325f, 7.0f }, { 5.0f, 5.0f });
-	MakeThing("caltrop", "metal", RenderLayer::Opaque, { 0.7f, 0.7f, 0.7f }, { 0.6f, 0.325f, 11.0f }, { 5.0f, 5.0f });
-	MakeThing("caltrop", "metal", RenderLayer::Opaque, { 0.7f, 0.7f, 0.7f }, { -0.3f, 0.325f, 14.0f }, { 5.0f, 5.0f });
-	MakeThing("caltrop", "metal", RenderLayer::Opaque, { 0.7f, 0.7f, 0.7f }, { 4.0f, 0.325f, 10.5f }, { 5.0f, 5.0f });
-
-	//right side spikes
-	MakeThing("spike", "wood", RenderLayer::Opaque, { 0.6f, 8.0f, 0.6f }, { 6.0f, 0.0f, -28.0f }, { 5.0f, 5.0f });
-	MakeThing("spike", "wood", RenderLayer::Opaque, { 0.6f, 8.0f, 0.6f }, { 6.0f, 0.0f, -30.25f }, { 5.0f, 5.0f });
-	MakeThing("spike", "wood", RenderLayer::Opaque, { 0.6f, 8.0f, 0.6f }, { 6.0f, 0.0f, -32.5f }, { 5.0f, 5.0f });
-	MakeThing("spike", "wood", RenderLayer::Opaque, { 0.6f, 8.0f, 0.6f }, { 6.0f, 0.0f, -34.75f }, { 5.0f, 5.0f });
-	MakeThing("spike", "wood", RenderLayer::Opaque, { 0.6f, 8.0f, 0.6f }, { 6.0f, 0.0f, -37.0f }, { 5.0f, 5.0f });
-	MakeThing("spike", "wood", RenderLayer::Opaque, { 0.6f, 8.0f, 0.6f }, { 6.0f, 0.0f, -39.25f }, { 5.0f, 5.0f });
-	MakeThing("spike", "wood", RenderLayer::Opaque, { 0.6f, 8.0f, 0.6f }, { 6.0f, 0.0f, -41.5f }, { 5.0f, 5.0f });
-
-	//left side spikes
-	MakeThing("spike", "wood", RenderLayer::Opaque, { 0.6f, 8.0f, 0.6f }, { -6.0f, 0.0f, -28.0f }, { 5.0f, 5.0f });
-	MakeThing("spike", "wood", RenderLayer::Opaque, { 0.6f, 8.0f, 0.6f }, { -6.0f, 0.0f, -30.25f }, { 5.0f, 5.0f });
-	MakeThing("spike", "wood", RenderLayer::Opaque, { 0.6f, 8.0f, 0.6f }, { -6.0f, 0.0f, -32.5f }, { 5.0f, 5.0f });
-	MakeThing("spike", "wood", RenderLayer::Opaque, { 0.6f, 8.0f, 0.6f }, { -6.0f, 0.0f, -34.75f }, { 5.0f, 5.0f });
-	MakeThing("spike", "wood", RenderLayer::Opaque, { 0.6f, 8.0f, 0.6f }, { -6.0f, 0.0f, -37.0f }, { 5.0f, 5.0f });
-	MakeThing("spike", "wood", RenderLayer::Opaque, { 0.6f, 8.0f, 0.6f }, { -6.0f, 0.0f, -39.25f }, { 5.0f, 5.0f });
-	MakeThing("spike", "wood", RenderLayer::Opaque, { 0.6f, 8.0f, 0.6f }, { -6.0f, 0.0f, -41.5f }, { 5.0f, 5.0f });
-
-	/*-------------------- CASTLE DRAWBRIDGE -------------------*/
-	MakeThing("wedge", "wood", RenderLayer::Opaque, { 5.0f, 20.0f, 10.0f }, { 0.0f, -2.0f, -35.0f }, { 5.0f, 5.0f }, { 0.0f, -90.0f, 90.0f });
-	MakeThing("wedge", "wood", RenderLayer::Opaque, { 5.0f, 20.0f, 10.0f }, { 0.0f, -2.0f, -55.1f }, { 5.0f, 5.0f }, { 0.0f, 90.0f, 90.0f });
-
-	/*------------------------ HEDGE MAZE ----------------------*/
-	MakeThing("box", "wirefence", RenderLayer::Opaque, {1.0f, 15.0f, 100.0f}, {-25.0f, 7.5f, -110.0f}, {5.0f, 5.0f}); //left outer wall
-	MakeThing("box", "wirefence", RenderLayer::Opaque, { 1.0f, 15.0f, 100.0f }, { 25.0f, 7.5f, -110.0f }, { 5.0f, 5.0f }); //right outer wall
-	MakeThing("box", "wirefence", RenderLayer::Opaque, { 20.0f, 15.0f, 1.0f }, { -15.0f, 7.5f, -160.0f }, { 5.0f, 5.0f }); //back left outer wall
-	MakeThing("box", "wirefence", RenderLayer::Opaque, { 20.0f, 15.0f, 1.0f }, { 15.0f, 7.5f, -160.0f }, { 5.0f, 5.0f }); //back right outer wall
-	MakeThing("box", "wirefence", RenderLayer::Opaque, { 20.0f, 15.0f, 1.0f }, { -15.0f, 7.5f, -60.0f }, { 5.0f, 5.0f }); //outer wall closest to castle, left side
-	MakeThing("box", "wirefence", RenderLayer::Opaque, { 20.0f, 15.0f, 1.0f }, { 15.0f, 7.5f, -60.0f }, { 5.0f, 5.0f }); //outer wall closest to castle, right side
-
-	/*--------------------- INNER HEDGE MAZE -------------------*/
-	MakeThing("box", "wirefence", RenderLayer::Opaque, { 1.0f, 15.0f, 10.0f }, { -5.5f, 7.5f, -155.0f }, { 5.0f, 5.0f }); //entrance left wall
-	MakeThing("box", "wirefence", RenderLayer::Opaque, { 1.0f, 15.0f, 10.0f }, { 5.5f, 7.5f, -155.0f }, { 5.0f, 5.0f }); //entrance right wall
-
-	MakeThing("box", "wirefence", RenderLayer::Opaque, { 10.0f, 15.0f, 1.0f }, { -10.0f, 7.5f, -150.0f }, { 5.0f, 5.0f }); //1
-	MakeThing("box", "wirefence", RenderLayer::Opaque, { 1.0f, 15.0f, 50.0f }, { -20.0f, 7.5f, -135.0f }, { 5.0f, 5.0f }); //2
-	MakeThing("box", "wirefence", RenderLayer::Opaque, { 30.0f, 15.0f, 1.0f }, { -5.5f, 7.5f, -120.0f }, { 5.0f, 5.0f }); //3
-	
-	MakeThing("box", "wirefence", RenderLayer::Opaque, { 20.0f, 15.0f, 1.0f }, { -2.25f, 7.5f, -130.0f }, { 5.0f, 5.0f }); //4 
-	MakeThing("box", "wirefence", RenderLayer::Opaque, { 1.0f, 15.0f, 12.5f }, { 7.5f, 7.5f, -135.7f }, { 5.0f, 5.0f }); // 5
-	MakeThing("box", "wirefence", RenderLayer::Opaque, { 20.0f, 15.0f, 1.0f }, { 15.0f, 7.5f, -141.5f }, { 5.0f, 5.0f }); // 6
+		state.SetVertexBuffer(batch.Geo->VertexBufferView());
+		if (gLightmaps)
+		{
+			// Geometry without lightmap UVs reads zeros, and its instances no slice.
+			state.SetVertexBuffer(batch.Geo->LightmapUVBufferGPU != nullptr ?
+				batch.Geo->LightmapUVBufferView() : D3D12_VERTEX_BUFFER_VIEW{}, 1);
+		}
+		state.SetIndexBuffer(batch.Geo->IndexBufferView());
+		state.SetPrimitiveTopology(batch.PrimitiveType);
 
-	MakeThing("box", "wirefence", RenderLayer::Opaque, { 1.0f, 15.0f, 10.0f }, { 10.0f, 7.5f, -114.5f }, { 5.0f, 5.0f }); // 7
-	MakeThing("box", "wirefence", RenderLayer::Opaque, { 1.0f, 15.0f, 25.0f }, { 17.5f, 7.5f, -130.0f }, { 5.0f, 5.0f }); // 8
-	//MakeThing("box", "wirefence", RenderLayer::Opaque, { 15.0f, 15.0f, 1.0f }, { 5.0f, 7.5f, -115.5f }, { 5.0f, 5.0f }); // 9
+		state.SetGraphicsRoot32BitConstants((UINT)RootParameter::DrawConstants, 0, (UINT)batch.Mat->MatCBIndex);
 
-	MakeThing("box", "wirefence", RenderLayer::Opaque, { 1.0f, 15.0f, 10.0f }, { -3.0f, 7.5f, -105.0f }, { 5.0f, 5.0f }); // 10
-	MakeThing("box", "wirefence", RenderLayer::Opaque, { 27.5f, 15.0f, 1.0f }, { 11.0f, 7.5f, -102.5f }, { 5.0f, 5.0f }); // 11
-	MakeThing("box", "wirefence", RenderLayer::Opaque, { 30.0f, 15.0f, 1.0f }, { -10.0f, 7.5f, -90.0f }, { 5.0f, 5.0f }); // 12
+		// Each meshlet draw sets gObjectIndex to its own list, counted from the start of
+		// the meshlet lists, and then leaves the constant changed behind the cache.
+		if (gpuCulled && batch.MeshletCount > 0)
+		{
+			state.SetGraphicsRootShaderResourceView((UINT)RootParameter::VisibleInstances,
+				visibleAddress + mInstanceCapacity * sizeof(UINT));
+			cmdList->ExecuteIndirect(mMeshletDrawSignature.Get(), batch.MeshletCount, drawArgs,
+				mBatchCapacity * sizeof(D3D12_DRAW_INDEXED_ARGUMENTS) + batch.MeshletDraw * sizeof(MeshletDrawArguments), nullptr, 0);
+			state.InvalidateRootArgument((UINT)RootParameter::DrawConstants);
+			continue;
+		}
 
-	MakeThing("box", "wirefence", RenderLayer::Opaque, { 1.0f, 15.0f, 20.0f }, { 15.0f, 7.5f, -85.0f }, { 5.0f, 5.0f }); // 13
-	MakeThing("box", "wirefence", RenderLayer::Opaque, { 35.0f, 15.0f, 1.0f }, {7.5f, 7.5f, -75.0f }, { 5.0f, 5.0f }); // 14
-	MakeThing("box", "wirefence", RenderLayer::Opaque, { 1.0f, 15.0f, 10.0f }, {-5.0f, 7.5f, -65.0f }, { 5.0f, 5.0f }); // 15
+		// SV_InstanceID starts at zero for every draw, so offset the root SRV to the batch's visible list.
+		D3D12_GPU_VIRTUAL_ADDRESS batchVisibleAddress = visibleAddress + batch.InstanceStart * sizeof(UINT);
+		state.SetGraphicsRootShaderResourceView((UINT)RootParameter::VisibleInstances, batchVisibleAddress);
 
-	MakeThing("box", "wirefence", RenderLayer::Opaque, { 10.0f, 15.0f, 1.0f }, {-2.5f, 7.5f, -70.0f }, { 5.0f, 5.0f }); // 16
+		if (gpuCulled)
+		{
+			cmdList->ExecuteIndirect(mDrawIndexedSignature.Get(), 1, drawArgs,
+				batch.BatchIndex * sizeof(D3D12_DRAW_INDEXED_ARGUMENTS), nullptr, 0);
+		}
+		else
+		{
+			cmdList->DrawIndexedInstanced(batch.IndexCount, batch.VisibleCount, batch.StartIndexLocation, batch.BaseVertexLocation, 0);
+		}
 
+		// Never drawn by meshlets, so it always gets here.
+		if (water)
+			SetShadingRate(cmdList, D3D12_SHADING_RATE_1X1);
+	}
 }
-// std::string name, std::string material, RenderLayer type, XMFLOAT3 objectScale, XMFLOAT3 objectPos, XMFLOAT2 textureScale, XMFLOAT3 ObjectRotation
 
-void ShapesApp::DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<RenderItem*>& ritems)
+void ShapesApp::DrawTrees(DrawStateCache& state, UINT view)
 {
-	UINT objCBByteSize = d3dUtil::CalcConstantBufferByteSize(sizeof(ObjectConstants));
-	UINT matCBByteSize = d3dUtil::CalcConstantBufferByteSize(sizeof(MaterialConstants));
-
-	auto objectCB = mCurrFrameResource->ObjectCB->Resource();
-	auto matCB = mCurrFrameResource->MaterialCB->Resource();
+	const auto& treeTiles = mRitemLayer[(int)RenderLayer::AlphaTestedTreeSprites];
+	if (treeTiles.empty())
+		return;
+
+	// Every tile shares the sprite material, and the positions are already in world
+	// space, so all the trees go out in one instanced strip draw.
+	state.SetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
+	state.SetGraphicsRoot32BitConstants((UINT)RootParameter::DrawConstants, 0, (UINT)treeTiles.front()->Mat->MatCBIndex);
+	const FrameResource::ViewBuffers& buffers = mCurrFrameResource->Views[view];
+	state.SetGraphicsRootShaderResourceView((UINT)RootParameter::VisibleInstances, buffers.VisibleTrees->GetGPUVirtualAddress());
+
+	state.CommandList()->ExecuteIndirect(mDrawSignature.Get(), 1, buffers.TreeDrawArgs.Get(), 0, nullptr, 0);
+}
 
-	// For each render item...
-	for (size_t i = 0; i < ritems.size(); ++i)
+// Renders every cluster into its slices, all frames of an item in one instanced
+// draw, with this frame's materials.  Runs once, ahead of the frame's passes, which
+// set their own targets and bindings again.
+void ShapesApp::BakeImpostors(ID3D12GraphicsCommandList* cmdList)
+{
+	GpuEvent event(cmdList, "impostor bake");
+
+	UploadRingBuffer::Allocation instances = mUploadRing->Allocate(mImpostorBakeDraws.size() * sizeof(InstanceData));
+	InstanceData* instanceData = static_cast<InstanceData*>(instances.CpuAddress);
+	for (size_t i = 0; i < mImpostorBakeDraws.size(); ++i)
+		instanceData[i] = mImpostorBakeDraws[i].Instance;
+
+	const D3D12_VIEWPORT viewport = { 0.0f, 0.0f, (float)gImpostorAtlasSize, (float)gImpostorAtlasSize, 0.0f, 1.0f };
+	const D3D12_RECT scissorRect = { 0, 0, (LONG)gImpostorAtlasSize, (LONG)gImpostorAtlasSize };
+	cmdList->RSSetViewports(1, &viewport);
+	cmdList->RSSetScissorRects(1, &scissorRect);
+	cmdList->SetGraphicsRootSignature(mRootSignature.Get());
+
+	DrawStateCache state(cmdList);
+	state.SetPipelineState(GetPipeline(PipelineId::ImpostorBake));
+	state.SetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	state.SetGraphicsRootShaderResourceView((UINT)RootParameter::InstanceData, instances.GpuAddress);
+	state.SetGraphicsRootShaderResourceView((UINT)RootParameter::MaterialData, mCurrFrameResource->MaterialBuffer->Resource()->GetGPUVirtualAddress());
+	state.SetGraphicsRootDescriptorTable((UINT)RootParameter::Textures, mSrvHeap->GpuHandle(0));
+
+	// Uncovered texels keep alpha 0, which the impostors clip.
+	const float clearColor[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	const D3D12_CPU_DESCRIPTOR_HANDLE depthStencilView = mImpostorDsvHeap->GetCPUDescriptorHandleForHeapStart();
+	for (UINT c = 0; c < (UINT)mImpostorClusters.size(); ++c)
 	{
-		auto ri = ritems[i];
-
-		cmdList->IASetVertexBuffers(0, 1, &ri->Geo->VertexBufferView());
-		cmdList->IASetIndexBuffer(&ri->Geo->IndexBufferView());
-		cmdList->IASetPrimitiveTopology(ri->PrimitiveType);
-
-		CD3DX12_GPU_DESCRIPTOR_HANDLE tex(mSrvDescriptorHeap->GetGPUDescriptorHandleForHeapStart());
-		tex.Offset(ri->Mat->DiffuseSrvHeapIndex, mCbvSrvDescriptorSize);
-
-		D3D12_GPU_VIRTUAL_ADDRESS objCBAddress = objectCB->GetGPUVirtualAddress() + ri->ObjCBIndex * objCBByteSize;
-		D3D12_GPU_VIRTUAL_ADDRESS matCBAddress = matCB->GetGPUVirtualAddress() + ri->Mat->MatCBIndex * matCBByteSize;
+		const ImpostorCluster& cluster = mImpostorClusters[c];
+		CD3DX12_CPU_DESCRIPTOR_HANDLE albedoView(mImpostorRtvHeap->GetCPUDescriptorHandleForHeapStart(), 2 * c, mRtvDescriptorSize);
+		const D3D12_CPU_DESCRIPTOR_HANDLE targets[2] = { albedoView, CD3DX12_CPU_DESCRIPTOR_HANDLE(albedoView, 1, mRtvDescriptorSize) };
+		cmdList->ClearRenderTargetView(targets[0], clearColor, 0, nullptr);
+		cmdList->ClearRenderTargetView(targets[1], clearColor, 0, nullptr);
+		cmdList->ClearDepthStencilView(depthStencilView, D3D12_CLEAR_FLAG_DEPTH, 1.0f, 0, 0, nullptr);
+		cmdList->OMSetRenderTargets(2, targets, false, &depthStencilView);
+
+		for (UINT i = 0; i < (UINT)cluster.Items.size(); ++i)
+		{
+			const UINT drawIndex = cluster.FirstBakeDraw + i;
+			const ImpostorBakeDraw& draw = mImpostorBakeDraws[drawIndex];
+			state.SetVertexBuffer(draw.Geo->VertexBufferView());
+			state.SetIndexBuffer(draw.Geo->IndexBufferView());
+			state.SetGraphicsRoot32BitConstants((UINT)RootParameter::DrawConstants, drawIndex, (UINT)draw.Mat->MatCBIndex);
+			cmdList->DrawIndexedInstanced(draw.IndexCount, gImpostorFrames * gImpostorFrames,
+				draw.StartIndexLocation, draw.BaseVertexLocation, 0);
+		}
+	}
 
-		cmdList->SetGraphicsRootDescriptorTable(0, tex);
-		cmdList->SetGraphicsRootConstantBufferView(1, objCBAddress);
-		cmdList->SetGraphicsRootConstantBufferView(3, matCBAddress);
+	cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mImpostorAtlas.Get(),
+		D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE));
+	mImpostorsBaked = true;
+}
 
-		cmdList->DrawIndexedInstanced(ri->IndexCount, 1, ri->StartIndexLocation, ri->BaseVertexLocation, 0);
-	}
+// Every loaded tile's distant clusters in one instanced strip draw, the quads built
+// from UpdateImpostors' list.  The list follows the first camera and isn't culled;
+// it is short, and the quads out of view are clipped.
+void ShapesApp::DrawImpostors(DrawStateCache& state)
+{
+	if (mImpostorCount == 0)
+		return;
+
+	state.SetPipelineState(GetPipeline(PipelineId::Impostor));
+	state.SetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
+	state.SetGraphicsRoot32BitConstants((UINT)RootParameter::DrawConstants, 0, mImpostorSrvIndex);
+	state.SetGraphicsRootShaderResourceView((UINT)RootParameter::VisibleInstances, mImpostorUpload.GpuAddress);
+	state.CommandList()->DrawInstanced(4, mImpostorCount, 0, 0);
 }
 
-std::array<const CD3DX12_STATIC_SAMPLER_DESC, 6> ShapesApp::GetStaticSamplers()
+std::array<const CD3DX12_STATIC_SAMPLER_DESC, 7> ShapesApp::GetStaticSamplers()
 {
 	// Applications usually only need a handful of samplers.  So just define them all up front
 	// and keep them available as part of the root signature.  
@@ -1561,8 +7709,21 @@ std::array<const CD3DX12_STATIC_SAMPLER_DESC, 6> ShapesApp::GetStaticSamplers()
 		0.0f,                              // mipLODBias
 		8);                                // maxAnisotropy
 
+	// Compares against the shadow map; outside it everything is lit.
+	const CD3DX12_STATIC_SAMPLER_DESC shadow(
+		6, // shaderRegister
+		D3D12_FILTER_COMPARISON_MIN_MAG_LINEAR_MIP_POINT, // filter
+		D3D12_TEXTURE_ADDRESS_MODE_BORDER,  // addressU
+		D3D12_TEXTURE_ADDRESS_MODE_BORDER,  // addressV
+		D3D12_TEXTURE_ADDRESS_MODE_BORDER,  // addressW
+		0.0f,                               // mipLODBias
+		16,                                 // maxAnisotropy
+		D3D12_COMPARISON_FUNC_LESS_EQUAL,
+		D3D12_STATIC_BORDER_COLOR_OPAQUE_WHITE);
+
 	return {
 		pointWrap, pointClamp,
 		linearWrap, linearClamp,
-		anisotropicWrap, anisotropicClamp };
+		anisotropicWrap, anisotropicClamp,
+		shadow };
 }
\ No newline at end of file
@@ -0,0 +1,449 @@
+//***************************************************************************************
+// Benchmark.cpp
+//***************************************************************************************
+
+#include "Benchmark.h"
+#include <algorithm>
+#include <sstream>
+
+using namespace DirectX;
+
+namespace
+{
+	// Whole string as a number, so "-frames 2x" is rejected rather than read as 2.
+	bool ParseUInt(const std::string& text, UINT& value)
+	{
+		std::istringstream in(text);
+		in >> value;
+		return !in.fail() && in.eof();
+	}
+
+	bool ParseFloat(const std::string& text, float& value)
+	{
+		std::istringstream in(text);
+		in >> value;
+		return !in.fail() && in.eof();
+	}
+
+	bool ParseGrid(const std::string& columns, const std::string& rows, BenchmarkSettings& settings)
+	{
+		return ParseUInt(columns, settings.GridColumns) && settings.GridColumns > 0 &&
+			ParseUInt(rows, settings.GridRows) && settings.GridRows > 0;
+	}
+
+	std::string Trim(const std::string& text)
+	{
+		size_t first = text.find_first_not_of(" \t\r\n");
+		if(first == std::string::npos)
+			return std::string();
+
+		size_t last = text.find_last_not_of(" \t\r\n");
+		return text.substr(first, last - first + 1);
+	}
+
+	// Splits on spaces; double quotes group a path containing spaces.
+	std::vector<std::string> Tokenize(const std::string& cmdLine)
+	{
+		std::vector<std::string> tokens;
+		std::string token;
+		bool quoted = false;
+		bool inToken = false;
+
+		for(char c : cmdLine)
+		{
+			if(c == '"')
+			{
+				quoted = !quoted;
+				inToken = true;
+			}
+			else if((c == ' ' || c == '\t') && !quoted)
+			{
+				if(inToken)
+					tokens.push_back(token);
+				token.clear();
+				inToken = false;
+			}
+			else
+			{
+				token += c;
+				inToken = true;
+			}
+		}
+
+		if(inToken)
+			tokens.push_back(token);
+
+		return tokens;
+	}
+}
+
+bool ParseBenchmarkSettings(const std::string& cmdLine, BenchmarkSettings& settings)
+{
+	std::vector<std::string> tokens = Tokenize(cmdLine);
+
+	for(size_t i = 0; i < tokens.size(); ++i)
+	{
+		const std::string& option = tokens[i];
+		bool hasValue = i + 1 < tokens.size();
+
+		if(option == "-benchmark")
+		{
+			settings.Enabled = true;
+		}
+		else if(option == "-nopresent")
+		{
+			settings.Present = false;
+		}
+		else if(option == "-frames" && hasValue)
+		{
+			if(!ParseUInt(tokens[++i], settings.FrameCount))
+				return false;
+		}
+		else if(option == "-warmup" && hasValue)
+		{
+			if(!ParseUInt(tokens[++i], settings.WarmupFrames))
+				return false;
+		}
+		else if(option == "-dt" && hasValue)
+		{
+			if(!ParseFloat(tokens[++i], settings.FixedDeltaTime) || settings.FixedDeltaTime <= 0.0f)
+				return false;
+		}
+		else if(option == "-out" && hasValue)
+		{
+			settings.OutputFile = tokens[++i];
+		}
+		else if(option == "-grid" && i + 2 < tokens.size())
+		{
+			if(!ParseGrid(tokens[i + 1], tokens[i + 2], settings))
+				return false;
+			i += 2;
+		}
+		else if(option == "-presentmode" && hasValue)
+		{
+			if(!ParsePresentMode(tokens[++i], settings.Presentation))
+				return false;
+		}
+		else if(option == "-aa" && hasValue)
+		{
+			if(!ParseAntiAliasing(tokens[++i], settings.AntiAliasingMode))
+				return false;
+		}
+		else if(option == "-dynres" && hasValue)
+		{
+			if(!ParseFloat(tokens[++i], settings.DynamicResolutionMs) || settings.DynamicResolutionMs < 0.0f)
+				return false;
+		}
+		else if(option == "-latency" && hasValue)
+		{
+			if(!ParseUInt(tokens[++i], settings.FramesInFlight) || settings.FramesInFlight == 0)
+				return false;
+		}
+		else if(option == "-rays" && hasValue)
+		{
+			if(!ParseUInt(tokens[++i], settings.RayQueries))
+				return false;
+		}
+		else if(option == "-config" && hasValue)
+		{
+			if(!LoadBenchmarkConfig(tokens[++i], settings))
+				return false;
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool LoadBenchmarkConfig(const std::string& filename, BenchmarkSettings& settings)
+{
+	std::ifstream fin(filename);
+	if(!fin)
+		return false;
+
+	std::string line;
+	while(std::getline(fin, line))
+	{
+		line = Trim(line.substr(0, line.find('#')));
+		if(line.empty())
+			continue;
+
+		size_t equals = line.find('=');
+		if(equals == std::string::npos)
+			return false;
+
+		std::string key = Trim(line.substr(0, equals));
+		std::string value = Trim(line.substr(equals + 1));
+
+		bool ok = true;
+		if(key == "frames")
+		{
+			ok = ParseUInt(value, settings.FrameCount);
+		}
+		else if(key == "warmup")
+		{
+			ok = ParseUInt(value, settings.WarmupFrames);
+		}
+		else if(key == "dt")
+		{
+			ok = ParseFloat(value, settings.FixedDeltaTime) && settings.FixedDeltaTime > 0.0f;
+		}
+		else if(key == "present")
+		{
+			ok = value == "0" || value == "1";
+			settings.Present = value == "1";
+		}
+		else if(key == "presentmode")
+		{
+			ok = ParsePresentMode(value, settings.Presentation);
+		}
+		else if(key == "aa")
+		{
+			ok = ParseAntiAliasing(value, settings.AntiAliasingMode);
+		}
+		else if(key == "dynres")
+		{
+			ok = ParseFloat(value, settings.DynamicResolutionMs) && settings.DynamicResolutionMs >= 0.0f;
+		}
+		else if(key == "out")
+		{
+			settings.OutputFile = value;
+		}
+		else if(key == "latency")
+		{
+			ok = ParseUInt(value, settings.FramesInFlight) && settings.FramesInFlight > 0;
+		}
+		else if(key == "rays")
+		{
+			ok = ParseUInt(value, settings.RayQueries);
+		}
+		else if(key == "grid")
+		{
+			std::string columns, rows, extra;
+			std::istringstream in(value);
+			in >> columns >> rows;
+			ok = !in.fail() && !(in >> extra) && ParseGrid(columns, rows, settings);
+		}
+		else if(key == "waypoint")
+		{
+			CameraWaypoint waypoint;
+			std::istringstream in(value);
+			in >> waypoint.Position.x >> waypoint.Position.y >> waypoint.Position.z
+			   >> waypoint.Target.x >> waypoint.Target.y >> waypoint.Target.z;
+			ok = !in.fail();
+			settings.Path.push_back(waypoint);
+		}
+		else
+		{
+			ok = false;
+		}
+
+		if(!ok)
+			return false;
+	}
+
+	return true;
+}
+
+const char* PresentModeName(PresentMode mode)
+{
+	static const char* names[] = { "vsync", "immediate", "tearing" };
+	static_assert(_countof(names) == (size_t)PresentMode::Count, "One name per present mode.");
+	return names[(int)mode];
+}
+
+bool ParsePresentMode(const std::string& name, PresentMode& mode)
+{
+	for(int i = 0; i < (int)PresentMode::Count; ++i)
+	{
+		if(name == PresentModeName((PresentMode)i))
+		{
+			mode = (PresentMode)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char* AntiAliasingName(AntiAliasing mode)
+{
+	static const char* names[] = { "none", "msaa4x", "fxaa" };
+	static_assert(_countof(names) == (size_t)AntiAliasing::Count, "One name per anti-aliasing mode.");
+	return names[(int)mode];
+}
+
+bool ParseAntiAliasing(const std::string& name, AntiAliasing& mode)
+{
+	for(int i = 0; i < (int)AntiAliasing::Count; ++i)
+	{
+		if(name == AntiAliasingName((AntiAliasing)i))
+		{
+			mode = (AntiAliasing)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+CameraPath::CameraPath(const std::vector<CameraWaypoint>& waypoints, float duration) :
+	mWaypoints(waypoints),
+	mDuration(duration)
+{
+	assert(!mWaypoints.empty());
+}
+
+void CameraPath::Sample(float t, XMFLOAT3& position, XMFLOAT3& target)const
+{
+	if(mWaypoints.size() == 1 || mDuration <= 0.0f)
+	{
+		position = mWaypoints.front().Position;
+		target = mWaypoints.front().Target;
+		return;
+	}
+
+	int segmentCount = (int)mWaypoints.size() - 1;
+	float s = MathHelper::Clamp(t / mDuration, 0.0f, 1.0f) * segmentCount;
+	int segment = MathHelper::Min((int)s, segmentCount - 1);
+	float u = s - segment;
+
+	// The end points are repeated so the curve starts and stops on them.
+	int i0 = MathHelper::Max(segment - 1, 0);
+	int i1 = segment;
+	int i2 = segment + 1;
+	int i3 = MathHelper::Min(segment + 2, segmentCount);
+
+	XMStoreFloat3(&position, XMVectorCatmullRom(
+		XMLoadFloat3(&mWaypoints[i0].Position), XMLoadFloat3(&mWaypoints[i1].Position),
+		XMLoadFloat3(&mWaypoints[i2].Position), XMLoadFloat3(&mWaypoints[i3].Position), u));
+
+	XMStoreFloat3(&target, XMVectorCatmullRom(
+		XMLoadFloat3(&mWaypoints[i0].Target), XMLoadFloat3(&mWaypoints[i1].Target),
+		XMLoadFloat3(&mWaypoints[i2].Target), XMLoadFloat3(&mWaypoints[i3].Target), u));
+}
+
+float CameraPath::Duration()const
+{
+	return mDuration;
+}
+
+void BenchmarkLog::Capture(const GpuProfiler& profiler, UINT64 firstFrame)
+{
+	if(mScopes.empty())
+	{
+		for(UINT i = 0; i < profiler.ScopeCount(); ++i)
+		{
+			ScopeInfo scope;
+			scope.Name = profiler.ScopeName(i);
+			scope.Gpu = profiler.IsGpuScope(i);
+			scope.Counter = profiler.IsCounter(i);
+			mScopes.push_back(scope);
+		}
+	}
+
+	// BeginFrame only collects once a slot has come round, so the first few calls
+	// have nothing new.
+	if(profiler.CollectedFrameCount() == mLastCollected)
+		return;
+	mLastCollected = profiler.CollectedFrameCount();
+
+	if(profiler.LastFrameNumber() < firstFrame)
+		return;
+
+	FrameTimes frame;
+	frame.FrameNumber = profiler.LastFrameNumber();
+	frame.Ms = profiler.LastFrameTimes();
+	mFrames.push_back(std::move(frame));
+}
+
+UINT BenchmarkLog::FrameCount()const
+{
+	return (UINT)mFrames.size();
+}
+
+bool BenchmarkLog::WriteJson(const std::string& filename, const BenchmarkSettings& settings, UINT objectCount)const
+{
+	std::ofstream fout(filename, std::ios::out | std::ios::trunc);
+	if(!fout)
+		return false;
+
+	fout << "{\n";
+	fout << "  \"settings\": { \"frames\": " << settings.FrameCount
+		 << ", \"warmup\": " << settings.WarmupFrames
+		 << ", \"dt\": " << settings.FixedDeltaTime
+		 << ", \"present\": " << (settings.Present ? "true" : "false")
+		 << ", \"presentMode\": \"" << PresentModeName(settings.Presentation) << "\""
+		 << ", \"aa\": \"" << AntiAliasingName(settings.AntiAliasingMode) << "\""
+		 << ", \"dynres\": " << settings.DynamicResolutionMs
+		 << ", \"grid\": [" << settings.GridColumns << ", " << settings.GridRows << "]"
+		 << ", \"latency\": " << settings.FramesInFlight
+		 << ", \"rays\": " << settings.RayQueries
+		 << ", \"objects\": " << objectCount << " },\n";
+
+	fout << "  \"scopes\": [";
+	for(size_t i = 0; i < mScopes.size(); ++i)
+	{
+		fout << (i == 0 ? "\n" : ",\n");
+		fout << "    { \"name\": \"" << mScopes[i].Name << "\", \"type\": \""
+			 << (mScopes[i].Gpu ? "gpu" : (mScopes[i].Counter ? "count" : "cpu")) << "\" }";
+	}
+	fout << "\n  ],\n";
+
+	// Summaries over the whole run, not the profiler's rolling window.
+	fout << "  \"summary\": [";
+	std::vector<float> samples;
+	for(size_t i = 0; i < mScopes.size(); ++i)
+	{
+		samples.clear();
+		for(const auto& frame : mFrames)
+		{
+			if(i < frame.Ms.size() && frame.Ms[i] >= 0.0f)
+				samples.push_back(frame.Ms[i]);
+		}
+
+		fout << (i == 0 ? "\n" : ",\n");
+		fout << "    { \"name\": \"" << mScopes[i].Name << "\", \"samples\": " << samples.size();
+
+		if(!samples.empty())
+		{
+			std::sort(samples.begin(), samples.end());
+
+			float sum = 0.0f;
+			for(float ms : samples)
+				sum += ms;
+
+			size_t p99 = (samples.size() * 99 + 99) / 100 - 1;
+
+			fout << ", \"min\": " << samples.front()
+				 << ", \"avg\": " << sum / samples.size()
+				 << ", \"max\": " << samples.back()
+				 << ", \"p99\": " << samples[p99];
+		}
+		fout << " }";
+	}
+	fout << "\n  ],\n";
+
+	fout << "  \"frames\": [";
+	for(size_t f = 0; f < mFrames.size(); ++f)
+	{
+		fout << (f == 0 ? "\n" : ",\n");
+		fout << "    { \"frame\": " << mFrames[f].FrameNumber << ", \"ms\": [";
+		for(size_t i = 0; i < mFrames[f].Ms.size(); ++i)
+		{
+			if(i > 0)
+				fout << ", ";
+
+			if(mFrames[f].Ms[i] >= 0.0f)
+				fout << mFrames[f].Ms[i];
+			else
+				fout << "null";
+		}
+		fout << "] }";
+	}
+	fout << "\n  ]\n";
+	fout << "}\n";
+
+	return fout.good();
+}
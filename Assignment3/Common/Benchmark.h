@@ -0,0 +1,129 @@
+//***************************************************************************************
+// Benchmark.h
+//
+// Deterministic benchmark runs.
+//   -BenchmarkSettings come from the command line, optionally extended by a config
+//    file of "key = value" lines:
+//        -benchmark            run the benchmark instead of the interactive app
+//        -frames N             frames to record (default 2000)
+//        -warmup N             frames to run before recording (default 60)
+//        -dt S                 fixed timestep in seconds (default 1/60)
+//        -nopresent            render but never present; GPU timings without vsync
+//        -presentmode M        vsync, immediate (default) or tearing; also
+//                              honoured without -benchmark
+//        -aa M                 none (default), msaa4x or fxaa; also honoured
+//                              without -benchmark
+//        -dynres MS            scale the render resolution to keep the GPU frame
+//                              under MS milliseconds (default 0: off); also
+//                              honoured without -benchmark
+//        -out FILE             JSON output (default benchmark.json)
+//        -grid N M             tile the scene N across and M deep (default 1 1);
+//                              also honoured without -benchmark
+//        -latency N            frames the CPU may run ahead of the GPU (default:
+//                              as many as there are frame resources); also
+//                              honoured without -benchmark
+//        -rays N               line-of-sight rays to cast each frame through the
+//                              scene's ray BVH (default 0); also honoured without
+//                              -benchmark
+//        -config FILE          frames, warmup, dt, present, presentmode, aa, dynres,
+//                              out, latency, rays, "grid = N M" and
+//                              any number of "waypoint = x y z tx ty tz" lines
+//   -CameraPath is a Catmull-Rom spline through the waypoints, sampled by time, so
+//    the same frame always sees the same view.
+//   -BenchmarkLog copies the per-frame timings out of a GpuProfiler and writes them,
+//    with per-scope summaries, as JSON.
+//***************************************************************************************
+
+#pragma once
+
+#include "GpuProfiler.h"
+
+struct CameraWaypoint
+{
+	DirectX::XMFLOAT3 Position;
+	DirectX::XMFLOAT3 Target;
+};
+
+struct BenchmarkSettings
+{
+	bool Enabled = false;
+	UINT FrameCount = 2000;
+	UINT WarmupFrames = 60;
+	float FixedDeltaTime = 1.0f / 60.0f;
+	bool Present = true;
+	PresentMode Presentation = PresentMode::Immediate;
+	AntiAliasing AntiAliasingMode = AntiAliasing::None;
+	float DynamicResolutionMs = 0.0f;
+	std::string OutputFile = "benchmark.json";
+	UINT GridColumns = 1;
+	UINT GridRows = 1;
+
+	// 0 leaves it to the application.
+	UINT FramesInFlight = 0;
+
+	// Line-of-sight rays a frame; 0 casts none.
+	UINT RayQueries = 0;
+
+	// Empty means the application's default path.
+	std::vector<CameraWaypoint> Path;
+};
+
+// Returns false, leaving the settings partly filled, when a value is malformed or the
+// config file cannot be read.
+bool ParseBenchmarkSettings(const std::string& cmdLine, BenchmarkSettings& settings);
+bool LoadBenchmarkConfig(const std::string& filename, BenchmarkSettings& settings);
+
+// "vsync", "immediate" and "tearing".
+const char* PresentModeName(PresentMode mode);
+bool ParsePresentMode(const std::string& name, PresentMode& mode);
+
+// "none", "msaa4x" and "fxaa".
+const char* AntiAliasingName(AntiAliasing mode);
+bool ParseAntiAliasing(const std::string& name, AntiAliasing& mode);
+
+class CameraPath
+{
+public:
+	CameraPath() = default;
+	CameraPath(const std::vector<CameraWaypoint>& waypoints, float duration);
+
+	// t in seconds; clamped to [0, duration].  Waypoints are evenly spaced in time.
+	void Sample(float t, DirectX::XMFLOAT3& position, DirectX::XMFLOAT3& target)const;
+
+	float Duration()const;
+
+private:
+	std::vector<CameraWaypoint> mWaypoints;
+	float mDuration = 0.0f;
+};
+
+class BenchmarkLog
+{
+public:
+	// Call after each GpuProfiler::BeginFrame(); records the frame it collected, if any
+	// and if it is not numbered before firstFrame.
+	void Capture(const GpuProfiler& profiler, UINT64 firstFrame = 0);
+
+	UINT FrameCount()const;
+
+	// objectCount is recorded with the settings so runs can be plotted against it.
+	bool WriteJson(const std::string& filename, const BenchmarkSettings& settings, UINT objectCount)const;
+
+private:
+	struct ScopeInfo
+	{
+		std::string Name;
+		bool Gpu = false;
+		bool Counter = false;
+	};
+
+	struct FrameTimes
+	{
+		UINT64 FrameNumber = 0;
+		std::vector<float> Ms;
+	};
+
+	std::vector<ScopeInfo> mScopes;
+	std::vector<FrameTimes> mFrames;
+	UINT64 mLastCollected = 0;
+};
@@ -0,0 +1,598 @@
+//***************************************************************************************
+// Bvh.cpp
+//***************************************************************************************
+
+#include "Bvh.h"
+#include "JobSystem.h"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+using namespace DirectX;
+
+namespace
+{
+	const int BinCount = 12;
+
+	// Below this depth the nodes split by the surface area heuristic; further down
+	// they split at the median, which halves the items and so bounds the depth.
+	const int MaxSahDepth = 32;
+
+	struct Box
+	{
+		float Min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+		float Max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+		void Grow(const float point[3])
+		{
+			for(int a = 0; a < 3; ++a)
+			{
+				Min[a] = std::min(Min[a], point[a]);
+				Max[a] = std::max(Max[a], point[a]);
+			}
+		}
+
+		void Grow(const Box& box)
+		{
+			Grow(box.Min);
+			Grow(box.Max);
+		}
+
+		// Half the surface area, which is all the heuristic's ratios need.
+		float Area()const
+		{
+			float dx = Max[0] - Min[0];
+			float dy = Max[1] - Min[1];
+			float dz = Max[2] - Min[2];
+			return dx < 0.0f ? 0.0f : dx * dy + dy * dz + dz * dx;
+		}
+	};
+
+	struct BuildItem
+	{
+		Box Bounds;
+		float Centroid[3];
+	};
+
+	MeshBvh::Node MakeNode(const Box& box)
+	{
+		MeshBvh::Node node;
+		node.Min = XMFLOAT3(box.Min);
+		node.Max = XMFLOAT3(box.Max);
+		node.LeftOrFirst = 0;
+		node.Count = 0;
+		return node;
+	}
+
+	// Splits the items into nodes with at most maxLeaf items a leaf.  order comes back
+	// holding the items' indices in leaf order, and a leaf's LeftOrFirst indexes it.
+	void BuildNodes(const std::vector<BuildItem>& items, std::uint32_t maxLeaf,
+		std::vector<MeshBvh::Node>& nodes, std::vector<std::uint32_t>& order)
+	{
+		nodes.clear();
+		order.resize(items.size());
+		for(std::uint32_t i = 0; i < (std::uint32_t)items.size(); ++i)
+			order[i] = i;
+
+		if(items.empty())
+			return;
+
+		struct Task
+		{
+			std::uint32_t Node;
+			std::uint32_t First;
+			std::uint32_t Count;
+			int Depth;
+		};
+
+		std::vector<Task> tasks;
+		nodes.reserve(2 * items.size() / maxLeaf + 1);
+		nodes.push_back(MeshBvh::Node());
+		tasks.push_back({ 0, 0, (std::uint32_t)items.size(), 0 });
+
+		while(!tasks.empty())
+		{
+			Task task = tasks.back();
+			tasks.pop_back();
+
+			Box bounds, centroids;
+			for(std::uint32_t i = task.First; i < task.First + task.Count; ++i)
+			{
+				bounds.Grow(items[order[i]].Bounds);
+				centroids.Grow(items[order[i]].Centroid);
+			}
+			nodes[task.Node] = MakeNode(bounds);
+
+			if(task.Count <= maxLeaf)
+			{
+				nodes[task.Node].LeftOrFirst = task.First;
+				nodes[task.Node].Count = task.Count;
+				continue;
+			}
+
+			// The cheapest plane between bins along any axis, weighing each side's
+			// items by its area.
+			int bestAxis = -1;
+			int bestSplit = 0;
+			float bestCost = FLT_MAX;
+			if(task.Depth < MaxSahDepth)
+			{
+				for(int a = 0; a < 3; ++a)
+				{
+					float extent = centroids.Max[a] - centroids.Min[a];
+					if(extent <= 0.0f)
+						continue;
+
+					Box binBounds[BinCount];
+					std::uint32_t binCounts[BinCount] = {};
+					float scale = BinCount / extent;
+					for(std::uint32_t i = task.First; i < task.First + task.Count; ++i)
+					{
+						const BuildItem& item = items[order[i]];
+						int bin = std::min(BinCount - 1, (int)((item.Centroid[a] - centroids.Min[a]) * scale));
+						binBounds[bin].Grow(item.Bounds);
+						++binCounts[bin];
+					}
+
+					// leftArea[s] and leftCount[s] cover the bins up to and including s.
+					float leftArea[BinCount - 1];
+					std::uint32_t leftCount[BinCount - 1];
+					Box left;
+					std::uint32_t count = 0;
+					for(int s = 0; s < BinCount - 1; ++s)
+					{
+						left.Grow(binBounds[s]);
+						count += binCounts[s];
+						leftArea[s] = left.Area();
+						leftCount[s] = count;
+					}
+
+					Box right;
+					count = 0;
+					for(int s = BinCount - 2; s >= 0; --s)
+					{
+						right.Grow(binBounds[s + 1]);
+						count += binCounts[s + 1];
+						float cost = leftCount[s] * leftArea[s] + count * right.Area();
+						if(leftCount[s] > 0 && count > 0 && cost < bestCost)
+						{
+							bestAxis = a;
+							bestSplit = s;
+							bestCost = cost;
+						}
+					}
+				}
+			}
+
+			std::uint32_t* first = order.data() + task.First;
+			std::uint32_t* last = first + task.Count;
+			std::uint32_t* middle = nullptr;
+			if(bestAxis >= 0)
+			{
+				float extent = centroids.Max[bestAxis] - centroids.Min[bestAxis];
+				float scale = BinCount / extent;
+				float minCentroid = centroids.Min[bestAxis];
+				middle = std::partition(first, last, [&](std::uint32_t i)
+				{
+					int bin = std::min(BinCount - 1, (int)((items[i].Centroid[bestAxis] - minCentroid) * scale));
+					return bin <= bestSplit;
+				});
+			}
+			else
+			{
+				// Too deep, or every centroid in one place: halve along the widest axis.
+				int axis = 0;
+				for(int a = 1; a < 3; ++a)
+				{
+					if(centroids.Max[a] - centroids.Min[a] > centroids.Max[axis] - centroids.Min[axis])
+						axis = a;
+				}
+				middle = first + task.Count / 2;
+				std::nth_element(first, middle, last, [&](std::uint32_t i, std::uint32_t j)
+				{
+					return items[i].Centroid[axis] < items[j].Centroid[axis];
+				});
+			}
+
+			std::uint32_t leftCount = (std::uint32_t)(middle - first);
+			std::uint32_t children = (std::uint32_t)nodes.size();
+			nodes[task.Node].LeftOrFirst = children;
+			nodes.push_back(MeshBvh::Node());
+			nodes.push_back(MeshBvh::Node());
+			tasks.push_back({ children, task.First, leftCount, task.Depth + 1 });
+			tasks.push_back({ children + 1, task.First + leftCount, task.Count - leftCount, task.Depth + 1 });
+		}
+	}
+
+	// An axis-parallel ray would divide by zero, and 0 * infinity is NaN where the ray
+	// starts on a slab; a tiny stand-in of the same sign keeps the slabs finite.
+	XMVECTOR SafeReciprocal(FXMVECTOR v)
+	{
+		const XMVECTOR tiny = XMVectorReplicate(1e-20f);
+		XMVECTOR signedTiny = XMVectorOrInt(tiny, XMVectorAndInt(v, XMVectorSplatSignMask()));
+		return XMVectorReciprocal(XMVectorSelect(v, signedTiny, XMVectorLess(XMVectorAbs(v), tiny)));
+	}
+
+	// Distance at which the ray enters the node's box, or FLT_MAX if it misses it
+	// before maxT.
+	float EnterBox(const MeshBvh::Node& node, FXMVECTOR origin, FXMVECTOR invDir, float maxT)
+	{
+		XMVECTOR t0 = (XMLoadFloat3(&node.Min) - origin) * invDir;
+		XMVECTOR t1 = (XMLoadFloat3(&node.Max) - origin) * invDir;
+		XMVECTOR tNear = XMVectorMin(t0, t1);
+		XMVECTOR tFar = XMVectorMax(t0, t1);
+
+		XMVECTOR enter = XMVectorMax(XMVectorMax(XMVectorSplatX(tNear), XMVectorSplatY(tNear)),
+			XMVectorMax(XMVectorSplatZ(tNear), XMVectorZero()));
+		XMVECTOR exit = XMVectorMin(XMVectorMin(XMVectorSplatX(tFar), XMVectorSplatY(tFar)),
+			XMVectorMin(XMVectorSplatZ(tFar), XMVectorReplicate(maxT)));
+
+		float t = XMVectorGetX(enter);
+		return t <= XMVectorGetX(exit) ? t : FLT_MAX;
+	}
+
+	// Walks the nodes nearest child first, handing each leaf the ray reaches before t
+	// to leaf(), which may lower t and returns true to stop the walk.
+	template<typename LeafFunction>
+	void Traverse(const std::vector<MeshBvh::Node>& nodes, FXMVECTOR origin, FXMVECTOR invDir, const float& t,
+		const LeafFunction& leaf)
+	{
+		if(nodes.empty() || EnterBox(nodes[0], origin, invDir, t) == FLT_MAX)
+			return;
+
+		struct Entry
+		{
+			const MeshBvh::Node* Node;
+			float T;
+		};
+
+		Entry stack[MeshBvh::StackSize];
+		int size = 0;
+		const MeshBvh::Node* node = &nodes[0];
+
+		for(;;)
+		{
+			if(node->Count > 0)
+			{
+				if(leaf(*node))
+					return;
+				node = nullptr;
+			}
+			else
+			{
+				const MeshBvh::Node* nearChild = &nodes[node->LeftOrFirst];
+				const MeshBvh::Node* farChild = nearChild + 1;
+				float tNear = EnterBox(*nearChild, origin, invDir, t);
+				float tFar = EnterBox(*farChild, origin, invDir, t);
+				if(tFar < tNear)
+				{
+					std::swap(nearChild, farChild);
+					std::swap(tNear, tFar);
+				}
+
+				node = tNear != FLT_MAX ? nearChild : nullptr;
+				if(tFar != FLT_MAX)
+				{
+					assert(size < MeshBvh::StackSize);
+					stack[size++] = { farChild, tFar };
+				}
+			}
+
+			// Boxes the ray entered beyond a hit found since can be skipped.
+			while(node == nullptr)
+			{
+				if(size == 0)
+					return;
+				--size;
+				if(stack[size].T < t)
+					node = stack[size].Node;
+			}
+		}
+	}
+}
+
+void MeshBvh::Build(const void* vertices, std::uint32_t vertexStride, const void* indices, std::uint32_t indexSize,
+	std::uint32_t indexCount, std::uint32_t startIndex, std::int32_t baseVertex)
+{
+	assert(indexSize == 2 || indexSize == 4);
+
+	mTriangleCount = indexCount / 3;
+
+	const std::uint8_t* vertexBytes = static_cast<const std::uint8_t*>(vertices);
+	const std::uint8_t* indexBytes = static_cast<const std::uint8_t*>(indices) + (size_t)startIndex * indexSize;
+
+	std::vector<XMFLOAT3> positions(3 * (size_t)mTriangleCount);
+	std::vector<BuildItem> items(mTriangleCount);
+	for(std::uint32_t t = 0; t < mTriangleCount; ++t)
+	{
+		BuildItem& item = items[t];
+		for(int k = 0; k < 3; ++k)
+		{
+			std::uint32_t index = 0;
+			if(indexSize == 2)
+			{
+				std::uint16_t index16;
+				std::memcpy(&index16, indexBytes + (3 * t + k) * 2, sizeof(index16));
+				index = index16;
+			}
+			else
+			{
+				std::memcpy(&index, indexBytes + (3 * t + k) * 4, sizeof(index));
+			}
+
+			XMFLOAT3& p = positions[3 * t + k];
+			std::memcpy(&p, vertexBytes + (size_t)(index + baseVertex) * vertexStride, sizeof(p));
+			item.Bounds.Grow(&p.x);
+		}
+
+		for(int a = 0; a < 3; ++a)
+			item.Centroid[a] = 0.5f * (item.Bounds.Min[a] + item.Bounds.Max[a]);
+	}
+
+	std::vector<std::uint32_t> order;
+	BuildNodes(items, 4, mNodes, order);
+
+	// Each leaf's triangles go into a packet of their own.
+	mPackets.clear();
+	for(Node& node : mNodes)
+	{
+		if(node.Count == 0)
+			continue;
+
+		TrianglePacket packet = {};
+		for(std::uint32_t lane = 0; lane < 4; ++lane)
+		{
+			packet.Ids[lane] = RayHit::NoHit;
+			if(lane >= node.Count)
+				continue;
+
+			std::uint32_t t = order[node.LeftOrFirst + lane];
+			XMVECTOR v0 = XMLoadFloat3(&positions[3 * t]);
+			XMFLOAT3 p[3];
+			XMStoreFloat3(&p[0], v0);
+			XMStoreFloat3(&p[1], XMLoadFloat3(&positions[3 * t + 1]) - v0);
+			XMStoreFloat3(&p[2], XMLoadFloat3(&positions[3 * t + 2]) - v0);
+
+			const float* components[3] = { &p[0].x, &p[1].x, &p[2].x };
+			for(int a = 0; a < 3; ++a)
+			{
+				(&packet.V0[a].x)[lane] = components[0][a];
+				(&packet.E1[a].x)[lane] = components[1][a];
+				(&packet.E2[a].x)[lane] = components[2][a];
+			}
+			packet.Ids[lane] = t;
+		}
+
+		node.LeftOrFirst = (std::uint32_t)mPackets.size();
+		mPackets.push_back(packet);
+	}
+
+	if(mNodes.empty())
+	{
+		mBounds = BoundingBox(XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT3(0.0f, 0.0f, 0.0f));
+	}
+	else
+	{
+		BoundingBox::CreateFromPoints(mBounds, XMLoadFloat3(&mNodes[0].Min), XMLoadFloat3(&mNodes[0].Max));
+	}
+}
+
+bool MeshBvh::Intersect(FXMVECTOR origin, FXMVECTOR direction, bool anyHit, float& t, std::uint32_t& triangle)const
+{
+	const XMVECTOR ox = XMVectorSplatX(origin);
+	const XMVECTOR oy = XMVectorSplatY(origin);
+	const XMVECTOR oz = XMVectorSplatZ(origin);
+	const XMVECTOR dx = XMVectorSplatX(direction);
+	const XMVECTOR dy = XMVectorSplatY(direction);
+	const XMVECTOR dz = XMVectorSplatZ(direction);
+	const XMVECTOR zero = XMVectorZero();
+	const XMVECTOR one = XMVectorSplatOne();
+
+	bool found = false;
+	Traverse(mNodes, origin, SafeReciprocal(direction), t, [&](const Node& leaf)
+	{
+		const TrianglePacket& packet = mPackets[leaf.LeftOrFirst];
+		XMVECTOR e1x = XMLoadFloat4A(&packet.E1[0]);
+		XMVECTOR e1y = XMLoadFloat4A(&packet.E1[1]);
+		XMVECTOR e1z = XMLoadFloat4A(&packet.E1[2]);
+		XMVECTOR e2x = XMLoadFloat4A(&packet.E2[0]);
+		XMVECTOR e2y = XMLoadFloat4A(&packet.E2[1]);
+		XMVECTOR e2z = XMLoadFloat4A(&packet.E2[2]);
+
+		// Moller-Trumbore for the four triangles at once: p = d x e2, s = o - v0,
+		// q = s x e1, then the determinant, barycentrics and distance.
+		XMVECTOR px = dy * e2z - dz * e2y;
+		XMVECTOR py = dz * e2x - dx * e2z;
+		XMVECTOR pz = dx * e2y - dy * e2x;
+		XMVECTOR det = e1x * px + e1y * py + e1z * pz;
+		XMVECTOR invDet = XMVectorReciprocal(det);
+
+		XMVECTOR sx = ox - XMLoadFloat4A(&packet.V0[0]);
+		XMVECTOR sy = oy - XMLoadFloat4A(&packet.V0[1]);
+		XMVECTOR sz = oz - XMLoadFloat4A(&packet.V0[2]);
+		XMVECTOR u = (sx * px + sy * py + sz * pz) * invDet;
+
+		XMVECTOR qx = sy * e1z - sz * e1y;
+		XMVECTOR qy = sz * e1x - sx * e1z;
+		XMVECTOR qz = sx * e1y - sy * e1x;
+		XMVECTOR v = (dx * qx + dy * qy + dz * qz) * invDet;
+		XMVECTOR hitT = (e2x * qx + e2y * qy + e2z * qz) * invDet;
+
+		// Both faces count, and the padding's zero determinant never does.
+		XMVECTOR hit = XMVectorNotEqual(det, zero);
+		hit = XMVectorAndInt(hit, XMVectorGreaterOrEqual(u, zero));
+		hit = XMVectorAndInt(hit, XMVectorGreaterOrEqual(v, zero));
+		hit = XMVectorAndInt(hit, XMVectorLessOrEqual(u + v, one));
+		hit = XMVectorAndInt(hit, XMVectorGreater(hitT, zero));
+		hit = XMVectorAndInt(hit, XMVectorLess(hitT, XMVectorReplicate(t)));
+		if(XMComparisonAllTrue(XMVector4EqualIntR(hit, XMVectorFalseInt())))
+			return false;
+
+		XMFLOAT4A distances;
+		XMStoreFloat4A(&distances, XMVectorSelect(XMVectorReplicate(FLT_MAX), hitT, hit));
+		const float* lanes = &distances.x;
+		for(int lane = 0; lane < 4; ++lane)
+		{
+			if(lanes[lane] < t)
+			{
+				t = lanes[lane];
+				triangle = packet.Ids[lane];
+			}
+		}
+
+		found = true;
+		return anyHit;
+	});
+
+	return found;
+}
+
+const BoundingBox& MeshBvh::Bounds()const
+{
+	return mBounds;
+}
+
+std::uint32_t MeshBvh::TriangleCount()const
+{
+	return mTriangleCount;
+}
+
+void SceneBvh::Clear()
+{
+	mInstances.clear();
+	mInstanceBounds.clear();
+	mNodes.clear();
+}
+
+void SceneBvh::Add(const MeshBvh* mesh, const XMFLOAT4X4& world, std::uint32_t userId)
+{
+	if(mesh == nullptr || mesh->TriangleCount() == 0)
+		return;
+
+	XMMATRIX W = XMLoadFloat4x4(&world);
+
+	Instance instance;
+	XMStoreFloat4x4(&instance.InvWorld, XMMatrixInverse(nullptr, W));
+	instance.Mesh = mesh;
+	instance.UserId = userId;
+	mInstances.push_back(instance);
+
+	BoundingBox bounds;
+	mesh->Bounds().Transform(bounds, W);
+	mInstanceBounds.push_back(bounds);
+}
+
+void SceneBvh::Build()
+{
+	std::vector<BuildItem> items(mInstances.size());
+	for(size_t i = 0; i < items.size(); ++i)
+	{
+		const BoundingBox& bounds = mInstanceBounds[i];
+		const float* center = &bounds.Center.x;
+		const float* extents = &bounds.Extents.x;
+		for(int a = 0; a < 3; ++a)
+		{
+			items[i].Bounds.Min[a] = center[a] - extents[a];
+			items[i].Bounds.Max[a] = center[a] + extents[a];
+			items[i].Centroid[a] = center[a];
+		}
+	}
+
+	// Two instances a leaf: a ray that reaches an instance descends a tree of its
+	// own, so the top level pays to split finely.
+	std::vector<std::uint32_t> order;
+	BuildNodes(items, 2, mNodes, order);
+
+	std::vector<Instance> instances(mInstances.size());
+	std::vector<BoundingBox> bounds(mInstanceBounds.size());
+	for(size_t i = 0; i < order.size(); ++i)
+	{
+		instances[i] = mInstances[order[i]];
+		bounds[i] = mInstanceBounds[order[i]];
+	}
+	mInstances.swap(instances);
+	mInstanceBounds.swap(bounds);
+}
+
+RayHit SceneBvh::Intersect(const Ray& ray)const
+{
+	RayHit hit;
+	Trace(ray, false, hit);
+	return hit;
+}
+
+bool SceneBvh::Occluded(const Ray& ray)const
+{
+	RayHit hit;
+	return Trace(ray, true, hit);
+}
+
+void SceneBvh::IntersectBatch(JobSystem& jobs, const Ray* rays, std::uint32_t count, RayHit* hits)const
+{
+	JobSystem::Counter counter;
+	for(std::uint32_t first = 0; first < count; first += BatchSize)
+	{
+		std::uint32_t last = std::min(first + BatchSize, count);
+		jobs.Run(counter, [this, rays, hits, first, last]()
+		{
+			for(std::uint32_t i = first; i < last; ++i)
+				hits[i] = Intersect(rays[i]);
+		});
+	}
+	jobs.Wait(counter);
+}
+
+void SceneBvh::OccludedBatch(JobSystem& jobs, const Ray* rays, std::uint32_t count, bool* occluded)const
+{
+	JobSystem::Counter counter;
+	for(std::uint32_t first = 0; first < count; first += BatchSize)
+	{
+		std::uint32_t last = std::min(first + BatchSize, count);
+		jobs.Run(counter, [this, rays, occluded, first, last]()
+		{
+			for(std::uint32_t i = first; i < last; ++i)
+				occluded[i] = Occluded(rays[i]);
+		});
+	}
+	jobs.Wait(counter);
+}
+
+std::uint32_t SceneBvh::InstanceCount()const
+{
+	return (std::uint32_t)mInstances.size();
+}
+
+bool SceneBvh::Trace(const Ray& ray, bool anyHit, RayHit& hit)const
+{
+	XMVECTOR origin = XMLoadFloat3(&ray.Origin);
+	XMVECTOR direction = XMLoadFloat3(&ray.Direction);
+
+	// The instance's inverse world takes the ray into the mesh's space unnormalized,
+	// so distances along it are the same in both.
+	float t = ray.MaxT;
+	bool found = false;
+	Traverse(mNodes, origin, SafeReciprocal(direction), t, [&](const MeshBvh::Node& leaf)
+	{
+		for(std::uint32_t i = leaf.LeftOrFirst; i < leaf.LeftOrFirst + leaf.Count; ++i)
+		{
+			const Instance& instance = mInstances[i];
+			XMMATRIX invWorld = XMLoadFloat4x4(&instance.InvWorld);
+			XMVECTOR localOrigin = XMVector3TransformCoord(origin, invWorld);
+			XMVECTOR localDirection = XMVector3TransformNormal(direction, invWorld);
+
+			std::uint32_t triangle = RayHit::NoHit;
+			if(instance.Mesh->Intersect(localOrigin, localDirection, anyHit, t, triangle))
+			{
+				found = true;
+				hit.T = t;
+				hit.UserId = instance.UserId;
+				hit.Triangle = triangle;
+				if(anyHit)
+					return true;
+			}
+		}
+		return false;
+	});
+
+	return found;
+}
@@ -0,0 +1,151 @@
+//***************************************************************************************
+// Bvh.h
+//
+// Bounding volume hierarchies for ray queries against the scene's triangles, in two
+// levels as DXR builds them.
+//   -A MeshBvh is built once per mesh, in the mesh's own space, over its triangles.
+//    Its leaves hold packets of up to four triangles stored as structures of arrays,
+//    so one ray is tested against a packet with four-wide SIMD.
+//   -A SceneBvh holds placed instances of MeshBvhs and is rebuilt over their world
+//    bounds whenever the set of instances changes, which is cheap next to rebuilding
+//    the triangles.  A ray is moved into each instance's space rather than the
+//    triangles into the world.
+//   -Both levels split their nodes by the surface area heuristic over binned
+//    centroids and are traversed nearest child first, so a closest-hit query can
+//    stop descending as soon as the boxes lie beyond the best hit.
+//   -IntersectBatch() and OccludedBatch() split a batch of rays across a JobSystem;
+//    the hierarchy is read only while the jobs run.
+//***************************************************************************************
+
+#pragma once
+
+#include <cfloat>
+#include <cstdint>
+#include <DirectXCollision.h>
+#include <DirectXMath.h>
+#include <vector>
+
+class JobSystem;
+
+struct Ray
+{
+	DirectX::XMFLOAT3 Origin = { 0.0f, 0.0f, 0.0f };
+
+	// Needn't be normalized; hit distances are in multiples of its length.
+	DirectX::XMFLOAT3 Direction = { 0.0f, 0.0f, 1.0f };
+	float MaxT = FLT_MAX;
+};
+
+struct RayHit
+{
+	static const std::uint32_t NoHit = 0xFFFFFFFF;
+
+	float T = FLT_MAX;
+
+	// The instance's user id and the triangle's index within its mesh, or NoHit.
+	std::uint32_t UserId = NoHit;
+	std::uint32_t Triangle = NoHit;
+};
+
+class MeshBvh
+{
+public:
+	// Interior nodes have Count 0 and their children at LeftOrFirst and LeftOrFirst + 1;
+	// leaves have Count items from LeftOrFirst on.
+	struct Node
+	{
+		DirectX::XMFLOAT3 Min;
+		std::uint32_t LeftOrFirst;
+		DirectX::XMFLOAT3 Max;
+		std::uint32_t Count;
+	};
+
+	// Deep enough for any tree Build() makes.
+	static const int StackSize = 64;
+
+	MeshBvh() = default;
+	MeshBvh(const MeshBvh& rhs) = delete;
+	MeshBvh& operator=(const MeshBvh& rhs) = delete;
+	~MeshBvh() = default;
+
+	// A triangle list whose positions are the first three floats of each vertex.
+	// indexSize is 2 or 4 bytes, and baseVertex is added to every index as
+	// DrawIndexedInstanced would.
+	void Build(const void* vertices, std::uint32_t vertexStride, const void* indices, std::uint32_t indexSize,
+		std::uint32_t indexCount, std::uint32_t startIndex, std::int32_t baseVertex);
+
+	// t holds the farthest distance to look on entry and the hit's on return, and
+	// triangle the triangle hit.  With anyHit the search stops at the first hit found
+	// rather than the closest.
+	bool Intersect(DirectX::FXMVECTOR origin, DirectX::FXMVECTOR direction, bool anyHit,
+		float& t, std::uint32_t& triangle)const;
+
+	const DirectX::BoundingBox& Bounds()const;
+	std::uint32_t TriangleCount()const;
+
+private:
+	// Four triangles as v0, e1 = v1 - v0 and e2 = v2 - v0, one component per vector.
+	// Packets that aren't full are padded with degenerate triangles, which no ray hits.
+	struct alignas(16) TrianglePacket
+	{
+		DirectX::XMFLOAT4A V0[3];
+		DirectX::XMFLOAT4A E1[3];
+		DirectX::XMFLOAT4A E2[3];
+		std::uint32_t Ids[4];
+	};
+
+private:
+	std::vector<Node> mNodes;
+
+	// One per leaf, in leaf order; a leaf's LeftOrFirst is its packet.
+	std::vector<TrianglePacket> mPackets;
+
+	DirectX::BoundingBox mBounds;
+	std::uint32_t mTriangleCount = 0;
+};
+
+class SceneBvh
+{
+public:
+	SceneBvh() = default;
+	SceneBvh(const SceneBvh& rhs) = delete;
+	SceneBvh& operator=(const SceneBvh& rhs) = delete;
+	~SceneBvh() = default;
+
+	// Add() the instances, then Build(); the meshes have to outlive the next Clear().
+	void Clear();
+	void Add(const MeshBvh* mesh, const DirectX::XMFLOAT4X4& world, std::uint32_t userId);
+	void Build();
+
+	// Closest hit along the ray, if any within MaxT.
+	RayHit Intersect(const Ray& ray)const;
+
+	// True if anything lies along the ray within MaxT.
+	bool Occluded(const Ray& ray)const;
+
+	// The same for count rays, run as jobs on the calling thread and the workers.
+	void IntersectBatch(JobSystem& jobs, const Ray* rays, std::uint32_t count, RayHit* hits)const;
+	void OccludedBatch(JobSystem& jobs, const Ray* rays, std::uint32_t count, bool* occluded)const;
+
+	std::uint32_t InstanceCount()const;
+
+private:
+	struct Instance
+	{
+		DirectX::XMFLOAT4X4 InvWorld;
+		const MeshBvh* Mesh = nullptr;
+		std::uint32_t UserId = 0;
+	};
+
+	bool Trace(const Ray& ray, bool anyHit, RayHit& hit)const;
+
+	// Rays a job takes from a batch.
+	static const std::uint32_t BatchSize = 256;
+
+private:
+	// Added instances and their world bounds; Build() reorders both into leaf order.
+	std::vector<Instance> mInstances;
+	std::vector<DirectX::BoundingBox> mInstanceBounds;
+
+	std::vector<MeshBvh::Node> mNodes;
+};
@@ -125,7 +125,32 @@ void Camera::SetLens(float fovY, float aspect, float zn, float zf)
 	mFarWindowHeight  = 2.0f * mFarZ * tanf( 0.5f*mFovY );
 
 	XMMATRIX P = XMMatrixPerspectiveFovLH(mFovY, mAspect, mNearZ, mFarZ);
+	XMStoreFloat4x4(&mCullProj, P);
+
+	if(mReverseZ)
+	{
+		// Depth = zn / z: 1 on the near plane, approaching 0 at infinity.
+		float yScale = 1.0f / tanf(0.5f*mFovY);
+		float xScale = yScale / mAspect;
+		P = XMMATRIX(
+			xScale, 0.0f,   0.0f,   0.0f,
+			0.0f,   yScale, 0.0f,   0.0f,
+			0.0f,   0.0f,   0.0f,   1.0f,
+			0.0f,   0.0f,   mNearZ, 0.0f);
+	}
 	XMStoreFloat4x4(&mProj, P);
+	++mLensVersion;
+}
+
+void Camera::SetReverseZ(bool reverseZ)
+{
+	mReverseZ = reverseZ;
+	SetLens(mFovY, mAspect, mNearZ, mFarZ);
+}
+
+bool Camera::GetReverseZ()const
+{
+	return mReverseZ;
 }
 
 void Camera::LookAt(FXMVECTOR pos, FXMVECTOR target, FXMVECTOR worldUp)
@@ -176,6 +201,11 @@ XMFLOAT4X4 Camera::GetProj4x4f()const
 	return mProj;
 }
 
+XMMATRIX Camera::GetCullProj()const
+{
+	return XMLoadFloat4x4(&mCullProj);
+}
+
 void Camera::Strafe(float d)
 {
 	// mPosition += d*mRight
@@ -294,7 +324,18 @@ void Camera::UpdateViewMatrix()
 		mView(3, 3) = 1.0f;
 
 		mViewDirty = false;
+		++mViewVersion;
 	}
 }
 
+UINT64 Camera::GetViewVersion()const
+{
+	return mViewVersion;
+}
+
+UINT64 Camera::GetLensVersion()const
+{
+	return mLensVersion;
+}
+
 
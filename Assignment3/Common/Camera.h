@@ -6,6 +6,10 @@
 //    so that the view matrix can be constructed.  
 //   -It keeps track of the viewing frustum of the camera so that the projection
 //    matrix can be obtained.
+//   -In reverse-Z mode the projection maps the near plane to depth 1 and puts the
+//    far plane at infinity, depth 0, so float depth keeps its precision with
+//    distance.  Depth tests become GREATER and depth buffers clear to 0.  The far
+//    plane still bounds culling; GetCullProj() has it.
 //***************************************************************************************
 
 #ifndef CAMERA_H
@@ -50,6 +54,9 @@ public:
 	// Set frustum.
 	void SetLens(float fovY, float aspect, float zn, float zf);
 
+	void SetReverseZ(bool reverseZ);
+	bool GetReverseZ()const;
+
 	// Define camera space via LookAt parameters.
 	void LookAt(DirectX::FXMVECTOR pos, DirectX::FXMVECTOR target, DirectX::FXMVECTOR worldUp);
 	void LookAt(const DirectX::XMFLOAT3& pos, const DirectX::XMFLOAT3& target, const DirectX::XMFLOAT3& up);
@@ -61,6 +68,9 @@ public:
 	DirectX::XMFLOAT4X4 GetView4x4f()const;
 	DirectX::XMFLOAT4X4 GetProj4x4f()const;
 
+	// Standard depth with the far plane at FarZ in either mode, for building frusta.
+	DirectX::XMMATRIX GetCullProj()const;
+
 	// Strafe/Walk the camera a distance d.
 	void Strafe(float d);
 	void Walk(float d);
@@ -74,6 +84,11 @@ public:
 	// After modifying camera position/orientation, call to rebuild the view matrix.
 	void UpdateViewMatrix();
 
+	// Advance each time UpdateViewMatrix() rebuilds the view or SetLens() the
+	// projection, so what is derived from them can be kept until they do.
+	UINT64 GetViewVersion()const;
+	UINT64 GetLensVersion()const;
+
 private:
 
 	// Camera coordinate system with coordinates relative to world space.
@@ -91,10 +106,14 @@ private:
 	float mFarWindowHeight = 0.0f;
 
 	bool mViewDirty = true;
+	bool mReverseZ = false;
+	UINT64 mViewVersion = 0;
+	UINT64 mLensVersion = 0;
 
 	// Cache View/Proj matrices.
 	DirectX::XMFLOAT4X4 mView = MathHelper::Identity4x4();
 	DirectX::XMFLOAT4X4 mProj = MathHelper::Identity4x4();
+	DirectX::XMFLOAT4X4 mCullProj = MathHelper::Identity4x4();
 };
 
 #endif // CAMERA_H
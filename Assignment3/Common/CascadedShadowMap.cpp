@@ -0,0 +1,292 @@
+//***************************************************************************************
+// CascadedShadowMap.cpp
+//***************************************************************************************
+
+#include "CascadedShadowMap.h"
+#include "MathHelper.h"
+
+using namespace DirectX;
+
+CascadedShadowMap::CascadedShadowMap(ID3D12Device* device, DescriptorAllocator& heap, ResourceStateTracker& states,
+	UINT size, float casterDistance, float splitLambda) :
+	mHeap(heap),
+	mSize(size),
+	mCasterDistance(casterDistance),
+	mSplitLambda(splitLambda)
+{
+	D3D12_CLEAR_VALUE optClear;
+	optClear.Format = DsvFormat;
+	optClear.DepthStencil.Depth = 1.0f;
+	optClear.DepthStencil.Stencil = 0;
+
+	// Typeless, so the depth can be read as R32_FLOAT.
+	CD3DX12_RESOURCE_DESC texDesc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R32_TYPELESS, size, size,
+		(UINT16)CascadeCount, 1, 1, 0, D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL);
+
+	ThrowIfFailed(device->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+		D3D12_HEAP_FLAG_NONE,
+		&texDesc,
+		D3D12_RESOURCE_STATE_COMMON,
+		&optClear,
+		IID_PPV_ARGS(mStaticMap.GetAddressOf())));
+
+	ThrowIfFailed(device->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+		D3D12_HEAP_FLAG_NONE,
+		&texDesc,
+		D3D12_RESOURCE_STATE_COMMON,
+		&optClear,
+		IID_PPV_ARGS(mMap.GetAddressOf())));
+
+	states.Track(mStaticMap.Get(), D3D12_RESOURCE_STATE_COMMON);
+	states.Track(mMap.Get(), D3D12_RESOURCE_STATE_COMMON);
+
+	// A DSV per slice: the static caches first, then the shadow map.
+	D3D12_DESCRIPTOR_HEAP_DESC dsvHeapDesc = {};
+	dsvHeapDesc.NumDescriptors = 2 * CascadeCount;
+	dsvHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_DSV;
+	dsvHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
+	ThrowIfFailed(device->CreateDescriptorHeap(&dsvHeapDesc, IID_PPV_ARGS(mDsvHeap.GetAddressOf())));
+	mDsvSize = device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_DSV);
+
+	for(UINT i = 0; i < 2 * CascadeCount; ++i)
+	{
+		D3D12_DEPTH_STENCIL_VIEW_DESC dsvDesc = {};
+		dsvDesc.Format = DsvFormat;
+		dsvDesc.ViewDimension = D3D12_DSV_DIMENSION_TEXTURE2DARRAY;
+		dsvDesc.Flags = D3D12_DSV_FLAG_NONE;
+		dsvDesc.Texture2DArray.MipSlice = 0;
+		dsvDesc.Texture2DArray.FirstArraySlice = i % CascadeCount;
+		dsvDesc.Texture2DArray.ArraySize = 1;
+		device->CreateDepthStencilView(i < CascadeCount ? mStaticMap.Get() : mMap.Get(), &dsvDesc, Dsv(i));
+	}
+
+	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+	srvDesc.Format = DXGI_FORMAT_R32_FLOAT;
+	srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2DARRAY;
+	srvDesc.Texture2DArray.MostDetailedMip = 0;
+	srvDesc.Texture2DArray.MipLevels = 1;
+	srvDesc.Texture2DArray.FirstArraySlice = 0;
+	srvDesc.Texture2DArray.ArraySize = CascadeCount;
+	mSrvIndex = mHeap.Allocate();
+	device->CreateShaderResourceView(mMap.Get(), &srvDesc, mHeap.CpuHandle(mSrvIndex));
+
+	XMStoreFloat4x4(&mLightView, XMMatrixIdentity());
+	for(UINT i = 0; i < CascadeCount; ++i)
+		XMStoreFloat4x4(&mViewProj[i], XMMatrixIdentity());
+}
+
+void CascadedShadowMap::Update(const Camera& camera, const XMFLOAT3& lightDirection)
+{
+	XMFLOAT3 direction;
+	XMStoreFloat3(&direction, XMVector3Normalize(XMLoadFloat3(&lightDirection)));
+
+	if(direction.x != mLightDirection.x || direction.y != mLightDirection.y || direction.z != mLightDirection.z)
+	{
+		mLightDirection = direction;
+
+		XMVECTOR up = fabsf(direction.y) > 0.99f ? XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f) : XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
+		XMStoreFloat4x4(&mLightView, XMMatrixLookToLH(XMVectorZero(), XMLoadFloat3(&direction), up));
+		mInvalid = true;
+	}
+
+	XMMATRIX lightView = XMLoadFloat4x4(&mLightView);
+
+	const float nearZ = camera.GetNearZ();
+	const float farZ = camera.GetFarZ();
+	const float tanHalfFovY = tanf(0.5f * camera.GetFovY());
+	const float tanHalfFovX = tanHalfFovY * camera.GetAspect();
+
+	// Squared distance from the view axis to a frustum corner, per unit of depth.
+	const float k2 = tanHalfFovX * tanHalfFovX + tanHalfFovY * tanHalfFovY;
+
+	XMVECTOR eye = camera.GetPosition();
+	XMVECTOR look = camera.GetLook();
+
+	Placement wanted[CascadeCount];
+	float sliceNear = nearZ;
+	for(UINT i = 0; i < CascadeCount; ++i)
+	{
+		float t = (float)(i + 1) / CascadeCount;
+		float logSplit = nearZ * powf(farZ / nearZ, t);
+		float uniformSplit = nearZ + (farZ - nearZ) * t;
+		float sliceFar = mSplitLambda * logSplit + (1.0f - mSplitLambda) * uniformSplit;
+		mSplits[i] = sliceFar;
+
+		// The slice's bounding sphere is centred on the view axis, as far from the near
+		// corners as from the far ones, unless that puts it past the far plane.
+		float centerZ = 0.5f * (sliceNear + sliceFar) * (1.0f + k2);
+		float radius;
+		if(centerZ < sliceFar)
+		{
+			radius = sqrtf((sliceFar - centerZ) * (sliceFar - centerZ) + sliceFar * sliceFar * k2);
+		}
+		else
+		{
+			centerZ = sliceFar;
+			radius = sliceFar * sqrtf(k2);
+		}
+		sliceNear = sliceFar;
+
+		// The box is an eighth of the radius bigger than the sphere all round; the grid
+		// step is at most that, in whole texels.
+		float halfWidth = radius * 1.125f;
+		float texel = 2.0f * halfWidth / mSize;
+		float step = MathHelper::Max(texel, floorf(0.125f * radius / texel) * texel);
+
+		XMFLOAT3 centerL;
+		XMStoreFloat3(&centerL, XMVector3TransformCoord(eye + look * centerZ, lightView));
+
+		wanted[i].CenterL = XMFLOAT3(
+			roundf(centerL.x / step) * step,
+			roundf(centerL.y / step) * step,
+			roundf(centerL.z / step) * step);
+		wanted[i].HalfWidth = halfWidth;
+	}
+
+	// A new lens resizes every cascade, so they all have to move together.
+	bool moveAll = mInvalid;
+	for(UINT i = 0; i < CascadeCount; ++i)
+	{
+		if(wanted[i].HalfWidth != mPlacements[i].HalfWidth)
+			moveAll = true;
+	}
+
+	// Otherwise the nearest cascade that wants to move goes first; the padding covers
+	// the others for the frames they wait.
+	bool moved = false;
+	for(UINT i = 0; i < CascadeCount; ++i)
+	{
+		const XMFLOAT3& a = wanted[i].CenterL;
+		const XMFLOAT3& b = mPlacements[i].CenterL;
+		bool stale = a.x != b.x || a.y != b.y || a.z != b.z;
+
+		mStaticDirty[i] = moveAll || (stale && !moved);
+		if(mStaticDirty[i])
+		{
+			Place(i, wanted[i]);
+			moved = true;
+		}
+	}
+
+	mInvalid = false;
+}
+
+void CascadedShadowMap::InvalidateStatic()
+{
+	mInvalid = true;
+}
+
+bool CascadedShadowMap::StaticDirty(UINT cascade)const
+{
+	return mStaticDirty[cascade];
+}
+
+void CascadedShadowMap::BeginStaticCascade(ID3D12GraphicsCommandList* cmdList, ResourceStateTracker& states, UINT cascade)
+{
+	states.Transition(mStaticMap.Get(), D3D12_RESOURCE_STATE_DEPTH_WRITE);
+	states.FlushBarriers(cmdList);
+
+	cmdList->ClearDepthStencilView(Dsv(cascade), D3D12_CLEAR_FLAG_DEPTH, 1.0f, 0, 0, nullptr);
+	SetTarget(cmdList, Dsv(cascade));
+}
+
+void CascadedShadowMap::CopyStatic(ID3D12GraphicsCommandList* cmdList, ResourceStateTracker& states)
+{
+	states.Transition(mStaticMap.Get(), D3D12_RESOURCE_STATE_COPY_SOURCE);
+	states.Transition(mMap.Get(), D3D12_RESOURCE_STATE_COPY_DEST);
+	states.FlushBarriers(cmdList);
+
+	cmdList->CopyResource(mMap.Get(), mStaticMap.Get());
+}
+
+void CascadedShadowMap::BeginDynamicCascade(ID3D12GraphicsCommandList* cmdList, ResourceStateTracker& states, UINT cascade)
+{
+	states.Transition(mMap.Get(), D3D12_RESOURCE_STATE_DEPTH_WRITE);
+	states.FlushBarriers(cmdList);
+
+	SetTarget(cmdList, Dsv(CascadeCount + cascade));
+}
+
+XMMATRIX CascadedShadowMap::ViewProj(UINT cascade)const
+{
+	return XMLoadFloat4x4(&mViewProj[cascade]);
+}
+
+const BoundingOrientedBox& CascadedShadowMap::CasterBounds(UINT cascade)const
+{
+	return mCasterBounds[cascade];
+}
+
+XMMATRIX CascadedShadowMap::ShadowTransform(UINT cascade)const
+{
+	// NDC space [-1, 1]^2 to texture space [0, 1]^2.
+	XMMATRIX toTexture(
+		0.5f, 0.0f, 0.0f, 0.0f,
+		0.0f, -0.5f, 0.0f, 0.0f,
+		0.0f, 0.0f, 1.0f, 0.0f,
+		0.5f, 0.5f, 0.0f, 1.0f);
+
+	return ViewProj(cascade) * toTexture;
+}
+
+float CascadedShadowMap::SplitDistance(UINT cascade)const
+{
+	return mSplits[cascade];
+}
+
+ID3D12Resource* CascadedShadowMap::Resource()const
+{
+	return mMap.Get();
+}
+
+ID3D12Resource* CascadedShadowMap::StaticResource()const
+{
+	return mStaticMap.Get();
+}
+
+UINT CascadedShadowMap::SrvIndex()const
+{
+	return mSrvIndex;
+}
+
+UINT CascadedShadowMap::Size()const
+{
+	return mSize;
+}
+
+void CascadedShadowMap::Place(UINT cascade, const Placement& placement)
+{
+	mPlacements[cascade] = placement;
+
+	const XMFLOAT3& c = placement.CenterL;
+	const float r = placement.HalfWidth;
+
+	// The near plane is pulled towards the light so casters outside the box still
+	// shadow what is in it.
+	XMMATRIX lightView = XMLoadFloat4x4(&mLightView);
+	XMMATRIX proj = XMMatrixOrthographicOffCenterLH(c.x - r, c.x + r, c.y - r, c.y + r,
+		c.z - r - mCasterDistance, c.z + r);
+	XMStoreFloat4x4(&mViewProj[cascade], lightView * proj);
+
+	BoundingBox boxL(XMFLOAT3(c.x, c.y, c.z - 0.5f * mCasterDistance), XMFLOAT3(r, r, r + 0.5f * mCasterDistance));
+	BoundingOrientedBox obbL;
+	BoundingOrientedBox::CreateFromBoundingBox(obbL, boxL);
+	obbL.Transform(mCasterBounds[cascade], XMMatrixInverse(nullptr, lightView));
+}
+
+void CascadedShadowMap::SetTarget(ID3D12GraphicsCommandList* cmdList, D3D12_CPU_DESCRIPTOR_HANDLE dsv)
+{
+	D3D12_VIEWPORT viewport = { 0.0f, 0.0f, (float)mSize, (float)mSize, 0.0f, 1.0f };
+	D3D12_RECT scissorRect = { 0, 0, (LONG)mSize, (LONG)mSize };
+	cmdList->RSSetViewports(1, &viewport);
+	cmdList->RSSetScissorRects(1, &scissorRect);
+	cmdList->OMSetRenderTargets(0, nullptr, false, &dsv);
+}
+
+CD3DX12_CPU_DESCRIPTOR_HANDLE CascadedShadowMap::Dsv(UINT index)const
+{
+	return CD3DX12_CPU_DESCRIPTOR_HANDLE(mDsvHeap->GetCPUDescriptorHandleForHeapStart(), (INT)index, mDsvSize);
+}
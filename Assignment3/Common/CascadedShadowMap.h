@@ -0,0 +1,108 @@
+//***************************************************************************************
+// CascadedShadowMap.h
+//
+// Cascaded shadow maps for one directional light, with the static casters cached.
+//   -The camera's depth range is split between practical (log/uniform) split
+//    distances.  Each cascade is a square orthographic box around the bounding sphere
+//    of its slice of the view frustum, so its size only depends on the lens, not on
+//    where the camera looks.
+//   -The box centre snaps to a grid an eighth of the sphere's radius wide, and the box
+//    is that much bigger than the sphere.  The cascade only moves when the camera
+//    crosses a grid line, and then by whole texels, so the cached depth stays valid
+//    in between.
+//   -Static casters render into a cached copy of each cascade when it moves.  Every
+//    frame the cache is copied into the shadow map and the dynamic casters are drawn
+//    on top.  Update() lets at most one cascade move a frame, unless the light or
+//    the lens changed, which moves them all.
+//   -Views live in a shader-visible DescriptorAllocator (one Texture2DArray SRV of
+//    the shadow map) and a heap of its own (a DSV per slice of either texture).
+//***************************************************************************************
+
+#pragma once
+
+#include "d3dUtil.h"
+#include "Camera.h"
+#include "DescriptorAllocator.h"
+#include "ResourceStateTracker.h"
+
+class CascadedShadowMap
+{
+public:
+	static const UINT CascadeCount = 4;
+	static const DXGI_FORMAT DsvFormat = DXGI_FORMAT_D32_FLOAT;
+
+	// casterDistance is how far past a cascade's box, towards the light, casters are
+	// still drawn into it.  splitLambda blends the log (1) and uniform (0) splits.
+	CascadedShadowMap(ID3D12Device* device, DescriptorAllocator& heap, ResourceStateTracker& states,
+		UINT size, float casterDistance, float splitLambda = 0.8f);
+	CascadedShadowMap(const CascadedShadowMap& rhs) = delete;
+	CascadedShadowMap& operator=(const CascadedShadowMap& rhs) = delete;
+	~CascadedShadowMap() = default;
+
+	// Fits the cascades to the camera.  lightDirection points away from the light.
+	void Update(const Camera& camera, const DirectX::XMFLOAT3& lightDirection);
+
+	// Makes every cascade re-render its static casters on the next Update, e.g. after
+	// static geometry changed.
+	void InvalidateStatic();
+
+	// Set by Update for each cascade whose static casters have to be drawn this frame.
+	bool StaticDirty(UINT cascade)const;
+
+	// Clears a cascade's static cache and makes it the depth target.
+	void BeginStaticCascade(ID3D12GraphicsCommandList* cmdList, ResourceStateTracker& states, UINT cascade);
+
+	// Copies the static caches into the shadow map; call once a frame, after the
+	// static cascades are drawn.
+	void CopyStatic(ID3D12GraphicsCommandList* cmdList, ResourceStateTracker& states);
+
+	// Makes one slice of the shadow map the depth target for the dynamic casters.
+	void BeginDynamicCascade(ID3D12GraphicsCommandList* cmdList, ResourceStateTracker& states, UINT cascade);
+
+	// World to light clip space and the world space box of casters, for drawing.
+	DirectX::XMMATRIX ViewProj(UINT cascade)const;
+	const DirectX::BoundingOrientedBox& CasterBounds(UINT cascade)const;
+
+	// World to shadow map texture space, and the view depth the cascade ends at.
+	DirectX::XMMATRIX ShadowTransform(UINT cascade)const;
+	float SplitDistance(UINT cascade)const;
+
+	ID3D12Resource* Resource()const;
+	ID3D12Resource* StaticResource()const;
+	UINT SrvIndex()const;
+	UINT Size()const;
+
+private:
+	struct Placement
+	{
+		DirectX::XMFLOAT3 CenterL = { 0.0f, 0.0f, 0.0f };
+		float HalfWidth = 0.0f;
+	};
+
+	void Place(UINT cascade, const Placement& placement);
+	void SetTarget(ID3D12GraphicsCommandList* cmdList, D3D12_CPU_DESCRIPTOR_HANDLE dsv);
+	CD3DX12_CPU_DESCRIPTOR_HANDLE Dsv(UINT index)const;
+
+private:
+	DescriptorAllocator& mHeap;
+	UINT mSize = 0;
+	float mCasterDistance = 0.0f;
+	float mSplitLambda = 0.0f;
+
+	Microsoft::WRL::ComPtr<ID3D12Resource> mStaticMap;
+	Microsoft::WRL::ComPtr<ID3D12Resource> mMap;
+	Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> mDsvHeap;
+	UINT mDsvSize = 0;
+	UINT mSrvIndex = 0;
+
+	// The light's rotation; cascades only differ by their box in light space.
+	DirectX::XMFLOAT3 mLightDirection = { 0.0f, 0.0f, 0.0f };
+	DirectX::XMFLOAT4X4 mLightView;
+	bool mInvalid = true;
+
+	Placement mPlacements[CascadeCount];
+	DirectX::XMFLOAT4X4 mViewProj[CascadeCount];
+	DirectX::BoundingOrientedBox mCasterBounds[CascadeCount];
+	float mSplits[CascadeCount] = {};
+	bool mStaticDirty[CascadeCount] = {};
+};
@@ -0,0 +1,224 @@
+//***************************************************************************************
+// CollisionGrid.cpp
+//***************************************************************************************
+
+#include "CollisionGrid.h"
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+
+using namespace DirectX;
+
+CollisionGrid::CollisionGrid(float cellSize) :
+	mCellSize(cellSize)
+{
+	assert(cellSize > 0.0f);
+}
+
+void CollisionGrid::Clear()
+{
+	mColliders.clear();
+	mCellStart.clear();
+	mCellColliders.clear();
+	mCellCountX = 0;
+	mCellCountZ = 0;
+}
+
+void CollisionGrid::Add(const BoundingBox& box, ColliderType type)
+{
+	Collider collider;
+	collider.Box = box;
+	collider.Type = type;
+	mColliders.push_back(collider);
+}
+
+void CollisionGrid::Build()
+{
+	mCellStart.clear();
+	mCellColliders.clear();
+	mCellCountX = 0;
+	mCellCountZ = 0;
+
+	if(mColliders.empty())
+		return;
+
+	// Fit the grid to the colliders.
+	float minX = +FLT_MAX, minZ = +FLT_MAX;
+	float maxX = -FLT_MAX, maxZ = -FLT_MAX;
+	for(const auto& c : mColliders)
+	{
+		minX = std::min(minX, c.Box.Center.x - c.Box.Extents.x);
+		minZ = std::min(minZ, c.Box.Center.z - c.Box.Extents.z);
+		maxX = std::max(maxX, c.Box.Center.x + c.Box.Extents.x);
+		maxZ = std::max(maxZ, c.Box.Center.z + c.Box.Extents.z);
+	}
+
+	mOriginX = minX;
+	mOriginZ = minZ;
+	mCellCountX = std::max(1, (int)std::ceil((maxX - minX) / mCellSize));
+	mCellCountZ = std::max(1, (int)std::ceil((maxZ - minZ) / mCellSize));
+
+	const size_t cellCount = (size_t)mCellCountX * mCellCountZ;
+
+	// Count the colliders touching each cell, turn the counts into offsets,
+	// then drop each collider into every cell it touches.
+	std::vector<std::uint32_t> counts(cellCount, 0);
+	for(const auto& c : mColliders)
+	{
+		int x0, z0, x1, z1;
+		CellRange(c.Box, x0, z0, x1, z1);
+		for(int z = z0; z <= z1; ++z)
+			for(int x = x0; x <= x1; ++x)
+				++counts[(size_t)z * mCellCountX + x];
+	}
+
+	mCellStart.resize(cellCount + 1);
+	mCellStart[0] = 0;
+	for(size_t i = 0; i < cellCount; ++i)
+		mCellStart[i + 1] = mCellStart[i] + counts[i];
+
+	mCellColliders.resize(mCellStart[cellCount]);
+
+	std::fill(counts.begin(), counts.end(), 0);
+	for(std::uint32_t i = 0; i < (std::uint32_t)mColliders.size(); ++i)
+	{
+		int x0, z0, x1, z1;
+		CellRange(mColliders[i].Box, x0, z0, x1, z1);
+		for(int z = z0; z <= z1; ++z)
+		{
+			for(int x = x0; x <= x1; ++x)
+			{
+				size_t cell = (size_t)z * mCellCountX + x;
+				mCellColliders[mCellStart[cell] + counts[cell]++] = i;
+			}
+		}
+	}
+}
+
+void CollisionGrid::Query(const BoundingBox& box, std::vector<std::uint32_t>& candidates)const
+{
+	candidates.clear();
+
+	int x0, z0, x1, z1;
+	if(mCellStart.empty() || !CellRange(box, x0, z0, x1, z1))
+		return;
+
+	for(int z = z0; z <= z1; ++z)
+	{
+		for(int x = x0; x <= x1; ++x)
+		{
+			size_t cell = (size_t)z * mCellCountX + x;
+			for(std::uint32_t i = mCellStart[cell]; i < mCellStart[cell + 1]; ++i)
+			{
+				std::uint32_t index = mCellColliders[i];
+				if(OverlapXZ(mColliders[index].Box, box))
+					candidates.push_back(index);
+			}
+		}
+	}
+
+	// A collider spanning several of the queried cells was found once per cell.
+	std::sort(candidates.begin(), candidates.end());
+	candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+}
+
+float CollisionGrid::Sweep(const BoundingBox& box, const XMFLOAT3& motion, XMFLOAT2& normal,
+	std::vector<std::uint32_t>& candidates)const
+{
+	normal = XMFLOAT2(0.0f, 0.0f);
+
+	// Whatever the box can run into overlaps the box around its start and end.
+	BoundingBox end = box;
+	end.Center.x += motion.x;
+	end.Center.z += motion.z;
+
+	BoundingBox swept;
+	BoundingBox::CreateMerged(swept, box, end);
+	Query(swept, candidates);
+
+	const float move[2] = { motion.x, motion.z };
+
+	float hit = 1.0f;
+	for(std::uint32_t index : candidates)
+	{
+		const BoundingBox& c = mColliders[index].Box;
+
+		// The box's center against the collider grown by the box's extents.
+		const float offset[2] = { box.Center.x - c.Center.x, box.Center.z - c.Center.z };
+		const float extent[2] = { c.Extents.x + box.Extents.x, c.Extents.z + box.Extents.z };
+
+		if(std::abs(offset[0]) < extent[0] && std::abs(offset[1]) < extent[1])
+			continue;
+
+		// Intersect the times the center is inside each slab.
+		float enter = -FLT_MAX;
+		float exit = 1.0f;
+		int enterAxis = -1;
+		for(int axis = 0; axis < 2 && enter < exit; ++axis)
+		{
+			if(std::abs(move[axis]) < 1e-8f)
+			{
+				if(std::abs(offset[axis]) >= extent[axis])
+					exit = -FLT_MAX;
+				continue;
+			}
+
+			float t0 = (-extent[axis] - offset[axis]) / move[axis];
+			float t1 = (extent[axis] - offset[axis]) / move[axis];
+			if(t0 > t1)
+				std::swap(t0, t1);
+
+			if(t0 > enter)
+			{
+				enter = t0;
+				enterAxis = axis;
+			}
+			exit = std::min(exit, t1);
+		}
+
+		// Starting outside, the center enters through a slab at a time of zero or more.
+		if(enterAxis < 0 || enter >= exit || enter < 0.0f || enter >= hit)
+			continue;
+
+		hit = enter;
+		normal = (enterAxis == 0) ? XMFLOAT2(move[0] > 0.0f ? -1.0f : 1.0f, 0.0f)
+			: XMFLOAT2(0.0f, move[1] > 0.0f ? -1.0f : 1.0f);
+	}
+
+	return hit;
+}
+
+const Collider& CollisionGrid::GetCollider(std::uint32_t index)const
+{
+	return mColliders[index];
+}
+
+std::uint32_t CollisionGrid::ColliderCount()const
+{
+	return (std::uint32_t)mColliders.size();
+}
+
+bool CollisionGrid::CellRange(const BoundingBox& box, int& x0, int& z0, int& x1, int& z1)const
+{
+	x0 = (int)std::floor((box.Center.x - box.Extents.x - mOriginX) / mCellSize);
+	z0 = (int)std::floor((box.Center.z - box.Extents.z - mOriginZ) / mCellSize);
+	x1 = (int)std::floor((box.Center.x + box.Extents.x - mOriginX) / mCellSize);
+	z1 = (int)std::floor((box.Center.z + box.Extents.z - mOriginZ) / mCellSize);
+
+	if(x1 < 0 || z1 < 0 || x0 >= mCellCountX || z0 >= mCellCountZ)
+		return false;
+
+	x0 = std::max(x0, 0);
+	z0 = std::max(z0, 0);
+	x1 = std::min(x1, mCellCountX - 1);
+	z1 = std::min(z1, mCellCountZ - 1);
+
+	return true;
+}
+
+bool CollisionGrid::OverlapXZ(const BoundingBox& a, const BoundingBox& b)
+{
+	return std::abs(a.Center.x - b.Center.x) <= a.Extents.x + b.Extents.x &&
+		std::abs(a.Center.z - b.Center.z) <= a.Extents.z + b.Extents.z;
+}
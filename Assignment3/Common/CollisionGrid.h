@@ -0,0 +1,80 @@
+//***************************************************************************************
+// CollisionGrid.h
+//
+// Static uniform grid over the XZ plane for the scene's collidable boxes.
+//   -Add() the colliders, then Build() once; the grid does not support moving
+//    colliders, so call Clear() and rebuild if the static geometry changes.
+//   -Query() returns the colliders whose boxes overlap the query box in XZ, so
+//    the per-frame cost depends on how crowded the cells around it are rather
+//    than on the number of colliders in the scene.
+//   -Sweep() moves a box through the grid in XZ and finds the first collider it
+//    runs into, so a box moving further than its own size in a step doesn't pass
+//    through thin walls.
+//***************************************************************************************
+
+#pragma once
+
+#include <cstdint>
+#include <DirectXCollision.h>
+#include <vector>
+
+enum class ColliderType : int
+{
+	Wall = 0,
+	Count
+};
+
+struct Collider
+{
+	DirectX::BoundingBox Box;
+	ColliderType Type = ColliderType::Wall;
+};
+
+class CollisionGrid
+{
+public:
+	explicit CollisionGrid(float cellSize = 10.0f);
+	CollisionGrid(const CollisionGrid& rhs) = delete;
+	CollisionGrid& operator=(const CollisionGrid& rhs) = delete;
+	~CollisionGrid() = default;
+
+	void Clear();
+	void Add(const DirectX::BoundingBox& box, ColliderType type);
+	void Build();
+
+	// Replaces the contents of candidates with the indices of the colliders
+	// overlapping the box, each listed once.
+	void Query(const DirectX::BoundingBox& box, std::vector<std::uint32_t>& candidates)const;
+
+	// Returns the fraction of motion the box travels in XZ before it touches a
+	// collider, 1 if it touches none, and sets normal to the XZ normal of the face
+	// it touches.  Colliders the box already overlaps are passed through, so it can
+	// always leave them.  candidates is scratch space, as for Query().
+	float Sweep(const DirectX::BoundingBox& box, const DirectX::XMFLOAT3& motion, DirectX::XMFLOAT2& normal,
+		std::vector<std::uint32_t>& candidates)const;
+
+	const Collider& GetCollider(std::uint32_t index)const;
+	std::uint32_t ColliderCount()const;
+
+private:
+	// Inclusive range of cells covered by the box, clamped to the grid.  Returns
+	// false if the box lies entirely outside the grid.
+	bool CellRange(const DirectX::BoundingBox& box, int& x0, int& z0, int& x1, int& z1)const;
+
+	static bool OverlapXZ(const DirectX::BoundingBox& a, const DirectX::BoundingBox& b);
+
+private:
+	float mCellSize = 10.0f;
+
+	float mOriginX = 0.0f;
+	float mOriginZ = 0.0f;
+	int mCellCountX = 0;
+	int mCellCountZ = 0;
+
+	// Colliders stored contiguously; the cells reference them by index.
+	std::vector<Collider> mColliders;
+
+	// Collider indices of cell c are mCellColliders[mCellStart[c], mCellStart[c + 1]).
+	std::vector<std::uint32_t> mCellStart;
+	std::vector<std::uint32_t> mCellColliders;
+};
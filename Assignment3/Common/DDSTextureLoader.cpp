@@ -24,6 +24,8 @@
 #include <wrl.h>
 
 #include "DDSTextureLoader.h" 
+#include "PlacedResourceAllocator.h"
+#include "UploadRingBuffer.h"
 
 using namespace Microsoft::WRL;
 
@@ -130,6 +132,10 @@ typedef public std::unique_ptr<void, handle_closer> ScopedHandle;
 
 inline HANDLE safe_handle( HANDLE h ) { return (h == INVALID_HANDLE_VALUE) ? 0 : h; }
 
+struct view_unmapper { void operator()(const void* p) { if (p) UnmapViewOfFile(p); } };
+
+typedef public std::unique_ptr<const void, view_unmapper> ScopedMapView;
+
 template<UINT TNameLength>
 inline void SetDebugObjectName(_In_ ID3D11DeviceChild* resource, _In_ const char (&name)[TNameLength])
 {
@@ -269,6 +275,131 @@ static HRESULT LoadTextureDataFromFile( _In_z_ const wchar_t* fileName,
 }
 
 
+//--------------------------------------------------------------------------------------
+// Same as LoadTextureDataFromFile, but maps the file read-only instead of reading it
+// into a heap buffer.  header and bitData point into the view, which must outlive
+// them; pages fault in from the file cache as they are touched, so the only copy
+// left is the one into the upload heap.
+//--------------------------------------------------------------------------------------
+static HRESULT MapTextureDataFromFile( _In_z_ const wchar_t* fileName,
+                                       ScopedMapView& view,
+                                       const DDS_HEADER** header,
+                                       const uint8_t** bitData,
+                                       size_t* bitSize
+                                     )
+{
+    if (!header || !bitData || !bitSize)
+    {
+        return E_POINTER;
+    }
+
+    // open the file
+#if (_WIN32_WINNT >= _WIN32_WINNT_WIN8)
+    CREATEFILE2_EXTENDED_PARAMETERS params = {};
+    params.dwSize = sizeof(params);
+    params.dwFileAttributes = FILE_ATTRIBUTE_NORMAL;
+    params.dwFileFlags = FILE_FLAG_SEQUENTIAL_SCAN;
+    ScopedHandle hFile( safe_handle( CreateFile2( fileName,
+                                                  GENERIC_READ,
+                                                  FILE_SHARE_READ,
+                                                  OPEN_EXISTING,
+                                                  &params ) ) );
+#else
+    ScopedHandle hFile( safe_handle( CreateFileW( fileName,
+                                                  GENERIC_READ,
+                                                  FILE_SHARE_READ,
+                                                  nullptr,
+                                                  OPEN_EXISTING,
+                                                  FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+                                                  nullptr ) ) );
+#endif
+
+    if ( !hFile )
+    {
+        return HRESULT_FROM_WIN32( GetLastError() );
+    }
+
+    // Get the file size
+    LARGE_INTEGER FileSize = { 0 };
+    if ( !GetFileSizeEx( hFile.get(), &FileSize ) )
+    {
+        return HRESULT_FROM_WIN32( GetLastError() );
+    }
+
+    // File is too big for 32-bit addressing, so reject it
+    if (FileSize.HighPart > 0)
+    {
+        return E_FAIL;
+    }
+
+    // Need at least enough data to fill the header and magic number to be a valid DDS
+    if (FileSize.LowPart < ( sizeof(DDS_HEADER) + sizeof(uint32_t) ) )
+    {
+        return E_FAIL;
+    }
+
+    // The view keeps the mapping alive, so neither handle is needed past this function
+    ScopedHandle hMapping( CreateFileMappingW( hFile.get(), nullptr, PAGE_READONLY, 0, 0, nullptr ) );
+    if ( !hMapping )
+    {
+        return HRESULT_FROM_WIN32( GetLastError() );
+    }
+
+    view.reset( MapViewOfFile( hMapping.get(), FILE_MAP_READ, 0, 0, 0 ) );
+    if ( !view )
+    {
+        return HRESULT_FROM_WIN32( GetLastError() );
+    }
+
+    auto ddsData = static_cast<const uint8_t*>( view.get() );
+
+#if (_WIN32_WINNT >= _WIN32_WINNT_WIN8)
+    // Start reading the whole file in while the caller creates the texture
+    WIN32_MEMORY_RANGE_ENTRY range = { const_cast<uint8_t*>( ddsData ), FileSize.LowPart };
+    PrefetchVirtualMemory( GetCurrentProcess(), 1, &range, 0 );
+#endif
+
+    // DDS files always start with the same magic number ("DDS ")
+    uint32_t dwMagicNumber = *( const uint32_t* )( ddsData );
+    if (dwMagicNumber != DDS_MAGIC)
+    {
+        return E_FAIL;
+    }
+
+    auto hdr = reinterpret_cast<const DDS_HEADER*>( ddsData + sizeof( uint32_t ) );
+
+    // Verify header to validate DDS file
+    if (hdr->size != sizeof(DDS_HEADER) ||
+        hdr->ddspf.size != sizeof(DDS_PIXELFORMAT))
+    {
+        return E_FAIL;
+    }
+
+    // Check for DX10 extension
+    bool bDXT10Header = false;
+    if ((hdr->ddspf.flags & DDS_FOURCC) &&
+        (MAKEFOURCC( 'D', 'X', '1', '0' ) == hdr->ddspf.fourCC))
+    {
+        // Must be long enough for both headers and magic value
+        if (FileSize.LowPart < ( sizeof(DDS_HEADER) + sizeof(uint32_t) + sizeof(DDS_HEADER_DXT10) ) )
+        {
+            return E_FAIL;
+        }
+
+        bDXT10Header = true;
+    }
+
+    // setup the pointers in the process request
+    *header = hdr;
+    ptrdiff_t offset = sizeof( uint32_t ) + sizeof( DDS_HEADER )
+                       + (bDXT10Header ? sizeof( DDS_HEADER_DXT10 ) : 0);
+    *bitData = ddsData + offset;
+    *bitSize = FileSize.LowPart - offset;
+
+    return S_OK;
+}
+
+
 //--------------------------------------------------------------------------------------
 // Return the BPP for a particular format
 //--------------------------------------------------------------------------------------
@@ -1241,7 +1372,10 @@ static HRESULT CreateD3DResources12(
 	_In_ bool isCubeMap,
 	_In_reads_opt_(mipCount*arraySize) D3D12_SUBRESOURCE_DATA* initData,
 	ComPtr<ID3D12Resource>& texture,
-	ComPtr<ID3D12Resource>& textureUploadHeap
+	ComPtr<ID3D12Resource>& textureUploadHeap,
+	PlacedResourceAllocator* allocator = nullptr,
+	UploadRingBuffer* stagingRing = nullptr,
+	D3D12_RESOURCE_STATES afterState = D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE
 	)
 {
 	if (device == nullptr)
@@ -1269,6 +1403,33 @@ static HRESULT CreateD3DResources12(
 		texDesc.Layout = D3D12_TEXTURE_LAYOUT_UNKNOWN;
 		texDesc.Flags = D3D12_RESOURCE_FLAG_NONE;
 
+		if (allocator != nullptr && stagingRing != nullptr)
+		{
+			// Placed path: the texture lives in one of the allocator's shared heaps and
+			// its texels are staged through the caller's ring instead of a private upload heap.
+			hr = allocator->CreateResource(texDesc, D3D12_RESOURCE_STATE_COMMON, texture);
+			if (FAILED(hr))
+			{
+				texture = nullptr;
+				return hr;
+			}
+
+			const UINT num2DSubresources = texDesc.DepthOrArraySize * texDesc.MipLevels;
+			const UINT64 uploadBufferSize = GetRequiredIntermediateSize(texture.Get(), 0, num2DSubresources);
+
+			UploadRingBuffer::Allocation staging = stagingRing->Allocate(
+				uploadBufferSize, D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT);
+
+			cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(texture.Get(),
+				D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_COPY_DEST));
+
+			UpdateSubresources(cmdList, texture.Get(), staging.Resource, staging.Offset, 0, num2DSubresources, initData);
+
+			cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(texture.Get(),
+				D3D12_RESOURCE_STATE_COPY_DEST, afterState));
+			break;
+		}
+
 		hr = device->CreateCommittedResource(
 			&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
 			D3D12_HEAP_FLAG_NONE,
@@ -1678,7 +1839,10 @@ static HRESULT CreateTextureFromDDS12(
 	_In_ size_t maxsize,
 	_In_ bool forceSRGB,
 	ComPtr<ID3D12Resource>& texture,
-	ComPtr<ID3D12Resource>& textureUploadHeap)
+	ComPtr<ID3D12Resource>& textureUploadHeap,
+	PlacedResourceAllocator* allocator = nullptr,
+	UploadRingBuffer* stagingRing = nullptr,
+	D3D12_RESOURCE_STATES afterState = D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE)
 {
 	HRESULT hr = S_OK;
 
@@ -1867,7 +2031,10 @@ static HRESULT CreateTextureFromDDS12(
 			isCubeMap,
 			initData.get(),
 			texture, 
-			textureUploadHeap);
+			textureUploadHeap,
+			allocator,
+			stagingRing,
+			afterState);
 	}
 
 	return hr;
@@ -1917,16 +2084,18 @@ HRESULT DirectX::CreateDDSTextureFromMemory( ID3D11Device* d3dDevice,
                                          texture, textureView, alphaMode );
 }
 
-_Use_decl_annotations_
-HRESULT DirectX::CreateDDSTextureFromMemory12(
+static HRESULT CreateTextureFromMemory12(
 	ID3D12Device* device,
-	_In_ ID3D12GraphicsCommandList* cmdList,
-	_In_reads_bytes_(ddsDataSize) const uint8_t* ddsData,
-	_In_ size_t ddsDataSize,
+	ID3D12GraphicsCommandList* cmdList,
+	const uint8_t* ddsData,
+	size_t ddsDataSize,
 	ComPtr<ID3D12Resource>& texture,
 	ComPtr<ID3D12Resource>& textureUploadHeap,
-	_In_ size_t maxsize,
-	_Out_opt_ DDS_ALPHA_MODE* alphaMode
+	size_t maxsize,
+	DDS_ALPHA_MODE* alphaMode,
+	PlacedResourceAllocator* allocator,
+	UploadRingBuffer* stagingRing,
+	D3D12_RESOURCE_STATES afterState
 	)
 {
 	if (alphaMode)
@@ -1979,7 +2148,10 @@ HRESULT DirectX::CreateDDSTextureFromMemory12(
 		maxsize,
 		false,
 		texture,
-		textureUploadHeap
+		textureUploadHeap,
+		allocator,
+		stagingRing,
+		afterState
 		);
 
 	if (SUCCEEDED(hr))
@@ -1991,6 +2163,49 @@ HRESULT DirectX::CreateDDSTextureFromMemory12(
 	return hr;
 }
 
+_Use_decl_annotations_
+HRESULT DirectX::CreateDDSTextureFromMemory12(
+	ID3D12Device* device,
+	_In_ ID3D12GraphicsCommandList* cmdList,
+	_In_reads_bytes_(ddsDataSize) const uint8_t* ddsData,
+	_In_ size_t ddsDataSize,
+	ComPtr<ID3D12Resource>& texture,
+	ComPtr<ID3D12Resource>& textureUploadHeap,
+	_In_ size_t maxsize,
+	_Out_opt_ DDS_ALPHA_MODE* alphaMode
+	)
+{
+	return CreateTextureFromMemory12(device, cmdList, ddsData, ddsDataSize,
+		texture, textureUploadHeap, maxsize, alphaMode,
+		nullptr, nullptr, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+}
+
+_Use_decl_annotations_
+HRESULT DirectX::CreateDDSTextureFromMemory12(
+	ID3D12Device* device,
+	_In_ ID3D12GraphicsCommandList* cmdList,
+	_In_reads_bytes_(ddsDataSize) const uint8_t* ddsData,
+	_In_ size_t ddsDataSize,
+	_In_ PlacedResourceAllocator& allocator,
+	_In_ UploadRingBuffer& stagingRing,
+	ComPtr<ID3D12Resource>& texture,
+	_In_ size_t maxsize,
+	_In_ D3D12_RESOURCE_STATES afterState,
+	_Out_opt_ DDS_ALPHA_MODE* alphaMode
+	)
+{
+	if (texture)
+	{
+		texture = nullptr;
+	}
+
+	// Unused: the staging memory belongs to the ring and is recycled by its fence.
+	ComPtr<ID3D12Resource> textureUploadHeap;
+	return CreateTextureFromMemory12(device, cmdList, ddsData, ddsDataSize,
+		texture, textureUploadHeap, maxsize, alphaMode,
+		&allocator, &stagingRing, afterState);
+}
+
 _Use_decl_annotations_
 HRESULT DirectX::CreateDDSTextureFromMemory( ID3D11Device* d3dDevice,
                                              ID3D11DeviceContext* d3dContext,
@@ -2228,6 +2443,54 @@ HRESULT DirectX::CreateDDSTextureFromFile12(_In_ ID3D12Device* device,
 	return hr;
 }
 
+HRESULT DirectX::CreateDDSTextureFromFile12(_In_ ID3D12Device* device,
+	_In_ ID3D12GraphicsCommandList* cmdList,
+	_In_z_ const wchar_t* szFileName,
+	_In_ PlacedResourceAllocator& allocator,
+	_In_ UploadRingBuffer& stagingRing,
+	_Out_ ComPtr<ID3D12Resource>& texture,
+	_In_ size_t maxsize,
+	_In_ D3D12_RESOURCE_STATES afterState,
+	_Out_opt_ DDS_ALPHA_MODE* alphaMode)
+{
+	if (texture)
+	{
+		texture = nullptr;
+	}
+	if (alphaMode)
+	{
+		*alphaMode = DDS_ALPHA_MODE_UNKNOWN;
+	}
+
+	if (!device || !cmdList || !szFileName)
+	{
+		return E_INVALIDARG;
+	}
+
+	const DDS_HEADER* header = nullptr;
+	const uint8_t* bitData = nullptr;
+	size_t bitSize = 0;
+
+	// Texels go straight from the mapped file into the staging ring.
+	ScopedMapView ddsView;
+	HRESULT hr = MapTextureDataFromFile(szFileName, ddsView, &header, &bitData, &bitSize);
+	if (FAILED(hr))
+	{
+		return hr;
+	}
+
+	// Unused: the staging memory belongs to the ring and is recycled by its fence.
+	ComPtr<ID3D12Resource> textureUploadHeap;
+	hr = CreateTextureFromDDS12(device, cmdList, header,
+		bitData, bitSize, maxsize, false, texture, textureUploadHeap,
+		&allocator, &stagingRing, afterState);
+
+	if (SUCCEEDED(hr) && alphaMode)
+		*alphaMode = GetAlphaMode(header);
+
+	return hr;
+}
+
 _Use_decl_annotations_
 HRESULT DirectX::CreateDDSTextureFromFile( ID3D11Device* d3dDevice,
                                            ID3D11DeviceContext* d3dContext,
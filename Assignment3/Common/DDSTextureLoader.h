@@ -44,6 +44,9 @@
 #define _Use_decl_annotations_
 #endif
 
+class PlacedResourceAllocator;
+class UploadRingBuffer;
+
 namespace DirectX
 {
     enum DDS_ALPHA_MODE
@@ -75,6 +78,20 @@ namespace DirectX
 		                                 _Out_opt_ DDS_ALPHA_MODE* alphaMode = nullptr
 		                                 );
 
+	// Placed/staged variant of the above.  afterState is the state the texture is left
+	// in; pass D3D12_RESOURCE_STATE_COMMON when recording on a copy command list.
+	HRESULT CreateDDSTextureFromMemory12(_In_ ID3D12Device* device,
+		                                 _In_ ID3D12GraphicsCommandList* cmdList,
+		                                 _In_reads_bytes_(ddsDataSize) const uint8_t* ddsData,
+		                                 _In_ size_t ddsDataSize,
+		                                 _In_ PlacedResourceAllocator& allocator,
+		                                 _In_ UploadRingBuffer& stagingRing,
+		                                 _Out_ Microsoft::WRL::ComPtr<ID3D12Resource>& texture,
+		                                 _In_ size_t maxsize = 0,
+		                                 _In_ D3D12_RESOURCE_STATES afterState = D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE,
+		                                 _Out_opt_ DDS_ALPHA_MODE* alphaMode = nullptr
+		                                 );
+
     HRESULT CreateDDSTextureFromFile( _In_ ID3D11Device* d3dDevice,
                                       _In_z_ const wchar_t* szFileName,
                                       _Outptr_opt_ ID3D11Resource** texture,
@@ -92,6 +109,21 @@ namespace DirectX
 		                               _Out_opt_ DDS_ALPHA_MODE* alphaMode = nullptr
 		                               );
 
+	// Places the texture in one of the allocator's heaps and stages its texels in
+	// stagingRing; the ring must not recycle that space until the copy has executed.
+	// The file is memory mapped rather than read, so its texels are copied once, from
+	// the file cache into the ring.  See CreateDDSTextureFromMemory12 for afterState.
+	HRESULT CreateDDSTextureFromFile12(_In_ ID3D12Device* device,
+		                               _In_ ID3D12GraphicsCommandList* cmdList,
+		                               _In_z_ const wchar_t* szFileName,
+		                               _In_ PlacedResourceAllocator& allocator,
+		                               _In_ UploadRingBuffer& stagingRing,
+		                               _Out_ Microsoft::WRL::ComPtr<ID3D12Resource>& texture,
+		                               _In_ size_t maxsize = 0,
+		                               _In_ D3D12_RESOURCE_STATES afterState = D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE,
+		                               _Out_opt_ DDS_ALPHA_MODE* alphaMode = nullptr
+		                               );
+
     // Standard version with optional auto-gen mipmap support
     HRESULT CreateDDSTextureFromMemory( _In_ ID3D11Device* d3dDevice,
                                         _In_opt_ ID3D11DeviceContext* d3dContext,
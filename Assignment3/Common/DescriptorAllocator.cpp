@@ -0,0 +1,74 @@
+//***************************************************************************************
+// DescriptorAllocator.cpp
+//***************************************************************************************
+
+#include "DescriptorAllocator.h"
+
+DescriptorAllocator::DescriptorAllocator(ID3D12Device* device, D3D12_DESCRIPTOR_HEAP_TYPE type, UINT capacity, bool shaderVisible) :
+	mCapacity(capacity)
+{
+	D3D12_DESCRIPTOR_HEAP_DESC heapDesc = {};
+	heapDesc.NumDescriptors = capacity;
+	heapDesc.Type = type;
+	heapDesc.Flags = shaderVisible ? D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE : D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
+	ThrowIfFailed(device->CreateDescriptorHeap(&heapDesc, IID_PPV_ARGS(mHeap.GetAddressOf())));
+
+	mDescriptorSize = device->GetDescriptorHandleIncrementSize(type);
+
+	// Popped from the back, so the lowest indices go first.
+	mFreeList.reserve(capacity);
+	for(UINT i = capacity; i > 0; --i)
+		mFreeList.push_back(i - 1);
+}
+
+UINT DescriptorAllocator::Allocate()
+{
+	if(mFreeList.empty())
+		ThrowIfFailed(E_OUTOFMEMORY);
+
+	UINT index = mFreeList.back();
+	mFreeList.pop_back();
+	return index;
+}
+
+void DescriptorAllocator::Free(UINT index, UINT64 retireFence)
+{
+	assert(index < mCapacity);
+
+	// Fences only grow, so the queue stays ordered.
+	mRetired.push_back({ index, retireFence });
+}
+
+void DescriptorAllocator::ReleaseCompleted(UINT64 completedFence)
+{
+	while(!mRetired.empty() && mRetired.front().Fence <= completedFence)
+	{
+		mFreeList.push_back(mRetired.front().Index);
+		mRetired.pop_front();
+	}
+}
+
+ID3D12DescriptorHeap* DescriptorAllocator::Heap()const
+{
+	return mHeap.Get();
+}
+
+CD3DX12_CPU_DESCRIPTOR_HANDLE DescriptorAllocator::CpuHandle(UINT index)const
+{
+	return CD3DX12_CPU_DESCRIPTOR_HANDLE(mHeap->GetCPUDescriptorHandleForHeapStart(), (INT)index, mDescriptorSize);
+}
+
+CD3DX12_GPU_DESCRIPTOR_HANDLE DescriptorAllocator::GpuHandle(UINT index)const
+{
+	return CD3DX12_GPU_DESCRIPTOR_HANDLE(mHeap->GetGPUDescriptorHandleForHeapStart(), (INT)index, mDescriptorSize);
+}
+
+UINT DescriptorAllocator::Capacity()const
+{
+	return mCapacity;
+}
+
+UINT DescriptorAllocator::AllocatedCount()const
+{
+	return mCapacity - (UINT)mFreeList.size() - (UINT)mRetired.size();
+}
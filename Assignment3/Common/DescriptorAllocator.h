@@ -0,0 +1,53 @@
+//***************************************************************************************
+// DescriptorAllocator.h
+//
+// One large, persistent descriptor heap handed out a descriptor at a time.
+//   -Allocate() pops a free-list, so any index can be reused in any order; the heap
+//    is never rebuilt or rebound.
+//   -Free() takes the fence value of the last frame that may still read the
+//    descriptor.  The index only returns to the free-list once ReleaseCompleted()
+//    sees the GPU past that fence.
+//   -A shader-visible CBV/SRV/UAV heap is meant to be bound whole as the table of
+//    an unbounded descriptor range, so shaders index it with the values Allocate()
+//    returns.
+//***************************************************************************************
+
+#pragma once
+
+#include "d3dUtil.h"
+#include <deque>
+
+class DescriptorAllocator
+{
+public:
+	DescriptorAllocator(ID3D12Device* device, D3D12_DESCRIPTOR_HEAP_TYPE type, UINT capacity, bool shaderVisible);
+	DescriptorAllocator(const DescriptorAllocator& rhs) = delete;
+	DescriptorAllocator& operator=(const DescriptorAllocator& rhs) = delete;
+	~DescriptorAllocator() = default;
+
+	// Throws DxException with E_OUTOFMEMORY when the heap is full.
+	UINT Allocate();
+	void Free(UINT index, UINT64 retireFence);
+	void ReleaseCompleted(UINT64 completedFence);
+
+	ID3D12DescriptorHeap* Heap()const;
+	CD3DX12_CPU_DESCRIPTOR_HANDLE CpuHandle(UINT index)const;
+	CD3DX12_GPU_DESCRIPTOR_HANDLE GpuHandle(UINT index)const;
+
+	UINT Capacity()const;
+	UINT AllocatedCount()const;
+
+private:
+	struct Retired
+	{
+		UINT Index;
+		UINT64 Fence;
+	};
+
+	Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> mHeap;
+	UINT mDescriptorSize = 0;
+	UINT mCapacity = 0;
+
+	std::vector<UINT> mFreeList;
+	std::deque<Retired> mRetired;
+};
@@ -0,0 +1,155 @@
+//***************************************************************************************
+// DrawStateCache.h
+//
+// Thin wrapper over a graphics command list that remembers the pipeline state,
+// input assembler bindings and root arguments last set on it, and drops calls
+// that would set the same value again.  Call Invalidate() after anything that
+// resets the bindings behind the cache's back (Reset, SetGraphicsRootSignature,
+// ExecuteBundle), or InvalidateRootArgument() after an ExecuteIndirect whose
+// command signature sets that root argument.
+//***************************************************************************************
+
+#pragma once
+
+#include "d3dUtil.h"
+
+class DrawStateCache
+{
+public:
+    explicit DrawStateCache(ID3D12GraphicsCommandList* cmdList) :
+        mCmdList(cmdList)
+    {
+        Invalidate();
+    }
+
+    DrawStateCache(const DrawStateCache& rhs) = delete;
+    DrawStateCache& operator=(const DrawStateCache& rhs) = delete;
+
+    ID3D12GraphicsCommandList* CommandList()const
+    {
+        return mCmdList;
+    }
+
+    void Invalidate()
+    {
+        mPipelineState = nullptr;
+        mVertexBuffers.fill({});
+        mIndexBuffer = {};
+        mTopology = D3D_PRIMITIVE_TOPOLOGY_UNDEFINED;
+        mRootArgs.fill(InvalidRootArg);
+    }
+
+    void InvalidateRootArgument(UINT rootIndex)
+    {
+        assert(rootIndex < MaxRootParameters);
+        mRootArgs[rootIndex] = InvalidRootArg;
+    }
+
+    void SetPipelineState(ID3D12PipelineState* pso)
+    {
+        if(pso == mPipelineState) { ++mSkippedCalls; return; }
+        mCmdList->SetPipelineState(pso);
+        mPipelineState = pso;
+    }
+
+    void SetVertexBuffer(const D3D12_VERTEX_BUFFER_VIEW& vbv, UINT slot = 0)
+    {
+        assert(slot < MaxVertexBuffers);
+        D3D12_VERTEX_BUFFER_VIEW& current = mVertexBuffers[slot];
+        if(vbv.BufferLocation == current.BufferLocation &&
+           vbv.SizeInBytes == current.SizeInBytes &&
+           vbv.StrideInBytes == current.StrideInBytes)
+        {
+            ++mSkippedCalls;
+            return;
+        }
+        mCmdList->IASetVertexBuffers(slot, 1, &vbv);
+        current = vbv;
+    }
+
+    void SetIndexBuffer(const D3D12_INDEX_BUFFER_VIEW& ibv)
+    {
+        if(ibv.BufferLocation == mIndexBuffer.BufferLocation &&
+           ibv.SizeInBytes == mIndexBuffer.SizeInBytes &&
+           ibv.Format == mIndexBuffer.Format)
+        {
+            ++mSkippedCalls;
+            return;
+        }
+        mCmdList->IASetIndexBuffer(&ibv);
+        mIndexBuffer = ibv;
+    }
+
+    void SetPrimitiveTopology(D3D12_PRIMITIVE_TOPOLOGY topology)
+    {
+        if(topology == mTopology) { ++mSkippedCalls; return; }
+        mCmdList->IASetPrimitiveTopology(topology);
+        mTopology = topology;
+    }
+
+    void SetGraphicsRootDescriptorTable(UINT rootIndex, D3D12_GPU_DESCRIPTOR_HANDLE handle)
+    {
+        if(!UpdateRootArg(rootIndex, handle.ptr)) return;
+        mCmdList->SetGraphicsRootDescriptorTable(rootIndex, handle);
+    }
+
+    void SetGraphicsRootConstantBufferView(UINT rootIndex, D3D12_GPU_VIRTUAL_ADDRESS address)
+    {
+        if(!UpdateRootArg(rootIndex, address)) return;
+        mCmdList->SetGraphicsRootConstantBufferView(rootIndex, address);
+    }
+
+    void SetGraphicsRootShaderResourceView(UINT rootIndex, D3D12_GPU_VIRTUAL_ADDRESS address)
+    {
+        if(!UpdateRootArg(rootIndex, address)) return;
+        mCmdList->SetGraphicsRootShaderResourceView(rootIndex, address);
+    }
+
+    void SetGraphicsRoot32BitConstant(UINT rootIndex, UINT value)
+    {
+        if(!UpdateRootArg(rootIndex, value)) return;
+        mCmdList->SetGraphicsRoot32BitConstant(rootIndex, value, 0);
+    }
+
+    // Both values are cached as one argument, so a pair of ~0u cannot be filtered.
+    void SetGraphicsRoot32BitConstants(UINT rootIndex, UINT first, UINT second)
+    {
+        if(!UpdateRootArg(rootIndex, ((UINT64)second << 32) | first)) return;
+        const UINT values[] = { first, second };
+        mCmdList->SetGraphicsRoot32BitConstants(rootIndex, _countof(values), values, 0);
+    }
+
+    // Number of redundant calls filtered out since construction.
+    UINT SkippedCalls()const
+    {
+        return mSkippedCalls;
+    }
+
+private:
+    bool UpdateRootArg(UINT rootIndex, UINT64 value)
+    {
+        assert(rootIndex < MaxRootParameters);
+        if(mRootArgs[rootIndex] == value)
+        {
+            ++mSkippedCalls;
+            return false;
+        }
+        mRootArgs[rootIndex] = value;
+        return true;
+    }
+
+private:
+    static const UINT MaxRootParameters = 16;
+    static const UINT MaxVertexBuffers = 2;
+    static const UINT64 InvalidRootArg = ~0ull;
+
+    ID3D12GraphicsCommandList* mCmdList = nullptr;
+
+    ID3D12PipelineState* mPipelineState = nullptr;
+    std::array<D3D12_VERTEX_BUFFER_VIEW, MaxVertexBuffers> mVertexBuffers;
+    D3D12_INDEX_BUFFER_VIEW mIndexBuffer = {};
+    D3D12_PRIMITIVE_TOPOLOGY mTopology = D3D_PRIMITIVE_TOPOLOGY_UNDEFINED;
+    std::array<UINT64, MaxRootParameters> mRootArgs;
+
+    UINT mSkippedCalls = 0;
+};
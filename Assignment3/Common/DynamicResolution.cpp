@@ -0,0 +1,65 @@
+//***************************************************************************************
+// DynamicResolution.cpp
+//***************************************************************************************
+
+#include "DynamicResolution.h"
+#include "MathHelper.h"
+#include <cmath>
+
+const float DynamicResolution::Headroom = 0.85f;
+const float DynamicResolution::MaxStep = 0.05f;
+const float DynamicResolution::Smoothing = 0.2f;
+
+static const float ScaleQuantum = 1.0f / 64.0f;
+
+DynamicResolution::DynamicResolution(float minScale, float maxScale) :
+	mMinScale(minScale),
+	mMaxScale(maxScale),
+	mScale(maxScale)
+{
+	assert(minScale > 0.0f && minScale <= maxScale);
+}
+
+void DynamicResolution::SetTargetMs(float targetMs)
+{
+	mTargetMs = MathHelper::Max(targetMs, 0.0f);
+	mSmoothedMs = -1.0f;
+	if(mTargetMs == 0.0f)
+		mScale = mMaxScale;
+}
+
+float DynamicResolution::TargetMs()const
+{
+	return mTargetMs;
+}
+
+bool DynamicResolution::Enabled()const
+{
+	return mTargetMs > 0.0f;
+}
+
+void DynamicResolution::Update(float gpuMs)
+{
+	if(!Enabled() || gpuMs <= 0.0f)
+		return;
+
+	mSmoothedMs = (mSmoothedMs < 0.0f) ? gpuMs : mSmoothedMs + Smoothing * (gpuMs - mSmoothedMs);
+
+	if(mSmoothedMs <= mTargetMs && mSmoothedMs >= mTargetMs * Headroom)
+		return;
+
+	float wanted = mScale * sqrtf(mTargetMs / mSmoothedMs);
+	float scale = MathHelper::Clamp(wanted, mScale - MaxStep, mScale + MaxStep);
+	scale = floorf(scale / ScaleQuantum + 0.5f) * ScaleQuantum;
+	mScale = MathHelper::Clamp(scale, mMinScale, mMaxScale);
+}
+
+float DynamicResolution::Scale()const
+{
+	return mScale;
+}
+
+UINT DynamicResolution::ScaledSize(UINT size)const
+{
+	return MathHelper::Max(1u, (UINT)(size * mScale + 0.5f));
+}
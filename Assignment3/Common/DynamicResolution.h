@@ -0,0 +1,50 @@
+//***************************************************************************************
+// DynamicResolution.h
+//
+// Picks the fraction of the window the scene is rendered at from the GPU frame time.
+//   -Update() takes the GPU milliseconds of the latest frame the profiler collected
+//    and smooths them.  Above the target the scale drops, below TargetMs * Headroom
+//    it rises; in between it stays, so it does not hunt around the target.
+//   -The GPU time goes roughly with the pixel count, the square of the scale, so a
+//    step aims at scale * sqrt(target / time).  Steps are limited to MaxStep per
+//    call because the time being read is several frames old.
+//   -The scale is quantized to 1/64 so small changes don't move the viewport every
+//    frame.  With no target (0 ms) it stays at the maximum.
+//***************************************************************************************
+
+#pragma once
+
+#include "d3dUtil.h"
+
+class DynamicResolution
+{
+public:
+	DynamicResolution(float minScale = 0.5f, float maxScale = 1.0f);
+	DynamicResolution(const DynamicResolution& rhs) = delete;
+	DynamicResolution& operator=(const DynamicResolution& rhs) = delete;
+	~DynamicResolution() = default;
+
+	// 0 disables it and returns the scale to the maximum.
+	void SetTargetMs(float targetMs);
+	float TargetMs()const;
+	bool Enabled()const;
+
+	// A negative time, e.g. a frame the profiler did not time, is ignored.
+	void Update(float gpuMs);
+
+	float Scale()const;
+
+	// size * Scale(), rounded, and at least 1.
+	UINT ScaledSize(UINT size)const;
+
+private:
+	static const float Headroom;
+	static const float MaxStep;
+	static const float Smoothing;
+
+	float mMinScale = 0.5f;
+	float mMaxScale = 1.0f;
+	float mTargetMs = 0.0f;
+	float mSmoothedMs = -1.0f;
+	float mScale = 1.0f;
+};
@@ -0,0 +1,144 @@
+//***************************************************************************************
+// FileWatcher.cpp
+//***************************************************************************************
+
+#include "FileWatcher.h"
+
+FileWatcher::~FileWatcher()
+{
+	Stop();
+}
+
+bool FileWatcher::Start(const std::wstring& directory, bool recursive)
+{
+	Stop();
+
+	mDirectory = CreateFileW(directory.c_str(), FILE_LIST_DIRECTORY,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+		FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+	if(mDirectory == INVALID_HANDLE_VALUE)
+		return false;
+
+	mStopEvent = CreateEventEx(nullptr, nullptr, CREATE_EVENT_MANUAL_RESET, EVENT_ALL_ACCESS);
+	if(mStopEvent == nullptr)
+		ThrowIfFailed(HRESULT_FROM_WIN32(GetLastError()));
+
+	mRecursive = recursive;
+	mThread = std::thread(&FileWatcher::WatchLoop, this);
+	return true;
+}
+
+void FileWatcher::Stop()
+{
+	if(mThread.joinable())
+	{
+		SetEvent(mStopEvent);
+		mThread.join();
+	}
+
+	if(mStopEvent != nullptr)
+		CloseHandle(mStopEvent);
+	if(mDirectory != INVALID_HANDLE_VALUE)
+		CloseHandle(mDirectory);
+	mStopEvent = nullptr;
+	mDirectory = INVALID_HANDLE_VALUE;
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	mChanges.clear();
+}
+
+void FileWatcher::TakeChanges(std::vector<std::wstring>& files)
+{
+	const ULONGLONG now = GetTickCount64();
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	for(size_t i = 0; i < mChanges.size();)
+	{
+		if(now - mChanges[i].second < SettleMs)
+		{
+			++i;
+			continue;
+		}
+
+		files.push_back(std::move(mChanges[i].first));
+		mChanges[i] = std::move(mChanges.back());
+		mChanges.pop_back();
+	}
+}
+
+void FileWatcher::WatchLoop()
+{
+	HANDLE completion = CreateEventEx(nullptr, nullptr, CREATE_EVENT_MANUAL_RESET, EVENT_ALL_ACCESS);
+	if(completion == nullptr)
+		return;
+
+	// FILE_NOTIFY_INFORMATION records have to be DWORD aligned.
+	std::vector<DWORD> buffer(16 * 1024);
+	const DWORD filter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE;
+
+	for(;;)
+	{
+		OVERLAPPED overlapped = {};
+		overlapped.hEvent = completion;
+		ResetEvent(completion);
+
+		if(!ReadDirectoryChangesW(mDirectory, buffer.data(), (DWORD)(buffer.size() * sizeof(DWORD)),
+			mRecursive, filter, nullptr, &overlapped, nullptr))
+			break;
+
+		HANDLE events[2] = { mStopEvent, completion };
+		DWORD bytes = 0;
+		if(WaitForMultipleObjects(2, events, FALSE, INFINITE) != WAIT_OBJECT_0 + 1)
+		{
+			// The read still owns the buffer until the cancellation completes.
+			CancelIoEx(mDirectory, &overlapped);
+			GetOverlappedResult(mDirectory, &overlapped, &bytes, TRUE);
+			break;
+		}
+
+		if(!GetOverlappedResult(mDirectory, &overlapped, &bytes, FALSE))
+		{
+			if(GetLastError() != ERROR_NOTIFY_ENUM_DIR)
+				break;
+			bytes = 0;
+		}
+
+		if(bytes == 0)
+		{
+			AddChange(std::wstring());
+			continue;
+		}
+
+		const BYTE* record = reinterpret_cast<const BYTE*>(buffer.data());
+		for(;;)
+		{
+			const FILE_NOTIFY_INFORMATION& info = *reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(record);
+
+			// A rename is reported under both names; only the new one has contents.
+			if(info.Action != FILE_ACTION_REMOVED && info.Action != FILE_ACTION_RENAMED_OLD_NAME)
+				AddChange(std::wstring(info.FileName, info.FileNameLength / sizeof(WCHAR)));
+
+			if(info.NextEntryOffset == 0)
+				break;
+			record += info.NextEntryOffset;
+		}
+	}
+
+	CloseHandle(completion);
+}
+
+void FileWatcher::AddChange(const std::wstring& file)
+{
+	const ULONGLONG now = GetTickCount64();
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	for(auto& change : mChanges)
+	{
+		if(_wcsicmp(change.first.c_str(), file.c_str()) == 0)
+		{
+			change.second = now;
+			return;
+		}
+	}
+	mChanges.push_back({ file, now });
+}
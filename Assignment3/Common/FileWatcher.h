@@ -0,0 +1,51 @@
+//***************************************************************************************
+// FileWatcher.h
+//
+// Reports the files written in a directory while the application runs, so edited
+// assets can be picked up without a restart.
+//   -Start() opens the directory and a thread of the watcher's own then waits on
+//    ReadDirectoryChangesW (overlapped) for files being created, written or renamed
+//    into it.  Stop(), or the destructor, cancels the wait and joins the thread.
+//   -Editors usually save in several steps, so a file is only handed over once it has
+//    gone SettleMs without another change.  TakeChanges() returns each such file once,
+//    by its name relative to the directory, however many times it was written.
+//   -When changes come faster than the buffer holds, the system drops them and an
+//    empty name is reported instead: anything in the directory may have changed.
+//***************************************************************************************
+
+#pragma once
+
+#include "d3dUtil.h"
+#include <mutex>
+#include <thread>
+
+class FileWatcher
+{
+public:
+	static const ULONGLONG SettleMs = 200;
+
+	FileWatcher() = default;
+	FileWatcher(const FileWatcher& rhs) = delete;
+	FileWatcher& operator=(const FileWatcher& rhs) = delete;
+	~FileWatcher();
+
+	// False if the directory can't be opened, e.g. it doesn't exist.
+	bool Start(const std::wstring& directory, bool recursive = false);
+	void Stop();
+
+	void TakeChanges(std::vector<std::wstring>& files);
+
+private:
+	void WatchLoop();
+	void AddChange(const std::wstring& file);
+
+private:
+	HANDLE mDirectory = INVALID_HANDLE_VALUE;
+	HANDLE mStopEvent = nullptr;
+	bool mRecursive = false;
+	std::thread mThread;
+
+	// Files changed but not handed over yet, with the tick of their last change.
+	std::mutex mMutex;
+	std::vector<std::pair<std::wstring, ULONGLONG>> mChanges;
+};
@@ -0,0 +1,76 @@
+//***************************************************************************************
+// FrameArena.cpp
+//***************************************************************************************
+
+#include "FrameArena.h"
+
+FrameArena::FrameArena(size_t blockSize) :
+	mBlockSize(blockSize)
+{
+}
+
+void* FrameArena::Allocate(size_t bytes, size_t alignment)
+{
+	assert(alignment != 0 && (alignment & (alignment - 1)) == 0);
+
+	for(;;)
+	{
+		if(mBlock < mBlocks.size())
+		{
+			Block& block = mBlocks[mBlock];
+			std::uintptr_t base = reinterpret_cast<std::uintptr_t>(block.Memory.get());
+			std::uintptr_t start = (base + mOffset + alignment - 1) & ~(std::uintptr_t)(alignment - 1);
+			if(start + bytes <= base + block.Size)
+			{
+				mOffset = (size_t)(start - base) + bytes;
+				mBytesUsed += bytes;
+				return reinterpret_cast<void*>(start);
+			}
+
+			// Whatever is left of this block stays unused until the next Reset().
+			if(mBlock + 1 < mBlocks.size() || mOffset != 0)
+			{
+				++mBlock;
+				mOffset = 0;
+				continue;
+			}
+		}
+
+		// Room for the request at any alignment.
+		Block block;
+		block.Size = bytes + alignment - 1 > mBlockSize ? bytes + alignment - 1 : mBlockSize;
+		block.Memory.reset(new std::uint8_t[block.Size]);
+		mBlocks.push_back(std::move(block));
+		mBlock = mBlocks.size() - 1;
+		mOffset = 0;
+	}
+}
+
+void FrameArena::Reset()
+{
+	if(mBlocks.size() > 1)
+	{
+		Block merged;
+		merged.Size = Capacity();
+		merged.Memory.reset(new std::uint8_t[merged.Size]);
+		mBlocks.clear();
+		mBlocks.push_back(std::move(merged));
+	}
+
+	mBlock = 0;
+	mOffset = 0;
+	mBytesUsed = 0;
+}
+
+size_t FrameArena::BytesUsed()const
+{
+	return mBytesUsed;
+}
+
+size_t FrameArena::Capacity()const
+{
+	size_t capacity = 0;
+	for(const Block& block : mBlocks)
+		capacity += block.Size;
+	return capacity;
+}
@@ -0,0 +1,70 @@
+//***************************************************************************************
+// FrameArena.h
+//
+// Linear allocator for CPU data that only lives while one frame is built, e.g. the
+// lists of what is visible and the work handed to jobs.
+//   -Allocate() bumps an offset through a block and Reset() rewinds it, so once the
+//    arena has seen its busiest frame nothing more comes from the heap.
+//   -A frame that outgrows the block spills into further blocks.  The next Reset()
+//    replaces them all with one block as large as the lot, so the spill only
+//    happens while the arena is warming up.
+//   -Nothing is destroyed on Reset(): only trivially destructible types go in.
+//   -Not thread safe.  One thread at a time allocates; what it hands out may be
+//    used on any thread until the next Reset().
+//***************************************************************************************
+
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+class FrameArena
+{
+public:
+	explicit FrameArena(size_t blockSize = 64 * 1024);
+	FrameArena(const FrameArena& rhs) = delete;
+	FrameArena& operator=(const FrameArena& rhs) = delete;
+	~FrameArena() = default;
+
+	// alignment has to be a power of two.
+	void* Allocate(size_t bytes, size_t alignment = alignof(std::max_align_t));
+
+	// count value-initialized elements.
+	template<typename T>
+	T* AllocateArray(size_t count)
+	{
+		static_assert(std::is_trivially_destructible<T>::value, "FrameArena never runs destructors");
+
+		T* elements = static_cast<T*>(Allocate(count * sizeof(T), alignof(T)));
+		for(size_t i = 0; i < count; ++i)
+			new(elements + i) T();
+		return elements;
+	}
+
+	// Everything handed out since the last Reset() is invalid afterwards.
+	void Reset();
+
+	// Bytes handed out since the last Reset(), and the bytes held from the heap.
+	size_t BytesUsed()const;
+	size_t Capacity()const;
+
+private:
+	struct Block
+	{
+		std::unique_ptr<std::uint8_t[]> Memory;
+		size_t Size = 0;
+	};
+
+	size_t mBlockSize = 0;
+
+	// mBlocks[mBlock] is the block being bumped through; the blocks before it are full.
+	std::vector<Block> mBlocks;
+	size_t mBlock = 0;
+	size_t mOffset = 0;
+	size_t mBytesUsed = 0;
+};
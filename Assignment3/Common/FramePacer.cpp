@@ -0,0 +1,114 @@
+//***************************************************************************************
+// FramePacer.cpp
+//***************************************************************************************
+
+#include "FramePacer.h"
+
+using Microsoft::WRL::ComPtr;
+
+// Long enough that a healthy swap chain never hits it, short enough that a lost one
+// (e.g. the window was minimized mid-frame) does not hang the app.
+static const DWORD FrameLatencyTimeoutMs = 1000;
+
+FramePacer::FramePacer(ID3D12Fence* fence, UINT maxFramesInFlight) :
+	mFence(fence),
+	mMaxFramesInFlight(maxFramesInFlight),
+	mFramesInFlight(maxFramesInFlight)
+{
+	assert(maxFramesInFlight > 0);
+
+	mFenceEvent = CreateEventEx(nullptr, nullptr, 0, EVENT_ALL_ACCESS);
+	if(mFenceEvent == nullptr)
+		ThrowIfFailed(HRESULT_FROM_WIN32(GetLastError()));
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	mTicksToMs = 1000.0 / (double)frequency.QuadPart;
+}
+
+FramePacer::~FramePacer()
+{
+	if(mFrameLatencyWaitable != nullptr)
+		CloseHandle(mFrameLatencyWaitable);
+	CloseHandle(mFenceEvent);
+}
+
+void FramePacer::SetSwapChain(IDXGISwapChain* swapChain)
+{
+	if(mFrameLatencyWaitable != nullptr)
+	{
+		CloseHandle(mFrameLatencyWaitable);
+		mFrameLatencyWaitable = nullptr;
+	}
+	mSwapChain.Reset();
+
+	if(swapChain == nullptr || FAILED(swapChain->QueryInterface(IID_PPV_ARGS(mSwapChain.GetAddressOf()))))
+		return;
+
+	DXGI_SWAP_CHAIN_DESC desc;
+	ThrowIfFailed(mSwapChain->GetDesc(&desc));
+	if((desc.Flags & DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT) == 0)
+	{
+		mSwapChain.Reset();
+		return;
+	}
+
+	ThrowIfFailed(mSwapChain->SetMaximumFrameLatency(mFramesInFlight));
+	mFrameLatencyWaitable = mSwapChain->GetFrameLatencyWaitableObject();
+}
+
+void FramePacer::SetFramesInFlight(UINT count)
+{
+	mFramesInFlight = MathHelper::Clamp<UINT>(count, 1, mMaxFramesInFlight);
+
+	if(mSwapChain != nullptr)
+		ThrowIfFailed(mSwapChain->SetMaximumFrameLatency(mFramesInFlight));
+}
+
+UINT FramePacer::FramesInFlight()const
+{
+	return mFramesInFlight;
+}
+
+UINT FramePacer::MaxFramesInFlight()const
+{
+	return mMaxFramesInFlight;
+}
+
+float FramePacer::WaitForFrame(UINT64 submittedFence, UINT64 resourceFence, bool waitForPresent)
+{
+	LARGE_INTEGER start;
+	QueryPerformanceCounter(&start);
+
+	if(waitForPresent && mFrameLatencyWaitable != nullptr)
+		WaitForSingleObjectEx(mFrameLatencyWaitable, FrameLatencyTimeoutMs, TRUE);
+
+	// With N frames in flight the frame about to be built may only start once the
+	// frame submitted N - 1 frames ago is done, and never before the frame resource
+	// it reuses is free.
+	UINT64 target = resourceFence;
+	if(submittedFence + 1 > mFramesInFlight)
+		target = MathHelper::Max(target, submittedFence + 1 - mFramesInFlight);
+
+	WaitForFence(target);
+
+	LARGE_INTEGER end;
+	QueryPerformanceCounter(&end);
+	return (float)((end.QuadPart - start.QuadPart) * mTicksToMs);
+}
+
+float FramePacer::WaitForFence(UINT64 value)
+{
+	if(value == 0 || mFence->GetCompletedValue() >= value)
+		return 0.0f;
+
+	LARGE_INTEGER start;
+	QueryPerformanceCounter(&start);
+
+	ThrowIfFailed(mFence->SetEventOnCompletion(value, mFenceEvent));
+	WaitForSingleObject(mFenceEvent, INFINITE);
+
+	LARGE_INTEGER end;
+	QueryPerformanceCounter(&end);
+	return (float)((end.QuadPart - start.QuadPart) * mTicksToMs);
+}
@@ -0,0 +1,54 @@
+//***************************************************************************************
+// FramePacer.h
+//
+// Decides when the CPU may start building the next frame.
+//   -WaitForFrame() blocks on the swap chain's frame-latency waitable object, then on
+//    the fence until no more than FramesInFlight() frames are queued on the GPU.  The
+//    frame should sample its input after this returns, not before.
+//   -One event is created for the life of the pacer and reused by every fence wait.
+//   -FramesInFlight() can be changed at any time between 1 and the count given to the
+//    constructor, which has to match the number of frame resources.  The swap chain's
+//    maximum frame latency follows it.
+//   -The swap chain must be created with DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT;
+//    without IDXGISwapChain2 only the fence is waited on.
+//***************************************************************************************
+
+#pragma once
+
+#include "d3dUtil.h"
+
+class FramePacer
+{
+public:
+	FramePacer(ID3D12Fence* fence, UINT maxFramesInFlight);
+	FramePacer(const FramePacer& rhs) = delete;
+	FramePacer& operator=(const FramePacer& rhs) = delete;
+	~FramePacer();
+
+	// Call again whenever the swap chain is recreated.
+	void SetSwapChain(IDXGISwapChain* swapChain);
+
+	void SetFramesInFlight(UINT count);
+	UINT FramesInFlight()const;
+	UINT MaxFramesInFlight()const;
+
+	// submittedFence is the last value signalled on the queue and resourceFence the
+	// value the next frame resource was last used with.  Pass waitForPresent = false
+	// when frames are not presented, since the waitable object is only signalled by
+	// Present.  Returns the milliseconds spent blocked.
+	float WaitForFrame(UINT64 submittedFence, UINT64 resourceFence, bool waitForPresent = true);
+
+	// Blocks until the fence reaches value.  Returns the milliseconds spent blocked.
+	float WaitForFence(UINT64 value);
+
+private:
+	Microsoft::WRL::ComPtr<ID3D12Fence> mFence;
+	Microsoft::WRL::ComPtr<IDXGISwapChain2> mSwapChain;
+	HANDLE mFenceEvent = nullptr;
+	HANDLE mFrameLatencyWaitable = nullptr;
+
+	UINT mMaxFramesInFlight = 1;
+	UINT mFramesInFlight = 1;
+
+	double mTicksToMs = 0.0;
+};
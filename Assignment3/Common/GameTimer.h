@@ -18,9 +18,15 @@ public:
 	void Stop();  // Call when paused.
 	void Tick();  // Call every frame.
 
+	// Makes every Tick() advance by exactly dt seconds, regardless of wall clock time,
+	// so runs can be replayed frame for frame.  Pass 0 to go back to the real clock.
+	void SetFixedDeltaTime(double dt);
+
 private:
 	double mSecondsPerCount;
 	double mDeltaTime;
+	double mFixedDeltaTime;
+	double mFixedTotalTime;
 
 	__int64 mBaseTime;
 	__int64 mPausedTime;
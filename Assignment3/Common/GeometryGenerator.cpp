@@ -3,7 +3,9 @@
 //***************************************************************************************
 
 #include "GeometryGenerator.h"
+#include "ThreadPool.h"
 #include <algorithm>
+#include <unordered_map>
 
 using namespace DirectX;
 
@@ -213,13 +215,6 @@ GeometryGenerator::MeshData GeometryGenerator::CreateSphere(float radius, uint32
 
 void GeometryGenerator::Subdivide(MeshData& meshData)
 {
-	// Save a copy of the input geometry.
-	MeshData inputCopy = meshData;
-
-
-	meshData.Vertices.resize(0);
-	meshData.Indices32.resize(0);
-
 	//       v1
 	//       *
 	//      / \
@@ -230,47 +225,62 @@ void GeometryGenerator::Subdivide(MeshData& meshData)
 	// *-----*-----*
 	// v0    m2     v2
 
-	uint32 numTris = (uint32)inputCopy.Indices32.size()/3;
-	for(uint32 i = 0; i < numTris; ++i)
+	std::vector<uint32> inputIndices;
+	inputIndices.swap(meshData.Indices32);
+
+	const uint32 numTris = (uint32)inputIndices.size()/3;
+
+	//
+	// Find each edge's midpoint index.  The key is the edge's two vertex indices,
+	// smaller first, so both triangles on it find the same one.
+	//
+
+	std::unordered_map<std::uint64_t, uint32> edgeMidpoints;
+	edgeMidpoints.reserve(numTris*3);
+
+	std::vector<uint32> midpoints(inputIndices.size());
+	uint32 numVertices = (uint32)meshData.Vertices.size();
+	for(uint32 i = 0; i < numTris*3; ++i)
 	{
-		Vertex v0 = inputCopy.Vertices[ inputCopy.Indices32[i*3+0] ];
-		Vertex v1 = inputCopy.Vertices[ inputCopy.Indices32[i*3+1] ];
-		Vertex v2 = inputCopy.Vertices[ inputCopy.Indices32[i*3+2] ];
-
-		//
-		// Generate the midpoints.
-		//
-
-        Vertex m0 = MidPoint(v0, v1);
-        Vertex m1 = MidPoint(v1, v2);
-        Vertex m2 = MidPoint(v0, v2);
-
-		//
-		// Add new geometry.
-		//
-
-		meshData.Vertices.push_back(v0); // 0
-		meshData.Vertices.push_back(v1); // 1
-		meshData.Vertices.push_back(v2); // 2
-		meshData.Vertices.push_back(m0); // 3
-		meshData.Vertices.push_back(m1); // 4
-		meshData.Vertices.push_back(m2); // 5
- 
-		meshData.Indices32.push_back(i*6+0);
-		meshData.Indices32.push_back(i*6+3);
-		meshData.Indices32.push_back(i*6+5);
+		// m0, m1 and m2 are on edges v0v1, v1v2 and v2v0.
+		uint32 a = inputIndices[i];
+		uint32 b = inputIndices[(i % 3 == 2) ? i - 2 : i + 1];
+		std::uint64_t key = ((std::uint64_t)std::min(a, b) << 32) | std::max(a, b);
+
+		auto inserted = edgeMidpoints.emplace(key, numVertices);
+		if(inserted.second)
+			++numVertices;
+		midpoints[i] = inserted.first->second;
+	}
 
-		meshData.Indices32.push_back(i*6+3);
-		meshData.Indices32.push_back(i*6+4);
-		meshData.Indices32.push_back(i*6+5);
+	//
+	// Add new geometry.
+	//
 
-		meshData.Indices32.push_back(i*6+5);
-		meshData.Indices32.push_back(i*6+4);
-		meshData.Indices32.push_back(i*6+2);
+	meshData.Vertices.resize(numVertices);
+	for(const auto& edge : edgeMidpoints)
+	{
+		uint32 a = (uint32)(edge.first >> 32);
+		uint32 b = (uint32)(edge.first & 0xffffffff);
+		meshData.Vertices[edge.second] = MidPoint(meshData.Vertices[a], meshData.Vertices[b]);
+	}
 
-		meshData.Indices32.push_back(i*6+3);
-		meshData.Indices32.push_back(i*6+1);
-		meshData.Indices32.push_back(i*6+4);
+	meshData.Indices32.resize(numTris*12);
+	for(uint32 i = 0; i < numTris; ++i)
+	{
+		uint32 v0 = inputIndices[i*3+0];
+		uint32 v1 = inputIndices[i*3+1];
+		uint32 v2 = inputIndices[i*3+2];
+		uint32 m0 = midpoints[i*3+0];
+		uint32 m1 = midpoints[i*3+1];
+		uint32 m2 = midpoints[i*3+2];
+
+		uint32* out = &meshData.Indices32[i*12];
+
+		out[0] = v0; out[1]  = m0; out[2]  = m2;
+		out[3] = m0; out[4]  = m1; out[5]  = m2;
+		out[6] = m2; out[7]  = m1; out[8]  = v2;
+		out[9] = m0; out[10] = v1; out[11] = m1;
 	}
 }
 
@@ -304,6 +314,17 @@ GeometryGenerator::Vertex GeometryGenerator::MidPoint(const Vertex& v0, const Ve
     return v;
 }
 
+std::vector<GeometryGenerator::MeshData> GeometryGenerator::CreateBatch(ThreadPool& pool, const std::vector<std::function<MeshData()>>& generators)
+{
+	// Each task writes only its own element, so the results need no locking.
+	std::vector<MeshData> meshes(generators.size());
+	for(size_t i = 0; i < generators.size(); ++i)
+		pool.Submit([&meshes, &generators, i]() { meshes[i] = generators[i](); });
+
+	pool.Wait();
+	return meshes;
+}
+
 GeometryGenerator::MeshData GeometryGenerator::CreateGeosphere(float radius, uint32 numSubdivisions)
 {
     MeshData meshData;
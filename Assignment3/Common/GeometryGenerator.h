@@ -10,14 +10,20 @@
 //   1. Change the Direct3D cull mode or manually reverse the winding order.
 //   2. Invert the normal.
 //   3. Update the texture coordinates and tangent vectors.
+//
+// The Create functions keep no state, so one GeometryGenerator can serve several
+// threads at once; CreateBatch() runs a list of them on a ThreadPool.
 //***************************************************************************************
 
 #pragma once
 
 #include <cstdint>
 #include <DirectXMath.h>
+#include <functional>
 #include <vector>
 
+class ThreadPool;
+
 class GeometryGenerator
 {
 public:
@@ -113,6 +119,13 @@ public:
 	//CALTROP - 6
 	MeshData CreateCaltrop(float depth, float width, float height);
 
+	// Runs each generator on pool and returns the meshes in the same order.  Rethrows
+	// the first exception a generator throws, once they have all finished.
+	static std::vector<MeshData> CreateBatch(ThreadPool& pool, const std::vector<std::function<MeshData()>>& generators);
+
+	// Splits each triangle into four.  Triangles that share an edge's two vertices
+	// share its midpoint, so the mesh stays indexed; the original vertices keep
+	// their indices.
 	void Subdivide(MeshData& meshData);
 private:
 	
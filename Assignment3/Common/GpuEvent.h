@@ -0,0 +1,48 @@
+//***************************************************************************************
+// GpuEvent.h
+//
+// Named regions of a command list for PIX and other GPU captures, through
+// BeginEvent/EndEvent on the list itself so the WinPixEventRuntime isn't needed.
+//   -The name goes as an ANSI string in PIX's legacy encoding (metadata 1), which
+//    the captures and the debug layer's messages both show.
+//   -A GpuEvent opens its region when constructed and closes it when it goes out
+//    of scope.  The region has to open and close on the same list; a profiler scope
+//    spanning several lists gets a region in each.
+//***************************************************************************************
+
+#pragma once
+
+#include "d3dUtil.h"
+
+class GpuEvent
+{
+public:
+	GpuEvent(ID3D12GraphicsCommandList* cmdList, const char* name) :
+		mCmdList(cmdList)
+	{
+		Begin(mCmdList, name);
+	}
+
+	GpuEvent(const GpuEvent& rhs) = delete;
+	GpuEvent& operator=(const GpuEvent& rhs) = delete;
+
+	~GpuEvent()
+	{
+		End(mCmdList);
+	}
+
+	static void Begin(ID3D12GraphicsCommandList* cmdList, const char* name)
+	{
+		cmdList->BeginEvent(AnsiMetadata, name, (UINT)strlen(name) + 1);
+	}
+
+	static void End(ID3D12GraphicsCommandList* cmdList)
+	{
+		cmdList->EndEvent();
+	}
+
+private:
+	static const UINT AnsiMetadata = 1;
+
+	ID3D12GraphicsCommandList* mCmdList = nullptr;
+};
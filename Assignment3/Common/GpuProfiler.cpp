@@ -0,0 +1,399 @@
+//***************************************************************************************
+// GpuProfiler.cpp
+//***************************************************************************************
+
+#include "GpuProfiler.h"
+
+using Microsoft::WRL::ComPtr;
+
+GpuProfiler::GpuProfiler(ID3D12Device* device, ID3D12CommandQueue* queue, UINT frameCount, UINT maxScopes) :
+	mDevice(device),
+	mMaxScopes(maxScopes)
+{
+	UINT64 gpuFrequency = 0;
+	ThrowIfFailed(queue->GetTimestampFrequency(&gpuFrequency));
+	mGpuTicksToMs = 1000.0 / (double)gpuFrequency;
+
+	LARGE_INTEGER cpuFrequency;
+	QueryPerformanceFrequency(&cpuFrequency);
+	mCpuTicksToMs = 1000.0 / (double)cpuFrequency.QuadPart;
+
+	// A begin and an end timestamp per scope per frame.
+	D3D12_QUERY_HEAP_DESC queryHeapDesc = {};
+	queryHeapDesc.Type = D3D12_QUERY_HEAP_TYPE_TIMESTAMP;
+	queryHeapDesc.Count = frameCount * mMaxScopes * 2;
+	ThrowIfFailed(mDevice->CreateQueryHeap(&queryHeapDesc, IID_PPV_ARGS(mQueryHeap.GetAddressOf())));
+
+	mFrames.resize(frameCount);
+	for(auto& frame : mFrames)
+	{
+		ThrowIfFailed(mDevice->CreateCommandAllocator(
+			D3D12_COMMAND_LIST_TYPE_DIRECT,
+			IID_PPV_ARGS(frame.CmdListAlloc.GetAddressOf())));
+
+		ThrowIfFailed(mDevice->CreateCommittedResource(
+			&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_READBACK),
+			D3D12_HEAP_FLAG_NONE,
+			&CD3DX12_RESOURCE_DESC::Buffer(mMaxScopes * 2 * sizeof(UINT64)),
+			D3D12_RESOURCE_STATE_COPY_DEST,
+			nullptr,
+			IID_PPV_ARGS(frame.Readback.GetAddressOf())));
+
+		frame.BeginRecorded.assign(mMaxScopes, 0);
+		frame.EndRecorded.assign(mMaxScopes, 0);
+		frame.CpuMs.assign(mMaxScopes, -1.0f);
+	}
+
+	ThrowIfFailed(mDevice->CreateCommandList(
+		0,
+		D3D12_COMMAND_LIST_TYPE_DIRECT,
+		mFrames[0].CmdListAlloc.Get(),
+		nullptr,
+		IID_PPV_ARGS(mResolveCmdList.GetAddressOf())));
+	ThrowIfFailed(mResolveCmdList->Close());
+}
+
+GpuProfiler::~GpuProfiler()
+{
+	CloseCsv();
+
+	if(mBreadcrumbs != nullptr)
+	{
+		CD3DX12_RANGE writeRange(0, 0);
+		mBreadcrumbs->Unmap(0, &writeRange);
+	}
+}
+
+UINT GpuProfiler::AddGpuScope(const std::string& name)
+{
+	return AddScope(name, ScopeKind::Gpu);
+}
+
+UINT GpuProfiler::AddCpuScope(const std::string& name)
+{
+	return AddScope(name, ScopeKind::Cpu);
+}
+
+UINT GpuProfiler::AddCounter(const std::string& name)
+{
+	return AddScope(name, ScopeKind::Counter);
+}
+
+void GpuProfiler::EnableBreadcrumbs()
+{
+	if(mBreadcrumbs != nullptr)
+		return;
+
+	// Readback resources stay in COPY_DEST, the state WriteBufferImmediate writes to.
+	ThrowIfFailed(mDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_READBACK),
+		D3D12_HEAP_FLAG_NONE,
+		&CD3DX12_RESOURCE_DESC::Buffer(mMaxScopes * 2 * sizeof(UINT)),
+		D3D12_RESOURCE_STATE_COPY_DEST,
+		nullptr,
+		IID_PPV_ARGS(mBreadcrumbs.GetAddressOf())));
+
+	// Mapped for good: after a device removal nothing else could be asked for.
+	void* data = nullptr;
+	ThrowIfFailed(mBreadcrumbs->Map(0, nullptr, &data));
+	mBreadcrumbData = static_cast<const UINT*>(data);
+}
+
+std::string GpuProfiler::BreadcrumbReport()const
+{
+	if(mBreadcrumbData == nullptr)
+		return std::string();
+
+	// The scopes all run on one queue, so the newest frame any of them began is the
+	// one the GPU stopped in.
+	UINT lastFrame = 0;
+	for(UINT i = 0; i < (UINT)mScopes.size(); ++i)
+		lastFrame = MathHelper::Max(lastFrame, mBreadcrumbData[i * 2]);
+	if(lastFrame == 0)
+		return "GPU breadcrumbs: no scope has started.\n";
+
+	// The slot that recorded the frame knows which scopes it had at all.
+	const Frame* recorded = nullptr;
+	for(const Frame& frame : mFrames)
+	{
+		if((UINT)(frame.FrameNumber + 1) == lastFrame)
+			recorded = &frame;
+	}
+
+	std::ostringstream report;
+	report << "GPU breadcrumbs, frame " << lastFrame - 1 << ":\n";
+	for(UINT i = 0; i < (UINT)mScopes.size(); ++i)
+	{
+		if(mScopes[i].Kind != ScopeKind::Gpu)
+			continue;
+
+		const char* status = "not reached";
+		if(mBreadcrumbData[i * 2 + 1] == lastFrame)
+			status = "finished";
+		else if(mBreadcrumbData[i * 2] == lastFrame)
+			status = "started, not finished";
+		else if(recorded != nullptr && !recorded->BeginRecorded[i])
+			status = "not recorded";
+
+		report << "  " << mScopes[i].Name << ": " << status << "\n";
+	}
+	return report.str();
+}
+
+UINT GpuProfiler::AddScope(const std::string& name, ScopeKind kind)
+{
+	assert(mScopes.size() < mMaxScopes);
+
+	Scope scope;
+	scope.Name = name;
+	scope.Kind = kind;
+	scope.Samples.resize(WindowSize);
+	mScopes.push_back(scope);
+
+	return (UINT)mScopes.size() - 1;
+}
+
+void GpuProfiler::BeginFrame(UINT frameIndex)
+{
+	Frame& frame = mFrames[frameIndex];
+
+	if(frame.Submitted)
+	{
+		UINT64* timestamps = nullptr;
+		CD3DX12_RANGE readRange(0, mScopes.size() * 2 * sizeof(UINT64));
+		ThrowIfFailed(frame.Readback->Map(0, &readRange, reinterpret_cast<void**>(&timestamps)));
+
+		mLastFrameMs.assign(mScopes.size(), -1.0f);
+		for(UINT i = 0; i < (UINT)mScopes.size(); ++i)
+		{
+			if(mScopes[i].Kind == ScopeKind::Gpu && frame.BeginRecorded[i] && frame.EndRecorded[i])
+			{
+				UINT64 ticks = timestamps[i * 2 + 1] - timestamps[i * 2];
+				mLastFrameMs[i] = (float)(ticks * mGpuTicksToMs);
+			}
+			else if(mScopes[i].Kind != ScopeKind::Gpu)
+			{
+				mLastFrameMs[i] = frame.CpuMs[i];
+			}
+
+			if(mLastFrameMs[i] >= 0.0f)
+				AddSample(mScopes[i], mLastFrameMs[i]);
+		}
+
+		CD3DX12_RANGE writeRange(0, 0);
+		frame.Readback->Unmap(0, &writeRange);
+
+		mLastFrameNumber = frame.FrameNumber;
+		++mCollectedFrames;
+
+		if(mCsv.is_open())
+		{
+			mCsv << frame.FrameNumber;
+			for(float ms : mLastFrameMs)
+			{
+				mCsv << ',';
+				if(ms >= 0.0f)
+					mCsv << ms;
+			}
+			mCsv << '\n';
+		}
+	}
+
+	std::fill(frame.BeginRecorded.begin(), frame.BeginRecorded.end(), (UINT8)0);
+	std::fill(frame.EndRecorded.begin(), frame.EndRecorded.end(), (UINT8)0);
+	std::fill(frame.CpuMs.begin(), frame.CpuMs.end(), -1.0f);
+	frame.FrameNumber = mFrameNumber++;
+	frame.Submitted = false;
+
+	mCurrFrame = frameIndex;
+}
+
+ID3D12CommandList* GpuProfiler::EndFrame()
+{
+	Frame& frame = mFrames[mCurrFrame];
+
+	// BeginFrame ran after this slot's fence, so its allocator is free.
+	ThrowIfFailed(frame.CmdListAlloc->Reset());
+	ThrowIfFailed(mResolveCmdList->Reset(frame.CmdListAlloc.Get(), nullptr));
+
+	for(UINT i = 0; i < (UINT)mScopes.size(); ++i)
+	{
+		if(frame.BeginRecorded[i] && frame.EndRecorded[i])
+		{
+			mResolveCmdList->ResolveQueryData(mQueryHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP,
+				QueryIndex(mCurrFrame, i), 2, frame.Readback.Get(), i * 2 * sizeof(UINT64));
+		}
+	}
+
+	ThrowIfFailed(mResolveCmdList->Close());
+	frame.Submitted = true;
+
+	return mResolveCmdList.Get();
+}
+
+void GpuProfiler::BeginScope(ID3D12GraphicsCommandList* cmdList, UINT scope)
+{
+	assert(mScopes[scope].Kind == ScopeKind::Gpu);
+	cmdList->EndQuery(mQueryHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, QueryIndex(mCurrFrame, scope));
+	mFrames[mCurrFrame].BeginRecorded[scope] = 1;
+	WriteBreadcrumb(cmdList, scope * 2, D3D12_WRITEBUFFERIMMEDIATE_MODE_MARKER_IN);
+}
+
+void GpuProfiler::EndScope(ID3D12GraphicsCommandList* cmdList, UINT scope)
+{
+	assert(mScopes[scope].Kind == ScopeKind::Gpu);
+	cmdList->EndQuery(mQueryHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, QueryIndex(mCurrFrame, scope) + 1);
+	mFrames[mCurrFrame].EndRecorded[scope] = 1;
+	WriteBreadcrumb(cmdList, scope * 2 + 1, D3D12_WRITEBUFFERIMMEDIATE_MODE_MARKER_OUT);
+}
+
+void GpuProfiler::BeginCpuScope(UINT scope)
+{
+	assert(mScopes[scope].Kind == ScopeKind::Cpu);
+	QueryPerformanceCounter(&mScopes[scope].CpuStart);
+}
+
+void GpuProfiler::EndCpuScope(UINT scope)
+{
+	assert(mScopes[scope].Kind == ScopeKind::Cpu);
+
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	float ms = (float)((now.QuadPart - mScopes[scope].CpuStart.QuadPart) * mCpuTicksToMs);
+
+	AddCpuTime(scope, ms);
+}
+
+void GpuProfiler::AddCpuTime(UINT scope, float ms)
+{
+	assert(mScopes[scope].Kind == ScopeKind::Cpu);
+
+	float& total = mFrames[mCurrFrame].CpuMs[scope];
+	total = (total < 0.0f) ? ms : total + ms;
+}
+
+void GpuProfiler::SetCount(UINT counter, float count)
+{
+	assert(mScopes[counter].Kind == ScopeKind::Counter);
+	mFrames[mCurrFrame].CpuMs[counter] = count;
+}
+
+UINT GpuProfiler::ScopeCount()const
+{
+	return (UINT)mScopes.size();
+}
+
+const std::string& GpuProfiler::ScopeName(UINT scope)const
+{
+	return mScopes[scope].Name;
+}
+
+bool GpuProfiler::IsGpuScope(UINT scope)const
+{
+	return mScopes[scope].Kind == ScopeKind::Gpu;
+}
+
+bool GpuProfiler::IsCounter(UINT scope)const
+{
+	return mScopes[scope].Kind == ScopeKind::Counter;
+}
+
+const ProfileStats& GpuProfiler::Stats(UINT scope)const
+{
+	return mScopes[scope].Stats;
+}
+
+const std::vector<float>& GpuProfiler::LastFrameTimes()const
+{
+	return mLastFrameMs;
+}
+
+UINT64 GpuProfiler::LastFrameNumber()const
+{
+	return mLastFrameNumber;
+}
+
+UINT64 GpuProfiler::CollectedFrameCount()const
+{
+	return mCollectedFrames;
+}
+
+bool GpuProfiler::OpenCsv(const std::wstring& filename)
+{
+	CloseCsv();
+
+	mCsv.open(filename, std::ios::out | std::ios::trunc);
+	if(!mCsv.is_open())
+		return false;
+
+	mCsv << "frame";
+	for(const auto& scope : mScopes)
+	{
+		const char* unit = " cpu ms";
+		if(scope.Kind == ScopeKind::Gpu)
+			unit = " gpu ms";
+		else if(scope.Kind == ScopeKind::Counter)
+			unit = " count";
+		mCsv << ',' << scope.Name << unit;
+	}
+	mCsv << '\n';
+
+	return true;
+}
+
+void GpuProfiler::CloseCsv()
+{
+	if(mCsv.is_open())
+		mCsv.close();
+}
+
+bool GpuProfiler::IsCsvOpen()const
+{
+	return mCsv.is_open();
+}
+
+void GpuProfiler::AddSample(Scope& scope, float ms)
+{
+	scope.Samples[scope.NextSample] = ms;
+	scope.NextSample = (scope.NextSample + 1) % WindowSize;
+	if(scope.SampleCount < WindowSize)
+		++scope.SampleCount;
+
+	ProfileStats& stats = scope.Stats;
+	stats.Last = ms;
+	stats.Min = ms;
+	stats.Max = ms;
+
+	float sum = 0.0f;
+	for(UINT i = 0; i < scope.SampleCount; ++i)
+	{
+		float sample = scope.Samples[i];
+		sum += sample;
+		stats.Min = MathHelper::Min(stats.Min, sample);
+		stats.Max = MathHelper::Max(stats.Max, sample);
+	}
+	stats.Avg = sum / scope.SampleCount;
+
+	mSortScratch.assign(scope.Samples.begin(), scope.Samples.begin() + scope.SampleCount);
+	size_t p99 = (mSortScratch.size() * 99 + 99) / 100 - 1;
+	std::nth_element(mSortScratch.begin(), mSortScratch.begin() + p99, mSortScratch.end());
+	stats.P99 = mSortScratch[p99];
+}
+
+UINT GpuProfiler::QueryIndex(UINT frameIndex, UINT scope)const
+{
+	return (frameIndex * mMaxScopes + scope) * 2;
+}
+
+void GpuProfiler::WriteBreadcrumb(ID3D12GraphicsCommandList* cmdList, UINT slot, D3D12_WRITEBUFFERIMMEDIATE_MODE mode)
+{
+	ComPtr<ID3D12GraphicsCommandList2> cmdList2;
+	if(mBreadcrumbs == nullptr || FAILED(cmdList->QueryInterface(IID_PPV_ARGS(cmdList2.GetAddressOf()))))
+		return;
+
+	// Frame numbers are kept one up so that 0 means never.
+	D3D12_WRITEBUFFERIMMEDIATE_PARAMETER param;
+	param.Dest = mBreadcrumbs->GetGPUVirtualAddress() + slot * sizeof(UINT);
+	param.Value = (UINT)(mFrames[mCurrFrame].FrameNumber + 1);
+	cmdList2->WriteBufferImmediate(1, &param, &mode);
+}
@@ -0,0 +1,161 @@
+//***************************************************************************************
+// GpuProfiler.h
+//
+// Frame profiler built on D3D12 timestamp queries.
+//   -GPU scopes write a timestamp at Begin and End into whatever command list they
+//    are recorded on, so a scope may start in one list and end in a later list of
+//    the same submission.  Scopes are registered up front and recorded by index,
+//    which lets worker threads time the lists they record without locking.
+//   -Each frame resource slot resolves into its own readback buffer, which is only
+//    read when the slot comes round again after its fence, so nothing stalls.
+//   -CPU scopes time the calling thread with QueryPerformanceCounter.
+//   -Counters hold a number the caller sets once a frame, e.g. heap allocations,
+//    and get the same stats and CSV column as a scope.
+//   -Every scope keeps a rolling window of samples for min/avg/max/p99, and each
+//    finished frame can be appended to a CSV file.
+//   -With EnableBreadcrumbs(), GPU scopes also write the frame's number at their
+//    Begin and End into a persistently mapped readback buffer, through
+//    WriteBufferImmediate: once the commands before have started and once they
+//    have finished.  The buffer survives a device removal, and BreadcrumbReport()
+//    then says which scopes of the last frame the GPU reached finished, which were
+//    still running and which it never got to.
+//***************************************************************************************
+
+#pragma once
+
+#include "d3dUtil.h"
+
+struct ProfileStats
+{
+	// Milliseconds, or a counter's value.
+	float Last = 0.0f;
+	float Min = 0.0f;
+	float Avg = 0.0f;
+	float Max = 0.0f;
+	float P99 = 0.0f;
+};
+
+class GpuProfiler
+{
+public:
+	GpuProfiler(ID3D12Device* device, ID3D12CommandQueue* queue, UINT frameCount, UINT maxScopes = 32);
+	GpuProfiler(const GpuProfiler& rhs) = delete;
+	GpuProfiler& operator=(const GpuProfiler& rhs) = delete;
+	~GpuProfiler();
+
+	UINT AddGpuScope(const std::string& name);
+	UINT AddCpuScope(const std::string& name);
+	UINT AddCounter(const std::string& name);
+
+	// Needs ID3D12GraphicsCommandList2 on the lists the scopes are recorded on; lists
+	// without it leave no breadcrumbs.
+	void EnableBreadcrumbs();
+	std::string BreadcrumbReport()const;
+
+	// Call once the GPU has finished the frame that last used frameIndex.  Collects that
+	// frame's timings into the stats (and the CSV) and starts recording a new frame.
+	void BeginFrame(UINT frameIndex);
+
+	// Returns a closed command list that resolves this frame's timestamps.  Submit it
+	// after every list that records a GPU scope.
+	ID3D12CommandList* EndFrame();
+
+	void BeginScope(ID3D12GraphicsCommandList* cmdList, UINT scope);
+	void EndScope(ID3D12GraphicsCommandList* cmdList, UINT scope);
+
+	// CPU scopes hit more than once in a frame report the sum.
+	void BeginCpuScope(UINT scope);
+	void EndCpuScope(UINT scope);
+
+	// Adds a time measured elsewhere, e.g. a wait that happened before BeginFrame.
+	void AddCpuTime(UINT scope, float ms);
+
+	// The frame's value of a counter; the last call in the frame counts.
+	void SetCount(UINT counter, float count);
+
+	UINT ScopeCount()const;
+	const std::string& ScopeName(UINT scope)const;
+	bool IsGpuScope(UINT scope)const;
+	bool IsCounter(UINT scope)const;
+	const ProfileStats& Stats(UINT scope)const;
+
+	// Per-scope milliseconds of the frame most recently collected by BeginFrame, or -1
+	// for scopes it did not record.  CollectedFrameCount() goes up by one per frame.
+	const std::vector<float>& LastFrameTimes()const;
+	UINT64 LastFrameNumber()const;
+	UINT64 CollectedFrameCount()const;
+
+	bool OpenCsv(const std::wstring& filename);
+	void CloseCsv();
+	bool IsCsvOpen()const;
+
+private:
+	enum class ScopeKind
+	{
+		Gpu,
+		Cpu,
+		Counter
+	};
+
+	struct Scope
+	{
+		std::string Name;
+		ScopeKind Kind = ScopeKind::Cpu;
+
+		std::vector<float> Samples;
+		UINT NextSample = 0;
+		UINT SampleCount = 0;
+		ProfileStats Stats;
+
+		LARGE_INTEGER CpuStart = {};
+	};
+
+	struct Frame
+	{
+		Microsoft::WRL::ComPtr<ID3D12CommandAllocator> CmdListAlloc;
+		Microsoft::WRL::ComPtr<ID3D12Resource> Readback;
+
+		// Separate flags for both ends since they may be recorded on different threads.
+		std::vector<UINT8> BeginRecorded;
+		std::vector<UINT8> EndRecorded;
+		// CPU milliseconds and counter values, -1 until set.
+		std::vector<float> CpuMs;
+
+		UINT64 FrameNumber = 0;
+		bool Submitted = false;
+	};
+
+	UINT AddScope(const std::string& name, ScopeKind kind);
+	void AddSample(Scope& scope, float ms);
+	UINT QueryIndex(UINT frameIndex, UINT scope)const;
+	void WriteBreadcrumb(ID3D12GraphicsCommandList* cmdList, UINT slot, D3D12_WRITEBUFFERIMMEDIATE_MODE mode);
+
+private:
+	static const UINT WindowSize = 128;
+
+	ID3D12Device* mDevice = nullptr;
+	UINT mMaxScopes = 0;
+
+	Microsoft::WRL::ComPtr<ID3D12QueryHeap> mQueryHeap;
+	Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> mResolveCmdList;
+
+	std::vector<Frame> mFrames;
+	UINT mCurrFrame = 0;
+	UINT64 mFrameNumber = 0;
+
+	std::vector<Scope> mScopes;
+	std::vector<float> mSortScratch;
+
+	// A begin and an end frame number per scope; 0 before the scope first ran.
+	Microsoft::WRL::ComPtr<ID3D12Resource> mBreadcrumbs;
+	const UINT* mBreadcrumbData = nullptr;
+
+	std::vector<float> mLastFrameMs;
+	UINT64 mLastFrameNumber = 0;
+	UINT64 mCollectedFrames = 0;
+
+	double mGpuTicksToMs = 0.0;
+	double mCpuTicksToMs = 0.0;
+
+	std::ofstream mCsv;
+};
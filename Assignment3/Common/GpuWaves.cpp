@@ -0,0 +1,135 @@
+//***************************************************************************************
+// GpuWaves.cpp
+//***************************************************************************************
+
+#include "GpuWaves.h"
+
+GpuWaves::GpuWaves(ID3D12Device* device, UINT columns, UINT rows, float spatialStep, float timeStep,
+	float speed, float damping, UINT maxStepsPerFrame) :
+	mColumns(columns),
+	mRows(rows),
+	mTimeStep(timeStep),
+	mMaxStepsPerFrame(maxStepsPerFrame)
+{
+	assert(columns >= 3 && rows >= 3);
+
+	// Finite-difference terms of u_tt = c^2 (u_xx + u_yy) - mu u_t, solved for the next step.
+	float d = damping * timeStep + 2.0f;
+	float e = (speed * speed) * (timeStep * timeStep) / (spatialStep * spatialStep);
+	mK[0] = (damping * timeStep - 2.0f) / d;
+	mK[1] = (4.0f - 8.0f * e) / d;
+	mK[2] = (2.0f * e) / d;
+
+	// Default-heap committed resources start zeroed, so the water starts flat.
+	for(UINT i = 0; i < BufferCount; ++i)
+	{
+		ThrowIfFailed(device->CreateCommittedResource(
+			&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+			D3D12_HEAP_FLAG_NONE,
+			&CD3DX12_RESOURCE_DESC::Buffer(columns * rows * sizeof(float), D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS),
+			D3D12_RESOURCE_STATE_COMMON,
+			nullptr,
+			IID_PPV_ARGS(mBuffers[i].GetAddressOf())));
+	}
+}
+
+UINT GpuWaves::Columns()const
+{
+	return mColumns;
+}
+
+UINT GpuWaves::Rows()const
+{
+	return mRows;
+}
+
+UINT GpuWaves::Advance(float dt)
+{
+	mAccumulatedTime += dt;
+
+	UINT steps = (UINT)(mAccumulatedTime / mTimeStep);
+	if(steps > mMaxStepsPerFrame)
+	{
+		steps = mMaxStepsPerFrame;
+		mAccumulatedTime = 0.0f;
+	}
+	else
+	{
+		mAccumulatedTime -= steps * mTimeStep;
+	}
+
+	return steps;
+}
+
+void GpuWaves::Disturb(UINT column, UINT row, float magnitude)
+{
+	assert(column < mColumns && row < mRows);
+	mDisturbances.push_back({ column, row, magnitude });
+}
+
+void GpuWaves::RecordSteps(ID3D12GraphicsCommandList* cmdList, ResourceStateTracker& states, UINT steps)
+{
+	StepConstants constants = {};
+	constants.K[0] = mK[0];
+	constants.K[1] = mK[1];
+	constants.K[2] = mK[2];
+	constants.Columns = mColumns;
+	constants.Rows = mRows;
+
+	for(UINT step = 0; step < steps; ++step)
+	{
+		constants.DisturbMagnitude = 0.0f;
+		if(!mDisturbances.empty())
+		{
+			constants.DisturbColumn = mDisturbances.front().Column;
+			constants.DisturbRow = mDisturbances.front().Row;
+			constants.DisturbMagnitude = mDisturbances.front().Magnitude;
+			mDisturbances.pop_front();
+		}
+
+		// The previous step's output becomes this one's current solution.
+		states.Transition(mBuffers[mPrev].Get(), D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+		states.Transition(mBuffers[mCurr].Get(), D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+		states.Transition(mBuffers[mNext].Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+		states.FlushBarriers(cmdList);
+
+		cmdList->SetComputeRoot32BitConstants(0, sizeof(StepConstants) / 4, &constants, 0);
+		cmdList->SetComputeRootShaderResourceView(1, mBuffers[mPrev]->GetGPUVirtualAddress());
+		cmdList->SetComputeRootShaderResourceView(2, mBuffers[mCurr]->GetGPUVirtualAddress());
+		cmdList->SetComputeRootUnorderedAccessView(3, mBuffers[mNext]->GetGPUVirtualAddress());
+
+		// 16x16 cells per group.
+		cmdList->Dispatch((mColumns + 15) / 16, (mRows + 15) / 16, 1);
+
+		UINT oldPrev = mPrev;
+		mPrev = mCurr;
+		mCurr = mNext;
+		mNext = oldPrev;
+	}
+}
+
+UINT64 GpuWaves::WriteFence(UINT steps)const
+{
+	// Step k writes the buffer that is next after k rotations.
+	const UINT written[BufferCount] = { mNext, mPrev, mCurr };
+
+	UINT64 fence = 0;
+	for(UINT k = 0; k < steps && k < BufferCount; ++k)
+		fence = MathHelper::Max(fence, mReadFences[written[k]]);
+	return fence;
+}
+
+void GpuWaves::MarkRead(UINT64 fence)
+{
+	mReadFences[mCurr] = fence;
+}
+
+ID3D12Resource* GpuWaves::Buffer(UINT index)const
+{
+	return mBuffers[index].Get();
+}
+
+D3D12_GPU_VIRTUAL_ADDRESS GpuWaves::Solution()const
+{
+	return mBuffers[mCurr]->GetGPUVirtualAddress();
+}
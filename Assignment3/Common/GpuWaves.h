@@ -0,0 +1,96 @@
+//***************************************************************************************
+// GpuWaves.h
+//
+// The 2D wave equation solved by a compute shader (Waves.hlsl) over a grid of heights,
+// after the GpuWaves demo of Frank Luna's book.
+//   -Three structured buffers of floats take turns: each step reads the previous and
+//    current solutions and writes the next, then the three rotate.  Solution() is the
+//    latest one, for a vertex shader to displace a grid with.
+//   -Advance() turns frame time into a whole number of fixed steps, so the solver
+//    stays stable whatever the frame rate.
+//   -RecordSteps() is meant for a list on a compute queue while the frame renders on
+//    another.  The buffers are tracked as decaying to COMMON on that queue's
+//    ResourceStateTracker; the reading queue needs no barriers, as buffers are
+//    implicitly promoted to a read state.
+//   -A step overwrites a buffer frames in flight may still read.  MarkRead() records
+//    the fence of each frame that reads Solution(), and the compute queue waits for
+//    WriteFence() before executing the steps.
+//***************************************************************************************
+
+#pragma once
+
+#include "d3dUtil.h"
+#include "ResourceStateTracker.h"
+#include <deque>
+
+class GpuWaves
+{
+public:
+	// Root parameters the caller's root signature has to provide, in this order:
+	// StepConstants as 32-bit constants (b0), the previous and current solutions as
+	// root SRVs (t0, t1) and the next solution as a root UAV (u0).
+	struct StepConstants
+	{
+		float K[3];
+		UINT Columns;
+		UINT Rows;
+		UINT DisturbColumn;
+		UINT DisturbRow;
+		float DisturbMagnitude;
+	};
+
+	static const UINT BufferCount = 3;
+
+	// spatialStep is the distance between cells and timeStep the length of one step,
+	// both as the wave speed sees them.  The solver is only stable while
+	// speed * timeStep / spatialStep stays well below 1/sqrt(2).
+	GpuWaves(ID3D12Device* device, UINT columns, UINT rows, float spatialStep, float timeStep,
+		float speed, float damping, UINT maxStepsPerFrame = 4);
+	GpuWaves(const GpuWaves& rhs) = delete;
+	GpuWaves& operator=(const GpuWaves& rhs) = delete;
+	~GpuWaves() = default;
+
+	UINT Columns()const;
+	UINT Rows()const;
+
+	// Returns the steps due after dt more seconds.  Time beyond maxStepsPerFrame steps
+	// is dropped rather than caught up on.
+	UINT Advance(float dt);
+
+	// One disturbance goes into each step recorded; cells on the border are held at zero.
+	void Disturb(UINT column, UINT row, float magnitude);
+
+	// Records the steps into a compute list that already has the wave PSO and root
+	// signature set.  All the buffers must be COMMON in states.
+	void RecordSteps(ID3D12GraphicsCommandList* cmdList, ResourceStateTracker& states, UINT steps);
+
+	// The last fence value MarkRead() gave any buffer the next steps will overwrite.
+	UINT64 WriteFence(UINT steps)const;
+	void MarkRead(UINT64 fence);
+
+	ID3D12Resource* Buffer(UINT index)const;
+	D3D12_GPU_VIRTUAL_ADDRESS Solution()const;
+
+private:
+	struct Disturbance
+	{
+		UINT Column;
+		UINT Row;
+		float Magnitude;
+	};
+
+	UINT mColumns = 0;
+	UINT mRows = 0;
+	float mTimeStep = 0.0f;
+	float mAccumulatedTime = 0.0f;
+	UINT mMaxStepsPerFrame = 0;
+	float mK[3] = {};
+
+	Microsoft::WRL::ComPtr<ID3D12Resource> mBuffers[BufferCount];
+	UINT64 mReadFences[BufferCount] = {};
+	UINT mPrev = 0;
+	UINT mCurr = 1;
+	UINT mNext = 2;
+
+	std::deque<Disturbance> mDisturbances;
+};
@@ -0,0 +1,199 @@
+//***************************************************************************************
+// HiZPyramid.cpp
+//***************************************************************************************
+
+#include "HiZPyramid.h"
+
+namespace
+{
+	UINT NextPowerOfTwo(UINT value)
+	{
+		UINT result = 1;
+		while(result < value)
+			result <<= 1;
+		return result;
+	}
+
+	UINT CeilShift(UINT value, UINT shift)
+	{
+		return (value + (1u << shift) - 1) >> shift;
+	}
+}
+
+HiZPyramid::HiZPyramid(ID3D12Device* device, DescriptorAllocator& heap) :
+	mDevice(device),
+	mHeap(heap)
+{
+	mNullSrvIndex = mHeap.Allocate();
+	mDepthSrvIndex = mHeap.Allocate();
+
+	// Null views until there is something to view, so binding Srv() is always valid.
+	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+	srvDesc.Format = DXGI_FORMAT_R32_FLOAT;
+	srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+	srvDesc.Texture2D.MipLevels = 1;
+	mDevice->CreateShaderResourceView(nullptr, &srvDesc, mHeap.CpuHandle(mNullSrvIndex));
+	mDevice->CreateShaderResourceView(nullptr, &srvDesc, mHeap.CpuHandle(mDepthSrvIndex));
+}
+
+void HiZPyramid::Resize(ID3D12Resource* depthBuffer, bool reverseZ, UINT64 retireFence)
+{
+	// The old texture no longer fits; the caller sets one of the new size.
+	SetTexture(nullptr, retireFence);
+	mDepthBuffer = nullptr;
+	mMipCount = 0;
+
+	D3D12_RESOURCE_DESC depthDesc = depthBuffer->GetDesc();
+	if(depthDesc.SampleDesc.Count > 1)
+		return;
+
+	mDepthBuffer = depthBuffer;
+	mReverseZ = reverseZ;
+	mDepthWidth = (UINT)depthDesc.Width;
+	mDepthHeight = depthDesc.Height;
+
+	mWidth = NextPowerOfTwo(CeilShift(mDepthWidth, 1));
+	mHeight = NextPowerOfTwo(CeilShift(mDepthHeight, 1));
+	mMipCount = 1;
+	while((mWidth >> (mMipCount - 1)) > 1 || (mHeight >> (mMipCount - 1)) > 1)
+		++mMipCount;
+
+	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+	srvDesc.Format = (depthDesc.Format == DXGI_FORMAT_R32_TYPELESS) ?
+		DXGI_FORMAT_R32_FLOAT : DXGI_FORMAT_R24_UNORM_X8_TYPELESS;
+	srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+	srvDesc.Texture2D.MipLevels = 1;
+	mDevice->CreateShaderResourceView(mDepthBuffer, &srvDesc, mHeap.CpuHandle(mDepthSrvIndex));
+}
+
+bool HiZPyramid::Supported()const
+{
+	return mMipCount > 0;
+}
+
+D3D12_RESOURCE_DESC HiZPyramid::TextureDesc()const
+{
+	assert(Supported());
+
+	return CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R32_FLOAT, mWidth, mHeight, 1, (UINT16)mMipCount,
+		1, 0, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
+}
+
+void HiZPyramid::SetTexture(ID3D12Resource* pyramid, UINT64 retireFence)
+{
+	if(pyramid == mPyramid)
+		return;
+
+	FreeViews(retireFence);
+	mPyramid = pyramid;
+	if(mPyramid == nullptr)
+		return;
+
+	assert(Supported());
+
+	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+	srvDesc.Format = DXGI_FORMAT_R32_FLOAT;
+	srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+	srvDesc.Texture2D.MipLevels = mMipCount;
+
+	mSrvIndex = mHeap.Allocate();
+	mDevice->CreateShaderResourceView(mPyramid, &srvDesc, mHeap.CpuHandle(mSrvIndex));
+
+	for(UINT mip = 0; mip < mMipCount; ++mip)
+	{
+		D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
+		uavDesc.Format = DXGI_FORMAT_R32_FLOAT;
+		uavDesc.ViewDimension = D3D12_UAV_DIMENSION_TEXTURE2D;
+		uavDesc.Texture2D.MipSlice = mip;
+
+		UINT index = mHeap.Allocate();
+		mDevice->CreateUnorderedAccessView(mPyramid, nullptr, &uavDesc, mHeap.CpuHandle(index));
+		mMipUavIndices.push_back(index);
+	}
+}
+
+void HiZPyramid::Build(ID3D12GraphicsCommandList* cmdList, ResourceStateTracker& states)
+{
+	assert(mPyramid != nullptr);
+
+	states.Transition(mDepthBuffer, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+	states.Transition(mPyramid, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+	states.FlushBarriers(cmdList);
+
+	cmdList->SetComputeRootDescriptorTable(1, mHeap.GpuHandle(mDepthSrvIndex));
+
+	for(UINT mip = 0; mip < mMipCount; ++mip)
+	{
+		BuildConstants constants = {};
+		constants.SrcWidth = mip == 0 ? mDepthWidth : ValidWidth(mip - 1);
+		constants.SrcHeight = mip == 0 ? mDepthHeight : ValidHeight(mip - 1);
+		constants.DstWidth = ValidWidth(mip);
+		constants.DstHeight = ValidHeight(mip);
+		constants.FromDepth = mip == 0;
+		constants.ReverseZ = mReverseZ;
+
+		// Mip 0 reads the depth buffer; its source UAV is bound but unused.
+		cmdList->SetComputeRoot32BitConstants(0, sizeof(BuildConstants) / 4, &constants, 0);
+		cmdList->SetComputeRootDescriptorTable(2, mHeap.GpuHandle(mMipUavIndices[mip == 0 ? 0 : mip - 1]));
+		cmdList->SetComputeRootDescriptorTable(3, mHeap.GpuHandle(mMipUavIndices[mip]));
+
+		// 8x8 texels per group.
+		cmdList->Dispatch((constants.DstWidth + 7) / 8, (constants.DstHeight + 7) / 8, 1);
+
+		// The next mip reads this one.
+		states.UavBarrier(mPyramid);
+		states.FlushBarriers(cmdList);
+	}
+
+	states.Transition(mPyramid, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+	states.FlushBarriers(cmdList);
+}
+
+ID3D12Resource* HiZPyramid::Resource()const
+{
+	return mPyramid;
+}
+
+D3D12_GPU_DESCRIPTOR_HANDLE HiZPyramid::Srv()const
+{
+	return mHeap.GpuHandle(mPyramid != nullptr ? mSrvIndex : mNullSrvIndex);
+}
+
+UINT HiZPyramid::DepthWidth()const
+{
+	return mDepthWidth;
+}
+
+UINT HiZPyramid::DepthHeight()const
+{
+	return mDepthHeight;
+}
+
+UINT HiZPyramid::MipCount()const
+{
+	return mMipCount;
+}
+
+UINT HiZPyramid::ValidWidth(UINT mip)const
+{
+	return CeilShift(mDepthWidth, mip + 1);
+}
+
+UINT HiZPyramid::ValidHeight(UINT mip)const
+{
+	return CeilShift(mDepthHeight, mip + 1);
+}
+
+void HiZPyramid::FreeViews(UINT64 retireFence)
+{
+	if(mPyramid == nullptr)
+		return;
+
+	mHeap.Free(mSrvIndex, retireFence);
+	for(UINT index : mMipUavIndices)
+		mHeap.Free(index, retireFence);
+	mMipUavIndices.clear();
+}
@@ -0,0 +1,96 @@
+//***************************************************************************************
+// HiZPyramid.h
+//
+// A hierarchical-Z pyramid of a depth buffer for GPU occlusion culling, built by a
+// compute shader (HiZ.hlsl).
+//   -Each texel holds the farthest depth of the texels below it.  Mip 0 covers 2x2
+//    depth pixels, so a texel of mip L covers the pixels [x, x + 1) * 2^(L + 1).
+//    Odd sizes round up, and the texels past the edge repeat the edge.
+//   -The texture is sized up to powers of two so the mip chain halves exactly; only
+//    the ValidWidth(L) x ValidHeight(L) corner of each mip is built.
+//   -The caller owns the texture, e.g. as a RenderGraph transient: Resize() gives
+//    its TextureDesc() and SetTexture() hands it over.  Its contents are only
+//    needed between Build() and the reads that follow.
+//   -Views live in a shader-visible DescriptorAllocator.  Resize() rewrites the
+//    depth SRV in place, so call it with the GPU idle, as D3DApp::OnResize leaves
+//    it.  A new texture gets new views and frees the old ones at retireFence.
+//   -Multisampled depth buffers are not supported; Supported() is false and no
+//    texture is set.  Without a texture Srv() still names a valid null view.
+//***************************************************************************************
+
+#pragma once
+
+#include "d3dUtil.h"
+#include "DescriptorAllocator.h"
+#include "ResourceStateTracker.h"
+
+class HiZPyramid
+{
+public:
+	// Root parameters the caller's root signature has to provide, in this order:
+	// BuildConstants as 32-bit constants (b0), a one-descriptor SRV table for the
+	// depth buffer (t0) and one-descriptor UAV tables for the mip read (u0) and the
+	// mip written (u1).
+	struct BuildConstants
+	{
+		UINT SrcWidth;
+		UINT SrcHeight;
+		UINT DstWidth;
+		UINT DstHeight;
+		UINT FromDepth;
+		UINT ReverseZ;
+	};
+
+	HiZPyramid(ID3D12Device* device, DescriptorAllocator& heap);
+	HiZPyramid(const HiZPyramid& rhs) = delete;
+	HiZPyramid& operator=(const HiZPyramid& rhs) = delete;
+	~HiZPyramid() = default;
+
+	// depthBuffer is an R24G8_TYPELESS or R32_TYPELESS texture.  With reverseZ the
+	// pyramid keeps the smallest depth, the farthest.  Drops the texture.
+	void Resize(ID3D12Resource* depthBuffer, bool reverseZ, UINT64 retireFence);
+	bool Supported()const;
+
+	// What SetTexture() expects, once Resize() has seen a supported depth buffer.
+	D3D12_RESOURCE_DESC TextureDesc()const;
+
+	// The texture has to be tracked in the states given to Build().  Setting the
+	// same one again keeps its views.
+	void SetTexture(ID3D12Resource* pyramid, UINT64 retireFence);
+
+	// Records the reduction into a direct list that already has the Hi-Z PSO, root
+	// signature and descriptor heap set.  Leaves the depth buffer and the pyramid in
+	// NON_PIXEL_SHADER_RESOURCE.
+	void Build(ID3D12GraphicsCommandList* cmdList, ResourceStateTracker& states);
+
+	ID3D12Resource* Resource()const;
+	D3D12_GPU_DESCRIPTOR_HANDLE Srv()const;
+
+	// The size of the depth buffer the pyramid was built for.
+	UINT DepthWidth()const;
+	UINT DepthHeight()const;
+	UINT MipCount()const;
+
+private:
+	UINT ValidWidth(UINT mip)const;
+	UINT ValidHeight(UINT mip)const;
+	void FreeViews(UINT64 retireFence);
+
+private:
+	ID3D12Device* mDevice = nullptr;
+	DescriptorAllocator& mHeap;
+
+	ID3D12Resource* mPyramid = nullptr;
+	ID3D12Resource* mDepthBuffer = nullptr;
+	UINT mWidth = 0;
+	UINT mHeight = 0;
+	UINT mDepthWidth = 0;
+	UINT mDepthHeight = 0;
+	UINT mMipCount = 0;
+	bool mReverseZ = false;
+
+	UINT mNullSrvIndex = 0;
+	UINT mSrvIndex = 0;
+	UINT mDepthSrvIndex = 0;
+	std::vector<UINT> mMipUavIndices;
+};
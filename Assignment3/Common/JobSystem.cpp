@@ -0,0 +1,276 @@
+//***************************************************************************************
+// JobSystem.cpp
+//***************************************************************************************
+
+#include "JobSystem.h"
+#include <cassert>
+
+// Which system's deque the calling thread owns, if any.
+static thread_local const JobSystem* tOwner = nullptr;
+static thread_local unsigned int tSlot = 0;
+
+bool JobSystem::Counter::Done()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mPending == 0;
+}
+
+JobSystem::JobSystem(unsigned int threadCount)
+{
+	if(threadCount == 0)
+	{
+		unsigned int cores = std::thread::hardware_concurrency();
+		threadCount = cores > 1 ? cores - 1 : 1;
+	}
+
+	mQueues.reserve(threadCount + 1);
+	for(unsigned int i = 0; i < threadCount + 1; ++i)
+		mQueues.push_back(std::make_unique<WorkQueue>());
+
+	tOwner = this;
+	tSlot = 0;
+
+	mThreads.reserve(threadCount);
+	for(unsigned int i = 0; i < threadCount; ++i)
+		mThreads.emplace_back(&JobSystem::WorkerLoop, this, i + 1);
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(mWakeMutex);
+		mShutdown = true;
+	}
+	mWake.notify_all();
+
+	for(auto& t : mThreads)
+		t.join();
+
+	if(tOwner == this)
+		tOwner = nullptr;
+}
+
+void JobSystem::Run(Counter& counter, std::function<void()> job)
+{
+	Push(Acquire(counter, job));
+}
+
+void JobSystem::RunAfter(std::initializer_list<Counter*> dependencies, Counter& counter, std::function<void()> job)
+{
+	assert(dependencies.size() <= MaxDependencies);
+
+	Job* j = Acquire(counter, job);
+	j->Blockers = 1;
+
+	// A dependency that is already done holds nothing back.
+	unsigned int links = 0;
+	for(Counter* dependency : dependencies)
+	{
+		std::lock_guard<std::mutex> lock(dependency->mMutex);
+		if(dependency->mPending == 0)
+			continue;
+
+		++j->Blockers;
+		Link& link = j->Links[links++];
+		link.Waiting = j;
+		link.Next = dependency->mWaiting;
+		dependency->mWaiting = &link;
+	}
+
+	Unblock(j);
+}
+
+void JobSystem::Wait(Counter& counter)
+{
+	while(!counter.Done())
+	{
+		Job* job = Pop(CurrentSlot());
+		if(job != nullptr)
+		{
+			Execute(job);
+			continue;
+		}
+
+		// Whatever is left is running on other threads, or held back behind it.
+		std::unique_lock<std::mutex> lock(mWakeMutex);
+		mWake.wait(lock, [this, &counter] { return mQueued.load() > 0 || counter.Done(); });
+	}
+
+	std::lock_guard<std::mutex> lock(mErrorMutex);
+	if(mFirstError != nullptr)
+	{
+		std::exception_ptr error = mFirstError;
+		mFirstError = nullptr;
+		std::rethrow_exception(error);
+	}
+}
+
+unsigned int JobSystem::ThreadCount()const
+{
+	return (unsigned int)mThreads.size();
+}
+
+JobSystem::Job* JobSystem::Acquire(Counter& counter, std::function<void()>& function)
+{
+	Job* job = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(mPoolMutex);
+		if(mFreeJobs.empty())
+		{
+			mJobStorage.push_back(std::make_unique<Job>());
+			job = mJobStorage.back().get();
+		}
+		else
+		{
+			job = mFreeJobs.back();
+			mFreeJobs.pop_back();
+		}
+	}
+
+	job->Function = std::move(function);
+	job->Owner = &counter;
+	{
+		std::lock_guard<std::mutex> lock(counter.mMutex);
+		++counter.mPending;
+	}
+	return job;
+}
+
+void JobSystem::Recycle(Job* job)
+{
+	// Releases the captures now rather than when the job is next handed out.
+	job->Function = nullptr;
+	job->Owner = nullptr;
+
+	std::lock_guard<std::mutex> lock(mPoolMutex);
+	mFreeJobs.push_back(job);
+}
+
+void JobSystem::Push(Job* job)
+{
+	WorkQueue& queue = *mQueues[CurrentSlot()];
+	{
+		std::lock_guard<std::mutex> lock(queue.Mutex);
+		queue.Jobs.push_back(job);
+		++mQueued;
+	}
+
+	// Taking the lock orders this against a thread that has just found nothing queued
+	// and is about to sleep.
+	{
+		std::lock_guard<std::mutex> lock(mWakeMutex);
+	}
+	mWake.notify_one();
+}
+
+JobSystem::Job* JobSystem::Pop(unsigned int slot)
+{
+	// The newest job of the thread's own deque, whose data is likely still in cache.
+	{
+		WorkQueue& queue = *mQueues[slot];
+		std::lock_guard<std::mutex> lock(queue.Mutex);
+		if(!queue.Jobs.empty())
+		{
+			Job* job = queue.Jobs.back();
+			queue.Jobs.pop_back();
+			--mQueued;
+			return job;
+		}
+	}
+
+	// Otherwise the oldest job of another deque, which tends to be the largest.
+	const unsigned int queueCount = (unsigned int)mQueues.size();
+	for(unsigned int i = 1; i < queueCount; ++i)
+	{
+		WorkQueue& queue = *mQueues[(slot + i) % queueCount];
+		std::lock_guard<std::mutex> lock(queue.Mutex);
+		if(!queue.Jobs.empty())
+		{
+			Job* job = queue.Jobs.front();
+			queue.Jobs.pop_front();
+			--mQueued;
+			return job;
+		}
+	}
+
+	return nullptr;
+}
+
+void JobSystem::Execute(Job* job)
+{
+	try
+	{
+		job->Function();
+	}
+	catch(...)
+	{
+		std::lock_guard<std::mutex> lock(mErrorMutex);
+		if(mFirstError == nullptr)
+			mFirstError = std::current_exception();
+	}
+
+	// The counter may be destroyed as soon as its lock is released with nothing
+	// pending, so nothing after this block touches it.
+	Counter& counter = *job->Owner;
+	Link* released = nullptr;
+	bool done = false;
+	{
+		std::lock_guard<std::mutex> lock(counter.mMutex);
+		done = (--counter.mPending == 0);
+		if(done)
+		{
+			released = counter.mWaiting;
+			counter.mWaiting = nullptr;
+		}
+	}
+	Recycle(job);
+
+	// A released job may run, and its links be reused, as soon as it is unblocked.
+	while(released != nullptr)
+	{
+		Link* next = released->Next;
+		Unblock(released->Waiting);
+		released = next;
+	}
+
+	if(done)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mWakeMutex);
+		}
+		mWake.notify_all();
+	}
+}
+
+void JobSystem::Unblock(Job* job)
+{
+	if(--job->Blockers == 0)
+		Push(job);
+}
+
+unsigned int JobSystem::CurrentSlot()const
+{
+	return tOwner == this ? tSlot : 0;
+}
+
+void JobSystem::WorkerLoop(unsigned int slot)
+{
+	tOwner = this;
+	tSlot = slot;
+
+	for(;;)
+	{
+		Job* job = Pop(slot);
+		if(job != nullptr)
+		{
+			Execute(job);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(mWakeMutex);
+		mWake.wait(lock, [this] { return mShutdown || mQueued.load() > 0; });
+
+		if(mShutdown && mQueued.load() == 0)
+			return;
+	}
+}
@@ -0,0 +1,133 @@
+//***************************************************************************************
+// JobSystem.h
+//
+// Work-stealing scheduler for the short jobs of a frame.
+//   -Every worker owns a deque.  It pushes and pops its own jobs at the back, newest
+//    first, and steals the oldest job from the front of another's when it runs out.
+//    Jobs submitted from a thread that isn't a worker go to the deque of slot 0,
+//    which belongs to the thread that created the system.
+//   -Jobs are added to a Counter, which counts those not finished yet.  RunAfter()
+//    holds a job back until every counter it depends on has reached zero, so a frame
+//    can be described as a graph up front.
+//   -Wait() runs jobs on the calling thread until the counter reaches zero, so the
+//    main thread (or a job waiting on its children) helps instead of blocking.
+//   -An exception thrown by a job (e.g. a DxException from ThrowIfFailed) is caught,
+//    still counts the job as finished and is rethrown from the next Wait().
+//   -Jobs are recycled through a pool that only grows, and a RunAfter() job waits
+//    on its counters through links of its own.  Once the pool holds a frame's worth,
+//    scheduling costs no heap allocation, as long as the function's captures fit
+//    in std::function's small buffer (a handful of pointers).
+//***************************************************************************************
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class JobSystem
+{
+private:
+	struct Job;
+
+	// Chains a job into the waiting list of one of its dependencies.
+	struct Link
+	{
+		Job* Waiting = nullptr;
+		Link* Next = nullptr;
+	};
+
+public:
+	// Has to outlive the jobs added to it, which Wait() on it guarantees.
+	class Counter
+	{
+	public:
+		Counter() = default;
+		Counter(const Counter& rhs) = delete;
+		Counter& operator=(const Counter& rhs) = delete;
+
+		bool Done();
+
+	private:
+		friend class JobSystem;
+
+		std::mutex mMutex;
+		unsigned int mPending = 0;
+
+		// Jobs held back until mPending reaches zero.
+		Link* mWaiting = nullptr;
+	};
+
+	static const unsigned int MaxDependencies = 8;
+
+	// A thread count of 0 uses one thread per hardware core minus the caller's.
+	explicit JobSystem(unsigned int threadCount = 0);
+	JobSystem(const JobSystem& rhs) = delete;
+	JobSystem& operator=(const JobSystem& rhs) = delete;
+	~JobSystem();
+
+	void Run(Counter& counter, std::function<void()> job);
+
+	// At most MaxDependencies dependencies.
+	void RunAfter(std::initializer_list<Counter*> dependencies, Counter& counter, std::function<void()> job);
+	void Wait(Counter& counter);
+
+	// Worker threads, not counting the threads that call Wait().
+	unsigned int ThreadCount()const;
+
+private:
+	struct Job
+	{
+		std::function<void()> Function;
+		Counter* Owner = nullptr;
+
+		// Dependencies not done yet, plus one held by RunAfter() until it has
+		// registered with all of them.
+		std::atomic<unsigned int> Blockers{ 0 };
+		Link Links[MaxDependencies];
+	};
+
+	struct WorkQueue
+	{
+		std::mutex Mutex;
+		std::deque<Job*> Jobs;
+	};
+
+	Job* Acquire(Counter& counter, std::function<void()>& function);
+	void Recycle(Job* job);
+	void Push(Job* job);
+	Job* Pop(unsigned int slot);
+	void Execute(Job* job);
+	void Unblock(Job* job);
+
+	// The deque the calling thread owns, or 0 for a thread other than a worker.
+	unsigned int CurrentSlot()const;
+
+	void WorkerLoop(unsigned int slot);
+
+private:
+	// Slot 0 is the creating thread's, and slot i + 1 mThreads[i]'s.
+	std::vector<std::unique_ptr<WorkQueue>> mQueues;
+	std::vector<std::thread> mThreads;
+
+	// Every job ever made, and those not queued, held back or running.
+	std::mutex mPoolMutex;
+	std::vector<std::unique_ptr<Job>> mJobStorage;
+	std::vector<Job*> mFreeJobs;
+
+	// Sleeping threads wake when a job is queued or a counter reaches zero.
+	std::mutex mWakeMutex;
+	std::condition_variable mWake;
+	std::atomic<unsigned int> mQueued{ 0 };
+	bool mShutdown = false;
+
+	std::mutex mErrorMutex;
+	std::exception_ptr mFirstError = nullptr;
+};
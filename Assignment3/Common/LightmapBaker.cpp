@@ -0,0 +1,525 @@
+//***************************************************************************************
+// LightmapBaker.cpp
+//***************************************************************************************
+
+#include "LightmapBaker.h"
+#include "Bvh.h"
+#include "JobSystem.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <numeric>
+
+using namespace DirectX;
+using namespace DirectX::PackedVector;
+
+namespace
+{
+	// A chart is laid on its plane when every triangle faces within about 45 degrees
+	// of the chart's average normal.
+	const float FlatCosine = 0.7f;
+
+	// Shadow rays start this far off the surface and stop this short of the light.
+	const float ShadowBias = 0.05f;
+
+	const int DilatePasses = 2;
+
+	float Cross2(const XMFLOAT2& a, const XMFLOAT2& b, const XMFLOAT2& c)
+	{
+		return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+	}
+
+	std::uint32_t FindRoot(std::vector<std::uint32_t>& parent, std::uint32_t v)
+	{
+		while(parent[v] != v)
+		{
+			parent[v] = parent[parent[v]];
+			v = parent[v];
+		}
+		return v;
+	}
+
+	struct Chart
+	{
+		std::vector<std::uint32_t> Triangles;
+		std::vector<std::uint32_t> Vertices;
+		XMFLOAT2 Min = { FLT_MAX, FLT_MAX };
+		XMFLOAT2 Max = { -FLT_MAX, -FLT_MAX };
+		XMFLOAT2 Offset = { 0.0f, 0.0f };
+	};
+
+	// True if the chart's triangles with any area in space all keep one winding in
+	// flat, so none folds over another.
+	bool Unfolded(const Chart& chart, const std::uint32_t* indices, const XMFLOAT2* flat,
+		const std::vector<float>& areas, float& flatArea)
+	{
+		flatArea = 0.0f;
+		int sign = 0;
+		for(std::uint32_t t : chart.Triangles)
+		{
+			if(areas[t] <= 0.0f)
+				continue;
+
+			float area = 0.5f * Cross2(flat[indices[3 * t]], flat[indices[3 * t + 1]], flat[indices[3 * t + 2]]);
+			int s = area > 0.0f ? 1 : (area < 0.0f ? -1 : 0);
+			if(s == 0 || (sign != 0 && s != sign))
+				return false;
+			sign = s;
+			flatArea += fabsf(area);
+		}
+		return flatArea > 0.0f;
+	}
+}
+
+bool LightmapBaker::GenerateUVs(const XMFLOAT3* positions, const XMFLOAT2* texCoords,
+	std::uint32_t vertexCount, const std::uint32_t* indices, std::uint32_t indexCount, float padding,
+	XMFLOAT2* uvs)
+{
+	const std::uint32_t triangleCount = indexCount / 3;
+
+	// The charts are the pieces connected through shared vertices.
+	std::vector<std::uint32_t> parent(vertexCount);
+	std::iota(parent.begin(), parent.end(), 0u);
+	for(std::uint32_t i = 0; i < triangleCount * 3; i += 3)
+	{
+		std::uint32_t a = FindRoot(parent, indices[i]);
+		parent[FindRoot(parent, indices[i + 1])] = a;
+		parent[FindRoot(parent, indices[i + 2])] = a;
+	}
+
+	std::vector<Chart> charts;
+	std::vector<std::uint32_t> chartOfRoot(vertexCount, 0xFFFFFFFF);
+	for(std::uint32_t t = 0; t < triangleCount; ++t)
+	{
+		std::uint32_t root = FindRoot(parent, indices[3 * t]);
+		if(chartOfRoot[root] == 0xFFFFFFFF)
+		{
+			chartOfRoot[root] = (std::uint32_t)charts.size();
+			charts.emplace_back();
+		}
+		charts[chartOfRoot[root]].Triangles.push_back(t);
+	}
+	for(std::uint32_t v = 0; v < vertexCount; ++v)
+	{
+		uvs[v] = XMFLOAT2(0.0f, 0.0f);
+		std::uint32_t chart = chartOfRoot[FindRoot(parent, v)];
+		if(chart != 0xFFFFFFFF)
+			charts[chart].Vertices.push_back(v);
+	}
+
+	// Each triangle's area and unit normal in the mesh's space.
+	std::vector<float> areas(triangleCount);
+	std::vector<XMFLOAT3> faceNormals(triangleCount);
+	for(std::uint32_t t = 0; t < triangleCount; ++t)
+	{
+		XMVECTOR p0 = XMLoadFloat3(&positions[indices[3 * t]]);
+		XMVECTOR p1 = XMLoadFloat3(&positions[indices[3 * t + 1]]);
+		XMVECTOR p2 = XMLoadFloat3(&positions[indices[3 * t + 2]]);
+		XMVECTOR c = XMVector3Cross(p1 - p0, p2 - p0);
+		float length = XMVectorGetX(XMVector3Length(c));
+		areas[t] = 0.5f * length;
+		XMStoreFloat3(&faceNormals[t], length > 0.0f ? c / length : XMVectorZero());
+	}
+
+	// Lay each chart flat in units of the mesh's space.
+	std::vector<XMFLOAT2> flat(vertexCount, XMFLOAT2(0.0f, 0.0f));
+	float meshArea = 0.0f;
+	for(Chart& chart : charts)
+	{
+		XMVECTOR sum = XMVectorZero();
+		float chartArea = 0.0f;
+		for(std::uint32_t t : chart.Triangles)
+		{
+			sum += areas[t] * XMLoadFloat3(&faceNormals[t]);
+			chartArea += areas[t];
+		}
+		if(chartArea <= 0.0f)
+			continue;
+		meshArea += chartArea;
+
+		// Flat enough for its plane?
+		bool laid = false;
+		float flatArea = 0.0f;
+		XMVECTOR n = XMVector3Normalize(sum);
+		bool flatEnough = XMVectorGetX(XMVector3LengthSq(sum)) > 0.0f;
+		for(std::uint32_t t : chart.Triangles)
+		{
+			if(areas[t] > 0.0f && XMVectorGetX(XMVector3Dot(XMLoadFloat3(&faceNormals[t]), n)) < FlatCosine)
+			{
+				flatEnough = false;
+				break;
+			}
+		}
+		if(flatEnough)
+		{
+			XMVECTOR reference = fabsf(XMVectorGetY(n)) < 0.99f ? XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f) : XMVectorSet(1.0f, 0.0f, 0.0f, 0.0f);
+			XMVECTOR tangent = XMVector3Normalize(XMVector3Cross(reference, n));
+			XMVECTOR bitangent = XMVector3Cross(n, tangent);
+			for(std::uint32_t v : chart.Vertices)
+			{
+				XMVECTOR p = XMLoadFloat3(&positions[v]);
+				flat[v] = XMFLOAT2(XMVectorGetX(XMVector3Dot(p, tangent)), XMVectorGetX(XMVector3Dot(p, bitangent)));
+			}
+			laid = Unfolded(chart, indices, flat.data(), areas, flatArea);
+		}
+
+		// Curved, like a cylinder's side: its texture coordinates may still unroll it.
+		if(!laid && texCoords != nullptr)
+		{
+			for(std::uint32_t v : chart.Vertices)
+				flat[v] = texCoords[v];
+			laid = Unfolded(chart, indices, flat.data(), areas, flatArea);
+		}
+
+		if(!laid)
+			return false;
+
+		const float scale = sqrtf(chartArea / flatArea);
+		for(std::uint32_t v : chart.Vertices)
+		{
+			flat[v].x *= scale;
+			flat[v].y *= scale;
+			chart.Min = XMFLOAT2(std::min(chart.Min.x, flat[v].x), std::min(chart.Min.y, flat[v].y));
+			chart.Max = XMFLOAT2(std::max(chart.Max.x, flat[v].x), std::max(chart.Max.y, flat[v].y));
+		}
+	}
+
+	if(meshArea <= 0.0f)
+		return false;
+
+	// Shelves of charts, tallest first, each with half the gutter around it.
+	const float gutter = padding * sqrtf(meshArea);
+	std::vector<Chart*> order;
+	float packedArea = 0.0f;
+	float widest = 0.0f;
+	for(Chart& chart : charts)
+	{
+		if(chart.Vertices.empty() || chart.Min.x > chart.Max.x)
+			continue;
+		order.push_back(&chart);
+		float width = chart.Max.x - chart.Min.x + gutter;
+		float height = chart.Max.y - chart.Min.y + gutter;
+		packedArea += width * height;
+		widest = std::max(widest, width);
+	}
+	std::sort(order.begin(), order.end(), [](const Chart* a, const Chart* b)
+	{
+		return a->Max.y - a->Min.y > b->Max.y - b->Min.y;
+	});
+
+	const float shelfWidth = std::max(widest, sqrtf(packedArea));
+	float x = 0.0f;
+	float y = 0.0f;
+	float shelfHeight = 0.0f;
+	float usedWidth = 0.0f;
+	for(Chart* chart : order)
+	{
+		float width = chart->Max.x - chart->Min.x + gutter;
+		float height = chart->Max.y - chart->Min.y + gutter;
+		if(x > 0.0f && x + width > shelfWidth)
+		{
+			y += shelfHeight;
+			x = 0.0f;
+			shelfHeight = 0.0f;
+		}
+
+		chart->Offset = XMFLOAT2(x + 0.5f * gutter - chart->Min.x, y + 0.5f * gutter - chart->Min.y);
+		x += width;
+		shelfHeight = std::max(shelfHeight, height);
+		usedWidth = std::max(usedWidth, x);
+	}
+
+	// Into the unit square, keeping the charts' proportions.
+	const float extent = std::max(usedWidth, y + shelfHeight);
+	for(const Chart* chart : order)
+	{
+		for(std::uint32_t v : chart->Vertices)
+			uvs[v] = XMFLOAT2((flat[v].x + chart->Offset.x) / extent, (flat[v].y + chart->Offset.y) / extent);
+	}
+
+	return true;
+}
+
+LightmapBaker::LightmapBaker(std::uint32_t atlasSize, std::uint32_t maxSlices, float texelsPerUnit,
+	std::uint32_t minRectSize, std::uint32_t maxRectSize) :
+	mAtlasSize(atlasSize),
+	mMaxSlices(maxSlices),
+	mTexelsPerUnit(texelsPerUnit),
+	mMinRectSize(minRectSize),
+	mMaxRectSize(std::min(maxRectSize, atlasSize))
+{
+}
+
+std::uint32_t LightmapBaker::AddInstance(const Mesh& mesh, const XMFLOAT4X4& world)
+{
+	XMMATRIX W = XMLoadFloat4x4(&world);
+
+	float area = 0.0f;
+	for(std::uint32_t i = 0; i + 2 < mesh.IndexCount; i += 3)
+	{
+		XMVECTOR p0 = XMVector3TransformCoord(XMLoadFloat3(&mesh.Positions[mesh.Indices[i]]), W);
+		XMVECTOR p1 = XMVector3TransformCoord(XMLoadFloat3(&mesh.Positions[mesh.Indices[i + 1]]), W);
+		XMVECTOR p2 = XMVector3TransformCoord(XMLoadFloat3(&mesh.Positions[mesh.Indices[i + 2]]), W);
+		area += 0.5f * XMVectorGetX(XMVector3Length(XMVector3Cross(p1 - p0, p2 - p0)));
+	}
+
+	// Square, as the UVs fill the unit square.
+	std::uint32_t size = (std::uint32_t)ceilf(sqrtf(area) * mTexelsPerUnit);
+	size = std::min(std::max(size, mMinRectSize), mMaxRectSize);
+
+	Instance instance;
+	instance.Geometry = mesh;
+	instance.World = world;
+	instance.Region.Width = size;
+	instance.Region.Height = size;
+	mInstances.push_back(instance);
+
+	return (std::uint32_t)mInstances.size() - 1;
+}
+
+bool LightmapBaker::AllocateRect(Rect& rect)
+{
+	if(mSliceCount == 0 || mShelfX + rect.Width > mAtlasSize)
+	{
+		// Onto the next shelf, or into a new slice.
+		mShelfY += mShelfHeight;
+		mShelfX = 0;
+		mShelfHeight = 0;
+		if(mSliceCount == 0 || mShelfY + rect.Height > mAtlasSize)
+		{
+			if(mSliceCount == mMaxSlices)
+				return false;
+			++mSliceCount;
+			mShelfY = 0;
+		}
+	}
+	else if(mShelfY + rect.Height > mAtlasSize)
+	{
+		return false;
+	}
+
+	rect.X = mShelfX;
+	rect.Y = mShelfY;
+	rect.Slice = mSliceCount - 1;
+	mShelfX += rect.Width;
+	mShelfHeight = std::max(mShelfHeight, rect.Height);
+	return true;
+}
+
+void LightmapBaker::Bake(JobSystem& jobs, const std::vector<Light>& lights, const SceneBvh& occluders)
+{
+	// The shelves stay tight when each is started by its tallest rectangle.
+	std::vector<std::uint32_t> order(mInstances.size());
+	std::iota(order.begin(), order.end(), 0u);
+	std::stable_sort(order.begin(), order.end(), [this](std::uint32_t a, std::uint32_t b)
+	{
+		return mInstances[a].Region.Height > mInstances[b].Region.Height;
+	});
+	for(std::uint32_t i : order)
+	{
+		if(!AllocateRect(mInstances[i].Region))
+			mInstances[i].Region.Slice = NoSlice;
+	}
+
+	mTexels.assign((std::size_t)mSliceCount * mAtlasSize * mAtlasSize, XMHALF4(0.0f, 0.0f, 0.0f, 1.0f));
+
+	JobSystem::Counter counter;
+	for(const Instance& instance : mInstances)
+	{
+		if(instance.Region.Slice == NoSlice)
+			continue;
+		jobs.Run(counter, [this, &instance, &lights, &occluders]()
+		{
+			BakeInstance(instance, lights, occluders);
+		});
+	}
+	jobs.Wait(counter);
+}
+
+void LightmapBaker::BakeInstance(const Instance& instance, const std::vector<Light>& lights, const SceneBvh& occluders)
+{
+	const Mesh& mesh = instance.Geometry;
+	const Rect& rect = instance.Region;
+
+	// The vertices in the world; normals by the inverse transpose, as the instances
+	// may be scaled unevenly.
+	XMMATRIX world = XMLoadFloat4x4(&instance.World);
+	XMMATRIX normalWorld = XMMatrixTranspose(XMMatrixInverse(nullptr, world));
+	std::vector<XMFLOAT3> positionsW(mesh.VertexCount);
+	std::vector<XMFLOAT3> normalsW(mesh.VertexCount);
+	std::vector<XMFLOAT2> texels(mesh.VertexCount);
+	for(std::uint32_t v = 0; v < mesh.VertexCount; ++v)
+	{
+		XMStoreFloat3(&positionsW[v], XMVector3TransformCoord(XMLoadFloat3(&mesh.Positions[v]), world));
+		XMStoreFloat3(&normalsW[v], XMVector3Normalize(XMVector3TransformNormal(XMLoadFloat3(&mesh.Normals[v]), normalWorld)));
+		texels[v] = XMFLOAT2(mesh.LightmapUVs[v].x * rect.Width, mesh.LightmapUVs[v].y * rect.Height);
+	}
+
+	// Only the lights whose range reaches the instance.
+	BoundingBox bounds;
+	BoundingBox::CreateFromPoints(bounds, positionsW.size(), positionsW.data(), sizeof(XMFLOAT3));
+	std::vector<const Light*> reaching;
+	for(const Light& light : lights)
+	{
+		if(bounds.Intersects(BoundingSphere(light.Position, light.FalloffEnd)))
+			reaching.push_back(&light);
+	}
+
+	std::vector<XMFLOAT3> irradiance((std::size_t)rect.Width * rect.Height, XMFLOAT3(0.0f, 0.0f, 0.0f));
+	std::vector<std::uint8_t> covered(irradiance.size(), 0);
+
+	for(std::uint32_t i = 0; i + 2 < mesh.IndexCount; i += 3)
+	{
+		const std::uint32_t v0 = mesh.Indices[i];
+		const std::uint32_t v1 = mesh.Indices[i + 1];
+		const std::uint32_t v2 = mesh.Indices[i + 2];
+		const XMFLOAT2& q0 = texels[v0];
+		const XMFLOAT2& q1 = texels[v1];
+		const XMFLOAT2& q2 = texels[v2];
+
+		float area = Cross2(q0, q1, q2);
+		if(fabsf(area) < 1e-8f)
+			continue;
+
+		int minX = std::max((int)floorf(std::min({ q0.x, q1.x, q2.x })), 0);
+		int minY = std::max((int)floorf(std::min({ q0.y, q1.y, q2.y })), 0);
+		int maxX = std::min((int)ceilf(std::max({ q0.x, q1.x, q2.x })), (int)rect.Width - 1);
+		int maxY = std::min((int)ceilf(std::max({ q0.y, q1.y, q2.y })), (int)rect.Height - 1);
+
+		for(int y = minY; y <= maxY; ++y)
+		{
+			for(int x = minX; x <= maxX; ++x)
+			{
+				const std::size_t texel = (std::size_t)y * rect.Width + x;
+				if(covered[texel])
+					continue;
+
+				// Barycentrics of the texel's centre; the first triangle over it wins.
+				XMFLOAT2 p((float)x + 0.5f, (float)y + 0.5f);
+				float b0 = Cross2(q1, q2, p) / area;
+				float b1 = Cross2(q2, q0, p) / area;
+				float b2 = 1.0f - b0 - b1;
+				if(b0 < 0.0f || b1 < 0.0f || b2 < 0.0f)
+					continue;
+
+				XMVECTOR posW = b0 * XMLoadFloat3(&positionsW[v0]) + b1 * XMLoadFloat3(&positionsW[v1]) + b2 * XMLoadFloat3(&positionsW[v2]);
+				XMVECTOR normalW = XMVector3Normalize(b0 * XMLoadFloat3(&normalsW[v0]) + b1 * XMLoadFloat3(&normalsW[v1]) + b2 * XMLoadFloat3(&normalsW[v2]));
+
+				// The diffuse term of ComputePointLight and ComputeSpotLight, the
+				// albedo left to the shader.
+				XMVECTOR sum = XMVectorZero();
+				for(const Light* light : reaching)
+				{
+					XMVECTOR lightPos = XMLoadFloat3(&light->Position);
+					XMVECTOR toLight = lightPos - posW;
+					float d = XMVectorGetX(XMVector3Length(toLight));
+					if(d <= ShadowBias || d > light->FalloffEnd)
+						continue;
+
+					XMVECTOR lightVec = toLight / d;
+					float ndotl = XMVectorGetX(XMVector3Dot(lightVec, normalW));
+					if(ndotl <= 0.0f)
+						continue;
+
+					float att = std::min(std::max((light->FalloffEnd - d) / (light->FalloffEnd - light->FalloffStart), 0.0f), 1.0f);
+					float spot = 1.0f;
+					if(light->SpotPower > 0.0f)
+						spot = powf(std::max(XMVectorGetX(XMVector3Dot(-lightVec, XMLoadFloat3(&light->Direction))), 0.0f), light->SpotPower);
+					if(att * spot <= 0.0f)
+						continue;
+
+					Ray ray;
+					XMVECTOR origin = posW + ShadowBias * normalW;
+					XMStoreFloat3(&ray.Origin, origin);
+					XMStoreFloat3(&ray.Direction, lightPos - origin);
+					ray.MaxT = 1.0f - ShadowBias / d;
+					if(occluders.Occluded(ray))
+						continue;
+
+					sum += XMLoadFloat3(&light->Strength) * (ndotl * att * spot);
+				}
+
+				XMStoreFloat3(&irradiance[texel], sum);
+				covered[texel] = 1;
+			}
+		}
+	}
+
+	// Grow the covered texels into the gutters.
+	std::vector<std::uint8_t> grown;
+	for(int pass = 0; pass < DilatePasses; ++pass)
+	{
+		grown = covered;
+		for(int y = 0; y < (int)rect.Height; ++y)
+		{
+			for(int x = 0; x < (int)rect.Width; ++x)
+			{
+				const std::size_t texel = (std::size_t)y * rect.Width + x;
+				if(covered[texel])
+					continue;
+
+				XMVECTOR sum = XMVectorZero();
+				int count = 0;
+				for(int dy = -1; dy <= 1; ++dy)
+				{
+					for(int dx = -1; dx <= 1; ++dx)
+					{
+						int nx = x + dx;
+						int ny = y + dy;
+						if(nx < 0 || ny < 0 || nx >= (int)rect.Width || ny >= (int)rect.Height)
+							continue;
+						const std::size_t neighbour = (std::size_t)ny * rect.Width + nx;
+						if(covered[neighbour])
+						{
+							sum += XMLoadFloat3(&irradiance[neighbour]);
+							++count;
+						}
+					}
+				}
+				if(count > 0)
+				{
+					XMStoreFloat3(&irradiance[texel], sum / (float)count);
+					grown[texel] = 1;
+				}
+			}
+		}
+		covered.swap(grown);
+	}
+
+	const std::size_t sliceStart = (std::size_t)rect.Slice * mAtlasSize * mAtlasSize;
+	for(std::uint32_t y = 0; y < rect.Height; ++y)
+	{
+		for(std::uint32_t x = 0; x < rect.Width; ++x)
+		{
+			const XMFLOAT3& e = irradiance[(std::size_t)y * rect.Width + x];
+			mTexels[sliceStart + (std::size_t)(rect.Y + y) * mAtlasSize + rect.X + x] = XMHALF4(e.x, e.y, e.z, 1.0f);
+		}
+	}
+}
+
+XMFLOAT4 LightmapBaker::ScaleOffset(std::uint32_t instance)const
+{
+	const Rect& rect = mInstances[instance].Region;
+	const float invSize = 1.0f / mAtlasSize;
+	return XMFLOAT4(rect.Width * invSize, rect.Height * invSize, rect.X * invSize, rect.Y * invSize);
+}
+
+std::uint32_t LightmapBaker::Slice(std::uint32_t instance)const
+{
+	return mInstances[instance].Region.Slice;
+}
+
+std::uint32_t LightmapBaker::AtlasSize()const
+{
+	return mAtlasSize;
+}
+
+std::uint32_t LightmapBaker::SliceCount()const
+{
+	return mSliceCount;
+}
+
+const std::vector<XMHALF4>& LightmapBaker::Texels()const
+{
+	return mTexels;
+}
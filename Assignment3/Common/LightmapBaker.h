@@ -0,0 +1,119 @@
+//***************************************************************************************
+// LightmapBaker.h
+//
+// Load-time lightmaps: the diffuse irradiance of lights that never move, baked on the
+// CPU into atlases of RGBA16F texels.
+//   -GenerateUVs() gives a mesh a second set of texture coordinates that covers the
+//    unit square without overlapping itself.  Its charts are the mesh's connected
+//    pieces, which share no vertices, so no vertex is split.  A chart is projected
+//    onto its plane if it is flat enough, or else keeps its own texture coordinates
+//    if those don't fold over, and is scaled to its area in the mesh's space.  The
+//    charts are packed onto shelves with a gutter between them.
+//   -AddInstance() sizes a placed mesh's rectangle of the atlases by its world area.
+//    Instances of one mesh share its UVs however they are scaled, so a non-uniform
+//    scale stretches the texels along the longer axis.
+//   -Bake() packs the rectangles onto shelves of the atlases, tallest first, and
+//    leaves out what doesn't fit.  It then rasterizes every instance's triangles into
+//    its rectangle, texel centres
+//    only, and sums the diffuse term of each light that reaches the texel, with a
+//    shadow ray against the occluders.  The texels no triangle covered take the
+//    average of their covered neighbours, twice over, so bilinear filtering across a
+//    chart's edge never reads black.  One job per instance; the instances' meshes
+//    have to live until it returns.
+//***************************************************************************************
+
+#pragma once
+
+#include "d3dUtil.h"
+#include <DirectXPackedVector.h>
+#include <vector>
+
+class JobSystem;
+class SceneBvh;
+
+class LightmapBaker
+{
+public:
+	// A submesh as its vertices and its indices, counted from its first vertex.
+	struct Mesh
+	{
+		const DirectX::XMFLOAT3* Positions = nullptr;
+		const DirectX::XMFLOAT3* Normals = nullptr;
+		const DirectX::XMFLOAT2* LightmapUVs = nullptr;
+		std::uint32_t VertexCount = 0;
+		const std::uint32_t* Indices = nullptr;
+		std::uint32_t IndexCount = 0;
+	};
+
+	// Fills uvs with a coordinate per vertex, or returns false if some chart can't be
+	// laid flat without folding over.  texCoords may be null.  padding is the gutter
+	// between charts as a fraction of the square root of the mesh's area.
+	static bool GenerateUVs(const DirectX::XMFLOAT3* positions, const DirectX::XMFLOAT2* texCoords,
+		std::uint32_t vertexCount, const std::uint32_t* indices, std::uint32_t indexCount, float padding,
+		DirectX::XMFLOAT2* uvs);
+
+	LightmapBaker(std::uint32_t atlasSize, std::uint32_t maxSlices, float texelsPerUnit,
+		std::uint32_t minRectSize, std::uint32_t maxRectSize);
+	LightmapBaker(const LightmapBaker& rhs) = delete;
+	LightmapBaker& operator=(const LightmapBaker& rhs) = delete;
+	~LightmapBaker() = default;
+
+	static const std::uint32_t NoSlice = 0xFFFFFFFF;
+
+	// Returns the instance's index for the queries below.
+	std::uint32_t AddInstance(const Mesh& mesh, const DirectX::XMFLOAT4X4& world);
+
+	// The point and spot lights to bake, point lights with a SpotPower of zero, and
+	// whatever casts their shadows.
+	void Bake(JobSystem& jobs, const std::vector<Light>& lights, const SceneBvh& occluders);
+
+	// After Bake(): the scale and offset that take an instance's lightmap UVs into its
+	// rectangle, and the rectangle's slice, or NoSlice if it found no room.
+	DirectX::XMFLOAT4 ScaleOffset(std::uint32_t instance)const;
+	std::uint32_t Slice(std::uint32_t instance)const;
+
+	std::uint32_t AtlasSize()const;
+	std::uint32_t SliceCount()const;
+
+	// SliceCount() slices of AtlasSize() rows, after Bake().
+	const std::vector<DirectX::PackedVector::XMHALF4>& Texels()const;
+
+private:
+	struct Rect
+	{
+		std::uint32_t X = 0;
+		std::uint32_t Y = 0;
+		std::uint32_t Width = 0;
+		std::uint32_t Height = 0;
+		std::uint32_t Slice = NoSlice;
+	};
+
+	struct Instance
+	{
+		Mesh Geometry;
+		DirectX::XMFLOAT4X4 World;
+		Rect Region;
+	};
+
+	bool AllocateRect(Rect& rect);
+
+	// Writes only the instance's own rectangle, so the jobs never share a texel.
+	void BakeInstance(const Instance& instance, const std::vector<Light>& lights, const SceneBvh& occluders);
+
+private:
+	std::uint32_t mAtlasSize = 0;
+	std::uint32_t mMaxSlices = 0;
+	float mTexelsPerUnit = 0.0f;
+	std::uint32_t mMinRectSize = 0;
+	std::uint32_t mMaxRectSize = 0;
+
+	// The shelf being filled: its top, its height and how far along it is, in the
+	// last of the slices.
+	std::uint32_t mShelfY = 0;
+	std::uint32_t mShelfHeight = 0;
+	std::uint32_t mShelfX = 0;
+	std::uint32_t mSliceCount = 0;
+
+	std::vector<Instance> mInstances;
+	std::vector<DirectX::PackedVector::XMHALF4> mTexels;
+};
@@ -33,6 +33,37 @@ float MathHelper::AngleFromXY(float x, float y)
 	return theta;
 }
 
+XMFLOAT2 MathHelper::OctahedralEncode(const XMFLOAT3& n)
+{
+	float l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+	float x = n.x / l1;
+	float y = n.y / l1;
+
+	if(n.z < 0.0f)
+	{
+		float foldedX = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		float foldedY = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+		x = foldedX;
+		y = foldedY;
+	}
+
+	return XMFLOAT2(x, y);
+}
+
+// The CPU's copy of OctahedralDecode in SurfaceShading.hlsl.
+XMFLOAT3 MathHelper::OctahedralDecode(const XMFLOAT2& e)
+{
+	XMFLOAT3 n(e.x, e.y, 1.0f - fabsf(e.x) - fabsf(e.y));
+
+	// Unfold the lower hemisphere.
+	float t = Clamp(-n.z, 0.0f, 1.0f);
+	n.x += n.x >= 0.0f ? -t : t;
+	n.y += n.y >= 0.0f ? -t : t;
+
+	XMStoreFloat3(&n, XMVector3Normalize(XMLoadFloat3(&n)));
+	return n;
+}
+
 XMVECTOR MathHelper::RandUnitVec3()
 {
 	XMVECTOR One  = XMVectorSet(1.0f, 1.0f, 1.0f, 1.0f);
@@ -89,6 +89,35 @@ public:
         return I;
     }
 
+	// Transposes src and writes it to dst with non-temporal stores, which go straight
+	// to write-combined memory such as a mapped upload heap without reading it into the
+	// cache.  dst must be 16-byte aligned; call StreamFence() before the GPU reads it.
+	static void StoreTransposedStream(DirectX::XMFLOAT4X4* dst, const DirectX::XMFLOAT4X4& src)
+	{
+		DirectX::XMMATRIX m = DirectX::XMMatrixTranspose(DirectX::XMLoadFloat4x4(&src));
+#if defined(_XM_SSE_INTRINSICS_)
+		float* out = reinterpret_cast<float*>(dst);
+		_mm_stream_ps(out + 0, m.r[0]);
+		_mm_stream_ps(out + 4, m.r[1]);
+		_mm_stream_ps(out + 8, m.r[2]);
+		_mm_stream_ps(out + 12, m.r[3]);
+#else
+		DirectX::XMStoreFloat4x4(dst, m);
+#endif
+	}
+
+	static void StreamFence()
+	{
+#if defined(_XM_SSE_INTRINSICS_)
+		_mm_sfence();
+#endif
+	}
+
+	// Maps a unit vector onto the [-1, 1]^2 octahedral square; the lower hemisphere
+	// is folded over the diagonals.  Decode in the shader with OctahedralDecode.
+	static DirectX::XMFLOAT2 OctahedralEncode(const DirectX::XMFLOAT3& n);
+	static DirectX::XMFLOAT3 OctahedralDecode(const DirectX::XMFLOAT2& e);
+
     static DirectX::XMVECTOR RandUnitVec3();
     static DirectX::XMVECTOR RandHemisphereUnitVec3(DirectX::XMVECTOR n);
 
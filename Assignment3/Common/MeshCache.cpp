@@ -0,0 +1,123 @@
+//***************************************************************************************
+// MeshCache.cpp
+//***************************************************************************************
+
+#include "MeshCache.h"
+#include <cstring>
+
+using namespace DirectX;
+
+namespace
+{
+	const char MeshMagic[4] = { 'M', 'E', 'S', 'H' };
+	const UINT MeshVersion = 2;
+
+	struct MeshHeader
+	{
+		char Magic[4];
+		UINT Version;
+		std::uint64_t Key;
+		UINT VertexStride;
+		UINT VertexCount;
+		UINT IndexCount;
+		UINT MeshletCount;
+		XMFLOAT3 BoundsCenter;
+		XMFLOAT3 BoundsExtents;
+	};
+}
+
+MeshCache::MeshCache(const std::wstring& directory) :
+	mDirectory(directory)
+{
+	CreateDirectoryW(mDirectory.c_str(), nullptr);
+}
+
+std::uint64_t MeshCache::Key(const std::string& description)
+{
+	return d3dUtil::HashBytes(description.data(), description.size());
+}
+
+bool MeshCache::Load(std::uint64_t key, Entry& entry)const
+{
+	std::ifstream fin(PathFor(key), std::ios::binary | std::ios::ate);
+	if(!fin)
+		return false;
+
+	const UINT64 fileSize = (UINT64)fin.tellg();
+	fin.seekg(0);
+
+	MeshHeader header;
+	if(!fin.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+		memcmp(header.Magic, MeshMagic, sizeof(MeshMagic)) != 0 ||
+		header.Version != MeshVersion || header.Key != key)
+	{
+		return false;
+	}
+
+	// Sized from the header, so a short or damaged file must not get to the resizes.
+	const UINT64 expectedSize = sizeof(header) + (UINT64)header.VertexStride * header.VertexCount +
+		(UINT64)header.IndexCount * sizeof(std::uint32_t) + (UINT64)header.MeshletCount * sizeof(Meshlet);
+	if(header.VertexStride == 0 || fileSize != expectedSize)
+		return false;
+
+	entry.VertexStride = header.VertexStride;
+	entry.VertexCount = header.VertexCount;
+	entry.Vertices.resize((size_t)header.VertexStride * header.VertexCount);
+	entry.Indices.resize(header.IndexCount);
+	entry.Meshlets.resize(header.MeshletCount);
+	entry.Bounds = BoundingBox(header.BoundsCenter, header.BoundsExtents);
+
+	fin.read(reinterpret_cast<char*>(entry.Vertices.data()), entry.Vertices.size());
+	fin.read(reinterpret_cast<char*>(entry.Indices.data()), entry.Indices.size() * sizeof(std::uint32_t));
+	fin.read(reinterpret_cast<char*>(entry.Meshlets.data()), entry.Meshlets.size() * sizeof(Meshlet));
+	if(fin.fail())
+		return false;
+
+	// The indices go to the GPU and the CPU BVH and lightmap passes as they are.
+	for(std::uint32_t index : entry.Indices)
+	{
+		if(index >= entry.VertexCount)
+			return false;
+	}
+
+	for(const Meshlet& meshlet : entry.Meshlets)
+	{
+		if((UINT64)meshlet.FirstIndex + meshlet.IndexCount > entry.Indices.size())
+			return false;
+	}
+
+	return true;
+}
+
+bool MeshCache::Store(std::uint64_t key, const Entry& entry)const
+{
+	assert(entry.Vertices.size() == (size_t)entry.VertexStride * entry.VertexCount);
+
+	MeshHeader header = {};
+	memcpy(header.Magic, MeshMagic, sizeof(MeshMagic));
+	header.Version = MeshVersion;
+	header.Key = key;
+	header.VertexStride = entry.VertexStride;
+	header.VertexCount = entry.VertexCount;
+	header.IndexCount = (UINT)entry.Indices.size();
+	header.MeshletCount = (UINT)entry.Meshlets.size();
+	header.BoundsCenter = entry.Bounds.Center;
+	header.BoundsExtents = entry.Bounds.Extents;
+
+	std::ofstream fout(PathFor(key), std::ios::binary);
+	if(!fout)
+		return false;
+
+	fout.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	fout.write(reinterpret_cast<const char*>(entry.Vertices.data()), entry.Vertices.size());
+	fout.write(reinterpret_cast<const char*>(entry.Indices.data()), entry.Indices.size() * sizeof(std::uint32_t));
+	fout.write(reinterpret_cast<const char*>(entry.Meshlets.data()), entry.Meshlets.size() * sizeof(Meshlet));
+	return fout.good();
+}
+
+std::wstring MeshCache::PathFor(std::uint64_t key)const
+{
+	wchar_t name[32];
+	swprintf_s(name, L"%016llx.mesh", (unsigned long long)key);
+	return mDirectory + L"\\" + name;
+}
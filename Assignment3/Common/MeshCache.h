@@ -0,0 +1,48 @@
+//***************************************************************************************
+// MeshCache.h
+//
+// On-disk cache of generated meshes in their final, GPU-ready form.
+//   -The key hashes a description of how the mesh was made: the generator and its
+//    parameters plus anything applied afterwards (optimization, vertex format).
+//    Change the description and the old entry is simply never asked for again.
+//   -An entry is the vertex bytes exactly as they go into the vertex buffer, the
+//    32-bit indices, the local bounds and the meshlets, one file per key in the
+//    cache directory.
+//   -Load() failing for any reason (missing, truncated, other version, an index or
+//    meshlet out of range) just means the caller regenerates and Store()s the mesh.
+//***************************************************************************************
+
+#pragma once
+
+#include "d3dUtil.h"
+#include "MeshletBuilder.h"
+
+class MeshCache
+{
+public:
+	struct Entry
+	{
+		UINT VertexStride = 0;
+		UINT VertexCount = 0;
+		std::vector<std::uint8_t> Vertices;
+		std::vector<std::uint32_t> Indices;
+		DirectX::BoundingBox Bounds;
+		std::vector<Meshlet> Meshlets;
+	};
+
+	// Creates the directory if needed.
+	explicit MeshCache(const std::wstring& directory);
+	MeshCache(const MeshCache& rhs) = delete;
+	MeshCache& operator=(const MeshCache& rhs) = delete;
+	~MeshCache() = default;
+
+	static std::uint64_t Key(const std::string& description);
+
+	bool Load(std::uint64_t key, Entry& entry)const;
+	bool Store(std::uint64_t key, const Entry& entry)const;
+
+private:
+	std::wstring PathFor(std::uint64_t key)const;
+
+	std::wstring mDirectory;
+};
@@ -0,0 +1,322 @@
+//***************************************************************************************
+// MeshOptimizer.cpp
+//***************************************************************************************
+
+#include "MeshOptimizer.h"
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+
+using namespace DirectX;
+
+namespace
+{
+	const std::uint32_t InvalidIndex = 0xFFFFFFFF;
+
+	// Forsyth's scoring: vertices of the last triangle get a fixed score so the next
+	// triangle doesn't simply reuse them, older cache entries fall off with a power
+	// curve, and vertices with few triangles left get a boost so they are finished
+	// off instead of being left as stragglers.
+	float VertexScore(int cachePosition, std::uint32_t trianglesLeft)
+	{
+		if(trianglesLeft == 0)
+			return -1.0f;
+
+		const int cacheSize = (int)MeshOptimizer::DefaultCacheSize;
+
+		float score = 0.0f;
+		if(cachePosition >= 0)
+		{
+			if(cachePosition < 3)
+				score = 0.75f;
+			else
+				score = powf(1.0f - (float)(cachePosition - 3) / (float)(cacheSize - 3), 1.5f);
+		}
+
+		return score + 2.0f / sqrtf((float)trianglesLeft);
+	}
+
+	// FIFO post-transform cache simulation.  A vertex is cached if it missed within
+	// the last cacheSize misses.
+	class FifoCache
+	{
+	public:
+		FifoCache(size_t vertexCount, std::uint32_t cacheSize) :
+			mInsertTime(vertexCount, 0),
+			mCacheSize(cacheSize),
+			mTime(cacheSize + 1)
+		{
+		}
+
+		// Returns true on a miss.
+		bool Access(std::uint32_t v)
+		{
+			if(mTime - mInsertTime[v] <= mCacheSize)
+				return false;
+
+			mInsertTime[v] = mTime++;
+			return true;
+		}
+
+	private:
+		std::vector<std::uint32_t> mInsertTime;
+		std::uint32_t mCacheSize;
+		std::uint32_t mTime;
+	};
+}
+
+void MeshOptimizer::OptimizeVertexCache(GeometryGenerator::MeshData& mesh)
+{
+	const std::vector<std::uint32_t>& indices = mesh.Indices32;
+	const size_t triangleCount = indices.size() / 3;
+	const size_t vertexCount = mesh.Vertices.size();
+	if(triangleCount == 0)
+		return;
+
+	// Triangles still to be emitted around each vertex, packed into one array.
+	std::vector<std::uint32_t> trianglesLeft(vertexCount, 0);
+	for(std::uint32_t v : indices)
+	{
+		assert(v < vertexCount);
+		++trianglesLeft[v];
+	}
+
+	std::vector<std::uint32_t> adjacencyStart(vertexCount + 1, 0);
+	for(size_t v = 0; v < vertexCount; ++v)
+		adjacencyStart[v + 1] = adjacencyStart[v] + trianglesLeft[v];
+
+	std::vector<std::uint32_t> adjacency(indices.size());
+	{
+		std::vector<std::uint32_t> cursor(adjacencyStart.begin(), adjacencyStart.end() - 1);
+		for(size_t i = 0; i < indices.size(); ++i)
+			adjacency[cursor[indices[i]]++] = (std::uint32_t)(i / 3);
+	}
+
+	std::vector<int> cachePosition(vertexCount, -1);
+	std::vector<float> vertexScore(vertexCount);
+	for(size_t v = 0; v < vertexCount; ++v)
+		vertexScore[v] = VertexScore(-1, trianglesLeft[v]);
+
+	std::vector<float> triangleScore(triangleCount);
+	std::vector<std::uint8_t> emitted(triangleCount, 0);
+	std::uint32_t bestTriangle = 0;
+	for(size_t t = 0; t < triangleCount; ++t)
+	{
+		triangleScore[t] = vertexScore[indices[t * 3 + 0]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+		if(triangleScore[t] > triangleScore[bestTriangle])
+			bestTriangle = (std::uint32_t)t;
+	}
+
+	std::vector<std::uint32_t> cache, newCache;
+	cache.reserve(DefaultCacheSize + 3);
+	newCache.reserve(DefaultCacheSize + 3);
+
+	std::vector<std::uint32_t> result;
+	result.reserve(indices.size());
+
+	size_t scanCursor = 0;
+	for(size_t emittedCount = 0; emittedCount < triangleCount; ++emittedCount)
+	{
+		// Nothing left next to the cache: carry on with the next unused triangle.
+		if(bestTriangle == InvalidIndex)
+		{
+			while(emitted[scanCursor])
+				++scanCursor;
+			bestTriangle = (std::uint32_t)scanCursor;
+		}
+
+		const std::uint32_t* tri = &indices[bestTriangle * 3];
+		result.insert(result.end(), tri, tri + 3);
+		emitted[bestTriangle] = 1;
+
+		// Take the triangle off its vertices' lists.
+		for(int corner = 0; corner < 3; ++corner)
+		{
+			std::uint32_t v = tri[corner];
+			std::uint32_t* first = &adjacency[adjacencyStart[v]];
+			std::uint32_t* last = first + trianglesLeft[v] - 1;
+			*std::find(first, last + 1, bestTriangle) = *last;
+			--trianglesLeft[v];
+		}
+
+		// The triangle's vertices move to the front of the LRU cache.
+		newCache.assign(tri, tri + 3);
+		for(std::uint32_t v : cache)
+		{
+			if(v != tri[0] && v != tri[1] && v != tri[2])
+				newCache.push_back(v);
+		}
+
+		for(size_t i = 0; i < newCache.size(); ++i)
+		{
+			std::uint32_t v = newCache[i];
+			cachePosition[v] = i < DefaultCacheSize ? (int)i : -1;
+			vertexScore[v] = VertexScore(cachePosition[v], trianglesLeft[v]);
+		}
+
+		// Only triangles around the touched vertices changed score.
+		bestTriangle = InvalidIndex;
+		float bestScore = -FLT_MAX;
+		for(std::uint32_t v : newCache)
+		{
+			for(std::uint32_t i = 0; i < trianglesLeft[v]; ++i)
+			{
+				std::uint32_t t = adjacency[adjacencyStart[v] + i];
+				triangleScore[t] = vertexScore[indices[t * 3 + 0]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+				if(triangleScore[t] > bestScore)
+				{
+					bestScore = triangleScore[t];
+					bestTriangle = t;
+				}
+			}
+		}
+
+		if(newCache.size() > DefaultCacheSize)
+			newCache.resize(DefaultCacheSize);
+		cache.swap(newCache);
+	}
+
+	mesh.Indices32.swap(result);
+}
+
+void MeshOptimizer::OptimizeOverdraw(GeometryGenerator::MeshData& mesh, float threshold)
+{
+	const std::vector<std::uint32_t>& indices = mesh.Indices32;
+	const size_t triangleCount = indices.size() / 3;
+	if(triangleCount < 2)
+		return;
+
+	// Split where a triangle misses on all three vertices, i.e. where the cache starts
+	// over anyway, as long as the cluster so far isn't worse than the whole mesh.
+	const float meshAcmr = AverageCacheMissRatio(indices);
+
+	std::vector<std::uint32_t> clusterStart(1, 0);
+	{
+		FifoCache fifo(mesh.Vertices.size(), DefaultCacheSize);
+		std::uint32_t clusterMisses = 0;
+		std::uint32_t clusterTriangles = 0;
+		for(size_t t = 0; t < triangleCount; ++t)
+		{
+			std::uint32_t misses = 0;
+			for(int corner = 0; corner < 3; ++corner)
+				misses += fifo.Access(indices[t * 3 + corner]) ? 1 : 0;
+
+			if(misses == 3 && clusterTriangles > 0 &&
+				(float)clusterMisses <= threshold * meshAcmr * (float)clusterTriangles)
+			{
+				clusterStart.push_back((std::uint32_t)t);
+				clusterMisses = 0;
+				clusterTriangles = 0;
+			}
+
+			clusterMisses += misses;
+			++clusterTriangles;
+		}
+	}
+
+	const size_t clusterCount = clusterStart.size();
+	if(clusterCount < 2)
+		return;
+	clusterStart.push_back((std::uint32_t)triangleCount);
+
+	// Area-weighted centroid and normal of each cluster and of the whole mesh.
+	std::vector<XMFLOAT3> clusterCentroid(clusterCount), clusterNormal(clusterCount);
+	XMVECTOR meshCentroid = XMVectorZero();
+	float meshArea = 0.0f;
+
+	for(size_t c = 0; c < clusterCount; ++c)
+	{
+		XMVECTOR centroid = XMVectorZero();
+		XMVECTOR normal = XMVectorZero();
+		float area = 0.0f;
+
+		for(std::uint32_t t = clusterStart[c]; t < clusterStart[c + 1]; ++t)
+		{
+			XMVECTOR p0 = XMLoadFloat3(&mesh.Vertices[indices[t * 3 + 0]].Position);
+			XMVECTOR p1 = XMLoadFloat3(&mesh.Vertices[indices[t * 3 + 1]].Position);
+			XMVECTOR p2 = XMLoadFloat3(&mesh.Vertices[indices[t * 3 + 2]].Position);
+
+			// Twice the area, pointing along the face normal.
+			XMVECTOR n = XMVector3Cross(p1 - p0, p2 - p0);
+			float a = XMVectorGetX(XMVector3Length(n));
+
+			centroid += (p0 + p1 + p2) * (a / 3.0f);
+			normal += n;
+			area += a;
+		}
+
+		meshCentroid += centroid;
+		meshArea += area;
+
+		XMStoreFloat3(&clusterCentroid[c], area > 0.0f ? centroid / area : centroid);
+		XMStoreFloat3(&clusterNormal[c], XMVector3Normalize(normal));
+	}
+
+	if(meshArea > 0.0f)
+		meshCentroid /= meshArea;
+
+	// Clusters facing away from the centre are on the outside and likely to cover the
+	// rest, so they go first.
+	std::vector<float> sortKey(clusterCount);
+	for(size_t c = 0; c < clusterCount; ++c)
+	{
+		XMVECTOR offset = XMLoadFloat3(&clusterCentroid[c]) - meshCentroid;
+		sortKey[c] = XMVectorGetX(XMVector3Dot(offset, XMLoadFloat3(&clusterNormal[c])));
+	}
+
+	std::vector<std::uint32_t> order(clusterCount);
+	for(size_t c = 0; c < clusterCount; ++c)
+		order[c] = (std::uint32_t)c;
+	std::stable_sort(order.begin(), order.end(),
+		[&sortKey](std::uint32_t a, std::uint32_t b) { return sortKey[a] > sortKey[b]; });
+
+	std::vector<std::uint32_t> result;
+	result.reserve(indices.size());
+	for(std::uint32_t c : order)
+		result.insert(result.end(), indices.begin() + clusterStart[c] * 3, indices.begin() + clusterStart[c + 1] * 3);
+
+	mesh.Indices32.swap(result);
+}
+
+void MeshOptimizer::OptimizeVertexFetch(GeometryGenerator::MeshData& mesh)
+{
+	std::vector<std::uint32_t> remap(mesh.Vertices.size(), InvalidIndex);
+	std::vector<GeometryGenerator::Vertex> vertices;
+	vertices.reserve(mesh.Vertices.size());
+
+	for(std::uint32_t& index : mesh.Indices32)
+	{
+		if(remap[index] == InvalidIndex)
+		{
+			remap[index] = (std::uint32_t)vertices.size();
+			vertices.push_back(mesh.Vertices[index]);
+		}
+
+		index = remap[index];
+	}
+
+	mesh.Vertices.swap(vertices);
+}
+
+void MeshOptimizer::Optimize(GeometryGenerator::MeshData& mesh)
+{
+	OptimizeVertexCache(mesh);
+	OptimizeOverdraw(mesh);
+	OptimizeVertexFetch(mesh);
+}
+
+float MeshOptimizer::AverageCacheMissRatio(const std::vector<std::uint32_t>& indices, std::uint32_t cacheSize)
+{
+	if(indices.size() < 3)
+		return 0.0f;
+
+	std::uint32_t vertexCount = *std::max_element(indices.begin(), indices.end()) + 1;
+	FifoCache fifo(vertexCount, cacheSize);
+
+	std::uint32_t misses = 0;
+	for(std::uint32_t v : indices)
+		misses += fifo.Access(v) ? 1 : 0;
+
+	return (float)misses / (float)(indices.size() / 3);
+}
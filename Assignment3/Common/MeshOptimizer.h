@@ -0,0 +1,35 @@
+//***************************************************************************************
+// MeshOptimizer.h
+//
+// Load-time reordering of GeometryGenerator meshes for the GPU's fixed-function
+// stages.  None of the passes change what is drawn, only the order.
+//   -OptimizeVertexCache() reorders triangles with Forsyth's linear-speed algorithm
+//    so that vertices are reused while still in the post-transform cache.
+//   -OptimizeOverdraw() cuts the cache-ordered triangles into clusters where the
+//    cache has just been refilled anyway and draws the outward-facing clusters
+//    first, so they occlude the rest.  threshold is how much worse than the input
+//    ACMR (cache misses per triangle) the result may get.
+//   -OptimizeVertexFetch() renumbers the vertices in first-use order, so the input
+//    assembler walks the vertex buffer front to back.  Unused vertices are dropped.
+//   -Optimize() runs all three in that order.  Run it before GetIndices16(), which
+//    caches its copy of the indices.
+//***************************************************************************************
+
+#pragma once
+
+#include "GeometryGenerator.h"
+
+class MeshOptimizer
+{
+public:
+	static const std::uint32_t DefaultCacheSize = 32;
+
+	static void OptimizeVertexCache(GeometryGenerator::MeshData& mesh);
+	static void OptimizeOverdraw(GeometryGenerator::MeshData& mesh, float threshold = 1.05f);
+	static void OptimizeVertexFetch(GeometryGenerator::MeshData& mesh);
+	static void Optimize(GeometryGenerator::MeshData& mesh);
+
+	// Cache misses per triangle for a FIFO cache of cacheSize entries.
+	static float AverageCacheMissRatio(const std::vector<std::uint32_t>& indices,
+		std::uint32_t cacheSize = DefaultCacheSize);
+};
@@ -0,0 +1,131 @@
+//***************************************************************************************
+// MeshletBuilder.cpp
+//***************************************************************************************
+
+#include "MeshletBuilder.h"
+#include "MathHelper.h"
+#include <cmath>
+
+using namespace DirectX;
+
+namespace
+{
+	const std::uint32_t NoMeshlet = 0xFFFFFFFF;
+
+	// Sphere around the box of the triangles' vertices, and the cone their face
+	// normals fit in.
+	void ComputeBounds(const GeometryGenerator::MeshData& mesh, Meshlet& meshlet)
+	{
+		const std::uint32_t* indices = mesh.Indices32.data() + meshlet.FirstIndex;
+
+		XMVECTOR lo = XMVectorReplicate(MathHelper::Infinity);
+		XMVECTOR hi = XMVectorReplicate(-MathHelper::Infinity);
+		for(UINT i = 0; i < meshlet.IndexCount; ++i)
+		{
+			XMVECTOR p = XMLoadFloat3(&mesh.Vertices[indices[i]].Position);
+			lo = XMVectorMin(lo, p);
+			hi = XMVectorMax(hi, p);
+		}
+
+		XMVECTOR center = 0.5f * (lo + hi);
+		float radius = 0.0f;
+		for(UINT i = 0; i < meshlet.IndexCount; ++i)
+		{
+			XMVECTOR p = XMLoadFloat3(&mesh.Vertices[indices[i]].Position);
+			radius = MathHelper::Max(radius, XMVectorGetX(XMVector3Length(p - center)));
+		}
+		XMStoreFloat3(&meshlet.Center, center);
+		meshlet.Radius = radius;
+
+		// Clockwise faces, so the cross product of the first two edges points out.
+		std::vector<XMVECTOR> normals;
+		normals.reserve(meshlet.IndexCount / 3);
+		XMVECTOR axis = XMVectorZero();
+		for(UINT i = 0; i + 2 < meshlet.IndexCount; i += 3)
+		{
+			XMVECTOR p0 = XMLoadFloat3(&mesh.Vertices[indices[i + 0]].Position);
+			XMVECTOR p1 = XMLoadFloat3(&mesh.Vertices[indices[i + 1]].Position);
+			XMVECTOR p2 = XMLoadFloat3(&mesh.Vertices[indices[i + 2]].Position);
+			XMVECTOR n = XMVector3Cross(p1 - p0, p2 - p0);
+
+			// Degenerate triangles aren't drawn, whichever way they face.
+			if(XMVectorGetX(XMVector3LengthSq(n)) <= 1e-12f)
+				continue;
+
+			n = XMVector3Normalize(n);
+			normals.push_back(n);
+			axis += n;
+		}
+
+		meshlet.ConeCutoff = 1.0f;
+		if(normals.empty() || XMVectorGetX(XMVector3LengthSq(axis)) <= 1e-12f)
+			return;
+
+		axis = XMVector3Normalize(axis);
+		XMStoreFloat3(&meshlet.ConeAxis, axis);
+
+		float minDot = 1.0f;
+		for(XMVECTOR n : normals)
+			minDot = MathHelper::Min(minDot, XMVectorGetX(XMVector3Dot(axis, n)));
+
+		// A cone of 90 degrees or more is seen from the front somewhere on every side.
+		if(minDot > 0.0f)
+			meshlet.ConeCutoff = sqrtf(1.0f - minDot * minDot);
+	}
+}
+
+std::vector<Meshlet> MeshletBuilder::Build(const GeometryGenerator::MeshData& mesh)
+{
+	std::vector<Meshlet> meshlets;
+
+	// The meshlet each vertex was last counted for.
+	std::vector<std::uint32_t> owner(mesh.Vertices.size(), NoMeshlet);
+
+	Meshlet current;
+	UINT vertexCount = 0;
+	auto finish = [&]()
+	{
+		if(current.IndexCount == 0)
+			return;
+
+		ComputeBounds(mesh, current);
+		meshlets.push_back(current);
+
+		Meshlet next;
+		next.FirstIndex = current.FirstIndex + current.IndexCount;
+		current = next;
+		vertexCount = 0;
+	};
+
+	const UINT indexCount = (UINT)mesh.Indices32.size();
+	for(UINT i = 0; i + 2 < indexCount; i += 3)
+	{
+		const std::uint32_t* tri = &mesh.Indices32[i];
+
+		// A degenerate triangle's repeated vertex counts twice here, which only
+		// ends the meshlet a little early.
+		UINT added = 0;
+		for(int k = 0; k < 3; ++k)
+		{
+			if(owner[tri[k]] != (std::uint32_t)meshlets.size())
+				++added;
+		}
+
+		if(vertexCount + added > MaxVertices || current.IndexCount / 3 == MaxTriangles)
+			finish();
+
+		const std::uint32_t id = (std::uint32_t)meshlets.size();
+		for(int k = 0; k < 3; ++k)
+		{
+			if(owner[tri[k]] != id)
+			{
+				owner[tri[k]] = id;
+				++vertexCount;
+			}
+		}
+		current.IndexCount += 3;
+	}
+
+	finish();
+	return meshlets;
+}
@@ -0,0 +1,48 @@
+//***************************************************************************************
+// MeshletBuilder.h
+//
+// Cuts a GeometryGenerator mesh into meshlets, small clusters of triangles that are
+// culled one by one on the GPU.
+//   -Build() scans the triangles in index order and starts a new meshlet whenever
+//    the next one would take the current one past MaxVertices distinct vertices or
+//    MaxTriangles triangles.  Run it after MeshOptimizer::Optimize(): the vertex
+//    cache order keeps neighbouring triangles together, so the triangles aren't
+//    reordered and a meshlet is just a range of the index list.
+//   -Each meshlet gets a bounding sphere and a normal cone around the average of
+//    its face normals.  Seen from an eye e, the meshlet is back facing if
+//        dot(Center - e, ConeAxis) >= ConeCutoff * length(Center - e) + Radius,
+//    the cone test for every point of the sphere at once.  Faces are clockwise
+//    from the front.
+//   -A meshlet whose faces spread over a half space or more has a ConeCutoff of 1
+//    and is never back facing.
+//***************************************************************************************
+
+#pragma once
+
+#include "GeometryGenerator.h"
+
+// Must match Cull.hlsl.
+struct Meshlet
+{
+	DirectX::XMFLOAT3 Center = { 0.0f, 0.0f, 0.0f };
+	float Radius = 0.0f;
+
+	// The direction the faces point on average, and the sine of the widest angle
+	// between it and a face normal.  Looking along a direction within
+	// acos(ConeCutoff) of the axis only back faces are seen.
+	DirectX::XMFLOAT3 ConeAxis = { 0.0f, 0.0f, 1.0f };
+	float ConeCutoff = 1.0f;
+
+	// Range of the mesh's index list.
+	UINT FirstIndex = 0;
+	UINT IndexCount = 0;
+};
+
+class MeshletBuilder
+{
+public:
+	static const UINT MaxVertices = 64;
+	static const UINT MaxTriangles = 124;
+
+	static std::vector<Meshlet> Build(const GeometryGenerator::MeshData& mesh);
+};
@@ -0,0 +1,198 @@
+//***************************************************************************************
+// MipGenerator.cpp
+//***************************************************************************************
+
+#include "MipGenerator.h"
+
+namespace
+{
+	const DXGI_FORMAT FullChainFormat = DXGI_FORMAT_R8G8B8A8_UNORM;
+	const UINT MaxMipsPerDispatch = 4;
+}
+
+MipGenerator::MipGenerator(ID3D12Device* device, DescriptorAllocator& heap) :
+	mDevice(device),
+	mHeap(heap)
+{
+	mNullSrvIndex = mHeap.Allocate();
+	mNullUavIndex = mHeap.Allocate();
+
+	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+	srvDesc.Format = FullChainFormat;
+	srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2DARRAY;
+	srvDesc.Texture2DArray.MipLevels = 1;
+	srvDesc.Texture2DArray.ArraySize = 1;
+	mDevice->CreateShaderResourceView(nullptr, &srvDesc, mHeap.CpuHandle(mNullSrvIndex));
+
+	D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
+	uavDesc.Format = FullChainFormat;
+	uavDesc.ViewDimension = D3D12_UAV_DIMENSION_TEXTURE2DARRAY;
+	uavDesc.Texture2DArray.ArraySize = 1;
+	mDevice->CreateUnorderedAccessView(nullptr, nullptr, &uavDesc, mHeap.CpuHandle(mNullUavIndex));
+}
+
+bool MipGenerator::Supported(DXGI_FORMAT format)const
+{
+	D3D12_FEATURE_DATA_FORMAT_SUPPORT support = { format };
+	if(FAILED(mDevice->CheckFeatureSupport(D3D12_FEATURE_FORMAT_SUPPORT, &support, sizeof(support))))
+		return false;
+
+	const D3D12_FORMAT_SUPPORT2 needed = D3D12_FORMAT_SUPPORT2_UAV_TYPED_LOAD | D3D12_FORMAT_SUPPORT2_UAV_TYPED_STORE;
+	return (support.Support2 & needed) == needed;
+}
+
+D3D12_RESOURCE_DESC MipGenerator::FullChainDesc(const D3D12_RESOURCE_DESC& source)
+{
+	// 0 asks for the full chain.
+	return CD3DX12_RESOURCE_DESC::Tex2D(FullChainFormat, source.Width, source.Height,
+		source.DepthOrArraySize, 0, 1, 0, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
+}
+
+void MipGenerator::Generate(ID3D12GraphicsCommandList* cmdList, ResourceStateTracker& states,
+	ID3D12Resource* texture, bool gammaEncoded, UINT64 retireFence)
+{
+	states.Transition(texture, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+	states.FlushBarriers(cmdList);
+
+	Dispatch(cmdList, states, texture, 0, gammaEncoded, retireFence);
+
+	states.Transition(texture, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+	states.FlushBarriers(cmdList);
+}
+
+void MipGenerator::GenerateFrom(ID3D12GraphicsCommandList* cmdList, ResourceStateTracker& states,
+	ID3D12Resource* source, ID3D12Resource* dest, bool gammaEncoded, UINT64 retireFence)
+{
+	D3D12_RESOURCE_DESC sourceDesc = source->GetDesc();
+	D3D12_RESOURCE_DESC destDesc = dest->GetDesc();
+	assert(sourceDesc.Width == destDesc.Width && sourceDesc.Height == destDesc.Height &&
+		sourceDesc.DepthOrArraySize == destDesc.DepthOrArraySize);
+
+	states.Transition(dest, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+	states.FlushBarriers(cmdList);
+
+	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+	srvDesc.Format = sourceDesc.Format;
+	srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2DARRAY;
+	srvDesc.Texture2DArray.MipLevels = 1;
+	srvDesc.Texture2DArray.ArraySize = sourceDesc.DepthOrArraySize;
+	UINT srvIndex = mHeap.Allocate();
+	mDevice->CreateShaderResourceView(source, &srvDesc, mHeap.CpuHandle(srvIndex));
+
+	// Mip 0 is a copy, so the first dispatch writes mip 0 and as many below it as
+	// halve exactly.
+	const UINT width = (UINT)destDesc.Width;
+	const UINT height = destDesc.Height;
+	Constants constants = {};
+	constants.SrcWidth = width;
+	constants.SrcHeight = height;
+	constants.NumMips = MipsPerDispatch(width, height, destDesc.MipLevels);
+	constants.GammaEncoded = gammaEncoded;
+	constants.FromSource = 1;
+
+	std::vector<UINT> uavIndices;
+	for(UINT i = 0; i < constants.NumMips; ++i)
+		uavIndices.push_back(CreateMipUav(dest, i));
+
+	cmdList->SetComputeRoot32BitConstants(0, sizeof(Constants) / 4, &constants, 0);
+	cmdList->SetComputeRootDescriptorTable(1, mHeap.GpuHandle(srvIndex));
+	cmdList->SetComputeRootDescriptorTable(2, mHeap.GpuHandle(mNullUavIndex));
+	for(UINT i = 0; i < MaxMipsPerDispatch; ++i)
+		cmdList->SetComputeRootDescriptorTable(3 + i, mHeap.GpuHandle(i < constants.NumMips ? uavIndices[i] : mNullUavIndex));
+
+	cmdList->Dispatch((width + 7) / 8, (height + 7) / 8, destDesc.DepthOrArraySize);
+
+	mHeap.Free(srvIndex, retireFence);
+	for(UINT index : uavIndices)
+		mHeap.Free(index, retireFence);
+
+	states.UavBarrier(dest);
+	states.FlushBarriers(cmdList);
+
+	Dispatch(cmdList, states, dest, constants.NumMips - 1, gammaEncoded, retireFence);
+
+	states.Transition(dest, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+	states.FlushBarriers(cmdList);
+}
+
+void MipGenerator::Dispatch(ID3D12GraphicsCommandList* cmdList, ResourceStateTracker& states,
+	ID3D12Resource* texture, UINT topMip, bool gammaEncoded, UINT64 retireFence)
+{
+	D3D12_RESOURCE_DESC desc = texture->GetDesc();
+	assert(desc.Flags & D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
+
+	cmdList->SetComputeRootDescriptorTable(1, mHeap.GpuHandle(mNullSrvIndex));
+
+	while(topMip + 1 < desc.MipLevels)
+	{
+		UINT srcWidth = MathHelper::Max(1u, (UINT)desc.Width >> topMip);
+		UINT srcHeight = MathHelper::Max(1u, desc.Height >> topMip);
+		UINT dstWidth = MathHelper::Max(1u, srcWidth / 2);
+		UINT dstHeight = MathHelper::Max(1u, srcHeight / 2);
+
+		Constants constants = {};
+		constants.SrcWidth = srcWidth;
+		constants.SrcHeight = srcHeight;
+		constants.NumMips = MipsPerDispatch(dstWidth, dstHeight, desc.MipLevels - topMip - 1);
+		constants.SrcOdd = (srcWidth > 1 && (srcWidth & 1) ? 1 : 0) | (srcHeight > 1 && (srcHeight & 1) ? 2 : 0);
+		constants.GammaEncoded = gammaEncoded;
+		constants.FromSource = 0;
+
+		UINT srcUav = CreateMipUav(texture, topMip);
+		UINT dstUavs[MaxMipsPerDispatch];
+		for(UINT i = 0; i < constants.NumMips; ++i)
+			dstUavs[i] = CreateMipUav(texture, topMip + 1 + i);
+
+		cmdList->SetComputeRoot32BitConstants(0, sizeof(Constants) / 4, &constants, 0);
+		cmdList->SetComputeRootDescriptorTable(2, mHeap.GpuHandle(srcUav));
+		for(UINT i = 0; i < MaxMipsPerDispatch; ++i)
+			cmdList->SetComputeRootDescriptorTable(3 + i, mHeap.GpuHandle(i < constants.NumMips ? dstUavs[i] : mNullUavIndex));
+
+		// One thread per texel of the first mip written.
+		cmdList->Dispatch((dstWidth + 7) / 8, (dstHeight + 7) / 8, desc.DepthOrArraySize);
+
+		mHeap.Free(srcUav, retireFence);
+		for(UINT i = 0; i < constants.NumMips; ++i)
+			mHeap.Free(dstUavs[i], retireFence);
+
+		// The next dispatch reads the last mip this one wrote.
+		states.UavBarrier(texture);
+		states.FlushBarriers(cmdList);
+
+		topMip += constants.NumMips;
+	}
+}
+
+UINT MipGenerator::MipsPerDispatch(UINT width, UINT height, UINT mipsLeft)
+{
+	// The groupshared steps average 2x2 texels of the mip before, so each mip after
+	// the first needs both sizes of that one even.  Once a side is down to 1 the
+	// rest get a dispatch each.
+	UINT count = 1;
+	while(count < MaxMipsPerDispatch && count < mipsLeft)
+	{
+		UINT w = width >> (count - 1);
+		UINT h = height >> (count - 1);
+		if((w & 1) || (h & 1))
+			break;
+		++count;
+	}
+	return count;
+}
+
+UINT MipGenerator::CreateMipUav(ID3D12Resource* texture, UINT mip)
+{
+	D3D12_RESOURCE_DESC desc = texture->GetDesc();
+
+	D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
+	uavDesc.Format = desc.Format;
+	uavDesc.ViewDimension = D3D12_UAV_DIMENSION_TEXTURE2DARRAY;
+	uavDesc.Texture2DArray.MipSlice = mip;
+	uavDesc.Texture2DArray.ArraySize = desc.DepthOrArraySize;
+
+	UINT index = mHeap.Allocate();
+	mDevice->CreateUnorderedAccessView(texture, nullptr, &uavDesc, mHeap.CpuHandle(index));
+	return index;
+}
@@ -0,0 +1,79 @@
+//***************************************************************************************
+// MipGenerator.h
+//
+// Fills a texture's mip chain on the GPU with a compute shader (GenerateMips.hlsl),
+// up to four mips per dispatch.
+//   -Generate() works in place on a texture created with ALLOW_UNORDERED_ACCESS, from
+//    its mip 0 down, every array slice at once.  Its format has to take typed UAV
+//    loads and stores; Supported() says whether it does on this device.
+//   -Loaded textures usually can't be written that way (block compressed, no UAV
+//    flag), and their mip count is fixed when they are created.  GenerateFrom()
+//    copies mip 0 of one into a FullChainDesc() texture and generates the rest.
+//   -For a render graph output, declare the pass as writing the texture in
+//    UNORDERED_ACCESS and call Generate() from its execute function.
+//   -Each call takes its views from a shader-visible DescriptorAllocator and frees
+//    them at retireFence, the fence value of the frame being recorded.
+//***************************************************************************************
+
+#pragma once
+
+#include "d3dUtil.h"
+#include "DescriptorAllocator.h"
+#include "ResourceStateTracker.h"
+
+class MipGenerator
+{
+public:
+	// Root parameters the caller's root signature has to provide, in this order:
+	// Constants as 32-bit constants (b0), a one-descriptor SRV table for the texture
+	// copied from (t0), and one-descriptor UAV tables for the mip read (u0) and each
+	// of the four mips written (u1-u4).
+	struct Constants
+	{
+		UINT SrcWidth;
+		UINT SrcHeight;
+		UINT NumMips;
+		UINT SrcOdd;
+		UINT GammaEncoded;
+		UINT FromSource;
+	};
+
+	MipGenerator(ID3D12Device* device, DescriptorAllocator& heap);
+	MipGenerator(const MipGenerator& rhs) = delete;
+	MipGenerator& operator=(const MipGenerator& rhs) = delete;
+	~MipGenerator() = default;
+
+	bool Supported(DXGI_FORMAT format)const;
+
+	// The size and slices of source with every mip, in a format Generate() writes.
+	static D3D12_RESOURCE_DESC FullChainDesc(const D3D12_RESOURCE_DESC& source);
+
+	// Both record into a direct list that already has the mip PSO, root signature
+	// and descriptor heap set, and leave the texture written in a shader resource
+	// state.  gammaEncoded colour is filtered in linear space.
+	void Generate(ID3D12GraphicsCommandList* cmdList, ResourceStateTracker& states,
+		ID3D12Resource* texture, bool gammaEncoded, UINT64 retireFence);
+
+	// source has to be in, or promotable from COMMON to, NON_PIXEL_SHADER_RESOURCE;
+	// it isn't transitioned.  dest is tracked in states.
+	void GenerateFrom(ID3D12GraphicsCommandList* cmdList, ResourceStateTracker& states,
+		ID3D12Resource* source, ID3D12Resource* dest, bool gammaEncoded, UINT64 retireFence);
+
+private:
+	// Dispatches from topMip of texture, already in UNORDERED_ACCESS, to its last mip.
+	void Dispatch(ID3D12GraphicsCommandList* cmdList, ResourceStateTracker& states,
+		ID3D12Resource* texture, UINT topMip, bool gammaEncoded, UINT64 retireFence);
+
+	// How many mips from the one of the given size halve exactly, up to four.
+	static UINT MipsPerDispatch(UINT width, UINT height, UINT mipsLeft);
+
+	UINT CreateMipUav(ID3D12Resource* texture, UINT mip);
+
+private:
+	ID3D12Device* mDevice = nullptr;
+	DescriptorAllocator& mHeap;
+
+	// Bound in place of the tables a dispatch doesn't use.
+	UINT mNullSrvIndex = 0;
+	UINT mNullUavIndex = 0;
+};
@@ -0,0 +1,286 @@
+//***************************************************************************************
+// PipelineCache.cpp
+//***************************************************************************************
+
+#include "PipelineCache.h"
+#include <cstring>
+#include <iterator>
+
+using Microsoft::WRL::ComPtr;
+
+namespace
+{
+	// The private data TagRootSignature() leaves on a root signature.
+	const GUID RootSignatureHashGuid = { 0x6c1f3a52, 0x9e4b, 0x4d17, { 0xa2, 0x3c, 0x5f, 0x08, 0xb9, 0x7e, 0x41, 0xd6 } };
+
+	template<typename T>
+	std::uint64_t HashValue(const T& value, std::uint64_t seed)
+	{
+		return d3dUtil::HashBytes(&value, sizeof(T), seed);
+	}
+
+	std::uint64_t HashShader(const D3D12_SHADER_BYTECODE& shader, std::uint64_t seed)
+	{
+		seed = HashValue(shader.BytecodeLength, seed);
+		return d3dUtil::HashBytes(shader.pShaderBytecode, shader.BytecodeLength, seed);
+	}
+
+	std::uint64_t HashRootSignature(ID3D12RootSignature* rootSignature, std::uint64_t seed)
+	{
+		std::uint64_t rootHash = 0;
+		UINT size = sizeof(rootHash);
+		if(rootSignature != nullptr && FAILED(rootSignature->GetPrivateData(RootSignatureHashGuid, &size, &rootHash)))
+		{
+			// Untagged, so a change to it would leave a stale entry behind.
+			assert(false && "root signature not tagged with PipelineCache::TagRootSignature");
+		}
+		return HashValue(rootHash, seed);
+	}
+
+	// Field by field: the descriptions hold pointers, and some have padding.
+	std::uint64_t HashGraphicsDesc(const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc)
+	{
+		std::uint64_t hash = HashRootSignature(desc.pRootSignature, d3dUtil::HashBytes(nullptr, 0));
+		hash = HashShader(desc.VS, hash);
+		hash = HashShader(desc.PS, hash);
+		hash = HashShader(desc.DS, hash);
+		hash = HashShader(desc.HS, hash);
+		hash = HashShader(desc.GS, hash);
+
+		hash = HashValue(desc.BlendState.AlphaToCoverageEnable, hash);
+		hash = HashValue(desc.BlendState.IndependentBlendEnable, hash);
+		for(const D3D12_RENDER_TARGET_BLEND_DESC& blend : desc.BlendState.RenderTarget)
+		{
+			hash = HashValue(blend.BlendEnable, hash);
+			hash = HashValue(blend.LogicOpEnable, hash);
+			hash = HashValue(blend.SrcBlend, hash);
+			hash = HashValue(blend.DestBlend, hash);
+			hash = HashValue(blend.BlendOp, hash);
+			hash = HashValue(blend.SrcBlendAlpha, hash);
+			hash = HashValue(blend.DestBlendAlpha, hash);
+			hash = HashValue(blend.BlendOpAlpha, hash);
+			hash = HashValue(blend.LogicOp, hash);
+			hash = HashValue(blend.RenderTargetWriteMask, hash);
+		}
+
+		hash = HashValue(desc.SampleMask, hash);
+		hash = HashValue(desc.RasterizerState, hash);
+
+		const D3D12_DEPTH_STENCIL_DESC& depth = desc.DepthStencilState;
+		hash = HashValue(depth.DepthEnable, hash);
+		hash = HashValue(depth.DepthWriteMask, hash);
+		hash = HashValue(depth.DepthFunc, hash);
+		hash = HashValue(depth.StencilEnable, hash);
+		hash = HashValue(depth.StencilReadMask, hash);
+		hash = HashValue(depth.StencilWriteMask, hash);
+		hash = HashValue(depth.FrontFace, hash);
+		hash = HashValue(depth.BackFace, hash);
+
+		for(UINT i = 0; i < desc.InputLayout.NumElements; ++i)
+		{
+			const D3D12_INPUT_ELEMENT_DESC& element = desc.InputLayout.pInputElementDescs[i];
+			hash = d3dUtil::HashBytes(element.SemanticName, strlen(element.SemanticName) + 1, hash);
+			hash = HashValue(element.SemanticIndex, hash);
+			hash = HashValue(element.Format, hash);
+			hash = HashValue(element.InputSlot, hash);
+			hash = HashValue(element.AlignedByteOffset, hash);
+			hash = HashValue(element.InputSlotClass, hash);
+			hash = HashValue(element.InstanceDataStepRate, hash);
+		}
+
+		hash = HashValue(desc.IBStripCutValue, hash);
+		hash = HashValue(desc.PrimitiveTopologyType, hash);
+		hash = HashValue(desc.NumRenderTargets, hash);
+		hash = HashValue(desc.RTVFormats, hash);
+		hash = HashValue(desc.DSVFormat, hash);
+		hash = HashValue(desc.SampleDesc, hash);
+		hash = HashValue(desc.NodeMask, hash);
+		return HashValue(desc.Flags, hash);
+	}
+
+	std::uint64_t HashComputeDesc(const D3D12_COMPUTE_PIPELINE_STATE_DESC& desc)
+	{
+		std::uint64_t hash = HashRootSignature(desc.pRootSignature, d3dUtil::HashBytes(nullptr, 0));
+		hash = HashShader(desc.CS, hash);
+		hash = HashValue(desc.NodeMask, hash);
+		return HashValue(desc.Flags, hash);
+	}
+}
+
+PipelineCache::PipelineCache(ID3D12Device* device, ThreadPool& pool, const std::wstring& filename) :
+	mDevice(device),
+	mPool(pool),
+	mFilename(filename)
+{
+	if(FAILED(device->QueryInterface(IID_PPV_ARGS(mDevice1.GetAddressOf()))))
+		return;
+
+	std::ifstream fin(filename, std::ios::binary);
+	mLibraryData.assign(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+
+	HRESULT hr = E_FAIL;
+	if(!mLibraryData.empty())
+		hr = mDevice1->CreatePipelineLibrary(mLibraryData.data(), mLibraryData.size(), IID_PPV_ARGS(mLibrary.GetAddressOf()));
+
+	if(FAILED(hr))
+	{
+		// Missing, corrupt or from another driver: start an empty library.  Some
+		// drivers and tools do not support pipeline libraries at all.
+		mLibraryData.clear();
+		if(FAILED(mDevice1->CreatePipelineLibrary(nullptr, 0, IID_PPV_ARGS(mLibrary.ReleaseAndGetAddressOf()))))
+			mLibrary = nullptr;
+	}
+}
+
+PipelineCache::~PipelineCache()
+{
+	// The queued tasks refer to this object.
+	WaitForAll();
+}
+
+void PipelineCache::TagRootSignature(ID3D12RootSignature* rootSignature, ID3DBlob* serialized)
+{
+	const std::uint64_t rootHash = d3dUtil::HashBytes(serialized->GetBufferPointer(), serialized->GetBufferSize());
+	ThrowIfFailed(rootSignature->SetPrivateData(RootSignatureHashGuid, sizeof(rootHash), &rootHash));
+}
+
+PipelineCache::Handle PipelineCache::CreateGraphics(const std::string& name, const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc)
+{
+	Slot* slot = &AddSlot(name, HashGraphicsDesc(desc));
+
+	mPool.Submit([this, slot, desc]()
+	{
+		HRESULT hr = E_INVALIDARG;
+		if(mLibrary)
+			hr = mLibrary->LoadGraphicsPipeline(slot->LibraryName.c_str(), &desc, IID_PPV_ARGS(slot->Pipeline.GetAddressOf()));
+
+		bool loaded = SUCCEEDED(hr);
+		if(!loaded)
+		{
+			hr = mDevice->CreateGraphicsPipelineState(&desc, IID_PPV_ARGS(slot->Pipeline.ReleaseAndGetAddressOf()));
+			if(SUCCEEDED(hr))
+				Store(*slot);
+		}
+
+		Finish(*slot, hr, loaded);
+	});
+
+	return (Handle)(mSlots.size() - 1);
+}
+
+PipelineCache::Handle PipelineCache::CreateCompute(const std::string& name, const D3D12_COMPUTE_PIPELINE_STATE_DESC& desc)
+{
+	Slot* slot = &AddSlot(name, HashComputeDesc(desc));
+
+	mPool.Submit([this, slot, desc]()
+	{
+		HRESULT hr = E_INVALIDARG;
+		if(mLibrary)
+			hr = mLibrary->LoadComputePipeline(slot->LibraryName.c_str(), &desc, IID_PPV_ARGS(slot->Pipeline.GetAddressOf()));
+
+		bool loaded = SUCCEEDED(hr);
+		if(!loaded)
+		{
+			hr = mDevice->CreateComputePipelineState(&desc, IID_PPV_ARGS(slot->Pipeline.ReleaseAndGetAddressOf()));
+			if(SUCCEEDED(hr))
+				Store(*slot);
+		}
+
+		Finish(*slot, hr, loaded);
+	});
+
+	return (Handle)(mSlots.size() - 1);
+}
+
+ID3D12PipelineState* PipelineCache::Get(Handle handle)
+{
+	assert(handle < mSlots.size());
+	Slot& slot = *mSlots[handle];
+
+	if(!slot.Ready.load(std::memory_order_acquire))
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		mSlotReady.wait(lock, [&slot]() { return slot.Ready.load(); });
+	}
+
+	ThrowIfFailed(slot.Result);
+	return slot.Pipeline.Get();
+}
+
+bool PipelineCache::Ready(Handle handle)const
+{
+	assert(handle < mSlots.size());
+	return mSlots[handle]->Ready.load(std::memory_order_acquire);
+}
+
+void PipelineCache::Flush()
+{
+	WaitForAll();
+
+	if(!mLibrary || !mLibraryChanged)
+		return;
+
+	std::vector<std::uint8_t> data(mLibrary->GetSerializedSize());
+	ThrowIfFailed(mLibrary->Serialize(data.data(), data.size()));
+
+	size_t slash = mFilename.find_last_of(L"\\/");
+	if(slash != std::wstring::npos)
+		CreateDirectoryW(mFilename.substr(0, slash).c_str(), nullptr);
+
+	// Only a cache, so a failed write just means compiling again next time.
+	std::ofstream fout(mFilename, std::ios::binary);
+	fout.write(reinterpret_cast<const char*>(data.data()), data.size());
+
+	mLibraryChanged = false;
+}
+
+UINT PipelineCache::LoadedCount()const
+{
+	return mLoaded;
+}
+
+PipelineCache::Slot& PipelineCache::AddSlot(const std::string& name, std::uint64_t stateHash)
+{
+	wchar_t hashText[32];
+	swprintf_s(hashText, L"-%016llx", (unsigned long long)stateHash);
+
+	auto slot = std::make_unique<Slot>();
+	slot->LibraryName = AnsiToWString(name) + hashText;
+	mSlots.push_back(std::move(slot));
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	++mPending;
+
+	return *mSlots.back();
+}
+
+void PipelineCache::Finish(Slot& slot, HRESULT result, bool loaded)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	slot.Result = result;
+	slot.Ready.store(true, std::memory_order_release);
+
+	--mPending;
+	if(loaded)
+		++mLoaded;
+
+	mSlotReady.notify_all();
+}
+
+void PipelineCache::Store(Slot& slot)
+{
+	// The library synchronizes stores internally; a failure only means the
+	// pipeline is compiled again next run.
+	if(SUCCEEDED(mLibrary ? mLibrary->StorePipeline(slot.LibraryName.c_str(), slot.Pipeline.Get()) : E_FAIL))
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mLibraryChanged = true;
+	}
+}
+
+void PipelineCache::WaitForAll()
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	mSlotReady.wait(lock, [this]() { return mPending == 0; });
+}
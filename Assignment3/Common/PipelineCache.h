@@ -0,0 +1,88 @@
+//***************************************************************************************
+// PipelineCache.h
+//
+// Pipeline state objects created on a ThreadPool and kept in an on-disk
+// ID3D12PipelineLibrary between runs.
+//   -CreateGraphics()/CreateCompute() queue the creation and return a handle right
+//    away.  A pipeline already in the library is loaded instead of compiled.
+//   -Get() returns the pipeline, waiting for it only if it is still being created,
+//    so after startup a lookup is an index and an atomic load.  Ready() polls instead,
+//    for pipelines replaced while the frame loop keeps drawing with the old ones.
+//   -Each pipeline is stored under its name plus a hash of its shaders, fixed state
+//    and root signature, so an edited shader is compiled again rather than matched to
+//    the old entry, which stays in the file unused until the file is deleted.  A root
+//    signature only hashes if TagRootSignature() was given its serialized form.  A library
+//    file written by another driver or adapter is ignored and rebuilt.
+//   -Flush() waits for everything and rewrites the file if anything was added.
+//    Without ID3D12Device1 the pipelines are still created in the background, just
+//    not persisted.
+//***************************************************************************************
+
+#pragma once
+
+#include "d3dUtil.h"
+#include "ThreadPool.h"
+#include <atomic>
+
+class PipelineCache
+{
+public:
+	typedef std::uint32_t Handle;
+
+	PipelineCache(ID3D12Device* device, ThreadPool& pool, const std::wstring& filename);
+	PipelineCache(const PipelineCache& rhs) = delete;
+	PipelineCache& operator=(const PipelineCache& rhs) = delete;
+	~PipelineCache();
+
+	// Keeps the hash of the serialized root signature with the object, for the names
+	// of the pipelines created with it.  Call it right after CreateRootSignature().
+	static void TagRootSignature(ID3D12RootSignature* rootSignature, ID3DBlob* serialized);
+
+	// The description is copied, but the shaders, input layout and root signature it
+	// points to must stay alive until the pipeline is ready.
+	Handle CreateGraphics(const std::string& name, const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc);
+	Handle CreateCompute(const std::string& name, const D3D12_COMPUTE_PIPELINE_STATE_DESC& desc);
+
+	// Throws DxException if the pipeline failed to create.
+	ID3D12PipelineState* Get(Handle handle);
+
+	// True once Get() would return without waiting, even if only to throw.
+	bool Ready(Handle handle)const;
+
+	void Flush();
+
+	// Pipelines loaded from the library rather than compiled.
+	UINT LoadedCount()const;
+
+private:
+	struct Slot
+	{
+		std::wstring LibraryName;
+		Microsoft::WRL::ComPtr<ID3D12PipelineState> Pipeline;
+		HRESULT Result = S_OK;
+		std::atomic<bool> Ready{ false };
+	};
+
+	Slot& AddSlot(const std::string& name, std::uint64_t stateHash);
+	void Finish(Slot& slot, HRESULT result, bool loaded);
+	void Store(Slot& slot);
+	void WaitForAll();
+
+private:
+	Microsoft::WRL::ComPtr<ID3D12Device> mDevice;
+	Microsoft::WRL::ComPtr<ID3D12Device1> mDevice1;
+	Microsoft::WRL::ComPtr<ID3D12PipelineLibrary> mLibrary;
+	ThreadPool& mPool;
+	std::wstring mFilename;
+
+	// The library reads its pipelines out of this for as long as it lives.
+	std::vector<std::uint8_t> mLibraryData;
+
+	std::vector<std::unique_ptr<Slot>> mSlots;
+
+	std::mutex mMutex;
+	std::condition_variable mSlotReady;
+	UINT mPending = 0;
+	UINT mLoaded = 0;
+	bool mLibraryChanged = false;
+};
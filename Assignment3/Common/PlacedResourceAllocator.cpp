@@ -0,0 +1,244 @@
+//***************************************************************************************
+// PlacedResourceAllocator.cpp
+//***************************************************************************************
+
+#include "PlacedResourceAllocator.h"
+
+using Microsoft::WRL::ComPtr;
+
+static UINT64 AlignUp(UINT64 value, UINT64 alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+PlacedResourceAllocator::PlacedResourceAllocator(ID3D12Device* device, UINT64 heapByteSize) :
+	mDevice(device)
+{
+	// Round the heap up to a size class so the largest class fills a heap exactly.
+	mHeapByteSize = SizeOfClass(SizeClassOf(heapByteSize));
+
+	const int classCount = SizeClassOf(mHeapByteSize) + 1;
+	for(auto& pool : mPools)
+		pool.FreeBlocks.resize(classCount);
+}
+
+HRESULT PlacedResourceAllocator::CreateResource(
+	const D3D12_RESOURCE_DESC& desc,
+	D3D12_RESOURCE_STATES initialState,
+	ComPtr<ID3D12Resource>& resource)
+{
+	const D3D12_RESOURCE_FLAGS targetFlags =
+		D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET | D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL;
+	if(desc.Flags & targetFlags)
+		return E_INVALIDARG;
+
+	HeapKind kind = (desc.Dimension == D3D12_RESOURCE_DIMENSION_BUFFER) ? HeapKind::Buffer : HeapKind::Texture;
+
+	D3D12_RESOURCE_ALLOCATION_INFO info = mDevice->GetResourceAllocationInfo(0, 1, &desc);
+	if(info.SizeInBytes == UINT64_MAX)
+		return E_INVALIDARG;
+
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	Block block;
+	HRESULT hr = AllocateBlock(kind, info.SizeInBytes, info.Alignment, block);
+	if(FAILED(hr))
+		return hr;
+
+	hr = mDevice->CreatePlacedResource(block.Heap, block.Offset, &desc, initialState,
+		nullptr, IID_PPV_ARGS(resource.ReleaseAndGetAddressOf()));
+	if(FAILED(hr))
+	{
+		// Hand the block straight back.
+		if(block.SizeClass >= 0)
+		{
+			mPools[(int)kind].FreeBlocks[block.SizeClass].push_back(block);
+			--mPools[(int)kind].LiveBlocks[block.HeapIndex];
+		}
+		return hr;
+	}
+
+	mLiveBlocks[resource.Get()] = block;
+	mBytesInUse += block.Size;
+	return S_OK;
+}
+
+void PlacedResourceAllocator::Release(ID3D12Resource* resource)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	auto it = mLiveBlocks.find(resource);
+	if(it == mLiveBlocks.end())
+		return;
+
+	Block block = it->second;
+	mLiveBlocks.erase(it);
+	mBytesInUse -= block.Size;
+
+	if(block.SizeClass >= 0)
+	{
+		mPools[(int)block.Kind].FreeBlocks[block.SizeClass].push_back(block);
+		--mPools[(int)block.Kind].LiveBlocks[block.HeapIndex];
+	}
+	else
+	{
+		// Dedicated heaps are not shared, so free them outright.
+		for(auto heap = mDedicatedHeaps.begin(); heap != mDedicatedHeaps.end(); ++heap)
+		{
+			if(heap->Get() == block.Heap)
+			{
+				mHeapBytes -= block.Size;
+				mDedicatedHeaps.erase(heap);
+				break;
+			}
+		}
+	}
+}
+
+UINT64 PlacedResourceAllocator::EvictUnusedHeaps()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	UINT64 evicted = 0;
+	for(auto& pool : mPools)
+	{
+		// The newest heap is still being bump allocated from.
+		for(size_t i = 0; i + 1 < pool.Heaps.size(); ++i)
+		{
+			if(pool.LiveBlocks[i] > 0 || pool.Evicted[i])
+				continue;
+
+			ID3D12Pageable* pageable = pool.Heaps[i].Get();
+			if(FAILED(mDevice->Evict(1, &pageable)))
+				continue;
+
+			pool.Evicted[i] = true;
+			evicted += mHeapByteSize;
+		}
+	}
+
+	mEvictedBytes += evicted;
+	return evicted;
+}
+
+UINT64 PlacedResourceAllocator::HeapBytes()const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mHeapBytes;
+}
+
+UINT64 PlacedResourceAllocator::BytesInUse()const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mBytesInUse;
+}
+
+UINT64 PlacedResourceAllocator::EvictedBytes()const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mEvictedBytes;
+}
+
+HRESULT PlacedResourceAllocator::AllocateBlock(HeapKind kind, UINT64 size, UINT64 alignment, Block& block)
+{
+	block.Kind = kind;
+
+	// Too big to share a heap with anything else.
+	if(size > mHeapByteSize)
+	{
+		ComPtr<ID3D12Heap> heap;
+		HRESULT hr = CreateHeap(kind, AlignUp(size, MinBlockSize), heap);
+		if(FAILED(hr))
+			return hr;
+
+		block.Heap = heap.Get();
+		block.Offset = 0;
+		block.Size = AlignUp(size, MinBlockSize);
+		block.SizeClass = -1;
+
+		mDedicatedHeaps.push_back(heap);
+		return S_OK;
+	}
+
+	HeapPool& pool = mPools[(int)kind];
+
+	block.SizeClass = SizeClassOf(size);
+	block.Size = SizeOfClass(block.SizeClass);
+
+	// Reuse a released block of the same class if one sits at a suitable alignment.
+	auto& freeBlocks = pool.FreeBlocks[block.SizeClass];
+	for(size_t i = 0; i < freeBlocks.size(); ++i)
+	{
+		if(freeBlocks[i].Offset % alignment == 0)
+		{
+			// Evicted heaps have nothing placed in them; bring this one back first.
+			if(pool.Evicted[freeBlocks[i].HeapIndex])
+			{
+				ID3D12Pageable* pageable = pool.Heaps[freeBlocks[i].HeapIndex].Get();
+				HRESULT hr = mDevice->MakeResident(1, &pageable);
+				if(FAILED(hr))
+					return hr;
+
+				pool.Evicted[freeBlocks[i].HeapIndex] = false;
+				mEvictedBytes -= mHeapByteSize;
+			}
+
+			block = freeBlocks[i];
+			freeBlocks[i] = freeBlocks.back();
+			freeBlocks.pop_back();
+			++pool.LiveBlocks[block.HeapIndex];
+			return S_OK;
+		}
+	}
+
+	// Otherwise bump allocate from the newest heap, starting a new one when it is full.
+	UINT64 offset = AlignUp(pool.CurrentOffset, alignment);
+	if(pool.Heaps.empty() || offset + block.Size > mHeapByteSize)
+	{
+		ComPtr<ID3D12Heap> heap;
+		HRESULT hr = CreateHeap(kind, mHeapByteSize, heap);
+		if(FAILED(hr))
+			return hr;
+
+		pool.Heaps.push_back(heap);
+		pool.LiveBlocks.push_back(0);
+		pool.Evicted.push_back(false);
+		offset = 0;
+	}
+
+	block.Heap = pool.Heaps.back().Get();
+	block.HeapIndex = (int)pool.Heaps.size() - 1;
+	block.Offset = offset;
+	pool.CurrentOffset = offset + block.Size;
+	++pool.LiveBlocks.back();
+	return S_OK;
+}
+
+HRESULT PlacedResourceAllocator::CreateHeap(HeapKind kind, UINT64 size, ComPtr<ID3D12Heap>& heap)
+{
+	D3D12_HEAP_DESC heapDesc = {};
+	heapDesc.SizeInBytes = size;
+	heapDesc.Properties = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT);
+	heapDesc.Alignment = D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT;
+	heapDesc.Flags = (kind == HeapKind::Buffer) ?
+		D3D12_HEAP_FLAG_ALLOW_ONLY_BUFFERS : D3D12_HEAP_FLAG_ALLOW_ONLY_NON_RT_DS_TEXTURES;
+
+	HRESULT hr = mDevice->CreateHeap(&heapDesc, IID_PPV_ARGS(heap.GetAddressOf()));
+	if(SUCCEEDED(hr))
+		mHeapBytes += size;
+
+	return hr;
+}
+
+int PlacedResourceAllocator::SizeClassOf(UINT64 size)const
+{
+	int sizeClass = 0;
+	while(SizeOfClass(sizeClass) < size)
+		++sizeClass;
+	return sizeClass;
+}
+
+UINT64 PlacedResourceAllocator::SizeOfClass(int sizeClass)const
+{
+	return MinBlockSize << sizeClass;
+}
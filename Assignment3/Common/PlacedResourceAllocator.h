@@ -0,0 +1,98 @@
+//***************************************************************************************
+// PlacedResourceAllocator.h
+//
+// Sub-allocates default-heap resources out of a few large ID3D12Heaps with
+// CreatePlacedResource instead of giving every buffer and texture its own
+// committed allocation.
+//   -Requests are rounded up to a power-of-two size class (64KB and up).  Released
+//    blocks go on their class's free list and are handed out again first.
+//   -Buffers and non render target/depth textures live in separate heaps so the
+//    allocator works on resource heap tier 1 hardware.
+//   -Resources larger than a heap get a heap of their own.
+//   -EvictUnusedHeaps() evicts shared heaps with nothing placed in them; the next
+//    block handed out from one makes it resident again.
+//   -Thread safe; loaders on worker threads can share one allocator.
+//***************************************************************************************
+
+#pragma once
+
+#include "d3dUtil.h"
+#include <mutex>
+
+class PlacedResourceAllocator
+{
+public:
+	PlacedResourceAllocator(ID3D12Device* device, UINT64 heapByteSize = 64 * 1024 * 1024);
+	PlacedResourceAllocator(const PlacedResourceAllocator& rhs) = delete;
+	PlacedResourceAllocator& operator=(const PlacedResourceAllocator& rhs) = delete;
+	~PlacedResourceAllocator() = default;
+
+	// Only buffers and textures without the render target/depth stencil flags are supported.
+	HRESULT CreateResource(
+		const D3D12_RESOURCE_DESC& desc,
+		D3D12_RESOURCE_STATES initialState,
+		Microsoft::WRL::ComPtr<ID3D12Resource>& resource);
+
+	// Returns the resource's memory to the allocator.  Call once the GPU is done with
+	// the resource and every reference to it has been dropped.
+	void Release(ID3D12Resource* resource);
+
+	// Returns the bytes evicted.  For when the process is over its video memory budget.
+	UINT64 EvictUnusedHeaps();
+
+	// Bytes of heap memory created so far, bytes currently handed out and bytes of
+	// heaps currently evicted.
+	UINT64 HeapBytes()const;
+	UINT64 BytesInUse()const;
+	UINT64 EvictedBytes()const;
+
+private:
+	enum class HeapKind : int
+	{
+		Buffer = 0,
+		Texture,
+		Count
+	};
+
+	struct Block
+	{
+		ID3D12Heap* Heap = nullptr;
+		UINT64 Offset = 0;
+		UINT64 Size = 0;
+		HeapKind Kind = HeapKind::Buffer;
+		int SizeClass = -1; // -1 for a dedicated heap.
+		int HeapIndex = -1; // Into the pool's Heaps; -1 for a dedicated heap.
+	};
+
+	struct HeapPool
+	{
+		std::vector<Microsoft::WRL::ComPtr<ID3D12Heap>> Heaps;
+		std::vector<UINT> LiveBlocks;
+		std::vector<bool> Evicted;
+		UINT64 CurrentOffset = 0;
+		std::vector<std::vector<Block>> FreeBlocks;
+	};
+
+	HRESULT AllocateBlock(HeapKind kind, UINT64 size, UINT64 alignment, Block& block);
+	HRESULT CreateHeap(HeapKind kind, UINT64 size, Microsoft::WRL::ComPtr<ID3D12Heap>& heap);
+
+	int SizeClassOf(UINT64 size)const;
+	UINT64 SizeOfClass(int sizeClass)const;
+
+private:
+	static const UINT64 MinBlockSize = D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT;
+
+	ID3D12Device* mDevice = nullptr;
+	UINT64 mHeapByteSize = 0;
+
+	HeapPool mPools[(int)HeapKind::Count];
+	std::vector<Microsoft::WRL::ComPtr<ID3D12Heap>> mDedicatedHeaps;
+
+	std::unordered_map<ID3D12Resource*, Block> mLiveBlocks;
+
+	UINT64 mHeapBytes = 0;
+	UINT64 mBytesInUse = 0;
+	UINT64 mEvictedBytes = 0;
+
+	mutable std::mutex mMutex;
+};
@@ -0,0 +1,59 @@
+//***************************************************************************************
+// RadixSort.cpp
+//***************************************************************************************
+
+#include "RadixSort.h"
+#include <cstring>
+
+void RadixSort::SortHigh32(std::vector<std::uint64_t>& keys, std::vector<std::uint64_t>& scratch)
+{
+	const size_t count = keys.size();
+	if(count < 2)
+		return;
+
+	// Every pass's histogram in one sweep over the keys.
+	std::uint32_t histograms[4][256] = {};
+	for(std::uint64_t key : keys)
+	{
+		for(int pass = 0; pass < 4; ++pass)
+			++histograms[pass][(key >> (32 + 8 * pass)) & 0xFF];
+	}
+
+	scratch.resize(count);
+	std::uint64_t* src = keys.data();
+	std::uint64_t* dst = scratch.data();
+	for(int pass = 0; pass < 4; ++pass)
+	{
+		std::uint32_t* histogram = histograms[pass];
+		const int shift = 32 + 8 * pass;
+		if(histogram[(src[0] >> shift) & 0xFF] == count)
+			continue;
+
+		std::uint32_t offset = 0;
+		for(int digit = 0; digit < 256; ++digit)
+		{
+			std::uint32_t n = histogram[digit];
+			histogram[digit] = offset;
+			offset += n;
+		}
+
+		for(size_t i = 0; i < count; ++i)
+			dst[histogram[(src[i] >> shift) & 0xFF]++] = src[i];
+
+		std::uint64_t* swap = src;
+		src = dst;
+		dst = swap;
+	}
+
+	if(src != keys.data())
+		std::memcpy(keys.data(), src, count * sizeof(std::uint64_t));
+}
+
+std::uint32_t RadixSort::FloatKey(float value)
+{
+	// Flip every bit of a negative, whose magnitude sorts backwards, and only the sign
+	// bit of a positive.
+	std::uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+}
@@ -0,0 +1,25 @@
+//***************************************************************************************
+// RadixSort.h
+//
+// Least significant digit radix sort of 64-bit keys by their upper 32 bits.
+//   -Four passes of 8 bits each, counting into 256 buckets and scattering between the
+//    keys and a scratch array of the same size.  A pass where every key has the same
+//    digit is skipped, which for keys of nearby values is most of them.
+//   -The sort is stable, so keys that tie keep their order, and the lower 32 bits are
+//    left free for a payload such as the index of what the key belongs to.
+//   -FloatKey() maps a float to 32 bits that sort in the same order, negatives first.
+//***************************************************************************************
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+class RadixSort
+{
+public:
+	// scratch is resized to match keys and left holding garbage.
+	static void SortHigh32(std::vector<std::uint64_t>& keys, std::vector<std::uint64_t>& scratch);
+
+	static std::uint32_t FloatKey(float value);
+};
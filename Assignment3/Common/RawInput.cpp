@@ -0,0 +1,141 @@
+//***************************************************************************************
+// RawInput.cpp
+//***************************************************************************************
+
+#include "RawInput.h"
+
+void RawInput::Register(HWND hwnd)
+{
+	// Generic desktop keyboard and mouse.  The legacy messages keep coming, so the
+	// window procedure still sees WM_KEYDOWN and the mouse messages.
+	RAWINPUTDEVICE devices[2] = {};
+	devices[0].usUsagePage = 0x01;
+	devices[0].usUsage = 0x06;
+	devices[0].hwndTarget = hwnd;
+	devices[1].usUsagePage = 0x01;
+	devices[1].usUsage = 0x02;
+	devices[1].hwndTarget = hwnd;
+
+	if(!RegisterRawInputDevices(devices, 2, sizeof(RAWINPUTDEVICE)))
+		ThrowIfFailed(HRESULT_FROM_WIN32(GetLastError()));
+}
+
+void RawInput::OnInput(HRAWINPUT input)
+{
+	const std::int64_t time = Now();
+
+	UINT size = 0;
+	GetRawInputData(input, RID_INPUT, nullptr, &size, sizeof(RAWINPUTHEADER));
+	if(size == 0)
+		return;
+
+	mBuffer.resize((size + sizeof(std::uint64_t) - 1) / sizeof(std::uint64_t));
+	if(GetRawInputData(input, RID_INPUT, mBuffer.data(), &size, sizeof(RAWINPUTHEADER)) == (UINT)-1)
+		return;
+
+	Process(*reinterpret_cast<const RAWINPUT*>(mBuffer.data()), time);
+}
+
+void RawInput::Poll()
+{
+	const std::int64_t time = Now();
+
+	for(;;)
+	{
+		// The size asked for is that of the largest single input; read a batch at a time.
+		UINT size = 0;
+		if(GetRawInputBuffer(nullptr, &size, sizeof(RAWINPUTHEADER)) != 0 || size == 0)
+			return;
+
+		size *= 16;
+		mBuffer.resize((size + sizeof(std::uint64_t) - 1) / sizeof(std::uint64_t));
+
+		UINT count = GetRawInputBuffer(reinterpret_cast<RAWINPUT*>(mBuffer.data()), &size, sizeof(RAWINPUTHEADER));
+		if(count == 0 || count == (UINT)-1)
+			return;
+
+		RAWINPUT* input = reinterpret_cast<RAWINPUT*>(mBuffer.data());
+		for(UINT i = 0; i < count; ++i)
+		{
+			Process(*input, time);
+			input = NEXTRAWINPUTBLOCK(input);
+		}
+	}
+}
+
+void RawInput::ReleaseAll()
+{
+	mKeyEvents.clear();
+	mKeyDown.reset();
+	mLeftButtonDown = false;
+	mMouseDX = 0;
+	mMouseDY = 0;
+}
+
+void RawInput::AdvanceTo(std::int64_t time)
+{
+	while(!mKeyEvents.empty() && mKeyEvents.front().Time <= time)
+	{
+		mKeyDown[mKeyEvents.front().Key] = mKeyEvents.front().Down;
+		mKeyEvents.pop_front();
+	}
+}
+
+bool RawInput::KeyDown(UINT virtualKey)const
+{
+	return virtualKey < mKeyDown.size() && mKeyDown[virtualKey];
+}
+
+void RawInput::TakeMouseDelta(long& dx, long& dy)
+{
+	dx = mMouseDX;
+	dy = mMouseDY;
+	mMouseDX = 0;
+	mMouseDY = 0;
+}
+
+std::int64_t RawInput::Now()
+{
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return counter.QuadPart;
+}
+
+std::int64_t RawInput::Frequency()
+{
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	return frequency.QuadPart;
+}
+
+void RawInput::Process(const RAWINPUT& input, std::int64_t time)
+{
+	if(input.header.dwType == RIM_TYPEKEYBOARD)
+	{
+		// 0xFF comes with the extra scan codes of some keys and isn't a key itself.
+		const RAWKEYBOARD& keyboard = input.data.keyboard;
+		if(keyboard.VKey == 0 || keyboard.VKey >= 0xFF)
+			return;
+
+		KeyEvent e;
+		e.Time = time;
+		e.Key = keyboard.VKey;
+		e.Down = (keyboard.Flags & RI_KEY_BREAK) == 0;
+		mKeyEvents.push_back(e);
+	}
+	else if(input.header.dwType == RIM_TYPEMOUSE)
+	{
+		const RAWMOUSE& mouse = input.data.mouse;
+		if(mouse.usButtonFlags & RI_MOUSE_LEFT_BUTTON_DOWN)
+			mLeftButtonDown = true;
+		if(mouse.usButtonFlags & RI_MOUSE_LEFT_BUTTON_UP)
+			mLeftButtonDown = false;
+
+		// Tablets and remote sessions report absolute positions, which can't turn the view.
+		if(mLeftButtonDown && (mouse.usFlags & MOUSE_MOVE_ABSOLUTE) == 0)
+		{
+			mMouseDX += mouse.lLastX;
+			mMouseDY += mouse.lLastY;
+		}
+	}
+}
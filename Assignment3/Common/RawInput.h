@@ -0,0 +1,66 @@
+//***************************************************************************************
+// RawInput.h
+//
+// Keyboard and mouse read through raw input (WM_INPUT) rather than polled.
+//   -Register() asks for the window's raw keyboard and mouse input.  Pass the lParam
+//    of every WM_INPUT to OnInput(), and call Poll() to take what queued up since the
+//    messages were last dispatched, e.g. while the frame waited on the GPU.  Input
+//    only arrives while the window is in the foreground, so call ReleaseAll() when it
+//    loses focus or the keys let go meanwhile would stay down.
+//   -Key presses and releases are queued with the QueryPerformanceCounter time they
+//    were received.  AdvanceTo() applies those up to a time, so a fixed-rate
+//    simulation sees which keys were down during each of its ticks rather than only
+//    when the frame started.
+//   -Mouse motion isn't replayed: the relative motion made with the left button down
+//    is summed as it arrives, and TakeMouseDelta() hands over the sum so far.
+//***************************************************************************************
+
+#pragma once
+
+#include "d3dUtil.h"
+#include <bitset>
+#include <deque>
+
+class RawInput
+{
+public:
+	RawInput() = default;
+	RawInput(const RawInput& rhs) = delete;
+	RawInput& operator=(const RawInput& rhs) = delete;
+	~RawInput() = default;
+
+	void Register(HWND hwnd);
+	void OnInput(HRAWINPUT input);
+	void Poll();
+	void ReleaseAll();
+
+	void AdvanceTo(std::int64_t time);
+	bool KeyDown(UINT virtualKey)const;
+
+	// Counts moved since the last call, about a pixel each at the default pointer speed.
+	void TakeMouseDelta(long& dx, long& dy);
+
+	// QueryPerformanceCounter time, and its counts per second.
+	static std::int64_t Now();
+	static std::int64_t Frequency();
+
+private:
+	void Process(const RAWINPUT& input, std::int64_t time);
+
+private:
+	struct KeyEvent
+	{
+		std::int64_t Time = 0;
+		USHORT Key = 0;
+		bool Down = false;
+	};
+
+	std::deque<KeyEvent> mKeyEvents;
+	std::bitset<256> mKeyDown;
+
+	bool mLeftButtonDown = false;
+	long mMouseDX = 0;
+	long mMouseDY = 0;
+
+	std::vector<std::uint64_t> mBuffer;
+};
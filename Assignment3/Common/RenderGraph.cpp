@@ -0,0 +1,522 @@
+//***************************************************************************************
+// RenderGraph.cpp
+//***************************************************************************************
+
+#include "RenderGraph.h"
+#include "GpuEvent.h"
+
+namespace
+{
+	UINT64 AlignUp(UINT64 value, UINT64 alignment)
+	{
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+
+	bool IsDepthFormat(DXGI_FORMAT format)
+	{
+		return format == DXGI_FORMAT_D32_FLOAT || format == DXGI_FORMAT_D24_UNORM_S8_UINT ||
+			format == DXGI_FORMAT_D16_UNORM || format == DXGI_FORMAT_D32_FLOAT_S8X24_UINT;
+	}
+
+	// Field by field; the descriptions come from callers with padding in any state.
+	bool SameDesc(const D3D12_RESOURCE_DESC& a, const D3D12_RESOURCE_DESC& b)
+	{
+		return a.Dimension == b.Dimension && a.Alignment == b.Alignment &&
+			a.Width == b.Width && a.Height == b.Height &&
+			a.DepthOrArraySize == b.DepthOrArraySize && a.MipLevels == b.MipLevels &&
+			a.Format == b.Format && a.SampleDesc.Count == b.SampleDesc.Count &&
+			a.SampleDesc.Quality == b.SampleDesc.Quality && a.Layout == b.Layout &&
+			a.Flags == b.Flags;
+	}
+
+	bool SameClearValue(const D3D12_CLEAR_VALUE& a, const D3D12_CLEAR_VALUE& b)
+	{
+		if(a.Format != b.Format)
+			return false;
+
+		if(IsDepthFormat(a.Format))
+			return a.DepthStencil.Depth == b.DepthStencil.Depth && a.DepthStencil.Stencil == b.DepthStencil.Stencil;
+
+		return memcmp(a.Color, b.Color, sizeof(a.Color)) == 0;
+	}
+}
+
+RenderGraph::Builder::Builder(RenderGraph& graph, UINT pass) :
+	mGraph(graph),
+	mPass(pass)
+{
+}
+
+void RenderGraph::Builder::Read(Handle resource, D3D12_RESOURCE_STATES state)
+{
+	Pass& pass = mGraph.mPasses[mPass];
+	for(UINT i = pass.FirstAccess; i < pass.FirstAccess + pass.AccessCount; ++i)
+	{
+		Access& access = mGraph.mAccesses[i];
+		if(access.Resource == resource)
+		{
+			assert(!access.Write);
+			access.State |= state;
+			return;
+		}
+	}
+
+	mGraph.mAccesses.push_back({ resource, state, false });
+	++pass.AccessCount;
+}
+
+void RenderGraph::Builder::Write(Handle resource, D3D12_RESOURCE_STATES state)
+{
+	Pass& pass = mGraph.mPasses[mPass];
+	for(const Access& access : mGraph.Accesses(mPass))
+		assert(access.Resource != resource);
+
+	mGraph.mAccesses.push_back({ resource, state, true });
+	++pass.AccessCount;
+}
+
+void RenderGraph::Builder::SideEffect()
+{
+	mGraph.mPasses[mPass].SideEffect = true;
+}
+
+RenderGraph::RenderGraph(ID3D12Device* device, ResourceStateTracker& states) :
+	mDevice(device),
+	mStates(states)
+{
+	D3D12_FEATURE_DATA_D3D12_OPTIONS options = {};
+	ThrowIfFailed(mDevice->CheckFeatureSupport(D3D12_FEATURE_D3D12_OPTIONS, &options, sizeof(options)));
+	mSingleHeap = options.ResourceHeapTier >= D3D12_RESOURCE_HEAP_TIER_2;
+}
+
+void RenderGraph::Reset()
+{
+	mPasses.clear();
+	mAccesses.clear();
+	mResources.clear();
+	mTransients.clear();
+}
+
+RenderGraph::Handle RenderGraph::Import(const char* name, ID3D12Resource* resource)
+{
+	assert(resource != nullptr);
+
+	ResourceNode node;
+	node.Name = name;
+	node.Imported = resource;
+	mResources.push_back(node);
+	return (Handle)mResources.size() - 1;
+}
+
+RenderGraph::Handle RenderGraph::CreateTransient(const char* name, const D3D12_RESOURCE_DESC& desc,
+	const D3D12_CLEAR_VALUE* clearValue)
+{
+	ResourceNode node;
+	node.Name = name;
+	node.Desc = desc;
+	node.HasClearValue = clearValue != nullptr;
+	if(clearValue != nullptr)
+		node.ClearValue = *clearValue;
+	node.Transient = (UINT)mTransients.size();
+	mResources.push_back(node);
+
+	Handle handle = (Handle)mResources.size() - 1;
+	mTransients.push_back(handle);
+	return handle;
+}
+
+UINT RenderGraph::BeginPass(const char* name, const ExecuteFunction& execute)
+{
+	mPasses.emplace_back();
+	Pass& pass = mPasses.back();
+	pass.Name = name;
+	pass.Execute = execute;
+	pass.FirstAccess = (UINT)mAccesses.size();
+
+	return (UINT)mPasses.size() - 1;
+}
+
+void RenderGraph::Compile(UINT64 retireFence)
+{
+	Cull();
+	ComputeLifetimes();
+	PlaceTransients();
+
+	if(PlacementChanged())
+		CreateTransients(retireFence);
+}
+
+ID3D12Resource* RenderGraph::Resource(Handle resource)const
+{
+	const ResourceNode& node = mResources[resource];
+	if(node.Imported != nullptr)
+		return node.Imported;
+
+	// Null for a transient only culled passes use.
+	return mPlaced[node.Transient].Resource.Get();
+}
+
+void RenderGraph::Execute(ID3D12GraphicsCommandList* cmdList)
+{
+	// The last kept pass to use each resource, and whether it wrote it.
+	mLastUse.assign(mResources.size(), NoPass);
+	mLastWrite.assign(mResources.size(), false);
+
+	for(UINT i = 0; i < (UINT)mPasses.size(); ++i)
+	{
+		const Pass& pass = mPasses[i];
+		if(pass.Culled)
+			continue;
+
+		// The pass's barriers and commands under its name in a capture.
+		GpuEvent event(cmdList, pass.Name);
+
+		for(const Access& access : Accesses(i))
+		{
+			const ResourceNode& node = mResources[access.Resource];
+			ID3D12Resource* resource = Resource(access.Resource);
+
+			// Whatever shared the memory before is done with it.
+			if(node.Imported == nullptr && node.FirstPass == i)
+				mStates.AliasingBarrier(nullptr, resource);
+
+			const bool wasUav = mStates.State(resource) == D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
+			mStates.Transition(resource, access.State);
+
+			if(wasUav && access.State == D3D12_RESOURCE_STATE_UNORDERED_ACCESS &&
+				mLastUse[access.Resource] != NoPass && (access.Write || mLastWrite[access.Resource]))
+			{
+				mStates.UavBarrier(resource);
+			}
+		}
+		mStates.FlushBarriers(cmdList);
+
+		// Placed render targets and depth buffers start out undefined and have to be
+		// initialized before they are drawn to.
+		for(const Access& access : Accesses(i))
+		{
+			const ResourceNode& node = mResources[access.Resource];
+			if(node.Imported == nullptr && node.FirstPass == i && access.Write &&
+				(access.State & (D3D12_RESOURCE_STATE_RENDER_TARGET | D3D12_RESOURCE_STATE_DEPTH_WRITE)) != 0)
+			{
+				cmdList->DiscardResource(Resource(access.Resource), nullptr);
+			}
+		}
+
+		if(pass.Execute)
+			pass.Execute(cmdList);
+
+		// Start the transitions to states wanted more than one pass later, so the
+		// passes in between overlap them.
+		for(const Access& access : Accesses(i))
+		{
+			mLastUse[access.Resource] = i;
+			mLastWrite[access.Resource] = access.Write;
+
+			D3D12_RESOURCE_STATES nextState;
+			UINT next = NextUse(access.Resource, i, nextState);
+			if(next == NoPass)
+				continue;
+
+			bool passesBetween = false;
+			for(UINT k = i + 1; k < next && !passesBetween; ++k)
+				passesBetween = !mPasses[k].Culled;
+
+			if(passesBetween)
+				mStates.BeginTransition(Resource(access.Resource), nextState);
+		}
+		mStates.FlushBarriers(cmdList);
+	}
+}
+
+void RenderGraph::ReleaseCompleted(UINT64 completedFence)
+{
+	while(!mRetired.empty() && mRetired.front().Fence <= completedFence)
+		mRetired.pop_front();
+}
+
+UINT RenderGraph::PassCount()const
+{
+	return (UINT)mPasses.size();
+}
+
+UINT RenderGraph::CulledPassCount()const
+{
+	return mCulledPassCount;
+}
+
+UINT64 RenderGraph::TransientHeapBytes()const
+{
+	UINT64 bytes = 0;
+	for(UINT64 size : mHeapSizes)
+		bytes += size;
+	return bytes;
+}
+
+UINT64 RenderGraph::TransientResourceBytes()const
+{
+	return mTransientResourceBytes;
+}
+
+RenderGraph::HeapKind RenderGraph::KindOf(const D3D12_RESOURCE_DESC& desc)const
+{
+	if(mSingleHeap || desc.Dimension == D3D12_RESOURCE_DIMENSION_BUFFER)
+		return HeapKind::Buffer;
+
+	if(desc.Flags & (D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET | D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL))
+		return HeapKind::Target;
+
+	return HeapKind::Texture;
+}
+
+// Walks the passes backwards.  A kept pass needs every earlier write of what it
+// touches, since a write may only cover part of a resource or add to it.
+void RenderGraph::Cull()
+{
+	mNeeded.assign(mResources.size(), false);
+	mCulledPassCount = 0;
+
+	for(UINT i = (UINT)mPasses.size(); i-- > 0;)
+	{
+		Pass& pass = mPasses[i];
+
+		bool keep = pass.SideEffect;
+		for(const Access& access : Accesses(i))
+		{
+			if(access.Write && (mResources[access.Resource].Imported != nullptr || mNeeded[access.Resource]))
+				keep = true;
+		}
+
+		pass.Culled = !keep;
+		if(!keep)
+		{
+			++mCulledPassCount;
+			continue;
+		}
+
+		for(const Access& access : Accesses(i))
+			mNeeded[access.Resource] = true;
+	}
+}
+
+void RenderGraph::ComputeLifetimes()
+{
+	for(ResourceNode& node : mResources)
+	{
+		node.FirstPass = NoPass;
+		node.LastPass = NoPass;
+	}
+
+	for(UINT i = 0; i < (UINT)mPasses.size(); ++i)
+	{
+		if(mPasses[i].Culled)
+			continue;
+
+		for(const Access& access : Accesses(i))
+		{
+			ResourceNode& node = mResources[access.Resource];
+			if(node.FirstPass == NoPass)
+				node.FirstPass = i;
+			node.LastPass = i;
+		}
+	}
+}
+
+// First fit, largest first: each transient goes at the lowest offset of its heap
+// that no transient already placed there uses during its lifetime.
+void RenderGraph::PlaceTransients()
+{
+	for(int k = 0; k < (int)HeapKind::Count; ++k)
+	{
+		mRequiredHeapSizes[k] = 0;
+		mRequiredHeapAlignments[k] = D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT;
+	}
+	mTransientResourceBytes = 0;
+
+	mPlaceOrder.clear();
+	for(Handle handle : mTransients)
+	{
+		ResourceNode& node = mResources[handle];
+		if(node.FirstPass == NoPass)
+			continue;
+
+		D3D12_RESOURCE_ALLOCATION_INFO info = mDevice->GetResourceAllocationInfo(0, 1, &node.Desc);
+		node.Kind = KindOf(node.Desc);
+		node.Size = info.SizeInBytes;
+		node.Alignment = info.Alignment;
+		mTransientResourceBytes += node.Size;
+		mPlaceOrder.push_back(handle);
+	}
+
+	std::stable_sort(mPlaceOrder.begin(), mPlaceOrder.end(), [this](Handle a, Handle b)
+	{
+		return mResources[a].Size > mResources[b].Size;
+	});
+
+	mPlacedNodes.clear();
+	for(Handle handle : mPlaceOrder)
+	{
+		ResourceNode& node = mResources[handle];
+
+		mConflicts.clear();
+		for(const ResourceNode* other : mPlacedNodes)
+		{
+			if(other->Kind == node.Kind && other->FirstPass <= node.LastPass && node.FirstPass <= other->LastPass)
+				mConflicts.push_back(other);
+		}
+		std::sort(mConflicts.begin(), mConflicts.end(), [](const ResourceNode* a, const ResourceNode* b)
+		{
+			return a->Offset < b->Offset;
+		});
+
+		UINT64 offset = 0;
+		for(const ResourceNode* other : mConflicts)
+		{
+			if(offset + node.Size <= other->Offset)
+				break;
+			if(other->Offset + other->Size > offset)
+				offset = AlignUp(other->Offset + other->Size, node.Alignment);
+		}
+		node.Offset = offset;
+		mPlacedNodes.push_back(&node);
+
+		const int kind = (int)node.Kind;
+		mRequiredHeapSizes[kind] = MathHelper::Max(mRequiredHeapSizes[kind], offset + node.Size);
+		mRequiredHeapAlignments[kind] = MathHelper::Max(mRequiredHeapAlignments[kind], node.Alignment);
+	}
+}
+
+bool RenderGraph::PlacementChanged()const
+{
+	if(mPlaced.size() != mTransients.size())
+		return true;
+
+	for(int k = 0; k < (int)HeapKind::Count; ++k)
+	{
+		if(mRequiredHeapSizes[k] > mHeapSizes[k])
+			return true;
+	}
+
+	for(size_t i = 0; i < mTransients.size(); ++i)
+	{
+		const ResourceNode& node = mResources[mTransients[i]];
+		const Placed& placed = mPlaced[i];
+
+		const bool used = node.FirstPass != NoPass;
+		if(used != (placed.Resource != nullptr))
+			return true;
+		if(!used)
+			continue;
+
+		if(!SameDesc(node.Desc, placed.Desc) || node.Kind != placed.Kind || node.Offset != placed.Offset)
+			return true;
+		if(node.HasClearValue != placed.HasClearValue ||
+			(node.HasClearValue && !SameClearValue(node.ClearValue, placed.ClearValue)))
+			return true;
+	}
+
+	return false;
+}
+
+void RenderGraph::CreateTransients(UINT64 retireFence)
+{
+	RetirePlacement(retireFence);
+
+	for(int k = 0; k < (int)HeapKind::Count; ++k)
+	{
+		if(mRequiredHeapSizes[k] == 0)
+			continue;
+
+		D3D12_HEAP_DESC heapDesc = {};
+		heapDesc.SizeInBytes = AlignUp(mRequiredHeapSizes[k], mRequiredHeapAlignments[k]);
+		heapDesc.Properties = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT);
+		heapDesc.Alignment = mRequiredHeapAlignments[k];
+		heapDesc.Flags =
+			mSingleHeap ? D3D12_HEAP_FLAG_ALLOW_ALL_BUFFERS_AND_TEXTURES :
+			k == (int)HeapKind::Buffer ? D3D12_HEAP_FLAG_ALLOW_ONLY_BUFFERS :
+			k == (int)HeapKind::Texture ? D3D12_HEAP_FLAG_ALLOW_ONLY_NON_RT_DS_TEXTURES :
+			D3D12_HEAP_FLAG_ALLOW_ONLY_RT_DS_TEXTURES;
+
+		ThrowIfFailed(mDevice->CreateHeap(&heapDesc, IID_PPV_ARGS(mHeaps[k].GetAddressOf())));
+		mHeapSizes[k] = heapDesc.SizeInBytes;
+	}
+
+	mPlaced.resize(mTransients.size());
+	for(size_t i = 0; i < mTransients.size(); ++i)
+	{
+		const ResourceNode& node = mResources[mTransients[i]];
+		Placed& placed = mPlaced[i];
+
+		placed.Desc = node.Desc;
+		placed.ClearValue = node.ClearValue;
+		placed.HasClearValue = node.HasClearValue;
+		placed.Kind = node.Kind;
+		placed.Offset = node.Offset;
+		if(node.FirstPass == NoPass)
+			continue;
+
+		ThrowIfFailed(mDevice->CreatePlacedResource(
+			mHeaps[(int)node.Kind].Get(),
+			node.Offset,
+			&node.Desc,
+			D3D12_RESOURCE_STATE_COMMON,
+			node.HasClearValue ? &node.ClearValue : nullptr,
+			IID_PPV_ARGS(placed.Resource.GetAddressOf())));
+		placed.Resource->SetName(AnsiToWString(node.Name).c_str());
+
+		const bool buffer = node.Desc.Dimension == D3D12_RESOURCE_DIMENSION_BUFFER;
+		mStates.Track(placed.Resource.Get(), D3D12_RESOURCE_STATE_COMMON, buffer);
+	}
+}
+
+void RenderGraph::RetirePlacement(UINT64 retireFence)
+{
+	Retired retired;
+	retired.Fence = retireFence;
+
+	for(Placed& placed : mPlaced)
+	{
+		if(placed.Resource == nullptr)
+			continue;
+
+		mStates.Untrack(placed.Resource.Get());
+		retired.Resources.push_back(placed.Resource);
+	}
+	mPlaced.clear();
+
+	for(int k = 0; k < (int)HeapKind::Count; ++k)
+	{
+		if(mHeaps[k] != nullptr)
+			retired.Heaps.push_back(mHeaps[k]);
+		mHeaps[k].Reset();
+		mHeapSizes[k] = 0;
+	}
+
+	mRetired.push_back(retired);
+}
+
+UINT RenderGraph::NextUse(Handle resource, UINT afterPass, D3D12_RESOURCE_STATES& state)const
+{
+	for(UINT i = afterPass + 1; i < (UINT)mPasses.size(); ++i)
+	{
+		if(mPasses[i].Culled)
+			continue;
+
+		for(const Access& access : Accesses(i))
+		{
+			if(access.Resource == resource)
+			{
+				state = access.State;
+				return i;
+			}
+		}
+	}
+
+	return NoPass;
+}
+
+RenderGraph::AccessRange RenderGraph::Accesses(UINT pass)const
+{
+	const Access* first = mAccesses.data() + mPasses[pass].FirstAccess;
+	return { first, first + mPasses[pass].AccessCount };
+}
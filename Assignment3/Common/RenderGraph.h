@@ -0,0 +1,219 @@
+//***************************************************************************************
+// RenderGraph.h
+//
+// A frame's GPU work as passes that declare the resources they read and write.
+//   -Each frame: Reset(), import the persistent resources and declare the transient
+//    ones, AddPass() in submission order, Compile(), then Execute() into a list.
+//   -A pass is culled unless it writes an imported resource, is marked SideEffect(),
+//    or writes something a later pass that is kept reads.
+//   -Execute() moves every resource to the state its pass declared, in one barrier
+//    batch ahead of the pass, through the shared ResourceStateTracker.  UAV-to-UAV
+//    use by consecutive passes gets a UAV barrier.  When a resource is next used
+//    more than one pass later, its transition is split to begin right after the
+//    pass that used it last.
+//   -Transient resources are placed in heaps shared between them.  Two transients
+//    whose first-to-last pass ranges don't overlap may share memory; each one gets
+//    an aliasing barrier, and a render target or depth buffer a DiscardResource,
+//    on its first use.  Don't expect a transient's contents to survive the frame.
+//   -The placement is kept while the transients' descriptions stay the same, so
+//    Resource() returns the same object frame to frame.  A new placement retires
+//    the old heaps until the GPU passes retireFence.
+//   -Passes record into the one list given to Execute().  Work recorded elsewhere
+//    afterwards, e.g. by worker threads, can be declared as a pass with an empty
+//    execute function; its barriers still go into that list.
+//   -Each kept pass is recorded inside a GpuEvent of its name.
+//   -Names aren't copied, so they have to outlive the frame, e.g. string literals.
+//    The graph keeps its arrays from frame to frame and only grows them, so a frame
+//    like the last one costs no heap allocation beyond what the functions' captures
+//    need when they don't fit std::function's small buffer.
+//***************************************************************************************
+
+#pragma once
+
+#include "d3dUtil.h"
+#include "ResourceStateTracker.h"
+#include <deque>
+#include <functional>
+
+class RenderGraph
+{
+public:
+	typedef UINT Handle;
+
+	class Builder
+	{
+	public:
+		// Reads may be declared more than once with different read states, which are
+		// combined.  A resource is either read or written by a pass, not both.
+		void Read(Handle resource, D3D12_RESOURCE_STATES state);
+		void Write(Handle resource, D3D12_RESOURCE_STATES state);
+
+		// Keeps the pass even though nothing in the graph reads what it writes.
+		void SideEffect();
+
+	private:
+		friend class RenderGraph;
+		Builder(RenderGraph& graph, UINT pass);
+
+		RenderGraph& mGraph;
+		UINT mPass;
+	};
+
+	typedef std::function<void(ID3D12GraphicsCommandList*)> ExecuteFunction;
+
+	RenderGraph(ID3D12Device* device, ResourceStateTracker& states);
+	RenderGraph(const RenderGraph& rhs) = delete;
+	RenderGraph& operator=(const RenderGraph& rhs) = delete;
+	~RenderGraph() = default;
+
+	// Drops last frame's passes and declarations; the placed transients stay.
+	void Reset();
+
+	// The resource has to be tracked in the graph's ResourceStateTracker.
+	Handle Import(const char* name, ID3D12Resource* resource);
+	Handle CreateTransient(const char* name, const D3D12_RESOURCE_DESC& desc,
+		const D3D12_CLEAR_VALUE* clearValue = nullptr);
+
+	// setup(Builder&) runs straight away, so it isn't stored and may capture anything;
+	// execute runs from Execute() if the pass is kept.
+	template<typename SetupFunction>
+	void AddPass(const char* name, const SetupFunction& setup, const ExecuteFunction& execute)
+	{
+		Builder builder(*this, BeginPass(name, execute));
+		setup(builder);
+	}
+
+	// Culls the passes and places the transients.  Throws DxException if a heap or
+	// placed resource can't be created.
+	void Compile(UINT64 retireFence);
+
+	// Valid after Compile().
+	ID3D12Resource* Resource(Handle resource)const;
+
+	void Execute(ID3D12GraphicsCommandList* cmdList);
+
+	void ReleaseCompleted(UINT64 completedFence);
+
+	UINT PassCount()const;
+	UINT CulledPassCount()const;
+
+	// Bytes of the transient heaps, and what the transients would take unaliased.
+	UINT64 TransientHeapBytes()const;
+	UINT64 TransientResourceBytes()const;
+
+private:
+	static const UINT NoPass = UINT_MAX;
+
+	// Resource heap tier 1 keeps buffers, textures, and render target and depth
+	// textures in separate heaps; tier 2 puts them all in the first.
+	enum class HeapKind
+	{
+		Buffer = 0,
+		Texture,
+		Target,
+		Count
+	};
+
+	struct Access
+	{
+		Handle Resource;
+		D3D12_RESOURCE_STATES State;
+		bool Write;
+	};
+
+	// A pass's accesses are contiguous in mAccesses, since its setup runs before the
+	// next pass is added.
+	struct Pass
+	{
+		const char* Name = nullptr;
+		ExecuteFunction Execute;
+		UINT FirstAccess = 0;
+		UINT AccessCount = 0;
+		bool SideEffect = false;
+		bool Culled = false;
+	};
+
+	struct AccessRange
+	{
+		const Access* First;
+		const Access* Last;
+
+		const Access* begin()const { return First; }
+		const Access* end()const { return Last; }
+	};
+
+	struct ResourceNode
+	{
+		const char* Name = nullptr;
+		ID3D12Resource* Imported = nullptr;
+		D3D12_RESOURCE_DESC Desc = {};
+		D3D12_CLEAR_VALUE ClearValue = {};
+		bool HasClearValue = false;
+		UINT Transient = NoPass;
+
+		// Placement, filled by Compile() for transients.
+		HeapKind Kind = HeapKind::Buffer;
+		UINT64 Size = 0;
+		UINT64 Alignment = 0;
+		UINT64 Offset = 0;
+		UINT FirstPass = NoPass;
+		UINT LastPass = NoPass;
+	};
+
+	struct Placed
+	{
+		D3D12_RESOURCE_DESC Desc;
+		D3D12_CLEAR_VALUE ClearValue;
+		bool HasClearValue;
+		HeapKind Kind;
+		UINT64 Offset;
+		Microsoft::WRL::ComPtr<ID3D12Resource> Resource;
+	};
+
+	struct Retired
+	{
+		std::vector<Microsoft::WRL::ComPtr<ID3D12Heap>> Heaps;
+		std::vector<Microsoft::WRL::ComPtr<ID3D12Resource>> Resources;
+		UINT64 Fence;
+	};
+
+	UINT BeginPass(const char* name, const ExecuteFunction& execute);
+	HeapKind KindOf(const D3D12_RESOURCE_DESC& desc)const;
+	void Cull();
+	void ComputeLifetimes();
+	void PlaceTransients();
+	bool PlacementChanged()const;
+	void CreateTransients(UINT64 retireFence);
+	void RetirePlacement(UINT64 retireFence);
+	UINT NextUse(Handle resource, UINT afterPass, D3D12_RESOURCE_STATES& state)const;
+	AccessRange Accesses(UINT pass)const;
+
+private:
+	ID3D12Device* mDevice = nullptr;
+	ResourceStateTracker& mStates;
+	bool mSingleHeap = false;
+
+	std::vector<Pass> mPasses;
+	std::vector<Access> mAccesses;
+	std::vector<ResourceNode> mResources;
+
+	// The placed transients, in declaration order; transient i is mResources[mTransients[i]].
+	std::vector<Handle> mTransients;
+	std::vector<Placed> mPlaced;
+	Microsoft::WRL::ComPtr<ID3D12Heap> mHeaps[(int)HeapKind::Count];
+	UINT64 mHeapSizes[(int)HeapKind::Count] = {};
+	UINT64 mRequiredHeapSizes[(int)HeapKind::Count] = {};
+	UINT64 mRequiredHeapAlignments[(int)HeapKind::Count] = {};
+	std::deque<Retired> mRetired;
+
+	UINT mCulledPassCount = 0;
+	UINT64 mTransientResourceBytes = 0;
+
+	// Scratch of Cull(), PlaceTransients() and Execute(), kept for its capacity.
+	std::vector<bool> mNeeded;
+	std::vector<Handle> mPlaceOrder;
+	std::vector<const ResourceNode*> mPlacedNodes;
+	std::vector<const ResourceNode*> mConflicts;
+	std::vector<UINT> mLastUse;
+	std::vector<bool> mLastWrite;
+};
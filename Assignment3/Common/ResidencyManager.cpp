@@ -0,0 +1,199 @@
+//***************************************************************************************
+// ResidencyManager.cpp
+//***************************************************************************************
+
+#include "ResidencyManager.h"
+#include <algorithm>
+
+const float ResidencyManager::HighWater = 0.95f;
+const float ResidencyManager::LowWater = 0.85f;
+
+ResidencyManager::ResidencyManager(IDXGIAdapter3* adapter, UINT minIdleFrames) :
+	mAdapter(adapter),
+	mMinIdleFrames(minIdleFrames)
+{
+	mInfo.Budget = UINT64_MAX;
+	if(mAdapter == nullptr)
+		return;
+
+	// Without the notification the budget is still polled.
+	mBudgetEvent = CreateEventEx(nullptr, nullptr, 0, EVENT_ALL_ACCESS);
+	if(FAILED(mAdapter->RegisterVideoMemoryBudgetChangeNotificationEvent(mBudgetEvent, &mBudgetCookie)))
+	{
+		CloseHandle(mBudgetEvent);
+		mBudgetEvent = nullptr;
+	}
+
+	QueryBudget();
+}
+
+ResidencyManager::~ResidencyManager()
+{
+	if(mBudgetEvent != nullptr)
+	{
+		mAdapter->UnregisterVideoMemoryBudgetChangeNotification(mBudgetCookie);
+		CloseHandle(mBudgetEvent);
+	}
+}
+
+UINT ResidencyManager::Register()
+{
+	// Pending until the first copy arrives, so nothing is demoted while it streams in.
+	Entry entry;
+	entry.Pending = true;
+	mEntries.push_back(entry);
+	return (UINT)mEntries.size() - 1;
+}
+
+void ResidencyManager::SetResidentBytes(UINT handle, UINT64 bytes, bool demoted)
+{
+	Entry& entry = mEntries[handle];
+	entry.Bytes = bytes;
+	entry.Demoted = demoted;
+	if(entry.Pending)
+	{
+		entry.Pending = false;
+		mLanded = true;
+	}
+	mQueryNeeded = true;
+}
+
+void ResidencyManager::MarkUsed(UINT handle, UINT64 frame)
+{
+	mEntries[handle].LastUsed = frame;
+}
+
+void ResidencyManager::Update(UINT64 frame, UINT64 reclaimableBytes, std::vector<UINT>& demote, std::vector<UINT>& promote)
+{
+	demote.clear();
+	promote.clear();
+
+	if(mAdapter == nullptr)
+		return;
+
+	// The event is auto reset, so a signal is seen once.
+	if(mBudgetEvent != nullptr && WaitForSingleObject(mBudgetEvent, 0) == WAIT_OBJECT_0)
+		mQueryNeeded = true;
+
+	if(mQueryNeeded || frame >= mLastQueryFrame + BudgetPollFrames)
+	{
+		QueryBudget();
+		mLastQueryFrame = frame;
+	}
+	mReclaimableBytes = reclaimableBytes;
+
+	if(mLanded)
+	{
+		mLanded = false;
+		mSettleUntil = frame + SettleFrames;
+	}
+	if(frame < mSettleUntil)
+		return;
+
+	const UINT64 highWater = (UINT64)(mInfo.Budget * (double)HighWater);
+	const UINT64 lowWater = (UINT64)(mInfo.Budget * (double)LowWater);
+	UINT64 projected = ProjectedUsage(reclaimableBytes);
+
+	std::vector<UINT> candidates;
+	if(projected > highWater)
+	{
+		for(UINT i = 0; i < (UINT)mEntries.size(); ++i)
+		{
+			const Entry& entry = mEntries[i];
+			if(!entry.Pending && !entry.Demoted && entry.LastUsed + mMinIdleFrames <= frame)
+				candidates.push_back(i);
+		}
+
+		// Least recently used first.
+		std::sort(candidates.begin(), candidates.end(),
+			[this](UINT a, UINT b) { return mEntries[a].LastUsed < mEntries[b].LastUsed; });
+
+		for(UINT i : candidates)
+		{
+			if(projected <= lowWater)
+				break;
+
+			Entry& entry = mEntries[i];
+			entry.Pending = true;
+			projected -= MathHelper::Min(projected, entry.Bytes - DemotedBytes(entry.Bytes));
+			demote.push_back(i);
+		}
+	}
+	else if(projected < lowWater)
+	{
+		for(UINT i = 0; i < (UINT)mEntries.size(); ++i)
+		{
+			const Entry& entry = mEntries[i];
+			if(!entry.Pending && entry.Demoted && entry.LastUsed + mMinIdleFrames > frame)
+				candidates.push_back(i);
+		}
+
+		// Most recently used first.
+		std::sort(candidates.begin(), candidates.end(),
+			[this](UINT a, UINT b) { return mEntries[a].LastUsed > mEntries[b].LastUsed; });
+
+		for(UINT i : candidates)
+		{
+			// Bytes here is the demoted copy's; the full one is about four times that.
+			Entry& entry = mEntries[i];
+			UINT64 growth = entry.Bytes * 3;
+			if(projected + growth >= lowWater)
+				break;
+
+			entry.Pending = true;
+			projected += growth;
+			promote.push_back(i);
+		}
+	}
+}
+
+bool ResidencyManager::OverBudget()const
+{
+	return Usage() > (UINT64)(mInfo.Budget * (double)HighWater);
+}
+
+UINT64 ResidencyManager::Budget()const
+{
+	return mInfo.Budget;
+}
+
+UINT64 ResidencyManager::Usage()const
+{
+	return mInfo.CurrentUsage - MathHelper::Min(mInfo.CurrentUsage, mReclaimableBytes);
+}
+
+UINT64 ResidencyManager::TrackedBytes()const
+{
+	UINT64 bytes = 0;
+	for(const Entry& entry : mEntries)
+		bytes += entry.Bytes;
+	return bytes;
+}
+
+void ResidencyManager::QueryBudget()
+{
+	mQueryNeeded = false;
+
+	DXGI_QUERY_VIDEO_MEMORY_INFO info = {};
+	if(SUCCEEDED(mAdapter->QueryVideoMemoryInfo(0, DXGI_MEMORY_SEGMENT_GROUP_LOCAL, &info)))
+		mInfo = info;
+}
+
+UINT64 ResidencyManager::ProjectedUsage(UINT64 reclaimableBytes)const
+{
+	UINT64 usage = mInfo.CurrentUsage - MathHelper::Min(mInfo.CurrentUsage, reclaimableBytes);
+
+	// Entries demoted or promoted but not landed yet.  A pending entry that was never
+	// resident has no bytes and changes nothing.
+	for(const Entry& entry : mEntries)
+	{
+		if(!entry.Pending || entry.Bytes == 0)
+			continue;
+
+		if(entry.Demoted)
+			usage += entry.Bytes * 3;
+		else
+			usage -= MathHelper::Min(usage, entry.Bytes - DemotedBytes(entry.Bytes));
+	}
+	return usage;
+}
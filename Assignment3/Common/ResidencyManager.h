@@ -0,0 +1,91 @@
+//***************************************************************************************
+// ResidencyManager.h
+//
+// Decides which textures to demote so the process stays inside the video memory
+// budget the OS gives it.
+//   -The budget and the process's usage come from IDXGIAdapter3::QueryVideoMemoryInfo
+//    for the local segment group.  They are read again when the OS signals a budget
+//    change, after a texture's copy is replaced, and every BudgetPollFrames frames.
+//   -Heap memory the allocator holds but has nothing placed in can be handed out
+//    again without growing, so the caller's reclaimable bytes don't count as used.
+//   -Each texture is registered once and told the bytes of its current copy when
+//    one arrives.  Frames that draw it mark it used.
+//   -Above HighWater of the budget, the least recently used textures that have been
+//    idle for MinIdleFrames are demoted (the caller drops their top mip) until the
+//    usage is projected to fall to LowWater.  Below LowWater, demoted textures used
+//    again are promoted while they still fit under it.
+//   -A texture with a demotion or promotion in flight is left alone until its next
+//    copy arrives, and nothing new is decided for SettleFrames frames after one does,
+//    while the copy it replaced waits for the GPU.  Without IDXGIAdapter3 the budget
+//    is unlimited.
+//***************************************************************************************
+
+#pragma once
+
+#include "d3dUtil.h"
+
+class ResidencyManager
+{
+public:
+	ResidencyManager(IDXGIAdapter3* adapter, UINT minIdleFrames = 300);
+	ResidencyManager(const ResidencyManager& rhs) = delete;
+	ResidencyManager& operator=(const ResidencyManager& rhs) = delete;
+	~ResidencyManager();
+
+	// Returns the handle the other calls take.
+	UINT Register();
+
+	// bytes is the allocation size of the copy now bound; demoted says whether it is
+	// missing its top mip.
+	void SetResidentBytes(UINT handle, UINT64 bytes, bool demoted);
+	void MarkUsed(UINT handle, UINT64 frame);
+
+	// Once per frame.  Fills demote and promote with the handles to act on now.
+	void Update(UINT64 frame, UINT64 reclaimableBytes, std::vector<UINT>& demote, std::vector<UINT>& promote);
+
+	bool OverBudget()const;
+
+	// As of the last Update(); Usage() leaves out the reclaimable bytes.
+	UINT64 Budget()const;
+	UINT64 Usage()const;
+
+	// Sum of the registered textures' current copies.
+	UINT64 TrackedBytes()const;
+
+private:
+	struct Entry
+	{
+		UINT64 Bytes = 0;
+		UINT64 LastUsed = 0;
+		bool Demoted = false;
+		bool Pending = false;
+	};
+
+	void QueryBudget();
+
+	// What the usage will be once every pending demotion and promotion has landed.
+	UINT64 ProjectedUsage(UINT64 reclaimableBytes)const;
+
+	// Dropping the top mip leaves about a quarter of a chain.
+	static UINT64 DemotedBytes(UINT64 fullBytes) { return fullBytes / 4; }
+
+private:
+	static const UINT64 BudgetPollFrames = 30;
+	static const UINT64 SettleFrames = 4;
+	static const float HighWater;
+	static const float LowWater;
+
+	Microsoft::WRL::ComPtr<IDXGIAdapter3> mAdapter;
+	HANDLE mBudgetEvent = nullptr;
+	DWORD mBudgetCookie = 0;
+
+	UINT mMinIdleFrames = 0;
+	UINT64 mLastQueryFrame = 0;
+	UINT64 mSettleUntil = 0;
+	bool mQueryNeeded = true;
+	bool mLanded = false;
+	DXGI_QUERY_VIDEO_MEMORY_INFO mInfo = {};
+	UINT64 mReclaimableBytes = 0;
+
+	std::vector<Entry> mEntries;
+};
@@ -0,0 +1,103 @@
+//***************************************************************************************
+// ResourceStateTracker.cpp
+//***************************************************************************************
+
+#include "ResourceStateTracker.h"
+
+void ResourceStateTracker::Track(ID3D12Resource* resource, D3D12_RESOURCE_STATES state, bool decaysToCommon)
+{
+	Entry& entry = mEntries[resource];
+	entry = Entry();
+	entry.State = state;
+	entry.DecaysToCommon = decaysToCommon;
+}
+
+void ResourceStateTracker::Untrack(ID3D12Resource* resource)
+{
+	mEntries.erase(resource);
+}
+
+void ResourceStateTracker::Transition(ID3D12Resource* resource, D3D12_RESOURCE_STATES after)
+{
+	Entry& entry = Find(resource);
+
+	if(entry.Splitting)
+		EndSplit(resource, entry);
+
+	if(entry.State == after)
+		return;
+
+	mPending.push_back(CD3DX12_RESOURCE_BARRIER::Transition(resource, entry.State, after));
+	entry.State = after;
+}
+
+void ResourceStateTracker::BeginTransition(ID3D12Resource* resource, D3D12_RESOURCE_STATES after)
+{
+	Entry& entry = Find(resource);
+
+	if(entry.Splitting)
+		EndSplit(resource, entry);
+
+	if(entry.State == after)
+		return;
+
+	mPending.push_back(CD3DX12_RESOURCE_BARRIER::Transition(resource, entry.State, after,
+		D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES, D3D12_RESOURCE_BARRIER_FLAG_BEGIN_ONLY));
+	entry.SplitTarget = after;
+	entry.Splitting = true;
+}
+
+void ResourceStateTracker::UavBarrier(ID3D12Resource* resource)
+{
+	mPending.push_back(CD3DX12_RESOURCE_BARRIER::UAV(resource));
+}
+
+void ResourceStateTracker::AliasingBarrier(ID3D12Resource* before, ID3D12Resource* after)
+{
+	mPending.push_back(CD3DX12_RESOURCE_BARRIER::Aliasing(before, after));
+}
+
+void ResourceStateTracker::FlushBarriers(ID3D12GraphicsCommandList* cmdList)
+{
+	if(mPending.empty())
+		return;
+
+	cmdList->ResourceBarrier((UINT)mPending.size(), mPending.data());
+	mPending.clear();
+}
+
+void ResourceStateTracker::OnCommandListsExecuted()
+{
+	assert(mPending.empty());
+
+	for(auto& e : mEntries)
+	{
+		// A split barrier cannot outlive the lists it was recorded into.
+		assert(!e.second.Splitting);
+
+		if(e.second.DecaysToCommon)
+			e.second.State = D3D12_RESOURCE_STATE_COMMON;
+	}
+}
+
+D3D12_RESOURCE_STATES ResourceStateTracker::State(ID3D12Resource* resource)const
+{
+	auto it = mEntries.find(resource);
+	assert(it != mEntries.end());
+	return it->second.Splitting ? it->second.SplitTarget : it->second.State;
+}
+
+ResourceStateTracker::Entry& ResourceStateTracker::Find(ID3D12Resource* resource)
+{
+	auto it = mEntries.find(resource);
+	assert(it != mEntries.end());
+	return it->second;
+}
+
+void ResourceStateTracker::EndSplit(ID3D12Resource* resource, Entry& entry)
+{
+	mPending.push_back(CD3DX12_RESOURCE_BARRIER::Transition(resource, entry.State, entry.SplitTarget,
+		D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES, D3D12_RESOURCE_BARRIER_FLAG_END_ONLY));
+	entry.State = entry.SplitTarget;
+	entry.Splitting = false;
+}
@@ -0,0 +1,59 @@
+//***************************************************************************************
+// ResourceStateTracker.h
+//
+// Remembers the state every tracked resource will be in once the commands recorded so
+// far execute, and turns state requests into the barriers actually needed.
+//   -Transition() queues a barrier only when the state changes.  The queued barriers
+//    go out in one ResourceBarrier call on FlushBarriers().
+//   -BeginTransition() queues the BEGIN_ONLY half of a split barrier; the next
+//    Transition() of that resource queues the END_ONLY half.  Work recorded in
+//    between can overlap the transition.  Keep both halves in one command list.
+//   -Buffers decay to COMMON once the command lists using them finish executing.
+//    Track them with decaysToCommon and call OnCommandListsExecuted() after each
+//    ExecuteCommandLists.
+//   -Only one thread at a time may use a tracker, and the lists have to execute in
+//    the order their transitions were recorded.
+//***************************************************************************************
+
+#pragma once
+
+#include "d3dUtil.h"
+
+class ResourceStateTracker
+{
+public:
+	ResourceStateTracker() = default;
+	ResourceStateTracker(const ResourceStateTracker& rhs) = delete;
+	ResourceStateTracker& operator=(const ResourceStateTracker& rhs) = delete;
+	~ResourceStateTracker() = default;
+
+	// Tracking a resource again replaces what was known about it.
+	void Track(ID3D12Resource* resource, D3D12_RESOURCE_STATES state, bool decaysToCommon = false);
+	void Untrack(ID3D12Resource* resource);
+
+	void Transition(ID3D12Resource* resource, D3D12_RESOURCE_STATES after);
+	void BeginTransition(ID3D12Resource* resource, D3D12_RESOURCE_STATES after);
+	void UavBarrier(ID3D12Resource* resource);
+	void AliasingBarrier(ID3D12Resource* before, ID3D12Resource* after);
+
+	void FlushBarriers(ID3D12GraphicsCommandList* cmdList);
+	void OnCommandListsExecuted();
+
+	D3D12_RESOURCE_STATES State(ID3D12Resource* resource)const;
+
+private:
+	struct Entry
+	{
+		D3D12_RESOURCE_STATES State = D3D12_RESOURCE_STATE_COMMON;
+		D3D12_RESOURCE_STATES SplitTarget = D3D12_RESOURCE_STATE_COMMON;
+		bool Splitting = false;
+		bool DecaysToCommon = false;
+	};
+
+	Entry& Find(ID3D12Resource* resource);
+	void EndSplit(ID3D12Resource* resource, Entry& entry);
+
+private:
+	std::unordered_map<ID3D12Resource*, Entry> mEntries;
+	std::vector<D3D12_RESOURCE_BARRIER> mPending;
+};
@@ -0,0 +1,589 @@
+//***************************************************************************************
+// SceneFile.cpp
+//***************************************************************************************
+
+#include "SceneFile.h"
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <unordered_map>
+
+using namespace DirectX;
+
+namespace
+{
+	const char SceneMagic[4] = { 'S', 'C', 'N', 'B' };
+	const UINT SceneVersion = 2;
+
+	bool CopyName(const std::string& value, char* dst, size_t capacity)
+	{
+		if(value.empty() || value.size() >= capacity)
+			return false;
+
+		memcpy(dst, value.c_str(), value.size() + 1);
+		return true;
+	}
+
+	bool ReadFloats(std::istringstream& in, float* values, int count)
+	{
+		for(int i = 0; i < count; ++i)
+			in >> values[i];
+		return !in.fail();
+	}
+
+	bool ReadFloat3(std::istringstream& in, XMFLOAT3& v)
+	{
+		return ReadFloats(in, &v.x, 3);
+	}
+
+	bool ReadFloat4(std::istringstream& in, XMFLOAT4& v)
+	{
+		return ReadFloats(in, &v.x, 4);
+	}
+
+	// True if nothing but whitespace is left.
+	bool AtEnd(std::istringstream& in)
+	{
+		std::string extra;
+		return !(in >> extra);
+	}
+
+	bool ScatterForest(std::istringstream& in, std::vector<SceneSprite>& sprites)
+	{
+		UINT count = 0;
+		float rect[4], base;
+		XMFLOAT2 size;
+		in >> count;
+		if(!ReadFloats(in, rect, 4) || !ReadFloats(in, &base, 1) || !ReadFloats(in, &size.x, 2))
+			return false;
+
+		// minstd_rand is fully specified, unlike the standard distributions, so every
+		// build scatters the same forest.
+		std::minstd_rand rng((std::uint32_t)sprites.size() + 1);
+		auto unit = [&rng]() { return (float)(rng() - rng.min()) / (float)(rng.max() - rng.min()); };
+
+		for(UINT i = 0; i < count; ++i)
+		{
+			SceneSprite sprite;
+			float scale = 0.75f + 0.5f * unit();
+			sprite.Size = XMFLOAT2(size.x * scale, size.y * scale);
+			sprite.Position.x = rect[0] + (rect[2] - rect[0]) * unit();
+			sprite.Position.z = rect[1] + (rect[3] - rect[1]) * unit();
+			sprite.Position.y = base + 0.5f * sprite.Size.y;
+			sprites.push_back(sprite);
+		}
+
+		return true;
+	}
+
+	bool ParseLight(std::istringstream& in, SceneLight& light)
+	{
+		std::string type;
+		in >> type;
+
+		if(type == "directional")
+		{
+			light.Type = SceneLightType::Directional;
+			return ReadFloat3(in, light.Data.Direction) && ReadFloat3(in, light.Data.Strength);
+		}
+		if(type == "point" || type == "camera")
+		{
+			light.Type = SceneLightType::Point;
+			light.FollowsCamera = type == "camera";
+			if(!light.FollowsCamera && !ReadFloat3(in, light.Data.Position))
+				return false;
+			return ReadFloat3(in, light.Data.Strength) && ReadFloats(in, &light.Data.FalloffStart, 1) &&
+				ReadFloats(in, &light.Data.FalloffEnd, 1);
+		}
+		if(type == "spot")
+		{
+			light.Type = SceneLightType::Spot;
+			return ReadFloat3(in, light.Data.Position) && ReadFloat3(in, light.Data.Direction) &&
+				ReadFloat3(in, light.Data.Strength) && ReadFloats(in, &light.Data.FalloffStart, 1) &&
+				ReadFloats(in, &light.Data.FalloffEnd, 1) && ReadFloats(in, &light.Data.SpotPower, 1);
+		}
+
+		return false;
+	}
+
+	size_t AlignUp(size_t size)
+	{
+		return (size + 15) & ~size_t(15);
+	}
+
+	template<size_t N>
+	bool Terminated(const char (&name)[N])
+	{
+		return memchr(name, '\0', N) != nullptr;
+	}
+}
+
+bool ParseScene(const std::string& text, SceneDescription& scene, std::string& error)
+{
+	std::unordered_map<std::string, UINT> nodeIndex;
+	auto parentIndex = [&nodeIndex](const std::string& name, UINT& parent)
+	{
+		if(name == "tile")
+		{
+			parent = SceneNoParent;
+			return true;
+		}
+
+		auto it = nodeIndex.find(name);
+		if(it == nodeIndex.end())
+			return false;
+
+		parent = it->second;
+		return true;
+	};
+
+	std::istringstream lines(text);
+	std::string line;
+	for(int lineNumber = 1; std::getline(lines, line); ++lineNumber)
+	{
+		line = line.substr(0, line.find('#'));
+
+		std::istringstream in(line);
+		std::string keyword;
+		if(!(in >> keyword))
+			continue;
+
+		bool ok = false;
+		if(keyword == "texture")
+		{
+			SceneTexture texture;
+			std::string name, file, flag;
+			in >> name >> file;
+			if(in >> flag)
+				texture.IsArray = flag == "array";
+			ok = CopyName(name, texture.Name, SceneNameLength) && CopyName(file, texture.File, SceneFileLength) &&
+				(flag.empty() || texture.IsArray);
+			scene.Textures.push_back(texture);
+		}
+		else if(keyword == "material")
+		{
+			SceneMaterial material;
+			std::string name, texture;
+			in >> name >> texture;
+			ok = CopyName(name, material.Name, SceneNameLength) && CopyName(texture, material.Texture, SceneNameLength) &&
+				ReadFloat4(in, material.DiffuseAlbedo) && ReadFloat3(in, material.FresnelR0) &&
+				ReadFloats(in, &material.Roughness, 1);
+			scene.Materials.push_back(material);
+		}
+		else if(keyword == "light")
+		{
+			SceneLight light;
+			ok = ParseLight(in, light);
+			scene.Lights.push_back(light);
+		}
+		else if(keyword == "ambient")
+		{
+			ok = ReadFloat4(in, scene.Environment.AmbientLight);
+		}
+		else if(keyword == "fog")
+		{
+			ok = ReadFloat4(in, scene.Environment.FogColor) && ReadFloats(in, &scene.Environment.FogStart, 1) &&
+				ReadFloats(in, &scene.Environment.FogRange, 1);
+		}
+		else if(keyword == "node")
+		{
+			SceneNode node;
+			std::string name, parent, flag;
+			in >> name >> parent;
+			ok = CopyName(name, node.Name, SceneNameLength) && name != "tile" && nodeIndex.count(name) == 0 &&
+				parentIndex(parent, node.Parent) && ReadFloat3(in, node.Translation);
+			if(in >> flag)
+			{
+				node.Flags = flag == "portcullis" ? SceneNodePortcullis : flag == "drawbridge" ? SceneNodeDrawbridge : 0;
+				ok = ok && node.Flags != 0;
+			}
+			nodeIndex[name] = (UINT)scene.Nodes.size();
+			scene.Nodes.push_back(node);
+		}
+		else if(keyword == "object")
+		{
+			SceneObject object;
+			std::string mesh, material, layer, parent;
+			in >> mesh >> material >> layer >> parent;
+			object.Layer = layer == "transparent" ? SceneLayer::Transparent : SceneLayer::Opaque;
+			ok = CopyName(mesh, object.Mesh, SceneNameLength) && CopyName(material, object.Material, SceneNameLength) &&
+				(layer == "opaque" || layer == "transparent") && parentIndex(parent, object.Parent) &&
+				ReadFloat3(in, object.Scale) && ReadFloat3(in, object.Position) && ReadFloats(in, &object.TexScale.x, 2);
+
+			// The rotation is optional; running out of input here is fine, a word is not.
+			if(ok)
+				ok = (in >> object.Rotation.x) ? ReadFloats(in, &object.Rotation.y, 2) : in.eof();
+			scene.Objects.push_back(object);
+		}
+		else if(keyword == "sprites")
+		{
+			std::string material;
+			in >> material;
+			ok = CopyName(material, scene.Environment.SpriteMaterial, SceneNameLength);
+		}
+		else if(keyword == "sprite")
+		{
+			SceneSprite sprite;
+			ok = ReadFloat3(in, sprite.Position) && ReadFloats(in, &sprite.Size.x, 2);
+			scene.Sprites.push_back(sprite);
+		}
+		else if(keyword == "forest")
+		{
+			ok = ScatterForest(in, scene.Sprites);
+		}
+
+		if(!ok || !AtEnd(in))
+		{
+			error = "line " + std::to_string(lineNumber) + ": " + line;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+std::uint64_t HashSceneSource(const std::string& text, std::uint64_t buildKey)
+{
+	std::uint64_t hash = d3dUtil::HashBytes(&buildKey, sizeof(buildKey));
+	return d3dUtil::HashBytes(text.data(), text.size(), hash);
+}
+
+SceneBinary::~SceneBinary()
+{
+	Close();
+}
+
+bool SceneBinary::Open(const std::wstring& filename)
+{
+	Close();
+
+	mFile = CreateFileW(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if(mFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if(!GetFileSizeEx(mFile, &size) || size.QuadPart < (LONGLONG)sizeof(Header))
+	{
+		Close();
+		return false;
+	}
+
+	mMapping = CreateFileMappingW(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if(mMapping != nullptr)
+		mData = static_cast<const std::uint8_t*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+
+	mSize = (size_t)size.QuadPart;
+	if(mData == nullptr || !Validate())
+	{
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+void SceneBinary::Build(const SceneDescription& scene, std::uint64_t sourceHash)
+{
+	Close();
+
+	struct Blob
+	{
+		const void* Data;
+		size_t ByteSize;
+	};
+
+	Blob blobs[SectionCount];
+	blobs[EnvironmentSection] = { &scene.Environment, sizeof(SceneEnvironment) };
+	blobs[TextureSection] = { scene.Textures.data(), scene.Textures.size() * sizeof(SceneTexture) };
+	blobs[MaterialSection] = { scene.Materials.data(), scene.Materials.size() * sizeof(SceneMaterial) };
+	blobs[LightSection] = { scene.Lights.data(), scene.Lights.size() * sizeof(SceneLight) };
+	blobs[NodeSection] = { scene.Nodes.data(), scene.Nodes.size() * sizeof(SceneNode) };
+	blobs[ObjectSection] = { scene.Objects.data(), scene.Objects.size() * sizeof(SceneObject) };
+	blobs[SpriteSection] = { scene.Sprites.data(), scene.Sprites.size() * sizeof(SceneSprite) };
+	blobs[SubmeshSection] = { scene.Submeshes.data(), scene.Submeshes.size() * sizeof(SceneSubmesh) };
+	blobs[MeshletSection] = { scene.Meshlets.data(), scene.Meshlets.size() * sizeof(Meshlet) };
+	blobs[VertexSection] = { scene.Vertices.data(), scene.Vertices.size() };
+	blobs[IndexSection] = { scene.Indices.data(), scene.Indices.size() };
+
+	Header header = {};
+	memcpy(header.Magic, SceneMagic, sizeof(SceneMagic));
+	header.Version = SceneVersion;
+	header.SourceHash = sourceHash;
+	header.VertexStride = scene.VertexStride;
+	header.IndexFormat = (UINT)scene.IndexFormat;
+
+	size_t offset = AlignUp(sizeof(Header));
+	for(int i = 0; i < SectionCount; ++i)
+	{
+		header.Sections[i].Offset = offset;
+		header.Sections[i].ByteSize = blobs[i].ByteSize;
+		offset = AlignUp(offset + blobs[i].ByteSize);
+	}
+
+	mOwned.assign(offset, 0);
+	memcpy(mOwned.data(), &header, sizeof(Header));
+	for(int i = 0; i < SectionCount; ++i)
+	{
+		if(blobs[i].ByteSize > 0)
+			memcpy(mOwned.data() + header.Sections[i].Offset, blobs[i].Data, blobs[i].ByteSize);
+	}
+
+	mData = mOwned.data();
+	mSize = mOwned.size();
+	mHeader = reinterpret_cast<const Header*>(mData);
+}
+
+bool SceneBinary::Save(const std::wstring& filename)const
+{
+	std::ofstream fout(filename, std::ios::binary);
+	if(!fout)
+		return false;
+
+	fout.write(reinterpret_cast<const char*>(mData), mSize);
+	return fout.good();
+}
+
+void SceneBinary::Close()
+{
+	if(mMapping != nullptr)
+	{
+		if(mData != nullptr)
+			UnmapViewOfFile(mData);
+		CloseHandle(mMapping);
+		mMapping = nullptr;
+	}
+
+	if(mFile != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(mFile);
+		mFile = INVALID_HANDLE_VALUE;
+	}
+
+	mOwned.clear();
+	mData = nullptr;
+	mSize = 0;
+	mHeader = nullptr;
+	mGeometryReleased = false;
+}
+
+void SceneBinary::ReleaseGeometry()
+{
+	if(mData == nullptr || mGeometryReleased)
+		return;
+
+	// Build() lays the vertex and index blobs out last.
+	size_t recordBytes = (size_t)mHeader->Sections[VertexSection].Offset;
+	for(int i = 0; i < VertexSection; ++i)
+	{
+		if(mHeader->Sections[i].Offset + mHeader->Sections[i].ByteSize > recordBytes)
+			return;
+	}
+
+	if(mMapping != nullptr)
+	{
+		// Keep the old view if a smaller one can't be had; it is only address space.
+		const std::uint8_t* records = static_cast<const std::uint8_t*>(
+			MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, recordBytes));
+		if(records == nullptr)
+			return;
+
+		UnmapViewOfFile(mData);
+		mData = records;
+	}
+	else
+	{
+		mOwned.resize(recordBytes);
+		mOwned.shrink_to_fit();
+		mData = mOwned.data();
+	}
+
+	mSize = recordBytes;
+	mHeader = reinterpret_cast<const Header*>(mData);
+	mGeometryReleased = true;
+}
+
+bool SceneBinary::Validate()
+{
+	mHeader = reinterpret_cast<const Header*>(mData);
+	if(memcmp(mHeader->Magic, SceneMagic, sizeof(SceneMagic)) != 0 || mHeader->Version != SceneVersion)
+		return false;
+
+	for(int i = 0; i < SectionCount; ++i)
+	{
+		const SectionEntry& section = mHeader->Sections[i];
+		if(section.Offset % 16 != 0 || section.Offset > mSize || section.ByteSize > mSize - section.Offset)
+			return false;
+	}
+
+	if(mHeader->Sections[EnvironmentSection].ByteSize != sizeof(SceneEnvironment))
+		return false;
+
+	// The records are used in place, so a stale or damaged file must not get past
+	// here with an unterminated name or an index that reads outside its section.
+	// A node's parent comes before it, as ParseScene() has it.
+	if(!Terminated(Environment().SpriteMaterial))
+		return false;
+
+	for(const SceneTexture& texture : Textures())
+	{
+		if(!Terminated(texture.Name) || !Terminated(texture.File))
+			return false;
+	}
+
+	for(const SceneMaterial& material : Materials())
+	{
+		if(!Terminated(material.Name) || !Terminated(material.Texture))
+			return false;
+	}
+
+	for(const SceneLight& light : Lights())
+	{
+		if(light.Type != SceneLightType::Directional && light.Type != SceneLightType::Point &&
+			light.Type != SceneLightType::Spot)
+			return false;
+	}
+
+	const SceneSpan<SceneNode> nodes = Nodes();
+	for(UINT i = 0; i < nodes.Count; ++i)
+	{
+		if(!Terminated(nodes[i].Name) || (nodes[i].Parent != SceneNoParent && nodes[i].Parent >= i))
+			return false;
+	}
+
+	for(const SceneObject& object : Objects())
+	{
+		if(!Terminated(object.Mesh) || !Terminated(object.Material) ||
+			(object.Layer != SceneLayer::Opaque && object.Layer != SceneLayer::Transparent) ||
+			(object.Parent != SceneNoParent && object.Parent >= nodes.Count))
+			return false;
+	}
+
+	// The geometry is read in place on the CPU too, for the ray BVHs and the lightmap
+	// UVs, so every submesh's indices, the vertices they reach and its meshlets'
+	// index ranges must lie inside the blobs.
+	const UINT indexFormat = mHeader->IndexFormat;
+	if(indexFormat != DXGI_FORMAT_R16_UINT && indexFormat != DXGI_FORMAT_R32_UINT)
+		return false;
+
+	const UINT stride = mHeader->VertexStride;
+	const UINT64 vertexBytes = mHeader->Sections[VertexSection].ByteSize;
+	if(stride == 0 || stride % 4 != 0 || vertexBytes % stride != 0)
+		return false;
+
+	const UINT indexSize = indexFormat == DXGI_FORMAT_R32_UINT ? 4 : 2;
+	const UINT64 vertexCount = vertexBytes / stride;
+	const UINT64 indexCount = mHeader->Sections[IndexSection].ByteSize / indexSize;
+	const std::uint8_t* indices = mData + mHeader->Sections[IndexSection].Offset;
+	const SceneSpan<Meshlet> meshlets = Meshlets();
+	for(const SceneSubmesh& submesh : Submeshes())
+	{
+		if(!Terminated(submesh.Name) || submesh.BaseVertexLocation < 0 ||
+			(UINT64)submesh.StartIndexLocation + submesh.IndexCount > indexCount ||
+			(UINT64)submesh.FirstMeshlet + submesh.MeshletCount > meshlets.Count)
+			return false;
+
+		UINT maxIndex = 0;
+		for(UINT i = submesh.StartIndexLocation; i < submesh.StartIndexLocation + submesh.IndexCount; ++i)
+		{
+			const UINT index = indexSize == 4 ? reinterpret_cast<const std::uint32_t*>(indices)[i] :
+				reinterpret_cast<const std::uint16_t*>(indices)[i];
+			maxIndex = index > maxIndex ? index : maxIndex;
+		}
+		if(submesh.IndexCount > 0 && (UINT64)submesh.BaseVertexLocation + maxIndex >= vertexCount)
+			return false;
+
+		for(UINT m = submesh.FirstMeshlet; m < submesh.FirstMeshlet + submesh.MeshletCount; ++m)
+		{
+			if((UINT64)meshlets[m].FirstIndex + meshlets[m].IndexCount > submesh.IndexCount)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+std::uint64_t SceneBinary::SourceHash()const
+{
+	return mHeader->SourceHash;
+}
+
+const SceneEnvironment& SceneBinary::Environment()const
+{
+	return *Records<SceneEnvironment>(EnvironmentSection).Data;
+}
+
+SceneSpan<SceneTexture> SceneBinary::Textures()const
+{
+	return Records<SceneTexture>(TextureSection);
+}
+
+SceneSpan<SceneMaterial> SceneBinary::Materials()const
+{
+	return Records<SceneMaterial>(MaterialSection);
+}
+
+SceneSpan<SceneLight> SceneBinary::Lights()const
+{
+	return Records<SceneLight>(LightSection);
+}
+
+SceneSpan<SceneNode> SceneBinary::Nodes()const
+{
+	return Records<SceneNode>(NodeSection);
+}
+
+SceneSpan<SceneObject> SceneBinary::Objects()const
+{
+	return Records<SceneObject>(ObjectSection);
+}
+
+SceneSpan<SceneSprite> SceneBinary::Sprites()const
+{
+	return Records<SceneSprite>(SpriteSection);
+}
+
+SceneSpan<SceneSubmesh> SceneBinary::Submeshes()const
+{
+	return Records<SceneSubmesh>(SubmeshSection);
+}
+
+SceneSpan<Meshlet> SceneBinary::Meshlets()const
+{
+	return Records<Meshlet>(MeshletSection);
+}
+
+UINT SceneBinary::VertexStride()const
+{
+	return mHeader->VertexStride;
+}
+
+DXGI_FORMAT SceneBinary::IndexFormat()const
+{
+	return (DXGI_FORMAT)mHeader->IndexFormat;
+}
+
+const void* SceneBinary::VertexData()const
+{
+	if(mGeometryReleased)
+		return nullptr;
+	return mData + mHeader->Sections[VertexSection].Offset;
+}
+
+UINT SceneBinary::VertexDataSize()const
+{
+	return (UINT)mHeader->Sections[VertexSection].ByteSize;
+}
+
+const void* SceneBinary::IndexData()const
+{
+	if(mGeometryReleased)
+		return nullptr;
+	return mData + mHeader->Sections[IndexSection].Offset;
+}
+
+UINT SceneBinary::IndexDataSize()const
+{
+	return (UINT)mHeader->Sections[IndexSection].ByteSize;
+}
@@ -0,0 +1,264 @@
+//***************************************************************************************
+// SceneFile.h
+//
+// Data-driven scenes: a text description and the binary it compiles to.
+//   -The text form is read by ParseScene(), one record per line, '#' starts a comment:
+//        texture  NAME FILE [array]
+//        material NAME TEXTURE  r g b a  fr fg fb  roughness
+//        light directional  dx dy dz  r g b
+//        light point  x y z  r g b  falloffStart falloffEnd
+//        light spot   x y z  dx dy dz  r g b  falloffStart falloffEnd spotPower
+//        light camera  r g b  falloffStart falloffEnd        (a point light on the eye)
+//        ambient  r g b a
+//        fog  r g b a  start range
+//        node  NAME PARENT  x y z  [portcullis|drawbridge]
+//        object  MESH MATERIAL opaque|transparent PARENT  sx sy sz  x y z  u v  [rx ry rz]
+//        sprites MATERIAL
+//        sprite  x y z  width height
+//        forest  count  x0 z0 x1 z1  y  width height
+//    PARENT is an earlier node or "tile", the root the scene is instanced under.
+//    Rotations are in degrees.  A forest scatters count sprites over the rectangle,
+//    standing on y, each a quarter bigger or smaller at most.  The scatter is seeded
+//    by the sprites before it, so the same text always places the same trees.
+//   -The application bakes the geometry the objects refer to into the description
+//    and SceneBinary::Build() lays everything out as fixed-size records and raw
+//    vertex/index blobs, 16-byte aligned, behind a table of sections.  Open() maps a
+//    compiled file read-only, so the records are used in place and each blob goes
+//    to the GPU with a single copy.  It fails on a file whose names aren't
+//    terminated, whose parents and enums are out of range, or whose submeshes'
+//    index, vertex and meshlet ranges run past the blobs.
+//   -ReleaseGeometry() drops the vertex/index blobs once they are on the GPU; the
+//    records stay.  The mapped view shrinks to the records, or the owned copy does.
+//   -SourceHash() is the hash the binary was built from.  A mismatch with
+//    HashSceneSource() for the current text (and build key) means it is stale.
+//***************************************************************************************
+
+#pragma once
+
+#include "d3dUtil.h"
+#include "MeshletBuilder.h"
+
+const UINT SceneNameLength = 32;
+const UINT SceneFileLength = 128;
+const UINT SceneNoParent = 0xFFFFFFFF;
+
+enum class SceneLayer : UINT
+{
+	Opaque = 0,
+	Transparent
+};
+
+enum class SceneLightType : UINT
+{
+	Directional = 0,
+	Point,
+	Spot
+};
+
+enum SceneNodeFlags : UINT
+{
+	SceneNodePortcullis = 0x1,
+	SceneNodeDrawbridge = 0x2
+};
+
+struct SceneTexture
+{
+	char Name[SceneNameLength] = {};
+	char File[SceneFileLength] = {};
+	UINT IsArray = 0;
+};
+
+struct SceneMaterial
+{
+	char Name[SceneNameLength] = {};
+	char Texture[SceneNameLength] = {};
+	DirectX::XMFLOAT4 DiffuseAlbedo = { 1.0f, 1.0f, 1.0f, 1.0f };
+	DirectX::XMFLOAT3 FresnelR0 = { 0.01f, 0.01f, 0.01f };
+	float Roughness = 0.25f;
+};
+
+struct SceneLight
+{
+	SceneLightType Type = SceneLightType::Directional;
+	UINT FollowsCamera = 0;
+	Light Data;
+};
+
+struct SceneNode
+{
+	char Name[SceneNameLength] = {};
+	UINT Parent = SceneNoParent;
+	UINT Flags = 0;
+	DirectX::XMFLOAT3 Translation = { 0.0f, 0.0f, 0.0f };
+};
+
+struct SceneObject
+{
+	char Mesh[SceneNameLength] = {};
+	char Material[SceneNameLength] = {};
+	SceneLayer Layer = SceneLayer::Opaque;
+	UINT Parent = SceneNoParent;
+	DirectX::XMFLOAT3 Scale = { 1.0f, 1.0f, 1.0f };
+	DirectX::XMFLOAT3 Position = { 0.0f, 0.0f, 0.0f };
+	DirectX::XMFLOAT3 Rotation = { 0.0f, 0.0f, 0.0f };
+	DirectX::XMFLOAT2 TexScale = { 1.0f, 1.0f };
+};
+
+// Also the layout TreeCull.hlsl reads the sprites with.
+struct SceneSprite
+{
+	DirectX::XMFLOAT3 Position = { 0.0f, 0.0f, 0.0f };
+	DirectX::XMFLOAT2 Size = { 1.0f, 1.0f };
+};
+
+struct SceneEnvironment
+{
+	DirectX::XMFLOAT4 AmbientLight = { 0.0f, 0.0f, 0.0f, 1.0f };
+	DirectX::XMFLOAT4 FogColor = { 0.7f, 0.7f, 0.7f, 1.0f };
+	float FogStart = 5.0f;
+	float FogRange = 150.0f;
+	char SpriteMaterial[SceneNameLength] = {};
+};
+
+struct SceneSubmesh
+{
+	char Name[SceneNameLength] = {};
+	UINT IndexCount = 0;
+	UINT StartIndexLocation = 0;
+	INT BaseVertexLocation = 0;
+	DirectX::XMFLOAT3 BoundsCenter = { 0.0f, 0.0f, 0.0f };
+	DirectX::XMFLOAT3 BoundsExtents = { 0.0f, 0.0f, 0.0f };
+
+	// The submesh's range of the meshlet list.  Their index ranges are relative to
+	// StartIndexLocation.
+	UINT FirstMeshlet = 0;
+	UINT MeshletCount = 0;
+};
+
+// Editable form of a scene.  The geometry is left to the application.
+struct SceneDescription
+{
+	SceneEnvironment Environment;
+	std::vector<SceneTexture> Textures;
+	std::vector<SceneMaterial> Materials;
+	std::vector<SceneLight> Lights;
+	std::vector<SceneNode> Nodes;
+	std::vector<SceneObject> Objects;
+	std::vector<SceneSprite> Sprites;
+
+	UINT VertexStride = 0;
+	DXGI_FORMAT IndexFormat = DXGI_FORMAT_R16_UINT;
+	std::vector<std::uint8_t> Vertices;
+	std::vector<std::uint8_t> Indices;
+	std::vector<SceneSubmesh> Submeshes;
+	std::vector<Meshlet> Meshlets;
+};
+
+// error names the offending line when parsing fails.
+bool ParseScene(const std::string& text, SceneDescription& scene, std::string& error);
+
+// buildKey stands for whatever else goes into the binary, e.g. the vertex format.
+std::uint64_t HashSceneSource(const std::string& text, std::uint64_t buildKey);
+
+template<typename T>
+struct SceneSpan
+{
+	const T* Data = nullptr;
+	UINT Count = 0;
+
+	const T* begin()const { return Data; }
+	const T* end()const { return Data + Count; }
+	const T& operator[](UINT i)const { return Data[i]; }
+};
+
+class SceneBinary
+{
+public:
+	SceneBinary() = default;
+	SceneBinary(const SceneBinary& rhs) = delete;
+	SceneBinary& operator=(const SceneBinary& rhs) = delete;
+	~SceneBinary();
+
+	// False if the file is missing or not a compiled scene of this version.
+	bool Open(const std::wstring& filename);
+	void Build(const SceneDescription& scene, std::uint64_t sourceHash);
+	bool Save(const std::wstring& filename)const;
+	void Close();
+
+	// VertexData() and IndexData() return nullptr afterwards; Save() has to come first.
+	void ReleaseGeometry();
+
+	std::uint64_t SourceHash()const;
+
+	const SceneEnvironment& Environment()const;
+	SceneSpan<SceneTexture> Textures()const;
+	SceneSpan<SceneMaterial> Materials()const;
+	SceneSpan<SceneLight> Lights()const;
+	SceneSpan<SceneNode> Nodes()const;
+	SceneSpan<SceneObject> Objects()const;
+	SceneSpan<SceneSprite> Sprites()const;
+	SceneSpan<SceneSubmesh> Submeshes()const;
+	SceneSpan<Meshlet> Meshlets()const;
+
+	UINT VertexStride()const;
+	DXGI_FORMAT IndexFormat()const;
+	const void* VertexData()const;
+	UINT VertexDataSize()const;
+	const void* IndexData()const;
+	UINT IndexDataSize()const;
+
+private:
+	enum Section : UINT
+	{
+		EnvironmentSection = 0,
+		TextureSection,
+		MaterialSection,
+		LightSection,
+		NodeSection,
+		ObjectSection,
+		SpriteSection,
+		SubmeshSection,
+		MeshletSection,
+		VertexSection,
+		IndexSection,
+		SectionCount
+	};
+
+	struct SectionEntry
+	{
+		UINT64 Offset;
+		UINT64 ByteSize;
+	};
+
+	struct Header
+	{
+		char Magic[4];
+		UINT Version;
+		std::uint64_t SourceHash;
+		UINT VertexStride;
+		UINT IndexFormat;
+		SectionEntry Sections[SectionCount];
+	};
+
+	bool Validate();
+
+	template<typename T>
+	SceneSpan<T> Records(Section section)const
+	{
+		SceneSpan<T> span;
+		span.Data = reinterpret_cast<const T*>(mData + mHeader->Sections[section].Offset);
+		span.Count = (UINT)(mHeader->Sections[section].ByteSize / sizeof(T));
+		return span;
+	}
+
+	// Either a mapped file or mOwned.
+	const std::uint8_t* mData = nullptr;
+	size_t mSize = 0;
+	const Header* mHeader = nullptr;
+	std::vector<std::uint8_t> mOwned;
+
+	HANDLE mFile = INVALID_HANDLE_VALUE;
+	HANDLE mMapping = nullptr;
+
+	bool mGeometryReleased = false;
+};
@@ -0,0 +1,61 @@
+//***************************************************************************************
+// SceneGraph.cpp
+//***************************************************************************************
+
+#include "SceneGraph.h"
+
+using namespace DirectX;
+
+std::uint32_t SceneGraph::AddNode(std::uint32_t parent, const XMFLOAT4X4& local)
+{
+	assert(parent == NoParent || parent < NodeCount());
+
+	std::uint32_t node = NodeCount();
+	mParent.push_back(parent);
+	mLocal.push_back(local);
+	mWorld.push_back(local);
+	mDirty.push_back(1);
+
+	if(mFirstDirty == NoParent || node < mFirstDirty)
+		mFirstDirty = node;
+
+	return node;
+}
+
+void SceneGraph::Clear()
+{
+	mParent.clear();
+	mLocal.clear();
+	mWorld.clear();
+	mDirty.clear();
+	mFirstDirty = NoParent;
+}
+
+void SceneGraph::SetLocal(std::uint32_t node, const XMFLOAT4X4& local)
+{
+	mLocal[node] = local;
+	mDirty[node] = 1;
+
+	if(mFirstDirty == NoParent || node < mFirstDirty)
+		mFirstDirty = node;
+}
+
+const XMFLOAT4X4& SceneGraph::Local(std::uint32_t node)const
+{
+	return mLocal[node];
+}
+
+const XMFLOAT4X4& SceneGraph::World(std::uint32_t node)const
+{
+	return mWorld[node];
+}
+
+std::uint32_t SceneGraph::Parent(std::uint32_t node)const
+{
+	return mParent[node];
+}
+
+std::uint32_t SceneGraph::NodeCount()const
+{
+	return (std::uint32_t)mParent.size();
+}
@@ -0,0 +1,83 @@
+//***************************************************************************************
+// SceneGraph.h
+//
+// Parent/child transform hierarchy.
+//   -Nodes live in flat arrays and are added after their parent, so the arrays are
+//    always topologically sorted and one forward pass sees every parent before its
+//    children.
+//   -SetLocal() only marks the node dirty.  Update() recomputes the world matrices
+//    of the dirty nodes and everything below them, starting from the first dirty
+//    node, and reports each changed node so the caller can forward it (e.g. to a
+//    TransformStore).  With nothing dirty Update() returns straight away.
+//***************************************************************************************
+
+#pragma once
+
+#include <DirectXMath.h>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+class SceneGraph
+{
+public:
+	static const std::uint32_t NoParent = 0xFFFFFFFF;
+
+	SceneGraph() = default;
+	SceneGraph(const SceneGraph& rhs) = delete;
+	SceneGraph& operator=(const SceneGraph& rhs) = delete;
+	~SceneGraph() = default;
+
+	// local is relative to the parent's world matrix.
+	std::uint32_t AddNode(std::uint32_t parent, const DirectX::XMFLOAT4X4& local);
+	void Clear();
+
+	void SetLocal(std::uint32_t node, const DirectX::XMFLOAT4X4& local);
+
+	const DirectX::XMFLOAT4X4& Local(std::uint32_t node)const;
+
+	// Up to date as of the last Update().
+	const DirectX::XMFLOAT4X4& World(std::uint32_t node)const;
+
+	std::uint32_t Parent(std::uint32_t node)const;
+	std::uint32_t NodeCount()const;
+
+	// Calls onWorldChanged(node, world) for every node whose world matrix was recomputed.
+	template<typename Fn>
+	void Update(Fn&& onWorldChanged)
+	{
+		const std::uint32_t nodeCount = NodeCount();
+		if(mFirstDirty >= nodeCount)
+			return;
+
+		for(std::uint32_t i = mFirstDirty; i < nodeCount; ++i)
+		{
+			// Parents come first, so a dirty parent has already flagged itself below.
+			std::uint32_t parent = mParent[i];
+			if(!mDirty[i] && (parent == NoParent || !mDirty[parent]))
+				continue;
+
+			mDirty[i] = 1;
+
+			DirectX::XMMATRIX world = DirectX::XMLoadFloat4x4(&mLocal[i]);
+			if(parent != NoParent)
+				world = DirectX::XMMatrixMultiply(world, DirectX::XMLoadFloat4x4(&mWorld[parent]));
+			DirectX::XMStoreFloat4x4(&mWorld[i], world);
+
+			onWorldChanged(i, mWorld[i]);
+		}
+
+		for(std::uint32_t i = mFirstDirty; i < nodeCount; ++i)
+			mDirty[i] = 0;
+		mFirstDirty = NoParent;
+	}
+
+private:
+	std::vector<std::uint32_t> mParent;
+	std::vector<DirectX::XMFLOAT4X4> mLocal;
+	std::vector<DirectX::XMFLOAT4X4> mWorld;
+	std::vector<std::uint8_t> mDirty;
+
+	// Nothing before this index needs recomputing.
+	std::uint32_t mFirstDirty = NoParent;
+};
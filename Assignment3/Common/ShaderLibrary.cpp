@@ -0,0 +1,212 @@
+//***************************************************************************************
+// ShaderLibrary.cpp
+//***************************************************************************************
+
+#include "ShaderLibrary.h"
+#include <iterator>
+
+using Microsoft::WRL::ComPtr;
+
+namespace
+{
+#if defined(DEBUG) || defined(_DEBUG)
+	// d3dUtil::CompileShader builds unoptimized shaders with debug info in debug builds.
+	const char BuildFlavour[] = "debug";
+#else
+	const char BuildFlavour[] = "release";
+#endif
+
+	bool FileExists(const std::wstring& filename)
+	{
+		return GetFileAttributesW(filename.c_str()) != INVALID_FILE_ATTRIBUTES;
+	}
+
+	std::uint64_t HashString(const std::string& str, std::uint64_t seed)
+	{
+		// The terminator keeps "ab" + "c" apart from "a" + "bc".
+		return d3dUtil::HashBytes(str.c_str(), str.size() + 1, seed);
+	}
+
+	std::wstring DirectoryOf(const std::wstring& filename)
+	{
+		size_t slash = filename.find_last_of(L"\\/");
+		return slash == std::wstring::npos ? std::wstring() : filename.substr(0, slash + 1);
+	}
+}
+
+ShaderLibrary::ShaderLibrary(const std::wstring& precompiledDirectory, const std::wstring& cacheDirectory) :
+	mPrecompiledDirectory(precompiledDirectory),
+	mCacheDirectory(cacheDirectory)
+{
+}
+
+void ShaderLibrary::AddProgram(const std::string& name, const std::wstring& filename,
+	const std::string& entryPoint, const std::string& target,
+	const std::vector<ShaderDefine>& defines,
+	const std::vector<std::string>& options)
+{
+	assert(mProgramIndex.count(name) == 0);
+	assert(options.size() < 32);
+
+	mProgramIndex[name] = mPrograms.size();
+	mPrograms.push_back({ name, filename, entryPoint, target, defines, options });
+}
+
+ComPtr<ID3DBlob> ShaderLibrary::Get(const std::string& name, const std::vector<std::string>& options)
+{
+	const Program& program = FindProgram(name);
+	const UINT optionMask = OptionMask(program, options);
+	const std::uint64_t key = PermutationKey(program, optionMask);
+
+	std::wstring precompiled = PermutationFile(mPrecompiledDirectory, program, key);
+	if(FileExists(precompiled))
+		return d3dUtil::LoadBinary(precompiled);
+
+	std::wstring cached = PermutationFile(mCacheDirectory, program, key);
+	if(FileExists(cached))
+		return d3dUtil::LoadBinary(cached);
+
+	ComPtr<ID3DBlob> byteCode = Compile(program, optionMask);
+
+	// The cache only saves time, so failing to write it is not an error.
+	CreateDirectoryW(mCacheDirectory.c_str(), nullptr);
+	D3DWriteBlobToFile(byteCode.Get(), cached.c_str(), TRUE);
+
+	return byteCode;
+}
+
+std::uint64_t ShaderLibrary::Key(const std::string& name, const std::vector<std::string>& options)
+{
+	const Program& program = FindProgram(name);
+	return PermutationKey(program, OptionMask(program, options));
+}
+
+void ShaderLibrary::ForgetSources()
+{
+	mSourceHashes.clear();
+}
+
+UINT ShaderLibrary::CompileAll()
+{
+	CreateDirectoryW(mPrecompiledDirectory.c_str(), nullptr);
+
+	UINT count = 0;
+	for(const Program& program : mPrograms)
+	{
+		for(UINT optionMask = 0; optionMask < (1u << program.Options.size()); ++optionMask)
+		{
+			ComPtr<ID3DBlob> byteCode = Compile(program, optionMask);
+
+			std::wstring filename = PermutationFile(mPrecompiledDirectory, program, PermutationKey(program, optionMask));
+			ThrowIfFailed(D3DWriteBlobToFile(byteCode.Get(), filename.c_str(), TRUE));
+			++count;
+		}
+	}
+
+	return count;
+}
+
+const ShaderLibrary::Program& ShaderLibrary::FindProgram(const std::string& name)const
+{
+	auto it = mProgramIndex.find(name);
+	assert(it != mProgramIndex.end());
+	return mPrograms[it->second];
+}
+
+UINT ShaderLibrary::OptionMask(const Program& program, const std::vector<std::string>& options)const
+{
+	UINT optionMask = 0;
+	for(const std::string& option : options)
+	{
+		auto found = std::find(program.Options.begin(), program.Options.end(), option);
+		assert(found != program.Options.end());
+		optionMask |= 1u << (UINT)(found - program.Options.begin());
+	}
+	return optionMask;
+}
+
+std::vector<ShaderDefine> ShaderLibrary::PermutationDefines(const Program& program, UINT optionMask)const
+{
+	std::vector<ShaderDefine> defines = program.Defines;
+	for(size_t i = 0; i < program.Options.size(); ++i)
+	{
+		if(optionMask & (1u << i))
+			defines.push_back({ program.Options[i] });
+	}
+
+	return defines;
+}
+
+std::uint64_t ShaderLibrary::PermutationKey(const Program& program, UINT optionMask)
+{
+	std::uint64_t key = SourceHash(program.Filename);
+	key = HashString(program.EntryPoint, key);
+	key = HashString(program.Target, key);
+	key = HashString(BuildFlavour, key);
+
+	for(const ShaderDefine& define : PermutationDefines(program, optionMask))
+	{
+		key = HashString(define.Name, key);
+		key = HashString(define.Value, key);
+	}
+
+	return key;
+}
+
+std::wstring ShaderLibrary::PermutationFile(const std::wstring& directory, const Program& program, std::uint64_t key)const
+{
+	wchar_t keyText[32];
+	swprintf_s(keyText, L"-%016llx.cso", (unsigned long long)key);
+	return directory + L"\\" + AnsiToWString(program.Name) + keyText;
+}
+
+ComPtr<ID3DBlob> ShaderLibrary::Compile(const Program& program, UINT optionMask)const
+{
+	std::vector<ShaderDefine> defines = PermutationDefines(program, optionMask);
+
+	std::vector<D3D_SHADER_MACRO> macros;
+	for(const ShaderDefine& define : defines)
+		macros.push_back({ define.Name.c_str(), define.Value.c_str() });
+	macros.push_back({ nullptr, nullptr });
+
+	return d3dUtil::CompileShader(program.Filename, macros.data(), program.EntryPoint, program.Target);
+}
+
+std::uint64_t ShaderLibrary::SourceHash(const std::wstring& filename)
+{
+	auto it = mSourceHashes.find(filename);
+	if(it != mSourceHashes.end())
+		return it->second;
+
+	// Stands in while the includes are hashed, in case they include this file again.
+	mSourceHashes[filename] = 0;
+
+	std::ifstream fin(filename, std::ios::binary);
+	std::string source((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+
+	std::uint64_t hash = d3dUtil::HashBytes(source.data(), source.size());
+
+	// Quoted includes are resolved against the including file, the way
+	// D3D_COMPILE_STANDARD_FILE_INCLUDE does.  Includes inside inactive #if blocks
+	// are hashed too, which only costs an occasional needless recompile.
+	std::istringstream lines(source);
+	std::string line;
+	while(std::getline(lines, line))
+	{
+		size_t directive = line.find_first_not_of(" \t");
+		if(directive == std::string::npos || line.compare(directive, 8, "#include") != 0)
+			continue;
+
+		size_t open = line.find('"', directive + 8);
+		size_t close = open == std::string::npos ? std::string::npos : line.find('"', open + 1);
+		if(close == std::string::npos)
+			continue;
+
+		std::wstring included = DirectoryOf(filename) + AnsiToWString(line.substr(open + 1, close - open - 1));
+		std::uint64_t includedHash = SourceHash(included);
+		hash = d3dUtil::HashBytes(&includedHash, sizeof(includedHash), hash);
+	}
+
+	mSourceHashes[filename] = hash;
+	return hash;
+}
@@ -0,0 +1,87 @@
+//***************************************************************************************
+// ShaderLibrary.h
+//
+// Named shader programs and the permutations of their optional defines, loaded as
+// precompiled bytecode instead of being compiled at every startup.
+//   -AddProgram() declares a file/entry point/target, the defines it is always built
+//    with and the options it may be built with.  Every subset of the options is one
+//    permutation, so CompileAll() can build them all ahead of time.
+//   -A permutation's key hashes the entry point, target, defines, build flavour and
+//    the source of the file and everything it #includes.  Editing a shader changes
+//    the key, so stale bytecode is never picked up.
+//   -Get() loads <name>-<key>.cso from the precompiled directory, then from the
+//    runtime cache, and only compiles when neither has it, storing the result in
+//    the cache for the next run.
+//   -Source hashes are memoized.  After ForgetSources() the files are read again,
+//    so comparing Key() before and after tells which permutations an edit touched
+//    and only those need Get() again.
+//***************************************************************************************
+
+#pragma once
+
+#include "d3dUtil.h"
+
+struct ShaderDefine
+{
+	std::string Name;
+	std::string Value = "1";
+};
+
+class ShaderLibrary
+{
+public:
+	// The directories are created on first write.
+	ShaderLibrary(const std::wstring& precompiledDirectory, const std::wstring& cacheDirectory);
+	ShaderLibrary(const ShaderLibrary& rhs) = delete;
+	ShaderLibrary& operator=(const ShaderLibrary& rhs) = delete;
+	~ShaderLibrary() = default;
+
+	void AddProgram(const std::string& name, const std::wstring& filename,
+		const std::string& entryPoint, const std::string& target,
+		const std::vector<ShaderDefine>& defines = {},
+		const std::vector<std::string>& options = {});
+
+	// options must all have been declared for the program.  Throws DxException if
+	// the shader has to be compiled and fails to.
+	Microsoft::WRL::ComPtr<ID3DBlob> Get(const std::string& name,
+		const std::vector<std::string>& options = {});
+
+	// The key Get() would look the permutation up by, without loading it.
+	std::uint64_t Key(const std::string& name, const std::vector<std::string>& options = {});
+
+	// Call after shader files changed on disk.
+	void ForgetSources();
+
+	// Compiles every permutation of every program into the precompiled directory and
+	// returns how many there were.
+	UINT CompileAll();
+
+private:
+	struct Program
+	{
+		std::string Name;
+		std::wstring Filename;
+		std::string EntryPoint;
+		std::string Target;
+		std::vector<ShaderDefine> Defines;
+		std::vector<std::string> Options;
+	};
+
+	const Program& FindProgram(const std::string& name)const;
+	UINT OptionMask(const Program& program, const std::vector<std::string>& options)const;
+	std::vector<ShaderDefine> PermutationDefines(const Program& program, UINT optionMask)const;
+	std::uint64_t PermutationKey(const Program& program, UINT optionMask);
+	std::wstring PermutationFile(const std::wstring& directory, const Program& program, std::uint64_t key)const;
+	Microsoft::WRL::ComPtr<ID3DBlob> Compile(const Program& program, UINT optionMask)const;
+
+	// Hash of a file and, recursively, of the files it #includes.  Memoized, since
+	// every permutation of a file hashes the same sources.
+	std::uint64_t SourceHash(const std::wstring& filename);
+
+	std::wstring mPrecompiledDirectory;
+	std::wstring mCacheDirectory;
+
+	std::vector<Program> mPrograms;
+	std::unordered_map<std::string, size_t> mProgramIndex;
+	std::unordered_map<std::wstring, std::uint64_t> mSourceHashes;
+};
@@ -0,0 +1,125 @@
+//***************************************************************************************
+// ShadingRateImage.cpp
+//***************************************************************************************
+
+#include "ShadingRateImage.h"
+
+ShadingRateImage::ShadingRateImage(ID3D12Device* device, DescriptorAllocator& heap) :
+	mDevice(device),
+	mHeap(heap)
+{
+	// Runtimes that predate the query fail it, which means no support either.
+	D3D12_FEATURE_DATA_D3D12_OPTIONS6 options = {};
+	if(SUCCEEDED(mDevice->CheckFeatureSupport(D3D12_FEATURE_D3D12_OPTIONS6, &options, sizeof(options))))
+	{
+		mTier = options.VariableShadingRateTier;
+		mTileSize = options.ShadingRateImageTileSize;
+	}
+
+	mNullSrvIndex = mHeap.Allocate();
+	mDepthSrvIndex = mHeap.Allocate();
+
+	// The colour is optional, so its table gets a null view when there is none.
+	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+	srvDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+	srvDesc.Texture2D.MipLevels = 1;
+	mDevice->CreateShaderResourceView(nullptr, &srvDesc, mHeap.CpuHandle(mNullSrvIndex));
+
+	srvDesc.Format = DXGI_FORMAT_R32_FLOAT;
+	mDevice->CreateShaderResourceView(nullptr, &srvDesc, mHeap.CpuHandle(mDepthSrvIndex));
+}
+
+D3D12_VARIABLE_SHADING_RATE_TIER ShadingRateImage::Tier()const
+{
+	return mTier;
+}
+
+void ShadingRateImage::Resize(ID3D12Resource* depthBuffer, UINT64 retireFence)
+{
+	// The old texture no longer fits; the caller sets one of the new size.
+	SetTexture(nullptr, retireFence);
+	mDepthBuffer = nullptr;
+
+	D3D12_RESOURCE_DESC depthDesc = depthBuffer->GetDesc();
+	if(mTier < D3D12_VARIABLE_SHADING_RATE_TIER_2 || mTileSize == 0 || depthDesc.SampleDesc.Count > 1)
+		return;
+
+	mDepthBuffer = depthBuffer;
+	mDepthWidth = (UINT)depthDesc.Width;
+	mDepthHeight = depthDesc.Height;
+
+	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+	srvDesc.Format = (depthDesc.Format == DXGI_FORMAT_R32_TYPELESS) ?
+		DXGI_FORMAT_R32_FLOAT : DXGI_FORMAT_R24_UNORM_X8_TYPELESS;
+	srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+	srvDesc.Texture2D.MipLevels = 1;
+	mDevice->CreateShaderResourceView(mDepthBuffer, &srvDesc, mHeap.CpuHandle(mDepthSrvIndex));
+}
+
+bool ShadingRateImage::ImageSupported()const
+{
+	return mDepthBuffer != nullptr;
+}
+
+UINT ShadingRateImage::TileSize()const
+{
+	return mTileSize;
+}
+
+D3D12_RESOURCE_DESC ShadingRateImage::TextureDesc()const
+{
+	assert(ImageSupported());
+
+	// A tile only partly on screen still gets a texel.
+	return CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R8_UINT,
+		(mDepthWidth + mTileSize - 1) / mTileSize, (mDepthHeight + mTileSize - 1) / mTileSize,
+		1, 1, 1, 0, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
+}
+
+void ShadingRateImage::SetTexture(ID3D12Resource* image, UINT64 retireFence)
+{
+	if(image == mImage)
+		return;
+
+	if(mImage != nullptr)
+		mHeap.Free(mUavIndex, retireFence);
+	mImage = image;
+	if(mImage == nullptr)
+		return;
+
+	assert(ImageSupported());
+
+	D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
+	uavDesc.Format = DXGI_FORMAT_R8_UINT;
+	uavDesc.ViewDimension = D3D12_UAV_DIMENSION_TEXTURE2D;
+
+	mUavIndex = mHeap.Allocate();
+	mDevice->CreateUnorderedAccessView(mImage, nullptr, &uavDesc, mHeap.CpuHandle(mUavIndex));
+}
+
+void ShadingRateImage::Build(ID3D12GraphicsCommandList* cmdList, BuildConstants constants, D3D12_GPU_DESCRIPTOR_HANDLE colorSrv)
+{
+	assert(mImage != nullptr);
+
+	constants.DepthWidth = mDepthWidth;
+	constants.DepthHeight = mDepthHeight;
+	constants.TileSize = mTileSize;
+	constants.HasColor = colorSrv.ptr != 0;
+
+	cmdList->SetComputeRoot32BitConstants(0, sizeof(BuildConstants) / 4, &constants, 0);
+	cmdList->SetComputeRootDescriptorTable(1, mHeap.GpuHandle(mDepthSrvIndex));
+	cmdList->SetComputeRootDescriptorTable(2, constants.HasColor ? colorSrv : mHeap.GpuHandle(mNullSrvIndex));
+	cmdList->SetComputeRootDescriptorTable(3, mHeap.GpuHandle(mUavIndex));
+
+	// One group per tile.
+	D3D12_RESOURCE_DESC desc = mImage->GetDesc();
+	cmdList->Dispatch((UINT)desc.Width, desc.Height, 1);
+}
+
+ID3D12Resource* ShadingRateImage::Resource()const
+{
+	return mImage;
+}
@@ -0,0 +1,95 @@
+//***************************************************************************************
+// ShadingRateImage.h
+//
+// Tier 2 variable rate shading: an image of one shading rate per screen tile, built
+// by a compute shader (ShadingRate.hlsl) from the depth and colour of the frame
+// before.
+//   -A tile is shaded coarsely where little detail reaches the screen.  Fog hides
+//    all but 1 - fogAmount of the lighting under it, taken at the nearest depth in
+//    the tile, and the colour gives the spread of luma across it.  The smaller of
+//    the two is compared with Coarse2x2Contrast and Coarse4x4Contrast.  Without a
+//    colour only the fog counts.
+//   -Build() comes before the frame clears the depth buffer, so it reads the last
+//    frame's.  Fogged distance hardly moves on screen from one frame to the next.
+//   -The caller owns the texture, as with HiZPyramid, e.g. as a RenderGraph
+//    transient: Resize() gives its TextureDesc() and SetTexture() hands it over.
+//    Draws read it through RSSetShadingRateImage in SHADING_RATE_SOURCE.
+//   -ImageSupported() is false below D3D12_VARIABLE_SHADING_RATE_TIER_2 or for a
+//    multisampled depth buffer, and no texture is set.  Tier() still says whether
+//    per-draw rates (RSSetShadingRate) can be used.
+//***************************************************************************************
+
+#pragma once
+
+#include "d3dUtil.h"
+#include "DescriptorAllocator.h"
+
+class ShadingRateImage
+{
+public:
+	// Root parameters the caller's root signature has to provide, in this order:
+	// BuildConstants as 32-bit constants (b0), one-descriptor SRV tables for the
+	// depth buffer (t0) and the colour (t1) and a one-descriptor UAV table for the
+	// image (u0).  Build() fills in the sizes, the caller the rest.
+	struct BuildConstants
+	{
+		UINT DepthWidth = 0;
+		UINT DepthHeight = 0;
+		UINT TileSize = 0;
+		UINT HasColor = 0;
+
+		// The projection's _33 and _43, so depth = ProjA + ProjB / viewZ.
+		float ProjA = 0.0f;
+		float ProjB = 0.0f;
+		float FogStart = 0.0f;
+		float FogRange = 1.0f;
+
+		float Coarse2x2Contrast = 0.0f;
+		float Coarse4x4Contrast = 0.0f;
+		UINT Pad0 = 0;
+		UINT Pad1 = 0;
+	};
+
+	ShadingRateImage(ID3D12Device* device, DescriptorAllocator& heap);
+	ShadingRateImage(const ShadingRateImage& rhs) = delete;
+	ShadingRateImage& operator=(const ShadingRateImage& rhs) = delete;
+	~ShadingRateImage() = default;
+
+	D3D12_VARIABLE_SHADING_RATE_TIER Tier()const;
+
+	// depthBuffer is an R24G8_TYPELESS or R32_TYPELESS texture.  Drops the texture.
+	void Resize(ID3D12Resource* depthBuffer, UINT64 retireFence);
+	bool ImageSupported()const;
+
+	// Screen pixels along each side of a tile.
+	UINT TileSize()const;
+
+	// What SetTexture() expects, once Resize() has seen a supported depth buffer.
+	D3D12_RESOURCE_DESC TextureDesc()const;
+
+	// Setting the same texture again keeps its view.
+	void SetTexture(ID3D12Resource* image, UINT64 retireFence);
+
+	// Records into a direct list that already has the PSO, root signature and
+	// descriptor heap set, with the depth buffer and colour readable by compute and
+	// the image in UNORDERED_ACCESS.  A zero colorSrv leaves the rates to the fog.
+	void Build(ID3D12GraphicsCommandList* cmdList, BuildConstants constants, D3D12_GPU_DESCRIPTOR_HANDLE colorSrv);
+
+	ID3D12Resource* Resource()const;
+
+private:
+	ID3D12Device* mDevice = nullptr;
+	DescriptorAllocator& mHeap;
+
+	D3D12_VARIABLE_SHADING_RATE_TIER mTier = D3D12_VARIABLE_SHADING_RATE_TIER_NOT_SUPPORTED;
+	UINT mTileSize = 0;
+
+	ID3D12Resource* mImage = nullptr;
+	ID3D12Resource* mDepthBuffer = nullptr;
+	UINT mDepthWidth = 0;
+	UINT mDepthHeight = 0;
+
+	UINT mNullSrvIndex = 0;
+	UINT mDepthSrvIndex = 0;
+	UINT mUavIndex = 0;
+};
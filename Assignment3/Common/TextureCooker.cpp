@@ -0,0 +1,1246 @@
+//***************************************************************************************
+// TextureCooker.cpp
+//***************************************************************************************
+
+#include "TextureCooker.h"
+#include <cmath>
+#include <comdef.h>
+#include <cstring>
+#include <wincodec.h>
+
+#pragma comment(lib, "windowscodecs.lib")
+
+using Microsoft::WRL::ComPtr;
+using namespace DirectX;
+
+const float TextureCooker::AlphaTestCutoff = 0.1f;
+
+namespace
+{
+	// Bump when the same sources and options would cook to something else.
+	const UINT CookerVersion = 1;
+
+	constexpr UINT32 FourCC(char a, char b, char c, char d)
+	{
+		return (UINT32)(std::uint8_t)a | ((UINT32)(std::uint8_t)b << 8) |
+			((UINT32)(std::uint8_t)c << 16) | ((UINT32)(std::uint8_t)d << 24);
+	}
+
+	const UINT32 DdsMagic = FourCC('D', 'D', 'S', ' ');
+
+	// Stored in the header's reserved words, followed by the recipe key.
+	const UINT32 CookedTag = FourCC('C', 'O', 'O', 'K');
+
+	const UINT32 DdsFlagsTexture = 0x1 | 0x2 | 0x4 | 0x1000;  // CAPS | HEIGHT | WIDTH | PIXELFORMAT
+	const UINT32 DdsFlagsMipCount = 0x20000;
+	const UINT32 DdsFlagsLinearSize = 0x80000;
+	const UINT32 DdsCapsTexture = 0x1000;
+	const UINT32 DdsCapsComplexMipmap = 0x8 | 0x400000;
+	const UINT32 DdsCaps2Cubemap = 0x200;
+	const UINT32 DdsPixelAlpha = 0x1;
+	const UINT32 DdsPixelFourCC = 0x4;
+	const UINT32 DdsPixelRgb = 0x40;
+	const UINT32 DdsDimensionTexture2D = 3;
+	const UINT32 DdsMiscTextureCube = 0x4;
+
+#pragma pack(push, 1)
+	struct DdsPixelFormat
+	{
+		UINT32 Size;
+		UINT32 Flags;
+		UINT32 FourCC;
+		UINT32 RgbBitCount;
+		UINT32 RMask;
+		UINT32 GMask;
+		UINT32 BMask;
+		UINT32 AMask;
+	};
+
+	struct DdsHeader
+	{
+		UINT32 Size;
+		UINT32 Flags;
+		UINT32 Height;
+		UINT32 Width;
+		UINT32 PitchOrLinearSize;
+		UINT32 Depth;
+		UINT32 MipMapCount;
+		UINT32 Reserved1[11];
+		DdsPixelFormat PixelFormat;
+		UINT32 Caps;
+		UINT32 Caps2;
+		UINT32 Caps3;
+		UINT32 Caps4;
+		UINT32 Reserved2;
+	};
+
+	struct DdsHeaderDxt10
+	{
+		DXGI_FORMAT Format;
+		UINT32 ResourceDimension;
+		UINT32 MiscFlag;
+		UINT32 ArraySize;
+		UINT32 MiscFlags2;
+	};
+#pragma pack(pop)
+
+	const HRESULT NotSupported = HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+	const HRESULT BadFormat = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+
+	// A source file's texels, in whatever format it had, as the runtime would lay
+	// them out: every slice's mips from the largest down.
+	struct DdsSource
+	{
+		DXGI_FORMAT Format = DXGI_FORMAT_UNKNOWN;
+		bool IgnoreAlpha = false;
+		UINT Width = 0;
+		UINT Height = 0;
+		UINT MipCount = 0;
+		UINT ArraySize = 0;
+		const std::uint8_t* Texels = nullptr;
+		size_t TexelBytes = 0;
+	};
+
+	// Floats, rows top to bottom.
+	struct Image
+	{
+		UINT Width = 0;
+		UINT Height = 0;
+		std::vector<XMFLOAT4> Texels;
+
+		void Resize(UINT width, UINT height)
+		{
+			Width = width;
+			Height = height;
+			Texels.assign((size_t)width * height, XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f));
+		}
+
+		XMFLOAT4& At(UINT x, UINT y) { return Texels[(size_t)y * Width + x]; }
+		const XMFLOAT4& At(UINT x, UINT y)const { return Texels[(size_t)y * Width + x]; }
+	};
+
+	bool IsBlockCompressed(DXGI_FORMAT format)
+	{
+		switch(format)
+		{
+		case DXGI_FORMAT_BC1_UNORM: case DXGI_FORMAT_BC1_UNORM_SRGB:
+		case DXGI_FORMAT_BC2_UNORM: case DXGI_FORMAT_BC2_UNORM_SRGB:
+		case DXGI_FORMAT_BC3_UNORM: case DXGI_FORMAT_BC3_UNORM_SRGB:
+		case DXGI_FORMAT_BC5_UNORM:
+		case DXGI_FORMAT_BC7_UNORM: case DXGI_FORMAT_BC7_UNORM_SRGB:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	// The formats the runtime accepts as cooked.
+	bool IsCookedFormat(DXGI_FORMAT format)
+	{
+		return IsBlockCompressed(format) &&
+			format != DXGI_FORMAT_BC2_UNORM && format != DXGI_FORMAT_BC2_UNORM_SRGB;
+	}
+
+	size_t SurfaceBytes(DXGI_FORMAT format, UINT width, UINT height)
+	{
+		if(!IsBlockCompressed(format))
+			return (size_t)width * height * 4;
+
+		size_t blockBytes = (format == DXGI_FORMAT_BC1_UNORM || format == DXGI_FORMAT_BC1_UNORM_SRGB) ? 8 : 16;
+		return (size_t)MathHelper::Max(1u, (width + 3) / 4) * MathHelper::Max(1u, (height + 3) / 4) * blockBytes;
+	}
+
+	size_t ChainBytes(DXGI_FORMAT format, UINT width, UINT height, UINT mipCount)
+	{
+		size_t bytes = 0;
+		for(UINT mip = 0; mip < mipCount; ++mip)
+			bytes += SurfaceBytes(format, MathHelper::Max(1u, width >> mip), MathHelper::Max(1u, height >> mip));
+		return bytes;
+	}
+
+	bool ReadWholeFile(const std::wstring& filename, std::vector<std::uint8_t>& bytes)
+	{
+		std::ifstream fin(filename, std::ios::binary | std::ios::ate);
+		if(!fin)
+			return false;
+
+		bytes.resize((size_t)fin.tellg());
+		fin.seekg(0, std::ios::beg);
+		fin.read(reinterpret_cast<char*>(bytes.data()), bytes.size());
+		return !fin.fail();
+	}
+
+	bool IsDdsFile(const std::wstring& filename)
+	{
+		size_t dot = filename.find_last_of(L'.');
+		if(dot == std::wstring::npos)
+			return false;
+
+		std::wstring extension = filename.substr(dot + 1);
+		return _wcsicmp(extension.c_str(), L"dds") == 0;
+	}
+
+	DXGI_FORMAT LegacyFormat(const DdsPixelFormat& pf, bool& ignoreAlpha)
+	{
+		if(pf.Flags & DdsPixelFourCC)
+		{
+			if(pf.FourCC == FourCC('D', 'X', 'T', '1')) return DXGI_FORMAT_BC1_UNORM;
+			if(pf.FourCC == FourCC('D', 'X', 'T', '2') || pf.FourCC == FourCC('D', 'X', 'T', '3')) return DXGI_FORMAT_BC2_UNORM;
+			if(pf.FourCC == FourCC('D', 'X', 'T', '4') || pf.FourCC == FourCC('D', 'X', 'T', '5')) return DXGI_FORMAT_BC3_UNORM;
+			if(pf.FourCC == FourCC('A', 'T', 'I', '2') || pf.FourCC == FourCC('B', 'C', '5', 'U')) return DXGI_FORMAT_BC5_UNORM;
+			return DXGI_FORMAT_UNKNOWN;
+		}
+
+		if((pf.Flags & DdsPixelRgb) && pf.RgbBitCount == 32)
+		{
+			ignoreAlpha = !(pf.Flags & DdsPixelAlpha) || pf.AMask == 0;
+			if(pf.RMask == 0x000000ff && pf.GMask == 0x0000ff00 && pf.BMask == 0x00ff0000)
+				return DXGI_FORMAT_R8G8B8A8_UNORM;
+			if(pf.RMask == 0x00ff0000 && pf.GMask == 0x0000ff00 && pf.BMask == 0x000000ff)
+				return DXGI_FORMAT_B8G8R8A8_UNORM;
+		}
+		return DXGI_FORMAT_UNKNOWN;
+	}
+
+	DXGI_FORMAT Dxt10Format(DXGI_FORMAT format, bool& ignoreAlpha)
+	{
+		switch(format)
+		{
+		case DXGI_FORMAT_R8G8B8A8_UNORM: case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
+			return DXGI_FORMAT_R8G8B8A8_UNORM;
+		case DXGI_FORMAT_B8G8R8X8_UNORM: case DXGI_FORMAT_B8G8R8X8_UNORM_SRGB:
+			ignoreAlpha = true;
+			return DXGI_FORMAT_B8G8R8A8_UNORM;
+		case DXGI_FORMAT_B8G8R8A8_UNORM: case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
+			return DXGI_FORMAT_B8G8R8A8_UNORM;
+		default:
+			return IsBlockCompressed(format) ? format : DXGI_FORMAT_UNKNOWN;
+		}
+	}
+
+	HRESULT ParseDds(const std::vector<std::uint8_t>& bytes, DdsSource& dds)
+	{
+		if(bytes.size() < sizeof(UINT32) + sizeof(DdsHeader))
+			return BadFormat;
+
+		UINT32 magic;
+		DdsHeader header;
+		memcpy(&magic, bytes.data(), sizeof(magic));
+		memcpy(&header, bytes.data() + sizeof(magic), sizeof(header));
+		if(magic != DdsMagic || header.Size != sizeof(DdsHeader) || header.PixelFormat.Size != sizeof(DdsPixelFormat))
+			return BadFormat;
+
+		// Cube maps and volumes don't go through the cooker.
+		if((header.Caps2 & DdsCaps2Cubemap) || header.Depth > 1)
+			return NotSupported;
+
+		size_t offset = sizeof(magic) + sizeof(header);
+		dds.ArraySize = 1;
+		if((header.PixelFormat.Flags & DdsPixelFourCC) && header.PixelFormat.FourCC == FourCC('D', 'X', '1', '0'))
+		{
+			DdsHeaderDxt10 dxt10;
+			if(bytes.size() < offset + sizeof(dxt10))
+				return BadFormat;
+			memcpy(&dxt10, bytes.data() + offset, sizeof(dxt10));
+			offset += sizeof(dxt10);
+
+			if(dxt10.ResourceDimension != DdsDimensionTexture2D || (dxt10.MiscFlag & DdsMiscTextureCube))
+				return NotSupported;
+
+			dds.Format = Dxt10Format(dxt10.Format, dds.IgnoreAlpha);
+			dds.ArraySize = MathHelper::Max(1u, dxt10.ArraySize);
+		}
+		else
+		{
+			dds.Format = LegacyFormat(header.PixelFormat, dds.IgnoreAlpha);
+		}
+
+		if(dds.Format == DXGI_FORMAT_UNKNOWN)
+			return NotSupported;
+
+		dds.Width = header.Width;
+		dds.Height = header.Height;
+		dds.MipCount = MathHelper::Max(1u, header.MipMapCount);
+		if(dds.Width == 0 || dds.Height == 0 || dds.MipCount > TextureCooker::FullMipCount(dds.Width, dds.Height))
+			return BadFormat;
+
+		dds.Texels = bytes.data() + offset;
+		dds.TexelBytes = ChainBytes(dds.Format, dds.Width, dds.Height, dds.MipCount) * dds.ArraySize;
+		if(bytes.size() < offset + dds.TexelBytes)
+			return BadFormat;
+
+		return S_OK;
+	}
+
+	XMFLOAT4 Unpack565(std::uint16_t c)
+	{
+		UINT r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+		return XMFLOAT4(((r << 3) | (r >> 2)) / 255.0f, ((g << 2) | (g >> 4)) / 255.0f,
+			((b << 3) | (b >> 2)) / 255.0f, 1.0f);
+	}
+
+	XMFLOAT4 Lerp(const XMFLOAT4& a, const XMFLOAT4& b, float t)
+	{
+		return XMFLOAT4(a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t, a.w + (b.w - a.w) * t);
+	}
+
+	// The colour half of BC1-BC3; BC2 and BC3 always use the four colour mode.
+	void DecodeColorBlock(const std::uint8_t* block, bool allowThreeColor, XMFLOAT4 texels[16])
+	{
+		std::uint16_t c0, c1;
+		UINT32 indices;
+		memcpy(&c0, block, 2);
+		memcpy(&c1, block + 2, 2);
+		memcpy(&indices, block + 4, 4);
+
+		XMFLOAT4 palette[4] = { Unpack565(c0), Unpack565(c1) };
+		if(c0 > c1 || !allowThreeColor)
+		{
+			palette[2] = Lerp(palette[0], palette[1], 1.0f / 3.0f);
+			palette[3] = Lerp(palette[0], palette[1], 2.0f / 3.0f);
+		}
+		else
+		{
+			palette[2] = Lerp(palette[0], palette[1], 0.5f);
+			palette[3] = XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f);
+		}
+
+		for(int i = 0; i < 16; ++i)
+			texels[i] = palette[(indices >> (2 * i)) & 3];
+	}
+
+	void DecodeAlphaBlock(const std::uint8_t* block, float alphas[16])
+	{
+		float palette[8] = { block[0] / 255.0f, block[1] / 255.0f };
+		if(block[0] > block[1])
+		{
+			for(int i = 1; i < 7; ++i)
+				palette[i + 1] = ((7 - i) * palette[0] + i * palette[1]) / 7.0f;
+		}
+		else
+		{
+			for(int i = 1; i < 5; ++i)
+				palette[i + 1] = ((5 - i) * palette[0] + i * palette[1]) / 5.0f;
+			palette[6] = 0.0f;
+			palette[7] = 1.0f;
+		}
+
+		std::uint64_t indices = 0;
+		memcpy(&indices, block + 2, 6);
+		for(int i = 0; i < 16; ++i)
+			alphas[i] = palette[(indices >> (3 * i)) & 7];
+	}
+
+	// Decodes the top mip of one slice.
+	HRESULT DecodeSlice(const DdsSource& dds, UINT slice, Image& image)
+	{
+		const std::uint8_t* src = dds.Texels + ChainBytes(dds.Format, dds.Width, dds.Height, dds.MipCount) * slice;
+		image.Resize(dds.Width, dds.Height);
+
+		if(!IsBlockCompressed(dds.Format))
+		{
+			bool bgra = dds.Format == DXGI_FORMAT_B8G8R8A8_UNORM;
+			for(UINT y = 0; y < dds.Height; ++y)
+			{
+				for(UINT x = 0; x < dds.Width; ++x, src += 4)
+				{
+					image.At(x, y) = XMFLOAT4((bgra ? src[2] : src[0]) / 255.0f, src[1] / 255.0f,
+						(bgra ? src[0] : src[2]) / 255.0f, dds.IgnoreAlpha ? 1.0f : src[3] / 255.0f);
+				}
+			}
+			return S_OK;
+		}
+
+		bool bc1 = dds.Format == DXGI_FORMAT_BC1_UNORM || dds.Format == DXGI_FORMAT_BC1_UNORM_SRGB;
+		bool bc2 = dds.Format == DXGI_FORMAT_BC2_UNORM || dds.Format == DXGI_FORMAT_BC2_UNORM_SRGB;
+		bool bc3 = dds.Format == DXGI_FORMAT_BC3_UNORM || dds.Format == DXGI_FORMAT_BC3_UNORM_SRGB;
+		if(!bc1 && !bc2 && !bc3)
+			return NotSupported;
+
+		for(UINT by = 0; by < dds.Height; by += 4)
+		{
+			for(UINT bx = 0; bx < dds.Width; bx += 4)
+			{
+				XMFLOAT4 texels[16];
+				if(bc1)
+				{
+					DecodeColorBlock(src, true, texels);
+					src += 8;
+				}
+				else
+				{
+					float alphas[16];
+					if(bc2)
+					{
+						for(int i = 0; i < 16; ++i)
+							alphas[i] = ((src[i / 2] >> (4 * (i & 1))) & 15) / 15.0f;
+					}
+					else
+					{
+						DecodeAlphaBlock(src, alphas);
+					}
+
+					DecodeColorBlock(src + 8, false, texels);
+					for(int i = 0; i < 16; ++i)
+						texels[i].w = alphas[i];
+					src += 16;
+				}
+
+				for(UINT i = 0; i < 16; ++i)
+				{
+					UINT x = bx + i % 4, y = by + i / 4;
+					if(x < dds.Width && y < dds.Height)
+						image.At(x, y) = texels[i];
+				}
+			}
+		}
+		return S_OK;
+	}
+
+	HRESULT LoadWic(const std::wstring& filename, Image& image)
+	{
+		HRESULT init = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+
+		HRESULT hr = S_OK;
+		{
+			ComPtr<IWICImagingFactory> factory;
+			ComPtr<IWICBitmapDecoder> decoder;
+			ComPtr<IWICBitmapFrameDecode> frame;
+			ComPtr<IWICFormatConverter> converter;
+			WICPixelFormatGUID pixelFormat;
+			UINT width = 0, height = 0;
+
+			hr = CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&factory));
+			if(SUCCEEDED(hr))
+				hr = factory->CreateDecoderFromFilename(filename.c_str(), nullptr, GENERIC_READ, WICDecodeMetadataCacheOnDemand, &decoder);
+			if(SUCCEEDED(hr))
+				hr = decoder->GetFrame(0, &frame);
+			if(SUCCEEDED(hr))
+				hr = frame->GetSize(&width, &height);
+			if(SUCCEEDED(hr))
+				hr = frame->GetPixelFormat(&pixelFormat);
+
+			// 32-bit BMPs with alpha in the spare byte decode as BGR; take the byte
+			// as alpha unless it is zero everywhere.
+			bool spareByteAlpha = SUCCEEDED(hr) && pixelFormat == GUID_WICPixelFormat32bppBGR;
+
+			std::vector<std::uint8_t> bytes((size_t)width * height * 4);
+			if(SUCCEEDED(hr) && spareByteAlpha)
+			{
+				hr = frame->CopyPixels(nullptr, width * 4, (UINT)bytes.size(), bytes.data());
+			}
+			else if(SUCCEEDED(hr))
+			{
+				hr = factory->CreateFormatConverter(&converter);
+				if(SUCCEEDED(hr))
+				{
+					hr = converter->Initialize(frame.Get(), GUID_WICPixelFormat32bppBGRA, WICBitmapDitherTypeNone,
+						nullptr, 0.0, WICBitmapPaletteTypeCustom);
+				}
+				if(SUCCEEDED(hr))
+					hr = converter->CopyPixels(nullptr, width * 4, (UINT)bytes.size(), bytes.data());
+			}
+
+			if(SUCCEEDED(hr))
+			{
+				bool anyAlpha = false;
+				for(size_t i = 3; i < bytes.size() && !anyAlpha; i += 4)
+					anyAlpha = bytes[i] != 0;
+
+				image.Resize(width, height);
+				for(size_t i = 0; i < image.Texels.size(); ++i)
+				{
+					const std::uint8_t* src = &bytes[i * 4];
+					image.Texels[i] = XMFLOAT4(src[2] / 255.0f, src[1] / 255.0f, src[0] / 255.0f,
+						(spareByteAlpha && !anyAlpha) ? 1.0f : src[3] / 255.0f);
+				}
+			}
+		}
+
+		if(SUCCEEDED(init))
+			CoUninitialize();
+		return hr;
+	}
+
+	float SrgbToLinear(float c)
+	{
+		return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+	}
+
+	float LinearToSrgb(float c)
+	{
+		return c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+	}
+
+	float BesselI0(float x)
+	{
+		float sum = 1.0f, term = 1.0f;
+		for(int k = 1; k < 20; ++k)
+		{
+			term *= (x / (2.0f * k)) * (x / (2.0f * k));
+			sum += term;
+		}
+		return sum;
+	}
+
+	// Kaiser-windowed sinc, x in texels of the smaller image.
+	float KaiserFilter(float x)
+	{
+		const float Width = 3.0f;
+		const float Alpha = 4.0f;
+		if(fabsf(x) >= Width)
+			return 0.0f;
+
+		float sinc = x == 0.0f ? 1.0f : sinf(MathHelper::Pi * x) / (MathHelper::Pi * x);
+		float t = x / Width;
+		return sinc * BesselI0(Alpha * sqrtf(1.0f - t * t)) / BesselI0(Alpha);
+	}
+
+	struct Tap
+	{
+		UINT Index;
+		float Weight;
+	};
+
+	// For each texel of a dstSize row, the srcSize texels it is filtered from.
+	std::vector<std::vector<Tap>> FilterTaps(UINT srcSize, UINT dstSize, bool clamp)
+	{
+		std::vector<std::vector<Tap>> taps(dstSize);
+		float scale = (float)srcSize / dstSize;
+		float stretch = MathHelper::Max(scale, 1.0f);
+		float support = 3.0f * stretch;
+
+		for(UINT i = 0; i < dstSize; ++i)
+		{
+			if(srcSize == dstSize)
+			{
+				taps[i].push_back({ i, 1.0f });
+				continue;
+			}
+
+			float center = (i + 0.5f) * scale;
+			int first = (int)floorf(center - support);
+			int last = (int)ceilf(center + support);
+			float total = 0.0f;
+			for(int j = first; j <= last; ++j)
+			{
+				float weight = KaiserFilter((j + 0.5f - center) / stretch);
+				if(weight == 0.0f)
+					continue;
+
+				int index = clamp ? MathHelper::Clamp(j, 0, (int)srcSize - 1) : ((j % (int)srcSize) + (int)srcSize) % (int)srcSize;
+				taps[i].push_back({ (UINT)index, weight });
+				total += weight;
+			}
+
+			for(Tap& tap : taps[i])
+				tap.Weight /= total;
+		}
+		return taps;
+	}
+
+	XMVECTOR Filter(const std::vector<Tap>& taps, const XMFLOAT4* texels, size_t stride)
+	{
+		XMVECTOR sum = XMVectorZero();
+		for(const Tap& tap : taps)
+			sum = XMVectorMultiplyAdd(XMLoadFloat4(&texels[tap.Index * stride]), XMVectorReplicate(tap.Weight), sum);
+		return sum;
+	}
+
+	void Resample(const Image& src, UINT width, UINT height, bool clamp, Image& dst)
+	{
+		auto tapsX = FilterTaps(src.Width, width, clamp);
+		auto tapsY = FilterTaps(src.Height, height, clamp);
+
+		Image rows;
+		rows.Resize(width, src.Height);
+		for(UINT y = 0; y < src.Height; ++y)
+		{
+			for(UINT x = 0; x < width; ++x)
+				XMStoreFloat4(&rows.At(x, y), Filter(tapsX[x], &src.At(0, y), 1));
+		}
+
+		dst.Resize(width, height);
+		for(UINT y = 0; y < height; ++y)
+		{
+			for(UINT x = 0; x < width; ++x)
+				XMStoreFloat4(&dst.At(x, y), Filter(tapsY[y], &rows.At(x, 0), width));
+		}
+	}
+
+	// Into the space mips are filtered in: linear, premultiplied colour or a [-1, 1]
+	// vector.
+	void ToFilterSpace(Image& image, bool normalMap, bool hasAlpha)
+	{
+		for(XMFLOAT4& t : image.Texels)
+		{
+			if(normalMap)
+			{
+				t = XMFLOAT4(t.x * 2.0f - 1.0f, t.y * 2.0f - 1.0f, t.z * 2.0f - 1.0f, t.w);
+				continue;
+			}
+
+			float a = hasAlpha ? t.w : 1.0f;
+			t = XMFLOAT4(SrgbToLinear(t.x) * a, SrgbToLinear(t.y) * a, SrgbToLinear(t.z) * a, t.w);
+		}
+	}
+
+	void FromFilterSpace(Image& image, bool normalMap, bool hasAlpha)
+	{
+		for(XMFLOAT4& t : image.Texels)
+		{
+			if(normalMap)
+			{
+				XMVECTOR n = XMVector3Normalize(XMVectorSet(t.x, t.y, t.z, 0.0f));
+				XMFLOAT3 v;
+				XMStoreFloat3(&v, XMVectorMultiplyAdd(n, XMVectorReplicate(0.5f), XMVectorReplicate(0.5f)));
+				t = XMFLOAT4(v.x, v.y, v.z, MathHelper::Clamp(t.w, 0.0f, 1.0f));
+				continue;
+			}
+
+			float a = MathHelper::Clamp(t.w, 0.0f, 1.0f);
+			float unpremultiply = hasAlpha ? (a > 0.0f ? 1.0f / a : 0.0f) : 1.0f;
+			t = XMFLOAT4(
+				LinearToSrgb(MathHelper::Clamp(t.x * unpremultiply, 0.0f, 1.0f)),
+				LinearToSrgb(MathHelper::Clamp(t.y * unpremultiply, 0.0f, 1.0f)),
+				LinearToSrgb(MathHelper::Clamp(t.z * unpremultiply, 0.0f, 1.0f)),
+				a);
+		}
+	}
+
+	float AlphaCoverage(const Image& image, float scale)
+	{
+		size_t covered = 0;
+		for(const XMFLOAT4& t : image.Texels)
+			covered += t.w * scale > TextureCooker::AlphaTestCutoff ? 1 : 0;
+		return (float)covered / image.Texels.size();
+	}
+
+	// Scales the alpha so the fraction of texels that pass the alpha test matches.
+	void PreserveCoverage(Image& image, float coverage)
+	{
+		float low = 0.0f, high = 4.0f, scale = 1.0f;
+		for(int i = 0; i < 16; ++i)
+		{
+			scale = 0.5f * (low + high);
+			if(AlphaCoverage(image, scale) < coverage)
+				low = scale;
+			else
+				high = scale;
+		}
+
+		for(XMFLOAT4& t : image.Texels)
+			t.w = MathHelper::Min(t.w * scale, 1.0f);
+	}
+
+	typedef std::uint8_t Block[16][4];
+
+	std::uint8_t ToByte(float v)
+	{
+		return (std::uint8_t)(MathHelper::Clamp(v, 0.0f, 1.0f) * 255.0f + 0.5f);
+	}
+
+	// Texels past the edge repeat the edge.
+	void FetchBlock(const Image& image, UINT bx, UINT by, Block texels)
+	{
+		for(UINT i = 0; i < 16; ++i)
+		{
+			const XMFLOAT4& t = image.At(MathHelper::Min(bx + i % 4, image.Width - 1), MathHelper::Min(by + i / 4, image.Height - 1));
+			texels[i][0] = ToByte(t.x);
+			texels[i][1] = ToByte(t.y);
+			texels[i][2] = ToByte(t.z);
+			texels[i][3] = ToByte(t.w);
+		}
+	}
+
+	// The direction the block's texels spread along most, over the first 'channels'
+	// channels, by power iteration on their covariance.
+	void PrincipalAxis(const Block texels, int channels, float mean[4], float axis[4])
+	{
+		float cov[4][4] = {};
+		for(int c = 0; c < channels; ++c)
+		{
+			mean[c] = 0.0f;
+			for(int i = 0; i < 16; ++i)
+				mean[c] += texels[i][c] / 16.0f;
+		}
+		for(int i = 0; i < 16; ++i)
+		{
+			for(int a = 0; a < channels; ++a)
+			{
+				for(int b = 0; b < channels; ++b)
+					cov[a][b] += (texels[i][a] - mean[a]) * (texels[i][b] - mean[b]);
+			}
+		}
+
+		for(int c = 0; c < 4; ++c)
+			axis[c] = c < channels ? 1.0f : 0.0f;
+		for(int iteration = 0; iteration < 8; ++iteration)
+		{
+			float next[4] = {};
+			float length = 0.0f;
+			for(int a = 0; a < channels; ++a)
+			{
+				for(int b = 0; b < channels; ++b)
+					next[a] += cov[a][b] * axis[b];
+				length += next[a] * next[a];
+			}
+			if(length < 1e-12f)
+				break;
+
+			length = sqrtf(length);
+			for(int a = 0; a < channels; ++a)
+				axis[a] = next[a] / length;
+		}
+	}
+
+	// The ends of the block's spread along its principal axis.
+	void AxisEndpoints(const Block texels, int channels, float e0[4], float e1[4])
+	{
+		float mean[4] = {}, axis[4] = {};
+		PrincipalAxis(texels, channels, mean, axis);
+
+		float lo = 0.0f, hi = 0.0f;
+		for(int i = 0; i < 16; ++i)
+		{
+			float t = 0.0f;
+			for(int c = 0; c < channels; ++c)
+				t += (texels[i][c] - mean[c]) * axis[c];
+			lo = MathHelper::Min(lo, t);
+			hi = MathHelper::Max(hi, t);
+		}
+
+		for(int c = 0; c < channels; ++c)
+		{
+			e0[c] = MathHelper::Clamp(mean[c] + axis[c] * hi, 0.0f, 255.0f);
+			e1[c] = MathHelper::Clamp(mean[c] + axis[c] * lo, 0.0f, 255.0f);
+		}
+	}
+
+	std::uint16_t Pack565(const float c[3])
+	{
+		UINT r = (UINT)(MathHelper::Clamp(c[0], 0.0f, 255.0f) * 31.0f / 255.0f + 0.5f);
+		UINT g = (UINT)(MathHelper::Clamp(c[1], 0.0f, 255.0f) * 63.0f / 255.0f + 0.5f);
+		UINT b = (UINT)(MathHelper::Clamp(c[2], 0.0f, 255.0f) * 31.0f / 255.0f + 0.5f);
+		return (std::uint16_t)((r << 11) | (g << 5) | b);
+	}
+
+	// Picks the nearest of the four colour mode palette entries for each texel;
+	// returns the squared error.
+	UINT ColorIndices(const Block texels, std::uint16_t c0, std::uint16_t c1, UINT32& indices)
+	{
+		XMFLOAT4 e0 = Unpack565(c0), e1 = Unpack565(c1);
+		XMFLOAT4 palette[4] = { e0, e1, Lerp(e0, e1, 1.0f / 3.0f), Lerp(e0, e1, 2.0f / 3.0f) };
+
+		indices = 0;
+		UINT error = 0;
+		for(int i = 0; i < 16; ++i)
+		{
+			UINT best = 0, bestError = UINT_MAX;
+			for(UINT p = 0; p < 4; ++p)
+			{
+				int dr = texels[i][0] - (int)(palette[p].x * 255.0f + 0.5f);
+				int dg = texels[i][1] - (int)(palette[p].y * 255.0f + 0.5f);
+				int db = texels[i][2] - (int)(palette[p].z * 255.0f + 0.5f);
+				UINT e = (UINT)(dr * dr + dg * dg + db * db);
+				if(e < bestError)
+				{
+					best = p;
+					bestError = e;
+				}
+			}
+			indices |= best << (2 * i);
+			error += bestError;
+		}
+		return error;
+	}
+
+	// BC1's colour block in the four colour mode, as BC3 needs it too.
+	void EncodeColorBlock(const Block texels, std::uint8_t* block)
+	{
+		float e0[4], e1[4];
+		AxisEndpoints(texels, 3, e0, e1);
+		std::uint16_t c0 = Pack565(e0), c1 = Pack565(e1);
+		UINT32 indices;
+		UINT error = ColorIndices(texels, c0, c1, indices);
+
+		// One least squares pass for the endpoints that best fit those indices.
+		static const float Weights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+		float aa = 0.0f, ab = 0.0f, bb = 0.0f, ax[3] = {}, bx[3] = {};
+		for(int i = 0; i < 16; ++i)
+		{
+			float w = Weights[(indices >> (2 * i)) & 3];
+			aa += (1.0f - w) * (1.0f - w);
+			ab += (1.0f - w) * w;
+			bb += w * w;
+			for(int c = 0; c < 3; ++c)
+			{
+				ax[c] += (1.0f - w) * texels[i][c];
+				bx[c] += w * texels[i][c];
+			}
+		}
+		float det = aa * bb - ab * ab;
+		if(fabsf(det) > 1e-6f)
+		{
+			float f0[3], f1[3];
+			for(int c = 0; c < 3; ++c)
+			{
+				f0[c] = (bb * ax[c] - ab * bx[c]) / det;
+				f1[c] = (aa * bx[c] - ab * ax[c]) / det;
+			}
+
+			std::uint16_t r0 = Pack565(f0), r1 = Pack565(f1);
+			UINT32 refined;
+			if(ColorIndices(texels, r0, r1, refined) < error)
+			{
+				c0 = r0;
+				c1 = r1;
+				indices = refined;
+			}
+		}
+
+		// c0 > c1 selects the four colour mode; swapping the ends swaps 0/1 and 2/3.
+		if(c0 < c1)
+		{
+			std::swap(c0, c1);
+			indices ^= 0x55555555;
+		}
+		else if(c0 == c1)
+		{
+			indices = 0;
+		}
+
+		memcpy(block, &c0, 2);
+		memcpy(block + 2, &c1, 2);
+		memcpy(block + 4, &indices, 4);
+	}
+
+	// BC4, as BC3's alpha and each of BC5's channels; the eight value mode only.
+	void EncodeSingleChannel(const Block texels, int channel, std::uint8_t* block)
+	{
+		UINT lo = 255, hi = 0;
+		for(int i = 0; i < 16; ++i)
+		{
+			lo = MathHelper::Min(lo, (UINT)texels[i][channel]);
+			hi = MathHelper::Max(hi, (UINT)texels[i][channel]);
+		}
+
+		block[0] = (std::uint8_t)hi;
+		block[1] = (std::uint8_t)lo;
+		std::uint64_t indices = 0;
+		if(hi > lo)
+		{
+			// Palette slot 0 is hi, 1 is lo and 2-7 step from hi to lo.
+			static const UINT Slots[8] = { 0, 2, 3, 4, 5, 6, 7, 1 };
+			for(int i = 0; i < 16; ++i)
+			{
+				UINT step = ((texels[i][channel] - lo) * 14 + (hi - lo)) / (2 * (hi - lo));
+				indices |= (std::uint64_t)Slots[7 - step] << (3 * i);
+			}
+		}
+		memcpy(block + 2, &indices, 6);
+	}
+
+	class BitWriter
+	{
+	public:
+		explicit BitWriter(std::uint8_t* bytes) : mBytes(bytes) { memset(mBytes, 0, 16); }
+
+		void Write(UINT value, UINT bitCount)
+		{
+			for(UINT i = 0; i < bitCount; ++i, ++mPosition)
+				mBytes[mPosition / 8] |= (std::uint8_t)(((value >> i) & 1) << (mPosition % 8));
+		}
+
+	private:
+		std::uint8_t* mBytes;
+		UINT mPosition = 0;
+	};
+
+	// BC7 mode 6: one RGBA line with 7-bit endpoints plus a p-bit each and 4-bit
+	// indices, good for both smooth colour and alpha.  Each p-bit pair is tried.
+	void EncodeBC7Block(const Block texels, std::uint8_t* block)
+	{
+		static const UINT Weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+		float e0[4], e1[4];
+		AxisEndpoints(texels, 4, e0, e1);
+
+		UINT bestError = UINT_MAX;
+		UINT bestQ[2][4] = {}, bestP[2] = {}, bestIndices[16] = {};
+		for(UINT pbits = 0; pbits < 4; ++pbits)
+		{
+			UINT p[2] = { pbits & 1, pbits >> 1 };
+			UINT q[2][4], expanded[2][4];
+			for(int c = 0; c < 4; ++c)
+			{
+				const float* e[2] = { e0, e1 };
+				for(int end = 0; end < 2; ++end)
+				{
+					q[end][c] = (UINT)MathHelper::Clamp((int)floorf((e[end][c] - p[end]) / 2.0f + 0.5f), 0, 127);
+					expanded[end][c] = (q[end][c] << 1) | p[end];
+				}
+			}
+
+			UINT palette[16][4];
+			for(int w = 0; w < 16; ++w)
+			{
+				for(int c = 0; c < 4; ++c)
+					palette[w][c] = ((64 - Weights[w]) * expanded[0][c] + Weights[w] * expanded[1][c] + 32) >> 6;
+			}
+
+			UINT error = 0, indices[16];
+			for(int i = 0; i < 16; ++i)
+			{
+				UINT bestTexelError = UINT_MAX;
+				for(UINT w = 0; w < 16; ++w)
+				{
+					UINT e = 0;
+					for(int c = 0; c < 4; ++c)
+					{
+						int d = (int)texels[i][c] - (int)palette[w][c];
+						e += (UINT)(d * d);
+					}
+					if(e < bestTexelError)
+					{
+						bestTexelError = e;
+						indices[i] = w;
+					}
+				}
+				error += bestTexelError;
+			}
+
+			if(error < bestError)
+			{
+				bestError = error;
+				memcpy(bestQ, q, sizeof(q));
+				memcpy(bestP, p, sizeof(p));
+				memcpy(bestIndices, indices, sizeof(indices));
+			}
+		}
+
+		// The first index is stored without its top bit, so it must be below 8.
+		if(bestIndices[0] >= 8)
+		{
+			for(int c = 0; c < 4; ++c)
+				std::swap(bestQ[0][c], bestQ[1][c]);
+			std::swap(bestP[0], bestP[1]);
+			for(UINT& index : bestIndices)
+				index = 15 - index;
+		}
+
+		BitWriter bits(block);
+		bits.Write(1 << 6, 7);
+		for(int c = 0; c < 4; ++c)
+		{
+			bits.Write(bestQ[0][c], 7);
+			bits.Write(bestQ[1][c], 7);
+		}
+		bits.Write(bestP[0], 1);
+		bits.Write(bestP[1], 1);
+		bits.Write(bestIndices[0], 3);
+		for(int i = 1; i < 16; ++i)
+			bits.Write(bestIndices[i], 4);
+	}
+
+	void EncodeSurface(const Image& image, DXGI_FORMAT format, std::vector<std::uint8_t>& out)
+	{
+		size_t blockBytes = format == DXGI_FORMAT_BC1_UNORM ? 8 : 16;
+		for(UINT by = 0; by < image.Height; by += 4)
+		{
+			for(UINT bx = 0; bx < image.Width; bx += 4)
+			{
+				Block texels;
+				FetchBlock(image, bx, by, texels);
+
+				size_t offset = out.size();
+				out.resize(offset + blockBytes);
+				std::uint8_t* block = &out[offset];
+				switch(format)
+				{
+				case DXGI_FORMAT_BC1_UNORM:
+					EncodeColorBlock(texels, block);
+					break;
+				case DXGI_FORMAT_BC3_UNORM:
+					EncodeSingleChannel(texels, 3, block);
+					EncodeColorBlock(texels, block + 8);
+					break;
+				case DXGI_FORMAT_BC5_UNORM:
+					EncodeSingleChannel(texels, 0, block);
+					EncodeSingleChannel(texels, 1, block + 8);
+					break;
+				default:
+					EncodeBC7Block(texels, block);
+					break;
+				}
+			}
+		}
+	}
+
+	DXGI_FORMAT ChooseFormat(const TextureRecipe& recipe, bool hasAlpha)
+	{
+		switch(recipe.Format)
+		{
+		case CookedFormat::BC1: return DXGI_FORMAT_BC1_UNORM;
+		case CookedFormat::BC3: return DXGI_FORMAT_BC3_UNORM;
+		case CookedFormat::BC5: return DXGI_FORMAT_BC5_UNORM;
+		case CookedFormat::BC7: return DXGI_FORMAT_BC7_UNORM;
+		default:
+			if(recipe.NormalMap)
+				return DXGI_FORMAT_BC5_UNORM;
+			return hasAlpha ? DXGI_FORMAT_BC3_UNORM : DXGI_FORMAT_BC1_UNORM;
+		}
+	}
+
+	bool MatchesFormat(CookedFormat wanted, DXGI_FORMAT format)
+	{
+		switch(wanted)
+		{
+		case CookedFormat::BC1: return format == DXGI_FORMAT_BC1_UNORM || format == DXGI_FORMAT_BC1_UNORM_SRGB;
+		case CookedFormat::BC3: return format == DXGI_FORMAT_BC3_UNORM || format == DXGI_FORMAT_BC3_UNORM_SRGB;
+		case CookedFormat::BC5: return format == DXGI_FORMAT_BC5_UNORM;
+		case CookedFormat::BC7: return format == DXGI_FORMAT_BC7_UNORM || format == DXGI_FORMAT_BC7_UNORM_SRGB;
+		default: return IsCookedFormat(format);
+		}
+	}
+
+	HRESULT WriteCooked(const std::wstring& filename, DXGI_FORMAT format, UINT width, UINT height,
+		UINT mipCount, UINT arraySize, std::uint64_t key, const std::uint8_t* texels, size_t texelBytes)
+	{
+		DdsHeader header = {};
+		header.Size = sizeof(DdsHeader);
+		header.Flags = DdsFlagsTexture | DdsFlagsMipCount | DdsFlagsLinearSize;
+		header.Height = height;
+		header.Width = width;
+		header.PitchOrLinearSize = (UINT32)SurfaceBytes(format, width, height);
+		header.Depth = 1;
+		header.MipMapCount = mipCount;
+		header.Reserved1[0] = CookedTag;
+		header.Reserved1[1] = (UINT32)key;
+		header.Reserved1[2] = (UINT32)(key >> 32);
+		header.PixelFormat.Size = sizeof(DdsPixelFormat);
+		header.PixelFormat.Flags = DdsPixelFourCC;
+		header.PixelFormat.FourCC = FourCC('D', 'X', '1', '0');
+		header.Caps = DdsCapsTexture | DdsCapsComplexMipmap;
+
+		DdsHeaderDxt10 dxt10 = {};
+		dxt10.Format = format;
+		dxt10.ResourceDimension = DdsDimensionTexture2D;
+		dxt10.ArraySize = arraySize;
+
+		size_t slash = filename.find_last_of(L"\\/");
+		if(slash != std::wstring::npos)
+			CreateDirectoryW(filename.substr(0, slash).c_str(), nullptr);
+
+		std::ofstream fout(filename, std::ios::binary | std::ios::trunc);
+		if(!fout)
+			return E_ACCESSDENIED;
+
+		fout.write(reinterpret_cast<const char*>(&DdsMagic), sizeof(DdsMagic));
+		fout.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		fout.write(reinterpret_cast<const char*>(&dxt10), sizeof(dxt10));
+		fout.write(reinterpret_cast<const char*>(texels), texelBytes);
+		return fout.fail() ? E_FAIL : S_OK;
+	}
+}
+
+bool TextureCooker::LoadManifest(const std::wstring& filename, std::string& error)
+{
+	mRecipes.clear();
+
+	std::ifstream fin(filename);
+	if(!fin)
+	{
+		error = "cannot open the manifest";
+		return false;
+	}
+
+	std::string line;
+	for(int lineNumber = 1; std::getline(fin, line); ++lineNumber)
+	{
+		line = line.substr(0, line.find('#'));
+
+		std::istringstream in(line);
+		std::string output;
+		if(!(in >> output))
+			continue;
+
+		TextureRecipe recipe;
+		recipe.Output = AnsiToWString(output);
+
+		std::string token;
+		while(in >> token)
+		{
+			if(token == "bc1") recipe.Format = CookedFormat::BC1;
+			else if(token == "bc3") recipe.Format = CookedFormat::BC3;
+			else if(token == "bc5") recipe.Format = CookedFormat::BC5;
+			else if(token == "bc7") recipe.Format = CookedFormat::BC7;
+			else if(token == "normal") recipe.NormalMap = true;
+			else if(token == "clamp") recipe.Clamp = true;
+			else if(token == "alphatest") recipe.AlphaTest = true;
+			else recipe.Sources.push_back(AnsiToWString(token));
+		}
+
+		if(recipe.Sources.empty())
+		{
+			error = "line " + std::to_string(lineNumber) + ": " + output + " has no sources";
+			return false;
+		}
+		mRecipes.push_back(std::move(recipe));
+	}
+	return true;
+}
+
+const std::vector<TextureRecipe>& TextureCooker::Recipes()const
+{
+	return mRecipes;
+}
+
+UINT TextureCooker::Cook(bool force, std::wstring& errors)const
+{
+	UINT cooked = 0;
+	for(const TextureRecipe& recipe : mRecipes)
+	{
+		std::uint64_t key = 0;
+		HRESULT hr = RecipeKey(recipe, key);
+		if(SUCCEEDED(hr) && !force && IsUpToDate(recipe, key))
+			continue;
+
+		if(SUCCEEDED(hr))
+			hr = CookRecipe(recipe, key);
+
+		if(SUCCEEDED(hr))
+			++cooked;
+		else
+			errors += recipe.Output + L": " + _com_error(hr).ErrorMessage() + L"\n";
+	}
+	return cooked;
+}
+
+bool TextureCooker::IsCooked(const D3D12_RESOURCE_DESC& desc)
+{
+	return desc.Dimension == D3D12_RESOURCE_DIMENSION_TEXTURE2D && IsCookedFormat(desc.Format) &&
+		desc.MipLevels == FullMipCount((UINT)desc.Width, desc.Height);
+}
+
+UINT TextureCooker::FullMipCount(UINT width, UINT height)
+{
+	UINT count = 1;
+	for(UINT size = MathHelper::Max(width, height); size > 1; size /= 2)
+		++count;
+	return count;
+}
+
+HRESULT TextureCooker::RecipeKey(const TextureRecipe& recipe, std::uint64_t& key)
+{
+	UINT options[] = { CookerVersion, (UINT)recipe.Format, recipe.NormalMap, recipe.Clamp, recipe.AlphaTest };
+	key = d3dUtil::HashBytes(options, sizeof(options));
+
+	for(const std::wstring& source : recipe.Sources)
+	{
+		std::vector<std::uint8_t> bytes;
+		if(!ReadWholeFile(source, bytes))
+			return HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+		key = d3dUtil::HashBytes(bytes.data(), bytes.size(), key);
+	}
+	return S_OK;
+}
+
+bool TextureCooker::IsUpToDate(const TextureRecipe& recipe, std::uint64_t key)
+{
+	std::ifstream fin(recipe.Output, std::ios::binary);
+	UINT32 magic = 0;
+	DdsHeader header = {};
+	fin.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+	fin.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+	return fin && magic == DdsMagic && header.Reserved1[0] == CookedTag &&
+		header.Reserved1[1] == (UINT32)key && header.Reserved1[2] == (UINT32)(key >> 32);
+}
+
+HRESULT TextureCooker::CookRecipe(const TextureRecipe& recipe, std::uint64_t key)
+{
+	std::vector<Image> slices;
+	for(const std::wstring& source : recipe.Sources)
+	{
+		if(!IsDdsFile(source))
+		{
+			slices.emplace_back();
+			HRESULT hr = LoadWic(source, slices.back());
+			if(FAILED(hr))
+				return hr;
+			continue;
+		}
+
+		std::vector<std::uint8_t> bytes;
+		if(!ReadWholeFile(source, bytes))
+			return HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+
+		DdsSource dds;
+		HRESULT hr = ParseDds(bytes, dds);
+		if(FAILED(hr))
+			return hr;
+
+		// Already cooked, by hand or by another tool: keep the texels as they are.
+		if(recipe.Sources.size() == 1 && MatchesFormat(recipe.Format, dds.Format) &&
+			dds.MipCount == FullMipCount(dds.Width, dds.Height))
+		{
+			return WriteCooked(recipe.Output, dds.Format, dds.Width, dds.Height, dds.MipCount,
+				dds.ArraySize, key, dds.Texels, dds.TexelBytes);
+		}
+
+		for(UINT slice = 0; slice < dds.ArraySize; ++slice)
+		{
+			slices.emplace_back();
+			hr = DecodeSlice(dds, slice, slices.back());
+			if(FAILED(hr))
+				return hr;
+		}
+	}
+
+	// Every slice takes the size of the first.
+	const UINT width = slices[0].Width;
+	const UINT height = slices[0].Height;
+	bool hasAlpha = false;
+	for(Image& slice : slices)
+	{
+		if(slice.Width != width || slice.Height != height)
+		{
+			Image resized;
+			Resample(slice, width, height, recipe.Clamp, resized);
+			slice = std::move(resized);
+		}
+
+		for(const XMFLOAT4& t : slice.Texels)
+			hasAlpha = hasAlpha || t.w < 254.5f / 255.0f;
+	}
+
+	const DXGI_FORMAT format = ChooseFormat(recipe, hasAlpha);
+	const UINT mipCount = FullMipCount(width, height);
+	const bool alphaTest = recipe.AlphaTest && hasAlpha;
+
+	std::vector<std::uint8_t> texels;
+	for(Image& slice : slices)
+	{
+		float coverage = alphaTest ? AlphaCoverage(slice, 1.0f) : 0.0f;
+		EncodeSurface(slice, format, texels);
+
+		Image level = std::move(slice);
+		ToFilterSpace(level, recipe.NormalMap, hasAlpha);
+		for(UINT mip = 1; mip < mipCount; ++mip)
+		{
+			Image next;
+			Resample(level, MathHelper::Max(1u, width >> mip), MathHelper::Max(1u, height >> mip), recipe.Clamp, next);
+			level = std::move(next);
+
+			Image output = level;
+			FromFilterSpace(output, recipe.NormalMap, hasAlpha);
+			if(alphaTest)
+				PreserveCoverage(output, coverage);
+			EncodeSurface(output, format, texels);
+		}
+	}
+
+	return WriteCooked(recipe.Output, format, width, height, mipCount, (UINT)slices.size(),
+		key, texels.data(), texels.size());
+}
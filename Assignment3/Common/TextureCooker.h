@@ -0,0 +1,81 @@
+//***************************************************************************************
+// TextureCooker.h
+//
+// Offline conversion of source images into the DDS files the runtime streams: block
+// compressed, with a complete mip chain, arrays already assembled.
+//   -A manifest lists one recipe per line: the cooked file, its sources (one per
+//    array slice; a DDS array source gives all of its slices) and options.  Sources
+//    are BMP/PNG/JPG/TIFF (through WIC) or DDS in an uncompressed 32-bit format or
+//    BC1-BC3, so the old hand-made DDS files can be cooked again.
+//   -Auto picks BC1 for opaque colour, BC3 when any texel has alpha and BC5 for
+//    normal maps; "bc7" asks for BC7 (mode 6) instead.  A source that is already
+//    BC1/BC3/BC5/BC7 with a complete mip chain is kept as it is.
+//   -Mips are downsampled from the previous level with a separable Kaiser-windowed
+//    sinc, in linear space for colour, premultiplied by alpha when there is alpha.
+//    Alpha tested textures keep the coverage of level 0 at AlphaTestCutoff.  Normal
+//    maps are renormalized.
+//   -The cooked header records a hash of the sources and options.  Cook() skips
+//    recipes whose output still matches, so it is cheap to run at every startup.
+//***************************************************************************************
+
+#pragma once
+
+#include "d3dUtil.h"
+
+enum class CookedFormat { Auto = 0, BC1, BC3, BC5, BC7 };
+
+struct TextureRecipe
+{
+	std::wstring Output;
+	std::vector<std::wstring> Sources;
+	CookedFormat Format = CookedFormat::Auto;
+
+	// Filter in [-1, 1] and renormalize; Auto picks BC5 (x and y only).
+	bool NormalMap = false;
+
+	// Repeat the edge instead of wrapping around when filtering, for textures that
+	// don't tile such as sprites.
+	bool Clamp = false;
+
+	// Keep each mip's coverage at AlphaTestCutoff what it is at level 0, so alpha
+	// tested edges don't fade out in the distance.
+	bool AlphaTest = false;
+};
+
+class TextureCooker
+{
+public:
+	// Matches the clip() in the shaders that alpha test.
+	static const float AlphaTestCutoff;
+
+	TextureCooker() = default;
+	TextureCooker(const TextureCooker& rhs) = delete;
+	TextureCooker& operator=(const TextureCooker& rhs) = delete;
+	~TextureCooker() = default;
+
+	// Lines are "<output> <source>... [options]", the options being bc1, bc3, bc5,
+	// bc7, normal, clamp and alphatest.  Paths are relative to the working directory
+	// and '#' starts a comment.  False with error set if the file is missing or a
+	// line is malformed.
+	bool LoadManifest(const std::wstring& filename, std::string& error);
+	const std::vector<TextureRecipe>& Recipes()const;
+
+	// Cooks every recipe whose output is missing or stale, or all of them with force.
+	// Returns how many were written; a recipe that fails adds a line to errors and
+	// leaves its old output alone.
+	UINT Cook(bool force, std::wstring& errors)const;
+
+	// True for what Cook() writes: BC1/BC3/BC5/BC7 with mips down to 1x1.  A copy
+	// with its top mips clipped still counts.
+	static bool IsCooked(const D3D12_RESOURCE_DESC& desc);
+	static UINT FullMipCount(UINT width, UINT height);
+
+private:
+	// Hashes the options and the bytes of every source; fails if one can't be read.
+	static HRESULT RecipeKey(const TextureRecipe& recipe, std::uint64_t& key);
+	static bool IsUpToDate(const TextureRecipe& recipe, std::uint64_t key);
+	static HRESULT CookRecipe(const TextureRecipe& recipe, std::uint64_t key);
+
+private:
+	std::vector<TextureRecipe> mRecipes;
+};
@@ -0,0 +1,322 @@
+//***************************************************************************************
+// TextureStreamer.cpp
+//***************************************************************************************
+
+#include "TextureStreamer.h"
+#include "DDSTextureLoader.h"
+#include "TextureCooker.h"
+#include <fstream>
+
+using Microsoft::WRL::ComPtr;
+
+TextureStreamer::TextureStreamer(ID3D12Device* device, PlacedResourceAllocator& allocator,
+	UINT64 stagingByteSize, UINT lowResMaxSize) :
+	mDevice(device),
+	mAllocator(allocator),
+	mLowResMaxSize(lowResMaxSize)
+{
+	D3D12_COMMAND_QUEUE_DESC queueDesc = {};
+	queueDesc.Type = D3D12_COMMAND_LIST_TYPE_COPY;
+	queueDesc.Flags = D3D12_COMMAND_QUEUE_FLAG_NONE;
+	ThrowIfFailed(mDevice->CreateCommandQueue(&queueDesc, IID_PPV_ARGS(mCopyQueue.GetAddressOf())));
+
+	for(int i = 0; i < CmdListAllocCount; ++i)
+	{
+		ThrowIfFailed(mDevice->CreateCommandAllocator(
+			D3D12_COMMAND_LIST_TYPE_COPY,
+			IID_PPV_ARGS(mCopyCmdListAllocs[i].GetAddressOf())));
+	}
+
+	ThrowIfFailed(mDevice->CreateCommandList(
+		0,
+		D3D12_COMMAND_LIST_TYPE_COPY,
+		mCopyCmdListAllocs[0].Get(),
+		nullptr,
+		IID_PPV_ARGS(mCopyCmdList.GetAddressOf())));
+	ThrowIfFailed(mCopyCmdList->Close());
+
+	ThrowIfFailed(mDevice->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&mCopyFence)));
+
+	mStagingRing = std::make_unique<UploadRingBuffer>(mDevice, stagingByteSize);
+
+	// One worker: the copy command list is recorded by a single thread.
+	mWorker = std::make_unique<ThreadPool>(1);
+}
+
+TextureStreamer::~TextureStreamer()
+{
+	// Queued jobs see the flag and return without loading anything, and the one
+	// running queues no full resolution pass.  Drained before the pool goes, since
+	// reset() nulls mWorker before joining.  A failed job has nobody left to tell.
+	mShutdown = true;
+	try
+	{
+		mWorker->Wait();
+	}
+	catch(...)
+	{
+	}
+	mWorker.reset();
+
+	WaitForCopy(mCopyFenceValue);
+}
+
+UINT TextureStreamer::Stream(const std::wstring& filename, ResidentCallback onResident)
+{
+	UINT id = (UINT)mEntries.size();
+
+	Entry entry;
+	entry.Filename = filename;
+	entry.OnResident = std::move(onResident);
+	mEntries.push_back(std::move(entry));
+
+	++mPendingCount;
+	mWorker->Submit([this, id, filename]() { LoadJob(id, filename, false); });
+	return id;
+}
+
+void TextureStreamer::Demote(UINT id)
+{
+	// The loader drops the mips larger than maxSize.
+	UINT maxSize = MathHelper::Max(mEntries[id].FullSize / 2, 1u);
+	std::wstring filename = mEntries[id].Filename;
+	mWorker->Submit([this, id, filename, maxSize]() { ReloadJob(id, filename, maxSize); });
+}
+
+void TextureStreamer::Promote(UINT id)
+{
+	std::wstring filename = mEntries[id].Filename;
+	mWorker->Submit([this, id, filename]() { ReloadJob(id, filename, 0); });
+}
+
+void TextureStreamer::Adopt(UINT id, const ComPtr<ID3D12Resource>& texture, UINT64 lastUseFence)
+{
+	Entry& entry = mEntries[id];
+	Retire(entry.Current, lastUseFence);
+	entry.Current = texture;
+}
+
+void TextureStreamer::Update(UINT64 submittedFence, UINT64 completedFence)
+{
+	UINT64 completedCopy = mCopyFence->GetCompletedValue();
+
+	std::vector<Arrival> ready;
+	{
+		std::lock_guard<std::mutex> lock(mArrivalMutex);
+		for(size_t i = 0; i < mArrivals.size(); )
+		{
+			if(mArrivals[i].CopyFence <= completedCopy)
+			{
+				ready.push_back(std::move(mArrivals[i]));
+				mArrivals.erase(mArrivals.begin() + i);
+			}
+			else
+			{
+				++i;
+			}
+		}
+	}
+
+	for(auto& arrival : ready)
+	{
+		Entry& entry = mEntries[arrival.Id];
+
+		// Frames already recorded may still sample the copy being replaced.
+		Retire(entry.Current, submittedFence);
+
+		entry.Current = arrival.Texture;
+		if(arrival.FullResolution)
+		{
+			D3D12_RESOURCE_DESC desc = entry.Current->GetDesc();
+			entry.FullSize = MathHelper::Max((UINT)desc.Width, desc.Height);
+		}
+		entry.OnResident(entry.Current, arrival.FullResolution);
+	}
+
+	for(size_t i = 0; i < mRetired.size(); )
+	{
+		if(mRetired[i].FrameFence <= completedFence)
+		{
+			ID3D12Resource* texture = mRetired[i].Texture.Get();
+			mRetired[i] = std::move(mRetired.back());
+			mRetired.pop_back();
+			mAllocator.Release(texture);
+		}
+		else
+		{
+			++i;
+		}
+	}
+}
+
+UINT TextureStreamer::PendingCount()const
+{
+	return mPendingCount;
+}
+
+ID3D12CommandQueue* TextureStreamer::CopyQueue()const
+{
+	return mCopyQueue.Get();
+}
+
+void TextureStreamer::LoadJob(UINT id, std::wstring filename, bool fullResolution)
+{
+	if(mShutdown)
+		return;
+
+	// Skip the low resolution pass for textures that already fit in it.  The DDS
+	// header stores height and width after the magic number, size and flags.
+	bool needsFullPass = false;
+	if(!fullResolution)
+	{
+		UINT32 header[5] = {};
+		std::ifstream fin(filename, std::ios::binary);
+		fin.read((char*)header, sizeof(header));
+		needsFullPass = fin && (header[4] > mLowResMaxSize || header[3] > mLowResMaxSize);
+	}
+
+	ComPtr<ID3D12Resource> texture;
+	if(!Load(filename, needsFullPass ? mLowResMaxSize : 0, texture))
+	{
+		--mPendingCount;
+		return;
+	}
+
+	PushArrival(id, texture, !needsFullPass);
+
+	// Queued behind the low resolution passes of everything streamed so far.
+	if(needsFullPass && !mShutdown)
+		mWorker->Submit([this, id, filename]() { LoadJob(id, filename, true); });
+	else
+		--mPendingCount;
+}
+
+void TextureStreamer::ReloadJob(UINT id, std::wstring filename, UINT maxSize)
+{
+	if(mShutdown)
+		return;
+
+	ComPtr<ID3D12Resource> texture;
+	if(Load(filename, maxSize, texture))
+		PushArrival(id, texture, maxSize == 0);
+}
+
+bool TextureStreamer::Load(const std::wstring& filename, UINT maxSize, ComPtr<ID3D12Resource>& texture)
+{
+	try
+	{
+		HRESULT hr = RecordCopy(filename, maxSize, texture);
+
+		// The staging ring can be full of copies still in flight; drain them and retry.
+		if(hr == E_OUTOFMEMORY)
+		{
+			WaitForCopy(mCopyFenceValue);
+			hr = RecordCopy(filename, maxSize, texture);
+		}
+
+		ThrowIfFailed(hr);
+	}
+	catch(DxException& e)
+	{
+		// The texture keeps whatever copy it had; nothing else depends on it.
+		OutputDebugString((L"TextureStreamer: " + filename + L": " + e.ToString() + L"\n").c_str());
+		return false;
+	}
+	return true;
+}
+
+void TextureStreamer::PushArrival(UINT id, const ComPtr<ID3D12Resource>& texture, bool fullResolution)
+{
+	Arrival arrival;
+	arrival.Id = id;
+	arrival.Texture = texture;
+	arrival.CopyFence = mCopyFenceValue;
+	arrival.FullResolution = fullResolution;
+
+	std::lock_guard<std::mutex> lock(mArrivalMutex);
+	mArrivals.push_back(std::move(arrival));
+}
+
+void TextureStreamer::Retire(ComPtr<ID3D12Resource>& texture, UINT64 frameFence)
+{
+	if(texture == nullptr)
+		return;
+
+	Retired retired;
+	retired.Texture = std::move(texture);
+	retired.FrameFence = frameFence;
+	mRetired.push_back(std::move(retired));
+}
+
+HRESULT TextureStreamer::RecordCopy(const std::wstring& filename, UINT maxSize, ComPtr<ID3D12Resource>& texture)
+{
+	// Alternate allocators so this copy records while the previous one executes.
+	int allocIndex = mNextCmdListAlloc;
+	mNextCmdListAlloc = (mNextCmdListAlloc + 1) % CmdListAllocCount;
+
+	WaitForCopy(mCopyCmdListAllocFences[allocIndex]);
+	mStagingRing->ReleaseCompleted(mCopyFence->GetCompletedValue());
+
+	auto cmdListAlloc = mCopyCmdListAllocs[allocIndex].Get();
+	ThrowIfFailed(cmdListAlloc->Reset());
+	ThrowIfFailed(mCopyCmdList->Reset(cmdListAlloc, nullptr));
+
+	// Copy queues only know the COMMON and copy states, so the texture is left in
+	// COMMON and promoted implicitly when the render queue first samples it.
+	HRESULT hr = S_OK;
+	try
+	{
+		hr = DirectX::CreateDDSTextureFromFile12(mDevice, mCopyCmdList.Get(), filename.c_str(),
+			mAllocator, *mStagingRing, texture, maxSize, D3D12_RESOURCE_STATE_COMMON);
+	}
+	catch(DxException& e)
+	{
+		// Thrown by the staging ring when it has no room.
+		hr = e.ErrorCode;
+	}
+
+	// Release builds only take what TextureCooker writes; a debug build loads anything
+	// so a texture can be tried out before it is added to the manifest.
+	if(SUCCEEDED(hr) && !TextureCooker::IsCooked(texture->GetDesc()))
+	{
+#if defined(DEBUG) | defined(_DEBUG)
+		OutputDebugString((L"TextureStreamer: " + filename + L" is not cooked\n").c_str());
+#else
+		hr = HRESULT_FROM_WIN32(ERROR_BAD_FORMAT);
+#endif
+	}
+
+	ThrowIfFailed(mCopyCmdList->Close());
+
+	if(FAILED(hr))
+	{
+		if(texture != nullptr)
+		{
+			ID3D12Resource* unused = texture.Get();
+			texture.Reset();
+			mAllocator.Release(unused);
+		}
+		return hr;
+	}
+
+	ID3D12CommandList* cmdsLists[] = { mCopyCmdList.Get() };
+	mCopyQueue->ExecuteCommandLists(_countof(cmdsLists), cmdsLists);
+
+	++mCopyFenceValue;
+	ThrowIfFailed(mCopyQueue->Signal(mCopyFence.Get(), mCopyFenceValue));
+	mCopyCmdListAllocFences[allocIndex] = mCopyFenceValue;
+	mStagingRing->FinishFrame(mCopyFenceValue);
+
+	return S_OK;
+}
+
+void TextureStreamer::WaitForCopy(UINT64 fenceValue)
+{
+	if(mCopyFence->GetCompletedValue() >= fenceValue)
+		return;
+
+	HANDLE eventHandle = CreateEventEx(nullptr, nullptr, false, EVENT_ALL_ACCESS);
+	ThrowIfFailed(mCopyFence->SetEventOnCompletion(fenceValue, eventHandle));
+	WaitForSingleObject(eventHandle, INFINITE);
+	CloseHandle(eventHandle);
+}
@@ -0,0 +1,131 @@
+//***************************************************************************************
+// TextureStreamer.h
+//
+// Loads DDS textures in the background on a dedicated copy queue.
+//   -Files are memory mapped and copies recorded on a worker thread, so the caller
+//    never waits on the disk.  Texels are copied once, from the file cache into the
+//    staging ring, and two command allocators let one copy record while the
+//    previous one executes.
+//   -Each texture arrives twice: first with its mips clipped to LowResMaxSize so
+//    something close to right shows up quickly, then at full resolution.  Every
+//    queued texture gets its low resolution pass before any full one.
+//   -Update() runs on the render thread once per frame.  It hands over textures
+//    whose copies have completed and frees superseded low resolution copies once
+//    the frames that sampled them have retired.
+//   -Demote() reloads a full resolution texture without its top mip to save video
+//    memory, and Promote() brings the mip back.  Either copy arrives like the others.
+//   -Release builds reject textures TextureCooker::IsCooked() doesn't accept, and
+//    the texture keeps its placeholder.
+//***************************************************************************************
+
+#pragma once
+
+#include "d3dUtil.h"
+#include "PlacedResourceAllocator.h"
+#include "ThreadPool.h"
+#include "UploadRingBuffer.h"
+#include <atomic>
+
+class TextureStreamer
+{
+public:
+	// Called from Update() when a copy of the texture is ready to sample.  When the
+	// full resolution copy arrives the caller must drop its references to the low
+	// resolution one; the streamer frees it once the current frame has retired.
+	typedef std::function<void(const Microsoft::WRL::ComPtr<ID3D12Resource>& texture, bool fullResolution)> ResidentCallback;
+
+	TextureStreamer(ID3D12Device* device, PlacedResourceAllocator& allocator,
+		UINT64 stagingByteSize = 32 * 1024 * 1024, UINT lowResMaxSize = 64);
+	TextureStreamer(const TextureStreamer& rhs) = delete;
+	TextureStreamer& operator=(const TextureStreamer& rhs) = delete;
+	~TextureStreamer();
+
+	// Returns the id the calls below take.
+	UINT Stream(const std::wstring& filename, ResidentCallback onResident);
+
+	// Only for a texture at full resolution, or demoted, with no reload in flight.
+	// fullResolution is false for the demoted copy.  A reload that fails leaves the
+	// current copy in place and never calls back.
+	void Demote(UINT id);
+	void Promote(UINT id);
+
+	// Makes texture the current copy in place of the one handed over, for a copy the
+	// caller made from it.  The frame with lastUseFence may still read the old one.
+	void Adopt(UINT id, const Microsoft::WRL::ComPtr<ID3D12Resource>& texture, UINT64 lastUseFence);
+
+	// submittedFence is the render queue fence value of the last frame submitted, i.e.
+	// the last one that may sample a copy replaced now; completedFence is the value
+	// the render queue has reached.
+	void Update(UINT64 submittedFence, UINT64 completedFence);
+
+	// Textures that have not reached full resolution yet.
+	UINT PendingCount()const;
+
+	ID3D12CommandQueue* CopyQueue()const;
+
+private:
+	struct Arrival
+	{
+		UINT Id = 0;
+		Microsoft::WRL::ComPtr<ID3D12Resource> Texture;
+		UINT64 CopyFence = 0;
+		bool FullResolution = false;
+	};
+
+	struct Entry
+	{
+		std::wstring Filename;
+		ResidentCallback OnResident;
+		Microsoft::WRL::ComPtr<ID3D12Resource> Current;
+
+		// Larger side of the full resolution copy, once it has arrived.
+		UINT FullSize = 0;
+	};
+
+	struct Retired
+	{
+		Microsoft::WRL::ComPtr<ID3D12Resource> Texture;
+		UINT64 FrameFence = 0;
+	};
+
+	void LoadJob(UINT id, std::wstring filename, bool fullResolution);
+	void ReloadJob(UINT id, std::wstring filename, UINT maxSize);
+
+	// Records and submits a copy, retrying once if the staging ring is full.  Logs and
+	// returns false on failure.
+	bool Load(const std::wstring& filename, UINT maxSize, Microsoft::WRL::ComPtr<ID3D12Resource>& texture);
+	void PushArrival(UINT id, const Microsoft::WRL::ComPtr<ID3D12Resource>& texture, bool fullResolution);
+	void Retire(Microsoft::WRL::ComPtr<ID3D12Resource>& texture, UINT64 frameFence);
+	HRESULT RecordCopy(const std::wstring& filename, UINT maxSize, Microsoft::WRL::ComPtr<ID3D12Resource>& texture);
+	void WaitForCopy(UINT64 fenceValue);
+
+private:
+	ID3D12Device* mDevice = nullptr;
+	PlacedResourceAllocator& mAllocator;
+	UINT mLowResMaxSize = 0;
+
+	Microsoft::WRL::ComPtr<ID3D12CommandQueue> mCopyQueue;
+	static const int CmdListAllocCount = 2;
+	Microsoft::WRL::ComPtr<ID3D12CommandAllocator> mCopyCmdListAllocs[CmdListAllocCount];
+	UINT64 mCopyCmdListAllocFences[CmdListAllocCount] = {};
+	int mNextCmdListAlloc = 0;
+	Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> mCopyCmdList;
+	Microsoft::WRL::ComPtr<ID3D12Fence> mCopyFence;
+	UINT64 mCopyFenceValue = 0;
+
+	// Only touched by the worker thread.
+	std::unique_ptr<UploadRingBuffer> mStagingRing;
+
+	// Render thread only.
+	std::vector<Entry> mEntries;
+	std::vector<Retired> mRetired;
+
+	std::mutex mArrivalMutex;
+	std::vector<Arrival> mArrivals;
+
+	std::atomic<UINT> mPendingCount{ 0 };
+	std::atomic<bool> mShutdown{ false };
+
+	// Declared last so the worker is joined before anything it uses is destroyed.
+	std::unique_ptr<ThreadPool> mWorker;
+};
@@ -0,0 +1,95 @@
+//***************************************************************************************
+// ThreadPool.cpp
+//***************************************************************************************
+
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(unsigned int threadCount)
+{
+	if(threadCount == 0)
+	{
+		unsigned int cores = std::thread::hardware_concurrency();
+		threadCount = cores > 1 ? cores - 1 : 1;
+	}
+
+	mThreads.reserve(threadCount);
+	for(unsigned int i = 0; i < threadCount; ++i)
+		mThreads.emplace_back(&ThreadPool::WorkerLoop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mShutdown = true;
+	}
+	mTaskAvailable.notify_all();
+
+	for(auto& t : mThreads)
+		t.join();
+}
+
+void ThreadPool::Submit(std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mTasks.push(std::move(task));
+		++mPendingTasks;
+	}
+	mTaskAvailable.notify_one();
+}
+
+void ThreadPool::Wait()
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	mAllDone.wait(lock, [this] { return mPendingTasks == 0; });
+
+	if(mFirstError != nullptr)
+	{
+		std::exception_ptr error = mFirstError;
+		mFirstError = nullptr;
+		std::rethrow_exception(error);
+	}
+}
+
+unsigned int ThreadPool::ThreadCount()const
+{
+	return (unsigned int)mThreads.size();
+}
+
+void ThreadPool::WorkerLoop()
+{
+	for(;;)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mTaskAvailable.wait(lock, [this] { return mShutdown || !mTasks.empty(); });
+
+			if(mShutdown && mTasks.empty())
+				return;
+
+			task = std::move(mTasks.front());
+			mTasks.pop();
+		}
+
+		try
+		{
+			task();
+		}
+		catch(...)
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			if(mFirstError == nullptr)
+				mFirstError = std::current_exception();
+		}
+
+		bool allDone = false;
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			allDone = (--mPendingTasks == 0);
+		}
+		if(allDone)
+			mAllDone.notify_all();
+	}
+}
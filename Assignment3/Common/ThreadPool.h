@@ -0,0 +1,49 @@
+//***************************************************************************************
+// ThreadPool.h
+//
+// Fixed set of worker threads that run submitted tasks in FIFO order.
+//   -Wait() blocks the caller until every submitted task has finished.
+//   -An exception thrown by a task (e.g. a DxException from ThrowIfFailed) is
+//    caught on the worker and rethrown from Wait() on the calling thread.
+//***************************************************************************************
+
+#pragma once
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+	// A thread count of 0 uses one thread per hardware core minus the caller's.
+	explicit ThreadPool(unsigned int threadCount = 0);
+	ThreadPool(const ThreadPool& rhs) = delete;
+	ThreadPool& operator=(const ThreadPool& rhs) = delete;
+	~ThreadPool();
+
+	void Submit(std::function<void()> task);
+	void Wait();
+
+	unsigned int ThreadCount()const;
+
+private:
+	void WorkerLoop();
+
+private:
+	std::vector<std::thread> mThreads;
+	std::queue<std::function<void()>> mTasks;
+
+	std::mutex mMutex;
+	std::condition_variable mTaskAvailable;
+	std::condition_variable mAllDone;
+
+	unsigned int mPendingTasks = 0;
+	bool mShutdown = false;
+
+	std::exception_ptr mFirstError = nullptr;
+};
@@ -0,0 +1,150 @@
+//***************************************************************************************
+// TransformStore.cpp
+//***************************************************************************************
+
+#include "TransformStore.h"
+#include <cassert>
+
+using namespace DirectX;
+
+namespace
+{
+	const XMFLOAT4X4 Identity(
+		1.0f, 0.0f, 0.0f, 0.0f,
+		0.0f, 1.0f, 0.0f, 0.0f,
+		0.0f, 0.0f, 1.0f, 0.0f,
+		0.0f, 0.0f, 0.0f, 1.0f);
+}
+
+DirtyList::DirtyList(int frameCount) :
+	mFrameCount(frameCount)
+{
+	assert(frameCount > 0 && frameCount < 256);
+}
+
+void DirtyList::Resize(std::uint32_t count)
+{
+	if(count < mFramesLeft.size())
+	{
+		mIds.erase(std::remove_if(mIds.begin(), mIds.end(),
+			[count](std::uint32_t id) { return id >= count; }), mIds.end());
+	}
+
+	mFramesLeft.resize(count, 0);
+}
+
+void DirtyList::Mark(std::uint32_t id)
+{
+	assert(id < mFramesLeft.size());
+
+	// Already listed ids just get their count topped up.
+	if(mFramesLeft[id] == 0)
+		mIds.push_back(id);
+
+	mFramesLeft[id] = (std::uint8_t)mFrameCount;
+}
+
+void DirtyList::Clear(std::uint32_t id)
+{
+	if(mFramesLeft[id] == 0)
+		return;
+
+	mFramesLeft[id] = 0;
+	mIds.erase(std::find(mIds.begin(), mIds.end(), id));
+}
+
+bool DirtyList::IsDirty(std::uint32_t id)const
+{
+	return mFramesLeft[id] > 0;
+}
+
+TransformStore::TransformStore(int frameCount) :
+	mDirty(frameCount)
+{
+}
+
+std::uint32_t TransformStore::Allocate()
+{
+	std::uint32_t slot;
+	if(!mFreeSlots.empty())
+	{
+		slot = mFreeSlots.back();
+		mFreeSlots.pop_back();
+	}
+	else
+	{
+		slot = (std::uint32_t)mWorld.size();
+		mWorld.push_back(Identity);
+		mTexTransform.push_back(Identity);
+		mDirty.Resize(slot + 1);
+	}
+
+	mWorld[slot] = Identity;
+	mTexTransform[slot] = Identity;
+	mDirty.Mark(slot);
+
+	return slot;
+}
+
+void TransformStore::Free(std::uint32_t slot)
+{
+	assert(slot < mWorld.size());
+
+	mDirty.Clear(slot);
+	mFreeSlots.push_back(slot);
+}
+
+void TransformStore::Reserve(std::uint32_t capacity)
+{
+	const std::uint32_t oldCapacity = Capacity();
+	if(capacity <= oldCapacity)
+		return;
+
+	mWorld.resize(capacity, Identity);
+	mTexTransform.resize(capacity, Identity);
+	mDirty.Resize(capacity);
+
+	// Allocate() pops from the back.
+	for(std::uint32_t slot = capacity; slot > oldCapacity; --slot)
+		mFreeSlots.push_back(slot - 1);
+}
+
+void TransformStore::Clear()
+{
+	mWorld.clear();
+	mTexTransform.clear();
+	mFreeSlots.clear();
+	mDirty.Resize(0);
+}
+
+void TransformStore::SetWorld(std::uint32_t slot, const XMFLOAT4X4& world)
+{
+	mWorld[slot] = world;
+	mDirty.Mark(slot);
+}
+
+void TransformStore::SetTexTransform(std::uint32_t slot, const XMFLOAT4X4& texTransform)
+{
+	mTexTransform[slot] = texTransform;
+	mDirty.Mark(slot);
+}
+
+void TransformStore::MarkDirty(std::uint32_t slot)
+{
+	mDirty.Mark(slot);
+}
+
+const XMFLOAT4X4& TransformStore::World(std::uint32_t slot)const
+{
+	return mWorld[slot];
+}
+
+const XMFLOAT4X4& TransformStore::TexTransform(std::uint32_t slot)const
+{
+	return mTexTransform[slot];
+}
+
+std::uint32_t TransformStore::Capacity()const
+{
+	return (std::uint32_t)mWorld.size();
+}
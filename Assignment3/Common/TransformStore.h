@@ -0,0 +1,111 @@
+//***************************************************************************************
+// TransformStore.h
+//
+// Structure-of-arrays storage for per-object transforms.
+//   -World and texture transforms live in two contiguous arrays indexed by slot;
+//    the slot doubles as the object's constant buffer index.  Freed slots go on a
+//    free list and are handed out again before the arrays grow.  Reserve() grows
+//    them up front, for a caller that sizes its constant buffers once.
+//   -DirtyList remembers which slots changed and for how many more frame resources
+//    they still have to be written.  Each frame the consumer visits only those
+//    slots, in ascending runs, so a static scene costs nothing to update.
+//***************************************************************************************
+
+#pragma once
+
+#include <DirectXMath.h>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+class DirtyList
+{
+public:
+	explicit DirtyList(int frameCount);
+	DirtyList(const DirtyList& rhs) = delete;
+	DirtyList& operator=(const DirtyList& rhs) = delete;
+	~DirtyList() = default;
+
+	void Resize(std::uint32_t count);
+
+	// The id has to be rewritten into the next frameCount frame resources.
+	void Mark(std::uint32_t id);
+
+	// Drops the id without writing it again, e.g. when its slot is freed.
+	void Clear(std::uint32_t id);
+
+	bool IsDirty(std::uint32_t id)const;
+
+	// Calls fn(first, count) for every run of consecutive dirty ids, in ascending
+	// order, then counts the frame resource as written.  Call once per frame.
+	template<typename Fn>
+	void Consume(Fn&& fn)
+	{
+		std::sort(mIds.begin(), mIds.end());
+
+		size_t runStart = 0;
+		for(size_t i = 1; i <= mIds.size(); ++i)
+		{
+			if(i == mIds.size() || mIds[i] != mIds[i - 1] + 1)
+			{
+				fn(mIds[runStart], (std::uint32_t)(i - runStart));
+				runStart = i;
+			}
+		}
+
+		// Keep the ids that still have frame resources to reach.
+		size_t kept = 0;
+		for(std::uint32_t id : mIds)
+		{
+			if(--mFramesLeft[id] > 0)
+				mIds[kept++] = id;
+		}
+		mIds.resize(kept);
+	}
+
+private:
+	int mFrameCount = 0;
+	std::vector<std::uint8_t> mFramesLeft;
+	std::vector<std::uint32_t> mIds;
+};
+
+class TransformStore
+{
+public:
+	explicit TransformStore(int frameCount);
+	TransformStore(const TransformStore& rhs) = delete;
+	TransformStore& operator=(const TransformStore& rhs) = delete;
+	~TransformStore() = default;
+
+	// New slots start with identity transforms and dirty.
+	std::uint32_t Allocate();
+	void Free(std::uint32_t slot);
+
+	// Adds free slots until Capacity() is at least capacity.  The lowest of them are
+	// handed out first.
+	void Reserve(std::uint32_t capacity);
+	void Clear();
+
+	void SetWorld(std::uint32_t slot, const DirectX::XMFLOAT4X4& world);
+	void SetTexTransform(std::uint32_t slot, const DirectX::XMFLOAT4X4& texTransform);
+	void MarkDirty(std::uint32_t slot);
+
+	const DirectX::XMFLOAT4X4& World(std::uint32_t slot)const;
+	const DirectX::XMFLOAT4X4& TexTransform(std::uint32_t slot)const;
+
+	// Slots in use or on the free list; constant buffers must hold this many.
+	std::uint32_t Capacity()const;
+
+	// See DirtyList::Consume.
+	template<typename Fn>
+	void ConsumeDirtyRanges(Fn&& fn)
+	{
+		mDirty.Consume(fn);
+	}
+
+private:
+	std::vector<DirectX::XMFLOAT4X4> mWorld;
+	std::vector<DirectX::XMFLOAT4X4> mTexTransform;
+	std::vector<std::uint32_t> mFreeSlots;
+	DirtyList mDirty;
+};
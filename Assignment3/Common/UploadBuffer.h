@@ -1,6 +1,7 @@
 #pragma once
 
 #include "d3dUtil.h"
+#include "ThreadPool.h"
 
 template<typename T>
 class UploadBuffer
@@ -55,6 +56,55 @@ public:
         memcpy(&mMappedData[elementIndex*mElementByteSize], &data, sizeof(T));
     }
 
+    // Fills elements [firstElement, firstElement + count) by calling write(index, dst)
+    // with dst pointing straight at the mapped element, so nothing is staged on the
+    // stack first.  The memory is write-combined: write() should store every byte
+    // once, ideally with MathHelper::StoreTransposedStream, and never read dst.
+    // Given a pool, ranges of ParallelThreshold elements or more are split across
+    // its threads, so write() must be safe to call concurrently for different indices.
+    template<typename Fn>
+    void CopyRange(UINT firstElement, UINT count, Fn write, ThreadPool* pool = nullptr)
+    {
+        auto writeSpan = [this, &write](UINT first, UINT end)
+        {
+            for(UINT i = first; i < end; ++i)
+                write(i, reinterpret_cast<T*>(&mMappedData[i*mElementByteSize]));
+
+            // Drain the write-combining buffers before the list using them is submitted.
+            MathHelper::StreamFence();
+        };
+
+        UINT end = firstElement + count;
+        if(pool == nullptr || count < ParallelThreshold)
+        {
+            writeSpan(firstElement, end);
+            return;
+        }
+
+        // One span per worker plus one for the calling thread.
+        UINT spanCount = pool->ThreadCount() + 1;
+        UINT spanSize = (count + spanCount - 1) / spanCount;
+
+        UINT first = firstElement;
+        for(; first + spanSize < end; first += spanSize)
+        {
+            UINT spanEnd = first + spanSize;
+            pool->Submit([&writeSpan, first, spanEnd]() { writeSpan(first, spanEnd); });
+        }
+        writeSpan(first, end);
+
+        pool->Wait();
+    }
+
+    // For stores into this buffer made from inside another buffer's CopyRange() write,
+    // whose fence also covers them.  The same rules apply: store only, never read.
+    T* MappedElement(UINT elementIndex)
+    {
+        return reinterpret_cast<T*>(&mMappedData[elementIndex*mElementByteSize]);
+    }
+
+    static const UINT ParallelThreshold = 4096;
+
 private:
     Microsoft::WRL::ComPtr<ID3D12Resource> mUploadBuffer;
     BYTE* mMappedData = nullptr;
@@ -0,0 +1,128 @@
+//***************************************************************************************
+// UploadRingBuffer.cpp
+//***************************************************************************************
+
+#include "UploadRingBuffer.h"
+
+static UINT64 AlignUp(UINT64 value, UINT64 alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+UploadRingBuffer::UploadRingBuffer(ID3D12Device* device, UINT64 byteSize) :
+	mSize(byteSize)
+{
+	ThrowIfFailed(device->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
+		D3D12_HEAP_FLAG_NONE,
+		&CD3DX12_RESOURCE_DESC::Buffer(byteSize),
+		D3D12_RESOURCE_STATE_GENERIC_READ,
+		nullptr,
+		IID_PPV_ARGS(&mBuffer)));
+
+	// Stays mapped for the lifetime of the ring.
+	ThrowIfFailed(mBuffer->Map(0, nullptr, reinterpret_cast<void**>(&mMappedData)));
+}
+
+UploadRingBuffer::~UploadRingBuffer()
+{
+	if(mBuffer != nullptr)
+		mBuffer->Unmap(0, nullptr);
+
+	mMappedData = nullptr;
+}
+
+UploadRingBuffer::Allocation UploadRingBuffer::Allocate(UINT64 byteSize, UINT64 alignment)
+{
+	assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+	// Nothing in flight, so start from the beginning and keep the allocation contiguous.
+	if(mBytesInUse == 0)
+		mHead = mTail = 0;
+
+	UINT64 offset = AlignUp(mHead, alignment);
+	bool fits = false;
+
+	if(mHead == mTail && mBytesInUse > 0)
+	{
+		// Head has caught up with the tail: every byte is in flight.
+		fits = false;
+	}
+	else if(mHead >= mTail)
+	{
+		// Free space is [head, size) followed by [0, tail).
+		if(offset + byteSize <= mSize)
+		{
+			fits = true;
+		}
+		else if(byteSize <= mTail)
+		{
+			// Skip the end of the buffer and wrap around.
+			offset = 0;
+			fits = true;
+		}
+	}
+	else
+	{
+		// Free space is [head, tail).
+		fits = offset + byteSize <= mTail;
+	}
+
+	if(!fits)
+		ThrowIfFailed(E_OUTOFMEMORY);
+
+	// Padding and the skipped end of the buffer count against the frame too.
+	UINT64 consumed = (offset >= mHead ? offset - mHead : mSize - mHead + offset) + byteSize;
+	mBytesInUse += consumed;
+	mFrameBytes += consumed;
+	mHead = offset + byteSize;
+
+	Allocation alloc;
+	alloc.CpuAddress = mMappedData + offset;
+	alloc.GpuAddress = mBuffer->GetGPUVirtualAddress() + offset;
+	alloc.Resource = mBuffer.Get();
+	alloc.Offset = offset;
+	return alloc;
+}
+
+UploadRingBuffer::Allocation UploadRingBuffer::AllocateConstants(UINT64 byteSize)
+{
+	return Allocate(d3dUtil::CalcConstantBufferByteSize((UINT)byteSize),
+		D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT);
+}
+
+void UploadRingBuffer::FinishFrame(UINT64 fenceValue)
+{
+	FrameMark mark;
+	mark.Fence = fenceValue;
+	mark.Head = mHead;
+	mark.ByteCount = mFrameBytes;
+	mFrames.push_back(mark);
+
+	mFrameBytes = 0;
+}
+
+void UploadRingBuffer::ReleaseCompleted(UINT64 completedFenceValue)
+{
+	while(!mFrames.empty() && mFrames.front().Fence <= completedFenceValue)
+	{
+		mTail = mFrames.front().Head;
+		mBytesInUse -= mFrames.front().ByteCount;
+		mFrames.pop_front();
+	}
+}
+
+ID3D12Resource* UploadRingBuffer::Resource()const
+{
+	return mBuffer.Get();
+}
+
+UINT64 UploadRingBuffer::Size()const
+{
+	return mSize;
+}
+
+UINT64 UploadRingBuffer::BytesInUse()const
+{
+	return mBytesInUse;
+}
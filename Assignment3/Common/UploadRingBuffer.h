@@ -0,0 +1,81 @@
+//***************************************************************************************
+// UploadRingBuffer.h
+//
+// One large, persistently mapped upload heap that hands out linear sub-allocations
+// for data that only lives for a frame (pass constants, per-frame lists, staging
+// copies).  Allocations are made at the head of the ring; each frame's allocations
+// are retired together once the GPU has passed the fence value given to
+// FinishFrame().  Constant buffer allocations are 256-byte aligned and sized.
+//
+// Usage per frame:
+//   ring.ReleaseCompleted(fence->GetCompletedValue());
+//   auto cb = ring.CopyConstants(passConstants);  ...
+//   ring.FinishFrame(fenceValueSignalledForThisFrame);
+//***************************************************************************************
+
+#pragma once
+
+#include "d3dUtil.h"
+#include <deque>
+
+class UploadRingBuffer
+{
+public:
+	struct Allocation
+	{
+		void* CpuAddress = nullptr;
+		D3D12_GPU_VIRTUAL_ADDRESS GpuAddress = 0;
+
+		// For CopyBufferRegion and friends.
+		ID3D12Resource* Resource = nullptr;
+		UINT64 Offset = 0;
+	};
+
+	UploadRingBuffer(ID3D12Device* device, UINT64 byteSize);
+	UploadRingBuffer(const UploadRingBuffer& rhs) = delete;
+	UploadRingBuffer& operator=(const UploadRingBuffer& rhs) = delete;
+	~UploadRingBuffer();
+
+	// Throws a DxException with E_OUTOFMEMORY if the frames still in flight leave no room.
+	Allocation Allocate(UINT64 byteSize, UINT64 alignment = 16);
+	Allocation AllocateConstants(UINT64 byteSize);
+
+	// Allocates constant buffer space for data and copies it in.
+	template<typename T>
+	Allocation CopyConstants(const T& data)
+	{
+		Allocation alloc = AllocateConstants(sizeof(T));
+		memcpy(alloc.CpuAddress, &data, sizeof(T));
+		return alloc;
+	}
+
+	// Closes the current frame; its allocations are retired once fenceValue completes.
+	void FinishFrame(UINT64 fenceValue);
+
+	// Retires every finished frame whose fence value is <= completedFenceValue.
+	void ReleaseCompleted(UINT64 completedFenceValue);
+
+	ID3D12Resource* Resource()const;
+	UINT64 Size()const;
+	UINT64 BytesInUse()const;
+
+private:
+	struct FrameMark
+	{
+		UINT64 Fence = 0;
+		UINT64 Head = 0;
+		UINT64 ByteCount = 0;
+	};
+
+	Microsoft::WRL::ComPtr<ID3D12Resource> mBuffer;
+	BYTE* mMappedData = nullptr;
+
+	UINT64 mSize = 0;
+	UINT64 mHead = 0;
+	UINT64 mTail = 0;
+	UINT64 mBytesInUse = 0;
+
+	// Bytes allocated since the last FinishFrame().
+	UINT64 mFrameBytes = 0;
+	std::deque<FrameMark> mFrames;
+};
@@ -0,0 +1,188 @@
+//***************************************************************************************
+// WorldPartition.cpp
+//***************************************************************************************
+
+#include "WorldPartition.h"
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+
+using namespace DirectX;
+
+WorldPartition::WorldPartition(const Settings& settings, LoadFunction load) :
+	mSettings(settings),
+	mLoad(std::move(load))
+{
+	assert(mSettings.UnloadRadius >= mSettings.LoadRadius);
+
+	mWorker = std::make_unique<ThreadPool>(1);
+}
+
+void WorldPartition::Update(const XMFLOAT3& eye, const LoadedCallback& onLoaded, const UnloadCallback& onUnload,
+	bool waitForLoads)
+{
+	Commit(onLoaded, mSettings.MaxCommitsPerUpdate);
+
+	// Cells out of range go first so their room can be loaded into.  One still loading
+	// just loses its entry; what it builds is dropped on arrival.
+	for(auto it = mCells.begin(); it != mCells.end();)
+	{
+		const Cell& cell = it->second;
+		if(Distance(eye, cell.X, cell.Z) <= mSettings.UnloadRadius)
+		{
+			++it;
+			continue;
+		}
+
+		if(cell.State == CellState::Loaded)
+			onUnload(cell.X, cell.Z);
+		else
+			--mLoadingCount;
+		it = mCells.erase(it);
+	}
+
+	StartLoads(eye);
+
+	if(waitForLoads)
+	{
+		mWorker->Wait();
+		Commit(onLoaded, SIZE_MAX);
+	}
+}
+
+XMFLOAT3 WorldPartition::CellCenter(int x, int z)const
+{
+	return XMFLOAT3(x * mSettings.CellWidth, 0.0f, z * mSettings.CellDepth);
+}
+
+const WorldPartition::Settings& WorldPartition::GetSettings()const
+{
+	return mSettings;
+}
+
+UINT WorldPartition::LoadedCount()const
+{
+	return (UINT)mCells.size() - mLoadingCount;
+}
+
+UINT WorldPartition::LoadingCount()const
+{
+	return mLoadingCount;
+}
+
+std::uint64_t WorldPartition::Key(int x, int z)
+{
+	return ((std::uint64_t)(std::uint32_t)x << 32) | (std::uint32_t)z;
+}
+
+float WorldPartition::Distance(const XMFLOAT3& eye, int x, int z)const
+{
+	const XMFLOAT3 center = CellCenter(x, z);
+	float dx = MathHelper::Max(fabsf(eye.x - center.x) - 0.5f * mSettings.CellWidth, 0.0f);
+	float dz = MathHelper::Max(fabsf(eye.z - center.z) - 0.5f * mSettings.CellDepth, 0.0f);
+	return sqrtf(dx * dx + dz * dz);
+}
+
+void WorldPartition::Commit(const LoadedCallback& onLoaded, size_t maxCommits)
+{
+	{
+		std::lock_guard<std::mutex> lock(mArrivalMutex);
+		size_t count = MathHelper::Min(maxCommits, mArrivals.size());
+		mCommitScratch.clear();
+		std::move(mArrivals.begin(), mArrivals.begin() + count, std::back_inserter(mCommitScratch));
+		mArrivals.erase(mArrivals.begin(), mArrivals.begin() + count);
+	}
+
+	mInFlight -= (UINT)mCommitScratch.size();
+	for(Arrival& arrival : mCommitScratch)
+	{
+		// Unloaded, or unloaded and asked for again, since this load started.
+		auto it = mCells.find(arrival.Key);
+		if(it == mCells.end() || it->second.Request != arrival.Request)
+			continue;
+
+		Cell& cell = it->second;
+		cell.State = CellState::Loaded;
+		--mLoadingCount;
+
+		// A loader that failed leaves the cell loaded and empty rather than retrying
+		// every frame.
+		if(arrival.Data != nullptr)
+			onLoaded(cell.X, cell.Z, std::move(arrival.Data));
+	}
+	mCommitScratch.clear();
+}
+
+void WorldPartition::StartLoads(const XMFLOAT3& eye)
+{
+	// Loads for cells dropped since still count until they arrive; the worker is
+	// busy with them all the same.
+	if(mInFlight >= mSettings.MaxLoadsInFlight || mCells.size() >= mSettings.MaxCells)
+		return;
+
+	// Only the cells whose rectangles can reach into the load radius are looked at.
+	// An unbounded radius is clamped so the range stays representable.
+	const float r = MathHelper::Min(mSettings.LoadRadius, 1.0e6f);
+	int x0 = MathHelper::Max(mSettings.MinX, (int)floorf((eye.x - r) / mSettings.CellWidth - 0.5f));
+	int x1 = MathHelper::Min(mSettings.MaxX, (int)ceilf((eye.x + r) / mSettings.CellWidth + 0.5f));
+	int z0 = MathHelper::Max(mSettings.MinZ, (int)floorf((eye.z - r) / mSettings.CellDepth - 0.5f));
+	int z1 = MathHelper::Min(mSettings.MaxZ, (int)ceilf((eye.z + r) / mSettings.CellDepth + 0.5f));
+
+	mCandidates.clear();
+	for(int z = z0; z <= z1; ++z)
+	{
+		for(int x = x0; x <= x1; ++x)
+		{
+			float distance = Distance(eye, x, z);
+			if(distance <= mSettings.LoadRadius && mCells.count(Key(x, z)) == 0)
+				mCandidates.push_back({ distance, x, z });
+		}
+	}
+
+	std::sort(mCandidates.begin(), mCandidates.end(),
+		[](const Candidate& a, const Candidate& b) { return a.Distance < b.Distance; });
+
+	for(const Candidate& candidate : mCandidates)
+	{
+		if(mInFlight >= mSettings.MaxLoadsInFlight || mCells.size() >= mSettings.MaxCells)
+			break;
+
+		Cell cell;
+		cell.X = candidate.X;
+		cell.Z = candidate.Z;
+		cell.Request = ++mNextRequest;
+		const std::uint64_t key = Key(cell.X, cell.Z);
+		mCells[key] = cell;
+		++mLoadingCount;
+		++mInFlight;
+
+		const int x = cell.X;
+		const int z = cell.Z;
+		const UINT64 request = cell.Request;
+		mWorker->Submit([this, key, x, z, request]()
+		{
+			Arrival arrival;
+			arrival.Key = key;
+			arrival.Request = request;
+
+			// Arrives even when the loader throws, so the cell doesn't stay loading.
+			std::exception_ptr error = nullptr;
+			try
+			{
+				arrival.Data = mLoad(x, z);
+			}
+			catch(...)
+			{
+				error = std::current_exception();
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(mArrivalMutex);
+				mArrivals.push_back(std::move(arrival));
+			}
+
+			if(error != nullptr)
+				std::rethrow_exception(error);
+		});
+	}
+}
@@ -0,0 +1,123 @@
+//***************************************************************************************
+// WorldPartition.h
+//
+// Streams a world made of a grid of cells in and out around the camera.
+//   -Cells are keyed by their grid position.  Only the cells loading or loaded have
+//    an entry, so the bookkeeping grows with what is resident, not with the world.
+//   -Cell (x, z) is centred on (x * CellWidth, z * CellDepth) in the XZ plane, and
+//    a cell's distance is from the eye to the nearest point of its rectangle.
+//   -Update() unloads the cells farther than UnloadRadius, then starts loading the
+//    nearest unloaded cells within LoadRadius, no more than MaxLoadsInFlight at a
+//    time and MaxCells in all.  The gap between the radii keeps a cell on the edge
+//    from loading and unloading every other frame.
+//   -The loader runs on a worker thread and returns the cell's content; Update()
+//    hands it to onLoaded on the calling thread, MaxCommitsPerUpdate at a time.  A
+//    cell unloaded while it loads has its content dropped when it arrives.
+//***************************************************************************************
+
+#pragma once
+
+#include "d3dUtil.h"
+#include "ThreadPool.h"
+
+class WorldPartition
+{
+public:
+	// What the loader builds for a cell; derive the content type from it.
+	struct CellData
+	{
+		virtual ~CellData() = default;
+	};
+
+	struct Settings
+	{
+		float CellWidth = 100.0f;
+		float CellDepth = 100.0f;
+
+		// Inclusive range of cells the world has.
+		int MinX = 0;
+		int MinZ = 0;
+		int MaxX = 0;
+		int MaxZ = 0;
+
+		float LoadRadius = 250.0f;
+		float UnloadRadius = 350.0f;
+		UINT MaxCells = 16;
+		UINT MaxLoadsInFlight = 2;
+		UINT MaxCommitsPerUpdate = 1;
+	};
+
+	// Both run on the worker thread; the loader may throw.
+	typedef std::function<std::unique_ptr<CellData>(int x, int z)> LoadFunction;
+
+	typedef std::function<void(int x, int z, std::unique_ptr<CellData> data)> LoadedCallback;
+	typedef std::function<void(int x, int z)> UnloadCallback;
+
+	WorldPartition(const Settings& settings, LoadFunction load);
+	WorldPartition(const WorldPartition& rhs) = delete;
+	WorldPartition& operator=(const WorldPartition& rhs) = delete;
+	~WorldPartition() = default;
+
+	// Once per frame.  waitForLoads blocks until the loads started so far (including
+	// this call's) arrive and commits all of them, e.g. before the first frame.
+	// Rethrows what a loader threw.
+	void Update(const DirectX::XMFLOAT3& eye, const LoadedCallback& onLoaded, const UnloadCallback& onUnload,
+		bool waitForLoads = false);
+
+	DirectX::XMFLOAT3 CellCenter(int x, int z)const;
+
+	const Settings& GetSettings()const;
+	UINT LoadedCount()const;
+	UINT LoadingCount()const;
+
+private:
+	enum class CellState { Loading, Loaded };
+
+	struct Cell
+	{
+		int X = 0;
+		int Z = 0;
+		CellState State = CellState::Loading;
+
+		// Tells a load that arrives for an earlier request of the cell from the current one.
+		UINT64 Request = 0;
+	};
+
+	struct Arrival
+	{
+		std::uint64_t Key = 0;
+		UINT64 Request = 0;
+		std::unique_ptr<CellData> Data;
+	};
+
+	static std::uint64_t Key(int x, int z);
+	float Distance(const DirectX::XMFLOAT3& eye, int x, int z)const;
+
+	void Commit(const LoadedCallback& onLoaded, size_t maxCommits);
+	void StartLoads(const DirectX::XMFLOAT3& eye);
+
+private:
+	Settings mSettings;
+	LoadFunction mLoad;
+
+	std::unordered_map<std::uint64_t, Cell> mCells;
+	UINT mLoadingCount = 0;
+	UINT mInFlight = 0;
+	UINT64 mNextRequest = 0;
+
+	// Render thread only; reused so the search allocates nothing once it has grown.
+	struct Candidate
+	{
+		float Distance = 0.0f;
+		int X = 0;
+		int Z = 0;
+	};
+	std::vector<Candidate> mCandidates;
+
+	std::mutex mArrivalMutex;
+	std::vector<Arrival> mArrivals;
+	std::vector<Arrival> mCommitScratch;
+
+	// Declared last so the worker is joined before anything it uses is destroyed.
+	std::unique_ptr<ThreadPool> mWorker;
+};
@@ -4,6 +4,7 @@
 
 #include "d3dApp.h"
 #include <WindowsX.h>
+#include <dxgi1_5.h>
 
 using Microsoft::WRL::ComPtr;
 using namespace std;
@@ -63,12 +64,32 @@ void D3DApp::Set4xMsaaState(bool value)
     {
         m4xMsaaState = value;
 
-        //! Recreate the swapchain and buffers with new multisample settings.
-        CreateSwapChain();
+        //! The swap chain stays single-sampled; only the MSAA target and the depth
+        //! buffer change, so recreating the buffers is enough.
         OnResize();
     }
 }
 
+PresentMode D3DApp::GetPresentMode()const
+{
+	return mPresentMode;
+}
+
+void D3DApp::SetPresentMode(PresentMode mode)
+{
+	// The swap chain is created allowing tearing whenever it is supported, so
+	// switching is only a matter of the arguments to Present.
+	if(mode == PresentMode::Tearing && !mTearingSupported)
+		mode = PresentMode::Immediate;
+
+	mPresentMode = mode;
+}
+
+bool D3DApp::IsTearingSupported()const
+{
+	return mTearingSupported;
+}
+
 int D3DApp::Run()
 {
 	MSG msg = {0};
@@ -121,7 +142,7 @@ bool D3DApp::Initialize()
 void D3DApp::CreateRtvAndDsvDescriptorHeaps()
 {
     D3D12_DESCRIPTOR_HEAP_DESC rtvHeapDesc;
-    rtvHeapDesc.NumDescriptors = SwapChainBufferCount;
+    rtvHeapDesc.NumDescriptors = SwapChainBufferCount + 1;
     rtvHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_RTV;
     rtvHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
 	rtvHeapDesc.NodeMask = 0;
@@ -153,13 +174,14 @@ void D3DApp::OnResize()
 	for (int i = 0; i < SwapChainBufferCount; ++i)
 		mSwapChainBuffer[i].Reset();
     mDepthStencilBuffer.Reset();
+    mMsaaRenderTarget.Reset();
 	
 	//! Resize the swap chain.
     ThrowIfFailed(mSwapChain->ResizeBuffers(
 		SwapChainBufferCount, 
 		mClientWidth, mClientHeight, 
 		mBackBufferFormat, 
-		DXGI_SWAP_CHAIN_FLAG_ALLOW_MODE_SWITCH));
+		mSwapChainFlags));
 
 	mCurrBackBuffer = 0;
  
@@ -171,6 +193,24 @@ void D3DApp::OnResize()
 		rtvHeapHandle.Offset(1, mRtvDescriptorSize);
 	}
 
+	//! Flip model swap chains can't be multisampled, so with 4X MSAA the scene is drawn
+	//! into a target of its own and resolved into the back buffer.  There is no
+	//! optimized clear value; the application picks the clear colour.
+	if (m4xMsaaState)
+	{
+		D3D12_RESOURCE_DESC msaaDesc = CD3DX12_RESOURCE_DESC::Tex2D(mBackBufferFormat,
+			mClientWidth, mClientHeight, 1, 1, 4, m4xMsaaQuality - 1,
+			D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET);
+		ThrowIfFailed(md3dDevice->CreateCommittedResource(
+			&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+			D3D12_HEAP_FLAG_NONE,
+			&msaaDesc,
+			D3D12_RESOURCE_STATE_RENDER_TARGET,
+			nullptr,
+			IID_PPV_ARGS(mMsaaRenderTarget.GetAddressOf())));
+		md3dDevice->CreateRenderTargetView(mMsaaRenderTarget.Get(), nullptr, MsaaRenderTargetView());
+	}
+
     //! Create the depth/stencil buffer and view.
     D3D12_RESOURCE_DESC depthStencilDesc;
     depthStencilDesc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
@@ -181,10 +221,11 @@ void D3DApp::OnResize()
     depthStencilDesc.MipLevels = 1;
 
 	//! the depth buffer.  Therefore, because we need to create two views to the same resource:
-	//!   1. SRV format: DXGI_FORMAT_R24_UNORM_X8_TYPELESS
+	//!   1. SRV format: DXGI_FORMAT_R24_UNORM_X8_TYPELESS (R32_FLOAT for D32_FLOAT)
 	//!   2. DSV Format: DXGI_FORMAT_D24_UNORM_S8_UINT
 	//! we need to create the depth buffer resource with a typeless format.  
-	depthStencilDesc.Format = DXGI_FORMAT_R24G8_TYPELESS;
+	depthStencilDesc.Format = (mDepthStencilFormat == DXGI_FORMAT_D32_FLOAT) ?
+		DXGI_FORMAT_R32_TYPELESS : DXGI_FORMAT_R24G8_TYPELESS;
 
     depthStencilDesc.SampleDesc.Count = m4xMsaaState ? 4 : 1;
     depthStencilDesc.SampleDesc.Quality = m4xMsaaState ? (m4xMsaaQuality - 1) : 0;
@@ -193,7 +234,7 @@ void D3DApp::OnResize()
 
     D3D12_CLEAR_VALUE optClear;
     optClear.Format = mDepthStencilFormat;
-    optClear.DepthStencil.Depth = 1.0f;
+    optClear.DepthStencil.Depth = DepthClearValue();
     optClear.DepthStencil.Stencil = 0;
     ThrowIfFailed(md3dDevice->CreateCommittedResource(
         &CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
@@ -242,7 +283,7 @@ LRESULT D3DApp::MsgProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
 	//! We pause the game when the window is deactivated and unpause it 
 	//! when it becomes active.  
 	case WM_ACTIVATE:
-		if( LOWORD(wParam) == WA_INACTIVE )
+		if( LOWORD(wParam) == WA_INACTIVE && mPauseWhenInactive )
 		{
 			mAppPaused = true;
 			mTimer.Stop();
@@ -362,8 +403,6 @@ LRESULT D3DApp::MsgProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
         {
             PostQuitMessage(0);
         }
-        else if((int)wParam == VK_F2)
-            Set4xMsaaState(!m4xMsaaState);
 
         return 0;
 	}
@@ -433,6 +472,20 @@ bool D3DApp::InitDirect3D()
      //! (resolution, refresh rate, and such); it also defines the various supported surface formats(DXGI_FORMAT).
 	ThrowIfFailed(CreateDXGIFactory1(IID_PPV_ARGS(&mdxgiFactory)));
 
+	//! Tearing needs a flip-model swap chain created with ALLOW_TEARING, and both
+	//! DXGI 1.5 and the display driver to support it.
+	ComPtr<IDXGIFactory5> factory5;
+	if(SUCCEEDED(mdxgiFactory.As(&factory5)))
+	{
+		BOOL allowTearing = FALSE;
+		if(SUCCEEDED(factory5->CheckFeatureSupport(DXGI_FEATURE_PRESENT_ALLOW_TEARING, &allowTearing, sizeof(allowTearing))))
+			mTearingSupported = allowTearing != FALSE;
+	}
+
+	if(mTearingSupported)
+		mSwapChainFlags |= DXGI_SWAP_CHAIN_FLAG_ALLOW_TEARING;
+	SetPresentMode(mPresentMode);
+
 	UINT i = 0;
 	IDXGIAdapter* adapter = nullptr;
 	//! I added this code to take advantage of your "stronger" GPU. 
@@ -462,9 +515,15 @@ bool D3DApp::InitDirect3D()
 			IID_PPV_ARGS(&md3dDevice)));
 	}
 
+	//! The adapter the device ended up on, for its video memory budget.  Stays null
+	//! if it can't be found; the app then runs without a budget.
+	mdxgiFactory->EnumAdapterByLuid(md3dDevice->GetAdapterLuid(), IID_PPV_ARGS(&mAdapter));
+
 	ThrowIfFailed(md3dDevice->CreateFence(0, D3D12_FENCE_FLAG_NONE,
 		IID_PPV_ARGS(&mFence)));
 
+	mFramePacer = std::make_unique<FramePacer>(mFence.Get(), mMaxFramesInFlight);
+
 	mRtvDescriptorSize = md3dDevice->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_RTV);
 	mDsvDescriptorSize = md3dDevice->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_DSV);
 	mCbvSrvUavDescriptorSize = md3dDevice->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
@@ -536,20 +595,23 @@ void D3DApp::CreateSwapChain()
     sd.BufferDesc.Format = mBackBufferFormat;
     sd.BufferDesc.ScanlineOrdering = DXGI_MODE_SCANLINE_ORDER_UNSPECIFIED;
     sd.BufferDesc.Scaling = DXGI_MODE_SCALING_UNSPECIFIED;
-    sd.SampleDesc.Count = m4xMsaaState ? 4 : 1;
-    sd.SampleDesc.Quality = m4xMsaaState ? (m4xMsaaQuality - 1) : 0;
+    //! DXGI_SWAP_EFFECT_FLIP_DISCARD needs single-sampled buffers; see mMsaaRenderTarget.
+    sd.SampleDesc.Count = 1;
+    sd.SampleDesc.Quality = 0;
     sd.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
     sd.BufferCount = SwapChainBufferCount;
     sd.OutputWindow = mhMainWnd;
     sd.Windowed = true;
 	sd.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD;
-    sd.Flags = DXGI_SWAP_CHAIN_FLAG_ALLOW_MODE_SWITCH;
+    sd.Flags = mSwapChainFlags;
 
 	// Note: Swap chain uses queue to perform flush.
     ThrowIfFailed(mdxgiFactory->CreateSwapChain(
 		mCommandQueue.Get(),
 		&sd, 
 		mSwapChain.GetAddressOf()));
+
+	mFramePacer->SetSwapChain(mSwapChain.Get());
 }
 
 void D3DApp::FlushCommandQueue()
@@ -563,17 +625,25 @@ void D3DApp::FlushCommandQueue()
     ThrowIfFailed(mCommandQueue->Signal(mFence.Get(), mCurrentFence));
 
 	//! Wait until the GPU has completed commands up to this fence point.
-    if(mFence->GetCompletedValue() < mCurrentFence)
-	{
-		HANDLE eventHandle = CreateEventEx(nullptr, nullptr, false, EVENT_ALL_ACCESS);
+    mFramePacer->WaitForFence(mCurrentFence);
+}
 
-        //! Fire event when GPU hits current fence.  
-        ThrowIfFailed(mFence->SetEventOnCompletion(mCurrentFence, eventHandle));
+void D3DApp::PresentFrame()
+{
+	UINT syncInterval = (mPresentMode == PresentMode::Vsync) ? 1 : 0;
+	UINT flags = 0;
 
-        //! Wait until the GPU hits current fence event is fired.
-		WaitForSingleObject(eventHandle, INFINITE);
-        CloseHandle(eventHandle);
+	//! Tearing is only allowed in windowed mode; in exclusive fullscreen the flip is
+	//! already immediate with a sync interval of 0.
+	if(mPresentMode == PresentMode::Tearing)
+	{
+		BOOL fullscreen = FALSE;
+		ThrowIfFailed(mSwapChain->GetFullscreenState(&fullscreen, nullptr));
+		if(!fullscreen)
+			flags |= DXGI_PRESENT_ALLOW_TEARING;
 	}
+
+	ThrowIfFailed(mSwapChain->Present(syncInterval, flags));
 }
 
 
@@ -591,11 +661,29 @@ D3D12_CPU_DESCRIPTOR_HANDLE D3DApp::CurrentBackBufferView()const
 		mRtvDescriptorSize);
 }
 
+ID3D12Resource* D3DApp::MsaaRenderTarget()const
+{
+	return mMsaaRenderTarget.Get();
+}
+
+D3D12_CPU_DESCRIPTOR_HANDLE D3DApp::MsaaRenderTargetView()const
+{
+	return CD3DX12_CPU_DESCRIPTOR_HANDLE(
+		mRtvHeap->GetCPUDescriptorHandleForHeapStart(),
+		SwapChainBufferCount,
+		mRtvDescriptorSize);
+}
+
 D3D12_CPU_DESCRIPTOR_HANDLE D3DApp::DepthStencilView()const
 {
 	return mDsvHeap->GetCPUDescriptorHandleForHeapStart();
 }
 
+float D3DApp::DepthClearValue()const
+{
+	return mReverseZ ? 0.0f : 1.0f;
+}
+
 void D3DApp::CalculateFrameStats()
 {
 	// Code computes the average frames per second, and also the 
@@ -9,6 +9,7 @@
 
 #include "d3dUtil.h"
 #include "GameTimer.h"
+#include "FramePacer.h"
 
 // Link necessary d3d12 libraries.
 #pragma comment(lib,"d3dcompiler.lib")
@@ -35,6 +36,12 @@ public:
     bool Get4xMsaaState()const;
     void Set4xMsaaState(bool value);
 
+	// Takes effect from the next PresentFrame().  Tearing falls back to Immediate when
+	// the display or driver does not support it.
+	PresentMode GetPresentMode()const;
+	void SetPresentMode(PresentMode mode);
+	bool IsTearingSupported()const;
+
 	int Run();
  
     virtual bool Initialize();
@@ -60,9 +67,17 @@ protected:
 
 	void FlushCommandQueue();
 
+	// Presents the back buffer in the current present mode.
+	void PresentFrame();
+
 	ID3D12Resource* CurrentBackBuffer()const;
 	D3D12_CPU_DESCRIPTOR_HANDLE CurrentBackBufferView()const;
 	D3D12_CPU_DESCRIPTOR_HANDLE DepthStencilView()const;
+	float DepthClearValue()const;
+
+	// Only while 4X MSAA is on; resolve it into CurrentBackBuffer() before presenting.
+	ID3D12Resource* MsaaRenderTarget()const;
+	D3D12_CPU_DESCRIPTOR_HANDLE MsaaRenderTargetView()const;
 
 	void CalculateFrameStats();
 
@@ -80,9 +95,13 @@ protected:
 	bool      mMinimized = false;  // is the application minimized?
 	bool      mMaximized = false;  // is the application maximized?
 	bool      mResizing = false;   // are the resize bars being dragged?
+	bool      mPauseWhenInactive = true; // pause when the window loses focus?
     bool      mFullscreenState = false;// fullscreen enabled
+	bool      mTearingSupported = false;   // DXGI_FEATURE_PRESENT_ALLOW_TEARING
+	PresentMode mPresentMode = PresentMode::Immediate;
 
-	// Set true to use 4X MSAA.  The default is false.
+	// Set true to use 4X MSAA.  The default is false.  The depth buffer and
+	// mMsaaRenderTarget follow it; the swap chain is always single-sampled.
     bool      m4xMsaaState = false;    // 4X MSAA enabled
     UINT      m4xMsaaQuality = 0;      // quality level of 4X MSAA
 
@@ -92,9 +111,13 @@ protected:
     Microsoft::WRL::ComPtr<IDXGIFactory4> mdxgiFactory;
     Microsoft::WRL::ComPtr<IDXGISwapChain> mSwapChain;
     Microsoft::WRL::ComPtr<ID3D12Device> md3dDevice;
+	Microsoft::WRL::ComPtr<IDXGIAdapter3> mAdapter; // the device's, for QueryVideoMemoryInfo
 
     Microsoft::WRL::ComPtr<ID3D12Fence> mFence;
     UINT64 mCurrentFence = 0;
+
+	// Owns the one event every fence wait reuses.  Created with mMaxFramesInFlight.
+	std::unique_ptr<FramePacer> mFramePacer;
 	
     Microsoft::WRL::ComPtr<ID3D12CommandQueue> mCommandQueue;
     Microsoft::WRL::ComPtr<ID3D12CommandAllocator> mDirectCmdListAlloc;
@@ -104,6 +127,7 @@ protected:
 	int mCurrBackBuffer = 0;
     Microsoft::WRL::ComPtr<ID3D12Resource> mSwapChainBuffer[SwapChainBufferCount];
     Microsoft::WRL::ComPtr<ID3D12Resource> mDepthStencilBuffer;
+    Microsoft::WRL::ComPtr<ID3D12Resource> mMsaaRenderTarget;
 
     Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> mRtvHeap;
     Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> mDsvHeap;
@@ -119,8 +143,13 @@ protected:
 	std::wstring mMainWndCaption = L"d3d App";
 	D3D_DRIVER_TYPE md3dDriverType = D3D_DRIVER_TYPE_HARDWARE;
     DXGI_FORMAT mBackBufferFormat = DXGI_FORMAT_R8G8B8A8_UNORM;
-    DXGI_FORMAT mDepthStencilFormat = DXGI_FORMAT_D24_UNORM_S8_UINT;
+    DXGI_FORMAT mDepthStencilFormat = DXGI_FORMAT_D24_UNORM_S8_UINT; // or D32_FLOAT
+	bool mReverseZ = false; // the depth buffer clears to 0 instead of 1
 	int mClientWidth = 800;
 	int mClientHeight = 600;
+
+	// Should match the derived class's frame resource count.
+	UINT mMaxFramesInFlight = 3;
+	UINT mSwapChainFlags = DXGI_SWAP_CHAIN_FLAG_ALLOW_MODE_SWITCH | DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT;
 };
 
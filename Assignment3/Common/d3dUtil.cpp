@@ -1,5 +1,7 @@
 
 #include "d3dUtil.h"
+#include "PlacedResourceAllocator.h"
+#include "UploadRingBuffer.h"
 #include <comdef.h>
 #include <fstream>
 
@@ -87,6 +89,34 @@ Microsoft::WRL::ComPtr<ID3D12Resource> d3dUtil::CreateDefaultBuffer(
     return defaultBuffer;
 }
 
+Microsoft::WRL::ComPtr<ID3D12Resource> d3dUtil::CreateDefaultBuffer(
+    ID3D12Device* device,
+    ID3D12GraphicsCommandList* cmdList,
+    const void* initData,
+    UINT64 byteSize,
+    PlacedResourceAllocator& allocator,
+    UploadRingBuffer& stagingRing)
+{
+    ComPtr<ID3D12Resource> defaultBuffer;
+
+    ThrowIfFailed(allocator.CreateResource(
+        CD3DX12_RESOURCE_DESC::Buffer(byteSize),
+        D3D12_RESOURCE_STATE_COMMON,
+        defaultBuffer));
+
+    // Stage the data in the shared upload ring rather than a dedicated upload heap.
+    UploadRingBuffer::Allocation staging = stagingRing.Allocate(byteSize);
+    memcpy(staging.CpuAddress, initData, (size_t)byteSize);
+
+	cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(defaultBuffer.Get(), 
+		D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_COPY_DEST));
+    cmdList->CopyBufferRegion(defaultBuffer.Get(), 0, staging.Resource, staging.Offset, byteSize);
+	cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(defaultBuffer.Get(),
+		D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_GENERIC_READ));
+
+    return defaultBuffer;
+}
+
 ComPtr<ID3DBlob> d3dUtil::CompileShader(
 	const std::wstring& filename,
 	const D3D_SHADER_MACRO* defines,
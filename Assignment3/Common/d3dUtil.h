@@ -27,6 +27,9 @@
 
 extern const int gNumFrameResources;
 
+class PlacedResourceAllocator;
+class UploadRingBuffer;
+
 inline void d3dSetDebugName(IDXGIObject* obj, const char* name)
 {
 	if (obj)
@@ -108,6 +111,20 @@ public:
 		return (byteSize + 255) & ~255;
 	}
 
+	// 64-bit FNV-1a, for content keys.  Pass the previous result as seed to hash
+	// several pieces as one.
+	static std::uint64_t HashBytes(const void* data, size_t byteSize, std::uint64_t seed = 14695981039346656037ull)
+	{
+		const std::uint8_t* bytes = static_cast<const std::uint8_t*>(data);
+		std::uint64_t hash = seed;
+		for(size_t i = 0; i < byteSize; ++i)
+		{
+			hash ^= bytes[i];
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
 	static Microsoft::WRL::ComPtr<ID3DBlob> LoadBinary(const std::wstring& filename);
 
 	static Microsoft::WRL::ComPtr<ID3D12Resource> CreateDefaultBuffer(
@@ -117,6 +134,16 @@ public:
 		UINT64 byteSize,
 		Microsoft::WRL::ComPtr<ID3D12Resource>& uploadBuffer);
 
+	// Same, but places the buffer in one of the allocator's heaps and stages the
+	// data through the ring.  The ring space is in use until the command list executes.
+	static Microsoft::WRL::ComPtr<ID3D12Resource> CreateDefaultBuffer(
+		ID3D12Device* device,
+		ID3D12GraphicsCommandList* cmdList,
+		const void* initData,
+		UINT64 byteSize,
+		PlacedResourceAllocator& allocator,
+		UploadRingBuffer& stagingRing);
+
 	static Microsoft::WRL::ComPtr<ID3DBlob> CompileShader(
 		const std::wstring& filename,
 		const D3D_SHADER_MACRO* defines,
@@ -138,6 +165,28 @@ public:
 	int LineNumber = -1;
 };
 
+// How D3DApp presents.  Vsync waits for vertical blank; Immediate flips at the next
+// opportunity the compositor allows; Tearing flips right away, which also lets a VRR
+// display follow the frame rate, and needs the swap chain to allow it.
+enum class PresentMode
+{
+	Vsync = 0,
+	Immediate,
+	Tearing,
+	Count
+};
+
+// How the scene is anti-aliased.  Msaa4x renders into a 4X multisampled target that
+// is resolved into the back buffer; Fxaa filters a single-sampled target in a
+// compute pass, which costs far less GPU time but blurs some texture detail.
+enum class AntiAliasing
+{
+	None = 0,
+	Msaa4x,
+	Fxaa,
+	Count
+};
+
 // Defines a subrange of geometry in a MeshGeometry.  This is for when multiple
 // geometries are stored in one vertex and index buffer.  It provides the offsets
 // and data needed to draw a subset of geometry stores in the vertex and index 
@@ -151,6 +200,10 @@ struct SubmeshGeometry
 	// Bounding box of the geometry defined by this submesh. 
 	// This is used in later chapters of the book.
 	DirectX::BoundingBox Bounds;
+
+	// The submesh's meshlets, if its geometry was cut into any.
+	UINT FirstMeshlet = 0;
+	UINT MeshletCount = 0;
 };
 
 struct MeshGeometry
@@ -159,24 +212,16 @@ struct MeshGeometry
 	// Give it a name so we can look it up by name.
 	std::string Name;
 
-	// System memory copies.  Use Blobs because the vertex/index format can be generic.
-	// It is up to the client to cast appropriately. 
-
-	Microsoft::WRL::ComPtr<ID3DBlob> VertexBufferCPU = nullptr;
-	Microsoft::WRL::ComPtr<ID3DBlob> IndexBufferCPU = nullptr;
-	Microsoft::WRL::ComPtr<ID3DBlob> ColorBufferCPU = nullptr;
-
+	// The GPU copies only.  CreateDefaultBuffer() stages through an UploadRingBuffer,
+	// so there are no uploaders to hold, and nothing reads the geometry back on the
+	// CPU; collision works on the render items' bounds.
 
 	Microsoft::WRL::ComPtr<ID3D12Resource> VertexBufferGPU = nullptr;
 	Microsoft::WRL::ComPtr<ID3D12Resource> IndexBufferGPU = nullptr;
 	Microsoft::WRL::ComPtr<ID3D12Resource> ColorBufferGPU = nullptr;
 
-
-	Microsoft::WRL::ComPtr<ID3D12Resource> VertexBufferUploader = nullptr;
-	Microsoft::WRL::ComPtr<ID3D12Resource> IndexBufferUploader = nullptr;
-	Microsoft::WRL::ComPtr<ID3D12Resource> ColorBufferUploader = nullptr;
-
-
+	// A second stream of lightmap texture coordinates, a vertex each, or null.
+	Microsoft::WRL::ComPtr<ID3D12Resource> LightmapUVBufferGPU = nullptr;
 
 	// Data about the buffers.
 	UINT VertexByteStride = 0;
@@ -185,6 +230,8 @@ struct MeshGeometry
 	UINT IndexBufferByteSize = 0;
 	UINT ColorByteStride = 0;
 	UINT ColorBufferByteSize = 0;
+	UINT LightmapUVByteStride = 0;
+	UINT LightmapUVBufferByteSize = 0;
 
 
 	// A MeshGeometry may store multiple geometries in one vertex/index buffer.
@@ -226,13 +273,15 @@ struct MeshGeometry
 		return cbv;
 	}
 
+	D3D12_VERTEX_BUFFER_VIEW LightmapUVBufferView()const
 
-	// We can free this memory after we finish upload to the GPU.
-	void DisposeUploaders()
 	{
-		VertexBufferUploader = nullptr;
-		IndexBufferUploader = nullptr;
-		ColorBufferUploader = nullptr;
+		D3D12_VERTEX_BUFFER_VIEW vbv;
+		vbv.BufferLocation = LightmapUVBufferGPU->GetGPUVirtualAddress();
+		vbv.StrideInBytes = LightmapUVByteStride;
+		vbv.SizeInBytes = LightmapUVBufferByteSize;
+
+		return vbv;
 	}
 };
 
@@ -278,11 +327,8 @@ struct Material
 	// Index into SRV heap for normal texture.
 	int NormalSrvHeapIndex = -1;
 
-	// Dirty flag indicating the material has changed and we need to update the constant buffer.
-	// Because we have a material constant buffer for each FrameResource, we have to apply the
-	// update to each FrameResource.  Thus, when we modify a material we should set 
-	// NumFramesDirty = gNumFrameResources so that each frame resource gets the update.
-	int NumFramesDirty = gNumFrameResources;
+	// Shader options, e.g. MaterialFlagWaves.
+	UINT Flags = 0;
 
 	// Material constant buffer data used for shading.
 	DirectX::XMFLOAT4 DiffuseAlbedo = { 1.0f, 1.0f, 1.0f, 1.0f };
@@ -298,8 +344,8 @@ struct Texture
 
 	std::wstring Filename;
 
+	// Texels are staged in an UploadRingBuffer, so there is no upload heap to keep.
 	Microsoft::WRL::ComPtr<ID3D12Resource> Resource = nullptr;
-	Microsoft::WRL::ComPtr<ID3D12Resource> UploadHeap = nullptr;
 };
 
 #ifndef ThrowIfFailed
@@ -1055,6 +1055,277 @@ struct CD3DX12_ROOT_SIGNATURE_DESC : public D3D12_ROOT_SIGNATURE_DESC
     }
 };
 
+//------------------------------------------------------------------------------------------------
+struct CD3DX12_DESCRIPTOR_RANGE1 : public D3D12_DESCRIPTOR_RANGE1
+{
+    CD3DX12_DESCRIPTOR_RANGE1() { }
+    explicit CD3DX12_DESCRIPTOR_RANGE1(const D3D12_DESCRIPTOR_RANGE1 &o) :
+        D3D12_DESCRIPTOR_RANGE1(o)
+    {}
+    CD3DX12_DESCRIPTOR_RANGE1(
+        D3D12_DESCRIPTOR_RANGE_TYPE rangeType,
+        UINT numDescriptors,
+        UINT baseShaderRegister,
+        UINT registerSpace = 0,
+        D3D12_DESCRIPTOR_RANGE_FLAGS flags = D3D12_DESCRIPTOR_RANGE_FLAG_NONE,
+        UINT offsetInDescriptorsFromTableStart =
+        D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND)
+    {
+        Init(rangeType, numDescriptors, baseShaderRegister, registerSpace, flags, offsetInDescriptorsFromTableStart);
+    }
+    
+    inline void Init(
+        D3D12_DESCRIPTOR_RANGE_TYPE rangeType,
+        UINT numDescriptors,
+        UINT baseShaderRegister,
+        UINT registerSpace = 0,
+        D3D12_DESCRIPTOR_RANGE_FLAGS flags = D3D12_DESCRIPTOR_RANGE_FLAG_NONE,
+        UINT offsetInDescriptorsFromTableStart =
+        D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND)
+    {
+        Init(*this, rangeType, numDescriptors, baseShaderRegister, registerSpace, flags, offsetInDescriptorsFromTableStart);
+    }
+    
+    static inline void Init(
+        _Out_ D3D12_DESCRIPTOR_RANGE1 &range,
+        D3D12_DESCRIPTOR_RANGE_TYPE rangeType,
+        UINT numDescriptors,
+        UINT baseShaderRegister,
+        UINT registerSpace = 0,
+        D3D12_DESCRIPTOR_RANGE_FLAGS flags = D3D12_DESCRIPTOR_RANGE_FLAG_NONE,
+        UINT offsetInDescriptorsFromTableStart =
+        D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND)
+    {
+        range.RangeType = rangeType;
+        range.NumDescriptors = numDescriptors;
+        range.BaseShaderRegister = baseShaderRegister;
+        range.RegisterSpace = registerSpace;
+        range.Flags = flags;
+        range.OffsetInDescriptorsFromTableStart = offsetInDescriptorsFromTableStart;
+    }
+};
+
+//------------------------------------------------------------------------------------------------
+struct CD3DX12_ROOT_PARAMETER1 : public D3D12_ROOT_PARAMETER1
+{
+    CD3DX12_ROOT_PARAMETER1() {}
+    explicit CD3DX12_ROOT_PARAMETER1(const D3D12_ROOT_PARAMETER1 &o) :
+        D3D12_ROOT_PARAMETER1(o)
+    {}
+    
+    static inline void InitAsDescriptorTable(
+        _Out_ D3D12_ROOT_PARAMETER1 &rootParam,
+        UINT numDescriptorRanges,
+        _In_reads_(numDescriptorRanges) const D3D12_DESCRIPTOR_RANGE1* pDescriptorRanges,
+        D3D12_SHADER_VISIBILITY visibility = D3D12_SHADER_VISIBILITY_ALL)
+    {
+        rootParam.ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
+        rootParam.ShaderVisibility = visibility;
+        rootParam.DescriptorTable.NumDescriptorRanges = numDescriptorRanges;
+        rootParam.DescriptorTable.pDescriptorRanges = pDescriptorRanges;
+    }
+
+    static inline void InitAsConstants(
+        _Out_ D3D12_ROOT_PARAMETER1 &rootParam,
+        UINT num32BitValues,
+        UINT shaderRegister,
+        UINT registerSpace = 0,
+        D3D12_SHADER_VISIBILITY visibility = D3D12_SHADER_VISIBILITY_ALL)
+    {
+        rootParam.ParameterType = D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS;
+        rootParam.ShaderVisibility = visibility;
+        CD3DX12_ROOT_CONSTANTS::Init(rootParam.Constants, num32BitValues, shaderRegister, registerSpace);
+    }
+
+    static inline void InitAsRootDescriptor(
+        _Out_ D3D12_ROOT_PARAMETER1 &rootParam,
+        D3D12_ROOT_PARAMETER_TYPE type,
+        UINT shaderRegister,
+        UINT registerSpace,
+        D3D12_ROOT_DESCRIPTOR_FLAGS flags,
+        D3D12_SHADER_VISIBILITY visibility)
+    {
+        rootParam.ParameterType = type;
+        rootParam.ShaderVisibility = visibility;
+        rootParam.Descriptor.ShaderRegister = shaderRegister;
+        rootParam.Descriptor.RegisterSpace = registerSpace;
+        rootParam.Descriptor.Flags = flags;
+    }
+    
+    inline void InitAsDescriptorTable(
+        UINT numDescriptorRanges,
+        _In_reads_(numDescriptorRanges) const D3D12_DESCRIPTOR_RANGE1* pDescriptorRanges,
+        D3D12_SHADER_VISIBILITY visibility = D3D12_SHADER_VISIBILITY_ALL)
+    {
+        InitAsDescriptorTable(*this, numDescriptorRanges, pDescriptorRanges, visibility);
+    }
+    
+    inline void InitAsConstants(
+        UINT num32BitValues,
+        UINT shaderRegister,
+        UINT registerSpace = 0,
+        D3D12_SHADER_VISIBILITY visibility = D3D12_SHADER_VISIBILITY_ALL)
+    {
+        InitAsConstants(*this, num32BitValues, shaderRegister, registerSpace, visibility);
+    }
+
+    inline void InitAsConstantBufferView(
+        UINT shaderRegister,
+        UINT registerSpace = 0,
+        D3D12_ROOT_DESCRIPTOR_FLAGS flags = D3D12_ROOT_DESCRIPTOR_FLAG_NONE,
+        D3D12_SHADER_VISIBILITY visibility = D3D12_SHADER_VISIBILITY_ALL)
+    {
+        InitAsRootDescriptor(*this, D3D12_ROOT_PARAMETER_TYPE_CBV, shaderRegister, registerSpace, flags, visibility);
+    }
+
+    inline void InitAsShaderResourceView(
+        UINT shaderRegister,
+        UINT registerSpace = 0,
+        D3D12_ROOT_DESCRIPTOR_FLAGS flags = D3D12_ROOT_DESCRIPTOR_FLAG_NONE,
+        D3D12_SHADER_VISIBILITY visibility = D3D12_SHADER_VISIBILITY_ALL)
+    {
+        InitAsRootDescriptor(*this, D3D12_ROOT_PARAMETER_TYPE_SRV, shaderRegister, registerSpace, flags, visibility);
+    }
+
+    inline void InitAsUnorderedAccessView(
+        UINT shaderRegister,
+        UINT registerSpace = 0,
+        D3D12_ROOT_DESCRIPTOR_FLAGS flags = D3D12_ROOT_DESCRIPTOR_FLAG_NONE,
+        D3D12_SHADER_VISIBILITY visibility = D3D12_SHADER_VISIBILITY_ALL)
+    {
+        InitAsRootDescriptor(*this, D3D12_ROOT_PARAMETER_TYPE_UAV, shaderRegister, registerSpace, flags, visibility);
+    }
+};
+
+//------------------------------------------------------------------------------------------------
+struct CD3DX12_VERSIONED_ROOT_SIGNATURE_DESC : public D3D12_VERSIONED_ROOT_SIGNATURE_DESC
+{
+    CD3DX12_VERSIONED_ROOT_SIGNATURE_DESC() {}
+    explicit CD3DX12_VERSIONED_ROOT_SIGNATURE_DESC(const D3D12_VERSIONED_ROOT_SIGNATURE_DESC &o) :
+        D3D12_VERSIONED_ROOT_SIGNATURE_DESC(o)
+    {}
+    CD3DX12_VERSIONED_ROOT_SIGNATURE_DESC(
+        UINT numParameters,
+        _In_reads_opt_(numParameters) const D3D12_ROOT_PARAMETER1* _pParameters,
+        UINT numStaticSamplers = 0,
+        _In_reads_opt_(numStaticSamplers) const D3D12_STATIC_SAMPLER_DESC* _pStaticSamplers = NULL,
+        D3D12_ROOT_SIGNATURE_FLAGS flags = D3D12_ROOT_SIGNATURE_FLAG_NONE)
+    {
+        Init_1_1(numParameters, _pParameters, numStaticSamplers, _pStaticSamplers, flags);
+    }
+
+    inline void Init_1_1(
+        UINT numParameters,
+        _In_reads_opt_(numParameters) const D3D12_ROOT_PARAMETER1* _pParameters,
+        UINT numStaticSamplers = 0,
+        _In_reads_opt_(numStaticSamplers) const D3D12_STATIC_SAMPLER_DESC* _pStaticSamplers = NULL,
+        D3D12_ROOT_SIGNATURE_FLAGS flags = D3D12_ROOT_SIGNATURE_FLAG_NONE)
+    {
+        Version = D3D_ROOT_SIGNATURE_VERSION_1_1;
+        Desc_1_1.NumParameters = numParameters;
+        Desc_1_1.pParameters = _pParameters;
+        Desc_1_1.NumStaticSamplers = numStaticSamplers;
+        Desc_1_1.pStaticSamplers = _pStaticSamplers;
+        Desc_1_1.Flags = flags;
+    }
+};
+
+//------------------------------------------------------------------------------------------------
+// Serializes a version 1.1 description as is when maxVersion allows it, and otherwise
+// as version 1.0 with the descriptor and range flags dropped.  maxVersion is the
+// HighestVersion reported for D3D12_FEATURE_ROOT_SIGNATURE.
+inline HRESULT D3DX12SerializeVersionedRootSignature(
+    _In_ const D3D12_VERSIONED_ROOT_SIGNATURE_DESC* pRootSignatureDesc,
+    D3D_ROOT_SIGNATURE_VERSION maxVersion,
+    _Outptr_ ID3DBlob** ppBlob,
+    _Always_(_Outptr_opt_result_maybenull_) ID3DBlob** ppErrorBlob)
+{
+    if (ppErrorBlob != NULL)
+    {
+        *ppErrorBlob = NULL;
+    }
+
+    if (pRootSignatureDesc->Version != D3D_ROOT_SIGNATURE_VERSION_1_1 || maxVersion == D3D_ROOT_SIGNATURE_VERSION_1_1)
+    {
+        return D3D12SerializeVersionedRootSignature(pRootSignatureDesc, ppBlob, ppErrorBlob);
+    }
+
+    const D3D12_ROOT_SIGNATURE_DESC1& desc_1_1 = pRootSignatureDesc->Desc_1_1;
+
+    UINT numRanges = 0;
+    for (UINT n = 0; n < desc_1_1.NumParameters; n++)
+    {
+        if (desc_1_1.pParameters[n].ParameterType == D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE)
+        {
+            numRanges += desc_1_1.pParameters[n].DescriptorTable.NumDescriptorRanges;
+        }
+    }
+
+    SIZE_T parametersSize = sizeof(D3D12_ROOT_PARAMETER) * desc_1_1.NumParameters;
+    SIZE_T rangesSize = sizeof(D3D12_DESCRIPTOR_RANGE) * numRanges;
+    void* pMemory = (parametersSize + rangesSize) > 0 ? HeapAlloc(GetProcessHeap(), 0, parametersSize + rangesSize) : NULL;
+    if ((parametersSize + rangesSize) > 0 && pMemory == NULL)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    D3D12_ROOT_PARAMETER* pParameters_1_0 = reinterpret_cast<D3D12_ROOT_PARAMETER*>(pMemory);
+    D3D12_DESCRIPTOR_RANGE* pRanges_1_0 = reinterpret_cast<D3D12_DESCRIPTOR_RANGE*>(reinterpret_cast<BYTE*>(pMemory) + parametersSize);
+
+    for (UINT n = 0; n < desc_1_1.NumParameters; n++)
+    {
+        const D3D12_ROOT_PARAMETER1& param_1_1 = desc_1_1.pParameters[n];
+        D3D12_ROOT_PARAMETER& param_1_0 = pParameters_1_0[n];
+        param_1_0.ParameterType = param_1_1.ParameterType;
+        param_1_0.ShaderVisibility = param_1_1.ShaderVisibility;
+
+        switch (param_1_1.ParameterType)
+        {
+        case D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS:
+            param_1_0.Constants = param_1_1.Constants;
+            break;
+
+        case D3D12_ROOT_PARAMETER_TYPE_CBV:
+        case D3D12_ROOT_PARAMETER_TYPE_SRV:
+        case D3D12_ROOT_PARAMETER_TYPE_UAV:
+            param_1_0.Descriptor.ShaderRegister = param_1_1.Descriptor.ShaderRegister;
+            param_1_0.Descriptor.RegisterSpace = param_1_1.Descriptor.RegisterSpace;
+            break;
+
+        case D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE:
+            param_1_0.DescriptorTable.NumDescriptorRanges = param_1_1.DescriptorTable.NumDescriptorRanges;
+            param_1_0.DescriptorTable.pDescriptorRanges = pRanges_1_0;
+            for (UINT x = 0; x < param_1_1.DescriptorTable.NumDescriptorRanges; x++)
+            {
+                const D3D12_DESCRIPTOR_RANGE1& range_1_1 = param_1_1.DescriptorTable.pDescriptorRanges[x];
+                pRanges_1_0->RangeType = range_1_1.RangeType;
+                pRanges_1_0->NumDescriptors = range_1_1.NumDescriptors;
+                pRanges_1_0->BaseShaderRegister = range_1_1.BaseShaderRegister;
+                pRanges_1_0->RegisterSpace = range_1_1.RegisterSpace;
+                pRanges_1_0->OffsetInDescriptorsFromTableStart = range_1_1.OffsetInDescriptorsFromTableStart;
+                pRanges_1_0++;
+            }
+            break;
+        }
+    }
+
+    D3D12_VERSIONED_ROOT_SIGNATURE_DESC desc_1_0 = {};
+    desc_1_0.Version = D3D_ROOT_SIGNATURE_VERSION_1_0;
+    desc_1_0.Desc_1_0.NumParameters = desc_1_1.NumParameters;
+    desc_1_0.Desc_1_0.pParameters = pParameters_1_0;
+    desc_1_0.Desc_1_0.NumStaticSamplers = desc_1_1.NumStaticSamplers;
+    desc_1_0.Desc_1_0.pStaticSamplers = desc_1_1.pStaticSamplers;
+    desc_1_0.Desc_1_0.Flags = desc_1_1.Flags;
+
+    HRESULT hr = D3D12SerializeVersionedRootSignature(&desc_1_0, ppBlob, ppErrorBlob);
+
+    if (pMemory)
+    {
+        HeapFree(GetProcessHeap(), 0, pMemory);
+    }
+    return hr;
+}
+
 //------------------------------------------------------------------------------------------------
 struct CD3DX12_CPU_DESCRIPTOR_HANDLE : public D3D12_CPU_DESCRIPTOR_HANDLE
 {